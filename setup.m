@@ -32,9 +32,12 @@ if nargin == 1
 end
 
 % List of mex functions that need to be compiled
-mexnames = {'osx_joystick_get_available','osx_joystick_get_capabilities','sfun_osx_joystick'};
+mexnames = {'osx_joystick_get_available','osx_joystick_get_capabilities','osx_joystick_stats','sfun_osx_joystick'};
+% Extra libraries each mex function links against. The s-function registers
+% fixed-point data types, which live in libfixedpoint.
+mexlibs = {{},{},{},{'-lfixedpoint'}};
 % Other files that need to be linked to the mex files
-libnames = {'osx_joystick.cpp','axes.cpp','button.cpp','pov.cpp','outputs.cpp'};
+libnames = {'osx_joystick.cpp','axes.cpp','button.cpp','pov.cpp','outputs.cpp','snapshot.cpp','buttonmask.cpp','axistable.cpp','axispipeline.cpp','hidreport.cpp','hidoutput.cpp','joyregistry.cpp','hidhotplug.cpp','joysession.cpp','joygroup.cpp','joyeffects.cpp','samplering.cpp','joytime.cpp','joystats.cpp','joycapture.cpp','joyshm.cpp'};
 
 % Loop through and compile the files if needed. Then copy them to the
 % ../bin/ directory if needed.
@@ -44,7 +47,7 @@ try
   for ii=1:length(mexnames)
     if ~exist( ['./',mexnames{ii},'.',mexext()], 'file' )
       mex('-v','LDFLAGS=\$LDFLAGS -framework IOKit -framework CoreFoundation',...
-        [mexnames{ii},'.cpp'],libnames{:});
+        [mexnames{ii},'.cpp'],libnames{:},mexlibs{ii}{:});
       copyfile( [mexnames{ii},'.',mexext()], '../bin/', 'f' );
     elseif ~exist( ['../bin/',mexnames{ii},'.',mexext()], 'file' )
       copyfile( [mexnames{ii},'.',mexext()], '../bin/', 'f' );
@@ -43,8 +43,27 @@ Axes::Axes( IOHIDDeviceRef device, IOHIDElementRef element )
   // Get the (logical) max and min of the element
   logmax = IOHIDElementGetLogicalMax( myElement );
   logmin = IOHIDElementGetLogicalMin( myElement );
-  // Is it relative?
+  // Is it relative? Relative values are accumulated from zero.
   isRelative = IOHIDElementIsRelative( myElement );
+  lastVal = 0.0;
+}
+
+/**
+ * \brief Initialise an Axes object with no device, such as one replayed from a
+ *  capture. Only its range is known, so it must not be read.
+ *
+ * \param[in] logicalMin Logical minimum of the axis.
+ * \param[in] logicalMax Logical maximum of the axis.
+ * \param[in] relative Whether the axis is relative.
+ */
+Axes::Axes( long logicalMin, long logicalMax, bool relative )
+{
+  myDevice = NULL;
+  myElement = NULL;
+  logmax = (double)logicalMax;
+  logmin = (double)logicalMin;
+  lastVal = 0.0;
+  isRelative = relative;
 }
 
 /**
@@ -60,23 +79,55 @@ Axes::~Axes(){}
  * \exception const char* exception thrown if the value cannot be read.
  */
 double Axes::ReadState( void )
+{
+  return Decode( ReadRaw() );
+}
+
+/**
+ * \brief Read the raw (integer) value of the axis from the device.
+ *
+ * \param[out] timeStamp If not NULL, receives the time stamp of the value.
+ * \return Raw value of the element, as reported by the device.
+ * \exception const char* exception thrown if the value cannot be read.
+ */
+long Axes::ReadRaw( uint64_t *timeStamp )
 {
   // Try opening the value
   IOHIDValueRef myValue;
   IOReturn mySuccess = IOHIDDeviceGetValue( myDevice, myElement, &myValue );
   if( mySuccess == kIOReturnSuccess )
   {
-    // If successful, read the value.
-    double value;
-    value = double( IOHIDValueGetIntegerValue( myValue ) );
-    // If it is relative, accumulate the value
-    if( isRelative )
-    {
-      value += lastVal;
-      lastVal = value;
-    }
-    // Normalise and return the result
-    return 2*value/(logmax-logmin) - 1;
+    // If successful, return the value.
+    if( timeStamp != NULL ) *timeStamp = IOHIDValueGetTimeStamp( myValue );
+    return IOHIDValueGetIntegerValue( myValue );
   }
   throw "Error reading axes";
-}
\ No newline at end of file
+}
+
+/**
+ * \brief Convert a raw value of this axis into a normalised double.
+ *
+ * \param[in] rawValue Raw value, such as returned by ReadRaw.
+ * \return Normalised state of the axis. -1 corresponds to LogicalMinimum and +1
+ *   corresponds to LogicalMaximum.
+ */
+double Axes::Decode( long rawValue )
+{
+  double value = double( rawValue );
+  // If it is relative, accumulate the value
+  if( isRelative )
+  {
+    value += lastVal;
+    lastVal = value;
+  }
+  // Normalise and return the result
+  return 2*(value-logmin)/(logmax-logmin) - 1;
+}
+
+/**
+ * \brief Whether the axis reports relative changes rather than positions.
+ */
+bool Axes::IsRelative( void ) const
+{
+  return isRelative;
+}
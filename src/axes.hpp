@@ -45,6 +45,16 @@ class Axes
      */
     Axes( IOHIDDeviceRef device, IOHIDElementRef element );
     
+    /**
+     * \brief Initialise an Axes object with no device, such as one replayed from a
+     *  capture. Only its range is known, so it must not be read.
+     *
+     * \param[in] logicalMin Logical minimum of the axis.
+     * \param[in] logicalMax Logical maximum of the axis.
+     * \param[in] relative Whether the axis is relative.
+     */
+    Axes( long logicalMin, long logicalMax, bool relative );
+    
     /**
      * \brief Axes destructor.
      */
@@ -59,6 +69,29 @@ class Axes
      */
     double ReadState( void );
     
+    /**
+     * \brief Read the raw (integer) value of the axis from the device.
+     *
+     * \param[out] timeStamp If not NULL, receives the time stamp of the value.
+     * \return Raw value of the element, as reported by the device.
+     * \exception const char* exception thrown if the value cannot be read.
+     */
+    long ReadRaw( uint64_t *timeStamp = NULL );
+    
+    /**
+     * \brief Convert a raw value of this axis into a normalised double.
+     *
+     * \param[in] rawValue Raw value, such as returned by ReadRaw.
+     * \return Normalised state of the axis. -1 corresponds to LogicalMinimum and +1
+     *   corresponds to LogicalMaximum.
+     */
+    double Decode( long rawValue );
+    
+    /**
+     * \brief Whether the axis reports relative changes rather than positions.
+     */
+    bool IsRelative( void ) const;
+    
   private:
     IOHIDElementRef myElement;
     IOHIDDeviceRef myDevice;
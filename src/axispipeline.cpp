@@ -0,0 +1,482 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "axispipeline.hpp"
+
+#ifndef M_PI
+  #define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * \brief Processing that leaves an axis as it is.
+ */
+AxisProcessing AxisProcessingDefaults( void )
+{
+  AxisProcessing config;
+  config.calMin = -1.0;
+  config.calCentre = 0.0;
+  config.calMax = 1.0;
+  config.deadzone = 0.0;
+  config.edge = 0.0;
+  config.curve = kAxisCurve_Linear;
+  config.curveAmount = 0.0;
+  config.cutoff = 0.0;
+  config.q = M_SQRT1_2;
+  return config;
+}
+
+/**
+ * \brief Apply one key=value setting of an axis processing file.
+ *
+ * \output true if the key is known and the value readable.
+ */
+static bool SetAxisSetting( AxisProcessing &config, const char *key, const char *value )
+{
+  if( strcmp( key, "curve" ) == 0 )
+  {
+    if( strcmp( value, "linear" ) == 0 ) config.curve = kAxisCurve_Linear;
+    else if( strcmp( value, "cubic" ) == 0 ) config.curve = kAxisCurve_Cubic;
+    else if( strcmp( value, "expo" ) == 0 ) config.curve = kAxisCurve_Expo;
+    else return false;
+    return true;
+  }
+  char *end;
+  double number = strtod( value, &end );
+  if( end == value || *end != '\0' ) return false;
+  if( strcmp( key, "min" ) == 0 ) config.calMin = number;
+  else if( strcmp( key, "centre" ) == 0 ) config.calCentre = number;
+  else if( strcmp( key, "max" ) == 0 ) config.calMax = number;
+  else if( strcmp( key, "deadzone" ) == 0 ) config.deadzone = number;
+  else if( strcmp( key, "edge" ) == 0 ) config.edge = number;
+  else if( strcmp( key, "amount" ) == 0 ) config.curveAmount = number;
+  else if( strcmp( key, "lowpass" ) == 0 ) config.cutoff = number;
+  else if( strcmp( key, "q" ) == 0 ) config.q = number;
+  else return false;
+  return true;
+}
+
+/**
+ * \brief Read axis processing from a text file. Each line is an axis number (1 based,
+ *  or * for every axis) followed by any of min=, centre=, max=, deadzone=, edge=,
+ *  curve= (linear, cubic or expo), amount=, lowpass= (Hz) and q=. Text after a # is
+ *  ignored, and later lines override earlier ones.
+ *
+ * \param[in] path File name.
+ * \param[in] numAxes Number of axes.
+ * \param[out] config Processing of each axis, numAxes long.
+ * \output true if successful, false if the file can't be read or has a bad line.
+ */
+bool ReadAxisProcessing( const char *path, size_t numAxes, std::vector<AxisProcessing> &config )
+{
+  config.assign( numAxes, AxisProcessingDefaults() );
+  FILE *file = fopen( path, "r" );
+  if( file == NULL ) return false;
+  
+  bool ok = true;
+  char line[512];
+  while( ok && fgets( line, sizeof(line), file ) != NULL )
+  {
+    char *comment = strchr( line, '#' );
+    if( comment != NULL ) *comment = '\0';
+    const char *blanks = " \t\r\n";
+    char *token = strtok( line, blanks );
+    if( token == NULL ) continue;
+    
+    // Which axes the line applies to
+    size_t first = 0, last = numAxes;
+    if( strcmp( token, "*" ) != 0 )
+    {
+      char *end;
+      long axis = strtol( token, &end, 10 );
+      if( *end != '\0' || axis < 1 || (size_t)axis > numAxes )
+      {
+        ok = false;
+        break;
+      }
+      first = (size_t)axis - 1;
+      last = first + 1;
+    }
+    
+    while( ok && (token = strtok( NULL, blanks )) != NULL )
+    {
+      char *value = strchr( token, '=' );
+      if( value == NULL )
+      {
+        ok = false;
+        break;
+      }
+      *value++ = '\0';
+      for( size_t ii=first; ii<last && ok; ii++ ) ok = SetAxisSetting( config[ ii ], token, value );
+    }
+  }
+  fclose( file );
+  return ok;
+}
+
+/**
+ * \brief AxisPipeline constructor. The pipeline starts empty (inactive).
+ */
+AxisPipeline::AxisPipeline()
+{
+  Clear();
+}
+
+/**
+ * \brief AxisPipeline destructor.
+ */
+AxisPipeline::~AxisPipeline()
+{
+}
+
+/**
+ * \brief Remove every axis. The pipeline is then inactive.
+ */
+void AxisPipeline::Clear( void )
+{
+  myCalCentre.clear();
+  myCalLow.clear();
+  myCalHigh.clear();
+  myDeadzone.clear();
+  myDeadScale.clear();
+  myCubic.clear();
+  myExpo.clear();
+  myExpoAmount.clear();
+  myExpoScale.clear();
+  myB0.clear();
+  myB1.clear();
+  myB2.clear();
+  myA1.clear();
+  myA2.clear();
+  myZ1.clear();
+  myZ2.clear();
+  myCalibrate = myDeadzones = myCurves = myFilters = myPrimed = false;
+}
+
+/**
+ * \brief Set the processing of every axis. The filters start over.
+ *
+ * \param[in] config Processing of each axis.
+ * \param[in] len Length of config. Axes beyond len are left as they are.
+ * \param[in] numAxes Number of axes.
+ * \param[in] rate Rate at which Process is called (Hz), for the filters.
+ * \output true if successful, false if a setting is out of range (the pipeline is
+ *  then cleared).
+ */
+bool AxisPipeline::Configure( const AxisProcessing *config, size_t len, size_t numAxes,
+                                                                            double rate )
+{
+  Clear();
+  myCalCentre.assign( numAxes, 0.0 );
+  myCalLow.assign( numAxes, 1.0 );
+  myCalHigh.assign( numAxes, 1.0 );
+  myDeadzone.assign( numAxes, 0.0 );
+  myDeadScale.assign( numAxes, 1.0 );
+  myCubic.assign( numAxes, 0.0 );
+  myB0.assign( numAxes, 1.0 );
+  myB1.assign( numAxes, 0.0 );
+  myB2.assign( numAxes, 0.0 );
+  myA1.assign( numAxes, 0.0 );
+  myA2.assign( numAxes, 0.0 );
+  myZ1.assign( numAxes, 0.0 );
+  myZ2.assign( numAxes, 0.0 );
+  
+  bool ok = true;
+  for( size_t ii=0; ii<len && ii<numAxes && ok; ii++ )
+  {
+    const AxisProcessing &axis = config[ ii ];
+    if( !(axis.calMin < axis.calCentre && axis.calCentre < axis.calMax) ||
+        !(axis.deadzone >= 0.0 && axis.edge >= 0.0 && axis.deadzone + axis.edge < 1.0) ||
+        axis.curve < kAxisCurve_Linear || axis.curve >= kAxisCurve_NumCurves ||
+        !(axis.cutoff >= 0.0) )
+    {
+      ok = false;
+      break;
+    }
+    
+    if( axis.calMin != -1.0 || axis.calCentre != 0.0 || axis.calMax != 1.0 )
+    {
+      myCalCentre[ ii ] = axis.calCentre;
+      myCalLow[ ii ] = 1.0/( axis.calCentre - axis.calMin );
+      myCalHigh[ ii ] = 1.0/( axis.calMax - axis.calCentre );
+      myCalibrate = true;
+    }
+    if( axis.deadzone > 0.0 || axis.edge > 0.0 )
+    {
+      myDeadzone[ ii ] = axis.deadzone;
+      myDeadScale[ ii ] = 1.0/( 1.0 - axis.deadzone - axis.edge );
+      myDeadzones = true;
+    }
+    if( axis.curve == kAxisCurve_Cubic && axis.curveAmount != 0.0 )
+    {
+      if( !(axis.curveAmount > 0.0 && axis.curveAmount <= 1.0) ) ok = false;
+      myCubic[ ii ] = axis.curveAmount;
+      myCurves = true;
+    }
+    if( axis.curve == kAxisCurve_Expo && axis.curveAmount != 0.0 )
+    {
+      if( !(axis.curveAmount > 0.0) ) ok = false;
+      myExpo.push_back( ii );
+      myExpoAmount.push_back( axis.curveAmount );
+      myExpoScale.push_back( 1.0/( exp( axis.curveAmount ) - 1.0 ) );
+      myCurves = true;
+    }
+    if( axis.cutoff > 0.0 )
+    {
+      // Low pass biquad from the Audio EQ Cookbook, normalised so that a0 = 1
+      if( !(rate > 0.0 && axis.cutoff < 0.5*rate && axis.q > 0.0) )
+      {
+        ok = false;
+        break;
+      }
+      double w0 = 2.0*M_PI*axis.cutoff/rate;
+      double alpha = sin( w0 )/( 2.0*axis.q );
+      double a0 = 1.0 + alpha;
+      myB1[ ii ] = ( 1.0 - cos( w0 ) )/a0;
+      myB0[ ii ] = myB2[ ii ] = 0.5*myB1[ ii ];
+      myA1[ ii ] = -2.0*cos( w0 )/a0;
+      myA2[ ii ] = ( 1.0 - alpha )/a0;
+      myFilters = true;
+    }
+  }
+  if( !ok ) Clear();
+  return ok;
+}
+
+/**
+ * \brief Whether any axis is processed.
+ */
+bool AxisPipeline::Active( void ) const
+{
+  return myCalibrate || myDeadzones || myCurves || myFilters;
+}
+
+/**
+ * \brief Whether any axis is calibrated, has deadzones or has a response curve.
+ */
+bool AxisPipeline::Shapes( void ) const
+{
+  return myCalibrate || myDeadzones || myCurves;
+}
+
+/**
+ * \brief Start the filters over. The next Process primes them with its values, so that
+ *  they don't rise from zero.
+ */
+void AxisPipeline::Reset( void )
+{
+  myPrimed = false;
+}
+
+/**
+ * \brief Process a block of normalised axis values in place.
+ *
+ * \param[in,out] values Axis values.
+ * \param[in] len Number of axes (at most the number configured).
+ */
+void AxisPipeline::Process( double *values, size_t len )
+{
+  if( len > myCubic.size() ) len = myCubic.size();
+  if( len == 0 ) return;
+  size_t ii;
+  
+  // Each stage is a straight pass over the arrays, with selects rather than branches,
+  // so that the compiler can vectorise it
+  if( myCalibrate )
+  {
+    const double *centre = &myCalCentre.front(), *low = &myCalLow.front(), *high = &myCalHigh.front();
+    for( ii=0; ii<len; ii++ )
+    {
+      double x = values[ ii ] - centre[ ii ];
+      x *= x < 0.0 ? low[ ii ] : high[ ii ];
+      values[ ii ] = x < -1.0 ? -1.0 : ( x > 1.0 ? 1.0 : x );
+    }
+  }
+  if( myDeadzones )
+  {
+    const double *deadzone = &myDeadzone.front(), *scale = &myDeadScale.front();
+    for( ii=0; ii<len; ii++ )
+    {
+      double x = values[ ii ];
+      double y = ( ( x < 0.0 ? -x : x ) - deadzone[ ii ] )*scale[ ii ];
+      y = y < 0.0 ? 0.0 : ( y > 1.0 ? 1.0 : y );
+      values[ ii ] = x < 0.0 ? -y : y;
+    }
+  }
+  if( myCurves )
+  {
+    const double *cubic = &myCubic.front();
+    for( ii=0; ii<len; ii++ )
+    {
+      double x = values[ ii ];
+      values[ ii ] = x + cubic[ ii ]*( x*x*x - x );
+    }
+    for( size_t jj=0; jj<myExpo.size(); jj++ )
+    {
+      ii = myExpo[ jj ];
+      if( ii >= len ) break;
+      double x = values[ ii ];
+      double y = ( exp( myExpoAmount[ jj ]*( x < 0.0 ? -x : x ) ) - 1.0 )*myExpoScale[ jj ];
+      values[ ii ] = x < 0.0 ? -y : y;
+    }
+  }
+  if( myFilters )
+  {
+    if( !myPrimed ) Prime( values, len );
+    const double *b0 = &myB0.front(), *b1 = &myB1.front(), *b2 = &myB2.front();
+    const double *a1 = &myA1.front(), *a2 = &myA2.front();
+    double *z1 = &myZ1.front(), *z2 = &myZ2.front();
+    for( ii=0; ii<len; ii++ )
+    {
+      double x = values[ ii ];
+      double y = b0[ ii ]*x + z1[ ii ];
+      z1[ ii ] = b1[ ii ]*x - a1[ ii ]*y + z2[ ii ];
+      z2[ ii ] = b2[ ii ]*x - a2[ ii ]*y;
+      values[ ii ] = y;
+    }
+  }
+}
+
+/**
+ * \brief Calibration, deadzones and response curve of one axis (the stages without
+ *  state), as Process would apply them to a single value. Used to bake them into lookup
+ *  tables (see AxisTable::BuildLookup).
+ *
+ * \param[in] axis Axis index. Axes that aren't configured are left as they are.
+ * \param[in] x Normalised value.
+ * \output Shaped value.
+ */
+double AxisPipeline::Shape( size_t axis, double x ) const
+{
+  if( axis >= myCubic.size() ) return x;
+  if( myCalibrate )
+  {
+    x -= myCalCentre[ axis ];
+    x *= x < 0.0 ? myCalLow[ axis ] : myCalHigh[ axis ];
+    x = x < -1.0 ? -1.0 : ( x > 1.0 ? 1.0 : x );
+  }
+  if( myDeadzones )
+  {
+    double y = ( fabs( x ) - myDeadzone[ axis ] )*myDeadScale[ axis ];
+    y = y < 0.0 ? 0.0 : ( y > 1.0 ? 1.0 : y );
+    x = x < 0.0 ? -y : y;
+  }
+  if( myCurves )
+  {
+    x += myCubic[ axis ]*( x*x*x - x );
+    double amount = ExpoAmount( axis );
+    if( amount != 0.0 )
+    {
+      double y = ( exp( amount*fabs( x ) ) - 1.0 )/( exp( amount ) - 1.0 );
+      x = x < 0.0 ? -y : y;
+    }
+  }
+  return x;
+}
+
+/**
+ * \brief Whether two axes are shaped the same way, so that they can share a lookup
+ *  table.
+ */
+bool AxisPipeline::SameShape( size_t a, size_t b ) const
+{
+  if( a >= myCubic.size() || b >= myCubic.size() ) return a >= myCubic.size() && b >= myCubic.size();
+  return myCalCentre[ a ] == myCalCentre[ b ] && myCalLow[ a ] == myCalLow[ b ] &&
+         myCalHigh[ a ] == myCalHigh[ b ] && myDeadzone[ a ] == myDeadzone[ b ] &&
+         myDeadScale[ a ] == myDeadScale[ b ] && myCubic[ a ] == myCubic[ b ] &&
+         ExpoAmount( a ) == ExpoAmount( b );
+}
+
+/**
+ * \brief Stop shaping an axis, because its lookup table already does. Its filter is
+ *  kept.
+ */
+void AxisPipeline::Bypass( size_t axis )
+{
+  if( axis >= myCubic.size() ) return;
+  myCalCentre[ axis ] = 0.0;
+  myCalLow[ axis ] = myCalHigh[ axis ] = 1.0;
+  myDeadzone[ axis ] = 0.0;
+  myDeadScale[ axis ] = 1.0;
+  myCubic[ axis ] = 0.0;
+  for( size_t jj=0; jj<myExpo.size(); jj++ )
+  {
+    if( myExpo[ jj ] != axis ) continue;
+    myExpo.erase( myExpo.begin() + jj );
+    myExpoAmount.erase( myExpoAmount.begin() + jj );
+    myExpoScale.erase( myExpoScale.begin() + jj );
+    break;
+  }
+  UpdateStages();
+}
+
+/**
+ * \brief Set the filter states to their steady state for the given values.
+ */
+void AxisPipeline::Prime( const double *values, size_t len )
+{
+  for( size_t ii=0; ii<len; ii++ )
+  {
+    // At rest, y = gain*x, and the states follow from the difference equations
+    double x = values[ ii ];
+    double gain = ( myB0[ ii ] + myB1[ ii ] + myB2[ ii ] )/( 1.0 + myA1[ ii ] + myA2[ ii ] );
+    double y = gain*x;
+    myZ2[ ii ] = myB2[ ii ]*x - myA2[ ii ]*y;
+    myZ1[ ii ] = y - myB0[ ii ]*x;
+  }
+  myPrimed = true;
+}
+
+/**
+ * \brief Expo amount of an axis, or 0 if it has no expo curve.
+ */
+double AxisPipeline::ExpoAmount( size_t axis ) const
+{
+  for( size_t jj=0; jj<myExpo.size(); jj++ )
+  {
+    if( myExpo[ jj ] == axis ) return myExpoAmount[ jj ];
+  }
+  return 0.0;
+}
+
+/**
+ * \brief Work out which stages any axis still uses.
+ */
+void AxisPipeline::UpdateStages( void )
+{
+  myCalibrate = myDeadzones = false;
+  myCurves = !myExpo.empty();
+  for( size_t ii=0; ii<myCubic.size(); ii++ )
+  {
+    if( myCalCentre[ ii ] != 0.0 || myCalLow[ ii ] != 1.0 || myCalHigh[ ii ] != 1.0 ) myCalibrate = true;
+    if( myDeadzone[ ii ] != 0.0 || myDeadScale[ ii ] != 1.0 ) myDeadzones = true;
+    if( myCubic[ ii ] != 0.0 ) myCurves = true;
+  }
+}
@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __AXISPIPELINE_H__
+#define __AXISPIPELINE_H__
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * \brief Response curves. kAxisCurve_Cubic blends the axis with its cube,
+ *  (1-amount)*x + amount*x^3. kAxisCurve_Expo is sign(x)*(exp(amount*|x|)-1)/(exp(amount)-1).
+ *  Both keep -1, 0 and 1 where they are.
+ */
+enum AxisCurve {
+  kAxisCurve_Linear = 0,
+  kAxisCurve_Cubic,
+  kAxisCurve_Expo,
+  kAxisCurve_NumCurves
+};
+
+/**
+ * \brief Processing of one normalised axis, in the order it is applied: calibration,
+ *  deadzones, response curve and low pass filter.
+ */
+struct AxisProcessing
+{
+  // Normalised values read at the ends and centre of travel, mapped to -1, 0 and 1
+  double calMin, calCentre, calMax;
+  // Fraction of travel ignored around the centre, and before each end
+  double deadzone, edge;
+  AxisCurve curve;
+  double curveAmount;
+  // Cutoff (Hz) and Q of a second order low pass filter, or 0 for none
+  double cutoff, q;
+};
+
+/**
+ * \brief Processing that leaves an axis as it is.
+ */
+AxisProcessing AxisProcessingDefaults( void );
+
+/**
+ * \brief Read axis processing from a text file. Each line is an axis number (1 based,
+ *  or * for every axis) followed by any of min=, centre=, max=, deadzone=, edge=,
+ *  curve= (linear, cubic or expo), amount=, lowpass= (Hz) and q=. Text after a # is
+ *  ignored, and later lines override earlier ones.
+ *
+ * \param[in] path File name.
+ * \param[in] numAxes Number of axes.
+ * \param[out] config Processing of each axis, numAxes long.
+ * \return true if successful, false if the file can't be read or has a bad line.
+ */
+bool ReadAxisProcessing( const char *path, size_t numAxes, std::vector<AxisProcessing> &config );
+
+/**
+ * \brief Per axis processing applied to normalised axes, one stage at a time over all
+ *  of the axes (structure of arrays, like AxisTable). Stages that no axis uses are
+ *  skipped, so an unconfigured pipeline costs nothing.
+ *
+ * The filters are stepped once per Process call, so their cutoff is relative to the
+ * rate given to Configure.
+ */
+class AxisPipeline
+{
+  public:
+    /**
+     * \brief AxisPipeline constructor. The pipeline starts empty (inactive).
+     */
+    AxisPipeline();
+    
+    /**
+     * \brief AxisPipeline destructor.
+     */
+    ~AxisPipeline();
+    
+    /**
+     * \brief Remove every axis. The pipeline is then inactive.
+     */
+    void Clear( void );
+    
+    /**
+     * \brief Set the processing of every axis. The filters start over.
+     *
+     * \param[in] config Processing of each axis.
+     * \param[in] len Length of config. Axes beyond len are left as they are.
+     * \param[in] numAxes Number of axes.
+     * \param[in] rate Rate at which Process is called (Hz), for the filters.
+     * \return true if successful, false if a setting is out of range (the pipeline is
+     *  then cleared).
+     */
+    bool Configure( const AxisProcessing *config, size_t len, size_t numAxes, double rate );
+    
+    /**
+     * \brief Whether any axis is processed.
+     */
+    bool Active( void ) const;
+    
+    /**
+     * \brief Whether any axis is calibrated, has deadzones or has a response curve.
+     */
+    bool Shapes( void ) const;
+    
+    /**
+     * \brief Start the filters over. The next Process primes them with its values, so
+     *  that they don't rise from zero.
+     */
+    void Reset( void );
+    
+    /**
+     * \brief Process a block of normalised axis values in place.
+     *
+     * \param[in,out] values Axis values.
+     * \param[in] len Number of axes (at most the number configured).
+     */
+    void Process( double *values, size_t len );
+    
+    /**
+     * \brief Calibration, deadzones and response curve of one axis (the stages without
+     *  state), as Process would apply them to a single value. Used to bake them into
+     *  lookup tables (see AxisTable::BuildLookup).
+     *
+     * \param[in] axis Axis index. Axes that aren't configured are left as they are.
+     * \param[in] x Normalised value.
+     * \return Shaped value.
+     */
+    double Shape( size_t axis, double x ) const;
+    
+    /**
+     * \brief Whether two axes are shaped the same way, so that they can share a lookup
+     *  table.
+     */
+    bool SameShape( size_t a, size_t b ) const;
+    
+    /**
+     * \brief Stop shaping an axis, because its lookup table already does. Its filter is
+     *  kept.
+     */
+    void Bypass( size_t axis );
+    
+  private:
+    // Calibration: x < centre scales by myCalLow, otherwise by myCalHigh
+    std::vector<double> myCalCentre, myCalLow, myCalHigh;
+    // Deadzones: (|x| - deadzone)*scale, limited to 0 to 1
+    std::vector<double> myDeadzone, myDeadScale;
+    // Cubic weight of each axis, and the expo axes with their amounts
+    std::vector<double> myCubic;
+    std::vector<size_t> myExpo;
+    std::vector<double> myExpoAmount, myExpoScale;
+    // Biquads (transposed direct form II, a0 = 1) and their states
+    std::vector<double> myB0, myB1, myB2, myA1, myA2, myZ1, myZ2;
+    bool myCalibrate, myDeadzones, myCurves, myFilters, myPrimed;
+    
+    /**
+     * \brief Set the filter states to their steady state for the given values.
+     */
+    void Prime( const double *values, size_t len );
+    
+    /**
+     * \brief Expo amount of an axis, or 0 if it has no expo curve.
+     */
+    double ExpoAmount( size_t axis ) const;
+    
+    /**
+     * \brief Work out which stages any axis still uses.
+     */
+    void UpdateStages( void );
+};
+
+#endif
@@ -0,0 +1,403 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "axistable.hpp"
+
+// Start of an axis without a lookup table
+#define NO_LOOKUP ((size_t)-1)
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+  #include <immintrin.h>
+#endif
+
+/**
+ * \brief Clamp a scaled value to [-1, 1], as a raw value clamped to its logical range
+ *  would scale.
+ */
+static inline double ClampScaled( double x )
+{
+  return x < -1.0 ? -1.0 : ( x > 1.0 ? 1.0 : x );
+}
+
+/**
+ * \brief AxisTable constructor. The table starts empty.
+ */
+AxisTable::AxisTable()
+{
+  myNumLookups = 0;
+  myRelativeMode = kAxisRelative_Position;
+}
+
+/**
+ * \brief AxisTable destructor.
+ */
+AxisTable::~AxisTable()
+{
+}
+
+/**
+ * \brief Remove all axes from the table, and make the relative axes read as
+ *  positions again.
+ */
+void AxisTable::Clear( void )
+{
+  myScale.clear();
+  myOffset.clear();
+  myRelative.clear();
+  myAccum.clear();
+  myLastCount.clear();
+  myRelativeMode = kAxisRelative_Position;
+  myMin.clear();
+  myMax.clear();
+  myLookupStart.clear();
+  myLookup.clear();
+  myNumLookups = 0;
+}
+
+/**
+ * \brief Append an axis to the table.
+ *
+ * \param[in] logmin Logical minimum of the element.
+ * \param[in] logmax Logical maximum of the element.
+ * \param[in] isRelative Whether the element reports relative changes.
+ * \return Index of the new axis.
+ */
+size_t AxisTable::Add( long logmin, long logmax, bool isRelative )
+{
+  // 2*(v - logmin)/(logmax - logmin) - 1, rearranged as scale*v + offset. A degenerate
+  // range gives a constant 0 rather than a division by zero.
+  double range = double( logmax ) - double( logmin );
+  double scale = 0.0, offset = 0.0;
+  if( range != 0.0 )
+  {
+    scale = 2.0/range;
+    offset = -2.0*double( logmin )/range - 1.0;
+  }
+  myScale.push_back( scale );
+  myOffset.push_back( offset );
+  myMin.push_back( (int32_t)logmin );
+  myMax.push_back( (int32_t)logmax );
+  myLookupStart.push_back( NO_LOOKUP );
+  if( isRelative )
+  {
+    myRelative.push_back( myScale.size()-1 );
+    myAccum.push_back( 0.0 );
+    myLastCount.push_back( 0 );
+  }
+  return myScale.size()-1;
+}
+
+/**
+ * \brief Choose what the relative axes read as. The default is
+ *  kAxisRelative_Position.
+ */
+void AxisTable::SetRelativeMode( AxisRelativeMode mode )
+{
+  myRelativeMode = mode;
+}
+
+/**
+ * \brief What the relative axes read as.
+ */
+AxisRelativeMode AxisTable::RelativeMode( void ) const
+{
+  return myRelativeMode;
+}
+
+/**
+ * \brief Indices of the relative axes, in increasing order.
+ */
+const std::vector<size_t> &AxisTable::Relative( void ) const
+{
+  return myRelative;
+}
+
+/**
+ * \brief Take the relative axes' counters as already read, so that only later
+ *  changes are integrated, such as after the counters have restarted.
+ *
+ * \param[in] raw Raw values, one per axis.
+ * \param[in] len Length of raw. Relative axes beyond len are left alone.
+ * \param[in] resetPosition Also move the origin here, so that the positions restart
+ *  from zero.
+ */
+void AxisTable::RebaseRelative( const int32_t *raw, size_t len, bool resetPosition )
+{
+  for( size_t jj=0; jj<myRelative.size(); jj++ )
+  {
+    if( myRelative[ jj ] >= len ) break;
+    myLastCount[ jj ] = raw[ myRelative[ jj ] ];
+    if( resetPosition ) myAccum[ jj ] = 0.0;
+  }
+}
+
+/**
+ * \brief Build the lookup tables. Axes with the same range and shaping share a table.
+ *  Axes that are relative, wider than AXIS_LOOKUP_MAX_ENTRIES or beyond the memory cap
+ *  are scaled as before. Any previous tables are replaced.
+ *
+ * \param[in] shaping Calibration, deadzones and curves to bake into the tables (see
+ *  AxisPipeline::Shape), or NULL for plain normalisation.
+ * \param[in] maxBytes Memory cap for all of the tables.
+ * \return Number of axes with a table.
+ */
+size_t AxisTable::BuildLookup( const AxisPipeline *shaping, size_t maxBytes )
+{
+  ClearLookup();
+  std::vector<bool> relative( myScale.size(), false );
+  for( size_t jj=0; jj<myRelative.size(); jj++ ) relative[ myRelative[ jj ] ] = true;
+  
+  size_t maxEntries = maxBytes/sizeof(double);
+  for( size_t ii=0; ii<myScale.size(); ii++ )
+  {
+    int64_t entries = (int64_t)myMax[ ii ] - (int64_t)myMin[ ii ] + 1;
+    if( relative[ ii ] || entries <= 0 || entries > AXIS_LOOKUP_MAX_ENTRIES ) continue;
+    
+    // Share the table of an earlier axis with the same range and shaping
+    for( size_t jj=0; jj<ii; jj++ )
+    {
+      if( myLookupStart[ jj ] != NO_LOOKUP && myMin[ jj ] == myMin[ ii ] &&
+          myMax[ jj ] == myMax[ ii ] && ( shaping == NULL || shaping->SameShape( ii, jj ) ) )
+      {
+        myLookupStart[ ii ] = myLookupStart[ jj ];
+        break;
+      }
+    }
+    if( myLookupStart[ ii ] == NO_LOOKUP )
+    {
+      if( myLookup.size() + (size_t)entries > maxEntries ) continue;
+      myLookupStart[ ii ] = myLookup.size();
+      for( int64_t v=myMin[ ii ]; v<=(int64_t)myMax[ ii ]; v++ )
+      {
+        double x = myScale[ ii ]*double( v ) + myOffset[ ii ];
+        myLookup.push_back( shaping != NULL ? shaping->Shape( ii, x ) : x );
+      }
+    }
+    myNumLookups++;
+  }
+  return myNumLookups;
+}
+
+/**
+ * \brief Drop the lookup tables, so that every axis is scaled.
+ */
+void AxisTable::ClearLookup( void )
+{
+  myLookup.clear();
+  myLookupStart.assign( myScale.size(), NO_LOOKUP );
+  myNumLookups = 0;
+}
+
+/**
+ * \brief Whether an axis is looked up in a table.
+ */
+bool AxisTable::HasLookup( size_t axis ) const
+{
+  return axis < myLookupStart.size() && myLookupStart[ axis ] != NO_LOOKUP;
+}
+
+/**
+ * \brief Memory used by the lookup tables (bytes).
+ */
+size_t AxisTable::LookupBytes( void ) const
+{
+  return myLookup.size()*sizeof(double);
+}
+
+/**
+ * \brief Number of axes in the table.
+ */
+size_t AxisTable::Size( void ) const
+{
+  return myScale.size();
+}
+
+/**
+ * \brief Normalise a block of raw axis values in one pass.
+ *
+ * \param[in] raw Raw values, one per axis.
+ * \param[out] dest Normalised values.
+ * \param[in] len Number of axes to normalise (at most Size()).
+ */
+void AxisTable::Normalise( const int32_t *raw, double *dest, size_t len )
+{
+  if( len > myScale.size() ) len = myScale.size();
+  if( len == 0 ) return;
+  const double *scale = &myScale.front();
+  const double *offset = &myOffset.front();
+  size_t ii = 0;
+  
+  // Raw values outside the logical range read as the nearest end on every path: a table
+  // clamps the raw value, and the arithmetic clamps the scaled one to [-1, 1]. The
+  // relative axes are integrated from the raw values afterwards, unclamped.
+  if( myNumLookups > 0 )
+  {
+    const int32_t *lo = &myMin.front(), *hi = &myMax.front();
+    const size_t *start = &myLookupStart.front();
+    const double *table = &myLookup.front();
+    if( myNumLookups == myScale.size() )
+    {
+      for( ; ii<len; ii++ )
+      {
+        int32_t v = raw[ ii ] < lo[ ii ] ? lo[ ii ] : ( raw[ ii ] > hi[ ii ] ? hi[ ii ] : raw[ ii ] );
+        dest[ ii ] = table[ start[ ii ] + (size_t)( v - lo[ ii ] ) ];
+      }
+      return;
+    }
+    for( ; ii<len; ii++ )
+    {
+      int32_t v = raw[ ii ];
+      if( start[ ii ] == NO_LOOKUP )
+      {
+        dest[ ii ] = ClampScaled( scale[ ii ]*double( v ) + offset[ ii ] );
+        continue;
+      }
+      v = v < lo[ ii ] ? lo[ ii ] : ( v > hi[ ii ] ? hi[ ii ] : v );
+      dest[ ii ] = table[ start[ ii ] + (size_t)( v - lo[ ii ] ) ];
+    }
+    if( !myRelative.empty() ) AccumulateRelative( raw, dest, len );
+    return;
+  }
+  
+#if defined(__AVX__)
+  const __m256d lower4 = _mm256_set1_pd( -1.0 ), upper4 = _mm256_set1_pd( 1.0 );
+  for( ; ii+4<=len; ii+=4 )
+  {
+    __m256d v = _mm256_cvtepi32_pd( _mm_loadu_si128( (const __m128i *)( raw + ii ) ) );
+    v = _mm256_add_pd( _mm256_mul_pd( v, _mm256_loadu_pd( scale + ii ) ),
+                       _mm256_loadu_pd( offset + ii ) );
+    _mm256_storeu_pd( dest + ii, _mm256_min_pd( _mm256_max_pd( v, lower4 ), upper4 ) );
+  }
+#endif
+
+#if defined(__SSE2__)
+  const __m128d lower2 = _mm_set1_pd( -1.0 ), upper2 = _mm_set1_pd( 1.0 );
+  for( ; ii+2<=len; ii+=2 )
+  {
+    __m128d v = _mm_cvtepi32_pd( _mm_loadl_epi64( (const __m128i *)( raw + ii ) ) );
+    v = _mm_add_pd( _mm_mul_pd( v, _mm_loadu_pd( scale + ii ) ), _mm_loadu_pd( offset + ii ) );
+    _mm_storeu_pd( dest + ii, _mm_min_pd( _mm_max_pd( v, lower2 ), upper2 ) );
+  }
+#endif
+
+  for( ; ii<len; ii++ )
+  {
+    dest[ ii ] = ClampScaled( scale[ ii ]*double( raw[ ii ] ) + offset[ ii ] );
+  }
+  
+  if( !myRelative.empty() ) AccumulateRelative( raw, dest, len );
+}
+
+/**
+ * \brief Scale a block of raw axis values without integrating the relative axes,
+ *  which read as their position since their counters started. Unlike Normalise this
+ *  doesn't change the table, so it can be called from any thread.
+ *
+ * \param[in] raw Raw values, one per axis.
+ * \param[out] dest Scaled values.
+ * \param[in] len Number of axes to scale (at most Size()).
+ */
+void AxisTable::Scale( const int32_t *raw, double *dest, size_t len ) const
+{
+  if( len > myScale.size() ) len = myScale.size();
+  for( size_t ii=0; ii<len; ii++ )
+  {
+    dest[ ii ] = ClampScaled( myScale[ ii ]*double( raw[ ii ] ) + myOffset[ ii ] );
+  }
+  // The positions of the relative axes aren't clamped
+  for( size_t jj=0; jj<myRelative.size() && myRelative[ jj ]<len; jj++ )
+  {
+    size_t ii = myRelative[ jj ];
+    dest[ ii ] = myScale[ ii ]*double( raw[ ii ] ) + myOffset[ ii ];
+  }
+}
+
+/**
+ * \brief Integrate the relative axes of a block of raw axis values in place, as
+ *  Normalise does, but leave them as counts: each relative axis becomes its position
+ *  since the origin (saturated to 32 bits) or its change. Absolute axes are left
+ *  alone, and no lookup table is used.
+ *
+ * \param[in,out] values Raw values, one per axis.
+ * \param[in] len Number of axes (at most Size()).
+ */
+void AxisTable::Counts( int32_t *values, size_t len )
+{
+  for( size_t jj=0; jj<myRelative.size(); jj++ )
+  {
+    size_t ii = myRelative[ jj ];
+    if( ii >= len ) break;
+    int32_t delta = (int32_t)( (uint32_t)values[ ii ] - (uint32_t)myLastCount[ jj ] );
+    myLastCount[ jj ] = values[ ii ];
+    myAccum[ jj ] += double( delta );
+    if( myRelativeMode == kAxisRelative_Delta )
+    {
+      values[ ii ] = delta;
+    }
+    else
+    {
+      double position = myAccum[ jj ];
+      if( position > 2147483647.0 ) position = 2147483647.0;
+      if( position < -2147483648.0 ) position = -2147483648.0;
+      values[ ii ] = (int32_t)position;
+    }
+  }
+}
+
+/**
+ * \brief Logical range of an axis.
+ *
+ * \param[in] axis Index of the axis.
+ * \param[out] logmin Logical minimum.
+ * \param[out] logmax Logical maximum.
+ */
+void AxisTable::Range( size_t axis, int32_t &logmin, int32_t &logmax ) const
+{
+  logmin = myMin[ axis ];
+  logmax = myMax[ axis ];
+}
+
+/**
+ * \brief Overwrite the relative axes with their positions or changes.
+ */
+void AxisTable::AccumulateRelative( const int32_t *raw, double *dest, size_t len )
+{
+  for( size_t jj=0; jj<myRelative.size(); jj++ )
+  {
+    size_t ii = myRelative[ jj ];
+    if( ii >= len ) break;
+    // The counters wrap around, so the difference is taken modulo 2^32
+    int32_t delta = (int32_t)( (uint32_t)raw[ ii ] - (uint32_t)myLastCount[ jj ] );
+    myLastCount[ jj ] = raw[ ii ];
+    myAccum[ jj ] += double( delta );
+    if( myRelativeMode == kAxisRelative_Delta ) dest[ ii ] = myScale[ ii ]*double( delta );
+    else dest[ ii ] = myScale[ ii ]*myAccum[ jj ] + myOffset[ ii ];
+  }
+}
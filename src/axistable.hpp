@@ -0,0 +1,222 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __AXISTABLE_H__
+#define __AXISTABLE_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include "axispipeline.hpp"
+
+/**
+ * \brief Largest lookup table (entries) built for an axis, enough for 16 bit axes.
+ */
+#define AXIS_LOOKUP_MAX_ENTRIES 65536
+
+/**
+ * \brief Default memory cap (bytes) for all of a table's lookup tables.
+ */
+#define AXIS_LOOKUP_MAX_BYTES (1 << 20)
+
+/**
+ * \brief What the relative axes read as.
+ */
+enum AxisRelativeMode {
+  // Scaled position, accumulated from the origin (see AxisTable::RebaseRelative)
+  kAxisRelative_Position = 0,
+  // Scaled change since the last Normalise, so that no motion reads as 0
+  kAxisRelative_Delta
+};
+
+/**
+ * \brief Flat (structure of arrays) table of axis scalings.
+ *
+ * Each axis maps its raw value v to scale*v + offset, where scale and offset are
+ * precomputed from the logical range so that LogicalMinimum maps to -1 and
+ * LogicalMaximum maps to +1. Raw values outside the logical range read as the nearest
+ * end, whether the axis is scaled or looked up.
+ *
+ * The raw values of relative axes are counters that sum every change reported (see
+ * JoySnapshot::SetRelative), so each Normalise takes the change since the previous
+ * one, wrapping around, and reads as the accumulated position or the change itself
+ * (see AxisRelativeMode).
+ *
+ * After BuildLookup, absolute axes with a narrow enough range are instead looked up
+ * in a table with an entry for every raw value, which holds the calibration, deadzones
+ * and response curve of the axis as well. Plain scaling is quicker than a table (it
+ * vectorises), so tables are only worth building to replace the shaping.
+ */
+class AxisTable
+{
+  public:
+    /**
+     * \brief AxisTable constructor. The table starts empty.
+     */
+    AxisTable();
+    
+    /**
+     * \brief AxisTable destructor.
+     */
+    ~AxisTable();
+    
+    /**
+     * \brief Remove all axes from the table, and make the relative axes read as
+     *  positions again.
+     */
+    void Clear( void );
+    
+    /**
+     * \brief Append an axis to the table.
+     *
+     * \param[in] logmin Logical minimum of the element.
+     * \param[in] logmax Logical maximum of the element.
+     * \param[in] isRelative Whether the element reports relative changes.
+     * \return Index of the new axis.
+     */
+    size_t Add( long logmin, long logmax, bool isRelative );
+    
+    /**
+     * \brief Choose what the relative axes read as. The default is
+     *  kAxisRelative_Position.
+     */
+    void SetRelativeMode( AxisRelativeMode mode );
+    
+    /**
+     * \brief What the relative axes read as.
+     */
+    AxisRelativeMode RelativeMode( void ) const;
+    
+    /**
+     * \brief Indices of the relative axes, in increasing order.
+     */
+    const std::vector<size_t> &Relative( void ) const;
+    
+    /**
+     * \brief Take the relative axes' counters as already read, so that only later
+     *  changes are integrated, such as after the counters have restarted.
+     *
+     * \param[in] raw Raw values, one per axis.
+     * \param[in] len Length of raw. Relative axes beyond len are left alone.
+     * \param[in] resetPosition Also move the origin here, so that the positions restart
+     *  from zero.
+     */
+    void RebaseRelative( const int32_t *raw, size_t len, bool resetPosition );
+    
+    /**
+     * \brief Build the lookup tables. Axes with the same range and shaping share a
+     *  table. Axes that are relative, wider than AXIS_LOOKUP_MAX_ENTRIES or beyond the
+     *  memory cap are scaled as before. Any previous tables are replaced.
+     *
+     * \param[in] shaping Calibration, deadzones and curves to bake into the tables (see
+     *  AxisPipeline::Shape), or NULL for plain normalisation.
+     * \param[in] maxBytes Memory cap for all of the tables.
+     * \return Number of axes with a table.
+     */
+    size_t BuildLookup( const AxisPipeline *shaping = NULL, size_t maxBytes = AXIS_LOOKUP_MAX_BYTES );
+    
+    /**
+     * \brief Drop the lookup tables, so that every axis is scaled.
+     */
+    void ClearLookup( void );
+    
+    /**
+     * \brief Whether an axis is looked up in a table.
+     */
+    bool HasLookup( size_t axis ) const;
+    
+    /**
+     * \brief Memory used by the lookup tables (bytes).
+     */
+    size_t LookupBytes( void ) const;
+    
+    /**
+     * \brief Number of axes in the table.
+     */
+    size_t Size( void ) const;
+    
+    /**
+     * \brief Normalise a block of raw axis values in one pass.
+     *
+     * \param[in] raw Raw values, one per axis.
+     * \param[out] dest Normalised values.
+     * \param[in] len Number of axes to normalise (at most Size()).
+     */
+    void Normalise( const int32_t *raw, double *dest, size_t len );
+    
+    /**
+     * \brief Scale a block of raw axis values without integrating the relative axes,
+     *  which read as their position since their counters started. Unlike Normalise this
+     *  doesn't change the table, so it can be called from any thread.
+     *
+     * \param[in] raw Raw values, one per axis.
+     * \param[out] dest Scaled values.
+     * \param[in] len Number of axes to scale (at most Size()).
+     */
+    void Scale( const int32_t *raw, double *dest, size_t len ) const;
+    
+    /**
+     * \brief Integrate the relative axes of a block of raw axis values in place, as
+     *  Normalise does, but leave them as counts: each relative axis becomes its position
+     *  since the origin (saturated to 32 bits) or its change. Absolute axes are left
+     *  alone, and no lookup table is used.
+     *
+     * \param[in,out] values Raw values, one per axis.
+     * \param[in] len Number of axes (at most Size()).
+     */
+    void Counts( int32_t *values, size_t len );
+    
+    /**
+     * \brief Logical range of an axis.
+     *
+     * \param[in] axis Index of the axis.
+     * \param[out] logmin Logical minimum.
+     * \param[out] logmax Logical maximum.
+     */
+    void Range( size_t axis, int32_t &logmin, int32_t &logmax ) const;
+    
+  private:
+    std::vector<double> myScale, myOffset;
+    // Logical ranges, and where each axis' table starts in myLookup (or NO_LOOKUP)
+    std::vector<int32_t> myMin, myMax;
+    std::vector<size_t> myLookupStart;
+    std::vector<double> myLookup;
+    size_t myNumLookups;
+    // Indices of relative axes, their accumulated raw values since the origin, and
+    // the counters last read
+    std::vector<size_t> myRelative;
+    std::vector<double> myAccum;
+    std::vector<int32_t> myLastCount;
+    AxisRelativeMode myRelativeMode;
+    
+    /**
+     * \brief Overwrite the relative axes with their positions or changes.
+     */
+    void AccumulateRelative( const int32_t *raw, double *dest, size_t len );
+};
+
+#endif
@@ -0,0 +1,458 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Benchmark of the poll and push paths, run against the synthetic HID backend in
+ * fakehid/ so that it builds and runs without IOKit or Matlab ('make bench', or
+ * 'make test' to build and run it).
+ *
+ * The checks run first, each on known values (see bench.hpp for where each lives).
+ * Any mismatch fails the run, and so does any allocation by the calling thread in an
+ * operation that should never allocate (the *Into polls, PushInputs[] and PushChanged,
+ * whose asynchronous reports must not allocate either).
+ *
+ * Every benchmark device has N axes, N buttons, N POV hats and N outputs. For each N
+ * and acquisition mode, each operation is timed over enough iterations to touch about
+ * a million elements, and reported as nanoseconds, heap allocations and IOKit calls
+ * per operation, and elements per second. PollAxesInto is timed again with every stage
+ * of the axis processing on every axis (PollAxesPiped), and without the filter, so all
+ * in the lookup tables (PollAxesShaped).
+ *
+ * Groups of joysticks, shared joysticks published by the acquisition daemon, capture
+ * and replay, button edge stores, the force feedback effect loop and (on Linux) the
+ * evdev and hidraw backends are then timed in turn.
+ */
+
+#include "bench.hpp"
+#include "joygroup.hpp"
+#include "joyeffects.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <new>
+#include <unistd.h>
+
+// Heap allocations made since the start, counted by the replacement operator new
+volatile uint64_t allocations = 0;
+static __thread uint64_t threadAllocations = 0;
+
+void *operator new( size_t size ) throw( std::bad_alloc )
+{
+  __sync_fetch_and_add( &allocations, 1 );
+  threadAllocations++;
+  void *ptr = malloc( size > 0 ? size : 1 );
+  if( ptr == NULL ) throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[]( size_t size ) throw( std::bad_alloc )
+{
+  return operator new( size );
+}
+
+void operator delete( void *ptr ) throw()
+{
+  free( ptr );
+}
+
+void operator delete[]( void *ptr ) throw()
+{
+  free( ptr );
+}
+
+/**
+ * \brief Heap allocations made by the calling thread since it started.
+ */
+uint64_t ThreadAllocations( void )
+{
+  return threadAllocations;
+}
+
+const size_t elementCounts[] = { 4, 16, 64, 256, 1024 };
+const size_t numElementCounts = sizeof(elementCounts)/sizeof(elementCounts[0]);
+static const size_t groupSizes[] = { 1, 2, 4, 8, 16, 32 };
+static const size_t numGroupSizes = sizeof(groupSizes)/sizeof(groupSizes[0]);
+// Elements per device, for the group benchmark
+static const size_t groupElements = 16;
+// Elements touched by each timed run
+static const size_t elementsPerRun = 1000000;
+
+static int32_t GroupLocation( size_t member ) { return (int32_t)( 0x200000 + member ); }
+
+/**
+ * \brief The operation being timed.
+ */
+enum BenchOp
+{
+  kBench_PollAxes,
+  kBench_PollAxesInto,
+  kBench_PollAxesInt16,
+  kBench_PollAxesFloat,
+  kBench_PollButtons,
+  kBench_PollButtonsInto,
+  kBench_PollPOV,
+  kBench_PollPOVInto,
+  kBench_PushInputs,
+  kBench_PushInputsArray,
+  kBench_PushChanged,
+  kBench_NumOps
+};
+
+static const char *opNames[ kBench_NumOps ] = { "PollAxes", "PollAxesInto", "PollAxes<int16>",
+   "PollAxes<float>", "PollButtons", "PollButtonsInto", "PollPOV", "PollPOVInto", "PushInputs", "PushInputs[]", "PushChanged" };
+
+// The operations that must never allocate, once warmed up
+static const bool opAllocationFree[ kBench_NumOps ] = { false, true, false, false, false, true,
+                                                        false, true, false, true, true };
+
+/**
+ * \brief Buffers reused across iterations by the *Into and array variants.
+ */
+struct BenchBuffers
+{
+  BenchBuffers( size_t n ) : values( n, 0.5 ), counts( n, 0 ), singles( n, 0.5f ), pressed( n, 0 ),
+    inputs( n, 0.25 ) {}
+  vector<double> values;
+  vector<int16_t> counts;
+  vector<float> singles;
+  vector<uint8_t> pressed;
+  vector<double> inputs;
+};
+
+/**
+ * \brief Run one operation once. Returns something derived from the result, so that
+ *  the call can't be optimised away.
+ */
+static double RunOp( Joystick &joy, BenchOp op, BenchBuffers &buf )
+{
+  size_t n = buf.values.size();
+  switch( op )
+  {
+    case kBench_PollAxes: return joy.PollAxes()[ 0 ];
+    case kBench_PollAxesInto: joy.PollAxesInto( &buf.values[0], n ); return buf.values[ 0 ];
+    case kBench_PollAxesInt16: joy.PollAxes( &buf.counts[0], n ); return buf.counts[ 0 ];
+    case kBench_PollAxesFloat: joy.PollAxes( &buf.singles[0], n ); return buf.singles[ 0 ];
+    case kBench_PollButtons: return joy.PollButtons()[ 0 ] ? 1.0 : 0.0;
+    case kBench_PollButtonsInto: joy.PollButtonsInto( &buf.pressed[0], n ); return buf.pressed[ 0 ];
+    case kBench_PollPOV: return joy.PollPOV()[ 0 ];
+    case kBench_PollPOVInto: joy.PollPOVInto( &buf.values[0], n ); return buf.values[ 0 ];
+    case kBench_PushInputs: joy.PushInputs( buf.inputs ); return 0.0;
+    case kBench_PushInputsArray: joy.PushInputs( &buf.inputs[0], n ); return 0.0;
+    case kBench_PushChanged:
+      // Every output changes on every push
+      for( size_t ii=0; ii<n; ii++ ) buf.inputs[ ii ] = 1.0 - buf.inputs[ ii ];
+      joy.PushInputs( &buf.inputs[0], n );
+      return 0.0;
+    default: return 0.0;
+  }
+}
+
+/**
+ * \brief Print one line of poll and push results.
+ */
+void Report( const char *name, const char *mode, size_t elements, size_t iterations,
+                    uint64_t ticks, uint64_t allocs, uint64_t calls )
+{
+  double seconds = JoyTicksToSeconds( ticks );
+  printf( "%-16s %-8s %6lu %12.1f %10.2f %10.2f %12.1f\n", name, mode, (unsigned long)elements,
+          seconds*1e9/(double)iterations, (double)allocs/(double)iterations,
+          (double)calls/(double)iterations, (double)( elements*iterations )/seconds*1e-6 );
+}
+
+/**
+ * \brief Print one line of per event results.
+ */
+void ReportCapture( const char *name, const char *mode, size_t events, uint64_t ticks,
+                    uint64_t allocs )
+{
+  double seconds = JoyTicksToSeconds( ticks );
+  printf( "%-16s %-8s %6lu %12.1f %10.3f %12.1f\n", name, mode, (unsigned long)events,
+          seconds*1e9/(double)events, (double)allocs/(double)events,
+          (double)events/seconds*1e-6 );
+}
+
+/**
+ * \brief Whether a processed value is the expected one.
+ */
+bool Near( double value, double expected )
+{
+  return fabs( value - expected ) < 1e-9;
+}
+
+/**
+ * \brief Print a failed check.
+ *
+ * \param[in] name What was checked.
+ * \param[in] failure What went wrong, or NULL if the check passed.
+ * \return true if the check passed.
+ */
+static bool RunCheck( const char *name, const char *failure )
+{
+  if( failure != NULL ) printf( "%s: %s.\n", name, failure );
+  return failure == NULL;
+}
+
+/**
+ * \brief Check that a change of an input reaches PollAxes. Event driven joysticks are
+ *  given up to a second to deliver it.
+ */
+static bool CheckDelivery( Joystick &joy, int32_t location )
+{
+  bool ok = false;
+  FakeHIDSetInput( location, 0, 1023 );
+  for( size_t ii=0; ii<1000 && !ok; ii++ )
+  {
+    ok = joy.PollAxes()[ 0 ] > 0.99;
+    if( !ok ) usleep( 1000 );
+  }
+  FakeHIDSetInput( location, 0, 512 );
+  return ok;
+}
+
+/**
+ * \brief Push a value to every output until one of them reaches the device, allowing a
+ *  second for asynchronous reports in flight.
+ */
+static bool CheckPush( Joystick &joy, int32_t location, size_t element, vector<double> &inputs,
+                                                                            double value )
+{
+  inputs.assign( inputs.size(), value );
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    joy.PushInputs( inputs );
+    if( FakeHIDGetValue( location, element ) == (long)( 1023*value ) ) return true;
+    usleep( 1000 );
+  }
+  return false;
+}
+
+/**
+ * \brief Time PollAxesInto with every axis processed (see BenchAxisProcessing).
+ *
+ * \param[in] cutoff Low pass cutoff (Hz), or 0 for no filters.
+ */
+static bool TimeAxisProcessing( Joystick &joy, size_t numElements, const char *modeName,
+                                const char *name, double cutoff, BenchBuffers &buf )
+{
+  vector<AxisProcessing> config( numElements, BenchAxisProcessing() );
+  for( size_t ii=0; ii<numElements; ii++ ) config[ ii ].cutoff = cutoff;
+  if( !joy.SetAxisProcessing( &config[0], config.size(), 1000.0 ) )
+  {
+    printf( "Unable to process the axes of the %lu element device.\n", (unsigned long)numElements );
+    return false;
+  }
+  size_t iterations = elementsPerRun/numElements;
+  double sink = 0.0;
+  for( size_t ii=0; ii<16; ii++ ) sink += RunOp( joy, kBench_PollAxesInto, buf );
+  uint64_t allocs = allocations, calls = FakeHIDCallCount();
+  uint64_t start = JoyNowTicks();
+  for( size_t ii=0; ii<iterations; ii++ ) sink += RunOp( joy, kBench_PollAxesInto, buf );
+  uint64_t ticks = JoyNowTicks() - start;
+  Report( name, modeName, numElements, iterations, ticks, allocations - allocs,
+          FakeHIDCallCount() - calls );
+  joy.ClearAxisProcessing();
+  return sink == sink;
+}
+
+/**
+ * \brief Time every operation on an N element device, in one acquisition mode.
+ */
+bool BenchDevice( size_t numElements, JoystickAcquisition mode, const char *modeName )
+{
+  int32_t location = DeviceLocation( numElements );
+  Joystick joy;
+  if( !joy.Initialise( location, mode ) )
+  {
+    printf( "Unable to initialise the %lu element device.\n", (unsigned long)numElements );
+    return false;
+  }
+  if( !CheckDelivery( joy, location ) )
+  {
+    printf( "A change of input didn't reach the %lu element device.\n", (unsigned long)numElements );
+    return false;
+  }
+  
+  BenchBuffers buf( numElements );
+  size_t iterations = elementsPerRun/numElements;
+  double sink = 0.0;
+  // Shared joysticks can't push to the device
+  size_t numOps = mode == kJoystick_Shared ? (size_t)kBench_PushInputs : (size_t)kBench_NumOps;
+  for( size_t op=0; op<numOps; op++ )
+  {
+    // Warm up, so that first time growth of any buffer isn't counted
+    for( size_t ii=0; ii<16; ii++ ) sink += RunOp( joy, (BenchOp)op, buf );
+    
+    uint64_t allocs = allocations, calls = FakeHIDCallCount(), own = ThreadAllocations();
+    uint64_t start = JoyNowTicks();
+    for( size_t ii=0; ii<iterations; ii++ ) sink += RunOp( joy, (BenchOp)op, buf );
+    uint64_t ticks = JoyNowTicks() - start;
+    Report( opNames[ op ], modeName, numElements, iterations, ticks,
+            allocations - allocs, FakeHIDCallCount() - calls );
+    if( opAllocationFree[ op ] && ThreadAllocations() != own )
+    {
+      printf( "%s allocated %lu times on the %lu element device (%s).\n", opNames[ op ],
+              (unsigned long)( ThreadAllocations() - own ), (unsigned long)numElements, modeName );
+      return false;
+    }
+  }
+  
+  // PollAxesInto again, with every stage of the axis processing on every axis, then
+  // without the filters (so all in the lookup tables)
+  if( !TimeAxisProcessing( joy, numElements, modeName, "PollAxesPiped", 20.0, buf ) ||
+      !TimeAxisProcessing( joy, numElements, modeName, "PollAxesShaped", 0.0, buf ) ) return false;
+  
+  // The outputs should end up with the last pushed value. An asynchronous report still
+  // in flight holds the newest values back until a later push.
+  if( mode != kJoystick_Shared && !CheckPush( joy, location, 4*numElements - 1, buf.inputs, 0.25 ) )
+  {
+    printf( "PushInputs didn't reach the %lu element device.\n", (unsigned long)numElements );
+    return false;
+  }
+  return sink == sink;
+}
+
+/**
+ * \brief Time JoystickGroup::PollInto over groups of event driven joysticks.
+ */
+static bool BenchGroup( size_t numMembers )
+{
+  vector<int32_t> locations( numMembers );
+  for( size_t ii=0; ii<numMembers; ii++ ) locations[ ii ] = GroupLocation( ii );
+  JoystickGroup group;
+  if( !group.Initialise( &locations[0], numMembers, kJoystick_EventDriven ) )
+  {
+    printf( "Unable to initialise a group of %lu.\n", (unsigned long)numMembers );
+    return false;
+  }
+  
+  size_t numElements = numMembers*groupElements;
+  vector<double> axes( numElements ), povs( numElements );
+  vector<uint8_t> buttons( numElements );
+  size_t iterations = elementsPerRun/numElements;
+  for( size_t ii=0; ii<16; ii++ ) group.PollInto( &axes[0], &buttons[0], &povs[0] );
+  
+  uint64_t allocs = allocations, calls = FakeHIDCallCount();
+  uint64_t start = JoyNowTicks();
+  for( size_t ii=0; ii<iterations; ii++ ) group.PollInto( &axes[0], &buttons[0], &povs[0] );
+  uint64_t ticks = JoyNowTicks() - start;
+  char name[32];
+  snprintf( name, sizeof(name), "Group(%lu)", (unsigned long)numMembers );
+  Report( name, "event", numElements, iterations, ticks, allocations - allocs,
+          FakeHIDCallCount() - calls );
+  return true;
+}
+
+int main( int argc, char *argv[] )
+{
+  if( argc == 3 && strcmp( argv[ 1 ], "--shared-reader" ) == 0 )
+  {
+    return RunSharedReader( (int32_t)atoi( argv[ 2 ] ) );
+  }
+  
+  // The devices must be attached before the registry first looks for them
+  for( size_t ii=0; ii<numElementCounts; ii++ )
+  {
+    FakeHIDDeviceSpec spec = { DeviceLocation( elementCounts[ ii ] ), "Benchmark joystick",
+                   elementCounts[ ii ], elementCounts[ ii ], elementCounts[ ii ], elementCounts[ ii ], 0 };
+    FakeHIDAttach( spec );
+  }
+  for( size_t ii=0; ii<groupSizes[ numGroupSizes-1 ]; ii++ )
+  {
+    FakeHIDDeviceSpec spec = { GroupLocation( ii ), "Benchmark group member",
+                               groupElements, groupElements, groupElements, 0, 0 };
+    FakeHIDAttach( spec );
+  }
+  FakeHIDDeviceSpec captureSpec = { captureLocation, "Captured joystick", captureAxes,
+                                    captureButtons, capturePOVs, 2, 0 };
+  FakeHIDAttach( captureSpec );
+  FakeHIDDeviceSpec outputSpec = { outputLocation, "Output report joystick", 1, 1, 0, outputCount, 0 };
+  FakeHIDAttach( outputSpec );
+  FakeHIDDeviceSpec effectSpec = { effectLocation, "Force feedback joystick", 2, 0, 0, 2, 0 };
+  FakeHIDAttach( effectSpec );
+  FakeHIDDeviceSpec edgeSpec = { edgeLocation, "Button edge joystick", 1, edgeButtons, 0, 0, 0 };
+  FakeHIDAttach( edgeSpec );
+  FakeHIDDeviceSpec relativeSpec = { relativeLocation, "Trackball", 3, 0, 0, 0, 2 };
+  FakeHIDAttach( relativeSpec );
+  FakeHIDDeviceSpec typedSpec = { typedLocation, "Typed joystick", 2, 0, 1, 0, 1 };
+  FakeHIDAttach( typedSpec );
+  FakeHIDDeviceSpec removedSpec = { removedLocation, "Removed joystick", 1, 1, 0, 0, 0 };
+  FakeHIDAttach( removedSpec );
+  FakeHIDDeviceSpec reportSpec = { reportLocation, "Raw report joystick", 2, reportButtons,
+                                   reportPOVs, 0, 1 };
+  FakeHIDAttach( reportSpec );
+  
+  // The checks. The C interface reads the typed joystick as the typed polls left it.
+  bool ok = RunCheck( "Axis processing", CheckAxisPipeline() );
+  ok = ok && RunCheck( "Output reports (polled)", CheckOutputReports( kJoystick_Polled ) );
+  ok = ok && RunCheck( "Output reports (event)", CheckOutputReports( kJoystick_EventDriven ) );
+  ok = ok && RunCheck( "Output reports (raw)", CheckOutputReports( kJoystick_RawReports ) );
+  ok = ok && RunCheck( "Report descriptors", CheckReportDescriptors() );
+  ok = ok && RunCheck( "Packed reports", CheckPackedReports() );
+  ok = ok && RunCheck( "Raw reports", CheckRawReports() );
+  ok = ok && RunCheck( "Button edges", CheckButtonEdges() );
+  ok = ok && RunCheck( "Edge queue swaps", CheckEdgeRingSwaps() );
+  ok = ok && RunCheck( "Button mask kernels", CheckButtonMaskKernels() );
+  ok = ok && RunCheck( "Session sharing", CheckSessionSharing() );
+  ok = ok && RunCheck( "Hotplug removal", CheckHotplugRemoval() );
+  ok = ok && RunCheck( "Snapshot reads", CheckSnapshotReads() );
+  ok = ok && RunCheck( "Performance counters", CheckPerfCounters() );
+  ok = ok && RunCheck( "Relative axes", CheckRelativeAxes() );
+  ok = ok && RunCheck( "Typed polls", CheckTypedPolls() );
+  ok = ok && RunCheck( "C interface", CheckCInterface() );
+  ok = ok && RunCheck( "Stopped daemon", CheckStoppedDaemon() );
+  ok = ok && RunCheck( "Time stamps (polled)", CheckTimeStamps( kJoystick_Polled ) );
+  ok = ok && RunCheck( "Time stamps (event)", CheckTimeStamps( kJoystick_EventDriven ) );
+  ok = ok && RunCheck( "Time stamps (raw)", CheckTimeStamps( kJoystick_RawReports ) );
+  
+  // The timings, which also check what they time
+  if( ok ) printf( "%-16s %-8s %6s %12s %10s %10s %12s\n", "operation", "mode", "N", "ns/op",
+                   "allocs/op", "iokit/op", "Melem/s" );
+  for( size_t ii=0; ii<numElementCounts && ok; ii++ )
+  {
+    ok = BenchDevice( elementCounts[ ii ], kJoystick_Polled, "polled" ) &&
+         BenchDevice( elementCounts[ ii ], kJoystick_EventDriven, "event" );
+  }
+  for( size_t ii=0; ii<numGroupSizes && ok; ii++ ) ok = BenchGroup( groupSizes[ ii ] );
+  ok = ok && BenchShared( argv[ 0 ] );
+  if( ok ) printf( "\n%-16s %-8s %6s %12s %10s %12s\n", "capture", "clock", "N",
+                   "ns/each", "allocs/ea", "M/s" );
+  ok = ok && BenchCapture();
+  if( ok ) TimeButtonEdges();
+  if( ok ) printf( "\n%-16s %-8s %6s %12s %10s %12s\n", "buttons", "kernel", "N", "ns/op",
+                   "x scalar", "Mbutton/s" );
+  if( ok ) TimeButtonMask();
+  if( ok ) printf( "\n%-16s %8s %8s %10s %10s %10s %10s %9s %7s\n", "effects", "Hz", "ticks",
+                   "late-us", "std-us", "p99-us", "max-us", "overruns", "errors" );
+  ok = ok && BenchEffects( JOY_EFFECT_RATE ) && BenchEffects( 4*JOY_EFFECT_RATE );
+#ifdef __linux__
+  ok = ok && BenchStreams();
+#endif
+  if( !ok ) printf( "\nFAILED\n" );
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/*
+ * Shared parts of the benchmark ('make bench'). bench.cpp times the poll and push paths
+ * and runs every check; the checks of each feature live in their own file:
+ *
+ *  benchaxes.cpp     Axis processing, lookup tables, relative axes and typed polls.
+ *  benchbuttons.cpp  Button edges and the button mask kernels.
+ *  benchoutputs.cpp  Output reports and the force feedback effect engine.
+ *  benchcapture.cpp  Capture recording and replay.
+ *  benchshared.cpp   The acquisition daemon and the C interface.
+ *  benchsessions.cpp The session pool, and groups sharing its joysticks.
+ *  benchsnapshot.cpp The snapshot seqlock and frame ring under a scripted writer.
+ *  benchreports.cpp  Report descriptors, report decoding and raw report acquisition.
+ *  benchstreams.cpp  The Linux evdev and hidraw backends.
+ *
+ * Checks return NULL if successful, or what went wrong, and any failure fails the run.
+ */
+
+#include "osx_joystick.hpp"
+#include "fakehid/fakehid.h"
+
+// Heap allocations made since the start, counted by the replacement operator new
+extern volatile uint64_t allocations;
+
+/**
+ * \brief Heap allocations made by the calling thread since it started. Unlike
+ *  allocations, this doesn't count the acquisition and effect threads.
+ */
+uint64_t ThreadAllocations( void );
+
+// Element counts of the benchmark devices (N axes, buttons, POVs and outputs each)
+extern const size_t elementCounts[];
+extern const size_t numElementCounts;
+
+// The output report device: an axis, a button and 12 outputs of 10 bits, sent as two
+// reports (IDs 2 and 3)
+static const int32_t outputLocation = 0x400000;
+static const size_t outputCount = 12;
+
+// The force feedback device: 2 axes, then 2 outputs
+static const int32_t effectLocation = 0x500000;
+
+// The captured device
+static const int32_t captureLocation = 0x300000;
+static const size_t captureAxes = 16, captureButtons = 16, capturePOVs = 4;
+
+// The button edge device
+static const int32_t edgeLocation = 0x600000;
+static const size_t edgeButtons = 8;
+
+// The relative axis device: two relative axes, then an absolute one used as a marker
+static const int32_t relativeLocation = 0x700000;
+
+// The typed poll device: a relative axis, an absolute axis and a POV
+static const int32_t typedLocation = 0x800000;
+
+// The device removed from the registry by the hotplug check
+static const int32_t removedLocation = 0x900000;
+
+// The raw report device: a relative axis, an absolute axis, 10 buttons and 2 POVs
+static const int32_t reportLocation = 0xA00000;
+static const size_t reportButtons = 10, reportPOVs = 2;
+
+/**
+ * \brief Location of the benchmark device with N elements of each type.
+ */
+inline int32_t DeviceLocation( size_t numElements ) { return (int32_t)( 0x100000 + numElements ); }
+
+/**
+ * \brief Whether a processed value is the expected one.
+ */
+bool Near( double value, double expected );
+
+/**
+ * \brief Print one line of poll and push results.
+ */
+void Report( const char *name, const char *mode, size_t elements, size_t iterations,
+             uint64_t ticks, uint64_t allocs, uint64_t calls );
+
+/**
+ * \brief Print one line of per event results.
+ */
+void ReportCapture( const char *name, const char *mode, size_t events, uint64_t ticks,
+                    uint64_t allocs );
+
+/**
+ * \brief Time every operation on an N element device, in one acquisition mode.
+ */
+bool BenchDevice( size_t numElements, JoystickAcquisition mode, const char *modeName );
+
+// benchaxes.cpp
+AxisProcessing BenchAxisProcessing( void );
+const char *CheckAxisPipeline( void );
+const char *CheckRelativeAxes( void );
+const char *CheckTypedPolls( void );
+
+// benchbuttons.cpp
+const char *CheckButtonEdges( void );
+const char *CheckEdgeRingSwaps( void );
+const char *CheckButtonMaskKernels( void );
+void TimeButtonEdges( void );
+void TimeButtonMask( void );
+
+// benchoutputs.cpp
+const char *CheckOutputReports( JoystickAcquisition mode );
+bool BenchEffects( double rate );
+
+// benchcapture.cpp
+bool BenchCapture( void );
+
+// benchshared.cpp
+const char *CheckCInterface( void );
+const char *CheckStoppedDaemon( void );
+int RunSharedReader( int32_t location );
+bool BenchShared( const char *program );
+
+// benchsessions.cpp
+const char *CheckSessionSharing( void );
+const char *CheckHotplugRemoval( void );
+
+// benchsnapshot.cpp
+const char *CheckSnapshotReads( void );
+
+// benchstats.cpp
+const char *CheckPerfCounters( void );
+
+// benchtimes.cpp
+const char *CheckTimeStamps( JoystickAcquisition mode );
+
+// benchreports.cpp
+const char *CheckReportDescriptors( void );
+const char *CheckPackedReports( void );
+const char *CheckRawReports( void );
+
+#ifdef __linux__
+// benchstreams.cpp
+bool BenchStreams( void );
+#endif
+
+#endif
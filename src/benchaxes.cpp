@@ -0,0 +1,368 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Checks of the axis processing: each stage on known values, the lookup tables against
+ * the arithmetic, relative axes and the typed polls.
+ */
+
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+
+/**
+ * \brief Axis processing using every stage.
+ */
+AxisProcessing BenchAxisProcessing( void )
+{
+  AxisProcessing config = AxisProcessingDefaults();
+  config.calMin = -0.9;
+  config.calCentre = 0.05;
+  config.calMax = 0.95;
+  config.deadzone = 0.05;
+  config.edge = 0.02;
+  config.curve = kAxisCurve_Cubic;
+  config.curveAmount = 0.3;
+  config.cutoff = 20.0;
+  return config;
+}
+
+/**
+ * \brief Check the axis lookup tables against the arithmetic: which axes get a table,
+ *  that tables are shared and capped, and that they give the same values, with and
+ *  without shaping baked in.
+ *
+ * \return NULL if successful, or what went wrong.
+ */
+static const char *CheckAxisLookup( void )
+{
+  AxisTable table;
+  table.Add( 0, 1023, false );
+  table.Add( -32768, 32767, false );
+  table.Add( 0, 1023, false );
+  table.Add( 0, 1 << 20, false );
+  table.Add( -127, 127, true );
+  if( table.BuildLookup() != 3 || !table.HasLookup( 2 ) || table.HasLookup( 3 ) || table.HasLookup( 4 ) )
+    return "the wrong axes have lookup tables";
+  if( table.LookupBytes() != ( 1024 + 65536 )*sizeof(double) ) return "the lookup tables aren't shared";
+  
+  AxisPipeline shaping;
+  AxisProcessing config[ 5 ];
+  for( size_t ii=0; ii<5; ii++ ) config[ ii ] = BenchAxisProcessing();
+  config[ 0 ].cutoff = config[ 1 ].cutoff = config[ 2 ].cutoff = 0.0;
+  config[ 2 ].curve = kAxisCurve_Expo;
+  config[ 2 ].curveAmount = 1.5;
+  if( !shaping.Configure( config, 5, 5, 1000.0 ) ) return "the shaping was refused";
+  
+  const int32_t raws[][ 5 ] = { { 0, -32768, 0, 0, 3 }, { 512, 0, 600, 1 << 19, -5 },
+                                { 1023, 32767, 1023, 1 << 20, 0 }, { 100, -1000, 900, 7, 1 } };
+  for( size_t pass=0; pass<2; pass++ )
+  {
+    AxisTable plain, looked;
+    for( size_t ii=0; ii<2; ii++ )
+    {
+      AxisTable &t = ii == 0 ? plain : looked;
+      t.Add( 0, 1023, false );
+      t.Add( -32768, 32767, false );
+      t.Add( 0, 1023, false );
+      t.Add( 0, 1 << 20, false );
+      t.Add( -127, 127, true );
+    }
+    looked.BuildLookup( pass == 1 ? &shaping : NULL );
+    for( size_t row=0; row<4; row++ )
+    {
+      double expected[ 5 ], value[ 5 ];
+      plain.Normalise( raws[ row ], expected, 5 );
+      for( size_t ii=0; ii<5 && pass == 1; ii++ )
+      {
+        if( looked.HasLookup( ii ) ) expected[ ii ] = shaping.Shape( ii, expected[ ii ] );
+      }
+      looked.Normalise( raws[ row ], value, 5 );
+      // Axes without a table are left to the pipeline
+      for( size_t ii=0; ii<5; ii++ )
+      {
+        if( fabs( value[ ii ] - expected[ ii ] ) > 1e-12 ) return "a lookup table disagrees with the arithmetic";
+      }
+    }
+  }
+  if( table.BuildLookup( NULL, 1024*sizeof(double) ) != 2 ) return "the memory cap wasn't kept";
+  return NULL;
+}
+
+/**
+ * \brief Check the scaling of raw counts over known logical ranges, including
+ *  negative and degenerate ones, with and without a lookup table. Counts outside the
+ *  range read as the nearest end either way, and so do those of an axis too wide for
+ *  a table.
+ *
+ * \return NULL if successful, or what went wrong.
+ */
+static const char *CheckAxisScaling( void )
+{
+  // Logical minimum, logical maximum, raw count and the expected value
+  const struct { long logmin, logmax; int32_t raw; double expected; } cases[] = {
+    { 0, 1023, 0, -1.0 }, { 0, 1023, 1023, 1.0 }, { 0, 1000, 250, -0.5 },
+    { -32768, 32767, -32768, -1.0 }, { -32768, 32767, 32767, 1.0 },
+    { -100, 100, 0, 0.0 }, { -100, 100, 50, 0.5 }, { -50, 150, 100, 0.5 },
+    { -1000, -200, -600, 0.0 }, { -1000, -200, -1000, -1.0 }, { 1, 3, 2, 0.0 },
+    { 5, 5, 5, 0.0 }, { 0, 1023, 1500, 1.0 }, { 0, 1023, -7, -1.0 },
+    { -100, 100, -300, -1.0 }, { -1000, -200, 0, 1.0 }, { -100000, 100000, 250000, 1.0 },
+    { -100000, 100000, -100001, -1.0 } };
+  const size_t numCases = sizeof(cases)/sizeof(cases[0]);
+  
+  AxisTable table;
+  int32_t raw[ numCases ];
+  size_t numLookups = 0;
+  for( size_t ii=0; ii<numCases; ii++ )
+  {
+    table.Add( cases[ ii ].logmin, cases[ ii ].logmax, false );
+    raw[ ii ] = cases[ ii ].raw;
+    if( cases[ ii ].logmax - cases[ ii ].logmin < AXIS_LOOKUP_MAX_ENTRIES ) numLookups++;
+  }
+  double value[ numCases ], scaled[ numCases ];
+  for( size_t pass=0; pass<2; pass++ )
+  {
+    if( pass == 1 && table.BuildLookup() != numLookups ) return "an axis has no lookup table";
+    table.Normalise( raw, value, numCases );
+    table.Scale( raw, scaled, numCases );
+    for( size_t ii=0; ii<numCases; ii++ )
+    {
+      if( !Near( value[ ii ], cases[ ii ].expected ) )
+        return pass == 0 ? "a raw count was scaled wrongly" : "a lookup table entry is wrong";
+      if( !Near( scaled[ ii ], cases[ ii ].expected ) ) return "Scale disagrees with Normalise";
+    }
+  }
+  return NULL;
+}
+
+/**
+ * \brief Check each axis processing stage on known values, the reading of an axis
+ *  processing file, the scaling of raw counts and the lookup tables.
+ */
+const char *CheckAxisPipeline( void )
+{
+  AxisProcessing config[ 4 ];
+  for( size_t ii=0; ii<4; ii++ ) config[ ii ] = AxisProcessingDefaults();
+  config[ 0 ].calMin = -0.8;
+  config[ 0 ].calCentre = 0.1;
+  config[ 0 ].calMax = 0.9;
+  config[ 1 ].deadzone = 0.1;
+  config[ 1 ].edge = 0.1;
+  config[ 2 ].curve = kAxisCurve_Cubic;
+  config[ 2 ].curveAmount = 1.0;
+  config[ 3 ].curve = kAxisCurve_Expo;
+  config[ 3 ].curveAmount = 2.0;
+  
+  AxisPipeline pipeline;
+  const char *failure = NULL;
+  double v[ 4 ];
+  if( !pipeline.Configure( config, 4, 4, 1000.0 ) ) failure = "a valid configuration was refused";
+  double a[ 4 ] = { 0.1, 0.05, 0.5, 1.0 }, b[ 4 ] = { 0.9, 0.5, -0.5, -1.0 };
+  double c[ 4 ] = { -0.8, 0.95, 0.0, 0.0 };
+  std::copy( a, a + 4, v );
+  pipeline.Process( v, 4 );
+  if( failure == NULL && !( Near( v[0], 0.0 ) && Near( v[1], 0.0 ) && Near( v[2], 0.125 ) && Near( v[3], 1.0 ) ) )
+    failure = "wrong values at the centres";
+  std::copy( b, b + 4, v );
+  pipeline.Process( v, 4 );
+  if( failure == NULL && !( Near( v[0], 1.0 ) && Near( v[1], 0.5 ) && Near( v[2], -0.125 ) && Near( v[3], -1.0 ) ) )
+    failure = "wrong values off centre";
+  std::copy( c, c + 4, v );
+  pipeline.Process( v, 4 );
+  if( failure == NULL && !( Near( v[0], -1.0 ) && Near( v[1], 1.0 ) ) ) failure = "wrong values at the ends";
+  
+  // A 10 Hz low pass at 1 kHz, primed at 0, then given a step
+  config[ 0 ] = AxisProcessingDefaults();
+  config[ 0 ].cutoff = 10.0;
+  if( failure == NULL && !pipeline.Configure( config, 1, 1, 1000.0 ) ) failure = "the filter was refused";
+  v[ 0 ] = 0.0;
+  pipeline.Process( v, 1 );
+  v[ 0 ] = 1.0;
+  pipeline.Process( v, 1 );
+  double first = v[ 0 ];
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    v[ 0 ] = 1.0;
+    pipeline.Process( v, 1 );
+  }
+  if( failure == NULL && !( first > 0.0 && first < 0.01 && fabs( v[ 0 ] - 1.0 ) < 1e-6 ) ) failure = "wrong step response";
+  config[ 0 ].cutoff = 600.0;
+  if( failure == NULL && pipeline.Configure( config, 1, 1, 1000.0 ) ) failure = "a cutoff above Nyquist was accepted";
+  
+  // The same settings from a file
+  char path[64];
+  snprintf( path, sizeof(path), "/tmp/bench_axes_%d.txt", (int)getpid() );
+  FILE *file = fopen( path, "w" );
+  if( file != NULL )
+  {
+    fprintf( file, "# Every axis, then the second\n* curve=expo amount=2\n2 deadzone=0.1 edge=0.1 curve=linear\n" );
+    fclose( file );
+  }
+  vector<AxisProcessing> read;
+  if( failure == NULL && !ReadAxisProcessing( path, 3, read ) ) failure = "the file couldn't be read";
+  else if( failure == NULL && !( read[ 0 ].curve == kAxisCurve_Expo && read[ 2 ].curveAmount == 2.0 &&
+                                 read[ 1 ].curve == kAxisCurve_Linear && read[ 1 ].deadzone == 0.1 ) )
+    failure = "the file was misread";
+  unlink( path );
+  
+  if( failure == NULL ) failure = CheckAxisScaling();
+  if( failure == NULL ) failure = CheckAxisLookup();
+  return failure;
+}
+
+
+/**
+ * \brief Send changes to the relative axes of the trackball without polling, then
+ *  move its absolute axis to a marker value, and poll until the marker arrives. The
+ *  changes are delivered in order, so they have all been integrated by then.
+ *
+ * \param[in,out] joy Trackball joystick.
+ * \param[in] steps Number of changes sent to each relative axis.
+ * \param[in] marker Raw value of the absolute axis.
+ * \param[out] sums Sum of the polled values of the relative axes, 2 long.
+ * \param[out] last Last polled values of the relative axes, 2 long.
+ */
+static bool MoveTrackball( Joystick &joy, size_t steps, long marker, double *sums, double *last )
+{
+  for( size_t ii=0; ii<steps; ii++ )
+  {
+    FakeHIDSetInput( relativeLocation, 0, 5 );
+    FakeHIDSetInput( relativeLocation, 1, -3 );
+  }
+  FakeHIDSetInput( relativeLocation, 2, marker );
+  double axes[ 3 ];
+  sums[ 0 ] = sums[ 1 ] = 0.0;
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    joy.PollAxesInto( axes, 3 );
+    sums[ 0 ] += axes[ 0 ];
+    sums[ 1 ] += axes[ 1 ];
+    if( axes[ 2 ] == 2.0*(double)marker/1023.0 - 1.0 ) break;
+    usleep( 1000 );
+  }
+  last[ 0 ] = axes[ 0 ];
+  last[ 1 ] = axes[ 1 ];
+  return axes[ 2 ] == 2.0*(double)marker/1023.0 - 1.0;
+}
+
+/**
+ * \brief Check that the changes of relative axes reported between polls are all
+ *  integrated, as positions and as changes, and that the origin can be reset.
+ */
+const char *CheckRelativeAxes( void )
+{
+  Joystick joy;
+  if( !joy.Initialise( relativeLocation, kJoystick_EventDriven ) ) return "unable to initialise";
+  joy.ResetRelativeAxes();
+  
+  // Positions: 100 changes of +5 and -3 counts, out of a range of 254
+  double sums[ 2 ], last[ 2 ];
+  if( !MoveTrackball( joy, 100, 1023, sums, last ) ) return "the marker wasn't delivered";
+  if( !Near( last[ 0 ], 500*2.0/254.0 ) || !Near( last[ 1 ], -300*2.0/254.0 ) )
+    return "the positions lost changes";
+  
+  // Polling again without any change leaves the positions alone
+  double axes[ 3 ];
+  joy.PollAxesInto( axes, 3 );
+  if( axes[ 0 ] != last[ 0 ] || axes[ 1 ] != last[ 1 ] ) return "a poll moved the positions";
+  
+  // Changes: summed over the polls, they cover every change once
+  joy.SetRelativeMode( kAxisRelative_Delta );
+  joy.PollAxesInto( axes, 3 );
+  if( axes[ 0 ] != 0.0 || axes[ 1 ] != 0.0 ) return "the changes didn't start from the last poll";
+  if( !MoveTrackball( joy, 50, 0, sums, last ) ) return "the marker wasn't delivered";
+  if( !Near( sums[ 0 ], 250*2.0/254.0 ) || !Near( sums[ 1 ], -150*2.0/254.0 ) )
+    return "the changes lost some";
+  
+  // A new origin
+  joy.SetRelativeMode( kAxisRelative_Position );
+  joy.ResetRelativeAxes();
+  joy.PollAxesInto( axes, 3 );
+  if( axes[ 0 ] != 0.0 || axes[ 1 ] != 0.0 ) return "the origin wasn't reset";
+  return NULL;
+}
+
+/**
+ * \brief Check that PollAxes reads raw counts into the integer types (saturating the
+ *  narrower ones) and matches PollAxesInto for float, and that PollPOV rounds angles.
+ */
+const char *CheckTypedPolls( void )
+{
+  Joystick joy;
+  if( !joy.Initialise( typedLocation, kJoystick_EventDriven ) ) return "unable to initialise";
+  joy.ResetRelativeAxes();
+  int32_t logmin = 0, logmax = 0;
+  if( !joy.AxisRange( 1, logmin, logmax ) || logmin != 0 || logmax != 1023 ) return "the axis range is wrong";
+  
+  // 20 changes of -4 counts and a POV angle, then the absolute axis as a marker
+  for( size_t ii=0; ii<20; ii++ ) FakeHIDSetInput( typedLocation, 0, -4 );
+  FakeHIDSetInput( typedLocation, 2, 3 );
+  FakeHIDSetInput( typedLocation, 1, 700 );
+  int32_t counts[ 2 ] = { 0, 0 };
+  for( size_t ii=0; ii<1000 && counts[ 1 ] != 700; ii++ )
+  {
+    joy.PollAxes( counts, 2 );
+    if( counts[ 1 ] != 700 ) usleep( 1000 );
+  }
+  if( counts[ 1 ] != 700 ) return "the raw count wasn't delivered";
+  if( counts[ 0 ] != -80 ) return "the relative axis lost counts";
+  
+  int16_t shorts[ 2 ];
+  uint16_t unsignedShorts[ 2 ];
+  joy.PollAxes( shorts, 2 );
+  joy.PollAxes( unsignedShorts, 2 );
+  if( shorts[ 0 ] != -80 || shorts[ 1 ] != 700 || unsignedShorts[ 0 ] != 0 || unsignedShorts[ 1 ] != 700 )
+    return "the narrower counts are wrong";
+  float singles[ 2 ];
+  double doubles[ 2 ];
+  joy.PollAxes( singles, 2 );
+  joy.PollAxesInto( doubles, 2 );
+  if( singles[ 0 ] != (float)doubles[ 0 ] || singles[ 1 ] != (float)doubles[ 1 ] )
+    return "the single axes don't match the doubles";
+  if( !Near( doubles[ 0 ], -80*2.0/254.0 ) || !Near( doubles[ 1 ], 2.0*700.0/1023.0 - 1.0 ) )
+    return "the counts don't normalise as the axes do";
+  
+  // 3 of 8 positions is 135 degrees, and centred is -1 in every type
+  int16_t angle = 0;
+  float singleAngle = 0.0f;
+  joy.PollPOV( &angle, 1 );
+  joy.PollPOV( &singleAngle, 1 );
+  if( angle != 135 || singleAngle != 135.0f ) return "the POV angle is wrong";
+  FakeHIDSetInput( typedLocation, 2, 8 );
+  int32_t centred = 0;
+  for( size_t ii=0; ii<1000 && centred != -1; ii++ )
+  {
+    joy.PollPOV( &centred, 1 );
+    if( centred != -1 ) usleep( 1000 );
+  }
+  if( centred != -1 ) return "the centred POV isn't -1";
+  return NULL;
+}
+
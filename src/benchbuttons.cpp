@@ -0,0 +1,333 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Checks of the button edge queue, and the time it adds to each button store, and of
+ * the button mask expansion kernels against the scalar one.
+ */
+
+#include "bench.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Button edges timed through a snapshot
+static const size_t edgeStores = 1000000;
+
+// Button counts the mask expansion is timed at, and the buttons expanded at each
+static const size_t maskButtons[] = { 16, 128, 1024 };
+static const size_t numMaskButtons = sizeof(maskButtons)/sizeof(maskButtons[0]);
+static const size_t maskExpanded = 50000000;
+
+// Longest mask the kernels are checked against the scalar one at
+static const size_t maskChecked = 1100;
+
+/**
+ * \brief A button mask expansion kernel (see buttonmask.hpp).
+ */
+struct MaskKernel
+{
+  const char *name;
+  void (*expand)( const uint64_t *mask, size_t numButtons, uint8_t *dest );
+};
+
+/**
+ * \brief The kernels this build and CPU can run, scalar first.
+ *
+ * \param[out] kernels Room for 4 kernels.
+ * \return Number of kernels.
+ */
+static size_t MaskKernels( MaskKernel *kernels )
+{
+  size_t count = 0;
+  MaskKernel scalar = { "scalar", &ExpandButtonMaskScalar };
+  kernels[ count++ ] = scalar;
+#if defined(BUTTONMASK_SSE2)
+  MaskKernel sse2 = { "sse2", &ExpandButtonMaskSSE2 };
+  kernels[ count++ ] = sse2;
+#endif
+#if defined(BUTTONMASK_AVX2)
+  MaskKernel avx2 = { "avx2", &ExpandButtonMaskAVX2 };
+  if( ButtonMaskHasAVX2() ) kernels[ count++ ] = avx2;
+#endif
+  MaskKernel dispatch = { "auto", &ExpandButtonMask };
+  kernels[ count++ ] = dispatch;
+  return count;
+}
+
+/**
+ * \brief Fill a mask with pseudo random bits.
+ */
+static void FillMask( uint64_t *mask, size_t numWords, uint32_t seed )
+{
+  for( size_t ii=0; ii<numWords; ii++ )
+  {
+    uint64_t word = 0;
+    for( size_t jj=0; jj<4; jj++ )
+    {
+      seed = seed*1103515245u + 12345u;
+      word = ( word << 16 ) | ( seed >> 16 );
+    }
+    mask[ ii ] = word;
+  }
+}
+
+/**
+ * \brief Check every mask expansion kernel against the scalar one, at every length up
+ *  to maskChecked, and that none writes past the last button.
+ */
+const char *CheckButtonMaskKernels( void )
+{
+  MaskKernel kernels[ 4 ];
+  size_t numKernels = MaskKernels( kernels );
+  uint64_t mask[ ( maskChecked + 63 )/64 ];
+  uint8_t expected[ maskChecked + 1 ], dest[ maskChecked + 1 ];
+  for( size_t numButtons=0; numButtons<=maskChecked; numButtons++ )
+  {
+    FillMask( mask, ButtonMaskWords( maskChecked ), (uint32_t)numButtons + 1 );
+    // An all clear and an all set word, for the ends of the lane masks
+    mask[ 0 ] = 0;
+    if( numButtons > 64 ) mask[ 1 ] = ~(uint64_t)0;
+    ExpandButtonMaskScalar( mask, numButtons, expected );
+    for( size_t ii=0; ii<numButtons; ii++ )
+    {
+      if( expected[ ii ] != (uint8_t)GetButtonMaskBit( mask, ii ) )
+        return "the scalar kernel is wrong";
+    }
+    for( size_t kk=1; kk<numKernels; kk++ )
+    {
+      memset( dest, 0xAA, sizeof(dest) );
+      kernels[ kk ].expand( mask, numButtons, dest );
+      if( memcmp( dest, expected, numButtons ) != 0 )
+      {
+        static char failure[ 64 ];
+        snprintf( failure, sizeof(failure), "the %s kernel differs at %lu buttons",
+                  kernels[ kk ].name, (unsigned long)numButtons );
+        return failure;
+      }
+      if( dest[ numButtons ] != 0xAA ) return "a kernel wrote past the last button";
+    }
+  }
+  return NULL;
+}
+
+/**
+ * \brief Time every mask expansion kernel at each of maskButtons.
+ */
+void TimeButtonMask( void )
+{
+  MaskKernel kernels[ 4 ];
+  size_t numKernels = MaskKernels( kernels );
+  static uint64_t mask[ 1024/64 ];
+  static uint8_t dest[ 1024 ];
+  FillMask( mask, 1024/64, 1 );
+  for( size_t nn=0; nn<numMaskButtons; nn++ )
+  {
+    size_t numButtons = maskButtons[ nn ];
+    size_t iterations = maskExpanded/numButtons;
+    double scalar = 0.0;
+    for( size_t kk=0; kk<numKernels; kk++ )
+    {
+      uint64_t start = JoyNowTicks();
+      for( size_t ii=0; ii<iterations; ii++ )
+      {
+        kernels[ kk ].expand( mask, numButtons, dest );
+        // Keep the expansion from being hoisted out of the loop
+        mask[ 0 ] ^= dest[ ii % numButtons ];
+      }
+      double ns = JoyTicksToSeconds( JoyNowTicks() - start )*1e9/(double)iterations;
+      if( kk == 0 ) scalar = ns;
+      printf( "%-16s %-8s %6lu %12.1f %10.2f %12.1f\n", "ExpandMask", kernels[ kk ].name,
+              (unsigned long)numButtons, ns, scalar/ns, (double)numButtons/ns*1e3 );
+    }
+  }
+}
+
+// Times the edge queue is attached, emptied, resized and detached under a writer
+static const size_t edgeSwaps = 2000;
+
+/**
+ * \brief A snapshot with a writer thread toggling its buttons as fast as it can.
+ */
+struct EdgeWriter
+{
+  JoySnapshot snapshot;
+  pthread_t thread;
+  volatile bool running;
+};
+
+/**
+ * \brief Writer thread of CheckEdgeRingSwaps.
+ */
+static void *EdgeWriterThread( void *context )
+{
+  EdgeWriter *writer = (EdgeWriter *)context;
+  for( uint64_t ii=1; writer->running; ii++ )
+  {
+    writer->snapshot.Write( kJoystick_Buttons, ii % edgeButtons,
+                            (int32_t)( ( ii / edgeButtons ) & 1 ), ii );
+  }
+  return NULL;
+}
+
+/**
+ * \brief Wait up to a second for a button of the edge device to reach a state.
+ */
+static bool WaitForButton( Joystick &joy, size_t button, uint8_t state )
+{
+  uint8_t pressed[ edgeButtons ];
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    joy.PollButtonsInto( pressed, edgeButtons );
+    if( pressed[ button ] == state ) return true;
+    usleep( 1000 );
+  }
+  return false;
+}
+
+/**
+ * \brief Check that taps made between polls are counted and latched, and that the edges
+ *  come out in order with their time stamps.
+ */
+const char *CheckButtonEdges( void )
+{
+  Joystick joy;
+  if( !joy.Initialise( edgeLocation, kJoystick_EventDriven ) ) return "unable to initialise";
+  if( !joy.EnableButtonEdges( 64 ) ) return "unable to enable the edge queue";
+  
+  // Tap button 3 once and button 5 twice, then hold button 1. The callbacks are
+  // delivered in order, so once button 1 is down, the taps have all been seen.
+  FakeHIDSetInput( edgeLocation, 1 + 3, 1 );
+  FakeHIDSetInput( edgeLocation, 1 + 3, 0 );
+  for( size_t ii=0; ii<2; ii++ )
+  {
+    FakeHIDSetInput( edgeLocation, 1 + 5, 1 );
+    FakeHIDSetInput( edgeLocation, 1 + 5, 0 );
+  }
+  FakeHIDSetInput( edgeLocation, 1 + 1, 1 );
+  if( !WaitForButton( joy, 1, 1 ) ) return "the button press wasn't delivered";
+  
+  double presses[ edgeButtons ], releases[ edgeButtons ];
+  uint8_t latched[ edgeButtons ];
+  if( joy.PollButtonEdgeCounts( presses, releases, latched, edgeButtons ) != edgeButtons )
+    return "the wrong number of buttons was polled";
+  if( presses[ 3 ] != 1.0 || releases[ 3 ] != 1.0 || latched[ 3 ] != 1 )
+    return "the tap wasn't counted and latched";
+  if( presses[ 5 ] != 2.0 || releases[ 5 ] != 2.0 ) return "the double tap wasn't counted";
+  if( presses[ 1 ] != 1.0 || releases[ 1 ] != 0.0 || latched[ 1 ] != 1 )
+    return "the held button wasn't counted";
+  
+  // Nothing happened since, so only the held button is latched
+  joy.PollButtonEdgeCounts( presses, releases, latched, edgeButtons );
+  for( size_t ii=0; ii<edgeButtons; ii++ )
+  {
+    if( presses[ ii ] != 0.0 || releases[ ii ] != 0.0 || latched[ ii ] != ( ii == 1 ) )
+      return "edges were counted twice";
+  }
+  
+  // The queue itself, in order
+  FakeHIDSetInput( edgeLocation, 1 + 2, 1 );
+  FakeHIDSetInput( edgeLocation, 1 + 1, 0 );
+  if( !WaitForButton( joy, 1, 0 ) ) return "the button release wasn't delivered";
+  JoyButtonEdge edges[ 4 ];
+  size_t count = joy.PollButtonEdges( edges, 4 );
+  if( count != 2 || edges[ 0 ].button != 2 || !edges[ 0 ].pressed || edges[ 1 ].button != 1 ||
+      edges[ 1 ].pressed || edges[ 1 ].time < edges[ 0 ].time || edges[ 0 ].time <= 0.0 )
+    return "the queued edges were wrong";
+  if( joy.ButtonEdgesDropped() != 0 ) return "edges were dropped";
+  return NULL;
+}
+
+/**
+ * \brief Check that the edge queue can be attached and detached while the writer runs
+ *  (see JoySnapshot::SetEdgeRing): once detached, the writer has stopped pushing into
+ *  it, so it can be emptied and resized, and it only ever holds whole edges.
+ */
+const char *CheckEdgeRingSwaps( void )
+{
+  EdgeWriter writer;
+  writer.snapshot.Resize( 0, edgeButtons, 0 );
+  SampleRing ring;
+  ring.Resize( 16, 2 );
+  writer.running = true;
+  if( pthread_create( &writer.thread, NULL, &EdgeWriterThread, &writer ) != 0 )
+    return "unable to start the writer";
+  
+  const char *failure = NULL;
+  size_t edges = 0;
+  for( size_t ii=0; ii<edgeSwaps && failure == NULL; ii++ )
+  {
+    writer.snapshot.SetEdgeRing( &ring );
+    for( size_t kk=0; kk<1000 && ring.Available() < 4; kk++ ) sched_yield();
+    for( size_t kk=0; kk<ring.Available() && failure == NULL; kk++ )
+    {
+      const int32_t *edge = ring.Peek( kk, NULL );
+      if( edge[ 0 ] < 0 || edge[ 0 ] >= (int32_t)edgeButtons || ( edge[ 1 ] & ~1 ) != 0 )
+        failure = "a torn edge was queued";
+    }
+    edges += ring.Available();
+    writer.snapshot.SetEdgeRing( NULL );
+    // Detached, so nothing may be pushed from here on
+    ring.Consume( ring.Available() );
+    if( ( ii & 63 ) == 63 ) ring.Resize( 16 + ( ii & 64 ), 2 );
+    if( failure == NULL && ring.Available() != 0 ) failure = "an edge was queued after detaching";
+  }
+  writer.running = false;
+  pthread_join( writer.thread, NULL );
+  if( failure == NULL && edges == 0 ) failure = "no edges were queued";
+  return failure;
+}
+
+/**
+ * \brief Time snapshot button stores that all change the button, with and without the
+ *  edge queue attached.
+ */
+void TimeButtonEdges( void )
+{
+  JoySnapshot snapshot;
+  snapshot.Resize( 0, 64, 0 );
+  SampleRing ring;
+  ring.Resize( 4096, 2 );
+  for( size_t run=0; run<2; run++ )
+  {
+    snapshot.SetEdgeRing( run == 0 ? NULL : &ring );
+    uint64_t allocs = allocations;
+    uint64_t start = JoyNowTicks();
+    for( size_t ii=0; ii<edgeStores; ii++ )
+    {
+      snapshot.Write( kJoystick_Buttons, ii & 63, (int32_t)( ( ii >> 6 ) & 1 ), start + ii );
+      if( ( ii & 1023 ) == 1023 ) ring.Consume( ring.Available() );
+    }
+    uint64_t ticks = JoyNowTicks() - start;
+    ReportCapture( "ButtonStore", run == 0 ? "plain" : "edges", edgeStores, ticks,
+                   allocations - allocs );
+  }
+}
+
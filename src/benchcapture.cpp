@@ -0,0 +1,195 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Timing of the capture writer, and checks that a capture recorded from an event driven
+ * joystick replays into the same state, in step with a simulation and faster than real
+ * time.
+ */
+
+#include "bench.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+
+// The number of input changes recorded from the captured device
+static const size_t captureChanges = 20000;
+// Simulation step used to replay the capture in step with the simulation time
+static const double captureStep = 1e-5;
+// Events written by the capture writer benchmark
+static const size_t writerEvents = 1000000;
+
+/**
+ * \brief Change input ii of the captured device. Each change moves an axis, a button or
+ *  a POV hat in turn.
+ */
+static void CaptureChange( size_t ii )
+{
+  size_t element = ii % ( captureAxes + captureButtons + capturePOVs );
+  long value;
+  if( element < captureAxes ) value = (long)( ii % 1024 );
+  else if( element < captureAxes + captureButtons ) value = (long)( ( ii / 7 ) % 2 );
+  else value = (long)( ii % 9 );
+  FakeHIDSetInput( captureLocation, element, value );
+}
+
+/**
+ * \brief Poll every value of a joystick into one vector, sized by the caller.
+ */
+static void PollAll( Joystick &joy, vector<double> &values, vector<uint8_t> &pressed )
+{
+  joy.PollAxesInto( &values[ 0 ], captureAxes );
+  joy.PollButtonsInto( &pressed[ 0 ], captureButtons );
+  for( size_t ii=0; ii<captureButtons; ii++ ) values[ captureAxes + ii ] = pressed[ ii ];
+  joy.PollPOVInto( &values[ captureAxes + captureButtons ], capturePOVs );
+}
+
+/**
+ * \brief Time the capture writer on its own, as the acquisition thread would drive it.
+ */
+static bool BenchCaptureWriter( const char *path )
+{
+  JoyCaptureInfo info;
+  info.locationKey = captureLocation;
+  info.vendorID = info.productID = info.mode = 0;
+  info.productKey = "Captured joystick";
+  info.numButtons = captureButtons;
+  info.numOutputs = 0;
+  JoyCaptureRange axis = { 0, 1023, 0, 0 }, pov = { 0, 7, 0, 0 };
+  info.axes.assign( captureAxes, axis );
+  info.povs.assign( capturePOVs, pov );
+  
+  JoyCaptureWriter writer;
+  uint64_t start = JoyNowTicks();
+  if( !writer.Open( path, info, start ) ) return false;
+  uint64_t allocs = allocations;
+  for( size_t ii=0; ii<writerEvents; ii++ )
+  {
+    writer.Record( kJoystick_Axes, ii % captureAxes, (int32_t)( ii % 1023 ), start + ii );
+  }
+  bool ok = writer.Close();
+  uint64_t ticks = JoyNowTicks() - start;
+  ReportCapture( "Writer", "-", writerEvents, ticks, allocations - allocs );
+  return ok && writer.Events() == writerEvents;
+}
+
+/**
+ * \brief Record a capture from an event driven joystick, then replay it in step with a
+ *  simulation (twice, to check that it is deterministic) and at 1000 times real time.
+ *  Each replay must end in the state the live joystick ended in.
+ */
+bool BenchCapture( void )
+{
+  char path[ 64 ];
+  snprintf( path, sizeof(path), "/tmp/bench_capture_%d.sljoycap", (int)getpid() );
+  bool ok = BenchCaptureWriter( path );
+  
+  // Record from the live joystick
+  vector<double> live( captureAxes + captureButtons + capturePOVs );
+  vector<double> replayed( live.size() );
+  vector<uint8_t> pressed( captureButtons );
+  Joystick joy;
+  if( !ok || !joy.Initialise( captureLocation, kJoystick_EventDriven ) ||
+      !joy.StartCapture( path ) )
+  {
+    printf( "Unable to record a capture into %s.\n", path );
+    unlink( path );
+    return false;
+  }
+  for( size_t ii=0; ii<captureChanges; ii++ ) CaptureChange( ii );
+  // Wait for the last change to be delivered
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    PollAll( joy, live, pressed );
+    if( live.back() == 45.0*(double)( ( captureChanges - 1 ) % 9 ) ) break;
+    usleep( 1000 );
+  }
+  ok = joy.StopCapture();
+  PollAll( joy, live, pressed );
+  JoyCapture capture;
+  ok = ok && capture.Open( path ) && capture.NumEvents() > 0;
+  size_t events = capture.NumEvents();
+  size_t steps = (size_t)( capture.Duration()/captureStep ) + 2;
+  
+  // Replay in step with the simulation time, twice. The sample age is measured in
+  // capture time, from the newest event played.
+  double checksums[ 2 ] = { 0.0, 0.0 };
+  bool agesOk = true;
+  for( size_t run=0; run<2 && ok; run++ )
+  {
+    Joystick replay;
+    ok = replay.InitialiseReplay( path, 0.0 );
+    uint64_t allocs = allocations;
+    uint64_t start = JoyNowTicks();
+    size_t played = 0;
+    for( size_t ii=0; ii<steps && ok; ii++ )
+    {
+      double time = (double)ii*captureStep;
+      replay.SetReplayTime( time );
+      PollAll( replay, replayed, pressed );
+      for( size_t jj=0; jj<replayed.size(); jj++ ) checksums[ run ] += replayed[ jj ]*(double)( ii+jj );
+      uint64_t until = (uint64_t)( time*1e9 + 0.5 );
+      while( played < events && capture.Events()[ played ].time <= until ) played++;
+      double age = replay.SampleAge();
+      double expected = played == 0 ? -1.0 : time - 1e-9*(double)capture.Events()[ played-1 ].time;
+      if( fabs( age - expected ) > 1e-6 ) agesOk = false;
+      checksums[ run ] += age;
+    }
+    uint64_t ticks = JoyNowTicks() - start;
+    if( run == 0 ) ReportCapture( "Replay", "sim", events, ticks, allocations - allocs );
+    ok = ok && replayed == live;
+  }
+  ok = ok && checksums[ 0 ] == checksums[ 1 ];
+  if( ok && !agesOk )
+  {
+    printf( "The replayed sample age didn't follow the simulation time.\n" );
+    ok = false;
+  }
+  
+  // Replay faster than real time, until it reaches the live joystick's final state
+  if( ok )
+  {
+    Joystick replay;
+    ok = replay.InitialiseReplay( path, 1000.0 );
+    uint64_t allocs = allocations;
+    uint64_t start = JoyNowTicks();
+    for( size_t ii=0; ii<10000000 && ok; ii++ )
+    {
+      PollAll( replay, replayed, pressed );
+      if( replayed == live ) break;
+    }
+    uint64_t ticks = JoyNowTicks() - start;
+    ok = ok && replayed == live;
+    if( ok ) ReportCapture( "Replay", "x1000", events, ticks, allocations - allocs );
+  }
+  capture.Close();
+  unlink( path );
+  if( !ok ) printf( "The replayed capture didn't match the live joystick.\n" );
+  return ok;
+}
+
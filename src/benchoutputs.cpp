@@ -0,0 +1,226 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Checks of the output reports, byte for byte, and of the force feedback effect engine,
+ * whose loop is then timed.
+ */
+
+#include "bench.hpp"
+#include "joygroup.hpp"
+#include "joyeffects.hpp"
+#include "joysession.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+
+/**
+ * \brief Build the output report the synthetic device should receive: 10 bit logical
+ *  values, least significant bit first, after the report ID byte.
+ */
+static vector<uint8_t> ExpectedReport( uint8_t reportID, const vector<double> &inputs )
+{
+  size_t first = 8*( reportID - 2 ), count = min( (size_t)8, inputs.size() - first );
+  vector<uint8_t> report( 1 + ( 10*count + 7 )/8, 0 );
+  report[ 0 ] = reportID;
+  for( size_t ii=0; ii<count; ii++ )
+  {
+    uint32_t value = (uint32_t)( 1023*inputs[ first+ii ] );
+    for( size_t bit=0; bit<10; bit++ )
+    {
+      size_t at = 8 + 10*ii + bit;
+      if( value & ( 1u << bit ) ) report[ at/8 ] |= (uint8_t)( 1u << ( at%8 ) );
+    }
+  }
+  return report;
+}
+
+/**
+ * \brief Whether the last report with an ID the synthetic device received is the
+ *  expected one, byte for byte.
+ */
+static bool ReportMatches( uint8_t reportID, const vector<double> &inputs )
+{
+  vector<uint8_t> expected = ExpectedReport( reportID, inputs );
+  uint8_t actual[ 64 ];
+  size_t len = FakeHIDGetReport( outputLocation, reportID, actual, sizeof(actual) );
+  return len == expected.size() && memcmp( actual, &expected[0], len ) == 0;
+}
+
+/**
+ * \brief Push until the device holds the given values in both of its reports, allowing
+ *  a second for asynchronous reports in flight.
+ */
+static bool PushUntilSent( Joystick &joy, const vector<double> &inputs )
+{
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    joy.PushInputs( inputs );
+    if( ReportMatches( 2, inputs ) && ReportMatches( 3, inputs ) ) return true;
+    usleep( 1000 );
+  }
+  return false;
+}
+
+/**
+ * \brief Check the output reports of a 12 output device byte for byte: the outputs go
+ *  out as two whole reports, unchanged values are never resent, and a single change
+ *  only resends the report that carries it.
+ */
+const char *CheckOutputReports( JoystickAcquisition mode )
+{
+  Joystick joy;
+  if( !joy.Initialise( outputLocation, mode ) ) return "unable to initialise";
+  vector<double> inputs( outputCount );
+  for( size_t ii=0; ii<outputCount; ii++ ) inputs[ ii ] = (double)ii/( outputCount-1 );
+  
+  const char *failure = NULL;
+  uint64_t sent = FakeHIDReportCount( outputLocation );
+  if( !PushUntilSent( joy, inputs ) ) failure = "the first reports don't match";
+  else if( FakeHIDReportCount( outputLocation ) - sent != 2 ) failure = "more than one report was sent per ID";
+  
+  sent = FakeHIDReportCount( outputLocation );
+  for( size_t ii=0; ii<100 && failure == NULL; ii++ ) joy.PushInputs( inputs );
+  if( failure == NULL && FakeHIDReportCount( outputLocation ) != sent ) failure = "unchanged values were sent";
+  
+  inputs[ 9 ] = 0.5;
+  if( failure == NULL && !PushUntilSent( joy, inputs ) ) failure = "the changed report doesn't match";
+  else if( failure == NULL && FakeHIDReportCount( outputLocation ) - sent != 1 ) failure = "an unchanged report was sent";
+  // The outputs follow the axis and the button
+  if( failure == NULL && FakeHIDGetValue( outputLocation, 2 + 9 ) != (long)( 1023*0.5 ) )
+    failure = "the report didn't set the output";
+  
+  return failure;
+}
+
+
+/**
+ * \brief Wait up to a second for the effect thread to bring an output (of the effect
+ *  device) within a couple of logical units of a value.
+ */
+static bool WaitForOutput( size_t output, long value )
+{
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    if( labs( FakeHIDGetValue( effectLocation, 2 + output ) - value ) <= 2 ) return true;
+    usleep( 1000 );
+  }
+  return false;
+}
+
+/**
+ * \brief Check that a spring and a constant force drive the outputs of an event driven
+ *  device from the effect thread, then time the effect loop for a second while the
+ *  device's frame ring grows (restarting its acquisition under the loop's reads).
+ *  Fails if too many iterations overran: on a loaded or single CPU machine the
+ *  lateness of single iterations says little, but losing a large part of them does.
+ */
+bool BenchEffects( double rate )
+{
+  // Another block sharing the device keeps its joystick, as Start claims a separate one
+  // for the engine's thread to push to
+  JoySessionPool &pool = SharedJoySessionPool();
+  Joystick *other = pool.Acquire( effectLocation, kJoystick_EventDriven );
+  JoystickGroup shared;
+  JoyEffectEngine sharedEngine;
+  uint32_t opens = pool.Stats().opens;
+  bool claimed = other != NULL && shared.Initialise( &effectLocation, 1, kJoystick_EventDriven ) &&
+                 pool.Stats().opens == opens && sharedEngine.Start( &shared, 1, rate ) &&
+                 pool.Stats().opens == opens + 1;
+  sharedEngine.Stop();
+  shared.Close();
+  pool.Release( other );
+  if( !claimed )
+  {
+    printf( "Effects: the engine pushed to a joystick shared with another block.\n" );
+    return false;
+  }
+  
+  JoystickGroup group;
+  if( !group.Initialise( &effectLocation, 1, kJoystick_EventDriven ) || !group.EnableFrames( 64 ) )
+  {
+    printf( "Unable to initialise the force feedback device.\n" );
+    return false;
+  }
+  JoyEffectEngine engine;
+  if( !engine.Start( &group, 2, rate ) )
+  {
+    printf( "Unable to start the effect engine.\n" );
+    return false;
+  }
+  
+  // A spring on the first axis driving output 1, and a constant force on output 2
+  const double params[ 2*JOY_EFFECT_PARAMS ] = {
+    kJoyEffect_Spring, 1, 1, 1.0, 0.0, 0.0, 0.0, 1.0,
+    kJoyEffect_Constant, 2, 1, 0.5, 0.0, 0.0, 0.0, 1.0 };
+  const double direct[ 2 ] = { 0.5, 0.5 };
+  engine.SetDirect( direct, 2 );
+  engine.SetEffectParams( params, 2 );
+  
+  const char *failure = NULL;
+  FakeHIDSetInput( effectLocation, 0, 1023 );
+  if( !WaitForOutput( 0, 0 ) ) failure = "the spring didn't push back at full deflection";
+  else if( !WaitForOutput( 1, (long)( 1023*0.75 ) ) ) failure = "the constant force wasn't added";
+  FakeHIDSetInput( effectLocation, 0, 512 );
+  if( failure == NULL && !WaitForOutput( 0, (long)( 1023*0.5 ) ) ) failure = "the spring didn't follow the axis";
+  if( failure != NULL )
+  {
+    printf( "Effects: %s.\n", failure );
+    return false;
+  }
+  
+  // Keep the spring busy while the loop is timed, and restart the acquisition every
+  // 100 ms with a larger ring
+  engine.ResetJitter();
+  for( size_t ii=0; ii<100; ii++ )
+  {
+    FakeHIDSetInput( effectLocation, 0, (long)( 512 + 511*sin( 2*M_PI*ii/100.0 ) ) );
+    if( ii % 10 == 9 && !group.EnableFrames( (size_t)64 << ( ii/10 + 1 ) ) )
+      failure = "the frame ring didn't grow";
+    usleep( 10000 );
+  }
+  JoyEffectJitter jitter = engine.Jitter();
+  engine.Stop();
+  printf( "%-16s %8.0f %8lu %10.1f %10.1f %10.1f %10.1f %9lu %7lu\n", "Spring+Constant", rate,
+          (unsigned long)jitter.ticks, 1e6*jitter.meanLate, 1e6*jitter.stdLate,
+          1e6*jitter.p99Late, 1e6*jitter.maxLate, (unsigned long)jitter.overruns,
+          (unsigned long)jitter.errors );
+  if( failure == NULL && jitter.errors != 0 ) failure = "pushes to the device failed";
+  if( failure == NULL && jitter.ticks < 3*jitter.overruns )
+    failure = "a quarter or more of the iterations overran";
+  if( failure != NULL )
+  {
+    printf( "Effects: %s.\n", failure );
+    return false;
+  }
+  return true;
+}
+
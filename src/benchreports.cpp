@@ -0,0 +1,328 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+ * Checks of the report descriptor parser and the report decoder on known descriptors,
+ * and of a joystick acquiring whole input reports (kJoystick_RawReports) from a
+ * synthetic device.
+ */
+
+#include "bench.hpp"
+#include "hidreport.hpp"
+
+#include <unistd.h>
+
+/**
+ * \brief A report descriptor, and what it should parse into.
+ */
+struct DescriptorFixture
+{
+  const char *name;
+  const uint8_t *desc;
+  size_t len;
+  const HIDField *fields;
+  size_t numFields;
+  bool usesReportIDs;
+  // Expected report lengths, indexed by report ID
+  uint32_t inputBytes[ 4 ];
+  uint32_t outputBytes[ 4 ];
+};
+
+// A gamepad without report IDs: 8 bit signed X and Y, a hat switch with a null state,
+// 10 buttons, then a 12 bit signed Z and a 12 bit unsigned Rz that straddle bytes
+static const uint8_t gamepadDescriptor[] = {
+  0x05, 0x01, 0x09, 0x05, 0xA1, 0x01,
+  0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x02,
+  0x09, 0x39, 0x15, 0x00, 0x25, 0x07, 0x75, 0x04, 0x95, 0x01, 0x81, 0x42,
+  0x75, 0x04, 0x95, 0x01, 0x81, 0x03,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x0A, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x0A, 0x81, 0x02,
+  0x75, 0x06, 0x95, 0x01, 0x81, 0x03,
+  0x05, 0x01, 0x09, 0x32, 0x16, 0x00, 0xF8, 0x26, 0xFF, 0x07, 0x75, 0x0C, 0x95, 0x01, 0x81, 0x02,
+  0x09, 0x35, 0x15, 0x00, 0x26, 0xFF, 0x0F, 0x75, 0x0C, 0x95, 0x01, 0x81, 0x02,
+  0xC0 };
+static const HIDField gamepadFields[] = {
+  { kHIDField_Input, 0, 0, 8, 0x01, 0x30, -127, 127, 0x02 },
+  { kHIDField_Input, 0, 8, 8, 0x01, 0x31, -127, 127, 0x02 },
+  { kHIDField_Input, 0, 16, 4, 0x01, 0x39, 0, 7, 0x42 },
+  { kHIDField_Input, 0, 24, 1, 0x09, 1, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 25, 1, 0x09, 2, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 26, 1, 0x09, 3, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 27, 1, 0x09, 4, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 28, 1, 0x09, 5, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 29, 1, 0x09, 6, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 30, 1, 0x09, 7, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 31, 1, 0x09, 8, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 32, 1, 0x09, 9, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 33, 1, 0x09, 10, 0, 1, 0x02 },
+  { kHIDField_Input, 0, 40, 12, 0x01, 0x32, -2048, 2047, 0x02 },
+  { kHIDField_Input, 0, 52, 12, 0x01, 0x35, 0, 4095, 0x02 } };
+
+// A joystick with report IDs: input report 1 has a 10 bit X, a 6 bit signed relative
+// Y and 3 buttons, output report 2 an LED, and input report 3 a 16 bit signed Rx
+static const uint8_t multiReportDescriptor[] = {
+  0x05, 0x01, 0x09, 0x04, 0xA1, 0x01,
+  0x85, 0x01,
+  0x09, 0x30, 0x15, 0x00, 0x26, 0xFF, 0x03, 0x75, 0x0A, 0x95, 0x01, 0x81, 0x02,
+  0x09, 0x31, 0x15, 0xE0, 0x25, 0x1F, 0x75, 0x06, 0x95, 0x01, 0x81, 0x06,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x03, 0x81, 0x02,
+  0x75, 0x05, 0x95, 0x01, 0x81, 0x03,
+  0x85, 0x02,
+  0x05, 0x08, 0x09, 0x4B, 0x75, 0x01, 0x95, 0x01, 0x91, 0x02,
+  0x75, 0x07, 0x95, 0x01, 0x91, 0x03,
+  0x85, 0x03,
+  0x05, 0x01, 0x09, 0x33, 0x16, 0x00, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x01, 0x81, 0x02,
+  0xC0 };
+static const HIDField multiReportFields[] = {
+  { kHIDField_Input, 1, 8, 10, 0x01, 0x30, 0, 1023, 0x02 },
+  { kHIDField_Input, 1, 18, 6, 0x01, 0x31, -32, 31, 0x06 },
+  { kHIDField_Input, 1, 24, 1, 0x09, 1, 0, 1, 0x02 },
+  { kHIDField_Input, 1, 25, 1, 0x09, 2, 0, 1, 0x02 },
+  { kHIDField_Input, 1, 26, 1, 0x09, 3, 0, 1, 0x02 },
+  { kHIDField_Output, 2, 8, 1, 0x08, 0x4B, 0, 1, 0x02 },
+  { kHIDField_Input, 3, 8, 16, 0x01, 0x33, -32768, 32767, 0x02 } };
+
+static const DescriptorFixture descriptorFixtures[] = {
+  { "gamepad", gamepadDescriptor, sizeof(gamepadDescriptor), gamepadFields,
+    sizeof(gamepadFields)/sizeof(gamepadFields[0]), false, { 8, 0, 0, 0 }, { 0, 0, 0, 0 } },
+  { "multiple reports", multiReportDescriptor, sizeof(multiReportDescriptor), multiReportFields,
+    sizeof(multiReportFields)/sizeof(multiReportFields[0]), true, { 0, 4, 0, 3 }, { 0, 0, 2, 0 } } };
+static const size_t numDescriptorFixtures = sizeof(descriptorFixtures)/sizeof(descriptorFixtures[0]);
+
+/**
+ * \brief Length of the report with an ID from a parsed list, or 0 if there is none.
+ */
+static uint32_t ReportBytes( const vector<uint32_t> &bytes, size_t reportID )
+{
+  return reportID < bytes.size() ? bytes[ reportID ] : 0;
+}
+
+/**
+ * \brief Check that known descriptors parse into the expected fields and report
+ *  lengths.
+ */
+const char *CheckReportDescriptors( void )
+{
+  for( size_t ff=0; ff<numDescriptorFixtures; ff++ )
+  {
+    const DescriptorFixture &fixture = descriptorFixtures[ ff ];
+    vector<HIDField> fields;
+    vector<uint32_t> inputBytes, outputBytes;
+    if( !ParseHIDDescriptor( fixture.desc, fixture.len, fields, &inputBytes, &outputBytes ) )
+      return "a descriptor didn't parse";
+    if( fields.size() != fixture.numFields ) return "a descriptor has the wrong number of fields";
+    for( size_t ii=0; ii<fields.size(); ii++ )
+    {
+      const HIDField &field = fields[ ii ], &expected = fixture.fields[ ii ];
+      if( field.direction != expected.direction || field.reportID != expected.reportID )
+        return "a field is in the wrong report";
+      if( field.bitOffset != expected.bitOffset || field.bitSize != expected.bitSize )
+        return "a field is in the wrong place";
+      if( field.usagePage != expected.usagePage || field.usage != expected.usage )
+        return "a field has the wrong usage";
+      if( field.logicalMin != expected.logicalMin || field.logicalMax != expected.logicalMax )
+        return "a field has the wrong logical range";
+      if( field.flags != expected.flags ) return "a field has the wrong flags";
+    }
+    if( HIDUsesReportIDs( fields ) != fixture.usesReportIDs ) return "the report IDs weren't seen";
+    for( size_t id=0; id<4; id++ )
+    {
+      if( ReportBytes( inputBytes, id ) != fixture.inputBytes[ id ] ) return "an input report has the wrong length";
+      if( ReportBytes( outputBytes, id ) != fixture.outputBytes[ id ] ) return "an output report has the wrong length";
+    }
+    
+    // A truncated descriptor is malformed
+    if( ParseHIDDescriptor( fixture.desc, fixture.len-2, fields ) ) return "a truncated descriptor parsed";
+  }
+  return NULL;
+}
+
+/**
+ * \brief Value of an input field in one pass of CheckPackedReports. Over three passes
+ *  every field takes its logical minimum, its maximum and a value in between.
+ */
+static int32_t PackedValue( const HIDField &field, size_t index, size_t pass )
+{
+  switch( ( index + pass ) % 3 )
+  {
+    case 0: return field.logicalMin;
+    case 1: return field.logicalMax;
+    default: return field.logicalMin + ( field.logicalMax - field.logicalMin )/2;
+  }
+}
+
+/**
+ * \brief Check that packed reports of the known descriptors, with fields of every width
+ *  and alignment and signed fields at their extremes, decode into the snapshot.
+ */
+const char *CheckPackedReports( void )
+{
+  for( size_t ff=0; ff<numDescriptorFixtures; ff++ )
+  {
+    const DescriptorFixture &fixture = descriptorFixtures[ ff ];
+    vector<HIDField> fields;
+    if( !ParseHIDDescriptor( fixture.desc, fixture.len, fields ) ) return "a descriptor didn't parse";
+    
+    // The plan, and where each input field lands in the snapshot
+    HIDReportPlan plan;
+    size_t counts[ kJoystick_Outputs ] = { 0, 0, 0 };
+    vector<JoystickIOIndex> types( fields.size(), kJoystick_Outputs );
+    vector<size_t> indices( fields.size(), 0 );
+    for( size_t ii=0; ii<fields.size(); ii++ )
+    {
+      if( fields[ ii ].direction != kHIDField_Input ) continue;
+      types[ ii ] = ClassifyHIDField( fields[ ii ] );
+      indices[ ii ] = counts[ types[ ii ] ]++;
+      plan.Add( fields[ ii ], types[ ii ], indices[ ii ] );
+    }
+    plan.Compile( fixture.usesReportIDs );
+    JoySnapshot snapshot;
+    snapshot.Resize( counts[ kJoystick_Axes ], counts[ kJoystick_Buttons ], counts[ kJoystick_POVs ] );
+    vector<int32_t> axes( counts[ kJoystick_Axes ] + 1 ), povs( counts[ kJoystick_POVs ] + 1 );
+    vector<uint64_t> buttons( ButtonMaskWords( counts[ kJoystick_Buttons ] ) + 1 );
+    
+    for( size_t pass=0; pass<3; pass++ )
+    {
+      for( uint8_t id=0; id<4; id++ )
+      {
+        size_t len = fixture.inputBytes[ id ];
+        if( len == 0 ) continue;
+        
+        // Pack every field of the report, with the other bits set to catch overlaps
+        vector<uint8_t> report( len, 0xFF );
+        if( fixture.usesReportIDs ) report[ 0 ] = id;
+        size_t inReport = 0, inShort = 0;
+        for( size_t ii=0; ii<fields.size(); ii++ )
+        {
+          const HIDField &field = fields[ ii ];
+          if( types[ ii ] == kJoystick_Outputs || field.reportID != id ) continue;
+          if( !InsertHIDField( &report[ 0 ], len, field.bitOffset, field.bitSize,
+                                                  PackedValue( field, ii, pass ) ) )
+            return "a field didn't fit its report";
+          inReport++;
+          if( ( field.bitOffset + field.bitSize - 1 )/8 < len-1 ) inShort++;
+        }
+        
+        for( size_t ii=0; ii<fields.size(); ii++ )
+        {
+          const HIDField &field = fields[ ii ];
+          if( types[ ii ] == kJoystick_Outputs || field.reportID != id ) continue;
+          if( ExtractHIDField( &report[ 0 ], len, field.bitOffset, field.bitSize, field.logicalMin < 0 )
+                != PackedValue( field, ii, pass ) )
+            return "a field didn't extract as it was inserted";
+        }
+        
+        // The report one byte short first, then the whole of it
+        if( plan.Decode( &report[ 0 ], len-1, &snapshot, 1 ) != inShort )
+          return "a short report decoded the wrong number of fields";
+        if( plan.Decode( &report[ 0 ], len, &snapshot, 2 ) != inReport )
+          return "a report decoded the wrong number of fields";
+        snapshot.Read( kJoystick_Axes, &axes[ 0 ] );
+        snapshot.Read( kJoystick_POVs, &povs[ 0 ] );
+        snapshot.ReadButtonMask( &buttons[ 0 ] );
+        for( size_t ii=0; ii<fields.size(); ii++ )
+        {
+          const HIDField &field = fields[ ii ];
+          if( types[ ii ] == kJoystick_Outputs || field.reportID != id ) continue;
+          int32_t expected = PackedValue( field, ii, pass ), value;
+          if( types[ ii ] == kJoystick_Buttons )
+          {
+            expected = expected != 0 ? 1 : 0;
+            value = GetButtonMaskBit( &buttons[ 0 ], indices[ ii ] ) ? 1 : 0;
+          }
+          else value = types[ ii ] == kJoystick_Axes ? axes[ indices[ ii ] ] : povs[ indices[ ii ] ];
+          if( value != expected ) return "a field decoded to the wrong value";
+        }
+      }
+    }
+    
+    // Reports with an ID the descriptor doesn't use are ignored
+    if( fixture.usesReportIDs )
+    {
+      const uint8_t unknown[ 4 ] = { 2, 0, 0, 0 };
+      if( plan.Decode( unknown, sizeof(unknown), &snapshot, 3 ) != 0 ) return "an output report ID decoded";
+    }
+  }
+  return NULL;
+}
+
+/**
+ * \brief Check that a joystick acquiring whole input reports decodes them from the
+ *  synthetic device's descriptor: signed relative changes, absolute axes, buttons and
+ *  POVs, each from a different part of the report.
+ */
+const char *CheckRawReports( void )
+{
+  Joystick joy;
+  if( !joy.Initialise( reportLocation, kJoystick_RawReports ) ) return "unable to initialise";
+  if( joy.Acquisition() != kJoystick_RawReports ) return "the report descriptor wasn't used";
+  joy.ResetRelativeAxes();
+  
+  // 20 changes of -4 counts, buttons 1, 4 and 10, both POVs, then the absolute axis as
+  // a marker
+  const size_t firstButton = 2, firstPOV = firstButton + reportButtons;
+  for( size_t ii=0; ii<20; ii++ ) FakeHIDSetInput( reportLocation, 0, -4 );
+  FakeHIDSetInput( reportLocation, firstButton, 1 );
+  FakeHIDSetInput( reportLocation, firstButton + 3, 1 );
+  FakeHIDSetInput( reportLocation, firstButton + 9, 1 );
+  FakeHIDSetInput( reportLocation, firstPOV, 3 );
+  FakeHIDSetInput( reportLocation, firstPOV + 1, 6 );
+  FakeHIDSetInput( reportLocation, 1, 700 );
+  int32_t counts[ 2 ] = { 0, 0 };
+  for( size_t ii=0; ii<1000 && counts[ 1 ] != 700; ii++ )
+  {
+    joy.PollAxes( counts, 2 );
+    if( counts[ 1 ] != 700 ) usleep( 1000 );
+  }
+  if( counts[ 1 ] != 700 ) return "the marker report wasn't delivered";
+  if( counts[ 0 ] != -80 ) return "the relative axis lost counts";
+  
+  uint8_t buttons[ reportButtons ];
+  if( joy.PollButtonsInto( buttons, reportButtons ) != reportButtons ) return "the buttons weren't read";
+  for( size_t ii=0; ii<reportButtons; ii++ )
+  {
+    if( buttons[ ii ] != ( ii == 0 || ii == 3 || ii == 9 ? 1 : 0 ) ) return "a button is wrong";
+  }
+  int16_t angles[ reportPOVs ];
+  joy.PollPOV( angles, reportPOVs );
+  if( angles[ 0 ] != 135 || angles[ 1 ] != 270 ) return "a POV angle is wrong";
+  
+  // Centring a POV and releasing a button leave the relative axis where it was
+  FakeHIDSetInput( reportLocation, firstPOV + 1, 8 );
+  FakeHIDSetInput( reportLocation, firstButton + 9, 0 );
+  for( size_t ii=0; ii<1000 && ( angles[ 1 ] != -1 || buttons[ 9 ] != 0 ); ii++ )
+  {
+    joy.PollPOV( angles, reportPOVs );
+    joy.PollButtonsInto( buttons, reportButtons );
+    if( angles[ 1 ] != -1 || buttons[ 9 ] != 0 ) usleep( 1000 );
+  }
+  if( angles[ 1 ] != -1 ) return "the centred POV isn't -1";
+  if( buttons[ 9 ] != 0 ) return "the released button wasn't delivered";
+  joy.PollAxes( counts, 2 );
+  if( counts[ 0 ] != -80 || counts[ 1 ] != 700 ) return "another report moved the axes";
+  return NULL;
+}
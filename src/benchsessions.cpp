@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+ * Checks of the session pool: which sessions are shared between groups, and what a
+ * group leaves behind when it closes.
+ */
+
+#include "bench.hpp"
+#include "joygroup.hpp"
+#include "joysession.hpp"
+#include "fakesource.hpp"
+
+#include <unistd.h>
+
+/**
+ * \brief Wait up to a second for a button of the edge device to reach a state in a
+ *  group.
+ */
+static bool WaitForGroupButton( JoystickGroup &group, size_t button, uint8_t state )
+{
+  uint8_t pressed[ edgeButtons ];
+  for( size_t ii=0; ii<1000; ii++ )
+  {
+    group.PollButtonsInto( pressed, edgeButtons );
+    if( pressed[ button ] == state ) return true;
+    usleep( 1000 );
+  }
+  return false;
+}
+
+/**
+ * \brief Tap a button of the edge device, and wait until the release is delivered.
+ */
+static bool TapButton( JoystickGroup &group, size_t button )
+{
+  FakeHIDSetInput( edgeLocation, 1 + button, 1 );
+  FakeHIDSetInput( edgeLocation, 1 + button, 0 );
+  // The callbacks are delivered in order, so a later press marks the tap as seen
+  FakeHIDSetInput( edgeLocation, 1 + 0, 1 );
+  bool ok = WaitForGroupButton( group, 0, 1 );
+  FakeHIDSetInput( edgeLocation, 1 + 0, 0 );
+  return ok && WaitForGroupButton( group, 0, 0 );
+}
+
+/**
+ * \brief Check that claiming a pooled joystick stops it being shared, that groups
+ *  enabling frames, button edges or axis processing don't see each other's, and that
+ *  Close leaves none of them on the pooled joystick.
+ */
+const char *CheckSessionSharing( void )
+{
+  JoySessionPool &pool = SharedJoySessionPool();
+  
+  // The pool itself: a claim opens a separate joystick while others hold the session
+  Joystick *first = pool.Acquire( edgeLocation, kJoystick_EventDriven );
+  Joystick *second = pool.Acquire( edgeLocation, kJoystick_EventDriven );
+  if( first == NULL || second != first ) return "the session wasn't shared";
+  size_t sessions = pool.Size();
+  Joystick *claimed = pool.Claim( second );
+  if( claimed == NULL || claimed == first || pool.Size() != sessions + 1 )
+    return "a held session was claimed";
+  if( pool.Acquire( edgeLocation, kJoystick_EventDriven ) != first )
+    return "the claimed session was shared";
+  pool.Release( first );
+  pool.Release( claimed );
+  if( pool.Size() != sessions ) return "the claimed session wasn't closed";
+  // ... but takes the session over when nobody else holds it
+  if( pool.Claim( first ) != first ) return "a sole session wasn't claimed in place";
+  second = pool.Acquire( edgeLocation, kJoystick_EventDriven );
+  if( second == NULL || second == first ) return "the claimed session was shared";
+  pool.Release( second );
+  pool.Release( first );
+  if( pool.Size() != sessions ) return "the released sessions weren't merged";
+  
+  // Groups: one records edges and frames and processes its axis, the other doesn't
+  int32_t location = edgeLocation;
+  JoystickGroup plain, recording;
+  if( !plain.Initialise( &location, 1 ) || !recording.Initialise( &location, 1 ) )
+    return "unable to initialise the groups";
+  AxisProcessing config = AxisProcessingDefaults();
+  config.deadzone = 0.9;
+  if( !recording.EnableButtonEdges( 16 ) || !recording.EnableFrames( 64 ) ||
+      !recording.SetAxisProcessing( &config, 1, 1000.0 ) )
+    return "unable to enable the edges, frames and processing";
+  if( pool.Size() != sessions + 1 ) return "the recording group shares its joystick";
+  
+  FakeHIDSetInput( edgeLocation, 0, 767 );
+  if( !TapButton( recording, 3 ) ) return "the tap wasn't delivered";
+  double presses[ edgeButtons ], axis;
+  plain.PollButtonEdgeCounts( presses, NULL, NULL, edgeButtons );
+  if( presses[ 3 ] != 0.0 ) return "the plain group sees the other's edges";
+  plain.PollAxesInto( &axis, 1 );
+  if( axis < 0.4 ) return "the plain group sees the other's processing";
+  recording.PollButtonEdgeCounts( presses, NULL, NULL, edgeButtons );
+  if( presses[ 3 ] != 1.0 ) return "the recording group missed the tap";
+  recording.PollAxesInto( &axis, 1 );
+  if( axis != 0.0 ) return "the recording group's axis wasn't processed";
+  
+  // Closing the recording group drops its joystick, as the plain group's is shared
+  recording.Close();
+  if( pool.Size() != sessions ) return "the claimed joystick wasn't closed";
+  plain.Close();
+  
+  // A group holding the only session claims it in place, and must then put it back
+  if( !recording.Initialise( &location, 1 ) || !recording.EnableButtonEdges( 16 ) ||
+      !recording.EnableFrames( 64 ) || !recording.SetAxisProcessing( &config, 1, 1000.0 ) )
+    return "unable to enable the edges, frames and processing again";
+  if( pool.Size() != sessions ) return "a sole session wasn't claimed in place";
+  recording.Close();
+  Joystick *joy = pool.Acquire( edgeLocation, kJoystick_EventDriven );
+  if( joy == NULL ) return "unable to acquire the closed session";
+  plain.Initialise( &location, 1 );
+  bool tapped = TapButton( plain, 3 );
+  double frame[ edgeButtons ];
+  uint8_t buttons[ edgeButtons ];
+  joy->PollButtonEdgeCounts( presses, NULL, NULL, edgeButtons );
+  size_t rows = joy->PollFrames( 1, NULL, frame, buttons, NULL );
+  joy->PollAxesInto( &axis, 1 );
+  plain.Close();
+  pool.Release( joy );
+  FakeHIDSetInput( edgeLocation, 0, 512 );
+  if( !tapped ) return "the second tap wasn't delivered";
+  if( presses[ 3 ] != 0.0 ) return "Close left the edge queue enabled";
+  if( rows != 0 ) return "Close left the frames enabled";
+  if( axis < 0.4 ) return "Close left the axis processing";
+  return NULL;
+}
+
+/**
+ * \brief Check that removing a device drops it from the registry, and closes its idle
+ *  session on the next Acquire of any device.
+ */
+const char *CheckHotplugRemoval( void )
+{
+  JoySessionPool &pool = SharedJoySessionPool();
+  JoyRegistry &registry = SharedJoyRegistry();
+  // Another device is held throughout, so that its session stays as it is
+  Joystick *held = pool.Acquire( edgeLocation, kJoystick_EventDriven );
+  Joystick *joy = pool.Acquire( removedLocation, kJoystick_EventDriven );
+  if( held == NULL || joy == NULL ) return "unable to acquire the devices";
+  pool.Release( joy );
+  size_t sessions = pool.Size(), devices = registry.Size();
+  
+  const char *failure = NULL;
+  FakeHotplug hotplug( &registry );
+  JoyDeviceEntry entry;
+  if( !hotplug.Unplug( removedLocation ) ) failure = "the device wasn't in the registry";
+  else if( registry.FindByLocation( removedLocation, entry ) || registry.Size() != devices - 1 )
+    failure = "the removed device is still in the registry";
+  else if( hotplug.Unplug( removedLocation ) ) failure = "the device was removed twice";
+  std::vector<JoyDev> listed = registry.Devices();
+  for( size_t ii=0; ii<listed.size(); ii++ )
+  {
+    if( listed[ ii ].locationKey == removedLocation ) failure = "the removed device is still listed";
+  }
+  
+  // The next Acquire, of any device, closes the removed device's idle session
+  joy = pool.Acquire( edgeLocation, kJoystick_EventDriven );
+  size_t remaining = pool.Size();
+  pool.Release( joy );
+  pool.Release( held );
+  if( failure != NULL ) return failure;
+  if( joy != held ) return "the held session wasn't shared";
+  if( remaining != sessions - 1 ) return "the removed device's idle session wasn't closed";
+  if( pool.Acquire( removedLocation, kJoystick_EventDriven ) != NULL )
+    return "the removed device was opened";
+  return NULL;
+}
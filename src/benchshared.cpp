@@ -0,0 +1,251 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Checks of the C interface (sljoy.h), and of shared joysticks published by the
+ * acquisition daemon, from this process and another.
+ */
+
+#include "bench.hpp"
+#include "joydaemon.hpp"
+#include "sljoy.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * \brief Check the C interface (sljoy.h) on a group of the typed poll and output
+ *  report joysticks: the layout, polls, pushes and error codes.
+ */
+const char *CheckCInterface( void )
+{
+  if( sljoy_version() != SLJOY_ABI_VERSION ) return "the version doesn't match";
+  SLJoy *handle = NULL;
+  int32_t missing = 0x7fff0000;
+  if( sljoy_open( &missing, 1, SLJOY_MODE_EVENTS, &handle ) != SLJOY_ERR_NOT_FOUND || handle != NULL )
+    return "a missing joystick opened";
+  const int32_t locations[ 2 ] = { typedLocation, outputLocation };
+  if( sljoy_open( locations, 2, 7, &handle ) != SLJOY_ERR_ARGUMENT ) return "an unknown mode opened";
+  if( sljoy_open( locations, 2, SLJOY_MODE_EVENTS, &handle ) != SLJOY_OK ) return "unable to open";
+  
+  // The typed joystick has 2 axes and a POV, the output one an axis, a button and the
+  // outputs. An older caller's shorter layout only gets the fields it knows.
+  SLJoyLayout layout;
+  layout.size = sizeof( layout );
+  const char *failure = NULL;
+  if( sljoy_layout( handle, &layout ) != SLJOY_OK || layout.numJoysticks != 2 || layout.numAxes != 3 ||
+      layout.numButtons != 1 || layout.numPOVs != 1 || layout.numOutputs != outputCount )
+    failure = "the layout is wrong";
+  SLJoyLayout older;
+  memset( &older, 0xff, sizeof( older ) );
+  older.size = 3*sizeof( uint32_t );
+  if( failure == NULL && ( sljoy_layout( handle, &older ) != SLJOY_OK || older.size != 3*sizeof( uint32_t ) ||
+                           older.numAxes != 3 || older.numButtons != 0xffffffffu ) )
+    failure = "a shorter layout was overrun";
+  
+  double axes[ 3 ], povs[ 1 ];
+  uint8_t buttons[ 1 ];
+  int32_t counts[ 3 ], logmin = 0, logmax = 0;
+  if( failure == NULL && ( sljoy_poll( handle, axes, 2, buttons, 1, povs, 1 ) != SLJOY_ERR_ARGUMENT ||
+                           sljoy_poll( NULL, axes, 3, buttons, 1, povs, 1 ) != SLJOY_ERR_ARGUMENT ) )
+    failure = "a short buffer was accepted";
+  if( failure == NULL && ( sljoy_poll( handle, axes, 3, buttons, 1, povs, 1 ) != SLJOY_OK ||
+                           sljoy_poll( handle, NULL, 0, buttons, 1, NULL, 0 ) != SLJOY_OK ||
+                           sljoy_poll_counts( handle, counts, 3 ) != SLJOY_OK ) )
+    failure = "unable to poll";
+  if( failure == NULL && ( counts[ 1 ] != 700 || !Near( axes[ 1 ], 2.0*700.0/1023.0 - 1.0 ) || povs[ 0 ] != -1.0 ) )
+    failure = "the polled values are wrong";
+  if( failure == NULL && ( sljoy_axis_range( handle, 2, &logmin, &logmax ) != SLJOY_OK || logmax != 1023 ||
+                           sljoy_axis_range( handle, 3, &logmin, &logmax ) != SLJOY_ERR_ARGUMENT ) )
+    failure = "the axis ranges are wrong";
+  
+  vector<double> outputs( outputCount, 0.5 );
+  if( failure == NULL && ( sljoy_push( handle, &outputs.front(), outputs.size() ) != SLJOY_OK ||
+                           sljoy_push( handle, &outputs.front(), 1 ) != SLJOY_ERR_ARGUMENT ) )
+    failure = "unable to push";
+  
+  SLJoyDevice devices[ 4 ];
+  size_t count = 0;
+  if( failure == NULL && ( sljoy_list( devices, 4, &count ) != SLJOY_OK || count < 4 ) )
+    failure = "the devices weren't listed";
+  sljoy_close( handle );
+  sljoy_close( NULL );
+  return failure;
+}
+
+/**
+ * \brief Check that a shared joystick reports a daemon that stops in the middle of a
+ *  write, rather than waiting for it forever or reading its last values.
+ */
+const char *CheckStoppedDaemon( void )
+{
+  char name[ 64 ];
+  snprintf( name, sizeof(name), "/sljoystick_stopped_%d", (int)getpid() );
+  setenv( "SLJOYSTICK_SHM", name, 1 );
+  
+  // Stand in for the daemon: publish a device with one axis, and write it
+  JoyShmSegment segment;
+  if( !segment.Create( name ) )
+  {
+    unsetenv( "SLJOYSTICK_SHM" );
+    return "unable to create the segment";
+  }
+  JoyCaptureInfo info;
+  info.locationKey = 0x7ffe0000;
+  info.vendorID = 0;
+  info.productID = 0;
+  info.mode = (int32_t)kJoystick_EventDriven;
+  info.productKey = "stopped";
+  info.numButtons = 0;
+  info.numOutputs = 0;
+  JoyCaptureRange range = { 0, 1023, 0, 0 };
+  info.axes.push_back( range );
+  void *storage = segment.Publish( info );
+  const char *failure = NULL;
+  if( storage == NULL ) failure = "unable to publish";
+  JoySnapshot writer;
+  if( failure == NULL )
+  {
+    writer.Place( storage, 1, 0, 0, false );
+    writer.Write( kJoystick_Axes, 0, 1023, JoyNowTicks() );
+  }
+  
+  Joystick joy;
+  double axis = 0.0;
+  int32_t scratch = 0;
+  if( failure == NULL && !joy.Initialise( info.locationKey, kJoystick_Shared ) )
+    failure = "unable to attach";
+  if( failure == NULL && ( joy.PollAxesInto( &axis, 1 ) != 1 || axis < 0.99 ) )
+    failure = "the published axis wasn't read";
+  
+  // The daemon stops with a write in progress. Polls and bare snapshot reads both throw.
+  if( failure == NULL )
+  {
+    writer.BeginWrite();
+    segment.Close();
+    try
+    {
+      joy.PollAxesInto( &axis, 1 );
+      failure = "a poll read the values of a stopped daemon";
+    }
+    catch( const char *message ) {}
+  }
+  if( failure == NULL )
+  {
+    try
+    {
+      joy.ReadAxesInto( &axis, &scratch, 1 );
+      failure = "a read didn't notice the daemon stopped";
+    }
+    catch( const char *message ) {}
+  }
+  segment.Close();
+  unsetenv( "SLJOYSTICK_SHM" );
+  return failure;
+}
+
+/**
+ * \brief Reader process: attach to a shared joystick, and wait (up to two seconds) for
+ *  its first axis to reach full scale.
+ */
+int RunSharedReader( int32_t location )
+{
+  Joystick joy;
+  if( !joy.Initialise( location, kJoystick_Shared ) ) return 2;
+  double axis = 0.0;
+  for( size_t ii=0; ii<2000; ii++ )
+  {
+    joy.PollAxesInto( &axis, 1 );
+    if( axis > 0.99 ) return 0;
+    usleep( 1000 );
+  }
+  return 1;
+}
+
+/**
+ * \brief Publish every device through the acquisition daemon, time the shared
+ *  joysticks, and check that another process sees a change of input.
+ */
+bool BenchShared( const char *program )
+{
+  char name[ 64 ];
+  snprintf( name, sizeof(name), "/sljoystick_bench_%d", (int)getpid() );
+  setenv( "SLJOYSTICK_SHM", name, 1 );
+  JoyDaemon daemon;
+  if( !daemon.Start( name, kJoystick_EventDriven ) )
+  {
+    printf( "Unable to start the acquisition daemon on %s.\n", name );
+    return false;
+  }
+  bool ok = true;
+  for( size_t ii=0; ii<numElementCounts && ok; ii++ )
+  {
+    // POVs are the tightest limit of a slot
+    if( elementCounts[ ii ] > JOY_SHM_MAX_POVS ) continue;
+    ok = BenchDevice( elementCounts[ ii ], kJoystick_Shared, "shared" );
+  }
+  
+  // Another process reads the same device
+  int32_t location = DeviceLocation( elementCounts[ 0 ] );
+  pid_t child = ok ? fork() : -1;
+  if( child == 0 )
+  {
+    char arg[ 32 ];
+    snprintf( arg, sizeof(arg), "%d", (int)location );
+    execl( program, program, "--shared-reader", arg, (char *)NULL );
+    _exit( 3 );
+  }
+  int status = -1;
+  if( child > 0 )
+  {
+    // Give the reader time to attach before the input moves
+    usleep( 200000 );
+    FakeHIDSetInput( location, 0, 1023 );
+    waitpid( child, &status, 0 );
+    FakeHIDSetInput( location, 0, 512 );
+  }
+  if( ok && !( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ) )
+  {
+    printf( "A change of input didn't reach the shared joystick in another process.\n" );
+    ok = false;
+  }
+  
+  // Once the daemon stops, readers can no longer attach
+  daemon.Stop();
+  Joystick joy;
+  if( ok && ( SharedJoyShm() != NULL || joy.Initialise( location, kJoystick_Shared ) ) )
+  {
+    printf( "The segment outlived the acquisition daemon.\n" );
+    ok = false;
+  }
+  unsetenv( "SLJOYSTICK_SHM" );
+  return ok;
+}
+
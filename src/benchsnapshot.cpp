@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+ * Checks of the snapshot seqlock and the frame ring, under a scripted writer thread
+ * (see fakesource.hpp) storing as fast as it can.
+ */
+
+#include "bench.hpp"
+#include "fakesource.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+// Axes of the scripted snapshot, and the script's steps. Step n stores n into every
+// axis in turn, one write each, and the script is played over and over.
+static const size_t scriptAxes = 16;
+static const int32_t scriptSteps = 1024;
+
+// Reads of the snapshot while the script plays
+static const size_t scriptReads = 2000000;
+
+/**
+ * \brief A scripted snapshot and the thread playing it.
+ */
+struct ScriptedWriter
+{
+  JoySnapshot snapshot;
+  ScriptedSource *source;
+  pthread_t thread;
+  volatile bool running;
+};
+
+/**
+ * \brief Writer thread of CheckSnapshotReads. Plays the script over and over.
+ */
+static void *ScriptedWriterThread( void *context )
+{
+  ScriptedWriter *writer = (ScriptedWriter *)context;
+  while( writer->running )
+  {
+    writer->source->Advance( 1e9 );
+    writer->source->Rewind();
+  }
+  return NULL;
+}
+
+/**
+ * \brief Whether axes read from the scripted snapshot are a state the script passes
+ *  through: the leading axes one step ahead of the rest, or all on the same step.
+ */
+static bool ScriptState( const int32_t *axes )
+{
+  int32_t ahead = 0;
+  for( size_t ii=1; ii<scriptAxes; ii++ )
+  {
+    ahead += ( axes[ ii - 1 ] - axes[ ii ] + scriptSteps ) % scriptSteps;
+  }
+  return ahead <= 1;
+}
+
+/**
+ * \brief Check that readers never see a torn snapshot, and that frames pushed to the
+ *  ring are whole, while a writer thread stores into it as fast as it can.
+ */
+const char *CheckSnapshotReads( void )
+{
+  ScriptedWriter writer;
+  writer.snapshot.Resize( scriptAxes, 0, 0 );
+  ScriptedSource source( &writer.snapshot );
+  for( int32_t step=1; step<=scriptSteps; step++ )
+  {
+    for( size_t ii=0; ii<scriptAxes; ii++ )
+    {
+      source.Add( ( (double)step*scriptAxes + (double)ii )*1e-6, kJoystick_Axes, ii,
+                  step % scriptSteps );
+    }
+  }
+  SampleRing ring;
+  ring.Resize( 4096, writer.snapshot.PackedSize() );
+  source.SetRing( &ring );
+  writer.source = &source;
+  writer.running = true;
+  if( pthread_create( &writer.thread, NULL, &ScriptedWriterThread, &writer ) != 0 )
+    return "unable to start the writer";
+  
+  const char *failure = NULL;
+  int32_t axes[ scriptAxes ];
+  size_t offset = writer.snapshot.PackedOffset( kJoystick_Axes );
+  size_t changes = 0, frames = 0;
+  int32_t last = 0;
+  for( size_t ii=0; ii<scriptReads && failure == NULL; ii++ )
+  {
+    writer.snapshot.Read( kJoystick_Axes, axes );
+    if( !ScriptState( axes ) ) failure = "a torn snapshot was read";
+    if( axes[ 0 ] != last ) changes++;
+    last = axes[ 0 ];
+    if( ( ii & 1023 ) != 1023 ) continue;
+    // Drain the frames, and let the writer run on a single core
+    size_t available = ring.Available();
+    for( size_t kk=0; kk<available && failure == NULL; kk++ )
+    {
+      if( !ScriptState( ring.Peek( kk, NULL ) + offset ) ) failure = "a torn frame was pushed";
+    }
+    ring.Consume( available );
+    frames += available;
+    sched_yield();
+  }
+  writer.running = false;
+  pthread_join( writer.thread, NULL );
+  if( failure == NULL && ( changes < 2 || frames == 0 ) )
+    failure = "the writer didn't run alongside the reads";
+  return failure;
+}
@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Checks of the performance counters (joystats.hpp), recorded from two threads at once
+ * as a poll and the force feedback effect thread's pushes would be.
+ */
+
+#include "bench.hpp"
+#include "joystats.hpp"
+
+#include <pthread.h>
+
+// Calls recorded by each thread
+static const size_t perfCalls = 200000;
+
+/**
+ * \brief Push thread: record perfCalls pushes of one IOKit call each.
+ */
+static void *PerfPushThread( void *context )
+{
+  JoyPerfCounters *counters = (JoyPerfCounters *)context;
+  for( size_t ii=0; ii<perfCalls; ii++ ) counters->RecordPush( JoyNowTicks(), 1 );
+  return NULL;
+}
+
+/**
+ * \brief The counters' record of the given location key, or NULL if there is none.
+ */
+static const JoyPerfRecord *FindRecord( const vector<JoyPerfRecord> &records, int32_t locationKey )
+{
+  for( size_t ii=0; ii<records.size(); ii++ )
+  {
+    if( records[ ii ].locationKey == locationKey ) return &records[ ii ];
+  }
+  return NULL;
+}
+
+/**
+ * \brief Whether a statistic's histogram accounts for every value added to it.
+ */
+static bool BucketsAddUp( const JoyStat &stat )
+{
+  uint64_t total = 0;
+  for( size_t ii=0; ii<JOY_STAT_BUCKETS; ii++ ) total += stat.buckets[ ii ];
+  return total == stat.count && ( stat.count == 0 || stat.min <= stat.max );
+}
+
+/**
+ * \brief Check that polls and pushes recorded from two threads at once are all
+ *  counted, and that a reset empties the counters.
+ */
+const char *CheckPerfCounters( void )
+{
+  const int32_t locationKey = 0x7ffd0000;
+  JoyPerfCounters counters;
+  if( !counters.Attach( locationKey, (int32_t)kJoystick_EventDriven ) ) return "unable to attach";
+  pthread_t thread;
+  if( pthread_create( &thread, NULL, &PerfPushThread, &counters ) != 0 ) return "unable to start the pushes";
+  for( size_t ii=0; ii<perfCalls; ii++ )
+  {
+    counters.RecordPoll( JoyNowTicks(), 2 );
+    if( ii % 100 == 99 ) counters.EndStep();
+  }
+  pthread_join( thread, NULL );
+  counters.EndStep();
+  
+  vector<JoyPerfRecord> records;
+  JoyPerfRead( records );
+  const JoyPerfRecord *record = FindRecord( records, locationKey );
+  if( record == NULL ) return "the counters weren't listed";
+  const JoyStat &calls = record->stats[ kJoyPerf_IOKitCalls ];
+  if( record->polls != perfCalls || record->stats[ kJoyPerf_PollTime ].count != perfCalls ||
+      record->stats[ kJoyPerf_PushTime ].count != perfCalls )
+    return "calls were lost";
+  if( calls.sum != 3*perfCalls ) return "IOKit calls were lost";
+  for( size_t ii=0; ii<kJoyPerf_NumStats; ii++ )
+  {
+    if( !BucketsAddUp( record->stats[ ii ] ) ) return "a histogram doesn't add up";
+  }
+  
+  JoyPerfReset();
+  JoyPerfRead( records );
+  record = FindRecord( records, locationKey );
+  if( record == NULL || record->polls != 0 || record->stats[ kJoyPerf_PollTime ].count != 0 ||
+      record->stats[ kJoyPerf_PollTime ].min != 0 )
+    return "the reset left counts behind";
+  counters.RecordPoll( JoyNowTicks(), 0 );
+  JoyPerfRead( records );
+  record = FindRecord( records, locationKey );
+  if( record == NULL || record->polls != 1 || !BucketsAddUp( record->stats[ kJoyPerf_PollTime ] ) )
+    return "counting didn't carry on after the reset";
+  return NULL;
+}
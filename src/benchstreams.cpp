@@ -0,0 +1,270 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Recorded evdev streams and raw HID report captures, played through pipes into
+ * EvdevJoysticks, all drained by the one epoll loop. For hidraw, an event is a whole
+ * report. Linux only.
+ */
+
+#include "bench.hpp"
+#ifdef __linux__
+  #include "evdev_joystick.hpp"
+#endif
+
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __linux__
+// Reports per recorded stream. Evdev reports have 11 events: 8 axes, a hat, a button
+// and SYN_REPORT.
+static const size_t streamReports = 20000;
+static const size_t evdevEventsPerReport = 11;
+static const size_t streamCounts[] = { 1, 4, 16 };
+static const size_t numStreamCounts = sizeof(streamCounts)/sizeof(streamCounts[0]);
+
+// Report descriptor of the captured hidraw gamepad: report ID 1, four 16 bit axes, a
+// hat switch with a null state, and 12 buttons
+static const uint8_t hidrawDescriptor[] = {
+  0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x85, 0x01,
+  0x09, 0x30, 0x09, 0x31, 0x09, 0x32, 0x09, 0x35,
+  0x15, 0x00, 0x26, 0xFF, 0x03, 0x75, 0x10, 0x95, 0x04, 0x81, 0x02,
+  0x09, 0x39, 0x15, 0x00, 0x25, 0x07, 0x75, 0x04, 0x95, 0x01, 0x81, 0x42,
+  0x75, 0x04, 0x95, 0x01, 0x81, 0x03,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x0C, 0x15, 0x00, 0x25, 0x01,
+  0x75, 0x01, 0x95, 0x0C, 0x81, 0x02,
+  0x75, 0x04, 0x95, 0x01, 0x81, 0x03,
+  0xC0 };
+static const size_t hidrawReportBytes = 12;
+
+/**
+ * \brief A recording being written into a pipe.
+ */
+struct RecordedStream
+{
+  int fds[ 2 ];
+  vector<uint8_t> data;
+  pthread_t writer;
+};
+
+/**
+ * \brief Capabilities of the recorded evdev device.
+ */
+static EvdevCaps EvdevBenchCaps( void )
+{
+  EvdevCaps caps;
+  caps.name = "Recorded joystick";
+  caps.vendorID = 0x1234;
+  caps.productID = 0x5678;
+  for( uint16_t code=ABS_X; code<=ABS_RUDDER; code++ )
+  {
+    EvdevAbsInfo abs = { code, 0, 1023, 512 };
+    caps.abs.push_back( abs );
+  }
+  EvdevAbsInfo hatX = { ABS_HAT0X, -1, 1, 0 }, hatY = { ABS_HAT0Y, -1, 1, 0 };
+  caps.abs.push_back( hatX );
+  caps.abs.push_back( hatY );
+  for( uint16_t code=BTN_TRIGGER; code<BTN_TRIGGER+16; code++ ) caps.keys.push_back( code );
+  return caps;
+}
+
+/**
+ * \brief Record an evdev stream: every report moves all the axes, the hat and a button.
+ */
+static void RecordEvdev( vector<uint8_t> &data )
+{
+  vector<struct input_event> events;
+  for( size_t ii=0; ii<streamReports; ii++ )
+  {
+    struct input_event ev;
+    ev.time.tv_sec = (time_t)( 1 + ii/1000 );
+    ev.time.tv_usec = (suseconds_t)( ( ii%1000 )*1000 );
+    ev.type = EV_ABS;
+    for( uint16_t code=ABS_X; code<=ABS_RUDDER; code++ )
+    {
+      ev.code = code;
+      ev.value = (int32_t)( ( ii + code ) % 1024 );
+      events.push_back( ev );
+    }
+    ev.code = ABS_HAT0X;
+    ev.value = (int32_t)( ii % 3 ) - 1;
+    events.push_back( ev );
+    ev.type = EV_KEY;
+    ev.code = (uint16_t)( BTN_TRIGGER + ii % 16 );
+    ev.value = (int32_t)( ( ii/16 ) % 2 );
+    events.push_back( ev );
+    ev.type = EV_SYN;
+    ev.code = SYN_REPORT;
+    ev.value = 0;
+    events.push_back( ev );
+  }
+  const uint8_t *bytes = (const uint8_t *)&events.front();
+  data.assign( bytes, bytes + events.size()*sizeof(struct input_event) );
+}
+
+/**
+ * \brief Record a hidraw capture: every report moves all the axes, the hat (through
+ *  its null state) and one button.
+ */
+static void RecordHidraw( vector<uint8_t> &data )
+{
+  data.assign( streamReports*hidrawReportBytes, 0 );
+  for( size_t ii=0; ii<streamReports; ii++ )
+  {
+    uint8_t *report = &data[ ii*hidrawReportBytes ];
+    report[ 0 ] = 1;
+    for( size_t axis=0; axis<4; axis++ )
+    {
+      uint16_t value = (uint16_t)( ( ii + axis ) % 1024 );
+      report[ 1 + 2*axis ] = (uint8_t)( value & 0xFF );
+      report[ 2 + 2*axis ] = (uint8_t)( value >> 8 );
+    }
+    report[ 9 ] = (uint8_t)( ii % 9 );
+    uint16_t buttons = (uint16_t)( 1u << ( ii % 12 ) );
+    report[ 10 ] = (uint8_t)( buttons & 0xFF );
+    report[ 11 ] = (uint8_t)( buttons >> 8 );
+  }
+}
+
+/**
+ * \brief Write a recording into its pipe, then close it.
+ */
+static void *StreamWriter( void *context )
+{
+  RecordedStream *stream = (RecordedStream *)context;
+  const uint8_t *data = &stream->data.front();
+  size_t left = stream->data.size();
+  while( left > 0 )
+  {
+    ssize_t put = write( stream->fds[ 1 ], data, left );
+    if( put <= 0 ) break;
+    data += put;
+    left -= (size_t)put;
+  }
+  close( stream->fds[ 1 ] );
+  return NULL;
+}
+
+/**
+ * \brief Check that a joystick holds the last recorded report.
+ */
+static bool CheckLastReport( EvdevJoystick &joy, bool hidraw )
+{
+  size_t last = streamReports - 1;
+  vector<double> axes = joy.PollAxes();
+  vector<double> povs = joy.PollPOV();
+  vector<bool> buttons = joy.PollButtons();
+  if( axes.size() != ( hidraw ? 4u : 8u ) || povs.size() != 1 ) return false;
+  if( buttons.size() != ( hidraw ? 12u : 16u ) ) return false;
+  if( fabs( axes[ 0 ] - ( 2.0*(double)( last % 1024 )/1023.0 - 1.0 ) ) > 1e-9 ) return false;
+  if( hidraw )
+  {
+    double pov = last % 9 == 8 ? -1.0 : 45.0*(double)( last % 9 );
+    return povs[ 0 ] == pov && buttons[ last % 12 ] && !buttons[ ( last+1 ) % 12 ];
+  }
+  double pov = last % 3 == 0 ? 270.0 : last % 3 == 1 ? -1.0 : 90.0;
+  return povs[ 0 ] == pov && buttons[ last % 16 ] == ( ( last/16 ) % 2 == 1 );
+}
+
+/**
+ * \brief Play recordings through pipes into several EvdevJoysticks at once, all drained
+ *  by the shared loop, and check that each ends up in the recorded final state.
+ *
+ * \param[in] numStreams Number of joysticks.
+ * \param[in] hidraw Play raw HID report captures rather than evdev streams.
+ */
+static bool BenchStreams( size_t numStreams, bool hidraw )
+{
+  EvdevCaps caps = EvdevBenchCaps();
+  vector<RecordedStream> streams( numStreams );
+  vector<EvdevJoystick *> joys( numStreams );
+  bool ok = true;
+  for( size_t ii=0; ii<numStreams; ii++ )
+  {
+    if( hidraw ) RecordHidraw( streams[ ii ].data );
+    else RecordEvdev( streams[ ii ].data );
+    if( pipe( streams[ ii ].fds ) != 0 ) return false;
+    joys[ ii ] = new EvdevJoystick;
+    if( hidraw ) ok = joys[ ii ]->InitialiseRawStream( streams[ ii ].fds[ 0 ], hidrawDescriptor,
+                                                       sizeof(hidrawDescriptor) ) && ok;
+    else ok = joys[ ii ]->InitialiseStream( streams[ ii ].fds[ 0 ], caps ) && ok;
+  }
+  
+  EvdevLoop &loop = SharedEvdevLoop();
+  uint64_t allocs = allocations, reads = loop.ReadCalls(), events = loop.EventsRead();
+  uint64_t start = JoyNowTicks();
+  for( size_t ii=0; ii<numStreams; ii++ )
+  {
+    pthread_create( &streams[ ii ].writer, NULL, &StreamWriter, &streams[ ii ] );
+  }
+  for( size_t ii=0; ii<numStreams; ii++ )
+  {
+    while( ok && joys[ ii ]->Connected() ) usleep( 50 );
+  }
+  uint64_t ticks = JoyNowTicks() - start;
+  allocs = allocations - allocs;
+  reads = loop.ReadCalls() - reads;
+  events = loop.EventsRead() - events;
+  
+  // Every joystick should hold the last report
+  size_t reports = numStreams*streamReports;
+  ok = ok && events == ( hidraw ? reports : reports*evdevEventsPerReport );
+  for( size_t ii=0; ii<numStreams; ii++ )
+  {
+    pthread_join( streams[ ii ].writer, NULL );
+    ok = ok && CheckLastReport( *joys[ ii ], hidraw );
+    delete joys[ ii ];
+    close( streams[ ii ].fds[ 0 ] );
+  }
+  if( !ok )
+  {
+    printf( "The %s streams didn't reach their final state.\n", hidraw ? "hidraw" : "evdev" );
+    return false;
+  }
+  
+  double seconds = JoyTicksToSeconds( ticks );
+  printf( "%-16s %-8s %6lu %12.1f %10.2f %10.3f %12.1f\n", hidraw ? "hidraw" : "evdev",
+          "epoll", (unsigned long)numStreams, seconds*1e9/(double)reports,
+          (double)allocs/(double)reports, (double)reads/(double)reports,
+          (double)events/seconds*1e-6 );
+  return true;
+}
+/**
+ * \brief Play the evdev streams, then the hidraw captures, into 1, 4 and 16 joysticks.
+ */
+bool BenchStreams( void )
+{
+  printf( "\n%-16s %-8s %6s %12s %10s %10s %12s\n", "stream", "backend", "N",
+          "ns/report", "allocs/rep", "reads/rep", "Mevent/s" );
+  bool ok = true;
+  for( size_t ii=0; ii<numStreamCounts && ok; ii++ ) ok = BenchStreams( streamCounts[ ii ], false );
+  for( size_t ii=0; ii<numStreamCounts && ok; ii++ ) ok = BenchStreams( streamCounts[ ii ], true );
+  return ok;
+}
+#endif
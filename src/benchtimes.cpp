@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+ * Checks of the element time stamps and sample ages, against the ticks at which the fake
+ * device produced a value.
+ */
+
+#include "bench.hpp"
+
+#include <unistd.h>
+
+// Sample ages read while no new value arrives, and the sleep between them (us)
+static const size_t numAges = 10;
+static const unsigned ageSleep = 2000;
+
+/**
+ * \brief Drive one axis of a fake device to a new value between two known ticks, and
+ *  check the time stamps and sample ages the joystick reports for it.
+ *
+ * In kJoystick_Polled mode the stamp is the one IOHIDDeviceGetValue returned, in
+ * kJoystick_EventDriven mode the value callback's IOHIDValueGetTimeStamp, and in
+ * kJoystick_RawReports mode the ticks at which InputReportCallback decoded the report.
+ */
+const char *CheckTimeStamps( JoystickAcquisition mode )
+{
+  // The raw report device's absolute axis follows its relative one
+  bool raw = mode == kJoystick_RawReports;
+  int32_t location = raw ? reportLocation : DeviceLocation( elementCounts[ 0 ] );
+  size_t axis = raw ? 1 : 0;
+  int32_t value = raw ? 300 : 700, rest = raw ? 700 : 512;
+  Joystick joy;
+  if( !joy.Initialise( location, mode ) ) return "unable to initialise";
+  if( joy.Acquisition() != mode ) return "the joystick isn't in the mode asked for";
+  
+  uint64_t before = JoyNowTicks();
+  FakeHIDSetInput( location, axis, value );
+  int32_t counts[ 2 ] = { 0, 0 };
+  for( size_t ii=0; ii<1000 && counts[ axis ] != value; ii++ )
+  {
+    joy.PollAxes( counts, 2 );
+    if( counts[ axis ] != value ) usleep( 1000 );
+  }
+  uint64_t after = JoyNowTicks();
+  
+  const char *error = NULL;
+  uint64_t times[ 2 ] = { 0, 0 };
+  joy.PollTimesInto( kJoystick_Axes, times, 2 );
+  uint64_t newest = joy.NewestTimeStamp();
+  if( counts[ axis ] != value ) error = "the value wasn't delivered";
+  else if( times[ axis ] < before || times[ axis ] > after )
+  {
+    error = "the axis time stamp isn't when its value was produced";
+  }
+  else if( newest < times[ axis ] || newest > after )
+  {
+    error = "the newest time stamp isn't the axis's";
+  }
+  
+  // With no new value, the age grows with the clock and never exceeds the time since the
+  // value was produced
+  double first = joy.SampleAge(), age = first;
+  if( !error && ( first < 0.0 || first > JoyTicksToSeconds( JoyNowTicks() - before ) ) )
+  {
+    error = "the sample age isn't the time since the value was produced";
+  }
+  for( size_t ii=0; ii<numAges && !error; ii++ )
+  {
+    usleep( ageSleep );
+    double next = joy.SampleAge();
+    if( next < age ) error = "the sample age went backwards";
+    else if( next > JoyTicksToSeconds( JoyNowTicks() - before ) ) error = "the sample age is too large";
+    age = next;
+  }
+  if( !error && age - first < 0.9*numAges*ageSleep*1e-6 ) error = "the sample age didn't grow with time";
+  
+  FakeHIDSetInput( location, axis, rest );
+  return error;
+}
@@ -57,14 +57,27 @@ Button::~Button( void )
  * \exception const char* exception thrown if the value cannot be read.
  */
 bool Button::ReadState( void )
+{
+  return (bool)ReadRaw();
+}
+
+/**
+ * \brief Read the raw (integer) value of the button from the device.
+ *
+ * \param[out] timeStamp If not NULL, receives the time stamp of the value.
+ * \return Raw value of the element, as reported by the device.
+ * \exception const char* exception thrown if the value cannot be read.
+ */
+long Button::ReadRaw( uint64_t *timeStamp )
 {
   // Get the value
   IOHIDValueRef myVal;
   IOReturn mySuccess = IOHIDDeviceGetValue( myDevice, myElement, &myVal );
-  // If successful, return the state of the button
+  // If successful, return the value of the button
   if( mySuccess == kIOReturnSuccess )
   {
-    return (bool)IOHIDValueGetIntegerValue( myVal );
+    if( timeStamp != NULL ) *timeStamp = IOHIDValueGetTimeStamp( myVal );
+    return IOHIDValueGetIntegerValue( myVal );
   }
   // Otherwise, throw an exception
   throw "Error reading button";
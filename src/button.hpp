@@ -58,6 +58,15 @@ class Button
      * \exception const char* exception thrown if the value cannot be read.
      */
     bool ReadState( void );
+    
+    /**
+     * \brief Read the raw (integer) value of the button from the device.
+     *
+     * \param[out] timeStamp If not NULL, receives the time stamp of the value.
+     * \return Raw value of the element, as reported by the device.
+     * \exception const char* exception thrown if the value cannot be read.
+     */
+    long ReadRaw( uint64_t *timeStamp = NULL );
   
   private:
     IOHIDElementRef myElement;
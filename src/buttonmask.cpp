@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "buttonmask.hpp"
+
+#if defined(BUTTONMASK_SSE2)
+  #include <emmintrin.h>
+#endif
+#if defined(BUTTONMASK_AVX2)
+  #include <immintrin.h>
+#endif
+
+// Compile the AVX2 kernel for AVX2 even when the rest isn't
+#if defined(BUTTONMASK_AVX2) && !defined(__AVX2__)
+  #define BUTTONMASK_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+  #define BUTTONMASK_TARGET_AVX2
+#endif
+
+/**
+ * \brief Expand buttons from ii on, one at a time, up to numButtons.
+ */
+static inline void ExpandButtonTail( const uint64_t *mask, size_t ii, size_t numButtons,
+                                                                       uint8_t *dest )
+{
+  for( ; ii<numButtons; ii++ )
+  {
+    dest[ ii ] = (uint8_t)( ( mask[ ii >> 6 ] >> ( ii & 63 ) ) & 1 );
+  }
+}
+
+#if defined(BUTTONMASK_SSE2)
+/**
+ * \brief Expand buttons from ii on, 16 at a time, while a whole 16 are left.
+ *
+ * \output Index of the first button left.
+ */
+static inline size_t ExpandButtonBlocksSSE2( const uint64_t *mask, size_t ii,
+                                             size_t numButtons, uint8_t *dest )
+{
+  // Spread the low mask byte over lanes 0-7 and the high byte over lanes 8-15, then
+  // test bit k%8 in lane k.
+  const __m128i bits = _mm_set_epi8( (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                     (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 );
+  const __m128i ones = _mm_set1_epi8( 1 );
+  for( ; ii+16<=numButtons; ii+=16 )
+  {
+    int chunk = (int)( ( mask[ ii >> 6 ] >> ( ii & 63 ) ) & 0xFFFF );
+    __m128i v = _mm_cvtsi32_si128( chunk );
+    v = _mm_unpacklo_epi8( v, v );
+    v = _mm_unpacklo_epi16( v, v );
+    v = _mm_unpacklo_epi32( v, v );
+    v = _mm_cmpeq_epi8( _mm_and_si128( v, bits ), bits );
+    _mm_storeu_si128( (__m128i *)( dest + ii ), _mm_and_si128( v, ones ) );
+  }
+  return ii;
+}
+#endif
+
+/**
+ * \brief Scalar version of ExpandButtonMask. Always available.
+ */
+void ExpandButtonMaskScalar( const uint64_t *mask, size_t numButtons, uint8_t *dest )
+{
+  ExpandButtonTail( mask, 0, numButtons, dest );
+}
+
+#if defined(BUTTONMASK_SSE2)
+/**
+ * \brief SSE2 version of ExpandButtonMask.
+ */
+void ExpandButtonMaskSSE2( const uint64_t *mask, size_t numButtons, uint8_t *dest )
+{
+  size_t ii = ExpandButtonBlocksSSE2( mask, 0, numButtons, dest );
+  ExpandButtonTail( mask, ii, numButtons, dest );
+}
+#endif
+
+#if defined(BUTTONMASK_AVX2)
+/**
+ * \brief Whether the CPU has AVX2, asked once.
+ */
+static bool DetectAVX2( void )
+{
+#if defined(__AVX2__)
+  return true;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports( "avx2" ) != 0;
+#endif
+}
+
+static const bool cpuHasAVX2 = DetectAVX2();
+
+/**
+ * \brief Whether the CPU can run ExpandButtonMaskAVX2.
+ */
+bool ButtonMaskHasAVX2( void )
+{
+  return cpuHasAVX2;
+}
+
+/**
+ * \brief AVX2 version of ExpandButtonMask. Only call it if ButtonMaskHasAVX2.
+ */
+BUTTONMASK_TARGET_AVX2
+void ExpandButtonMaskAVX2( const uint64_t *mask, size_t numButtons, uint8_t *dest )
+{
+  // 32 buttons per iteration. Broadcast the 32 bits to every dword, then shuffle so
+  // that byte lane k holds mask byte k/8, and test bit k%8 of it.
+  const __m256i shuffle = _mm256_setr_epi8( 0,0,0,0,0,0,0,0, 1,1,1,1,1,1,1,1,
+                                            2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3 );
+  const __m256i bits = _mm256_setr_epi8(
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80 );
+  const __m256i ones = _mm256_set1_epi8( 1 );
+  size_t ii = 0;
+  for( ; ii+32<=numButtons; ii+=32 )
+  {
+    uint32_t chunk = (uint32_t)( mask[ ii >> 6 ] >> ( ii & 63 ) );
+    __m256i v = _mm256_shuffle_epi8( _mm256_set1_epi32( (int)chunk ), shuffle );
+    v = _mm256_cmpeq_epi8( _mm256_and_si256( v, bits ), bits );
+    _mm256_storeu_si256( (__m256i *)( dest + ii ), _mm256_and_si256( v, ones ) );
+  }
+  // AVX2 implies SSE2, for a remaining 16
+  ii = ExpandButtonBlocksSSE2( mask, ii, numButtons, dest );
+  ExpandButtonTail( mask, ii, numButtons, dest );
+}
+#endif
+
+/**
+ * \brief Expand a packed button mask into one byte (0 or 1) per button.
+ *
+ * Uses AVX2 if it is built and the CPU has it, otherwise SSE2 on x86, otherwise the
+ * scalar version.
+ *
+ * \param[in] mask Packed button mask.
+ * \param[in] numButtons Number of buttons in the mask.
+ * \param[out] dest Destination, numButtons bytes long.
+ */
+void ExpandButtonMask( const uint64_t *mask, size_t numButtons, uint8_t *dest )
+{
+#if defined(BUTTONMASK_AVX2)
+  if( cpuHasAVX2 )
+  {
+    ExpandButtonMaskAVX2( mask, numButtons, dest );
+    return;
+  }
+#endif
+#if defined(BUTTONMASK_SSE2)
+  ExpandButtonMaskSSE2( mask, numButtons, dest );
+#else
+  ExpandButtonMaskScalar( mask, numButtons, dest );
+#endif
+}
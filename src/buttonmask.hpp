@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __BUTTONMASK_H__
+#define __BUTTONMASK_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * \brief Number of 64-bit words needed to hold a packed mask of numButtons buttons.
+ */
+inline size_t ButtonMaskWords( size_t numButtons )
+{
+  return ( numButtons + 63 )/64;
+}
+
+/**
+ * \brief Set or clear a single button in a packed mask.
+ *
+ * \param[in,out] mask Packed button mask. Button n is bit (n%64) of word n/64.
+ * \param[in] index Index of the button.
+ * \param[in] state New state of the button.
+ */
+inline void SetButtonMaskBit( uint64_t *mask, size_t index, bool state )
+{
+  uint64_t bit = (uint64_t)1 << ( index & 63 );
+  if( state ) mask[ index >> 6 ] |= bit;
+  else mask[ index >> 6 ] &= ~bit;
+}
+
+/**
+ * \brief Read a single button from a packed mask.
+ */
+inline bool GetButtonMaskBit( const uint64_t *mask, size_t index )
+{
+  return ( ( mask[ index >> 6 ] >> ( index & 63 ) ) & 1 ) != 0;
+}
+
+// The SIMD kernels built. The AVX2 one is built on 64-bit x86 by compilers that can
+// target it per function, and is then only used by CPUs that have it.
+#if defined(__SSE2__)
+  #define BUTTONMASK_SSE2
+#endif
+#if defined(__AVX2__) || ( defined(__x86_64__) && ( defined(__clang__) || \
+    ( defined(__GNUC__) && ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) ) ) ) )
+  #define BUTTONMASK_AVX2
+#endif
+
+/**
+ * \brief Expand a packed button mask into one byte (0 or 1) per button.
+ *
+ * Uses AVX2 if it is built and the CPU has it, otherwise SSE2 on x86, otherwise the
+ * scalar version.
+ *
+ * \param[in] mask Packed button mask.
+ * \param[in] numButtons Number of buttons in the mask.
+ * \param[out] dest Destination, numButtons bytes long.
+ */
+void ExpandButtonMask( const uint64_t *mask, size_t numButtons, uint8_t *dest );
+
+/**
+ * \brief Scalar version of ExpandButtonMask. Always available.
+ */
+void ExpandButtonMaskScalar( const uint64_t *mask, size_t numButtons, uint8_t *dest );
+
+#if defined(BUTTONMASK_SSE2)
+/**
+ * \brief SSE2 version of ExpandButtonMask.
+ */
+void ExpandButtonMaskSSE2( const uint64_t *mask, size_t numButtons, uint8_t *dest );
+#endif
+
+#if defined(BUTTONMASK_AVX2)
+/**
+ * \brief AVX2 version of ExpandButtonMask. Only call it if ButtonMaskHasAVX2.
+ */
+void ExpandButtonMaskAVX2( const uint64_t *mask, size_t numButtons, uint8_t *dest );
+
+/**
+ * \brief Whether the CPU can run ExpandButtonMaskAVX2.
+ */
+bool ButtonMaskHasAVX2( void );
+#endif
+
+#endif
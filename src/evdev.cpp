@@ -0,0 +1,685 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "evdev.hpp"
+#include "joytime.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+#define EVDEV_LONG_BITS ( 8*sizeof(unsigned long) )
+#define EVDEV_BITS_LONGS( n ) ( ( (n) + EVDEV_LONG_BITS - 1 ) / EVDEV_LONG_BITS )
+
+/**
+ * \brief Test a bit of a kernel bitmap (an array of longs).
+ */
+static bool TestBit( const unsigned long *bits, size_t bit )
+{
+  return ( bits[ bit/EVDEV_LONG_BITS ] >> ( bit%EVDEV_LONG_BITS ) ) & 1u;
+}
+
+/**
+ * \brief Whether an EV_ABS code is one of the hat axes.
+ */
+static bool IsHat( uint16_t code )
+{
+  return code >= ABS_HAT0X && code <= ABS_HAT3Y;
+}
+
+/**
+ * \brief Time stamp of an event in ticks. Devices are switched to the monotonic clock,
+ *  so these are the same ticks as JoyNowTicks.
+ */
+static uint64_t EventTime( const struct input_event &ev )
+{
+  return (uint64_t)ev.time.tv_sec*1000000000u + (uint64_t)ev.time.tv_usec*1000u;
+}
+
+/**
+ * \brief Location key of a Linux input device: a 32 bit FNV-1a hash of its physical
+ *  path (or of its node's path if it has none).
+ */
+int32_t EvdevLocationKey( const std::string &text )
+{
+  uint32_t hash = 2166136261u;
+  for( size_t ii=0; ii<text.size(); ii++ )
+  {
+    hash ^= (uint8_t)text[ ii ];
+    hash *= 16777619u;
+  }
+  // A location key of 0 means an error elsewhere
+  return hash == 0 ? 1 : (int32_t)hash;
+}
+
+static bool NodeCompare( const EvdevNode &i, const EvdevNode &j )
+{
+  return i.locationKey < j.locationKey;
+}
+
+/**
+ * \brief Read the capabilities (and current state) of an evdev device.
+ *
+ * \param[in] fd Open file descriptor of the device.
+ * \param[out] caps Capabilities of the device.
+ * \return true if successful, false if fd is not an evdev device.
+ */
+bool EvdevReadCaps( int fd, EvdevCaps &caps )
+{
+  unsigned long evBits[ EVDEV_BITS_LONGS( EV_CNT ) ];
+  unsigned long absBits[ EVDEV_BITS_LONGS( ABS_CNT ) ];
+  unsigned long keyBits[ EVDEV_BITS_LONGS( KEY_CNT ) ];
+  unsigned long keyState[ EVDEV_BITS_LONGS( KEY_CNT ) ];
+  memset( evBits, 0, sizeof(evBits) );
+  memset( absBits, 0, sizeof(absBits) );
+  memset( keyBits, 0, sizeof(keyBits) );
+  memset( keyState, 0, sizeof(keyState) );
+  if( ioctl( fd, EVIOCGBIT( 0, sizeof(evBits) ), evBits ) < 0 ) return false;
+  
+  char text[ 256 ];
+  caps.name.clear();
+  caps.phys.clear();
+  memset( text, 0, sizeof(text) );
+  if( ioctl( fd, EVIOCGNAME( sizeof(text) - 1 ), text ) >= 0 ) caps.name = text;
+  memset( text, 0, sizeof(text) );
+  if( ioctl( fd, EVIOCGPHYS( sizeof(text) - 1 ), text ) >= 0 ) caps.phys = text;
+  struct input_id id;
+  memset( &id, 0, sizeof(id) );
+  ioctl( fd, EVIOCGID, &id );
+  caps.vendorID = id.vendor;
+  caps.productID = id.product;
+  
+  caps.abs.clear();
+  if( TestBit( evBits, EV_ABS ) && ioctl( fd, EVIOCGBIT( EV_ABS, sizeof(absBits) ), absBits ) >= 0 )
+  {
+    for( uint16_t code=0; code<ABS_CNT; code++ )
+    {
+      struct input_absinfo info;
+      if( !TestBit( absBits, code ) || ioctl( fd, EVIOCGABS( code ), &info ) < 0 ) continue;
+      EvdevAbsInfo abs = { code, info.minimum, info.maximum, info.value };
+      caps.abs.push_back( abs );
+    }
+  }
+  
+  caps.keys.clear();
+  caps.pressed.clear();
+  if( TestBit( evBits, EV_KEY ) && ioctl( fd, EVIOCGBIT( EV_KEY, sizeof(keyBits) ), keyBits ) >= 0 )
+  {
+    ioctl( fd, EVIOCGKEY( sizeof(keyState) ), keyState );
+    for( uint16_t code=0; code<KEY_CNT; code++ )
+    {
+      if( !TestBit( keyBits, code ) ) continue;
+      caps.keys.push_back( code );
+      if( TestBit( keyState, code ) ) caps.pressed.push_back( code );
+    }
+  }
+  return true;
+}
+
+/**
+ * \brief Whether a device looks like a joystick or gamepad: it has an X axis or a hat,
+ *  and a joystick or gamepad button.
+ */
+bool EvdevIsJoystick( const EvdevCaps &caps )
+{
+  bool hasAxis = false, hasButton = false;
+  for( size_t ii=0; ii<caps.abs.size(); ii++ )
+  {
+    if( caps.abs[ ii ].code == ABS_X || caps.abs[ ii ].code == ABS_HAT0X ) hasAxis = true;
+  }
+  for( size_t ii=0; ii<caps.keys.size(); ii++ )
+  {
+    uint16_t code = caps.keys[ ii ];
+    if( ( code >= BTN_JOYSTICK && code < BTN_DIGI ) ||
+        ( code >= BTN_TRIGGER_HAPPY && code <= BTN_TRIGGER_HAPPY40 ) ) hasButton = true;
+  }
+  return hasAxis && hasButton;
+}
+
+/**
+ * \brief List the joysticks among the event devices in a directory.
+ *
+ * \param[in] dir Directory of event devices (normally /dev/input).
+ * \return Joysticks found, sorted by location key.
+ */
+std::vector<EvdevNode> EvdevScan( const char *dir )
+{
+  std::vector<EvdevNode> nodes;
+  DIR *d = opendir( dir );
+  if( d == NULL ) return nodes;
+  struct dirent *entry;
+  while( ( entry = readdir( d ) ) != NULL )
+  {
+    if( strncmp( entry->d_name, "event", 5 ) != 0 ) continue;
+    EvdevNode node;
+    node.path = std::string( dir ) + "/" + entry->d_name;
+    int fd = open( node.path.c_str(), O_RDONLY | O_NONBLOCK );
+    if( fd < 0 ) continue;
+    if( EvdevReadCaps( fd, node.caps ) && EvdevIsJoystick( node.caps ) )
+    {
+      node.locationKey = EvdevLocationKey( node.caps.phys.empty() ? node.path : node.caps.phys );
+      nodes.push_back( node );
+    }
+    close( fd );
+  }
+  closedir( d );
+  std::sort( nodes.begin(), nodes.end(), NodeCompare );
+  return nodes;
+}
+
+/**
+ * \brief EvdevDevice constructor. The snapshot is seeded with the state in caps.
+ *
+ * \param[in] fd File descriptor to read input_events from. It is made non-blocking.
+ * \param[in] caps Capabilities of the device.
+ * \param[in] ownsFd Whether the destructor should close fd.
+ */
+EvdevDevice::EvdevDevice( int fd, const EvdevCaps &caps, bool ownsFd ) : myCaps( caps )
+{
+  myFd = fd;
+  myOwnsFd = ownsFd;
+  myClosed = false;
+  myDropping = false;
+  myCarryBytes = 0;
+  fcntl( myFd, F_SETFL, fcntl( myFd, F_GETFL ) | O_NONBLOCK );
+  // Time stamp events with the monotonic clock (fails harmlessly on a pipe)
+  int clockID = CLOCK_MONOTONIC;
+  ioctl( myFd, EVIOCSCLOCKID, &clockID );
+  
+  // Flat code tables, as for the IOKit element cookies
+  CodeSlot unmapped = { kJoystick_Outputs, 0 };
+  myAbsSlots.assign( ABS_CNT, unmapped );
+  myKeySlots.assign( KEY_CNT, unmapped );
+  for( size_t ii=0; ii<kJoystick_Outputs; ii++ ) myCounts[ ii ] = 0;
+  
+  // Hat pairs become POVs, in hat order
+  int povOfHat[ 4 ] = { -1, -1, -1, -1 };
+  for( size_t ii=0; ii<myCaps.abs.size(); ii++ )
+  {
+    if( IsHat( myCaps.abs[ ii ].code ) ) povOfHat[ ( myCaps.abs[ ii ].code - ABS_HAT0X )/2 ] = 0;
+  }
+  for( size_t ii=0; ii<4; ii++ )
+  {
+    if( povOfHat[ ii ] == 0 ) povOfHat[ ii ] = (int)myCounts[ kJoystick_POVs ]++;
+  }
+  myHats.assign( 2*myCounts[ kJoystick_POVs ], 0 );
+  for( size_t ii=0; ii<myCaps.abs.size(); ii++ )
+  {
+    const EvdevAbsInfo &abs = myCaps.abs[ ii ];
+    if( abs.code >= ABS_CNT ) continue;
+    CodeSlot &slot = myAbsSlots[ abs.code ];
+    if( IsHat( abs.code ) )
+    {
+      // The index is of the hat component, two per POV
+      size_t hat = (size_t)( abs.code - ABS_HAT0X );
+      slot.type = kJoystick_POVs;
+      slot.index = (uint32_t)( 2*povOfHat[ hat/2 ] + hat%2 );
+      myHats[ slot.index ] = (int8_t)( abs.value < 0 ? -1 : abs.value > 0 ? 1 : 0 );
+    }
+    else
+    {
+      slot.type = kJoystick_Axes;
+      slot.index = (uint32_t)myCounts[ kJoystick_Axes ]++;
+      myAxes.Add( abs.min, abs.max, false );
+    }
+  }
+  for( size_t ii=0; ii<myCaps.keys.size(); ii++ )
+  {
+    if( myCaps.keys[ ii ] >= KEY_CNT ) continue;
+    myKeySlots[ myCaps.keys[ ii ] ].type = kJoystick_Buttons;
+    myKeySlots[ myCaps.keys[ ii ] ].index = (uint32_t)myCounts[ kJoystick_Buttons ]++;
+  }
+  
+  // Seed the snapshot
+  mySnapshot.Resize( myCounts[ kJoystick_Axes ], myCounts[ kJoystick_Buttons ],
+                     myCounts[ kJoystick_POVs ] );
+  uint64_t time = JoyNowTicks();
+  mySnapshot.BeginWrite();
+  for( size_t ii=0; ii<myCaps.abs.size(); ii++ )
+  {
+    const EvdevAbsInfo &abs = myCaps.abs[ ii ];
+    if( abs.code < ABS_CNT && myAbsSlots[ abs.code ].type == kJoystick_Axes )
+      mySnapshot.Store( kJoystick_Axes, myAbsSlots[ abs.code ].index, abs.value, time );
+  }
+  for( size_t ii=0; ii<myCaps.pressed.size(); ii++ )
+  {
+    uint16_t code = myCaps.pressed[ ii ];
+    if( code < KEY_CNT && myKeySlots[ code ].type == kJoystick_Buttons )
+      mySnapshot.Store( kJoystick_Buttons, myKeySlots[ code ].index, 1, time );
+  }
+  for( size_t ii=0; ii<myCounts[ kJoystick_POVs ]; ii++ )
+  {
+    mySnapshot.Store( kJoystick_POVs, ii, HatDirection( ii ), time );
+  }
+  mySnapshot.EndWrite();
+}
+
+/**
+ * \brief EvdevDevice destructor. The device must have been removed from any loop.
+ */
+EvdevDevice::~EvdevDevice()
+{
+  if( myOwnsFd ) close( myFd );
+}
+
+/**
+ * \brief File descriptor the events are read from.
+ */
+int EvdevDevice::Fd( void ) const
+{
+  return myFd;
+}
+
+/**
+ * \brief Capabilities the device was created with.
+ */
+const EvdevCaps &EvdevDevice::Caps( void ) const
+{
+  return myCaps;
+}
+
+/**
+ * \brief Number of elements of the given type (kJoystick_Outputs is always 0).
+ */
+size_t EvdevDevice::Count( JoystickIOIndex type ) const
+{
+  return type < kJoystick_Outputs ? myCounts[ type ] : 0;
+}
+
+/**
+ * \brief Snapshot of the element values, written by the loop thread.
+ */
+JoySnapshot &EvdevDevice::Snapshot( void )
+{
+  return mySnapshot;
+}
+
+/**
+ * \brief Normalisation table of the axes, in axis order.
+ */
+AxisTable &EvdevDevice::Axes( void )
+{
+  return myAxes;
+}
+
+/**
+ * \brief Whether the stream has ended or failed (such as the device being unplugged).
+ */
+bool EvdevDevice::Closed( void ) const
+{
+  return myClosed;
+}
+
+/**
+ * \brief Read every input_event waiting on the file descriptor, in reads of up to the
+ *  given buffer size, and decode them.
+ *
+ * \param[in] buffer Scratch buffer.
+ * \param[in] size Size of buffer in bytes (at least one input_event).
+ * \param[out] reads Incremented for every read call made.
+ * \return Number of events decoded.
+ */
+size_t EvdevDevice::Drain( uint8_t *buffer, size_t size, uint64_t *reads )
+{
+  const size_t eventSize = sizeof(struct input_event);
+  size_t whole = size - size % eventSize;
+  size_t decoded = 0;
+  while( !myClosed )
+  {
+    // A pipe may split an event across reads; an event device never does
+    memcpy( buffer, myCarry, myCarryBytes );
+    ssize_t got = read( myFd, buffer + myCarryBytes, whole - myCarryBytes );
+    (*reads)++;
+    if( got < 0 )
+    {
+      if( errno == EINTR ) continue;
+      if( errno != EAGAIN && errno != EWOULDBLOCK ) myClosed = true;
+      break;
+    }
+    if( got == 0 )
+    {
+      myClosed = true;
+      break;
+    }
+    size_t bytes = myCarryBytes + (size_t)got;
+    size_t count = bytes/eventSize;
+    Decode( (const struct input_event *)buffer, count );
+    decoded += count;
+    myCarryBytes = bytes - count*eventSize;
+    memcpy( myCarry, buffer + count*eventSize, myCarryBytes );
+    // A short read means nothing more is waiting
+    if( bytes < whole ) break;
+  }
+  return decoded;
+}
+
+/**
+ * \brief Decode a batch of events.
+ */
+void EvdevDevice::Decode( const struct input_event *events, size_t count )
+{
+  for( size_t ii=0; ii<count; ii++ )
+  {
+    const struct input_event &ev = events[ ii ];
+    if( ev.type == EV_SYN )
+    {
+      if( ev.code == SYN_DROPPED )
+      {
+        // The kernel's buffer overflowed: ignore everything up to the next report
+        myDropping = true;
+        myPending.clear();
+      }
+      else if( ev.code == SYN_REPORT )
+      {
+        if( myDropping )
+        {
+          myDropping = false;
+          Resync( EventTime( ev ) );
+        }
+        else Commit( EventTime( ev ) );
+      }
+      continue;
+    }
+    if( myDropping ) continue;
+    if( ev.type == EV_ABS && ev.code < ABS_CNT )
+    {
+      AbsChanged( ev.code, ev.value );
+    }
+    else if( ev.type == EV_KEY && ev.code < KEY_CNT )
+    {
+      const CodeSlot &slot = myKeySlots[ ev.code ];
+      if( slot.type != kJoystick_Buttons ) continue;
+      // 2 is auto-repeat, which is still pressed
+      Change change = { kJoystick_Buttons, slot.index, ev.value != 0 ? 1 : 0 };
+      myPending.push_back( change );
+    }
+  }
+}
+
+/**
+ * \brief Convert a POV direction (as stored in the snapshot) into an angle in degrees,
+ *  or -1 if centred.
+ */
+double EvdevDevice::DecodePOV( size_t index, int32_t raw ) const
+{
+  (void)index;
+  if( raw < 0 || raw > 7 ) return -1.0;
+  return 45.0*raw;
+}
+
+/**
+ * \brief Write the pending changes into the snapshot.
+ */
+void EvdevDevice::Commit( uint64_t time )
+{
+  if( myPending.empty() ) return;
+  mySnapshot.BeginWrite();
+  for( size_t ii=0; ii<myPending.size(); ii++ )
+  {
+    mySnapshot.Store( myPending[ ii ].type, myPending[ ii ].index, myPending[ ii ].value, time );
+  }
+  mySnapshot.EndWrite();
+  myPending.clear();
+}
+
+/**
+ * \brief Queue a change of an EV_ABS code.
+ */
+void EvdevDevice::AbsChanged( uint16_t code, int32_t value )
+{
+  const CodeSlot &slot = myAbsSlots[ code ];
+  if( slot.type == kJoystick_Axes )
+  {
+    Change change = { kJoystick_Axes, slot.index, value };
+    myPending.push_back( change );
+  }
+  else if( slot.type == kJoystick_POVs )
+  {
+    myHats[ slot.index ] = (int8_t)( value < 0 ? -1 : value > 0 ? 1 : 0 );
+    Change change = { kJoystick_POVs, slot.index/2, HatDirection( slot.index/2 ) };
+    myPending.push_back( change );
+  }
+}
+
+/**
+ * \brief Direction (0 up, clockwise to 7, or -1 when centred) of a hat.
+ */
+int32_t EvdevDevice::HatDirection( size_t pov ) const
+{
+  static const int32_t directions[ 3 ][ 3 ] = { { 7, 0, 1 }, { 6, -1, 2 }, { 5, 4, 3 } };
+  return directions[ myHats[ 2*pov+1 ] + 1 ][ myHats[ 2*pov ] + 1 ];
+}
+
+/**
+ * \brief Re-read the whole state after the kernel dropped events (SYN_DROPPED). Only
+ *  possible for a real device; a stream just carries on from the next report.
+ */
+void EvdevDevice::Resync( uint64_t time )
+{
+  EvdevCaps state;
+  if( !EvdevReadCaps( myFd, state ) ) return;
+  myPending.clear();
+  for( size_t ii=0; ii<state.abs.size(); ii++ ) AbsChanged( state.abs[ ii ].code, state.abs[ ii ].value );
+  for( size_t ii=0; ii<myCaps.keys.size(); ii++ )
+  {
+    uint16_t code = myCaps.keys[ ii ];
+    if( code >= KEY_CNT || myKeySlots[ code ].type != kJoystick_Buttons ) continue;
+    bool down = std::binary_search( state.pressed.begin(), state.pressed.end(), code );
+    Change change = { kJoystick_Buttons, myKeySlots[ code ].index, down ? 1 : 0 };
+    myPending.push_back( change );
+  }
+  Commit( time );
+}
+
+/**
+ * \brief EvdevLoop constructor. The thread is started by the first Add.
+ *
+ * \param[in] bufferEvents Size of the read buffer, in input_events.
+ */
+EvdevLoop::EvdevLoop( size_t bufferEvents )
+{
+  myEpoll = -1;
+  myWake[ 0 ] = myWake[ 1 ] = -1;
+  myStarted = false;
+  myRunning = false;
+  myBuffer.assign( std::max( bufferEvents, (size_t)1 )*sizeof(struct input_event), 0 );
+  myEvents = 0;
+  myReads = 0;
+  pthread_mutex_init( &myMutex, NULL );
+}
+
+/**
+ * \brief EvdevLoop destructor. Stops the thread. Devices are not deleted.
+ */
+EvdevLoop::~EvdevLoop()
+{
+  if( myStarted )
+  {
+    myRunning = false;
+    char wake = 0;
+    while( write( myWake[ 1 ], &wake, 1 ) < 0 && errno == EINTR ) {}
+    pthread_join( myThread, NULL );
+  }
+  if( myEpoll >= 0 ) close( myEpoll );
+  if( myWake[ 0 ] >= 0 ) close( myWake[ 0 ] );
+  if( myWake[ 1 ] >= 0 ) close( myWake[ 1 ] );
+  pthread_mutex_destroy( &myMutex );
+}
+
+/**
+ * \brief Start draining a device.
+ *
+ * \return true if successful, false if the thread or epoll couldn't be set up.
+ */
+bool EvdevLoop::Add( EvdevSource *device )
+{
+  pthread_mutex_lock( &myMutex );
+  if( !myStarted && !StartLocked() )
+  {
+    pthread_mutex_unlock( &myMutex );
+    return false;
+  }
+  struct epoll_event ev;
+  memset( &ev, 0, sizeof(ev) );
+  ev.events = EPOLLIN;
+  ev.data.ptr = device;
+  if( epoll_ctl( myEpoll, EPOLL_CTL_ADD, device->Fd(), &ev ) != 0 )
+  {
+    ERR_PRINTF("EvdevLoop::Add - Failed to add a device to epoll.\n");
+    pthread_mutex_unlock( &myMutex );
+    return false;
+  }
+  myDevices.push_back( device );
+  pthread_mutex_unlock( &myMutex );
+  return true;
+}
+
+/**
+ * \brief Stop draining a device. Once this returns, the loop no longer uses it.
+ */
+void EvdevLoop::Remove( EvdevSource *device )
+{
+  // The thread holds the mutex while it handles a batch of ready devices, and the
+  // next batch can't include a device that is no longer registered.
+  pthread_mutex_lock( &myMutex );
+  std::vector<EvdevSource *>::iterator it = std::find( myDevices.begin(), myDevices.end(), device );
+  if( it != myDevices.end() )
+  {
+    epoll_ctl( myEpoll, EPOLL_CTL_DEL, device->Fd(), NULL );
+    myDevices.erase( it );
+  }
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Number of devices being drained.
+ */
+size_t EvdevLoop::Size( void )
+{
+  pthread_mutex_lock( &myMutex );
+  size_t size = myDevices.size();
+  pthread_mutex_unlock( &myMutex );
+  return size;
+}
+
+/**
+ * \brief Number of events decoded since the loop was created.
+ */
+uint64_t EvdevLoop::EventsRead( void ) const
+{
+  return myEvents;
+}
+
+/**
+ * \brief Number of read calls made since the loop was created.
+ */
+uint64_t EvdevLoop::ReadCalls( void ) const
+{
+  return myReads;
+}
+
+/**
+ * \brief Create the epoll instance and start the thread (myMutex must be held).
+ */
+bool EvdevLoop::StartLocked( void )
+{
+  myEpoll = epoll_create( 16 );
+  if( myEpoll < 0 || pipe( myWake ) != 0 )
+  {
+    ERR_PRINTF("EvdevLoop::StartLocked - Failed to create epoll.\n");
+    return false;
+  }
+  // The wake pipe is the only descriptor with a NULL pointer
+  struct epoll_event ev;
+  memset( &ev, 0, sizeof(ev) );
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl( myEpoll, EPOLL_CTL_ADD, myWake[ 0 ], &ev );
+  
+  myRunning = true;
+  if( pthread_create( &myThread, NULL, &EvdevLoop::LoopThread, this ) != 0 )
+  {
+    myRunning = false;
+    return false;
+  }
+  myStarted = true;
+  return true;
+}
+
+/**
+ * \brief Loop thread. Waits on every device and drains those that are readable.
+ */
+void *EvdevLoop::LoopThread( void *context )
+{
+  EvdevLoop *loop = (EvdevLoop *)context;
+  struct epoll_event ready[ 64 ];
+  while( loop->myRunning )
+  {
+    int num = epoll_wait( loop->myEpoll, ready, 64, -1 );
+    if( num < 0 )
+    {
+      if( errno == EINTR ) continue;
+      ERR_PRINTF("EvdevLoop::LoopThread - epoll_wait failed.\n");
+      break;
+    }
+    pthread_mutex_lock( &loop->myMutex );
+    uint64_t events = 0, reads = 0;
+    for( int ii=0; ii<num; ii++ )
+    {
+      EvdevSource *device = (EvdevSource *)ready[ ii ].data.ptr;
+      if( device == NULL ) continue;
+      events += device->Drain( &loop->myBuffer.front(), loop->myBuffer.size(), &reads );
+      // An ended stream stays readable forever, so stop waiting on it
+      if( device->Closed() ) epoll_ctl( loop->myEpoll, EPOLL_CTL_DEL, device->Fd(), NULL );
+    }
+    loop->myEvents += events;
+    loop->myReads += reads;
+    pthread_mutex_unlock( &loop->myMutex );
+  }
+  return NULL;
+}
+
+/**
+ * \brief The process wide evdev loop.
+ */
+EvdevLoop &SharedEvdevLoop( void )
+{
+  static EvdevLoop loop;
+  return loop;
+}
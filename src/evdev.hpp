@@ -0,0 +1,351 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __EVDEV_H__
+#define __EVDEV_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/input.h>
+#include "snapshot.hpp"
+#include "axistable.hpp"
+
+/**
+ * \brief Range and current value of one absolute axis of an evdev device.
+ */
+struct EvdevAbsInfo
+{
+  uint16_t code;
+  int32_t min, max, value;
+};
+
+/**
+ * \brief What an evdev device reports: its EV_ABS axes and EV_KEY keys (both in code
+ *  order), and which keys are down. Read from a device with EvdevReadCaps, or filled
+ *  in by hand for a recorded stream played through a pipe.
+ */
+struct EvdevCaps
+{
+  std::string name;
+  std::string phys;
+  int32_t vendorID;
+  int32_t productID;
+  std::vector<EvdevAbsInfo> abs;
+  std::vector<uint16_t> keys;
+  std::vector<uint16_t> pressed;
+};
+
+/**
+ * \brief An evdev joystick found by EvdevScan.
+ */
+struct EvdevNode
+{
+  std::string path;
+  int32_t locationKey;
+  EvdevCaps caps;
+};
+
+/**
+ * \brief Read the capabilities (and current state) of an evdev device.
+ *
+ * \param[in] fd Open file descriptor of the device.
+ * \param[out] caps Capabilities of the device.
+ * \return true if successful, false if fd is not an evdev device.
+ */
+bool EvdevReadCaps( int fd, EvdevCaps &caps );
+
+/**
+ * \brief Whether a device looks like a joystick or gamepad: it has an X axis or a hat,
+ *  and a joystick or gamepad button.
+ */
+bool EvdevIsJoystick( const EvdevCaps &caps );
+
+/**
+ * \brief Location key of a Linux input device: a hash of its physical path (or of its
+ *  node's path if it has none), which stays the same while it is in the same port.
+ */
+int32_t EvdevLocationKey( const std::string &text );
+
+/**
+ * \brief List the joysticks among the event devices in a directory.
+ *
+ * The location key is from EvdevLocationKey.
+ *
+ * \param[in] dir Directory of event devices (normally /dev/input).
+ * \return Joysticks found, sorted by location key.
+ */
+std::vector<EvdevNode> EvdevScan( const char *dir = "/dev/input" );
+
+/**
+ * \brief A file descriptor drained by EvdevLoop, whose data is decoded into a JoySnapshot
+ *  with the axes, buttons and POV model of Joystick. EvdevDevice reads input_events and
+ *  HidrawDevice (see hidraw.hpp) raw HID reports.
+ */
+class EvdevSource
+{
+  public:
+    virtual ~EvdevSource() {}
+    
+    /**
+     * \brief File descriptor the data is read from.
+     */
+    virtual int Fd( void ) const = 0;
+    
+    /**
+     * \brief Number of elements of the given type (kJoystick_Outputs is always 0).
+     */
+    virtual size_t Count( JoystickIOIndex type ) const = 0;
+    
+    /**
+     * \brief Snapshot of the element values, written by the loop thread.
+     */
+    virtual JoySnapshot &Snapshot( void ) = 0;
+    
+    /**
+     * \brief Normalisation table of the axes, in axis order.
+     */
+    virtual AxisTable &Axes( void ) = 0;
+    
+    /**
+     * \brief Whether the stream has ended or failed (such as the device being unplugged).
+     */
+    virtual bool Closed( void ) const = 0;
+    
+    /**
+     * \brief Read and decode everything waiting on the file descriptor. Called by
+     *  EvdevLoop when the descriptor is readable.
+     *
+     * \param[in] buffer Scratch buffer.
+     * \param[in] size Size of buffer in bytes.
+     * \param[out] reads Incremented for every read call made.
+     * \return Number of events (or reports) decoded.
+     */
+    virtual size_t Drain( uint8_t *buffer, size_t size, uint64_t *reads ) = 0;
+    
+    /**
+     * \brief Convert the raw value of a POV, as stored in the snapshot, into an angle in
+     *  degrees, or -1 if centred.
+     */
+    virtual double DecodePOV( size_t index, int32_t raw ) const = 0;
+};
+
+/**
+ * \brief An evdev device (or a recorded stream of input_events) mapped onto the axes,
+ *  buttons and POV model used by Joystick, and decoded into a JoySnapshot.
+ *
+ * Every EV_ABS code except the hats becomes an axis, and every EV_KEY code a button,
+ * both in code order. Each ABS_HATnX/ABS_HATnY pair becomes one POV, stored in the
+ * snapshot as a direction of 0 (up) to 7 clockwise, or -1 when centred. Changes between
+ * SYN_REPORTs are held back and written to the snapshot together, so readers only ever
+ * see whole reports.
+ */
+class EvdevDevice : public EvdevSource
+{
+  public:
+    /**
+     * \brief EvdevDevice constructor. The snapshot is seeded with the state in caps.
+     *
+     * \param[in] fd File descriptor to read input_events from. It is made non-blocking.
+     * \param[in] caps Capabilities of the device.
+     * \param[in] ownsFd Whether the destructor should close fd.
+     */
+    EvdevDevice( int fd, const EvdevCaps &caps, bool ownsFd );
+    
+    /**
+     * \brief EvdevDevice destructor. The device must have been removed from any loop.
+     */
+    ~EvdevDevice();
+    
+    /**
+     * \brief Capabilities the device was created with.
+     */
+    const EvdevCaps &Caps( void ) const;
+    
+    // EvdevSource
+    int Fd( void ) const;
+    size_t Count( JoystickIOIndex type ) const;
+    JoySnapshot &Snapshot( void );
+    AxisTable &Axes( void );
+    bool Closed( void ) const;
+    
+    /**
+     * \brief Read every input_event waiting on the file descriptor, in reads of up to
+     *  the given buffer size, and decode them. Called by EvdevLoop when the descriptor
+     *  is readable.
+     *
+     * \param[in] buffer Scratch buffer.
+     * \param[in] size Size of buffer in bytes (at least one input_event).
+     * \param[out] reads Incremented for every read call made.
+     * \return Number of events decoded.
+     */
+    size_t Drain( uint8_t *buffer, size_t size, uint64_t *reads );
+    
+    /**
+     * \brief Decode a batch of events.
+     */
+    void Decode( const struct input_event *events, size_t count );
+    
+    /**
+     * \brief Convert a POV direction (as stored in the snapshot) into an angle in
+     *  degrees, or -1 if centred.
+     */
+    double DecodePOV( size_t index, int32_t raw ) const;
+    
+  private:
+    struct CodeSlot
+    {
+      JoystickIOIndex type;
+      uint32_t index;
+    };
+    struct Change
+    {
+      JoystickIOIndex type;
+      uint32_t index;
+      int32_t value;
+    };
+    int myFd;
+    bool myOwnsFd;
+    volatile bool myClosed;
+    EvdevCaps myCaps;
+    JoySnapshot mySnapshot;
+    AxisTable myAxes;
+    size_t myCounts[ kJoystick_Outputs ];
+    // Flat code tables, unmapped entries are marked with kJoystick_Outputs
+    std::vector<CodeSlot> myAbsSlots, myKeySlots;
+    // Hat positions (-1, 0 or 1), two per POV
+    std::vector<int8_t> myHats;
+    // Changes since the last SYN_REPORT
+    std::vector<Change> myPending;
+    bool myDropping;
+    // Bytes of a partial input_event left over by the last read
+    uint8_t myCarry[ sizeof(struct input_event) ];
+    size_t myCarryBytes;
+    
+    /**
+     * \brief Write the pending changes into the snapshot.
+     */
+    void Commit( uint64_t time );
+    
+    /**
+     * \brief Queue a change of an EV_ABS code.
+     */
+    void AbsChanged( uint16_t code, int32_t value );
+    
+    /**
+     * \brief Direction (0-7, or -1 when centred) of a hat.
+     */
+    int32_t HatDirection( size_t pov ) const;
+    
+    /**
+     * \brief Re-read the whole state after the kernel dropped events (SYN_DROPPED). Only
+     *  possible for a real device; a stream just carries on from the next report.
+     */
+    void Resync( uint64_t time );
+    
+    // Non-copyable
+    EvdevDevice( const EvdevDevice & );
+    EvdevDevice &operator=( const EvdevDevice & );
+};
+
+/**
+ * \brief Drains any number of EvdevSources from one epoll loop on a dedicated thread.
+ *
+ * Every readable device is drained with large batched reads into one buffer, so a busy
+ * device costs a few system calls per burst rather than one per event.
+ */
+class EvdevLoop
+{
+  public:
+    /**
+     * \brief EvdevLoop constructor. The thread is started by the first Add.
+     *
+     * \param[in] bufferEvents Size of the read buffer, in input_events.
+     */
+    EvdevLoop( size_t bufferEvents = 1024 );
+    
+    /**
+     * \brief EvdevLoop destructor. Stops the thread. Devices are not deleted.
+     */
+    ~EvdevLoop();
+    
+    /**
+     * \brief Start draining a device.
+     *
+     * \return true if successful, false if the thread or epoll couldn't be set up.
+     */
+    bool Add( EvdevSource *device );
+    
+    /**
+     * \brief Stop draining a device. Once this returns, the loop no longer uses it.
+     */
+    void Remove( EvdevSource *device );
+    
+    /**
+     * \brief Number of devices being drained.
+     */
+    size_t Size( void );
+    
+    /**
+     * \brief Number of events decoded, and read calls made, since the loop was created.
+     */
+    uint64_t EventsRead( void ) const;
+    uint64_t ReadCalls( void ) const;
+    
+  private:
+    int myEpoll;
+    int myWake[ 2 ];
+    pthread_t myThread;
+    pthread_mutex_t myMutex;
+    bool myStarted;
+    volatile bool myRunning;
+    std::vector<EvdevSource *> myDevices;
+    std::vector<uint8_t> myBuffer;
+    volatile uint64_t myEvents, myReads;
+    
+    /**
+     * \brief Create the epoll instance and start the thread (myMutex must be held).
+     */
+    bool StartLocked( void );
+    
+    /**
+     * \brief Loop thread. Waits on every device and drains those that are readable.
+     */
+    static void *LoopThread( void *context );
+    
+    // Non-copyable
+    EvdevLoop( const EvdevLoop & );
+    EvdevLoop &operator=( const EvdevLoop & );
+};
+
+/**
+ * \brief The process wide evdev loop.
+ */
+EvdevLoop &SharedEvdevLoop( void );
+
+#endif
@@ -0,0 +1,438 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "evdev_joystick.hpp"
+#include "buttonmask.hpp"
+#include "joytime.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief EvdevJoystick constructor.
+ */
+EvdevJoystick::EvdevJoystick()
+{
+  myDevice = NULL;
+}
+
+/**
+ * \brief EvdevJoystick destructor.
+ */
+EvdevJoystick::~EvdevJoystick()
+{
+  ReleaseDevice();
+}
+
+/**
+ * \brief Open a joystick.
+ *
+ * \param[in] joyLocation LocationKey of the joystick, from QueryAvailableDevices.
+ * \return true if successful, false if unsuccessful (such as the joystick doesn't exist
+ *  or can't be opened).
+ */
+bool EvdevJoystick::Initialise( int32_t joyLocation )
+{
+  ReleaseDevice();
+  std::vector<EvdevNode> nodes = EvdevScan();
+  for( size_t ii=0; ii<nodes.size(); ii++ )
+  {
+    if( nodes[ ii ].locationKey != joyLocation ) continue;
+    int fd = open( nodes[ ii ].path.c_str(), O_RDONLY | O_NONBLOCK );
+    if( fd < 0 )
+    {
+      ERR_PRINTF("Failed to open %s.\n", nodes[ ii ].path.c_str());
+      return false;
+    }
+    // Read the state again, now that the device is open
+    EvdevCaps caps;
+    if( !EvdevReadCaps( fd, caps ) )
+    {
+      close( fd );
+      return false;
+    }
+    return Attach( new EvdevDevice( fd, caps, true ) );
+  }
+  return false;
+}
+
+/**
+ * \brief Read input_events from a stream, such as a pipe playing back a recording, as
+ *  if it were a device with the given capabilities.
+ *
+ * \param[in] fd File descriptor of the stream. It is not closed by the joystick.
+ * \param[in] caps Capabilities of the recorded device.
+ * \return true if successful.
+ */
+bool EvdevJoystick::InitialiseStream( int fd, const EvdevCaps &caps )
+{
+  ReleaseDevice();
+  return Attach( new EvdevDevice( fd, caps, false ) );
+}
+
+/**
+ * \brief Open a joystick through hidraw, decoding its raw reports.
+ *
+ * \param[in] joyLocation LocationKey of the joystick, from QueryAvailableRawDevices.
+ * \return true if successful, false if unsuccessful (such as the joystick doesn't exist,
+ *  can't be opened, or has an unusable report descriptor).
+ */
+bool EvdevJoystick::InitialiseRaw( int32_t joyLocation )
+{
+  ReleaseDevice();
+  std::vector<HidrawNode> nodes = HidrawScan();
+  for( size_t ii=0; ii<nodes.size(); ii++ )
+  {
+    if( nodes[ ii ].locationKey != joyLocation ) continue;
+    int fd = open( nodes[ ii ].path.c_str(), O_RDONLY | O_NONBLOCK );
+    if( fd < 0 )
+    {
+      ERR_PRINTF("Failed to open %s.\n", nodes[ ii ].path.c_str());
+      return false;
+    }
+    const std::vector<uint8_t> &desc = nodes[ ii ].descriptor;
+    HidrawDevice *device = new HidrawDevice( fd, &desc.front(), desc.size(), true );
+    if( !device->Valid() )
+    {
+      ERR_PRINTF("%s has an unusable report descriptor.\n", nodes[ ii ].path.c_str());
+      delete device;
+      return false;
+    }
+    return Attach( device );
+  }
+  return false;
+}
+
+/**
+ * \brief Read raw input reports from a stream, such as a pipe playing back a capture, as
+ *  if it were a hidraw device with the given report descriptor.
+ *
+ * \param[in] fd File descriptor of the stream. It is not closed by the joystick.
+ * \param[in] descriptor Report descriptor bytes of the captured device.
+ * \param[in] len Length of the descriptor.
+ * \return true if successful, false if the descriptor is unusable.
+ */
+bool EvdevJoystick::InitialiseRawStream( int fd, const uint8_t *descriptor, size_t len )
+{
+  ReleaseDevice();
+  HidrawDevice *device = new HidrawDevice( fd, descriptor, len, false );
+  if( !device->Valid() )
+  {
+    delete device;
+    return false;
+  }
+  return Attach( device );
+}
+
+/**
+ * \brief Query joystick for IO capabilities
+ *
+ * \return An vector containing the number of axes, buttons, pov, outputs. If the joystick
+ *         has not been initialised yet, the result will be all -1.
+ */
+std::vector<int> EvdevJoystick::QueryIO( void )
+{
+  std::vector<int> result( 4, -1 );
+  if( myDevice != NULL )
+  {
+    result[ kJoystick_Axes ] = (int)myDevice->Count( kJoystick_Axes );
+    result[ kJoystick_Buttons ] = (int)myDevice->Count( kJoystick_Buttons );
+    result[ kJoystick_POVs ] = (int)myDevice->Count( kJoystick_POVs );
+    result[ kJoystick_Outputs ] = 0;
+  }
+  return result;
+}
+
+/**
+ * \brief Poll the joystick axes
+ *
+ * \output vector of normalised axes doubles.
+ */
+std::vector<double> EvdevJoystick::PollAxes( void )
+{
+  std::vector<double> axes( myDevice != NULL ? myDevice->Count( kJoystick_Axes ) : 0, 0.0 );
+  if( !axes.empty() ) PollAxesInto( &axes.front(), axes.size() );
+  return axes;
+}
+
+/**
+ * \brief Poll the joystick axes into a caller supplied buffer. Does not allocate.
+ *
+ * \param[out] dest Buffer for the normalised axes.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of axes on the joystick.
+ */
+size_t EvdevJoystick::PollAxesInto( double *dest, size_t len )
+{
+  if( myDevice == NULL ) return 0;
+  size_t num = std::min( len, myDevice->Count( kJoystick_Axes ) );
+  myDevice->Snapshot().Read( kJoystick_Axes, &myRaw.front() );
+  myDevice->Axes().Normalise( &myRaw.front(), dest, num );
+  return myDevice->Count( kJoystick_Axes );
+}
+
+/**
+ * \brief Poll the joystick buttons
+ *
+ * \output vector of button boolean values.
+ */
+std::vector<bool> EvdevJoystick::PollButtons( void )
+{
+  std::vector<bool> buttons( myDevice != NULL ? myDevice->Count( kJoystick_Buttons ) : 0, false );
+  if( buttons.empty() ) return buttons;
+  PollButtonMask( &myButtonWords.front(), myButtonWords.size() );
+  for( size_t ii=0; ii<buttons.size(); ii++ )
+  {
+    buttons[ ii ] = GetButtonMaskBit( &myButtonWords.front(), ii );
+  }
+  return buttons;
+}
+
+/**
+ * \brief Poll the joystick buttons into a caller supplied buffer. Does not allocate.
+ *
+ * \param[out] dest Buffer for the button states (0 or 1).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of buttons on the joystick.
+ */
+size_t EvdevJoystick::PollButtonsInto( uint8_t *dest, size_t len )
+{
+  if( myDevice == NULL ) return 0;
+  PollButtonMask( &myButtonWords.front(), myButtonWords.size() );
+  ExpandButtonMask( &myButtonWords.front(), std::min( len, myDevice->Count( kJoystick_Buttons ) ),
+                    dest );
+  return myDevice->Count( kJoystick_Buttons );
+}
+
+/**
+ * \brief Poll the joystick buttons as a packed mask (see buttonmask.hpp).
+ *
+ * \param[out] dest Buffer for the mask. Button n is bit (n%64) of word n/64.
+ * \param[in] numWords Length of dest in words. Buttons beyond 64*numWords are dropped.
+ * \output Number of buttons on the joystick.
+ */
+size_t EvdevJoystick::PollButtonMask( uint64_t *dest, size_t numWords )
+{
+  if( myDevice == NULL ) return 0;
+  size_t numButtons = myDevice->Count( kJoystick_Buttons );
+  size_t words = std::min( numWords, ButtonMaskWords( numButtons ) );
+  if( words == ButtonMaskWords( numButtons ) )
+  {
+    myDevice->Snapshot().ReadButtonMask( dest );
+  }
+  else
+  {
+    myDevice->Snapshot().ReadButtonMask( &myButtonWords.front() );
+    std::copy( myButtonWords.begin(), myButtonWords.begin()+words, dest );
+  }
+  return numButtons;
+}
+
+/**
+ * \brief Poll the joystick POV hats
+ *
+ * \output vector of POV doubles. The value corresponds to the angle (degrees) and
+ *         -1 corresponds to nothing pressed.
+ */
+std::vector<double> EvdevJoystick::PollPOV( void )
+{
+  std::vector<double> POVs( myDevice != NULL ? myDevice->Count( kJoystick_POVs ) : 0, -1.0 );
+  if( !POVs.empty() ) PollPOVInto( &POVs.front(), POVs.size() );
+  return POVs;
+}
+
+/**
+ * \brief Poll the joystick POV hats into a caller supplied buffer. Does not allocate.
+ *
+ * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of POV hats on the joystick.
+ */
+size_t EvdevJoystick::PollPOVInto( double *dest, size_t len )
+{
+  if( myDevice == NULL ) return 0;
+  size_t num = std::min( len, myDevice->Count( kJoystick_POVs ) );
+  myDevice->Snapshot().Read( kJoystick_POVs, &myRaw.front() );
+  for( size_t ii=0; ii<num; ii++ ) dest[ ii ] = myDevice->DecodePOV( ii, myRaw[ ii ] );
+  return myDevice->Count( kJoystick_POVs );
+}
+
+/**
+ * \brief Time stamps (ticks, see joytime.hpp) of the latest value of each element of the
+ *  given type.
+ *
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ * \param[out] dest Buffer for the time stamps.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of elements of the given type.
+ */
+size_t EvdevJoystick::PollTimesInto( JoystickIOIndex type, uint64_t *dest, size_t len )
+{
+  if( myDevice == NULL || type == kJoystick_Outputs ) return 0;
+  size_t count = myDevice->Count( type );
+  if( count == 0 ) return 0;
+  if( len >= count )
+  {
+    myDevice->Snapshot().ReadTimes( type, dest );
+  }
+  else
+  {
+    std::vector<uint64_t> times( count );
+    myDevice->Snapshot().ReadTimes( type, &times.front() );
+    std::copy( times.begin(), times.begin()+len, dest );
+  }
+  return count;
+}
+
+/**
+ * \brief Time stamp (ticks) of the newest value of any element, or 0 if none.
+ */
+uint64_t EvdevJoystick::NewestTimeStamp( void )
+{
+  return myDevice != NULL ? myDevice->Snapshot().NewestTime() : 0;
+}
+
+/**
+ * \brief Age (seconds) of the newest value of any element, or -1 if none.
+ */
+double EvdevJoystick::SampleAge( void )
+{
+  uint64_t newest = NewestTimeStamp();
+  if( newest == 0 ) return -1.0;
+  uint64_t now = JoyNowTicks();
+  return now > newest ? JoyTicksToSeconds( now - newest ) : 0.0;
+}
+
+/**
+ * \brief Push the inputs to the joystick. Evdev outputs aren't mapped, so this does
+ *  nothing.
+ */
+void EvdevJoystick::PushInputs( const std::vector<double> &normInputs )
+{
+  (void)normInputs;
+}
+
+/**
+ * \brief Push the inputs to the joystick. Evdev outputs aren't mapped, so this does
+ *  nothing.
+ */
+void EvdevJoystick::PushInputs( const double *normInputs, size_t len )
+{
+  (void)normInputs;
+  (void)len;
+}
+
+/**
+ * \brief Whether the device (or stream) is still delivering events.
+ */
+bool EvdevJoystick::Connected( void )
+{
+  return myDevice != NULL && !myDevice->Closed();
+}
+
+/**
+ * \brief Query for the available joysticks.
+ *
+ * \output vector of JoyDev objects, sorted by location key.
+ */
+std::vector<JoyDev> EvdevJoystick::QueryAvailableDevices( void )
+{
+  std::vector<EvdevNode> nodes = EvdevScan();
+  std::vector<JoyDev> devs( nodes.size() );
+  for( size_t ii=0; ii<nodes.size(); ii++ )
+  {
+    devs[ ii ].productKey = nodes[ ii ].caps.name;
+    devs[ ii ].locationKey = nodes[ ii ].locationKey;
+  }
+  return devs;
+}
+
+/**
+ * \brief Query for the number of available joysticks.
+ *
+ * \output number of available joysticks
+ */
+unsigned int EvdevJoystick::QueryNumberDevices( void )
+{
+  return (unsigned int)EvdevScan().size();
+}
+
+/**
+ * \brief Query for the joysticks available through hidraw.
+ *
+ * \output vector of JoyDev objects, sorted by location key.
+ */
+std::vector<JoyDev> EvdevJoystick::QueryAvailableRawDevices( void )
+{
+  std::vector<HidrawNode> nodes = HidrawScan();
+  std::vector<JoyDev> devs( nodes.size() );
+  for( size_t ii=0; ii<nodes.size(); ii++ )
+  {
+    devs[ ii ].productKey = nodes[ ii ].name;
+    devs[ ii ].locationKey = nodes[ ii ].locationKey;
+  }
+  return devs;
+}
+
+/**
+ * \brief Start draining a device. The joystick takes ownership of it.
+ */
+bool EvdevJoystick::Attach( EvdevSource *device )
+{
+  myDevice = device;
+  size_t maxElements = std::max( myDevice->Count( kJoystick_Axes ),
+                                 myDevice->Count( kJoystick_POVs ) );
+  myRaw.assign( std::max( maxElements, (size_t)1 ), 0 );
+  myButtonWords.assign( std::max( ButtonMaskWords( myDevice->Count( kJoystick_Buttons ) ),
+                                  (size_t)1 ), 0 );
+  if( !SharedEvdevLoop().Add( myDevice ) )
+  {
+    ERR_PRINTF("EvdevJoystick::Attach - Failed to start draining the device.\n");
+    delete myDevice;
+    myDevice = NULL;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Stop draining and delete the device.
+ */
+void EvdevJoystick::ReleaseDevice( void )
+{
+  if( myDevice == NULL ) return;
+  SharedEvdevLoop().Remove( myDevice );
+  delete myDevice;
+  myDevice = NULL;
+}
@@ -0,0 +1,239 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __EVDEV_JOYSTICK_H__
+#define __EVDEV_JOYSTICK_H__
+
+#include <vector>
+#include "evdev.hpp"
+#include "hidraw.hpp"
+#include "joyregistry.hpp"
+
+/**
+ * \brief Linux counterpart of Joystick, reading evdev devices (/dev/input/event*) or
+ *  hidraw devices (/dev/hidraw*).
+ *
+ * Has the same polling interface as Joystick, so code written against one builds
+ * against the other. Every device is drained by the shared EvdevLoop, so polling only
+ * copies the snapshot. Outputs (force feedback, LEDs) are not mapped, so there are
+ * none. A recorded input_event stream, or a capture of raw reports, can be played
+ * through a pipe with InitialiseStream or InitialiseRawStream, without any device.
+ */
+class EvdevJoystick
+{
+  public:
+    /**
+     * \brief EvdevJoystick constructor.
+     */
+    EvdevJoystick();
+    
+    /**
+     * \brief EvdevJoystick destructor.
+     */
+    ~EvdevJoystick();
+    
+    /**
+     * \brief Open a joystick.
+     *
+     * \param[in] joyLocation LocationKey of the joystick, from QueryAvailableDevices.
+     * \return true if successful, false if unsuccessful (such as the joystick doesn't
+     *  exist or can't be opened).
+     */
+    bool Initialise( int32_t joyLocation );
+    
+    /**
+     * \brief Read input_events from a stream, such as a pipe playing back a recording,
+     *  as if it were a device with the given capabilities.
+     *
+     * \param[in] fd File descriptor of the stream. It is not closed by the joystick.
+     * \param[in] caps Capabilities of the recorded device.
+     * \return true if successful.
+     */
+    bool InitialiseStream( int fd, const EvdevCaps &caps );
+    
+    /**
+     * \brief Open a joystick through hidraw, decoding its raw reports. This sees the
+     *  vendor axes, extra hats and multi-count fields that evdev drops.
+     *
+     * \param[in] joyLocation LocationKey of the joystick, from QueryAvailableRawDevices.
+     * \return true if successful, false if unsuccessful (such as the joystick doesn't
+     *  exist, can't be opened, or has an unusable report descriptor).
+     */
+    bool InitialiseRaw( int32_t joyLocation );
+    
+    /**
+     * \brief Read raw input reports from a stream, such as a pipe playing back a capture,
+     *  as if it were a hidraw device with the given report descriptor.
+     *
+     * \param[in] fd File descriptor of the stream. It is not closed by the joystick.
+     * \param[in] descriptor Report descriptor bytes of the captured device.
+     * \param[in] len Length of the descriptor.
+     * \return true if successful, false if the descriptor is unusable.
+     */
+    bool InitialiseRawStream( int fd, const uint8_t *descriptor, size_t len );
+    
+    /**
+     * \brief Query joystick for IO capabilities
+     *
+     * \return An vector containing the number of axes, buttons, pov, outputs. If the
+     *  joystick has not been initialised yet, the result will be all -1.
+     */
+    std::vector<int> QueryIO( void );
+    
+    /**
+     * \brief Poll the joystick axes
+     *
+     * \output vector of normalised axes doubles.
+     */
+    std::vector<double> PollAxes( void );
+    
+    /**
+     * \brief Poll the joystick axes into a caller supplied buffer. Does not allocate.
+     *
+     * \param[out] dest Buffer for the normalised axes.
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Number of axes on the joystick.
+     */
+    size_t PollAxesInto( double *dest, size_t len );
+    
+    /**
+     * \brief Poll the joystick buttons
+     *
+     * \output vector of button boolean values.
+     */
+    std::vector<bool> PollButtons( void );
+    
+    /**
+     * \brief Poll the joystick buttons into a caller supplied buffer. Does not allocate.
+     *
+     * \param[out] dest Buffer for the button states (0 or 1).
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Number of buttons on the joystick.
+     */
+    size_t PollButtonsInto( uint8_t *dest, size_t len );
+    
+    /**
+     * \brief Poll the joystick buttons as a packed mask (see buttonmask.hpp).
+     *
+     * \param[out] dest Buffer for the mask. Button n is bit (n%64) of word n/64.
+     * \param[in] numWords Length of dest in words. Buttons beyond 64*numWords are dropped.
+     * \output Number of buttons on the joystick.
+     */
+    size_t PollButtonMask( uint64_t *dest, size_t numWords );
+    
+    /**
+     * \brief Poll the joystick POV hats
+     *
+     * \output vector of POV doubles. The value corresponds to the angle (degrees) and
+     *         -1 corresponds to nothing pressed.
+     */
+    std::vector<double> PollPOV( void );
+    
+    /**
+     * \brief Poll the joystick POV hats into a caller supplied buffer. Does not allocate.
+     *
+     * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Number of POV hats on the joystick.
+     */
+    size_t PollPOVInto( double *dest, size_t len );
+    
+    /**
+     * \brief Time stamps (ticks, see joytime.hpp) of the latest value of each element of
+     *  the given type.
+     *
+     * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+     * \param[out] dest Buffer for the time stamps.
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Number of elements of the given type.
+     */
+    size_t PollTimesInto( JoystickIOIndex type, uint64_t *dest, size_t len );
+    
+    /**
+     * \brief Time stamp (ticks) of the newest value of any element, or 0 if none.
+     */
+    uint64_t NewestTimeStamp( void );
+    
+    /**
+     * \brief Age (seconds) of the newest value of any element, or -1 if none.
+     */
+    double SampleAge( void );
+    
+    /**
+     * \brief Push the inputs to the joystick. Evdev outputs aren't mapped, so this does
+     *  nothing; it is here so that code written against Joystick builds unchanged.
+     */
+    void PushInputs( const std::vector<double> &normInputs );
+    void PushInputs( const double *normInputs, size_t len );
+    
+    /**
+     * \brief Whether the device (or stream) is still delivering events.
+     */
+    bool Connected( void );
+    
+    /**
+     * \brief Query for the available joysticks.
+     *
+     * \output vector of JoyDev objects, sorted by location key.
+     */
+    std::vector<JoyDev> QueryAvailableDevices( );
+    
+    /**
+     * \brief Query for the number of available joysticks.
+     *
+     * \output number of available joysticks
+     */
+    unsigned int QueryNumberDevices( );
+    
+    /**
+     * \brief Query for the joysticks available through hidraw.
+     *
+     * \output vector of JoyDev objects, sorted by location key.
+     */
+    std::vector<JoyDev> QueryAvailableRawDevices( );
+    
+  private:
+    EvdevSource *myDevice;
+    std::vector<int32_t> myRaw;
+    std::vector<uint64_t> myButtonWords;
+    
+    /**
+     * \brief Start draining a device. The joystick takes ownership of it.
+     */
+    bool Attach( EvdevSource *device );
+    
+    /**
+     * \brief Stop draining and delete the device.
+     */
+    void ReleaseDevice( void );
+    
+    // Non-copyable
+    EvdevJoystick( const EvdevJoystick & );
+    EvdevJoystick &operator=( const EvdevJoystick & );
+};
+
+#endif
@@ -0,0 +1,2 @@
+/* Synthetic HID backend, see fakehid.h */
+#include "../../fakehid.h"
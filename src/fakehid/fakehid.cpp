@@ -0,0 +1,1450 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fakehid.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * \brief Type IDs of the synthetic CoreFoundation objects.
+ */
+enum FakeTypeID
+{
+  kFakeType_Array = 1,
+  kFakeType_Dictionary,
+  kFakeType_Number,
+  kFakeType_String,
+  kFakeType_Data,
+  kFakeType_RunLoop,
+  kFakeType_Observer,
+  kFakeType_Manager,
+  kFakeType_Device,
+  kFakeType_Element,
+  kFakeType_Value
+};
+
+/**
+ * \brief Base of every synthetic CoreFoundation object. Reference counted, and deleted
+ *  by the CFRelease that takes the count to zero.
+ */
+struct FakeCFObject
+{
+  FakeCFObject( CFTypeID id ) : typeID( id ), refs( 1 ) {}
+  virtual ~FakeCFObject() {}
+  CFTypeID typeID;
+  volatile int refs;
+};
+
+struct __CFArray : public FakeCFObject
+{
+  __CFArray() : FakeCFObject( kFakeType_Array ) {}
+  ~__CFArray()
+  {
+    for( size_t ii=0; ii<values.size(); ii++ ) CFRelease( values[ ii ] );
+  }
+  vector<const void *> values;
+};
+
+// Matching dictionaries are only ever handed to IOHIDManagerSetDeviceMatchingMultiple,
+// which matches every synthetic device, so their contents aren't kept.
+struct __CFDictionary : public FakeCFObject
+{
+  __CFDictionary() : FakeCFObject( kFakeType_Dictionary ) {}
+};
+
+struct __CFNumber : public FakeCFObject
+{
+  __CFNumber( CFNumberType t, int64_t v ) : FakeCFObject( kFakeType_Number ), type( t ), value( v ) {}
+  CFNumberType type;
+  int64_t value;
+};
+
+struct __CFString : public FakeCFObject
+{
+  __CFString( const char *s ) : FakeCFObject( kFakeType_String ), value( s ) {}
+  string value;
+};
+
+struct __CFData : public FakeCFObject
+{
+  __CFData() : FakeCFObject( kFakeType_Data ) {}
+  vector<uint8_t> bytes;
+};
+
+struct __CFRunLoopObserver : public FakeCFObject
+{
+  __CFRunLoopObserver() : FakeCFObject( kFakeType_Observer ) {}
+  CFOptionFlags activities;
+  CFRunLoopObserverCallBack callout;
+  void *info;
+};
+
+/**
+ * \brief A callback waiting to be delivered on a run loop. The sender is retained until
+ *  the event is delivered or dropped, and an input report is owned by its event.
+ */
+struct FakeEvent
+{
+  enum Kind { kMatched, kRemoved, kValue, kReport, kInput } kind;
+  FakeCFObject *sender;
+  IOHIDDeviceRef device;
+  IOHIDValueRef value;
+  // Completion of an asynchronous output report, or an input report
+  IOHIDReportCallback reportCallback;
+  void *reportContext;
+  uint32_t reportID;
+  uint8_t *report;
+  CFIndex reportLength;
+};
+
+/**
+ * \brief First in, first out queue of events that reuses its storage, so that posting
+ *  an event (such as an asynchronous report completion) doesn't allocate once the
+ *  queue has grown to its working size.
+ */
+struct FakeEventQueue
+{
+  FakeEventQueue() : head( 0 ) { items.reserve( 4096 ); }
+  bool empty( void ) const { return head == items.size(); }
+  size_t size( void ) const { return items.size() - head; }
+  const FakeEvent &operator[]( size_t ii ) const { return items[ head + ii ]; }
+  const FakeEvent &front( void ) const { return items[ head ]; }
+  void push_back( const FakeEvent &ev )
+  {
+    // Move the queued events down rather than growing, once most of it is consumed
+    if( items.size() == items.capacity() && head > 0 )
+    {
+      items.erase( items.begin(), items.begin() + (ptrdiff_t)head );
+      head = 0;
+    }
+    items.push_back( ev );
+  }
+  void pop_front( void )
+  {
+    if( ++head == items.size() )
+    {
+      items.clear();
+      head = 0;
+    }
+  }
+  vector<FakeEvent> items;
+  size_t head;
+};
+
+struct __CFRunLoop : public FakeCFObject
+{
+  __CFRunLoop() : FakeCFObject( kFakeType_RunLoop ), stopped( false )
+  {
+    pthread_mutex_init( &mutex, NULL );
+    pthread_cond_init( &cond, NULL );
+  }
+  ~__CFRunLoop();
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  FakeEventQueue events;
+  vector<__CFRunLoopObserver *> observers;
+  // Copy of the observers being called out, reused by the run loop's own thread
+  vector<__CFRunLoopObserver *> calling;
+  bool stopped;
+};
+
+struct FakeDevice;
+
+struct __IOHIDElement : public FakeCFObject
+{
+  __IOHIDElement() : FakeCFObject( kFakeType_Element ) {}
+  FakeDevice *device;
+  IOHIDElementType type;
+  IOHIDElementCookie cookie;
+  uint32_t usagePage, usage;
+  long min, max;
+  bool relative;
+  uint32_t reportID, bitOffset, reportSize;
+  volatile long value;
+  volatile uint64_t time;
+  // Returned by IOHIDDeviceGetValue, which (like IOKit) doesn't allocate
+  IOHIDValueRef current;
+};
+
+struct __IOHIDValue : public FakeCFObject
+{
+  __IOHIDValue() : FakeCFObject( kFakeType_Value ) {}
+  IOHIDElementRef element;
+  long value;
+  uint64_t time;
+};
+
+struct __IOHIDDevice : public FakeCFObject
+{
+  __IOHIDDevice( FakeDevice *d );
+  ~__IOHIDDevice();
+  FakeDevice *device;
+  bool open;
+  IOHIDValueCallback valueCallback;
+  void *valueContext;
+  // Input reports are copied into the registered buffer before the callback
+  IOHIDReportCallback reportCallback;
+  void *reportContext;
+  uint8_t *reportBuffer;
+  CFIndex reportBufferLength;
+  CFRunLoopRef runLoop;
+};
+
+struct __IOHIDManager : public FakeCFObject
+{
+  __IOHIDManager() : FakeCFObject( kFakeType_Manager ), open( false ), matched( NULL ),
+          matchedContext( NULL ), removed( NULL ), removedContext( NULL ), runLoop( NULL ) {}
+  ~__IOHIDManager();
+  bool open;
+  IOHIDDeviceCallback matched;
+  void *matchedContext;
+  IOHIDDeviceCallback removed;
+  void *removedContext;
+  CFRunLoopRef runLoop;
+  // The manager's own reference to each device it has matched
+  vector<IOHIDDeviceRef> devices;
+};
+
+/**
+ * \brief A synthetic device. Never freed, so references to a detached device stay safe.
+ */
+struct FakeDevice
+{
+  int32_t locationID;
+  io_service_t service;
+  bool attached;
+  vector<IOHIDElementRef> elements;
+  CFNumberRef location, vendorID, productID;
+  CFStringRef product, serialNumber;
+  CFDataRef descriptor;
+  // Length of the input report (ID 1), including the ID byte, or 0 if there is none
+  uint32_t inputReportBytes;
+  CFNumberRef maxInputReportSize;
+  // The last output report with each ID, and the number sent
+  vector< vector<uint8_t> > reports;
+  uint64_t reportCount;
+  // Every device reference made for this device
+  vector<IOHIDDeviceRef> refs;
+};
+
+/**
+ * \brief Process wide state of the synthetic backend. The mutex is recursive, as
+ *  releasing a reference while it is held takes it again.
+ */
+struct FakeHIDState
+{
+  pthread_mutex_t mutex;
+  pthread_key_t runLoopKey;
+  vector<FakeDevice *> devices;
+  vector<IOHIDManagerRef> managers;
+  io_service_t nextService;
+  volatile uint64_t calls;
+};
+
+CFAllocatorRef kCFAllocatorDefault = NULL;
+CFStringRef kCFRunLoopDefaultMode = CFSTR("kCFRunLoopDefaultMode");
+const int kCFTypeArrayCallBacks = 0;
+const int kCFTypeDictionaryKeyCallBacks = 0;
+const int kCFTypeDictionaryValueCallBacks = 0;
+
+static pthread_once_t stateOnce = PTHREAD_ONCE_INIT;
+static FakeHIDState *state = NULL;
+
+/**
+ * \brief Release a thread's run loop when the thread exits.
+ */
+static void ReleaseRunLoop( void *runLoop )
+{
+  CFRelease( runLoop );
+}
+
+/**
+ * \brief Make the process wide state. It is never freed, so that it outlives any
+ *  static object that still holds references at exit.
+ */
+static void InitState( void )
+{
+  state = new FakeHIDState;
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init( &attr );
+  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+  pthread_mutex_init( &state->mutex, &attr );
+  pthread_mutexattr_destroy( &attr );
+  pthread_key_create( &state->runLoopKey, &ReleaseRunLoop );
+  state->nextService = 0x1000;
+  state->calls = 0;
+}
+
+static FakeHIDState &State( void )
+{
+  pthread_once( &stateOnce, &InitState );
+  return *state;
+}
+
+/**
+ * \brief Find an attached device by location ID (state mutex must be held).
+ */
+static FakeDevice *FindDevice( int32_t locationID )
+{
+  FakeHIDState &s = State();
+  for( size_t ii=0; ii<s.devices.size(); ii++ )
+  {
+    if( s.devices[ ii ]->attached && s.devices[ ii ]->locationID == locationID ) return s.devices[ ii ];
+  }
+  return NULL;
+}
+
+/**
+ * \brief Queue a filled in event on a run loop, retaining its sender and device.
+ */
+static void QueueEvent( CFRunLoopRef runLoop, const FakeEvent &ev )
+{
+  CFRetain( ev.sender );
+  if( ev.device != NULL ) CFRetain( ev.device );
+  pthread_mutex_lock( &runLoop->mutex );
+  runLoop->events.push_back( ev );
+  pthread_cond_signal( &runLoop->cond );
+  pthread_mutex_unlock( &runLoop->mutex );
+}
+
+/**
+ * \brief Queue an event on a run loop. The sender is retained by the event.
+ */
+static void PostEvent( CFRunLoopRef runLoop, FakeEvent::Kind kind, FakeCFObject *sender,
+                                                  IOHIDDeviceRef device, IOHIDValueRef value )
+{
+  FakeEvent ev;
+  ev.kind = kind;
+  ev.sender = sender;
+  ev.device = device;
+  ev.value = value;
+  ev.reportCallback = NULL;
+  ev.reportContext = NULL;
+  ev.reportID = 0;
+  ev.report = NULL;
+  ev.reportLength = 0;
+  QueueEvent( runLoop, ev );
+}
+
+/**
+ * \brief Queue the completion of an asynchronous output report on a device's run loop.
+ */
+static void PostReportSent( IOHIDDeviceRef device, IOHIDReportCallback callback,
+                void *context, uint32_t reportID, const uint8_t *report, CFIndex reportLength )
+{
+  FakeEvent ev;
+  ev.kind = FakeEvent::kReport;
+  ev.sender = device;
+  ev.device = NULL;
+  ev.value = NULL;
+  ev.reportCallback = callback;
+  ev.reportContext = context;
+  ev.reportID = reportID;
+  ev.report = (uint8_t *)report;
+  ev.reportLength = reportLength;
+  QueueEvent( device->runLoop, ev );
+}
+
+/**
+ * \brief Queue an input report on a device's run loop. The event takes the report.
+ */
+static void PostInputReport( IOHIDDeviceRef device, uint8_t *report, CFIndex reportLength )
+{
+  FakeEvent ev;
+  ev.kind = FakeEvent::kInput;
+  ev.sender = device;
+  ev.device = NULL;
+  ev.value = NULL;
+  ev.reportCallback = NULL;
+  ev.reportContext = NULL;
+  ev.reportID = 1;
+  ev.report = report;
+  ev.reportLength = reportLength;
+  QueueEvent( device->runLoop, ev );
+}
+
+/**
+ * \brief Drop the references held by an event.
+ */
+static void DropEvent( const FakeEvent &ev )
+{
+  if( ev.kind == FakeEvent::kInput ) delete[] ev.report;
+  if( ev.value != NULL ) CFRelease( ev.value );
+  if( ev.device != NULL ) CFRelease( ev.device );
+  CFRelease( ev.sender );
+}
+
+/**
+ * \brief Deliver an event (on its run loop's thread, with no locks held).
+ */
+static void DeliverEvent( const FakeEvent &ev )
+{
+  FakeHIDState &s = State();
+  IOHIDDeviceCallback deviceCallback = NULL;
+  IOHIDValueCallback valueCallback = NULL;
+  IOHIDReportCallback reportCallback = NULL;
+  IOHIDReportType reportType = kIOHIDReportTypeOutput;
+  uint8_t *report = ev.report;
+  void *context = NULL;
+  pthread_mutex_lock( &s.mutex );
+  if( ev.kind == FakeEvent::kInput )
+  {
+    // Like IOKit, the report is delivered in the buffer registered with the callback
+    IOHIDDeviceRef device = (IOHIDDeviceRef)ev.sender;
+    if( device->runLoop != NULL && device->reportCallback != NULL &&
+                                   device->reportBufferLength >= ev.reportLength )
+    {
+      memcpy( device->reportBuffer, ev.report, (size_t)ev.reportLength );
+      reportCallback = device->reportCallback;
+      reportType = kIOHIDReportTypeInput;
+      report = device->reportBuffer;
+      context = device->reportContext;
+    }
+  }
+  else if( ev.kind == FakeEvent::kReport )
+  {
+    // Like IOKit, completions are dropped once the device is unscheduled
+    if( ((IOHIDDeviceRef)ev.sender)->runLoop != NULL )
+    {
+      reportCallback = ev.reportCallback;
+      context = ev.reportContext;
+    }
+  }
+  else if( ev.kind == FakeEvent::kValue )
+  {
+    IOHIDDeviceRef device = (IOHIDDeviceRef)ev.sender;
+    if( device->runLoop != NULL )
+    {
+      valueCallback = device->valueCallback;
+      context = device->valueContext;
+    }
+  }
+  else
+  {
+    IOHIDManagerRef manager = (IOHIDManagerRef)ev.sender;
+    if( manager->runLoop != NULL )
+    {
+      deviceCallback = ev.kind == FakeEvent::kMatched ? manager->matched : manager->removed;
+      context = ev.kind == FakeEvent::kMatched ? manager->matchedContext : manager->removedContext;
+    }
+  }
+  pthread_mutex_unlock( &s.mutex );
+  
+  if( valueCallback != NULL ) valueCallback( context, kIOReturnSuccess, ev.sender, ev.value );
+  if( deviceCallback != NULL ) deviceCallback( context, kIOReturnSuccess, ev.sender, ev.device );
+  if( reportCallback != NULL )
+    reportCallback( context, kIOReturnSuccess, ev.sender, reportType, ev.reportID, report,
+                    ev.reportLength );
+}
+
+/**
+ * \brief Have a manager match a device (state mutex must be held).
+ */
+static void MatchDevice( IOHIDManagerRef manager, FakeDevice *device )
+{
+  IOHIDDeviceRef ref = new __IOHIDDevice( device );
+  ref->open = true;
+  manager->devices.push_back( ref );
+  PostEvent( manager->runLoop, FakeEvent::kMatched, manager, ref, NULL );
+}
+
+__CFRunLoop::~__CFRunLoop()
+{
+  for( size_t ii=0; ii<events.size(); ii++ ) DropEvent( events[ ii ] );
+  for( size_t ii=0; ii<observers.size(); ii++ ) CFRelease( observers[ ii ] );
+  pthread_cond_destroy( &cond );
+  pthread_mutex_destroy( &mutex );
+}
+
+__IOHIDDevice::__IOHIDDevice( FakeDevice *d ) : FakeCFObject( kFakeType_Device ), device( d ),
+                       open( false ), valueCallback( NULL ), valueContext( NULL ),
+                       reportCallback( NULL ), reportContext( NULL ), reportBuffer( NULL ),
+                       reportBufferLength( 0 ), runLoop( NULL )
+{
+  pthread_mutex_lock( &State().mutex );
+  device->refs.push_back( this );
+  pthread_mutex_unlock( &State().mutex );
+}
+
+__IOHIDDevice::~__IOHIDDevice()
+{
+  pthread_mutex_lock( &State().mutex );
+  for( size_t ii=0; ii<device->refs.size(); ii++ )
+  {
+    if( device->refs[ ii ] != this ) continue;
+    device->refs.erase( device->refs.begin() + ii );
+    break;
+  }
+  pthread_mutex_unlock( &State().mutex );
+}
+
+__IOHIDManager::~__IOHIDManager()
+{
+  FakeHIDState &s = State();
+  pthread_mutex_lock( &s.mutex );
+  for( size_t ii=0; ii<s.managers.size(); ii++ )
+  {
+    if( s.managers[ ii ] != this ) continue;
+    s.managers.erase( s.managers.begin() + ii );
+    break;
+  }
+  for( size_t ii=0; ii<devices.size(); ii++ ) CFRelease( devices[ ii ] );
+  pthread_mutex_unlock( &s.mutex );
+}
+
+// CoreFoundation
+
+CFTypeRef CFRetain( CFTypeRef cf )
+{
+  __sync_fetch_and_add( &((FakeCFObject *)cf)->refs, 1 );
+  return cf;
+}
+
+void CFRelease( CFTypeRef cf )
+{
+  FakeCFObject *object = (FakeCFObject *)cf;
+  if( __sync_sub_and_fetch( &object->refs, 1 ) == 0 ) delete object;
+}
+
+CFTypeID CFGetTypeID( CFTypeRef cf ) { return ((const FakeCFObject *)cf)->typeID; }
+CFTypeID CFNumberGetTypeID( void ) { return kFakeType_Number; }
+CFTypeID CFStringGetTypeID( void ) { return kFakeType_String; }
+CFTypeID CFDataGetTypeID( void ) { return kFakeType_Data; }
+
+CFMutableArrayRef CFArrayCreateMutable( CFAllocatorRef allocator, CFIndex capacity,
+                                                                const void *callBacks )
+{
+  (void)allocator;
+  (void)callBacks;
+  CFMutableArrayRef array = new __CFArray;
+  array->values.reserve( (size_t)capacity );
+  return array;
+}
+
+void CFArrayAppendValue( CFMutableArrayRef array, const void *value )
+{
+  CFRetain( value );
+  array->values.push_back( value );
+}
+
+CFIndex CFArrayGetCount( CFArrayRef array ) { return (CFIndex)array->values.size(); }
+
+const void *CFArrayGetValueAtIndex( CFArrayRef array, CFIndex index )
+{
+  return array->values[ (size_t)index ];
+}
+
+CFMutableDictionaryRef CFDictionaryCreateMutable( CFAllocatorRef allocator,
+                  CFIndex capacity, const void *keyCallBacks, const void *valueCallBacks )
+{
+  (void)allocator;
+  (void)capacity;
+  (void)keyCallBacks;
+  (void)valueCallBacks;
+  return new __CFDictionary;
+}
+
+void CFDictionarySetValue( CFMutableDictionaryRef dict, const void *key, const void *value )
+{
+  (void)dict;
+  (void)key;
+  (void)value;
+}
+
+CFNumberRef CFNumberCreate( CFAllocatorRef allocator, CFNumberType type, const void *valuePtr )
+{
+  (void)allocator;
+  int64_t value;
+  switch( type )
+  {
+    case kCFNumberSInt64Type: value = *(const int64_t *)valuePtr; break;
+    case kCFNumberIntType: value = *(const int *)valuePtr; break;
+    default: value = *(const int32_t *)valuePtr; break;
+  }
+  return new __CFNumber( type, value );
+}
+
+CFNumberType CFNumberGetType( CFNumberRef number ) { return number->type; }
+
+Boolean CFNumberGetValue( CFNumberRef number, CFNumberType type, void *valuePtr )
+{
+  switch( type )
+  {
+    case kCFNumberSInt64Type: *(int64_t *)valuePtr = number->value; break;
+    case kCFNumberIntType: *(int *)valuePtr = (int)number->value; break;
+    default: *(int32_t *)valuePtr = (int32_t)number->value; break;
+  }
+  return true;
+}
+
+Boolean CFStringGetCString( CFStringRef string, char *buffer, CFIndex bufferSize,
+                                                                     uint32_t encoding )
+{
+  (void)encoding;
+  if( bufferSize <= 0 || string->value.size() >= (size_t)bufferSize ) return false;
+  strcpy( buffer, string->value.c_str() );
+  return true;
+}
+
+CFIndex CFDataGetLength( CFDataRef data ) { return (CFIndex)data->bytes.size(); }
+
+const uint8_t *CFDataGetBytePtr( CFDataRef data )
+{
+  return data->bytes.empty() ? NULL : &data->bytes.front();
+}
+
+CFRunLoopRef CFRunLoopGetCurrent( void )
+{
+  FakeHIDState &s = State();
+  CFRunLoopRef runLoop = (CFRunLoopRef)pthread_getspecific( s.runLoopKey );
+  if( runLoop == NULL )
+  {
+    runLoop = new __CFRunLoop;
+    pthread_setspecific( s.runLoopKey, runLoop );
+  }
+  return runLoop;
+}
+
+/**
+ * \brief Service the current thread's run loop: deliver queued events, calling the
+ *  observers before each wait, until stopped or the time runs out.
+ */
+int CFRunLoopRunInMode( CFStringRef mode, CFTimeInterval seconds,
+                                                      Boolean returnAfterSourceHandled )
+{
+  (void)mode;
+  CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+  struct timespec deadline;
+  clock_gettime( CLOCK_REALTIME, &deadline );
+  long nsec = deadline.tv_nsec + (long)( ( seconds - (double)(long)seconds )*1e9 );
+  deadline.tv_sec += (time_t)seconds + nsec / 1000000000L;
+  deadline.tv_nsec = nsec % 1000000000L;
+  
+  pthread_mutex_lock( &runLoop->mutex );
+  for( ;; )
+  {
+    if( runLoop->stopped )
+    {
+      runLoop->stopped = false;
+      pthread_mutex_unlock( &runLoop->mutex );
+      return kCFRunLoopRunStopped;
+    }
+    if( !runLoop->events.empty() )
+    {
+      FakeEvent ev = runLoop->events.front();
+      runLoop->events.pop_front();
+      pthread_mutex_unlock( &runLoop->mutex );
+      DeliverEvent( ev );
+      DropEvent( ev );
+      if( returnAfterSourceHandled ) return kCFRunLoopRunHandledSource;
+      pthread_mutex_lock( &runLoop->mutex );
+      continue;
+    }
+    
+    // About to wait
+    vector<__CFRunLoopObserver *> &observers = runLoop->calling;
+    observers.assign( runLoop->observers.begin(), runLoop->observers.end() );
+    pthread_mutex_unlock( &runLoop->mutex );
+    for( size_t ii=0; ii<observers.size(); ii++ )
+    {
+      if( observers[ ii ]->activities & kCFRunLoopBeforeWaiting )
+        observers[ ii ]->callout( observers[ ii ], kCFRunLoopBeforeWaiting, observers[ ii ]->info );
+    }
+    pthread_mutex_lock( &runLoop->mutex );
+    if( !runLoop->events.empty() || runLoop->stopped ) continue;
+    if( pthread_cond_timedwait( &runLoop->cond, &runLoop->mutex, &deadline ) != 0 &&
+        runLoop->events.empty() && !runLoop->stopped )
+    {
+      pthread_mutex_unlock( &runLoop->mutex );
+      return kCFRunLoopRunTimedOut;
+    }
+  }
+}
+
+void CFRunLoopStop( CFRunLoopRef runLoop )
+{
+  pthread_mutex_lock( &runLoop->mutex );
+  runLoop->stopped = true;
+  pthread_cond_signal( &runLoop->cond );
+  pthread_mutex_unlock( &runLoop->mutex );
+}
+
+CFRunLoopObserverRef CFRunLoopObserverCreate( CFAllocatorRef allocator,
+         CFOptionFlags activities, Boolean repeats, CFIndex order,
+         CFRunLoopObserverCallBack callout, CFRunLoopObserverContext *context )
+{
+  (void)allocator;
+  (void)repeats;
+  (void)order;
+  CFRunLoopObserverRef observer = new __CFRunLoopObserver;
+  observer->activities = activities;
+  observer->callout = callout;
+  observer->info = context != NULL ? context->info : NULL;
+  return observer;
+}
+
+void CFRunLoopAddObserver( CFRunLoopRef runLoop, CFRunLoopObserverRef observer,
+                                                                      CFStringRef mode )
+{
+  (void)mode;
+  CFRetain( observer );
+  pthread_mutex_lock( &runLoop->mutex );
+  runLoop->observers.push_back( observer );
+  pthread_mutex_unlock( &runLoop->mutex );
+}
+
+void CFRunLoopRemoveObserver( CFRunLoopRef runLoop, CFRunLoopObserverRef observer,
+                                                                      CFStringRef mode )
+{
+  (void)mode;
+  pthread_mutex_lock( &runLoop->mutex );
+  for( size_t ii=0; ii<runLoop->observers.size(); ii++ )
+  {
+    if( runLoop->observers[ ii ] != observer ) continue;
+    runLoop->observers.erase( runLoop->observers.begin() + ii );
+    pthread_mutex_unlock( &runLoop->mutex );
+    CFRelease( observer );
+    return;
+  }
+  pthread_mutex_unlock( &runLoop->mutex );
+}
+
+// mach
+
+uint64_t mach_absolute_time( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int mach_timebase_info( mach_timebase_info_data_t *info )
+{
+  info->numer = 1;
+  info->denom = 1;
+  return 0;
+}
+
+// IOKit
+
+kern_return_t IOObjectRetain( io_object_t object ) { (void)object; return 0; }
+kern_return_t IOObjectRelease( io_object_t object ) { (void)object; return 0; }
+
+IOHIDManagerRef IOHIDManagerCreate( CFAllocatorRef allocator, IOOptionBits options )
+{
+  (void)allocator;
+  (void)options;
+  IOHIDManagerRef manager = new __IOHIDManager;
+  FakeHIDState &s = State();
+  pthread_mutex_lock( &s.mutex );
+  s.managers.push_back( manager );
+  pthread_mutex_unlock( &s.mutex );
+  return manager;
+}
+
+IOReturn IOHIDManagerOpen( IOHIDManagerRef manager, IOOptionBits options )
+{
+  (void)options;
+  pthread_mutex_lock( &State().mutex );
+  manager->open = true;
+  pthread_mutex_unlock( &State().mutex );
+  return kIOReturnSuccess;
+}
+
+IOReturn IOHIDManagerClose( IOHIDManagerRef manager, IOOptionBits options )
+{
+  (void)options;
+  pthread_mutex_lock( &State().mutex );
+  manager->open = false;
+  pthread_mutex_unlock( &State().mutex );
+  return kIOReturnSuccess;
+}
+
+void IOHIDManagerSetDeviceMatchingMultiple( IOHIDManagerRef manager, CFArrayRef multiple )
+{
+  (void)manager;
+  (void)multiple;
+}
+
+void IOHIDManagerRegisterDeviceMatchingCallback( IOHIDManagerRef manager,
+                                          IOHIDDeviceCallback callback, void *context )
+{
+  pthread_mutex_lock( &State().mutex );
+  manager->matched = callback;
+  manager->matchedContext = context;
+  pthread_mutex_unlock( &State().mutex );
+}
+
+void IOHIDManagerRegisterDeviceRemovalCallback( IOHIDManagerRef manager,
+                                          IOHIDDeviceCallback callback, void *context )
+{
+  pthread_mutex_lock( &State().mutex );
+  manager->removed = callback;
+  manager->removedContext = context;
+  pthread_mutex_unlock( &State().mutex );
+}
+
+/**
+ * \brief Schedule a manager. The devices already attached are matched as soon as the
+ *  run loop runs.
+ */
+void IOHIDManagerScheduleWithRunLoop( IOHIDManagerRef manager, CFRunLoopRef runLoop,
+                                                                CFStringRef runLoopMode )
+{
+  (void)runLoopMode;
+  FakeHIDState &s = State();
+  pthread_mutex_lock( &s.mutex );
+  manager->runLoop = runLoop;
+  if( manager->open )
+  {
+    for( size_t ii=0; ii<s.devices.size(); ii++ )
+    {
+      if( s.devices[ ii ]->attached ) MatchDevice( manager, s.devices[ ii ] );
+    }
+  }
+  pthread_mutex_unlock( &s.mutex );
+}
+
+void IOHIDManagerUnscheduleFromRunLoop( IOHIDManagerRef manager, CFRunLoopRef runLoop,
+                                                                CFStringRef runLoopMode )
+{
+  (void)runLoop;
+  (void)runLoopMode;
+  pthread_mutex_lock( &State().mutex );
+  manager->runLoop = NULL;
+  pthread_mutex_unlock( &State().mutex );
+}
+
+IOHIDDeviceRef IOHIDDeviceCreate( CFAllocatorRef allocator, io_service_t service )
+{
+  (void)allocator;
+  FakeHIDState &s = State();
+  IOHIDDeviceRef device = NULL;
+  pthread_mutex_lock( &s.mutex );
+  for( size_t ii=0; ii<s.devices.size(); ii++ )
+  {
+    if( s.devices[ ii ]->service == service && s.devices[ ii ]->attached )
+    {
+      device = new __IOHIDDevice( s.devices[ ii ] );
+      break;
+    }
+  }
+  pthread_mutex_unlock( &s.mutex );
+  return device;
+}
+
+io_service_t IOHIDDeviceGetService( IOHIDDeviceRef device ) { return device->device->service; }
+
+IOReturn IOHIDDeviceOpen( IOHIDDeviceRef device, IOOptionBits options )
+{
+  (void)options;
+  if( !device->device->attached ) return kIOReturnNoDevice;
+  device->open = true;
+  return kIOReturnSuccess;
+}
+
+IOReturn IOHIDDeviceClose( IOHIDDeviceRef device, IOOptionBits options )
+{
+  (void)options;
+  device->open = false;
+  return kIOReturnSuccess;
+}
+
+CFTypeRef IOHIDDeviceGetProperty( IOHIDDeviceRef device, CFStringRef key )
+{
+  const char *name = (const char *)key;
+  const FakeDevice *d = device->device;
+  if( strcmp( name, kIOHIDLocationIDKey ) == 0 ) return d->location;
+  if( strcmp( name, kIOHIDProductKey ) == 0 ) return d->product;
+  if( strcmp( name, kIOHIDVendorIDKey ) == 0 ) return d->vendorID;
+  if( strcmp( name, kIOHIDProductIDKey ) == 0 ) return d->productID;
+  if( strcmp( name, kIOHIDSerialNumberKey ) == 0 ) return d->serialNumber;
+  if( strcmp( name, kIOHIDReportDescriptorKey ) == 0 ) return d->descriptor;
+  if( strcmp( name, kIOHIDMaxInputReportSizeKey ) == 0 ) return d->maxInputReportSize;
+  return NULL;
+}
+
+CFArrayRef IOHIDDeviceCopyMatchingElements( IOHIDDeviceRef device,
+                                           CFDictionaryRef matching, IOOptionBits options )
+{
+  (void)matching;
+  (void)options;
+  const vector<IOHIDElementRef> &elements = device->device->elements;
+  CFMutableArrayRef array = CFArrayCreateMutable( kCFAllocatorDefault,
+                                      (CFIndex)elements.size(), &kCFTypeArrayCallBacks );
+  for( size_t ii=0; ii<elements.size(); ii++ ) CFArrayAppendValue( array, elements[ ii ] );
+  return array;
+}
+
+IOReturn IOHIDDeviceGetValue( IOHIDDeviceRef device, IOHIDElementRef element,
+                                                                   IOHIDValueRef *value )
+{
+  __sync_fetch_and_add( &State().calls, 1 );
+  if( !device->open ) return kIOReturnNotOpen;
+  if( !device->device->attached ) return kIOReturnNoDevice;
+  element->current->value = element->value;
+  element->current->time = element->time;
+  *value = element->current;
+  return kIOReturnSuccess;
+}
+
+IOReturn IOHIDDeviceSetValue( IOHIDDeviceRef device, IOHIDElementRef element,
+                                                                    IOHIDValueRef value )
+{
+  __sync_fetch_and_add( &State().calls, 1 );
+  if( !device->open ) return kIOReturnNotOpen;
+  if( !device->device->attached ) return kIOReturnNoDevice;
+  element->value = value->value;
+  element->time = value->time;
+  return kIOReturnSuccess;
+}
+
+/**
+ * \brief Keep an output report sent to a device and set the output elements it carries
+ *  (state mutex must be held).
+ */
+static void ReceiveReport( FakeDevice *device, uint32_t reportID, const uint8_t *report,
+                                                                          size_t len )
+{
+  device->reports[ reportID & 0xFF ].assign( report, report+len );
+  device->reportCount++;
+  uint64_t time = mach_absolute_time();
+  for( size_t ii=0; ii<device->elements.size(); ii++ )
+  {
+    IOHIDElementRef el = device->elements[ ii ];
+    if( el->type != kIOHIDElementTypeOutput || el->reportID != reportID ) continue;
+    if( ( el->bitOffset + el->reportSize + 7 )/8 > len ) continue;
+    long value = 0;
+    for( uint32_t bit=0; bit<el->reportSize; bit++ )
+    {
+      uint32_t at = el->bitOffset + bit;
+      if( report[ at/8 ] & ( 1u << ( at & 7 ) ) ) value |= 1L << bit;
+    }
+    el->value = value;
+    el->time = time;
+  }
+}
+
+IOReturn IOHIDDeviceSetReport( IOHIDDeviceRef device, IOHIDReportType reportType,
+                              CFIndex reportID, const uint8_t *report, CFIndex reportLength )
+{
+  __sync_fetch_and_add( &State().calls, 1 );
+  if( !device->open ) return kIOReturnNotOpen;
+  if( !device->device->attached ) return kIOReturnNoDevice;
+  if( reportType != kIOHIDReportTypeOutput || reportLength <= 0 ) return kIOReturnError;
+  pthread_mutex_lock( &State().mutex );
+  ReceiveReport( device->device, (uint32_t)reportID, report, (size_t)reportLength );
+  pthread_mutex_unlock( &State().mutex );
+  return kIOReturnSuccess;
+}
+
+/**
+ * \brief The report is taken at once, and the callback is queued on the device's run
+ *  loop, which (as with IOKit) it must be scheduled on. The timeout is ignored.
+ */
+IOReturn IOHIDDeviceSetReportWithCallback( IOHIDDeviceRef device, IOHIDReportType reportType,
+                              CFIndex reportID, const uint8_t *report, CFIndex reportLength,
+                              CFTimeInterval timeout, IOHIDReportCallback callback, void *context )
+{
+  (void)timeout;
+  __sync_fetch_and_add( &State().calls, 1 );
+  if( !device->open ) return kIOReturnNotOpen;
+  if( !device->device->attached ) return kIOReturnNoDevice;
+  if( reportType != kIOHIDReportTypeOutput || reportLength <= 0 ) return kIOReturnError;
+  pthread_mutex_lock( &State().mutex );
+  if( device->runLoop == NULL )
+  {
+    pthread_mutex_unlock( &State().mutex );
+    return kIOReturnNotReady;
+  }
+  ReceiveReport( device->device, (uint32_t)reportID, report, (size_t)reportLength );
+  if( callback != NULL )
+    PostReportSent( device, callback, context, (uint32_t)reportID, report, reportLength );
+  pthread_mutex_unlock( &State().mutex );
+  return kIOReturnSuccess;
+}
+
+void IOHIDDeviceRegisterInputValueCallback( IOHIDDeviceRef device,
+                                          IOHIDValueCallback callback, void *context )
+{
+  pthread_mutex_lock( &State().mutex );
+  device->valueCallback = callback;
+  device->valueContext = context;
+  pthread_mutex_unlock( &State().mutex );
+}
+
+void IOHIDDeviceRegisterInputReportCallback( IOHIDDeviceRef device, uint8_t *report,
+                     CFIndex reportLength, IOHIDReportCallback callback, void *context )
+{
+  pthread_mutex_lock( &State().mutex );
+  device->reportCallback = callback;
+  device->reportContext = context;
+  device->reportBuffer = report;
+  device->reportBufferLength = reportLength;
+  pthread_mutex_unlock( &State().mutex );
+}
+
+void IOHIDDeviceScheduleWithRunLoop( IOHIDDeviceRef device, CFRunLoopRef runLoop,
+                                                                CFStringRef runLoopMode )
+{
+  (void)runLoopMode;
+  pthread_mutex_lock( &State().mutex );
+  device->runLoop = runLoop;
+  pthread_mutex_unlock( &State().mutex );
+}
+
+void IOHIDDeviceUnscheduleFromRunLoop( IOHIDDeviceRef device, CFRunLoopRef runLoop,
+                                                                CFStringRef runLoopMode )
+{
+  (void)runLoop;
+  (void)runLoopMode;
+  pthread_mutex_lock( &State().mutex );
+  device->runLoop = NULL;
+  pthread_mutex_unlock( &State().mutex );
+}
+
+IOHIDElementType IOHIDElementGetType( IOHIDElementRef element ) { return element->type; }
+IOHIDElementCookie IOHIDElementGetCookie( IOHIDElementRef element ) { return element->cookie; }
+uint32_t IOHIDElementGetUsagePage( IOHIDElementRef element ) { return element->usagePage; }
+uint32_t IOHIDElementGetUsage( IOHIDElementRef element ) { return element->usage; }
+long IOHIDElementGetLogicalMin( IOHIDElementRef element ) { return element->min; }
+long IOHIDElementGetLogicalMax( IOHIDElementRef element ) { return element->max; }
+Boolean IOHIDElementIsRelative( IOHIDElementRef element ) { return element->relative; }
+uint32_t IOHIDElementGetReportID( IOHIDElementRef element ) { return element->reportID; }
+uint32_t IOHIDElementGetReportSize( IOHIDElementRef element ) { return element->reportSize; }
+uint32_t IOHIDElementGetReportCount( IOHIDElementRef element ) { (void)element; return 1; }
+
+IOHIDValueRef IOHIDValueCreateWithIntegerValue( CFAllocatorRef allocator,
+                            IOHIDElementRef element, uint64_t timeStamp, long value )
+{
+  (void)allocator;
+  IOHIDValueRef result = new __IOHIDValue;
+  result->element = element;
+  result->value = value;
+  result->time = timeStamp;
+  return result;
+}
+
+IOHIDElementRef IOHIDValueGetElement( IOHIDValueRef value ) { return value->element; }
+long IOHIDValueGetIntegerValue( IOHIDValueRef value ) { return value->value; }
+uint64_t IOHIDValueGetTimeStamp( IOHIDValueRef value ) { return value->time; }
+CFIndex IOHIDValueGetLength( IOHIDValueRef value ) { (void)value; return (CFIndex)sizeof(int32_t); }
+
+// Control of the synthetic devices
+
+/**
+ * \brief Add an element to a synthetic device.
+ */
+static void AddElement( FakeDevice *device, IOHIDElementType type, uint32_t usagePage,
+                                      uint32_t usage, long min, long max, long value )
+{
+  IOHIDElementRef element = new __IOHIDElement;
+  element->device = device;
+  element->type = type;
+  element->cookie = (IOHIDElementCookie)( device->elements.size() + 1 );
+  element->usagePage = usagePage;
+  element->usage = usage;
+  element->min = min;
+  element->max = max;
+  element->relative = false;
+  element->reportID = 0;
+  element->bitOffset = 0;
+  element->reportSize = 16;
+  element->value = value;
+  element->time = mach_absolute_time();
+  element->current = new __IOHIDValue;
+  element->current->element = element;
+  device->elements.push_back( element );
+}
+
+/**
+ * \brief Append a short item to a report descriptor, with the fewest data bytes that
+ *  hold the value (as a signed number).
+ */
+static void AddItem( vector<uint8_t> &d, uint8_t prefix, int32_t value )
+{
+  if( value >= -128 && value <= 127 )
+  {
+    d.push_back( (uint8_t)( prefix | 1 ) );
+    d.push_back( (uint8_t)value );
+  }
+  else if( value >= -32768 && value <= 32767 )
+  {
+    d.push_back( (uint8_t)( prefix | 2 ) );
+    d.push_back( (uint8_t)value );
+    d.push_back( (uint8_t)( value >> 8 ) );
+  }
+  else
+  {
+    d.push_back( (uint8_t)( prefix | 3 ) );
+    for( int ii=0; ii<4; ii++ ) d.push_back( (uint8_t)( value >> 8*ii ) );
+  }
+}
+
+/**
+ * \brief Append a constant (padding) input field, up to the next whole byte.
+ */
+static void AddInputPadding( vector<uint8_t> &d, uint32_t &bit )
+{
+  if( bit % 8 == 0 ) return;
+  AddItem( d, 0x74, (int32_t)( 8 - bit%8 ) );   // Report size
+  AddItem( d, 0x94, 1 );                       // Report count
+  AddItem( d, 0x80, 0x03 );                    // Input (constant, variable)
+  bit += 8 - bit%8;
+}
+
+/**
+ * \brief Lay out the elements of a synthetic device in its reports, and make its report
+ *  descriptor: a joystick collection with an input report (ID 1) of 16 bit absolute
+ *  axes, 8 bit signed relative axes, 1 bit buttons and 4 bit POVs (the buttons and POVs
+ *  each padded to a whole byte), then output reports (from ID 2) of (up to) 8 outputs
+ *  of 10 bits each, also padded to a whole byte.
+ */
+static CFDataRef MakeDescriptor( FakeDevice *device, const FakeHIDDeviceSpec &spec )
+{
+  CFDataRef data = new __CFData;
+  device->inputReportBytes = 0;
+  size_t numInputs = spec.numAxes + spec.numButtons + spec.numPOVs;
+  if( numInputs + spec.numOutputs == 0 ) return data;
+  vector<uint8_t> &d = data->bytes;
+  const uint8_t head[] = { 0x05, 0x01, 0x09, 0x04, 0xA1, 0x01 };
+  d.insert( d.end(), head, head+sizeof(head) );
+  
+  if( numInputs > 0 )
+  {
+    AddItem( d, 0x84, 1 );                                   // Report ID
+    uint32_t bit = 8;
+    for( size_t ii=0; ii<spec.numAxes; ii++ )
+    {
+      IOHIDElementRef element = device->elements[ ii ];
+      element->reportID = 1;
+      element->bitOffset = bit;
+      element->reportSize = element->relative ? 8 : 16;
+      AddItem( d, 0x04, kHIDPage_GenericDesktop );            // Usage page
+      AddItem( d, 0x14, (int32_t)element->min );              // Logical minimum
+      AddItem( d, 0x24, (int32_t)element->max );              // Logical maximum
+      AddItem( d, 0x74, (int32_t)element->reportSize );       // Report size
+      AddItem( d, 0x94, 1 );                                  // Report count
+      AddItem( d, 0x08, (int32_t)element->usage );            // Usage
+      AddItem( d, 0x80, element->relative ? 0x06 : 0x02 );    // Input (data, variable)
+      bit += element->reportSize;
+    }
+    if( spec.numButtons > 0 )
+    {
+      for( size_t ii=0; ii<spec.numButtons; ii++ )
+      {
+        IOHIDElementRef element = device->elements[ spec.numAxes + ii ];
+        element->reportID = 1;
+        element->bitOffset = bit + (uint32_t)ii;
+        element->reportSize = 1;
+      }
+      AddItem( d, 0x04, kHIDPage_Button );                    // Usage page
+      AddItem( d, 0x18, 1 );                                  // Usage minimum
+      AddItem( d, 0x28, (int32_t)spec.numButtons );           // Usage maximum
+      AddItem( d, 0x14, 0 );                                  // Logical minimum
+      AddItem( d, 0x24, 1 );                                  // Logical maximum
+      AddItem( d, 0x74, 1 );                                  // Report size
+      AddItem( d, 0x94, (int32_t)spec.numButtons );           // Report count
+      AddItem( d, 0x80, 0x02 );                               // Input (data, variable)
+      bit += (uint32_t)spec.numButtons;
+      AddInputPadding( d, bit );
+    }
+    if( spec.numPOVs > 0 )
+    {
+      for( size_t ii=0; ii<spec.numPOVs; ii++ )
+      {
+        IOHIDElementRef element = device->elements[ spec.numAxes + spec.numButtons + ii ];
+        element->reportID = 1;
+        element->bitOffset = bit + 4*(uint32_t)ii;
+        element->reportSize = 4;
+      }
+      AddItem( d, 0x04, kHIDPage_GenericDesktop );            // Usage page
+      AddItem( d, 0x08, kHIDUsage_GD_Hatswitch );             // Usage
+      AddItem( d, 0x14, 0 );                                  // Logical minimum
+      AddItem( d, 0x24, 7 );                                  // Logical maximum
+      AddItem( d, 0x74, 4 );                                  // Report size
+      AddItem( d, 0x94, (int32_t)spec.numPOVs );              // Report count
+      AddItem( d, 0x80, 0x42 );                               // Input (data, variable, null state)
+      bit += 4*(uint32_t)spec.numPOVs;
+      AddInputPadding( d, bit );
+    }
+    device->inputReportBytes = bit/8;
+  }
+  
+  for( size_t first=0; first<spec.numOutputs; first+=8 )
+  {
+    size_t count = spec.numOutputs-first < 8 ? spec.numOutputs-first : 8;
+    uint16_t usageMin = (uint16_t)( first+1 ), usageMax = (uint16_t)( first+count );
+    const uint8_t report[] = {
+      0x85, (uint8_t)( 2 + first/8 ),                     // Report ID
+      0x05, 0x08,                                         // Usage page (LEDs)
+      0x1A, (uint8_t)usageMin, (uint8_t)( usageMin >> 8 ),  // Usage minimum
+      0x2A, (uint8_t)usageMax, (uint8_t)( usageMax >> 8 ),  // Usage maximum
+      0x15, 0x00,                                         // Logical minimum (0)
+      0x26, 0xFF, 0x03,                                   // Logical maximum (1023)
+      0x75, 0x0A,                                         // Report size (10)
+      0x95, (uint8_t)count,                               // Report count
+      0x91, 0x02 };                                       // Output (data, variable)
+    d.insert( d.end(), report, report+sizeof(report) );
+    size_t bits = 10*count;
+    if( bits % 8 != 0 )
+    {
+      const uint8_t pad[] = { 0x75, (uint8_t)( 8 - bits%8 ), 0x95, 0x01, 0x91, 0x01 };
+      d.insert( d.end(), pad, pad+sizeof(pad) );
+    }
+  }
+  d.push_back( 0xC0 );
+  return data;
+}
+
+/**
+ * \brief Make the input report of a synthetic device from the values of its elements
+ *  (state mutex must be held). Relative axes only report a change in the report of the
+ *  element that changed, and are 0 in every other report.
+ *
+ * \return The report (allocated with new[]), or NULL if the device has no input report.
+ */
+static uint8_t *MakeInputReport( const FakeDevice *device, IOHIDElementRef changed )
+{
+  if( device->inputReportBytes == 0 ) return NULL;
+  uint8_t *report = new uint8_t[ device->inputReportBytes ];
+  memset( report, 0, device->inputReportBytes );
+  report[ 0 ] = 1;
+  for( size_t ii=0; ii<device->elements.size(); ii++ )
+  {
+    IOHIDElementRef element = device->elements[ ii ];
+    if( element->reportID != 1 ) continue;
+    unsigned long value = (unsigned long)element->value;
+    if( element->relative && element != changed ) value = 0;
+    else if( element->reportSize == 1 ) value = element->value != 0 ? 1 : 0;
+    for( uint32_t bb=0; bb<element->reportSize; bb++ )
+    {
+      uint32_t bit = element->bitOffset + bb;
+      if( ( value >> bb ) & 1 ) report[ bit/8 ] = (uint8_t)( report[ bit/8 ] | ( 1 << ( bit%8 ) ) );
+    }
+  }
+  return report;
+}
+
+/**
+ * \brief Attach a synthetic device. Open managers are told of it (on their run loop).
+ *
+ * \return false if a device with the same location ID is already attached.
+ */
+bool FakeHIDAttach( const FakeHIDDeviceSpec &spec )
+{
+  FakeHIDState &s = State();
+  pthread_mutex_lock( &s.mutex );
+  if( FindDevice( spec.locationID ) != NULL )
+  {
+    pthread_mutex_unlock( &s.mutex );
+    return false;
+  }
+  
+  FakeDevice *device = new FakeDevice;
+  device->locationID = spec.locationID;
+  device->service = s.nextService++;
+  device->attached = true;
+  int32_t value = spec.locationID;
+  device->location = CFNumberCreate( kCFAllocatorDefault, kCFNumberSInt32Type, &value );
+  value = 0x1234;
+  device->vendorID = CFNumberCreate( kCFAllocatorDefault, kCFNumberSInt32Type, &value );
+  value = (int32_t)( spec.numAxes*1000 + spec.numButtons );
+  device->productID = CFNumberCreate( kCFAllocatorDefault, kCFNumberSInt32Type, &value );
+  device->product = new __CFString( spec.product != NULL ? spec.product : "Synthetic joystick" );
+  device->serialNumber = new __CFString( "" );
+  
+  // Axes cycle through the generic desktop axis usages, skipping the hat switch
+  for( size_t ii=0; ii<spec.numAxes; ii++ )
+  {
+    bool relative = ii < spec.numRelative;
+    AddElement( device, kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop,
+                kHIDUsage_GD_X + (uint32_t)( ii % 9 ), relative ? -127 : 0,
+                relative ? 127 : 1023, relative ? 0 : 512 );
+    device->elements.back()->relative = relative;
+  }
+  for( size_t ii=0; ii<spec.numButtons; ii++ )
+    AddElement( device, kIOHIDElementTypeInput_Button, kHIDPage_Button, (uint32_t)ii + 1, 0, 1, 0 );
+  for( size_t ii=0; ii<spec.numPOVs; ii++ )
+    AddElement( device, kIOHIDElementTypeInput_Misc, kHIDPage_GenericDesktop,
+                kHIDUsage_GD_Hatswitch, 0, 7, 8 );
+  for( size_t ii=0; ii<spec.numOutputs; ii++ )
+  {
+    AddElement( device, kIOHIDElementTypeOutput, 0x08, (uint32_t)ii + 1, 0, 1023, 0 );
+    IOHIDElementRef element = device->elements.back();
+    element->reportID = (uint32_t)( 2 + ii/8 );
+    element->bitOffset = (uint32_t)( 8 + 10*( ii%8 ) );
+    element->reportSize = 10;
+  }
+  device->descriptor = MakeDescriptor( device, spec );
+  value = (int32_t)device->inputReportBytes;
+  device->maxInputReportSize = CFNumberCreate( kCFAllocatorDefault, kCFNumberSInt32Type, &value );
+  device->reports.resize( 256 );
+  device->reportCount = 0;
+  s.devices.push_back( device );
+  
+  for( size_t ii=0; ii<s.managers.size(); ii++ )
+  {
+    if( s.managers[ ii ]->open && s.managers[ ii ]->runLoop != NULL ) MatchDevice( s.managers[ ii ], device );
+  }
+  pthread_mutex_unlock( &s.mutex );
+  return true;
+}
+
+/**
+ * \brief Detach a synthetic device. Open managers are told of it, and further IO on
+ *  references to it fails.
+ *
+ * \return false if there is no such device.
+ */
+bool FakeHIDDetach( int32_t locationID )
+{
+  FakeHIDState &s = State();
+  pthread_mutex_lock( &s.mutex );
+  FakeDevice *device = FindDevice( locationID );
+  if( device == NULL )
+  {
+    pthread_mutex_unlock( &s.mutex );
+    return false;
+  }
+  device->attached = false;
+  for( size_t ii=0; ii<s.managers.size(); ii++ )
+  {
+    IOHIDManagerRef manager = s.managers[ ii ];
+    for( size_t jj=0; jj<manager->devices.size(); jj++ )
+    {
+      IOHIDDeviceRef ref = manager->devices[ jj ];
+      if( ref->device != device ) continue;
+      manager->devices.erase( manager->devices.begin() + jj );
+      if( manager->runLoop != NULL ) PostEvent( manager->runLoop, FakeEvent::kRemoved, manager, ref, NULL );
+      CFRelease( ref );
+      break;
+    }
+  }
+  pthread_mutex_unlock( &s.mutex );
+  return true;
+}
+
+/**
+ * \brief Change the value of an element of a synthetic device, as if the device had
+ *  reported it. Input value callbacks registered on the device, and input report
+ *  callbacks (with the whole report), are queued on their run loops.
+ */
+bool FakeHIDSetInput( int32_t locationID, size_t element, long value )
+{
+  FakeHIDState &s = State();
+  pthread_mutex_lock( &s.mutex );
+  FakeDevice *device = FindDevice( locationID );
+  if( device == NULL || element >= device->elements.size() )
+  {
+    pthread_mutex_unlock( &s.mutex );
+    return false;
+  }
+  IOHIDElementRef el = device->elements[ element ];
+  el->value = value;
+  el->time = mach_absolute_time();
+  for( size_t ii=0; ii<device->refs.size(); ii++ )
+  {
+    IOHIDDeviceRef ref = device->refs[ ii ];
+    if( !ref->open || ref->runLoop == NULL ) continue;
+    if( ref->valueCallback != NULL )
+    {
+      PostEvent( ref->runLoop, FakeEvent::kValue, ref, NULL,
+                 IOHIDValueCreateWithIntegerValue( kCFAllocatorDefault, el, el->time, value ) );
+    }
+    if( ref->reportCallback != NULL && el->reportID == 1 && el->type != kIOHIDElementTypeOutput )
+    {
+      PostInputReport( ref, MakeInputReport( device, el ), (CFIndex)device->inputReportBytes );
+    }
+  }
+  pthread_mutex_unlock( &s.mutex );
+  return true;
+}
+
+/**
+ * \brief The last value written to an element of a synthetic device (such as by
+ *  IOHIDDeviceSetValue), or 0 if there is no such device or element.
+ */
+long FakeHIDGetValue( int32_t locationID, size_t element )
+{
+  FakeHIDState &s = State();
+  long value = 0;
+  pthread_mutex_lock( &s.mutex );
+  FakeDevice *device = FindDevice( locationID );
+  if( device != NULL && element < device->elements.size() ) value = device->elements[ element ]->value;
+  pthread_mutex_unlock( &s.mutex );
+  return value;
+}
+
+/**
+ * \brief Copy the last output report with an ID sent to a synthetic device (with
+ *  IOHIDDeviceSetReport or IOHIDDeviceSetReportWithCallback).
+ */
+size_t FakeHIDGetReport( int32_t locationID, uint8_t reportID, uint8_t *report, size_t len )
+{
+  FakeHIDState &s = State();
+  size_t reportLength = 0;
+  pthread_mutex_lock( &s.mutex );
+  FakeDevice *device = FindDevice( locationID );
+  if( device != NULL )
+  {
+    const vector<uint8_t> &last = device->reports[ reportID ];
+    reportLength = last.size();
+    for( size_t ii=0; ii<reportLength && ii<len; ii++ ) report[ ii ] = last[ ii ];
+  }
+  pthread_mutex_unlock( &s.mutex );
+  return reportLength;
+}
+
+/**
+ * \brief Number of output reports sent to a synthetic device, or 0 if there is no such
+ *  device.
+ */
+uint64_t FakeHIDReportCount( int32_t locationID )
+{
+  FakeHIDState &s = State();
+  uint64_t count = 0;
+  pthread_mutex_lock( &s.mutex );
+  FakeDevice *device = FindDevice( locationID );
+  if( device != NULL ) count = device->reportCount;
+  pthread_mutex_unlock( &s.mutex );
+  return count;
+}
+
+/**
+ * \brief Total number of IOHIDDeviceGetValue, IOHIDDeviceSetValue and output report
+ *  calls made.
+ */
+uint64_t FakeHIDCallCount( void )
+{
+  return State().calls;
+}
@@ -0,0 +1,333 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __FAKEHID_H__
+#define __FAKEHID_H__
+
+/*
+ * A synthetic, in-memory stand in for the parts of IOKit HID and CoreFoundation used by
+ * this project. With fakehid/ on the include path, the joystick code builds and runs
+ * unchanged on a machine without IOKit (such as Linux), against devices made with
+ * FakeHIDAttach. It is only meant for benchmarks and other off-target checks.
+ *
+ * Run loops are serviced by CFRunLoopRunInMode on the thread that owns them. The device
+ * matching, removal, input value and output report callbacks are delivered on the run
+ * loops their manager or device is scheduled on. The report descriptor of a device
+ * describes an input report (ID 1) of 16 bit absolute axes, 8 bit signed relative axes,
+ * 1 bit buttons and 4 bit POVs, and output reports (from ID 2) with 8 outputs of 10 bits
+ * in each. Every change made with FakeHIDSetInput is also delivered as a whole input
+ * report to input report callbacks, so kJoystick_RawReports decodes real reports. Output
+ * reports sent to a device set its output elements, and the last one with each ID can be
+ * read back byte for byte with FakeHIDGetReport.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRUE 1
+#define FALSE 0
+
+// CoreFoundation
+typedef long CFIndex;
+typedef unsigned long CFTypeID;
+typedef unsigned long CFOptionFlags;
+typedef unsigned char Boolean;
+typedef double CFTimeInterval;
+typedef int32_t SInt32;
+typedef const void *CFTypeRef;
+typedef struct __CFAllocator *CFAllocatorRef;
+typedef struct __CFArray *CFArrayRef;
+typedef struct __CFArray *CFMutableArrayRef;
+typedef struct __CFDictionary *CFDictionaryRef;
+typedef struct __CFDictionary *CFMutableDictionaryRef;
+typedef struct __CFNumber *CFNumberRef;
+typedef struct __CFString *CFStringRef;
+typedef struct __CFData *CFDataRef;
+typedef struct __CFRunLoop *CFRunLoopRef;
+typedef struct __CFRunLoopObserver *CFRunLoopObserverRef;
+typedef CFOptionFlags CFRunLoopActivity;
+typedef int CFNumberType;
+
+// Constant strings are plain C strings, compared by value
+#define CFSTR(x) ((CFStringRef)(x))
+
+extern CFAllocatorRef kCFAllocatorDefault;
+extern CFStringRef kCFRunLoopDefaultMode;
+extern const int kCFTypeArrayCallBacks;
+extern const int kCFTypeDictionaryKeyCallBacks;
+extern const int kCFTypeDictionaryValueCallBacks;
+
+enum { kCFNumberSInt32Type = 3, kCFNumberSInt64Type = 4, kCFNumberIntType = 9 };
+enum { kCFStringEncodingUTF8 = 0x08000100 };
+enum { kCFRunLoopRunFinished = 1, kCFRunLoopRunStopped, kCFRunLoopRunTimedOut,
+                                                         kCFRunLoopRunHandledSource };
+enum { kCFRunLoopEntry = 1, kCFRunLoopBeforeTimers = 2, kCFRunLoopBeforeSources = 4,
+       kCFRunLoopBeforeWaiting = 32, kCFRunLoopAfterWaiting = 64, kCFRunLoopExit = 128 };
+
+typedef void (*CFRunLoopObserverCallBack)( CFRunLoopObserverRef, CFRunLoopActivity, void * );
+typedef struct
+{
+  CFIndex version;
+  void *info;
+  const void *(*retain)( const void * );
+  void (*release)( const void * );
+  CFStringRef (*copyDescription)( const void * );
+} CFRunLoopObserverContext;
+
+CFTypeRef CFRetain( CFTypeRef cf );
+void CFRelease( CFTypeRef cf );
+CFTypeID CFGetTypeID( CFTypeRef cf );
+CFTypeID CFNumberGetTypeID( void );
+CFTypeID CFStringGetTypeID( void );
+CFTypeID CFDataGetTypeID( void );
+CFMutableArrayRef CFArrayCreateMutable( CFAllocatorRef allocator, CFIndex capacity,
+                                                               const void *callBacks );
+void CFArrayAppendValue( CFMutableArrayRef array, const void *value );
+CFIndex CFArrayGetCount( CFArrayRef array );
+const void *CFArrayGetValueAtIndex( CFArrayRef array, CFIndex index );
+CFMutableDictionaryRef CFDictionaryCreateMutable( CFAllocatorRef allocator,
+                 CFIndex capacity, const void *keyCallBacks, const void *valueCallBacks );
+void CFDictionarySetValue( CFMutableDictionaryRef dict, const void *key, const void *value );
+CFNumberRef CFNumberCreate( CFAllocatorRef allocator, CFNumberType type, const void *valuePtr );
+CFNumberType CFNumberGetType( CFNumberRef number );
+Boolean CFNumberGetValue( CFNumberRef number, CFNumberType type, void *valuePtr );
+Boolean CFStringGetCString( CFStringRef string, char *buffer, CFIndex bufferSize,
+                                                                     uint32_t encoding );
+CFIndex CFDataGetLength( CFDataRef data );
+const uint8_t *CFDataGetBytePtr( CFDataRef data );
+CFRunLoopRef CFRunLoopGetCurrent( void );
+int CFRunLoopRunInMode( CFStringRef mode, CFTimeInterval seconds,
+                                                      Boolean returnAfterSourceHandled );
+void CFRunLoopStop( CFRunLoopRef runLoop );
+CFRunLoopObserverRef CFRunLoopObserverCreate( CFAllocatorRef allocator,
+         CFOptionFlags activities, Boolean repeats, CFIndex order,
+         CFRunLoopObserverCallBack callout, CFRunLoopObserverContext *context );
+void CFRunLoopAddObserver( CFRunLoopRef runLoop, CFRunLoopObserverRef observer,
+                                                                     CFStringRef mode );
+void CFRunLoopRemoveObserver( CFRunLoopRef runLoop, CFRunLoopObserverRef observer,
+                                                                     CFStringRef mode );
+
+// mach
+typedef struct { uint32_t numer, denom; } mach_timebase_info_data_t;
+uint64_t mach_absolute_time( void );
+int mach_timebase_info( mach_timebase_info_data_t *info );
+
+// IOKit
+typedef int IOReturn;
+typedef int kern_return_t;
+typedef uint32_t IOOptionBits;
+typedef uint32_t io_object_t;
+typedef uint32_t io_service_t;
+typedef uint32_t IOHIDElementCookie;
+typedef struct __IOHIDManager *IOHIDManagerRef;
+typedef struct __IOHIDDevice *IOHIDDeviceRef;
+typedef struct __IOHIDElement *IOHIDElementRef;
+typedef struct __IOHIDValue *IOHIDValueRef;
+
+enum { kIOReturnSuccess = 0, kIOReturnError = (int)0xE00002BC,
+       kIOReturnNotOpen = (int)0xE00002CD, kIOReturnNoDevice = (int)0xE00002C0,
+       kIOReturnNotReady = (int)0xE00002D8 };
+enum { kIOHIDOptionsTypeNone = 0, kIOHIDManagerOptionNone = 0 };
+
+typedef enum
+{
+  kIOHIDElementTypeInput_Misc = 1,
+  kIOHIDElementTypeInput_Button = 2,
+  kIOHIDElementTypeInput_Axis = 3,
+  kIOHIDElementTypeInput_ScanCodes = 4,
+  kIOHIDElementTypeOutput = 129,
+  kIOHIDElementTypeFeature = 257,
+  kIOHIDElementTypeCollection = 513
+} IOHIDElementType;
+
+typedef enum
+{
+  kIOHIDReportTypeInput = 0,
+  kIOHIDReportTypeOutput,
+  kIOHIDReportTypeFeature
+} IOHIDReportType;
+
+typedef void (*IOHIDCallback)( void *, IOReturn, void * );
+typedef void (*IOHIDValueCallback)( void *, IOReturn, void *, IOHIDValueRef );
+typedef void (*IOHIDDeviceCallback)( void *, IOReturn, void *, IOHIDDeviceRef );
+typedef void (*IOHIDReportCallback)( void *, IOReturn, void *, IOHIDReportType, uint32_t,
+                                                                       uint8_t *, CFIndex );
+
+#define kIOHIDDeviceUsagePageKey "DeviceUsagePage"
+#define kIOHIDDeviceUsageKey "DeviceUsage"
+#define kIOHIDLocationIDKey "LocationID"
+#define kIOHIDProductKey "Product"
+#define kIOHIDSerialNumberKey "SerialNumber"
+#define kIOHIDTransportKey "Transport"
+#define kIOHIDVendorIDKey "VendorID"
+#define kIOHIDProductIDKey "ProductID"
+#define kIOHIDReportDescriptorKey "ReportDescriptor"
+#define kIOHIDMaxInputReportSizeKey "MaxInputReportSize"
+
+enum { kHIDPage_GenericDesktop = 0x01, kHIDPage_Button = 0x09 };
+enum
+{
+  kHIDUsage_GD_Joystick = 0x04, kHIDUsage_GD_GamePad = 0x05,
+  kHIDUsage_GD_MultiAxisController = 0x08,
+  kHIDUsage_GD_X = 0x30, kHIDUsage_GD_Y, kHIDUsage_GD_Z, kHIDUsage_GD_Rx, kHIDUsage_GD_Ry,
+  kHIDUsage_GD_Rz, kHIDUsage_GD_Slider, kHIDUsage_GD_Dial, kHIDUsage_GD_Wheel,
+  kHIDUsage_GD_Hatswitch
+};
+
+kern_return_t IOObjectRetain( io_object_t object );
+kern_return_t IOObjectRelease( io_object_t object );
+
+IOHIDManagerRef IOHIDManagerCreate( CFAllocatorRef allocator, IOOptionBits options );
+IOReturn IOHIDManagerOpen( IOHIDManagerRef manager, IOOptionBits options );
+IOReturn IOHIDManagerClose( IOHIDManagerRef manager, IOOptionBits options );
+void IOHIDManagerSetDeviceMatchingMultiple( IOHIDManagerRef manager, CFArrayRef multiple );
+void IOHIDManagerRegisterDeviceMatchingCallback( IOHIDManagerRef manager,
+                                         IOHIDDeviceCallback callback, void *context );
+void IOHIDManagerRegisterDeviceRemovalCallback( IOHIDManagerRef manager,
+                                         IOHIDDeviceCallback callback, void *context );
+void IOHIDManagerScheduleWithRunLoop( IOHIDManagerRef manager, CFRunLoopRef runLoop,
+                                                               CFStringRef runLoopMode );
+void IOHIDManagerUnscheduleFromRunLoop( IOHIDManagerRef manager, CFRunLoopRef runLoop,
+                                                               CFStringRef runLoopMode );
+
+IOHIDDeviceRef IOHIDDeviceCreate( CFAllocatorRef allocator, io_service_t service );
+io_service_t IOHIDDeviceGetService( IOHIDDeviceRef device );
+IOReturn IOHIDDeviceOpen( IOHIDDeviceRef device, IOOptionBits options );
+IOReturn IOHIDDeviceClose( IOHIDDeviceRef device, IOOptionBits options );
+CFTypeRef IOHIDDeviceGetProperty( IOHIDDeviceRef device, CFStringRef key );
+CFArrayRef IOHIDDeviceCopyMatchingElements( IOHIDDeviceRef device,
+                                          CFDictionaryRef matching, IOOptionBits options );
+IOReturn IOHIDDeviceGetValue( IOHIDDeviceRef device, IOHIDElementRef element,
+                                                                   IOHIDValueRef *value );
+IOReturn IOHIDDeviceSetValue( IOHIDDeviceRef device, IOHIDElementRef element,
+                                                                    IOHIDValueRef value );
+IOReturn IOHIDDeviceSetReport( IOHIDDeviceRef device, IOHIDReportType reportType,
+                              CFIndex reportID, const uint8_t *report, CFIndex reportLength );
+IOReturn IOHIDDeviceSetReportWithCallback( IOHIDDeviceRef device, IOHIDReportType reportType,
+                              CFIndex reportID, const uint8_t *report, CFIndex reportLength,
+                              CFTimeInterval timeout, IOHIDReportCallback callback, void *context );
+void IOHIDDeviceRegisterInputValueCallback( IOHIDDeviceRef device,
+                                          IOHIDValueCallback callback, void *context );
+void IOHIDDeviceRegisterInputReportCallback( IOHIDDeviceRef device, uint8_t *report,
+                     CFIndex reportLength, IOHIDReportCallback callback, void *context );
+void IOHIDDeviceScheduleWithRunLoop( IOHIDDeviceRef device, CFRunLoopRef runLoop,
+                                                               CFStringRef runLoopMode );
+void IOHIDDeviceUnscheduleFromRunLoop( IOHIDDeviceRef device, CFRunLoopRef runLoop,
+                                                               CFStringRef runLoopMode );
+
+IOHIDElementType IOHIDElementGetType( IOHIDElementRef element );
+IOHIDElementCookie IOHIDElementGetCookie( IOHIDElementRef element );
+uint32_t IOHIDElementGetUsagePage( IOHIDElementRef element );
+uint32_t IOHIDElementGetUsage( IOHIDElementRef element );
+long IOHIDElementGetLogicalMin( IOHIDElementRef element );
+long IOHIDElementGetLogicalMax( IOHIDElementRef element );
+Boolean IOHIDElementIsRelative( IOHIDElementRef element );
+uint32_t IOHIDElementGetReportID( IOHIDElementRef element );
+uint32_t IOHIDElementGetReportSize( IOHIDElementRef element );
+uint32_t IOHIDElementGetReportCount( IOHIDElementRef element );
+
+IOHIDValueRef IOHIDValueCreateWithIntegerValue( CFAllocatorRef allocator,
+                           IOHIDElementRef element, uint64_t timeStamp, long value );
+IOHIDElementRef IOHIDValueGetElement( IOHIDValueRef value );
+long IOHIDValueGetIntegerValue( IOHIDValueRef value );
+uint64_t IOHIDValueGetTimeStamp( IOHIDValueRef value );
+CFIndex IOHIDValueGetLength( IOHIDValueRef value );
+
+// Control of the synthetic devices
+
+/**
+ * \brief Description of a synthetic joystick. Its elements are the axes, then the
+ *  buttons, then the POV hats, then the outputs. Axes and outputs range from 0 to 1023,
+ *  and POV hats from 0 to 7 (with 8 for nothing pressed). The first numRelative axes
+ *  are relative instead, reporting changes from -127 to 127.
+ */
+struct FakeHIDDeviceSpec
+{
+  int32_t locationID;
+  const char *product;
+  size_t numAxes, numButtons, numPOVs, numOutputs;
+  size_t numRelative;
+};
+
+/**
+ * \brief Attach a synthetic device. Open managers are told of it (on their run loop).
+ *
+ * \return false if a device with the same location ID is already attached.
+ */
+bool FakeHIDAttach( const FakeHIDDeviceSpec &spec );
+
+/**
+ * \brief Detach a synthetic device. Open managers are told of it, and further IO on
+ *  references to it fails.
+ *
+ * \return false if there is no such device.
+ */
+bool FakeHIDDetach( int32_t locationID );
+
+/**
+ * \brief Change the value of an element of a synthetic device, as if the device had
+ *  reported it. Input value callbacks registered on the device, and input report
+ *  callbacks (with the whole report), are queued on their run loops.
+ *
+ * \param[in] locationID Device location ID.
+ * \param[in] element Element index (see FakeHIDDeviceSpec).
+ * \param[in] value New value.
+ * \return false if there is no such device or element.
+ */
+bool FakeHIDSetInput( int32_t locationID, size_t element, long value );
+
+/**
+ * \brief The last value written to an element of a synthetic device (such as by
+ *  IOHIDDeviceSetValue), or 0 if there is no such device or element.
+ */
+long FakeHIDGetValue( int32_t locationID, size_t element );
+
+/**
+ * \brief Copy the last output report with an ID sent to a synthetic device (with
+ *  IOHIDDeviceSetReport or IOHIDDeviceSetReportWithCallback).
+ *
+ * \param[in] locationID Device location ID.
+ * \param[in] reportID Report ID.
+ * \param[out] report Receives the report bytes, including the report ID byte.
+ * \param[in] len Size of report.
+ * \return Length of the report (which may exceed len), or 0 if none has been sent.
+ */
+size_t FakeHIDGetReport( int32_t locationID, uint8_t reportID, uint8_t *report, size_t len );
+
+/**
+ * \brief Number of output reports sent to a synthetic device, or 0 if there is no such
+ *  device.
+ */
+uint64_t FakeHIDReportCount( int32_t locationID );
+
+/**
+ * \brief Total number of IOHIDDeviceGetValue, IOHIDDeviceSetValue and output report
+ *  calls made.
+ */
+uint64_t FakeHIDCallCount( void );
+
+#endif
@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fakesource.hpp"
+
+/**
+ * \brief ScriptedSource constructor.
+ *
+ * \param[in] snapshot Snapshot to write the element values into.
+ */
+ScriptedSource::ScriptedSource( JoySnapshot *snapshot )
+{
+  mySnapshot = snapshot;
+  myRing = NULL;
+  myNext = 0;
+}
+
+/**
+ * \brief ScriptedSource destructor.
+ */
+ScriptedSource::~ScriptedSource()
+{
+}
+
+/**
+ * \brief Append an element value change to the script. Events must be added in
+ *  non-decreasing time order.
+ *
+ * \param[in] time Time (seconds) at which the value changes.
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ * \param[in] index Index of the element within its type.
+ * \param[in] value Raw (integer) value of the element.
+ */
+void ScriptedSource::Add( double time, JoystickIOIndex type, size_t index, int32_t value )
+{
+  if( !myEvents.empty() && time < myEvents.back().time )
+  {
+    throw "ScriptedSource events must be added in time order";
+  }
+  Event ev;
+  ev.time = time;
+  ev.type = type;
+  ev.index = index;
+  ev.value = value;
+  myEvents.push_back( ev );
+}
+
+/**
+ * \brief Also record samples into a ring, as the acquisition thread does for
+ *  Joystick::EnableFrames. Events with the same time make up one sample, pushed after
+ *  the last of them. The time stamps are in nanoseconds.
+ *
+ * \param[in] ring Ring to push samples into, with a stride of at least the
+ *  snapshot's PackedSize(). NULL stops recording.
+ */
+void ScriptedSource::SetRing( SampleRing *ring )
+{
+  myRing = ring;
+}
+
+/**
+ * \brief Play all events up to and including the given time into the snapshot.
+ *
+ * \param[in] time Time (seconds) to advance the script to.
+ * \return Number of events played.
+ */
+size_t ScriptedSource::Advance( double time )
+{
+  size_t played = 0;
+  // Each event is a separate write, the same as one IOKit value callback.
+  while( myNext < myEvents.size() && myEvents[ myNext ].time <= time )
+  {
+    const Event &ev = myEvents[ myNext ];
+    uint64_t stamp = (uint64_t)( ev.time*1e9 );
+    mySnapshot->Write( ev.type, ev.index, ev.value, stamp );
+    myNext++;
+    played++;
+    
+    bool lastOfSample = ( myNext == myEvents.size() || myEvents[ myNext ].time != ev.time );
+    if( myRing != NULL && lastOfSample )
+    {
+      int32_t *slot = myRing->BeginPush();
+      if( slot != NULL )
+      {
+        mySnapshot->CopyPacked( slot );
+        myRing->EndPush( stamp );
+      }
+    }
+  }
+  return played;
+}
+
+/**
+ * \brief Restart the script from the beginning.
+ */
+void ScriptedSource::Rewind( void )
+{
+  myNext = 0;
+}
+
+/**
+ * \brief Whether every event in the script has been played.
+ */
+bool ScriptedSource::Finished( void ) const
+{
+  return myNext >= myEvents.size();
+}
+
+/**
+ * \brief FakeHotplug constructor.
+ *
+ * \param[in] registry Registry to add the devices to.
+ */
+FakeHotplug::FakeHotplug( JoyRegistry *registry )
+{
+  myRegistry = registry;
+}
+
+/**
+ * \brief Simulate a device being attached. The handle is left NULL.
+ */
+void FakeHotplug::Plug( int32_t locationKey, const std::string &productKey, int32_t vendorID,
+                        int32_t productID, const std::string &serialNumber )
+{
+  JoyDeviceEntry entry;
+  entry.locationKey = locationKey;
+  entry.productKey = productKey;
+  entry.vendorID = vendorID;
+  entry.productID = productID;
+  entry.serialNumber = serialNumber;
+  entry.handle = NULL;
+  myRegistry->Add( entry );
+}
+
+/**
+ * \brief Simulate a device being removed.
+ *
+ * \return true if the device was in the registry.
+ */
+bool FakeHotplug::Unplug( int32_t locationKey )
+{
+  return myRegistry->Remove( locationKey );
+}
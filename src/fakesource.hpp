@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __FAKESOURCE_H__
+#define __FAKESOURCE_H__
+
+#include <vector>
+#include <string>
+#include "snapshot.hpp"
+#include "samplering.hpp"
+#include "joyregistry.hpp"
+
+/**
+ * \brief A scripted element value source. Plays back a list of timestamped element value
+ *  changes into a JoySnapshot, exactly as the IOKit input value callback would. This
+ *  allows the snapshot path to be exercised (and timed) without any hardware. Element
+ *  time stamps are the script times in nanoseconds.
+ */
+class ScriptedSource
+{
+  public:
+    /**
+     * \brief ScriptedSource constructor.
+     *
+     * \param[in] snapshot Snapshot to write the element values into.
+     */
+    ScriptedSource( JoySnapshot *snapshot );
+    
+    /**
+     * \brief ScriptedSource destructor.
+     */
+    ~ScriptedSource();
+    
+    /**
+     * \brief Append an element value change to the script. Events must be added in
+     *  non-decreasing time order.
+     *
+     * \param[in] time Time (seconds) at which the value changes.
+     * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+     * \param[in] index Index of the element within its type.
+     * \param[in] value Raw (integer) value of the element.
+     */
+    void Add( double time, JoystickIOIndex type, size_t index, int32_t value );
+    
+    /**
+     * \brief Also record samples into a ring, as the acquisition thread does for
+     *  Joystick::EnableFrames. Events with the same time make up one sample, pushed after
+     *  the last of them. The time stamps are in nanoseconds.
+     *
+     * \param[in] ring Ring to push samples into, with a stride of at least the
+     *  snapshot's PackedSize(). NULL stops recording.
+     */
+    void SetRing( SampleRing *ring );
+    
+    /**
+     * \brief Play all events up to and including the given time into the snapshot.
+     *
+     * \param[in] time Time (seconds) to advance the script to.
+     * \return Number of events played.
+     */
+    size_t Advance( double time );
+    
+    /**
+     * \brief Restart the script from the beginning.
+     */
+    void Rewind( void );
+    
+    /**
+     * \brief Whether every event in the script has been played.
+     */
+    bool Finished( void ) const;
+    
+  private:
+    struct Event
+    {
+      double time;
+      JoystickIOIndex type;
+      size_t index;
+      int32_t value;
+    };
+    JoySnapshot *mySnapshot;
+    SampleRing *myRing;
+    std::vector<Event> myEvents;
+    size_t myNext;
+};
+
+/**
+ * \brief A stand in for the IOKit hotplug callbacks. Adds and removes devices from a
+ *  JoyRegistry, so the registry can be exercised without any hardware.
+ */
+class FakeHotplug
+{
+  public:
+    /**
+     * \brief FakeHotplug constructor.
+     *
+     * \param[in] registry Registry to add the devices to.
+     */
+    FakeHotplug( JoyRegistry *registry );
+    
+    /**
+     * \brief Simulate a device being attached. The handle is left NULL.
+     */
+    void Plug( int32_t locationKey, const std::string &productKey, int32_t vendorID = 0,
+               int32_t productID = 0, const std::string &serialNumber = std::string() );
+    
+    /**
+     * \brief Simulate a device being removed.
+     *
+     * \return true if the device was in the registry.
+     */
+    bool Unplug( int32_t locationKey );
+    
+  private:
+    JoyRegistry *myRegistry;
+};
+
+#endif
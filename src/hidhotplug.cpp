@@ -0,0 +1,369 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "hidhotplug.hpp"
+
+#define UNUSED(x) (void)(x)
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief Retain an io_service_t registry handle.
+ */
+static void RetainService( void *handle )
+{
+  IOObjectRetain( (io_service_t)(uintptr_t)handle );
+}
+
+/**
+ * \brief Release an io_service_t registry handle.
+ */
+static void ReleaseService( void *handle )
+{
+  IOObjectRelease( (io_service_t)(uintptr_t)handle );
+}
+
+/**
+ * \brief The process wide registry of attached joysticks. The hotplug thread is started
+ *  on first use.
+ */
+JoyRegistry &SharedJoyRegistry( void )
+{
+  static JoyRegistry registry;
+  static HIDHotplug hotplug( &registry );
+  if( !hotplug.Start() )
+  {
+    ERR_PRINTF("SharedJoyRegistry - Failed to start the hotplug thread.\n");
+  }
+  return registry;
+}
+
+/**
+ * \brief HIDHotplug constructor.
+ *
+ * \param[in] registry Registry to keep up to date.
+ */
+HIDHotplug::HIDHotplug( JoyRegistry *registry )
+{
+  myRegistry = registry;
+  myRegistry->SetHandleCallbacks( &RetainService, &ReleaseService );
+  myManager = NULL;
+  myRunLoop = NULL;
+  myStarted = false;
+  myReady = false;
+  myRunning = false;
+  pthread_mutex_init( &myMutex, NULL );
+  pthread_cond_init( &myCond, NULL );
+}
+
+/**
+ * \brief HIDHotplug destructor. Stops the hotplug thread.
+ */
+HIDHotplug::~HIDHotplug()
+{
+  Stop();
+  pthread_cond_destroy( &myCond );
+  pthread_mutex_destroy( &myMutex );
+}
+
+/**
+ * \brief Start the hotplug thread, and wait until the devices that are already
+ *  attached have been added to the registry. Does nothing if already started.
+ *
+ * \output true if successful, false if unsuccessful.
+ */
+bool HIDHotplug::Start( void )
+{
+  pthread_mutex_lock( &myMutex );
+  if( myStarted )
+  {
+    pthread_mutex_unlock( &myMutex );
+    return true;
+  }
+  if( !CreateManager() )
+  {
+    pthread_mutex_unlock( &myMutex );
+    return false;
+  }
+  myRunning = true;
+  myReady = false;
+  if( pthread_create( &myThread, NULL, &HIDHotplug::HotplugThread, this ) != 0 )
+  {
+    myRunning = false;
+    IOHIDManagerClose( myManager, kIOHIDOptionsTypeNone );
+    CFRelease( myManager );
+    myManager = NULL;
+    pthread_mutex_unlock( &myMutex );
+    return false;
+  }
+  myStarted = true;
+  // Wait for the initial matching callbacks
+  while( !myReady ) pthread_cond_wait( &myCond, &myMutex );
+  pthread_mutex_unlock( &myMutex );
+  return true;
+}
+
+/**
+ * \brief Stop the hotplug thread.
+ */
+void HIDHotplug::Stop( void )
+{
+  pthread_mutex_lock( &myMutex );
+  if( !myStarted )
+  {
+    pthread_mutex_unlock( &myMutex );
+    return;
+  }
+  myRunning = false;
+  if( myRunLoop != NULL ) CFRunLoopStop( myRunLoop );
+  pthread_mutex_unlock( &myMutex );
+  
+  pthread_join( myThread, NULL );
+  IOHIDManagerClose( myManager, kIOHIDOptionsTypeNone );
+  CFRelease( myManager );
+  myManager = NULL;
+  myRunLoop = NULL;
+  myStarted = false;
+}
+
+/**
+ * \brief Create and open the IO HID manager, matching joysticks, gamepads and multi
+ *  axis controllers.
+ *
+ * \output true if successful, false if unsuccessful.
+ */
+bool HIDHotplug::CreateManager( void )
+{
+  // Create IO HID manager
+  myManager = IOHIDManagerCreate( kCFAllocatorDefault, kIOHIDManagerOptionNone );
+  if( myManager == NULL ){
+    ERR_PRINTF("Failed to create the IO HID Manager.\n");
+    return false;
+  }
+
+  // Magic numbers telling the system to access joysticks (and associated)
+  uint32_t page = kHIDPage_GenericDesktop;
+  const uint32_t usages[] = { kHIDUsage_GD_Joystick,
+                              kHIDUsage_GD_GamePad,
+                              kHIDUsage_GD_MultiAxisController };
+  
+  CFMutableArrayRef myMatching = CFArrayCreateMutable( kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks );
+  if( myMatching == NULL )
+  {
+    ERR_PRINTF("Failed to create CFMutableArrayRef.\n");
+    CFRelease( myManager );
+    myManager = NULL;
+    return false;
+  }
+  
+  // Loop through and add the usages.
+  for( size_t ii=0; ii<(sizeof(usages)/sizeof(uint32_t)); ii++ )
+  {
+    CFMutableDictionaryRef matchingDict = CFDictionaryCreateMutable( kCFAllocatorDefault,
+                    1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks );
+    if( matchingDict == NULL )
+    {
+      ERR_PRINTF("Failed to create CFMutableDictionaryRef.\n");
+      continue;
+    }
+    
+    // Add the page reference
+    CFNumberRef pageRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &page);
+    if( pageRef != NULL )
+    {
+      CFDictionarySetValue( matchingDict, CFSTR(kIOHIDDeviceUsagePageKey), pageRef );
+      CFRelease( pageRef );
+    }
+    
+    // Add the usage reference
+    CFNumberRef usageRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usages[ii] );
+    if( usageRef != NULL )
+    {
+      CFDictionarySetValue( matchingDict, CFSTR(kIOHIDDeviceUsageKey), usageRef );
+      CFRelease( usageRef );
+    }
+    
+    // Append the page-usage pairs to the CFArray
+    CFArrayAppendValue( myMatching, matchingDict );
+    CFRelease( matchingDict );
+  }
+
+  IOHIDManagerSetDeviceMatchingMultiple( myManager, myMatching );
+  CFRelease( myMatching );
+  
+  IOHIDManagerRegisterDeviceMatchingCallback( myManager, &HIDHotplug::MatchingCallback, this );
+  IOHIDManagerRegisterDeviceRemovalCallback( myManager, &HIDHotplug::RemovalCallback, this );
+  
+  // Open IO HID manager
+  if( IOHIDManagerOpen( myManager, kIOHIDManagerOptionNone ) != kIOReturnSuccess )
+  {
+    ERR_PRINTF("Failed to open the IO HID Manager.\n");
+    CFRelease( myManager );
+    myManager = NULL;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Hotplug thread. Services the manager's callbacks until Stop is called.
+ */
+void *HIDHotplug::HotplugThread( void *context )
+{
+  HIDHotplug *hp = (HIDHotplug *)context;
+  CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+  IOHIDManagerScheduleWithRunLoop( hp->myManager, runLoop, kCFRunLoopDefaultMode );
+  
+  // The devices already attached are matched as soon as the run loop first runs.
+  while( CFRunLoopRunInMode( kCFRunLoopDefaultMode, 0, true ) == kCFRunLoopRunHandledSource ) {}
+  
+  pthread_mutex_lock( &hp->myMutex );
+  hp->myRunLoop = runLoop;
+  hp->myReady = true;
+  pthread_cond_signal( &hp->myCond );
+  pthread_mutex_unlock( &hp->myMutex );
+  
+  // The timeout covers a CFRunLoopStop that arrives before the run loop is entered.
+  while( hp->myRunning )
+  {
+    CFRunLoopRunInMode( kCFRunLoopDefaultMode, 0.5, false );
+  }
+  
+  IOHIDManagerUnscheduleFromRunLoop( hp->myManager, runLoop, kCFRunLoopDefaultMode );
+  return NULL;
+}
+
+/**
+ * \brief Device matching callback. Adds the device to the registry.
+ */
+void HIDHotplug::MatchingCallback( void *context, IOReturn result, void *sender,
+                                                              IOHIDDeviceRef device )
+{
+  UNUSED( sender );
+  if( result != kIOReturnSuccess ) return;
+  HIDHotplug *hp = (HIDHotplug *)context;
+  
+  JoyDeviceEntry entry;
+  entry.locationKey = GetLocationKey( device );
+  entry.productKey = GetStringProperty( device, CFSTR(kIOHIDProductKey) );
+  entry.vendorID = GetIntProperty( device, CFSTR(kIOHIDVendorIDKey) );
+  entry.productID = GetIntProperty( device, CFSTR(kIOHIDProductIDKey) );
+  entry.serialNumber = GetStringProperty( device, CFSTR(kIOHIDSerialNumberKey) );
+  entry.handle = (void *)(uintptr_t)IOHIDDeviceGetService( device );
+  hp->myRegistry->Add( entry );
+}
+
+/**
+ * \brief Device removal callback. Removes the device from the registry.
+ */
+void HIDHotplug::RemovalCallback( void *context, IOReturn result, void *sender,
+                                                              IOHIDDeviceRef device )
+{
+  UNUSED( sender );
+  UNUSED( result );
+  HIDHotplug *hp = (HIDHotplug *)context;
+  hp->myRegistry->Remove( GetLocationKey( device ) );
+}
+
+/**
+ * \brief Returns the LocationKey of the input device.
+ *
+ * \param[in] dev Device to extract the LocationKey from.
+ * \return LocationKey, or 0 if there was an error.
+ */
+int32_t HIDHotplug::GetLocationKey( IOHIDDeviceRef dev )
+{
+  CFTypeRef locRef = IOHIDDeviceGetProperty( dev, CFSTR(kIOHIDLocationIDKey) );
+  if( locRef == NULL )
+  {
+    ERR_PRINTF("Device returned a NULL location key.");
+    return 0;
+  }
+  else if( CFGetTypeID( (CFNumberRef)locRef) == CFNumberGetTypeID() )
+  {
+    if( CFNumberGetType( (CFNumberRef)locRef) == kCFNumberSInt32Type )
+    {
+      int32_t devLocInt;
+      CFNumberGetValue( (CFNumberRef)locRef, kCFNumberSInt32Type, (void *)&devLocInt );
+      return devLocInt;
+    }
+    else
+    {
+      ERR_PRINTF("Device returned a location key that wasn't an int32.");
+      return 0;
+    }
+  }
+  else
+  {
+    ERR_PRINTF("Device returned a location key that wasn't a number.");
+    return 0;
+  }
+}
+
+/**
+ * \brief Returns a string property of the device, such as the ProductKey.
+ *
+ * \param[in] dev Device to extract the property from.
+ * \param[in] key Property key.
+ * \return A string object with the property in it. The string may be empty if there
+ *  was an error (or the device doesn't have the property).
+ */
+std::string HIDHotplug::GetStringProperty( IOHIDDeviceRef dev, CFStringRef key )
+{
+  std::string devStr;
+  CFTypeRef ref = IOHIDDeviceGetProperty( dev, key );
+  if( ref != NULL && CFGetTypeID( ref ) == CFStringGetTypeID() )
+  {
+    char buffer[256];
+    if( CFStringGetCString( (CFStringRef)ref, buffer, sizeof(buffer), kCFStringEncodingUTF8 ) )
+    {
+      devStr.append( buffer );
+    }
+  }
+  return devStr;
+}
+
+/**
+ * \brief Returns an integer property of the device, such as the VendorID.
+ *
+ * \return The property, or 0 if there was an error.
+ */
+int32_t HIDHotplug::GetIntProperty( IOHIDDeviceRef dev, CFStringRef key )
+{
+  int32_t value = 0;
+  CFTypeRef ref = IOHIDDeviceGetProperty( dev, key );
+  if( ref != NULL && CFGetTypeID( ref ) == CFNumberGetTypeID() )
+  {
+    CFNumberGetValue( (CFNumberRef)ref, kCFNumberSInt32Type, &value );
+  }
+  return value;
+}
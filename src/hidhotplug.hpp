@@ -0,0 +1,144 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __HIDHOTPLUG_H__
+#define __HIDHOTPLUG_H__
+
+#include <string>
+#include <pthread.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/hid/IOHIDManager.h>
+#include <IOKit/hid/IOHIDDevice.h>
+#include "joyregistry.hpp"
+
+/**
+ * \brief Keeps a JoyRegistry up to date with the attached joysticks.
+ *
+ * Owns an IO HID manager scheduled on a dedicated thread, whose device matching and
+ * removal callbacks add and remove registry entries. The registry handles are the
+ * io_service_t of each device, from which a Joystick creates its own IOHIDDeviceRef.
+ */
+class HIDHotplug
+{
+  public:
+    /**
+     * \brief HIDHotplug constructor.
+     *
+     * \param[in] registry Registry to keep up to date.
+     */
+    HIDHotplug( JoyRegistry *registry );
+    
+    /**
+     * \brief HIDHotplug destructor. Stops the hotplug thread.
+     */
+    ~HIDHotplug();
+    
+    /**
+     * \brief Start the hotplug thread, and wait until the devices that are already
+     *  attached have been added to the registry. Does nothing if already started.
+     *
+     * \output true if successful, false if unsuccessful.
+     */
+    bool Start( void );
+    
+    /**
+     * \brief Stop the hotplug thread.
+     */
+    void Stop( void );
+    
+    /**
+     * \brief Returns the LocationKey of the input device.
+     *
+     * \param[in] dev Device to extract the LocationKey from.
+     * \return LocationKey, or 0 if there was an error.
+     */
+    static int32_t GetLocationKey( IOHIDDeviceRef dev );
+    
+    /**
+     * \brief Returns a string property of the device, such as the ProductKey.
+     *
+     * \param[in] dev Device to extract the property from.
+     * \param[in] key Property key.
+     * \return A string object with the property in it. The string may be empty if there
+     *  was an error (or the device doesn't have the property).
+     */
+    static std::string GetStringProperty( IOHIDDeviceRef dev, CFStringRef key );
+    
+    /**
+     * \brief Returns an integer property of the device, such as the VendorID.
+     *
+     * \return The property, or 0 if there was an error.
+     */
+    static int32_t GetIntProperty( IOHIDDeviceRef dev, CFStringRef key );
+    
+  private:
+    JoyRegistry *myRegistry;
+    IOHIDManagerRef myManager;
+    pthread_t myThread;
+    pthread_mutex_t myMutex;
+    pthread_cond_t myCond;
+    CFRunLoopRef myRunLoop;
+    bool myStarted, myReady;
+    volatile bool myRunning;
+    
+    /**
+     * \brief Create and open the IO HID manager, matching joysticks, gamepads and multi
+     *  axis controllers.
+     *
+     * \output true if successful, false if unsuccessful.
+     */
+    bool CreateManager( void );
+    
+    /**
+     * \brief Hotplug thread. Services the manager's callbacks until Stop is called.
+     */
+    static void *HotplugThread( void *context );
+    
+    /**
+     * \brief Device matching callback. Adds the device to the registry.
+     */
+    static void MatchingCallback( void *context, IOReturn result, void *sender,
+                                                                  IOHIDDeviceRef device );
+    
+    /**
+     * \brief Device removal callback. Removes the device from the registry.
+     */
+    static void RemovalCallback( void *context, IOReturn result, void *sender,
+                                                                  IOHIDDeviceRef device );
+    
+    // Non-copyable
+    HIDHotplug( const HIDHotplug & );
+    HIDHotplug &operator=( const HIDHotplug & );
+};
+
+/**
+ * \brief The process wide registry of attached joysticks. The hotplug thread is started
+ *  on first use.
+ */
+JoyRegistry &SharedJoyRegistry( void );
+
+#endif
@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "hidoutput.hpp"
+
+// Report of the outputs an HIDOutputPlan doesn't carry
+#define NO_REPORT ((size_t)-1)
+
+/**
+ * \brief HIDOutputSink destructor.
+ */
+HIDOutputSink::~HIDOutputSink()
+{
+}
+
+/**
+ * \brief HIDOutputPlan constructor. The plan is empty until Compile is called.
+ */
+HIDOutputPlan::HIDOutputPlan()
+{
+  Clear();
+}
+
+/**
+ * \brief HIDOutputPlan destructor.
+ */
+HIDOutputPlan::~HIDOutputPlan()
+{
+}
+
+/**
+ * \brief Remove all fields from the plan.
+ */
+void HIDOutputPlan::Clear( void )
+{
+  mySlots.clear();
+  myReports.clear();
+}
+
+/**
+ * \brief Add an output field to the plan.
+ *
+ * \param[in] field Field from ParseHIDDescriptor.
+ * \param[in] index Index of the output the field carries.
+ */
+void HIDOutputPlan::Add( const HIDField &field, size_t index )
+{
+  if( field.direction != kHIDField_Output || field.bitSize == 0 || field.bitSize > 32 ) return;
+  if( index >= mySlots.size() )
+  {
+    Slot none = { 0, 0, NO_REPORT, 0, false };
+    mySlots.resize( index+1, none );
+  }
+  Slot &slot = mySlots[ index ];
+  slot.bitOffset = field.bitOffset;
+  slot.bitSize = field.bitSize;
+  slot.report = field.reportID;
+  slot.value = 0;
+  slot.staged = false;
+}
+
+/**
+ * \brief Build the staging report of each report ID. Must be called after the last
+ *  Add, and before Stage.
+ *
+ * \param[in] usesReportIDs Whether reports are prefixed with a report ID byte.
+ * \param[in] reportBytes Length of each output report, indexed by report ID (from
+ *  ParseHIDDescriptor).
+ */
+void HIDOutputPlan::Compile( bool usesReportIDs, const std::vector<uint32_t> &reportBytes )
+{
+  myReports.clear();
+  size_t reportOf[ 256 ];
+  for( size_t ii=0; ii<256; ii++ ) reportOf[ ii ] = NO_REPORT;
+  
+  for( size_t ii=0; ii<mySlots.size(); ii++ )
+  {
+    Slot &slot = mySlots[ ii ];
+    if( slot.report == NO_REPORT ) continue;
+    size_t id = slot.report;
+    size_t needed = ( slot.bitOffset + slot.bitSize + 7 )/8;
+    if( reportOf[ id ] == NO_REPORT )
+    {
+      Report report;
+      report.reportID = (uint8_t)id;
+      report.dirty = false;
+      size_t len = id < reportBytes.size() ? reportBytes[ id ] : 0;
+      report.bytes.assign( len, 0 );
+      if( usesReportIDs && !report.bytes.empty() ) report.bytes[ 0 ] = (uint8_t)id;
+      reportOf[ id ] = myReports.size();
+      myReports.push_back( report );
+    }
+    
+    // A field beyond the end of its report means the lengths don't match the fields
+    slot.report = reportOf[ id ];
+    if( needed > myReports[ slot.report ].bytes.size() ) slot.report = NO_REPORT;
+  }
+}
+
+/**
+ * \brief Whether the plan contains any fields.
+ */
+bool HIDOutputPlan::Empty( void ) const
+{
+  for( size_t ii=0; ii<mySlots.size(); ii++ )
+  {
+    if( mySlots[ ii ].report != NO_REPORT ) return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Whether an output is carried by the plan.
+ */
+bool HIDOutputPlan::Covers( size_t index ) const
+{
+  return index < mySlots.size() && mySlots[ index ].report != NO_REPORT;
+}
+
+/**
+ * \brief Stage a new value of an output. Its report is marked to be sent if the value
+ *  differs from the one last staged (or if it is the first). Does not allocate.
+ *
+ * \param[in] index Index of the output (must be covered by the plan).
+ * \param[in] value Logical value of the output.
+ */
+void HIDOutputPlan::Stage( size_t index, int32_t value )
+{
+  Slot &slot = mySlots[ index ];
+  if( slot.staged && slot.value == value ) return;
+  slot.value = value;
+  slot.staged = true;
+  Report &report = myReports[ slot.report ];
+  InsertHIDField( &report.bytes.front(), report.bytes.size(), slot.bitOffset, slot.bitSize, value );
+  report.dirty = true;
+}
+
+/**
+ * \brief Send every report with a changed value. Does not allocate.
+ *
+ * \param[in] sink Where to send the reports.
+ * \return Number of reports sent.
+ * \exception const char* exception thrown by the sink.
+ */
+size_t HIDOutputPlan::Flush( HIDOutputSink &sink )
+{
+  size_t sent = 0;
+  for( size_t ii=0; ii<myReports.size(); ii++ )
+  {
+    Report &report = myReports[ ii ];
+    if( !report.dirty ) continue;
+    if( !sink.SendReport( report.reportID, &report.bytes.front(), report.bytes.size() ) ) continue;
+    report.dirty = false;
+    sent++;
+  }
+  return sent;
+}
+
+/**
+ * \brief Number of reports with changes that have not yet been sent.
+ */
+size_t HIDOutputPlan::Pending( void ) const
+{
+  size_t pending = 0;
+  for( size_t ii=0; ii<myReports.size(); ii++ )
+  {
+    if( myReports[ ii ].dirty ) pending++;
+  }
+  return pending;
+}
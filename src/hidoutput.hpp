@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __HIDOUTPUT_H__
+#define __HIDOUTPUT_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include "hidreport.hpp"
+
+/**
+ * \brief Destination of the output reports built by an HIDOutputPlan, such as a device
+ *  or (for off-target checks) a recorder.
+ */
+class HIDOutputSink
+{
+  public:
+    /**
+     * \brief HIDOutputSink destructor.
+     */
+    virtual ~HIDOutputSink();
+    
+    /**
+     * \brief Send a whole output report.
+     *
+     * \param[in] reportID Report ID (0 if the device doesn't use report IDs).
+     * \param[in] report Report bytes, including the report ID byte if used. Only valid
+     *  for the duration of the call.
+     * \param[in] len Length of the report.
+     * \return true if the report was sent (or queued to be sent), false if the sink is
+     *  still busy with an earlier report with that ID and this one should be offered
+     *  again later.
+     * \exception const char* exception thrown if the report cannot be sent.
+     */
+    virtual bool SendReport( uint8_t reportID, const uint8_t *report, size_t len ) = 0;
+};
+
+/**
+ * \brief A compiled plan for packing output values into the output reports of a device.
+ *
+ * Each output is bit packed into a staging copy of its report as it is staged, and a
+ * report is only sent by Flush if one of its values changed since it was last sent.
+ * Every output in a report therefore costs one send per changed step between them,
+ * rather than one per output per step. A report the sink is busy with stays staged, so
+ * the newest values go out with the next Flush.
+ */
+class HIDOutputPlan
+{
+  public:
+    /**
+     * \brief HIDOutputPlan constructor. The plan is empty until Compile is called.
+     */
+    HIDOutputPlan();
+    
+    /**
+     * \brief HIDOutputPlan destructor.
+     */
+    ~HIDOutputPlan();
+    
+    /**
+     * \brief Remove all fields from the plan.
+     */
+    void Clear( void );
+    
+    /**
+     * \brief Add an output field to the plan.
+     *
+     * \param[in] field Field from ParseHIDDescriptor.
+     * \param[in] index Index of the output the field carries.
+     */
+    void Add( const HIDField &field, size_t index );
+    
+    /**
+     * \brief Build the staging report of each report ID. Must be called after the last
+     *  Add, and before Stage.
+     *
+     * \param[in] usesReportIDs Whether reports are prefixed with a report ID byte.
+     * \param[in] reportBytes Length of each output report, indexed by report ID (from
+     *  ParseHIDDescriptor).
+     */
+    void Compile( bool usesReportIDs, const std::vector<uint32_t> &reportBytes );
+    
+    /**
+     * \brief Whether the plan contains any fields.
+     */
+    bool Empty( void ) const;
+    
+    /**
+     * \brief Whether an output is carried by the plan.
+     */
+    bool Covers( size_t index ) const;
+    
+    /**
+     * \brief Stage a new value of an output. Its report is marked to be sent if the value
+     *  differs from the one last staged (or if it is the first). Does not allocate.
+     *
+     * \param[in] index Index of the output (must be covered by the plan).
+     * \param[in] value Logical value of the output.
+     */
+    void Stage( size_t index, int32_t value );
+    
+    /**
+     * \brief Send every report with a changed value. Does not allocate.
+     *
+     * \param[in] sink Where to send the reports.
+     * \return Number of reports sent.
+     * \exception const char* exception thrown by the sink.
+     */
+    size_t Flush( HIDOutputSink &sink );
+    
+    /**
+     * \brief Number of reports with changes that have not yet been sent.
+     */
+    size_t Pending( void ) const;
+    
+  private:
+    struct Slot
+    {
+      uint32_t bitOffset;
+      uint32_t bitSize;
+      size_t report;
+      int32_t value;
+      bool staged;
+    };
+    struct Report
+    {
+      uint8_t reportID;
+      bool dirty;
+      std::vector<uint8_t> bytes;
+    };
+    // Indexed by output; report is the index into myReports (or the report ID until
+    // Compile), and NO_REPORT for outputs the plan doesn't carry
+    std::vector<Slot> mySlots;
+    std::vector<Report> myReports;
+};
+
+#endif
@@ -0,0 +1,349 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "hidraw.hpp"
+#include "joytime.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/hidraw.h>
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+#define HID_USAGE_GD_X 0x30
+
+static bool NodeCompare( const HidrawNode &i, const HidrawNode &j )
+{
+  return i.locationKey < j.locationKey;
+}
+
+/**
+ * \brief Read the name, IDs and report descriptor of a hidraw device.
+ *
+ * \param[in] fd Open file descriptor of the device.
+ * \param[out] node Description of the device (the path is left alone).
+ * \return true if successful, false if fd is not a hidraw device.
+ */
+bool HidrawReadNode( int fd, HidrawNode &node )
+{
+  int descSize = 0;
+  if( ioctl( fd, HIDIOCGRDESCSIZE, &descSize ) < 0 || descSize <= 0 ) return false;
+  struct hidraw_report_descriptor desc;
+  memset( &desc, 0, sizeof(desc) );
+  desc.size = (uint32_t)std::min( descSize, (int)HID_MAX_DESCRIPTOR_SIZE );
+  if( ioctl( fd, HIDIOCGRDESC, &desc ) < 0 ) return false;
+  node.descriptor.assign( desc.value, desc.value + desc.size );
+  
+  char text[ 256 ];
+  node.name.clear();
+  node.phys.clear();
+  memset( text, 0, sizeof(text) );
+  if( ioctl( fd, HIDIOCGRAWNAME( sizeof(text) - 1 ), text ) >= 0 ) node.name = text;
+  memset( text, 0, sizeof(text) );
+  if( ioctl( fd, HIDIOCGRAWPHYS( sizeof(text) - 1 ), text ) >= 0 ) node.phys = text;
+  struct hidraw_devinfo info;
+  memset( &info, 0, sizeof(info) );
+  ioctl( fd, HIDIOCGRAWINFO, &info );
+  node.vendorID = (uint16_t)info.vendor;
+  node.productID = (uint16_t)info.product;
+  return true;
+}
+
+/**
+ * \brief Whether parsed report fields look like a joystick or gamepad: an X axis or a
+ *  hat switch, and a button.
+ */
+bool HidrawIsJoystick( const std::vector<HIDField> &fields )
+{
+  bool hasAxis = false, hasButton = false;
+  for( size_t ii=0; ii<fields.size(); ii++ )
+  {
+    const HIDField &field = fields[ ii ];
+    if( field.direction != kHIDField_Input ) continue;
+    if( field.usagePage == HID_PAGE_GENERIC_DESKTOP &&
+        ( field.usage == HID_USAGE_GD_X || field.usage == HID_USAGE_GD_HATSWITCH ) ) hasAxis = true;
+    if( field.usagePage == HID_PAGE_BUTTON ) hasButton = true;
+  }
+  return hasAxis && hasButton;
+}
+
+/**
+ * \brief List the joysticks among the hidraw devices in a directory.
+ *
+ * \param[in] dir Directory of hidraw devices (normally /dev).
+ * \return Joysticks found, sorted by location key (see EvdevLocationKey).
+ */
+std::vector<HidrawNode> HidrawScan( const char *dir )
+{
+  std::vector<HidrawNode> nodes;
+  DIR *d = opendir( dir );
+  if( d == NULL ) return nodes;
+  struct dirent *entry;
+  while( ( entry = readdir( d ) ) != NULL )
+  {
+    if( strncmp( entry->d_name, "hidraw", 6 ) != 0 ) continue;
+    HidrawNode node;
+    node.path = std::string( dir ) + "/" + entry->d_name;
+    int fd = open( node.path.c_str(), O_RDONLY | O_NONBLOCK );
+    if( fd < 0 ) continue;
+    std::vector<HIDField> fields;
+    if( HidrawReadNode( fd, node ) &&
+        ParseHIDDescriptor( &node.descriptor.front(), node.descriptor.size(), fields ) &&
+        HidrawIsJoystick( fields ) )
+    {
+      node.locationKey = EvdevLocationKey( node.phys.empty() ? node.path : node.phys );
+      nodes.push_back( node );
+    }
+    close( fd );
+  }
+  closedir( d );
+  std::sort( nodes.begin(), nodes.end(), NodeCompare );
+  return nodes;
+}
+
+/**
+ * \brief HidrawDevice constructor.
+ *
+ * \param[in] fd File descriptor to read reports from. It is made non-blocking.
+ * \param[in] descriptor Report descriptor bytes.
+ * \param[in] len Length of the descriptor.
+ * \param[in] ownsFd Whether the destructor should close fd.
+ */
+HidrawDevice::HidrawDevice( int fd, const uint8_t *descriptor, size_t len, bool ownsFd )
+{
+  myFd = fd;
+  myOwnsFd = ownsFd;
+  myClosed = false;
+  fcntl( myFd, F_SETFL, fcntl( myFd, F_GETFL ) | O_NONBLOCK );
+  struct stat info;
+  myFramed = fstat( myFd, &info ) == 0 && S_ISCHR( info.st_mode );
+  for( size_t ii=0; ii<kJoystick_Outputs; ii++ ) myCounts[ ii ] = 0;
+  
+  std::vector<HIDField> fields;
+  myValid = ParseHIDDescriptor( descriptor, len, fields, &myReportBytes );
+  myUsesReportIDs = HIDUsesReportIDs( fields );
+  for( size_t ii=0; ii<fields.size() && myValid; ii++ )
+  {
+    const HIDField &field = fields[ ii ];
+    if( field.direction != kHIDField_Input ) continue;
+    JoystickIOIndex type = ClassifyHIDField( field );
+    if( type == kJoystick_Axes )
+    {
+      myAxes.Add( field.logicalMin, field.logicalMax, ( field.flags & kHIDFlag_Relative ) != 0 );
+    }
+    else if( type == kJoystick_POVs )
+    {
+      myPOVMin.push_back( field.logicalMin );
+      myPOVMax.push_back( field.logicalMax );
+    }
+    myPlan.Add( field, type, myCounts[ type ]++ );
+  }
+  myValid = myValid && !myPlan.Empty();
+  if( myValid ) myPlan.Compile( myUsesReportIDs );
+  
+  // Relative axes are summed as they arrive, and hats read as centred until the first
+  // report
+  mySnapshot.Resize( myCounts[ kJoystick_Axes ], myCounts[ kJoystick_Buttons ],
+                     myCounts[ kJoystick_POVs ] );
+  const std::vector<size_t> &relative = myAxes.Relative();
+  for( size_t ii=0; ii<relative.size(); ii++ ) mySnapshot.SetRelative( relative[ ii ], true );
+  uint64_t time = JoyNowTicks();
+  mySnapshot.BeginWrite();
+  for( size_t ii=0; ii<myPOVMax.size(); ii++ )
+  {
+    mySnapshot.Store( kJoystick_POVs, ii, myPOVMax[ ii ] + 1, time );
+  }
+  mySnapshot.EndWrite();
+}
+
+/**
+ * \brief HidrawDevice destructor. The device must have been removed from any loop.
+ */
+HidrawDevice::~HidrawDevice()
+{
+  if( myOwnsFd ) close( myFd );
+}
+
+/**
+ * \brief Whether the descriptor was well formed and has input fields.
+ */
+bool HidrawDevice::Valid( void ) const
+{
+  return myValid;
+}
+
+/**
+ * \brief Decode one input report into the snapshot.
+ *
+ * \return Number of fields written.
+ */
+size_t HidrawDevice::Decode( const uint8_t *report, size_t len, uint64_t time )
+{
+  return myPlan.Decode( report, len, &mySnapshot, time );
+}
+
+/**
+ * \brief File descriptor the reports are read from.
+ */
+int HidrawDevice::Fd( void ) const
+{
+  return myFd;
+}
+
+/**
+ * \brief Number of elements of the given type (kJoystick_Outputs is always 0).
+ */
+size_t HidrawDevice::Count( JoystickIOIndex type ) const
+{
+  return type < kJoystick_Outputs ? myCounts[ type ] : 0;
+}
+
+/**
+ * \brief Snapshot of the element values, written by the loop thread.
+ */
+JoySnapshot &HidrawDevice::Snapshot( void )
+{
+  return mySnapshot;
+}
+
+/**
+ * \brief Normalisation table of the axes, in axis order.
+ */
+AxisTable &HidrawDevice::Axes( void )
+{
+  return myAxes;
+}
+
+/**
+ * \brief Whether the stream has ended or failed (such as the device being unplugged).
+ */
+bool HidrawDevice::Closed( void ) const
+{
+  return myClosed;
+}
+
+/**
+ * \brief Read and decode every report waiting on the file descriptor, one read each.
+ *
+ * \param[in] buffer Scratch buffer, at least as long as the longest report.
+ * \param[in] size Size of buffer in bytes.
+ * \param[out] reads Incremented for every read call made.
+ * \return Number of reports decoded.
+ */
+size_t HidrawDevice::Drain( uint8_t *buffer, size_t size, uint64_t *reads )
+{
+  if( !myFramed ) return DrainStream( buffer, size, reads );
+  size_t decoded = 0;
+  while( !myClosed )
+  {
+    ssize_t got = read( myFd, buffer, size );
+    (*reads)++;
+    if( got < 0 )
+    {
+      if( errno == EINTR ) continue;
+      if( errno != EAGAIN && errno != EWOULDBLOCK ) myClosed = true;
+      break;
+    }
+    if( got == 0 )
+    {
+      myClosed = true;
+      break;
+    }
+    if( myValid ) Decode( buffer, (size_t)got, JoyNowTicks() );
+    decoded++;
+  }
+  return decoded;
+}
+
+/**
+ * \brief Drain a capture, splitting it into reports.
+ */
+size_t HidrawDevice::DrainStream( uint8_t *buffer, size_t size, uint64_t *reads )
+{
+  size_t decoded = 0;
+  while( !myClosed )
+  {
+    size_t carry = myCarry.size() < size ? myCarry.size() : 0;
+    if( carry > 0 ) memcpy( buffer, &myCarry.front(), carry );
+    myCarry.clear();
+    ssize_t got = read( myFd, buffer + carry, size - carry );
+    (*reads)++;
+    if( got < 0 )
+    {
+      if( errno == EINTR ) continue;
+      if( errno != EAGAIN && errno != EWOULDBLOCK ) myClosed = true;
+      break;
+    }
+    if( got == 0 )
+    {
+      myClosed = true;
+      break;
+    }
+    
+    // Reports are the length given by the descriptor for their ID. A byte that isn't a
+    // known report ID is skipped, so a damaged capture resynchronises.
+    size_t bytes = carry + (size_t)got, pos = 0;
+    uint64_t time = JoyNowTicks();
+    while( pos < bytes && myValid )
+    {
+      size_t need = myReportBytes[ myUsesReportIDs ? buffer[ pos ] : 0 ];
+      if( need == 0 )
+      {
+        pos++;
+        continue;
+      }
+      if( bytes - pos < need ) break;
+      Decode( buffer + pos, need, time );
+      decoded++;
+      pos += need;
+    }
+    if( myValid ) myCarry.assign( buffer + pos, buffer + bytes );
+    if( bytes < size ) break;
+  }
+  return decoded;
+}
+
+/**
+ * \brief Convert the raw value of a hat switch into an angle in degrees, or -1 if it is
+ *  in its null state (outside the logical range).
+ */
+double HidrawDevice::DecodePOV( size_t index, int32_t raw ) const
+{
+  int32_t min = myPOVMin[ index ], max = myPOVMax[ index ];
+  if( raw < min || raw > max ) return -1.0;
+  return 360.0*(double)( raw - min )/(double)( max - min + 1 );
+}
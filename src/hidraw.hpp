@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __HIDRAW_H__
+#define __HIDRAW_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "evdev.hpp"
+#include "hidreport.hpp"
+
+/**
+ * \brief A joystick found by HidrawScan.
+ */
+struct HidrawNode
+{
+  std::string path;
+  int32_t locationKey;
+  std::string name;
+  std::string phys;
+  int32_t vendorID;
+  int32_t productID;
+  std::vector<uint8_t> descriptor;
+};
+
+/**
+ * \brief Read the name, IDs and report descriptor of a hidraw device.
+ *
+ * \param[in] fd Open file descriptor of the device.
+ * \param[out] node Description of the device (the path is left alone).
+ * \return true if successful, false if fd is not a hidraw device.
+ */
+bool HidrawReadNode( int fd, HidrawNode &node );
+
+/**
+ * \brief Whether parsed report fields look like a joystick or gamepad: an X axis or a
+ *  hat switch, and a button.
+ */
+bool HidrawIsJoystick( const std::vector<HIDField> &fields );
+
+/**
+ * \brief List the joysticks among the hidraw devices in a directory.
+ *
+ * \param[in] dir Directory of hidraw devices (normally /dev).
+ * \return Joysticks found, sorted by location key (see EvdevLocationKey).
+ */
+std::vector<HidrawNode> HidrawScan( const char *dir = "/dev" );
+
+/**
+ * \brief A hidraw device (or a capture of its raw input reports) decoded with a plan
+ *  compiled from its report descriptor.
+ *
+ * This sees everything the device reports, including the vendor axes, extra hats and
+ * multi-count fields that evdev drops. Fields are classified as IOKit classifies
+ * elements (see ClassifyHIDField). A hidraw device delivers one whole report per read; a
+ * capture played through a pipe or file is split into reports using the report lengths
+ * from the descriptor.
+ */
+class HidrawDevice : public EvdevSource
+{
+  public:
+    /**
+     * \brief HidrawDevice constructor.
+     *
+     * \param[in] fd File descriptor to read reports from. It is made non-blocking.
+     * \param[in] descriptor Report descriptor bytes.
+     * \param[in] len Length of the descriptor.
+     * \param[in] ownsFd Whether the destructor should close fd.
+     */
+    HidrawDevice( int fd, const uint8_t *descriptor, size_t len, bool ownsFd );
+    
+    /**
+     * \brief HidrawDevice destructor. The device must have been removed from any loop.
+     */
+    ~HidrawDevice();
+    
+    /**
+     * \brief Whether the descriptor was well formed and has input fields.
+     */
+    bool Valid( void ) const;
+    
+    /**
+     * \brief Decode one input report into the snapshot.
+     *
+     * \return Number of fields written.
+     */
+    size_t Decode( const uint8_t *report, size_t len, uint64_t time );
+    
+    // EvdevSource
+    int Fd( void ) const;
+    size_t Count( JoystickIOIndex type ) const;
+    JoySnapshot &Snapshot( void );
+    AxisTable &Axes( void );
+    bool Closed( void ) const;
+    size_t Drain( uint8_t *buffer, size_t size, uint64_t *reads );
+    double DecodePOV( size_t index, int32_t raw ) const;
+    
+  private:
+    int myFd;
+    bool myOwnsFd;
+    volatile bool myClosed;
+    bool myValid;
+    // Whether each read returns exactly one report (a hidraw device, not a pipe)
+    bool myFramed;
+    bool myUsesReportIDs;
+    HIDReportPlan myPlan;
+    // Length of the input report with each ID
+    std::vector<uint32_t> myReportBytes;
+    JoySnapshot mySnapshot;
+    AxisTable myAxes;
+    size_t myCounts[ kJoystick_Outputs ];
+    std::vector<int32_t> myPOVMin, myPOVMax;
+    // Bytes of a partial report left over by the last read of a capture
+    std::vector<uint8_t> myCarry;
+    
+    /**
+     * \brief Drain a capture, splitting it into reports.
+     */
+    size_t DrainStream( uint8_t *buffer, size_t size, uint64_t *reads );
+    
+    // Non-copyable
+    HidrawDevice( const HidrawDevice & );
+    HidrawDevice &operator=( const HidrawDevice & );
+};
+
+#endif
@@ -0,0 +1,479 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "hidreport.hpp"
+#include <algorithm>
+
+// Item types (HID 1.11, section 6.2.2.2)
+#define ITEM_MAIN 0
+#define ITEM_GLOBAL 1
+#define ITEM_LOCAL 2
+#define ITEM_LONG 0xFE
+
+// Main item tags
+#define MAIN_INPUT 0x8
+#define MAIN_OUTPUT 0x9
+#define MAIN_COLLECTION 0xA
+#define MAIN_FEATURE 0xB
+#define MAIN_END_COLLECTION 0xC
+
+// Global item tags
+#define GLOBAL_USAGE_PAGE 0x0
+#define GLOBAL_LOGICAL_MIN 0x1
+#define GLOBAL_LOGICAL_MAX 0x2
+#define GLOBAL_REPORT_SIZE 0x7
+#define GLOBAL_REPORT_ID 0x8
+#define GLOBAL_REPORT_COUNT 0x9
+#define GLOBAL_PUSH 0xA
+#define GLOBAL_POP 0xB
+
+// Local item tags
+#define LOCAL_USAGE 0x0
+#define LOCAL_USAGE_MIN 0x1
+#define LOCAL_USAGE_MAX 0x2
+
+// Sanity limits, to stop a corrupt descriptor from allocating huge amounts of memory
+#define MAX_REPORT_COUNT 4096
+#define MAX_USAGE_RANGE 4096
+
+/**
+ * \brief Parser state that is saved and restored by Push and Pop items.
+ */
+struct HIDGlobals
+{
+  uint16_t usagePage;
+  int32_t logicalMin;
+  int32_t logicalMax;
+  uint32_t logicalMaxRaw;
+  uint32_t reportSize;
+  uint32_t reportCount;
+  uint8_t reportID;
+};
+
+/**
+ * \brief Parse a HID report descriptor into its variable (non-constant, non-array)
+ *  fields.
+ *
+ * \param[in] desc Report descriptor bytes.
+ * \param[in] len Length of the descriptor.
+ * \param[out] fields Parsed fields, in descriptor order.
+ * \param[out] inputReportBytes If not NULL, receives the length in bytes of the input
+ *  report with each ID (indexed by report ID, 0 if there is no such report), including
+ *  the report ID byte and any padding.
+ * \param[out] outputReportBytes If not NULL, receives the length in bytes of each output
+ *  report, in the same way as inputReportBytes.
+ * \return true if the descriptor was well formed, false otherwise. On failure, fields
+ *  holds whatever was parsed before the error.
+ */
+bool ParseHIDDescriptor( const uint8_t *desc, size_t len, std::vector<HIDField> &fields,
+                         std::vector<uint32_t> *inputReportBytes,
+                         std::vector<uint32_t> *outputReportBytes )
+{
+  fields.clear();
+  
+  HIDGlobals globals = { 0, 0, 0, 0, 0, 0, 0 };
+  std::vector<HIDGlobals> globalStack;
+  std::vector<uint32_t> usages;
+  uint32_t usageMin = 0, usageMax = 0;
+  bool hasUsageMin = false, hasUsageMax = false;
+  // Running bit offset for each direction and report ID
+  std::vector<uint32_t> offsets( 3*256, 0 );
+  
+  size_t pos = 0;
+  while( pos < len )
+  {
+    uint8_t prefix = desc[ pos ];
+    
+    // Long items are reserved and carry nothing we need; skip them.
+    if( prefix == ITEM_LONG )
+    {
+      if( pos+1 >= len ) return false;
+      pos += 3 + desc[ pos+1 ];
+      continue;
+    }
+    
+    size_t size = prefix & 0x3;
+    if( size == 3 ) size = 4;
+    uint8_t type = (uint8_t)( ( prefix >> 2 ) & 0x3 );
+    uint8_t tag = (uint8_t)( prefix >> 4 );
+    if( pos+1+size > len ) return false;
+    
+    // Item data, both unsigned and sign extended
+    uint32_t data = 0;
+    for( size_t ii=0; ii<size; ii++ ) data |= (uint32_t)desc[ pos+1+ii ] << ( 8*ii );
+    int32_t sdata = (int32_t)data;
+    if( size == 1 ) sdata = (int8_t)data;
+    else if( size == 2 ) sdata = (int16_t)data;
+    pos += 1 + size;
+    
+    if( type == ITEM_MAIN )
+    {
+      if( tag == MAIN_INPUT || tag == MAIN_OUTPUT || tag == MAIN_FEATURE )
+      {
+        HIDFieldDirection direction = kHIDField_Input;
+        if( tag == MAIN_OUTPUT ) direction = kHIDField_Output;
+        else if( tag == MAIN_FEATURE ) direction = kHIDField_Feature;
+        uint32_t &offset = offsets[ 256*direction + globals.reportID ];
+        
+        if( globals.reportCount > MAX_REPORT_COUNT || globals.reportSize > 32 ) return false;
+        
+        // Constant (padding) and array items only take up space.
+        if( ( data & kHIDFlag_Constant ) || !( data & kHIDFlag_Variable ) )
+        {
+          offset += globals.reportSize*globals.reportCount;
+        }
+        else
+        {
+          // Usages are taken from the list first, then from the range. The last usage
+          // is repeated if there are more fields than usages.
+          if( hasUsageMin && hasUsageMax && usageMax >= usageMin &&
+                                                  usageMax - usageMin < MAX_USAGE_RANGE )
+          {
+            for( uint32_t uu=usageMin; uu<=usageMax && usages.size()<globals.reportCount; uu++ )
+            {
+              usages.push_back( uu );
+            }
+          }
+          
+          // A logical maximum is only signed if the logical minimum is negative.
+          int32_t logicalMax = globals.logicalMax;
+          if( globals.logicalMin >= 0 ) logicalMax = (int32_t)globals.logicalMaxRaw;
+          
+          for( uint32_t ii=0; ii<globals.reportCount; ii++ )
+          {
+            uint32_t usage = 0;
+            if( !usages.empty() ) usage = usages[ std::min( (size_t)ii, usages.size()-1 ) ];
+            HIDField field;
+            field.direction = direction;
+            field.reportID = globals.reportID;
+            field.bitOffset = offset + ( globals.reportID != 0 ? 8 : 0 );
+            field.bitSize = globals.reportSize;
+            // Extended (32 bit) usages carry their own page
+            field.usagePage = ( usage > 0xFFFF ) ? (uint16_t)( usage >> 16 ) : globals.usagePage;
+            field.usage = (uint16_t)( usage & 0xFFFF );
+            field.logicalMin = globals.logicalMin;
+            field.logicalMax = logicalMax;
+            field.flags = data;
+            if( field.bitSize > 0 ) fields.push_back( field );
+            offset += globals.reportSize;
+          }
+        }
+      }
+      // Every main item (including collections) clears the local state.
+      usages.clear();
+      hasUsageMin = hasUsageMax = false;
+    }
+    else if( type == ITEM_GLOBAL )
+    {
+      switch( tag )
+      {
+        case GLOBAL_USAGE_PAGE: globals.usagePage = (uint16_t)data; break;
+        case GLOBAL_LOGICAL_MIN: globals.logicalMin = sdata; break;
+        case GLOBAL_LOGICAL_MAX:
+          globals.logicalMax = sdata;
+          globals.logicalMaxRaw = data;
+          break;
+        case GLOBAL_REPORT_SIZE: globals.reportSize = data; break;
+        case GLOBAL_REPORT_ID:
+          if( data == 0 || data > 255 ) return false;
+          globals.reportID = (uint8_t)data;
+          break;
+        case GLOBAL_REPORT_COUNT: globals.reportCount = data; break;
+        case GLOBAL_PUSH: globalStack.push_back( globals ); break;
+        case GLOBAL_POP:
+          if( globalStack.empty() ) return false;
+          globals = globalStack.back();
+          globalStack.pop_back();
+          break;
+        default: break;
+      }
+    }
+    else if( type == ITEM_LOCAL )
+    {
+      // Usages given with 4 bytes include the usage page in the upper 16 bits.
+      uint32_t usage = data;
+      switch( tag )
+      {
+        case LOCAL_USAGE: usages.push_back( usage ); break;
+        case LOCAL_USAGE_MIN: usageMin = usage; hasUsageMin = true; break;
+        case LOCAL_USAGE_MAX: usageMax = usage; hasUsageMax = true; break;
+        default: break;
+      }
+    }
+  }
+  
+  std::vector<uint32_t> *reportBytes[ 2 ] = { inputReportBytes, outputReportBytes };
+  HIDFieldDirection directions[ 2 ] = { kHIDField_Input, kHIDField_Output };
+  for( size_t dd=0; dd<2; dd++ )
+  {
+    if( reportBytes[ dd ] == NULL ) continue;
+    reportBytes[ dd ]->assign( 256, 0 );
+    for( size_t id=0; id<256; id++ )
+    {
+      uint32_t bits = offsets[ 256*directions[ dd ] + id ];
+      if( bits > 0 ) (*reportBytes[ dd ])[ id ] = ( bits + 7 )/8 + ( id != 0 ? 1 : 0 );
+    }
+  }
+  return true;
+}
+
+/**
+ * \brief Whether the parsed descriptor uses report IDs (i.e. every report is prefixed
+ *  with an ID byte).
+ */
+bool HIDUsesReportIDs( const std::vector<HIDField> &fields )
+{
+  for( size_t ii=0; ii<fields.size(); ii++ )
+  {
+    if( fields[ ii ].reportID != 0 ) return true;
+  }
+  return false;
+}
+
+/**
+ * \brief Classify an input field the same way IOKit classifies elements.
+ *
+ * \return kJoystick_Buttons, kJoystick_POVs or kJoystick_Axes.
+ */
+JoystickIOIndex ClassifyHIDField( const HIDField &field )
+{
+  if( field.usagePage == HID_PAGE_BUTTON ) return kJoystick_Buttons;
+  if( field.usagePage == HID_PAGE_GENERIC_DESKTOP && field.usage == HID_USAGE_GD_HATSWITCH )
+  {
+    return kJoystick_POVs;
+  }
+  return kJoystick_Axes;
+}
+
+/**
+ * \brief Extract a single field from a report. Handles any alignment and sizes up to 32
+ *  bits.
+ *
+ * \param[in] report Report bytes.
+ * \param[in] len Length of the report.
+ * \param[in] bitOffset Offset of the field from the start of the report.
+ * \param[in] bitSize Size of the field in bits (1 to 32).
+ * \param[in] isSigned Whether to sign extend the field.
+ * \return Field value, or 0 if the field lies outside the report.
+ */
+int32_t ExtractHIDField( const uint8_t *report, size_t len, uint32_t bitOffset,
+                                                      uint32_t bitSize, bool isSigned )
+{
+  if( bitSize == 0 || bitSize > 32 ) return 0;
+  size_t first = bitOffset/8;
+  size_t last = ( bitOffset + bitSize - 1 )/8;
+  if( last >= len ) return 0;
+  
+  // At most 5 bytes hold a 32 bit field
+  uint64_t bits = 0;
+  for( size_t ii=first; ii<=last; ii++ ) bits |= (uint64_t)report[ ii ] << ( 8*(ii-first) );
+  bits >>= ( bitOffset & 7 );
+  
+  uint32_t value = (uint32_t)bits;
+  if( bitSize < 32 )
+  {
+    value &= ( (uint32_t)1 << bitSize ) - 1;
+    if( isSigned && ( value & ( (uint32_t)1 << ( bitSize-1 ) ) ) )
+    {
+      value |= ~( ( (uint32_t)1 << bitSize ) - 1 );
+    }
+  }
+  return (int32_t)value;
+}
+
+/**
+ * \brief Insert a single field into a report, the inverse of ExtractHIDField. The other
+ *  bits of the report are left unchanged.
+ *
+ * \param[in,out] report Report bytes.
+ * \param[in] len Length of the report.
+ * \param[in] bitOffset Offset of the field from the start of the report.
+ * \param[in] bitSize Size of the field in bits (1 to 32).
+ * \param[in] value Field value, truncated to bitSize bits.
+ * \return false if the field lies outside the report (nothing is written).
+ */
+bool InsertHIDField( uint8_t *report, size_t len, uint32_t bitOffset, uint32_t bitSize,
+                                                                        int32_t value )
+{
+  if( bitSize == 0 || bitSize > 32 ) return false;
+  size_t first = bitOffset/8;
+  size_t last = ( bitOffset + bitSize - 1 )/8;
+  if( last >= len ) return false;
+  
+  uint32_t shift = bitOffset & 7;
+  uint64_t mask = ( ( (uint64_t)1 << bitSize ) - 1 ) << shift;
+  uint64_t bits = ( (uint64_t)(uint32_t)value << shift ) & mask;
+  for( size_t ii=first; ii<=last; ii++ )
+  {
+    uint8_t byteMask = (uint8_t)( mask >> ( 8*(ii-first) ) );
+    report[ ii ] = (uint8_t)( ( report[ ii ] & ~byteMask ) | ( bits >> ( 8*(ii-first) ) ) );
+  }
+  return true;
+}
+
+/**
+ * \brief HIDReportPlan constructor. The plan is empty until Compile is called.
+ */
+HIDReportPlan::HIDReportPlan()
+{
+  Clear();
+}
+
+/**
+ * \brief HIDReportPlan destructor.
+ */
+HIDReportPlan::~HIDReportPlan()
+{
+}
+
+/**
+ * \brief Remove all fields from the plan.
+ */
+void HIDReportPlan::Clear( void )
+{
+  mySteps.clear();
+  for( size_t ii=0; ii<256; ii++ )
+  {
+    myFirst[ ii ] = 0;
+    myEnd[ ii ] = 0;
+  }
+  myUsesReportIDs = false;
+}
+
+/**
+ * \brief Add an input field to the plan.
+ *
+ * \param[in] field Field from ParseHIDDescriptor.
+ * \param[in] type Snapshot type the value is written to.
+ * \param[in] index Index of the element within its type.
+ */
+void HIDReportPlan::Add( const HIDField &field, JoystickIOIndex type, size_t index )
+{
+  if( field.direction != kHIDField_Input || field.bitSize == 0 || field.bitSize > 32 ) return;
+  Step step;
+  step.bitOffset = field.bitOffset;
+  step.byteOffset = field.bitOffset/8;
+  step.lastByte = ( field.bitOffset + field.bitSize - 1 )/8;
+  step.bitSize = field.bitSize;
+  step.reportID = field.reportID;
+  step.isSigned = ( field.logicalMin < 0 );
+  step.type = type;
+  step.index = index;
+  step.kind = kStep_Generic;
+  mySteps.push_back( step );
+}
+
+/**
+ * \brief Group the fields by report ID and pick the extraction path of each. Must be
+ *  called after the last Add, and before Decode.
+ *
+ * \param[in] usesReportIDs Whether reports are prefixed with a report ID byte.
+ */
+void HIDReportPlan::Compile( bool usesReportIDs )
+{
+  myUsesReportIDs = usesReportIDs;
+  std::stable_sort( mySteps.begin(), mySteps.end(), StepLess );
+  
+  for( size_t ii=0; ii<256; ii++ )
+  {
+    myFirst[ ii ] = 0;
+    myEnd[ ii ] = 0;
+  }
+  for( size_t ii=0; ii<mySteps.size(); ii++ )
+  {
+    Step &step = mySteps[ ii ];
+    bool aligned = ( step.bitOffset & 7 ) == 0;
+    if( aligned && step.bitSize == 8 ) step.kind = step.isSigned ? kStep_S8 : kStep_U8;
+    else if( aligned && step.bitSize == 16 ) step.kind = step.isSigned ? kStep_S16 : kStep_U16;
+    else if( step.bitSize == 1 ) step.kind = kStep_Bit;
+    else step.kind = kStep_Generic;
+    
+    if( ii == 0 || mySteps[ ii-1 ].reportID != step.reportID ) myFirst[ step.reportID ] = ii;
+    myEnd[ step.reportID ] = ii+1;
+  }
+}
+
+/**
+ * \brief Whether the plan contains any fields.
+ */
+bool HIDReportPlan::Empty( void ) const
+{
+  return mySteps.empty();
+}
+
+/**
+ * \brief Decode a whole input report into the snapshot (writer only).
+ *
+ * \param[in] report Report bytes, including the report ID byte if used.
+ * \param[in] len Length of the report.
+ * \param[in,out] snapshot Snapshot to write the values into.
+ * \param[in] time Time stamp of the report, recorded against every field written.
+ * \return Number of fields written.
+ */
+size_t HIDReportPlan::Decode( const uint8_t *report, size_t len, JoySnapshot *snapshot,
+                                                                         uint64_t time ) const
+{
+  if( len == 0 ) return 0;
+  uint8_t id = myUsesReportIDs ? report[ 0 ] : 0;
+  size_t first = myFirst[ id ], end = myEnd[ id ];
+  if( first == end ) return 0;
+  
+  size_t written = 0;
+  snapshot->BeginWrite();
+  for( size_t ii=first; ii<end; ii++ )
+  {
+    const Step &step = mySteps[ ii ];
+    // Short reports leave the remaining fields unchanged
+    if( step.lastByte >= len ) continue;
+    const uint8_t *p = report + step.byteOffset;
+    int32_t value;
+    switch( step.kind )
+    {
+      case kStep_U8: value = p[ 0 ]; break;
+      case kStep_S8: value = (int8_t)p[ 0 ]; break;
+      case kStep_U16: value = (int32_t)( p[ 0 ] | ( p[ 1 ] << 8 ) ); break;
+      case kStep_S16: value = (int16_t)( p[ 0 ] | ( p[ 1 ] << 8 ) ); break;
+      case kStep_Bit: value = ( p[ 0 ] >> ( step.bitOffset & 7 ) ) & 1; break;
+      default:
+        value = ExtractHIDField( report, len, step.bitOffset, step.bitSize, step.isSigned );
+        break;
+    }
+    snapshot->Store( step.type, step.index, value, time );
+    written++;
+  }
+  snapshot->EndWrite();
+  return written;
+}
+
+/**
+ * \brief Sort order for steps: by report ID, then by offset.
+ */
+bool HIDReportPlan::StepLess( const Step &a, const Step &b )
+{
+  if( a.reportID != b.reportID ) return a.reportID < b.reportID;
+  return a.bitOffset < b.bitOffset;
+}
@@ -0,0 +1,233 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __HIDREPORT_H__
+#define __HIDREPORT_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include "snapshot.hpp"
+
+/**
+ * \brief Direction of a HID report field.
+ */
+enum HIDFieldDirection {
+  kHIDField_Input = 0,
+  kHIDField_Output,
+  kHIDField_Feature
+};
+
+/**
+ * \brief Flags of a HID main item (HID 1.11, section 6.2.2.5).
+ */
+enum HIDFieldFlags {
+  kHIDFlag_Constant = 0x01,
+  kHIDFlag_Variable = 0x02,
+  kHIDFlag_Relative = 0x04,
+  kHIDFlag_NullState = 0x40
+};
+
+/**
+ * \brief Usage pages and usages the decoder needs to classify fields.
+ */
+#define HID_PAGE_GENERIC_DESKTOP 0x01
+#define HID_PAGE_BUTTON 0x09
+#define HID_USAGE_GD_HATSWITCH 0x39
+
+/**
+ * \brief A single value within a HID report, as described by the report descriptor.
+ *
+ * Bit offsets are from the start of the report as delivered by the OS, which includes
+ * the report ID byte when the device uses report IDs.
+ */
+struct HIDField
+{
+  HIDFieldDirection direction;
+  uint8_t reportID;
+  uint32_t bitOffset;
+  uint32_t bitSize;
+  uint16_t usagePage;
+  uint16_t usage;
+  int32_t logicalMin;
+  int32_t logicalMax;
+  uint32_t flags;
+};
+
+/**
+ * \brief Parse a HID report descriptor into its variable (non-constant, non-array)
+ *  fields.
+ *
+ * \param[in] desc Report descriptor bytes.
+ * \param[in] len Length of the descriptor.
+ * \param[out] fields Parsed fields, in descriptor order.
+ * \param[out] inputReportBytes If not NULL, receives the length in bytes of the input
+ *  report with each ID (indexed by report ID, 0 if there is no such report), including
+ *  the report ID byte and any padding.
+ * \param[out] outputReportBytes If not NULL, receives the length in bytes of each output
+ *  report, in the same way as inputReportBytes.
+ * \return true if the descriptor was well formed, false otherwise. On failure, fields
+ *  holds whatever was parsed before the error.
+ */
+bool ParseHIDDescriptor( const uint8_t *desc, size_t len, std::vector<HIDField> &fields,
+                         std::vector<uint32_t> *inputReportBytes = NULL,
+                         std::vector<uint32_t> *outputReportBytes = NULL );
+
+/**
+ * \brief Whether the parsed descriptor uses report IDs (i.e. every report is prefixed
+ *  with an ID byte).
+ */
+bool HIDUsesReportIDs( const std::vector<HIDField> &fields );
+
+/**
+ * \brief Classify an input field the same way IOKit classifies elements.
+ *
+ * \return kJoystick_Buttons, kJoystick_POVs or kJoystick_Axes.
+ */
+JoystickIOIndex ClassifyHIDField( const HIDField &field );
+
+/**
+ * \brief Extract a single field from a report. Handles any alignment and sizes up to 32
+ *  bits.
+ *
+ * \param[in] report Report bytes.
+ * \param[in] len Length of the report.
+ * \param[in] bitOffset Offset of the field from the start of the report.
+ * \param[in] bitSize Size of the field in bits (1 to 32).
+ * \param[in] isSigned Whether to sign extend the field.
+ * \return Field value, or 0 if the field lies outside the report.
+ */
+int32_t ExtractHIDField( const uint8_t *report, size_t len, uint32_t bitOffset,
+                                                      uint32_t bitSize, bool isSigned );
+
+/**
+ * \brief Insert a single field into a report, the inverse of ExtractHIDField. The other
+ *  bits of the report are left unchanged.
+ *
+ * \param[in,out] report Report bytes.
+ * \param[in] len Length of the report.
+ * \param[in] bitOffset Offset of the field from the start of the report.
+ * \param[in] bitSize Size of the field in bits (1 to 32).
+ * \param[in] value Field value, truncated to bitSize bits.
+ * \return false if the field lies outside the report (nothing is written).
+ */
+bool InsertHIDField( uint8_t *report, size_t len, uint32_t bitOffset, uint32_t bitSize,
+                                                                        int32_t value );
+
+/**
+ * \brief A compiled extraction plan for the input reports of a device.
+ *
+ * The plan is built once from the parsed descriptor. Decoding a report is then a single
+ * loop over the fields of that report ID, with specialised cases for byte aligned 8 and
+ * 16 bit fields and single bit buttons. Values are written into a JoySnapshot as raw
+ * integers, to be normalised by the poll functions.
+ */
+class HIDReportPlan
+{
+  public:
+    /**
+     * \brief HIDReportPlan constructor. The plan is empty until Compile is called.
+     */
+    HIDReportPlan();
+    
+    /**
+     * \brief HIDReportPlan destructor.
+     */
+    ~HIDReportPlan();
+    
+    /**
+     * \brief Remove all fields from the plan.
+     */
+    void Clear( void );
+    
+    /**
+     * \brief Add an input field to the plan.
+     *
+     * \param[in] field Field from ParseHIDDescriptor.
+     * \param[in] type Snapshot type the value is written to.
+     * \param[in] index Index of the element within its type.
+     */
+    void Add( const HIDField &field, JoystickIOIndex type, size_t index );
+    
+    /**
+     * \brief Group the fields by report ID and pick the extraction path of each. Must be
+     *  called after the last Add, and before Decode.
+     *
+     * \param[in] usesReportIDs Whether reports are prefixed with a report ID byte.
+     */
+    void Compile( bool usesReportIDs );
+    
+    /**
+     * \brief Whether the plan contains any fields.
+     */
+    bool Empty( void ) const;
+    
+    /**
+     * \brief Decode a whole input report into the snapshot (writer only).
+     *
+     * \param[in] report Report bytes, including the report ID byte if used.
+     * \param[in] len Length of the report.
+     * \param[in,out] snapshot Snapshot to write the values into.
+     * \param[in] time Time stamp of the report, recorded against every field written.
+     * \return Number of fields written.
+     */
+    size_t Decode( const uint8_t *report, size_t len, JoySnapshot *snapshot,
+                                                                  uint64_t time ) const;
+    
+  private:
+    enum StepKind {
+      kStep_U8 = 0,
+      kStep_S8,
+      kStep_U16,
+      kStep_S16,
+      kStep_Bit,
+      kStep_Generic
+    };
+    struct Step
+    {
+      uint32_t bitOffset;
+      uint32_t byteOffset;
+      uint32_t lastByte;
+      uint32_t bitSize;
+      uint8_t reportID;
+      uint8_t kind;
+      bool isSigned;
+      JoystickIOIndex type;
+      size_t index;
+    };
+    std::vector<Step> mySteps;
+    // Range of steps [myFirst[id], myEnd[id]) for each report ID
+    size_t myFirst[256], myEnd[256];
+    bool myUsesReportIDs;
+    
+    /**
+     * \brief Sort order for steps: by report ID, then by offset.
+     */
+    static bool StepLess( const Step &a, const Step &b );
+};
+
+#endif
@@ -0,0 +1,547 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joycapture.hpp"
+#include "buttonmask.hpp"
+#include "joytime.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef ERROR_OUT
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief Number of events buffered between writes.
+ */
+#define JOY_CAPTURE_BLOCK 4096
+
+/**
+ * \brief JoyCaptureWriter constructor. Nothing is recorded until Open is called.
+ */
+JoyCaptureWriter::JoyCaptureWriter()
+{
+  myFile = NULL;
+  myFailed = false;
+  myStart = myLastTime = myEvents = 0;
+  myBuffered = 0;
+  for( size_t ii=0; ii<3; ii++ ) myCount[ ii ] = 0;
+}
+
+/**
+ * \brief JoyCaptureWriter destructor. Closes the file.
+ */
+JoyCaptureWriter::~JoyCaptureWriter()
+{
+  Close();
+}
+
+/**
+ * \brief Create (or truncate) a capture file, and write the header.
+ *
+ * \param[in] path File name.
+ * \param[in] info Device description.
+ * \param[in] startTicks Time (ticks, see joytime.hpp) the capture starts at. Earlier
+ *  values are recorded at time 0.
+ * \return true if successful, false if the file could not be written.
+ */
+bool JoyCaptureWriter::Open( const char *path, const JoyCaptureInfo &info,
+                                                                  uint64_t startTicks )
+{
+  Close();
+  if( info.axes.size() > 0xFFFF || info.numButtons > 0xFFFF || info.povs.size() > 0xFFFF )
+  {
+    ERR_PRINTF("JoyCaptureWriter::Open - Too many elements to capture.\n");
+    return false;
+  }
+  myFile = fopen( path, "wb" );
+  if( myFile == NULL )
+  {
+    ERR_PRINTF("JoyCaptureWriter::Open - Unable to create %s.\n", path);
+    return false;
+  }
+  
+  JoyCaptureHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, JOY_CAPTURE_MAGIC, sizeof(header.magic) );
+  header.version = JOY_CAPTURE_VERSION;
+  header.headerBytes = (uint32_t)sizeof(header);
+  header.locationKey = info.locationKey;
+  header.vendorID = info.vendorID;
+  header.productID = info.productID;
+  header.mode = info.mode;
+  header.count[ kJoystick_Axes ] = (uint32_t)info.axes.size();
+  header.count[ kJoystick_Buttons ] = (uint32_t)info.numButtons;
+  header.count[ kJoystick_POVs ] = (uint32_t)info.povs.size();
+  header.count[ kJoystick_Outputs ] = (uint32_t)info.numOutputs;
+  header.rangesOffset = sizeof(header);
+  header.eventsOffset = header.rangesOffset +
+                        ( info.axes.size() + info.povs.size() )*sizeof(JoyCaptureRange);
+  strncpy( header.productKey, info.productKey.c_str(), JOY_CAPTURE_NAME_LEN-1 );
+  
+  myFailed = fwrite( &header, sizeof(header), 1, myFile ) != 1;
+  if( !info.axes.empty() && !myFailed )
+  {
+    myFailed = fwrite( &info.axes.front(), sizeof(JoyCaptureRange), info.axes.size(),
+                       myFile ) != info.axes.size();
+  }
+  if( !info.povs.empty() && !myFailed )
+  {
+    myFailed = fwrite( &info.povs.front(), sizeof(JoyCaptureRange), info.povs.size(),
+                       myFile ) != info.povs.size();
+  }
+  if( myFailed )
+  {
+    ERR_PRINTF("JoyCaptureWriter::Open - Unable to write the header of %s.\n", path);
+    fclose( myFile );
+    myFile = NULL;
+    return false;
+  }
+  
+  myCount[ kJoystick_Axes ] = info.axes.size();
+  myCount[ kJoystick_Buttons ] = info.numButtons;
+  myCount[ kJoystick_POVs ] = info.povs.size();
+  size_t numElements = myCount[ 0 ] + myCount[ 1 ] + myCount[ 2 ];
+  myLast.assign( numElements, 0 );
+  myKnown.assign( numElements, 0 );
+  myBuffer.resize( JOY_CAPTURE_BLOCK );
+  myBuffered = 0;
+  myStart = startTicks;
+  myLastTime = 0;
+  myEvents = 0;
+  return true;
+}
+
+/**
+ * \brief Flush the buffered events and close the file.
+ *
+ * \return true if every event was written, false if any write failed.
+ */
+bool JoyCaptureWriter::Close( void )
+{
+  if( myFile == NULL ) return !myFailed;
+  Flush();
+  if( fclose( myFile ) != 0 ) myFailed = true;
+  myFile = NULL;
+  return !myFailed;
+}
+
+/**
+ * \brief Whether a capture file is open.
+ */
+bool JoyCaptureWriter::IsOpen( void ) const
+{
+  return myFile != NULL;
+}
+
+/**
+ * \brief Record an element value, if it differs from the last one recorded.
+ *
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ * \param[in] index Index of the element within its type.
+ * \param[in] value Raw (integer) element value.
+ * \param[in] ticks Time stamp (ticks) of the value.
+ */
+void JoyCaptureWriter::Record( JoystickIOIndex type, size_t index, int32_t value,
+                                                                        uint64_t ticks )
+{
+  if( myFile == NULL || type > kJoystick_POVs || index >= myCount[ type ] ) return;
+  size_t slot = index;
+  for( size_t ii=0; ii<(size_t)type; ii++ ) slot += myCount[ ii ];
+  if( myKnown[ slot ] && myLast[ slot ] == value ) return;
+  myKnown[ slot ] = 1;
+  myLast[ slot ] = value;
+  
+  // Keep the events in time order, even if the time stamps aren't quite
+  uint64_t time = 0;
+  if( ticks > myStart ) time = (uint64_t)( JoyTicksToSeconds( ticks - myStart )*1e9 + 0.5 );
+  if( time < myLastTime ) time = myLastTime;
+  myLastTime = time;
+  
+  JoyCaptureEvent &ev = myBuffer[ myBuffered++ ];
+  ev.time = time;
+  ev.value = value;
+  ev.type = (uint16_t)type;
+  ev.index = (uint16_t)index;
+  myEvents++;
+  if( myBuffered == myBuffer.size() ) Flush();
+}
+
+/**
+ * \brief Record every element of a packed snapshot (see JoySnapshot::CopyPacked) that
+ *  changed, all with the same time stamp.
+ *
+ * \param[in] layout Snapshot the packed values were copied from.
+ * \param[in] packed Packed values.
+ * \param[in] ticks Time stamp (ticks) of the values.
+ */
+void JoyCaptureWriter::RecordPacked( const JoySnapshot &layout, const int32_t *packed,
+                                                                        uint64_t ticks )
+{
+  const int32_t *axes = packed + layout.PackedOffset( kJoystick_Axes );
+  for( size_t ii=0; ii<layout.Count( kJoystick_Axes ); ii++ )
+  {
+    Record( kJoystick_Axes, ii, axes[ ii ], ticks );
+  }
+  const uint64_t *mask = (const uint64_t *)( packed + layout.PackedOffset( kJoystick_Buttons ) );
+  for( size_t ii=0; ii<layout.Count( kJoystick_Buttons ); ii++ )
+  {
+    Record( kJoystick_Buttons, ii, GetButtonMaskBit( mask, ii ) ? 1 : 0, ticks );
+  }
+  const int32_t *povs = packed + layout.PackedOffset( kJoystick_POVs );
+  for( size_t ii=0; ii<layout.Count( kJoystick_POVs ); ii++ )
+  {
+    Record( kJoystick_POVs, ii, povs[ ii ], ticks );
+  }
+}
+
+/**
+ * \brief Number of events recorded since Open.
+ */
+uint64_t JoyCaptureWriter::Events( void ) const
+{
+  return myEvents;
+}
+
+/**
+ * \brief Write the buffered events to the file.
+ */
+void JoyCaptureWriter::Flush( void )
+{
+  if( myBuffered == 0 ) return;
+  if( !myFailed &&
+      fwrite( &myBuffer.front(), sizeof(JoyCaptureEvent), myBuffered, myFile ) != myBuffered )
+  {
+    ERR_PRINTF("JoyCaptureWriter::Flush - Failed to write %u events.\n", (unsigned)myBuffered);
+    myFailed = true;
+  }
+  myBuffered = 0;
+}
+
+/**
+ * \brief JoyCapture constructor. Nothing is mapped until Open is called.
+ */
+JoyCapture::JoyCapture()
+{
+  myMap = NULL;
+  myBytes = 0;
+  myHeader = NULL;
+  myRanges = NULL;
+  myEvents = NULL;
+  myNumEvents = 0;
+}
+
+/**
+ * \brief JoyCapture destructor. Unmaps the file.
+ */
+JoyCapture::~JoyCapture()
+{
+  Close();
+}
+
+/**
+ * \brief Map a capture file and check its header.
+ *
+ * \param[in] path File name.
+ * \return true if successful, false if the file can't be read or isn't a capture.
+ */
+bool JoyCapture::Open( const char *path )
+{
+  Close();
+  int fd = open( path, O_RDONLY );
+  if( fd < 0 )
+  {
+    ERR_PRINTF("JoyCapture::Open - Unable to open %s.\n", path);
+    return false;
+  }
+  struct stat info;
+  if( fstat( fd, &info ) != 0 || (size_t)info.st_size < sizeof(JoyCaptureHeader) )
+  {
+    ERR_PRINTF("JoyCapture::Open - %s is too short to be a capture.\n", path);
+    close( fd );
+    return false;
+  }
+  myBytes = (size_t)info.st_size;
+  void *map = mmap( NULL, myBytes, PROT_READ, MAP_PRIVATE, fd, 0 );
+  // The mapping keeps the file open
+  close( fd );
+  if( map == MAP_FAILED )
+  {
+    ERR_PRINTF("JoyCapture::Open - Unable to map %s.\n", path);
+    myBytes = 0;
+    return false;
+  }
+  myMap = map;
+  
+  // Check the header, and that the tables it points to are inside the file
+  const JoyCaptureHeader *header = (const JoyCaptureHeader *)myMap;
+  uint64_t numRanges = (uint64_t)header->count[ kJoystick_Axes ] + header->count[ kJoystick_POVs ];
+  if( memcmp( header->magic, JOY_CAPTURE_MAGIC, sizeof(header->magic) ) != 0 ||
+      header->version != JOY_CAPTURE_VERSION || header->headerBytes != sizeof(JoyCaptureHeader) ||
+      header->rangesOffset < sizeof(JoyCaptureHeader) || header->rangesOffset % 8 != 0 ||
+      header->eventsOffset < header->rangesOffset + numRanges*sizeof(JoyCaptureRange) ||
+      header->eventsOffset % 8 != 0 || header->eventsOffset > myBytes ||
+      header->productKey[ JOY_CAPTURE_NAME_LEN-1 ] != '\0' )
+  {
+    ERR_PRINTF("JoyCapture::Open - %s is not a version %i capture.\n", path, JOY_CAPTURE_VERSION);
+    Close();
+    return false;
+  }
+  myHeader = header;
+  myRanges = (const JoyCaptureRange *)( (const char *)myMap + header->rangesOffset );
+  myEvents = (const JoyCaptureEvent *)( (const char *)myMap + header->eventsOffset );
+  // A partly written last event is ignored
+  myNumEvents = ( myBytes - (size_t)header->eventsOffset ) / sizeof(JoyCaptureEvent);
+  return true;
+}
+
+/**
+ * \brief Unmap the file.
+ */
+void JoyCapture::Close( void )
+{
+  if( myMap != NULL ) munmap( myMap, myBytes );
+  myMap = NULL;
+  myBytes = 0;
+  myHeader = NULL;
+  myRanges = NULL;
+  myEvents = NULL;
+  myNumEvents = 0;
+}
+
+/**
+ * \brief Whether a capture is mapped.
+ */
+bool JoyCapture::IsOpen( void ) const
+{
+  return myHeader != NULL;
+}
+
+/**
+ * \brief The capture's header. Only valid while the capture is open.
+ */
+const JoyCaptureHeader &JoyCapture::Header( void ) const
+{
+  return *myHeader;
+}
+
+/**
+ * \brief Number of elements of the given type in the captured device.
+ *
+ * \param[in] type Any JoystickIOIndex.
+ */
+size_t JoyCapture::Count( JoystickIOIndex type ) const
+{
+  if( myHeader == NULL || type > kJoystick_Outputs ) return 0;
+  return myHeader->count[ type ];
+}
+
+/**
+ * \brief Logical range of an axis or POV.
+ *
+ * \param[in] type kJoystick_Axes or kJoystick_POVs.
+ * \param[in] index Index of the element within its type.
+ */
+const JoyCaptureRange &JoyCapture::Range( JoystickIOIndex type, size_t index ) const
+{
+  if( type == kJoystick_POVs ) index += myHeader->count[ kJoystick_Axes ];
+  return myRanges[ index ];
+}
+
+/**
+ * \brief The product key of the captured device.
+ */
+std::string JoyCapture::ProductKey( void ) const
+{
+  if( myHeader == NULL ) return std::string();
+  return std::string( myHeader->productKey );
+}
+
+/**
+ * \brief The recorded events, in time order.
+ */
+const JoyCaptureEvent *JoyCapture::Events( void ) const
+{
+  return myEvents;
+}
+
+/**
+ * \brief Number of recorded events.
+ */
+size_t JoyCapture::NumEvents( void ) const
+{
+  return myNumEvents;
+}
+
+/**
+ * \brief Time (seconds) of the last event, or 0 if there are none.
+ */
+double JoyCapture::Duration( void ) const
+{
+  if( myNumEvents == 0 ) return 0.0;
+  return 1e-9 * (double)myEvents[ myNumEvents-1 ].time;
+}
+
+/**
+ * \brief JoyReplay constructor. Nothing is played until Open and Start are called.
+ */
+JoyReplay::JoyReplay()
+{
+  mySnapshot = NULL;
+  myRing = NULL;
+  myBase = 0;
+  mySpeed = 1.0;
+  myNext = 0;
+}
+
+/**
+ * \brief JoyReplay destructor.
+ */
+JoyReplay::~JoyReplay()
+{
+}
+
+/**
+ * \brief Map a capture file to play.
+ *
+ * \param[in] path File name.
+ * \return true if successful, false if the file isn't a readable capture.
+ */
+bool JoyReplay::Open( const char *path )
+{
+  Close();
+  return myCapture.Open( path );
+}
+
+/**
+ * \brief Stop playing and unmap the capture.
+ */
+void JoyReplay::Close( void )
+{
+  myCapture.Close();
+  mySnapshot = NULL;
+  myRing = NULL;
+  myNext = 0;
+}
+
+/**
+ * \brief The capture being played.
+ */
+const JoyCapture &JoyReplay::Capture( void ) const
+{
+  return myCapture;
+}
+
+/**
+ * \brief Start (or restart) playing from the beginning of the capture. The snapshot
+ *  must already be sized for the captured device.
+ *
+ * \param[in] snapshot Snapshot to write the element values into.
+ * \param[in] baseTicks Time stamp (ticks) of capture time 0.
+ * \param[in] speed Capture seconds played per second of element time stamps.
+ */
+void JoyReplay::Start( JoySnapshot *snapshot, uint64_t baseTicks, double speed )
+{
+  mySnapshot = snapshot;
+  myBase = baseTicks;
+  mySpeed = speed > 0.0 ? speed : 1.0;
+  myNext = 0;
+}
+
+/**
+ * \brief Also push a sample into a ring after each batch of events, as the
+ *  acquisition thread does for Joystick::EnableFrames.
+ *
+ * \param[in] ring Ring with a stride of at least the snapshot's PackedSize(). NULL
+ *  stops pushing samples.
+ */
+void JoyReplay::SetRing( SampleRing *ring )
+{
+  myRing = ring;
+}
+
+/**
+ * \brief Play every event up to and including the given capture time.
+ *
+ * \param[in] time Capture time (seconds).
+ * \return Number of events played.
+ */
+size_t JoyReplay::Advance( double time )
+{
+  if( mySnapshot == NULL || time < 0.0 ) return 0;
+  const JoyCaptureEvent *events = myCapture.Events();
+  size_t numEvents = myCapture.NumEvents();
+  uint64_t until = (uint64_t)( time*1e9 + 0.5 );
+  size_t first = myNext;
+  while( myNext < numEvents && events[ myNext ].time <= until )
+  {
+    // Events with the same time are one batch, like one input report
+    uint64_t batchTime = events[ myNext ].time;
+    uint64_t stamp = myBase + JoySecondsToTicks( 1e-9*(double)batchTime / mySpeed );
+    mySnapshot->BeginWrite();
+    for( ; myNext < numEvents && events[ myNext ].time == batchTime; myNext++ )
+    {
+      const JoyCaptureEvent &ev = events[ myNext ];
+      if( ev.type > kJoystick_POVs || ev.index >= mySnapshot->Count( (JoystickIOIndex)ev.type ) )
+        continue;
+      mySnapshot->Store( (JoystickIOIndex)ev.type, ev.index, ev.value, stamp );
+    }
+    mySnapshot->EndWrite();
+    
+    if( myRing != NULL )
+    {
+      int32_t *slot = myRing->BeginPush();
+      if( slot != NULL )
+      {
+        mySnapshot->CopyPacked( slot );
+        myRing->EndPush( stamp );
+      }
+    }
+  }
+  return myNext - first;
+}
+
+/**
+ * \brief Whether every event has been played.
+ */
+bool JoyReplay::Finished( void ) const
+{
+  return myNext >= myCapture.NumEvents();
+}
+
+/**
+ * \brief Number of events played since Start.
+ */
+size_t JoyReplay::Played( void ) const
+{
+  return myNext;
+}
@@ -0,0 +1,379 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYCAPTURE_H__
+#define __JOYCAPTURE_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "snapshot.hpp"
+#include "samplering.hpp"
+
+/**
+ * \brief Capture file identification and format version.
+ */
+#define JOY_CAPTURE_MAGIC "SLJOYCAP"
+#define JOY_CAPTURE_VERSION 1
+
+/**
+ * \brief Room for the product key in the header, including the terminating NUL.
+ */
+#define JOY_CAPTURE_NAME_LEN 128
+
+/**
+ * \brief Capture file header. Every structure in the file is a multiple of 8 bytes, in
+ *  the recording machine's byte order, so the file can be mapped and read in place.
+ *
+ * The header is followed by a JoyCaptureRange for each axis and then each POV, and then
+ * by the JoyCaptureEvents up to the end of the file. The number of events is worked out
+ * from the file size, so a capture cut short (by a crash, say) is still readable.
+ */
+struct JoyCaptureHeader
+{
+  char magic[ 8 ];
+  uint32_t version;
+  uint32_t headerBytes;
+  int32_t locationKey;
+  int32_t vendorID;
+  int32_t productID;
+  // JoystickAcquisition the capture was recorded with
+  int32_t mode;
+  // QueryIO layout, indexed by JoystickIOIndex
+  uint32_t count[ 4 ];
+  uint64_t rangesOffset;
+  uint64_t eventsOffset;
+  char productKey[ JOY_CAPTURE_NAME_LEN ];
+};
+
+/**
+ * \brief Logical range of an axis or POV.
+ */
+struct JoyCaptureRange
+{
+  int32_t logicalMin;
+  int32_t logicalMax;
+  uint32_t relative;
+  uint32_t reserved;
+};
+
+/**
+ * \brief One element value change. The time is in nanoseconds since the capture was
+ *  started, and never decreases from one event to the next.
+ */
+struct JoyCaptureEvent
+{
+  uint64_t time;
+  int32_t value;
+  uint16_t type;
+  uint16_t index;
+};
+
+/**
+ * \brief Device description written at the start of a capture.
+ */
+struct JoyCaptureInfo
+{
+  int32_t locationKey;
+  int32_t vendorID;
+  int32_t productID;
+  int32_t mode;
+  std::string productKey;
+  size_t numButtons;
+  size_t numOutputs;
+  std::vector<JoyCaptureRange> axes;
+  std::vector<JoyCaptureRange> povs;
+};
+
+/**
+ * \brief Records element value changes into a capture file.
+ *
+ * Only changes are written: a value equal to the last one recorded for its element is
+ * skipped, so callers may record whole snapshots. Events are buffered and written in
+ * blocks. There must only be one thread recording at a time.
+ */
+class JoyCaptureWriter
+{
+  public:
+    /**
+     * \brief JoyCaptureWriter constructor. Nothing is recorded until Open is called.
+     */
+    JoyCaptureWriter();
+    
+    /**
+     * \brief JoyCaptureWriter destructor. Closes the file.
+     */
+    ~JoyCaptureWriter();
+    
+    /**
+     * \brief Create (or truncate) a capture file, and write the header.
+     *
+     * \param[in] path File name.
+     * \param[in] info Device description.
+     * \param[in] startTicks Time (ticks, see joytime.hpp) the capture starts at. Earlier
+     *  values are recorded at time 0.
+     * \return true if successful, false if the file could not be written.
+     */
+    bool Open( const char *path, const JoyCaptureInfo &info, uint64_t startTicks );
+    
+    /**
+     * \brief Flush the buffered events and close the file.
+     *
+     * \return true if every event was written, false if any write failed.
+     */
+    bool Close( void );
+    
+    /**
+     * \brief Whether a capture file is open.
+     */
+    bool IsOpen( void ) const;
+    
+    /**
+     * \brief Record an element value, if it differs from the last one recorded.
+     *
+     * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+     * \param[in] index Index of the element within its type.
+     * \param[in] value Raw (integer) element value.
+     * \param[in] ticks Time stamp (ticks) of the value.
+     */
+    void Record( JoystickIOIndex type, size_t index, int32_t value, uint64_t ticks );
+    
+    /**
+     * \brief Record every element of a packed snapshot (see JoySnapshot::CopyPacked) that
+     *  changed, all with the same time stamp.
+     *
+     * \param[in] layout Snapshot the packed values were copied from.
+     * \param[in] packed Packed values.
+     * \param[in] ticks Time stamp (ticks) of the values.
+     */
+    void RecordPacked( const JoySnapshot &layout, const int32_t *packed, uint64_t ticks );
+    
+    /**
+     * \brief Number of events recorded since Open.
+     */
+    uint64_t Events( void ) const;
+    
+  private:
+    FILE *myFile;
+    bool myFailed;
+    uint64_t myStart, myLastTime, myEvents;
+    size_t myCount[ 3 ];
+    // Last value recorded for each element (axes, then buttons, then POVs), and whether
+    // there is one
+    std::vector<int32_t> myLast;
+    std::vector<uint8_t> myKnown;
+    std::vector<JoyCaptureEvent> myBuffer;
+    size_t myBuffered;
+    
+    /**
+     * \brief Write the buffered events to the file.
+     */
+    void Flush( void );
+    
+    // Non-copyable
+    JoyCaptureWriter( const JoyCaptureWriter & );
+    JoyCaptureWriter &operator=( const JoyCaptureWriter & );
+};
+
+/**
+ * \brief A capture file mapped into memory.
+ */
+class JoyCapture
+{
+  public:
+    /**
+     * \brief JoyCapture constructor. Nothing is mapped until Open is called.
+     */
+    JoyCapture();
+    
+    /**
+     * \brief JoyCapture destructor. Unmaps the file.
+     */
+    ~JoyCapture();
+    
+    /**
+     * \brief Map a capture file and check its header.
+     *
+     * \param[in] path File name.
+     * \return true if successful, false if the file can't be read or isn't a capture.
+     */
+    bool Open( const char *path );
+    
+    /**
+     * \brief Unmap the file.
+     */
+    void Close( void );
+    
+    /**
+     * \brief Whether a capture is mapped.
+     */
+    bool IsOpen( void ) const;
+    
+    /**
+     * \brief The capture's header. Only valid while the capture is open.
+     */
+    const JoyCaptureHeader &Header( void ) const;
+    
+    /**
+     * \brief Number of elements of the given type in the captured device.
+     *
+     * \param[in] type Any JoystickIOIndex.
+     */
+    size_t Count( JoystickIOIndex type ) const;
+    
+    /**
+     * \brief Logical range of an axis or POV.
+     *
+     * \param[in] type kJoystick_Axes or kJoystick_POVs.
+     * \param[in] index Index of the element within its type.
+     */
+    const JoyCaptureRange &Range( JoystickIOIndex type, size_t index ) const;
+    
+    /**
+     * \brief The product key of the captured device.
+     */
+    std::string ProductKey( void ) const;
+    
+    /**
+     * \brief The recorded events, in time order.
+     */
+    const JoyCaptureEvent *Events( void ) const;
+    
+    /**
+     * \brief Number of recorded events.
+     */
+    size_t NumEvents( void ) const;
+    
+    /**
+     * \brief Time (seconds) of the last event, or 0 if there are none.
+     */
+    double Duration( void ) const;
+    
+  private:
+    void *myMap;
+    size_t myBytes;
+    const JoyCaptureHeader *myHeader;
+    const JoyCaptureRange *myRanges;
+    const JoyCaptureEvent *myEvents;
+    size_t myNumEvents;
+    
+    // Non-copyable
+    JoyCapture( const JoyCapture & );
+    JoyCapture &operator=( const JoyCapture & );
+};
+
+/**
+ * \brief Plays a capture back into a JoySnapshot, as its acquisition thread would.
+ *
+ * Playback is driven by the caller: Advance plays every event up to a given capture
+ * time, so the same sequence of Advance calls always gives the same snapshots. Events
+ * with the same time are written as one batch (one sample). Element time stamps are the
+ * capture times, scaled by the playback speed, from the base time given to Start.
+ */
+class JoyReplay
+{
+  public:
+    /**
+     * \brief JoyReplay constructor. Nothing is played until Open and Start are called.
+     */
+    JoyReplay();
+    
+    /**
+     * \brief JoyReplay destructor.
+     */
+    ~JoyReplay();
+    
+    /**
+     * \brief Map a capture file to play.
+     *
+     * \param[in] path File name.
+     * \return true if successful, false if the file isn't a readable capture.
+     */
+    bool Open( const char *path );
+    
+    /**
+     * \brief Stop playing and unmap the capture.
+     */
+    void Close( void );
+    
+    /**
+     * \brief The capture being played.
+     */
+    const JoyCapture &Capture( void ) const;
+    
+    /**
+     * \brief Start (or restart) playing from the beginning of the capture. The snapshot
+     *  must already be sized for the captured device.
+     *
+     * \param[in] snapshot Snapshot to write the element values into.
+     * \param[in] baseTicks Time stamp (ticks) of capture time 0.
+     * \param[in] speed Capture seconds played per second of element time stamps.
+     */
+    void Start( JoySnapshot *snapshot, uint64_t baseTicks, double speed );
+    
+    /**
+     * \brief Also push a sample into a ring after each batch of events, as the
+     *  acquisition thread does for Joystick::EnableFrames.
+     *
+     * \param[in] ring Ring with a stride of at least the snapshot's PackedSize(). NULL
+     *  stops pushing samples.
+     */
+    void SetRing( SampleRing *ring );
+    
+    /**
+     * \brief Play every event up to and including the given capture time.
+     *
+     * \param[in] time Capture time (seconds).
+     * \return Number of events played.
+     */
+    size_t Advance( double time );
+    
+    /**
+     * \brief Whether every event has been played.
+     */
+    bool Finished( void ) const;
+    
+    /**
+     * \brief Number of events played since Start.
+     */
+    size_t Played( void ) const;
+    
+  private:
+    JoyCapture myCapture;
+    JoySnapshot *mySnapshot;
+    SampleRing *myRing;
+    uint64_t myBase;
+    double mySpeed;
+    size_t myNext;
+    
+    // Non-copyable
+    JoyReplay( const JoyReplay & );
+    JoyReplay &operator=( const JoyReplay & );
+};
+
+#endif
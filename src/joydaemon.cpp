@@ -0,0 +1,149 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joydaemon.hpp"
+#include "hidhotplug.hpp"
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief JoyDaemon constructor. Nothing is published until Start is called.
+ */
+JoyDaemon::JoyDaemon()
+{
+  myMode = kJoystick_RawReports;
+  myGeneration = 0;
+}
+
+/**
+ * \brief JoyDaemon destructor. Stops publishing.
+ */
+JoyDaemon::~JoyDaemon()
+{
+  Stop();
+}
+
+/**
+ * \brief Create the segment, and publish the joysticks already attached.
+ *
+ * \param[in] name Shared memory name, such as JoyShmName().
+ * \param[in] mode kJoystick_EventDriven or kJoystick_RawReports.
+ * \return true if successful, false if the segment could not be created (such as
+ *  when another daemon is running).
+ */
+bool JoyDaemon::Start( const char *name, JoystickAcquisition mode )
+{
+  Stop();
+  if( mode != kJoystick_EventDriven && mode != kJoystick_RawReports ) return false;
+  if( !mySegment.Create( name ) ) return false;
+  myMode = mode;
+  Synchronise();
+  return true;
+}
+
+/**
+ * \brief Publish newly attached joysticks, withdraw removed ones, and refresh the
+ *  heartbeat. Must be called more often than JOY_SHM_TIMEOUT_MS.
+ */
+void JoyDaemon::Refresh( void )
+{
+  if( !mySegment.IsOpen() ) return;
+  if( SharedJoyRegistry().Generation() != myGeneration ) Synchronise();
+  mySegment.Beat();
+}
+
+/**
+ * \brief Withdraw and close every joystick, and remove the segment.
+ */
+void JoyDaemon::Stop( void )
+{
+  // The acquisition threads write into the segment, so they go first
+  for( std::map<int32_t, Joystick *>::iterator it = myJoysticks.begin();
+       it != myJoysticks.end(); ++it )
+  {
+    mySegment.Withdraw( it->first );
+    delete it->second;
+  }
+  myJoysticks.clear();
+  mySegment.Close();
+}
+
+/**
+ * \brief Number of joysticks being published.
+ */
+size_t JoyDaemon::Size( void ) const
+{
+  return myJoysticks.size();
+}
+
+/**
+ * \brief Bring the published joysticks in line with the registry.
+ */
+void JoyDaemon::Synchronise( void )
+{
+  JoyRegistry &registry = SharedJoyRegistry();
+  myGeneration = registry.Generation();
+  vector<JoyDev> devices = registry.Devices();
+  
+  // Withdraw the joysticks that have gone
+  std::map<int32_t, Joystick *> current;
+  for( size_t ii=0; ii<devices.size(); ii++ )
+  {
+    std::map<int32_t, Joystick *>::iterator it = myJoysticks.find( devices[ ii ].locationKey );
+    if( it == myJoysticks.end() ) continue;
+    current[ it->first ] = it->second;
+    myJoysticks.erase( it );
+  }
+  for( std::map<int32_t, Joystick *>::iterator it = myJoysticks.begin();
+       it != myJoysticks.end(); ++it )
+  {
+    mySegment.Withdraw( it->first );
+    delete it->second;
+  }
+  myJoysticks.swap( current );
+  
+  // Publish the new ones
+  for( size_t ii=0; ii<devices.size(); ii++ )
+  {
+    int32_t location = devices[ ii ].locationKey;
+    if( myJoysticks.find( location ) != myJoysticks.end() ) continue;
+    Joystick *joy = new Joystick;
+    if( !joy->Initialise( location, myMode ) || !joy->Publish( mySegment ) )
+    {
+      ERR_PRINTF("JoyDaemon::Synchronise - Joystick %i could not be published.\n", location);
+      delete joy;
+      mySegment.Withdraw( location );
+      continue;
+    }
+    myJoysticks[ location ] = joy;
+  }
+}
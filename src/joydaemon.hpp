@@ -0,0 +1,102 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYDAEMON_H__
+#define __JOYDAEMON_H__
+
+#include <map>
+#include <stdint.h>
+#include "osx_joystick.hpp"
+#include "joyshm.hpp"
+
+/**
+ * \brief The acquisition daemon (sljoyd): owns every attached joystick and publishes its
+ *  state in the shared memory segment (see joyshm.hpp).
+ *
+ * Each joystick is acquired by its own thread at the device's native rate, straight
+ * into its slot. Refresh follows the shared registry, publishing joysticks as they are
+ * attached and withdrawing them as they are removed, and keeps the heartbeat going.
+ */
+class JoyDaemon
+{
+  public:
+    /**
+     * \brief JoyDaemon constructor. Nothing is published until Start is called.
+     */
+    JoyDaemon();
+    
+    /**
+     * \brief JoyDaemon destructor. Stops publishing.
+     */
+    ~JoyDaemon();
+    
+    /**
+     * \brief Create the segment, and publish the joysticks already attached.
+     *
+     * \param[in] name Shared memory name, such as JoyShmName().
+     * \param[in] mode kJoystick_EventDriven or kJoystick_RawReports.
+     * \return true if successful, false if the segment could not be created (such as
+     *  when another daemon is running).
+     */
+    bool Start( const char *name, JoystickAcquisition mode = kJoystick_RawReports );
+    
+    /**
+     * \brief Publish newly attached joysticks, withdraw removed ones, and refresh the
+     *  heartbeat. Must be called more often than JOY_SHM_TIMEOUT_MS.
+     */
+    void Refresh( void );
+    
+    /**
+     * \brief Withdraw and close every joystick, and remove the segment.
+     */
+    void Stop( void );
+    
+    /**
+     * \brief Number of joysticks being published.
+     */
+    size_t Size( void ) const;
+    
+  private:
+    JoyShmSegment mySegment;
+    JoystickAcquisition myMode;
+    // Registry generation last synchronised with. Joysticks that couldn't be published
+    // are only retried once it changes.
+    uint32_t myGeneration;
+    // Published joysticks, by location key
+    std::map<int32_t, Joystick *> myJoysticks;
+    
+    /**
+     * \brief Bring the published joysticks in line with the registry.
+     */
+    void Synchronise( void );
+    
+    // Non-copyable
+    JoyDaemon( const JoyDaemon & );
+    JoyDaemon &operator=( const JoyDaemon & );
+};
+
+#endif
@@ -0,0 +1,480 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <algorithm>
+#include "joyeffects.hpp"
+#include "joytime.hpp"
+
+#ifdef __APPLE__
+  #include <mach/mach.h>
+  #include <mach/thread_policy.h>
+#endif
+
+#define UNUSED(x) (void)(x)
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+#ifndef M_PI
+  #define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * \brief Decode an effect from a row of block parameters: type, output (1 based), axis
+ *  (1 based), magnitude, offset, period, deadband and saturation.
+ *
+ * \param[in] params JOY_EFFECT_PARAMS values.
+ * \param[out] effect Decoded effect, of type kJoyEffect_None if the row isn't valid.
+ * \output true if the row is a valid effect.
+ */
+bool JoyEffectFromParams( const double *params, JoyEffect &effect )
+{
+  effect.type = kJoyEffect_None;
+  effect.output = 0;
+  effect.axis = 0;
+  effect.magnitude = params[3];
+  effect.offset = params[4];
+  effect.period = params[5];
+  effect.deadband = params[6];
+  effect.saturation = params[7];
+  
+  double type = params[0];
+  if( !(type >= 1.0 && type < (double)kJoyEffect_NumTypes) || type != floor( type ) ) return false;
+  if( !(params[1] >= 1.0) ) return false;
+  effect.output = (size_t)params[1] - 1;
+  effect.axis = params[2] >= 1.0 ? (size_t)params[2] - 1 : 0;
+  effect.type = (JoyEffectType)(int)type;
+  return true;
+}
+
+/**
+ * \brief Force produced by an effect.
+ *
+ * \param[in] effect Effect.
+ * \param[in] elapsed Seconds since the effect started.
+ * \param[in] position Normalised position of its axis (-1 to 1).
+ * \param[in] velocity Normalised velocity of its axis (per second).
+ * \output Force, from -saturation to saturation.
+ */
+double JoyEffectForce( const JoyEffect &effect, double elapsed, double position,
+                                                                      double velocity )
+{
+  double force = 0.0;
+  double x;
+  switch( effect.type )
+  {
+    case kJoyEffect_Constant:
+      force = effect.magnitude;
+      break;
+    case kJoyEffect_Periodic:
+      force = effect.offset;
+      if( effect.period > 0.0 ) force += effect.magnitude*sin( 2.0*M_PI*elapsed/effect.period );
+      break;
+    case kJoyEffect_Spring:
+    case kJoyEffect_Damper:
+      x = effect.type == kJoyEffect_Spring ? position - effect.offset : velocity;
+      // Only the part beyond the deadband counts, so the force doesn't jump at its edge
+      if( x > effect.deadband ) force = -effect.magnitude*(x - effect.deadband);
+      else if( x < -effect.deadband ) force = -effect.magnitude*(x + effect.deadband);
+      break;
+    case kJoyEffect_Ramp:
+      if( effect.period > 0.0 && elapsed < effect.period )
+        force = effect.magnitude + (effect.offset - effect.magnitude)*elapsed/effect.period;
+      else
+        force = effect.offset;
+      break;
+    default:
+      break;
+  }
+  
+  double saturation = effect.saturation > 0.0 ? std::min( effect.saturation, 1.0 ) : 1.0;
+  if( force > saturation ) force = saturation;
+  if( force < -saturation ) force = -saturation;
+  return force;
+}
+
+/**
+ * \brief Ask for the effect loop to be scheduled as a real-time thread with a
+ *  guaranteed share of each period. Elsewhere the loop relies on its absolute deadlines
+ *  alone.
+ *
+ * \param[in] period Loop period (ticks).
+ */
+static void MakeRealTime( uint64_t period )
+{
+#ifdef __APPLE__
+  thread_time_constraint_policy_data_t policy;
+  policy.period = (uint32_t)period;
+  policy.computation = (uint32_t)(period/4);
+  policy.constraint = (uint32_t)(period/2);
+  policy.preemptible = 1;
+  if( thread_policy_set( pthread_mach_thread_np( pthread_self() ),
+                         THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&policy,
+                         THREAD_TIME_CONSTRAINT_POLICY_COUNT ) != KERN_SUCCESS )
+  {
+    ERR_PRINTF("MakeRealTime - Failed to set the time constraint policy.\n");
+  }
+#else
+  UNUSED(period);
+#endif
+}
+
+/**
+ * \brief JoyEffectEngine constructor. Nothing runs until Start.
+ */
+JoyEffectEngine::JoyEffectEngine()
+{
+  myGroup = NULL;
+  myPeriod = 0;
+  myStarted = false;
+  myRunning = false;
+  myChanged = false;
+  myNeedsAxes = false;
+  myHistogram.resize( JOY_JITTER_BINS );
+  pthread_mutex_init( &myMutex, NULL );
+  ResetJitter();
+}
+
+/**
+ * \brief JoyEffectEngine destructor. Stops the engine.
+ */
+JoyEffectEngine::~JoyEffectEngine()
+{
+  Stop();
+  pthread_mutex_destroy( &myMutex );
+}
+
+/**
+ * \brief Start the effect loop on a group of joysticks, once every member has been
+ *  claimed (see the class comment). The group must outlive the engine, or at least
+ *  Stop.
+ *
+ * \param[in] group Group whose outputs are driven.
+ * \param[in] numEffects Number of effect slots.
+ * \param[in] rate Loop rate (Hz).
+ * \output true if successful, false if already running, the group has no outputs, a
+ *  member couldn't be claimed or the thread couldn't be started.
+ */
+bool JoyEffectEngine::Start( JoystickGroup *group, size_t numEffects, double rate )
+{
+  if( myStarted || group == NULL || !(rate > 0.0) ) return false;
+  vector<int> io = group->QueryIO();
+  if( io[kJoystick_Outputs] <= 0 ) return false;
+  // The thread pushes without any lock, so the members mustn't be shared with a block
+  // pushing from another thread
+  if( !group->ClaimAll() )
+  {
+    ERR_PRINTF("JoyEffectEngine::Start - Unable to claim the group's joysticks.\n");
+    return false;
+  }
+  
+  JoyEffect none;
+  none.type = kJoyEffect_None;
+  none.output = 0;
+  none.axis = 0;
+  none.magnitude = none.offset = none.period = none.deadband = none.saturation = 0.0;
+  
+  // Everything the loop touches is sized here, so that it never allocates
+  myGroup = group;
+  myPeriod = std::max( JoySecondsToTicks( 1.0/rate ), (uint64_t)1 );
+  myPending.assign( numEffects, none );
+  myEffects.assign( numEffects, none );
+  myStarts.assign( numEffects, 0 );
+  myPendingDirect.assign( io[kJoystick_Outputs], 0.0 );
+  myDirect.assign( io[kJoystick_Outputs], 0.0 );
+  myValues.assign( io[kJoystick_Outputs], 0.0 );
+  myAxes.assign( io[kJoystick_Axes], 0.0 );
+  myLastAxes.assign( io[kJoystick_Axes], 0.0 );
+  myVelocity.assign( io[kJoystick_Axes], 0.0 );
+  myScratch.assign( std::max( io[kJoystick_Axes], 1 ), 0 );
+  myChanged = false;
+  myNeedsAxes = false;
+  ResetJitter();
+  
+  myRunning = true;
+  if( pthread_create( &myThread, NULL, &JoyEffectEngine::EngineThread, this ) != 0 )
+  {
+    ERR_PRINTF("JoyEffectEngine::Start - Failed to start the effect thread.\n");
+    myRunning = false;
+    myGroup = NULL;
+    return false;
+  }
+  myStarted = true;
+  return true;
+}
+
+/**
+ * \brief Stop the effect loop and wait for its thread. The outputs keep their last
+ *  values.
+ */
+void JoyEffectEngine::Stop( void )
+{
+  if( !myStarted ) return;
+  myRunning = false;
+  // The loop never sleeps for more than a period
+  pthread_join( myThread, NULL );
+  myStarted = false;
+  myGroup = NULL;
+}
+
+/**
+ * \brief Whether the effect loop is running.
+ */
+bool JoyEffectEngine::Running( void ) const
+{
+  return myStarted;
+}
+
+/**
+ * \brief Replace the effects. A slot whose type or output changes restarts, which
+ *  matters to periodic effects and ramps. Does not allocate.
+ *
+ * \param[in] effects Effects, one per slot.
+ * \param[in] len Length of effects. Slots beyond len are left unchanged.
+ */
+void JoyEffectEngine::SetEffects( const JoyEffect *effects, size_t len )
+{
+  pthread_mutex_lock( &myMutex );
+  len = std::min( len, myPending.size() );
+  std::copy( effects, effects + len, myPending.begin() );
+  myChanged = true;
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Replace the effects from rows of block parameters (see JoyEffectFromParams).
+ *  Does not allocate.
+ *
+ * \param[in] params JOY_EFFECT_PARAMS values per effect, one effect after another.
+ * \param[in] numEffects Number of effects in params.
+ */
+void JoyEffectEngine::SetEffectParams( const double *params, size_t numEffects )
+{
+  pthread_mutex_lock( &myMutex );
+  numEffects = std::min( numEffects, myPending.size() );
+  for( size_t ii = 0; ii < numEffects; ii++ )
+    JoyEffectFromParams( params + ii*JOY_EFFECT_PARAMS, myPending[ii] );
+  myChanged = true;
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Set the direct value of the outputs, which the effects are added to. Does not
+ *  allocate.
+ *
+ * \param[in] normInputs Normalised values, laid out as for the group's outputs.
+ * \param[in] len Length of normInputs. Outputs beyond len are left unchanged.
+ */
+void JoyEffectEngine::SetDirect( const double *normInputs, size_t len )
+{
+  pthread_mutex_lock( &myMutex );
+  len = std::min( len, myPendingDirect.size() );
+  std::copy( normInputs, normInputs + len, myPendingDirect.begin() );
+  myChanged = true;
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Timing of the effect loop since it started (or ResetJitter).
+ */
+JoyEffectJitter JoyEffectEngine::Jitter( void )
+{
+  JoyEffectJitter jitter;
+  pthread_mutex_lock( &myMutex );
+  jitter.ticks = myTicks;
+  jitter.overruns = myOverruns;
+  jitter.errors = myErrors;
+  jitter.meanLate = jitter.stdLate = jitter.p99Late = 0.0;
+  jitter.maxLate = myLateMax;
+  if( myTicks > 0 )
+  {
+    jitter.meanLate = myLateSum/(double)myTicks;
+    double variance = myLateSquares/(double)myTicks - jitter.meanLate*jitter.meanLate;
+    jitter.stdLate = variance > 0.0 ? sqrt( variance ) : 0.0;
+    
+    // Upper edge of the bin holding the 99th percentile, but no more than the maximum
+    uint64_t target = myTicks - myTicks/100, count = 0;
+    size_t bin = 0;
+    while( bin < JOY_JITTER_BINS - 1 && (count += myHistogram[bin]) < target ) bin++;
+    jitter.p99Late = std::min( (double)(bin + 1)*JOY_JITTER_BIN_SECONDS, myLateMax );
+  }
+  pthread_mutex_unlock( &myMutex );
+  return jitter;
+}
+
+/**
+ * \brief Start the timing over.
+ */
+void JoyEffectEngine::ResetJitter( void )
+{
+  pthread_mutex_lock( &myMutex );
+  myTicks = myOverruns = myErrors = 0;
+  myLateSum = myLateSquares = myLateMax = 0.0;
+  std::fill( myHistogram.begin(), myHistogram.end(), (uint64_t)0 );
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Effect loop thread. Each iteration sleeps until an absolute deadline, so that
+ *  the time spent evaluating doesn't accumulate as drift. Deadlines already missed are
+ *  skipped rather than run back to back.
+ */
+void *JoyEffectEngine::EngineThread( void *context )
+{
+  JoyEffectEngine *engine = (JoyEffectEngine *)context;
+  MakeRealTime( engine->myPeriod );
+  
+  uint64_t last = JoyNowTicks();
+  uint64_t deadline = last + engine->myPeriod;
+  while( engine->myRunning )
+  {
+    JoySleepUntil( deadline );
+    uint64_t now = JoyNowTicks();
+    double late = now > deadline ? JoyTicksToSeconds( now - deadline ) : 0.0;
+    bool pushed = engine->Update( now, JoyTicksToSeconds( now - last ) );
+    last = now;
+    
+    now = JoyNowTicks();
+    uint64_t missed = 0;
+    deadline += engine->myPeriod;
+    if( deadline <= now )
+    {
+      missed = (now - deadline)/engine->myPeriod + 1;
+      deadline += missed*engine->myPeriod;
+    }
+    engine->RecordTick( late, missed, pushed );
+  }
+  return NULL;
+}
+
+/**
+ * \brief Evaluate the effects and push the outputs, once.
+ *
+ * \param[in] now Time of this iteration (ticks).
+ * \param[in] dt Seconds since the previous iteration.
+ * \output true if the push succeeded.
+ */
+bool JoyEffectEngine::Update( uint64_t now, double dt )
+{
+  size_t ii;
+  pthread_mutex_lock( &myMutex );
+  if( myChanged )
+  {
+    myNeedsAxes = false;
+    for( ii = 0; ii < myEffects.size(); ii++ )
+    {
+      const JoyEffect &effect = myPending[ii];
+      if( effect.type != myEffects[ii].type || effect.output != myEffects[ii].output )
+        myStarts[ii] = now;
+      myEffects[ii] = effect;
+      if( effect.type == kJoyEffect_Spring || effect.type == kJoyEffect_Damper )
+        myNeedsAxes = true;
+    }
+    std::copy( myPendingDirect.begin(), myPendingDirect.end(), myDirect.begin() );
+    myChanged = false;
+  }
+  pthread_mutex_unlock( &myMutex );
+  
+  if( myNeedsAxes && !myAxes.empty() )
+  {
+    // A shared joystick throws once its daemon stops in the middle of a write
+    try
+    {
+      myGroup->ReadAxesInto( &myAxes.front(), &myScratch.front(), myAxes.size() );
+    }
+    catch( const char *err )
+    {
+      UNUSED(err);
+      ERR_PRINTF("JoyEffectEngine::Update - %s\n", err);
+      return false;
+    }
+    for( ii = 0; ii < myAxes.size(); ii++ )
+    {
+      if( dt > 0.0 )
+      {
+        double raw = (myAxes[ii] - myLastAxes[ii])/dt;
+        myVelocity[ii] += JOY_EFFECT_VELOCITY_WEIGHT*(raw - myVelocity[ii]);
+      }
+      myLastAxes[ii] = myAxes[ii];
+    }
+  }
+  
+  std::copy( myDirect.begin(), myDirect.end(), myValues.begin() );
+  for( ii = 0; ii < myEffects.size(); ii++ )
+  {
+    const JoyEffect &effect = myEffects[ii];
+    if( effect.type == kJoyEffect_None || effect.output >= myValues.size() ) continue;
+    double position = 0.0, velocity = 0.0;
+    if( effect.axis < myAxes.size() )
+    {
+      position = myAxes[effect.axis];
+      velocity = myVelocity[effect.axis];
+    }
+    myValues[effect.output] += 0.5*JoyEffectForce( effect,
+                                  JoyTicksToSeconds( now - myStarts[ii] ), position, velocity );
+  }
+  for( ii = 0; ii < myValues.size(); ii++ )
+    myValues[ii] = std::min( std::max( myValues[ii], 0.0 ), 1.0 );
+  
+  try
+  {
+    myGroup->PushInputs( &myValues.front(), myValues.size() );
+  }
+  catch( const char *err )
+  {
+    UNUSED(err);
+    ERR_PRINTF("JoyEffectEngine::Update - %s\n", err);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Add an iteration to the timing.
+ *
+ * \param[in] late How late the iteration woke up (seconds).
+ * \param[in] missed Number of iterations skipped after it.
+ * \param[in] pushed Whether its push succeeded.
+ */
+void JoyEffectEngine::RecordTick( double late, uint64_t missed, bool pushed )
+{
+  size_t bin = (size_t)(late/JOY_JITTER_BIN_SECONDS);
+  pthread_mutex_lock( &myMutex );
+  myTicks++;
+  myOverruns += missed;
+  if( !pushed ) myErrors++;
+  myLateSum += late;
+  myLateSquares += late*late;
+  if( late > myLateMax ) myLateMax = late;
+  myHistogram[std::min( bin, (size_t)JOY_JITTER_BINS - 1 )]++;
+  pthread_mutex_unlock( &myMutex );
+}
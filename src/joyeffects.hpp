@@ -0,0 +1,286 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYEFFECTS_H__
+#define __JOYEFFECTS_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+#include "joygroup.hpp"
+
+/**
+ * \brief Default rate of the effect loop (Hz).
+ */
+#define JOY_EFFECT_RATE 1000.0
+
+/**
+ * \brief Number of parameters describing an effect on the block's effect port (see
+ *  JoyEffectFromParams).
+ */
+#define JOY_EFFECT_PARAMS 8
+
+/**
+ * \brief Jitter histogram: bins of 5 us, so the last bin holds everything 1 ms late or
+ *  later.
+ */
+#define JOY_JITTER_BINS 200
+#define JOY_JITTER_BIN_SECONDS 5e-6
+
+/**
+ * \brief Weight of the newest axis difference in the smoothed velocity of a damper. A
+ *  raw difference at 1 kHz is mostly quantisation noise.
+ */
+#define JOY_EFFECT_VELOCITY_WEIGHT 0.2
+
+/**
+ * \brief Kinds of force feedback effect.
+ *
+ * kJoyEffect_Constant pushes with a fixed force (magnitude).
+ * kJoyEffect_Periodic is a sine wave of the given amplitude (magnitude), period and
+ * offset.
+ * kJoyEffect_Spring pulls the axis back to a centre position (offset), with a force of
+ * magnitude per unit of normalised displacement outside the deadband.
+ * kJoyEffect_Damper resists the axis velocity, with a force of magnitude per unit of
+ * normalised velocity (full scale per second) outside the deadband.
+ * kJoyEffect_Ramp goes from one force (magnitude) to another (offset) over the period,
+ * then holds.
+ */
+enum JoyEffectType {
+  kJoyEffect_None = 0,
+  kJoyEffect_Constant,
+  kJoyEffect_Periodic,
+  kJoyEffect_Spring,
+  kJoyEffect_Damper,
+  kJoyEffect_Ramp,
+  kJoyEffect_NumTypes
+};
+
+/**
+ * \brief A force feedback effect. Forces are from -1 to 1, and are added to an output
+ *  as half of its normalised range, so that with an output held at 0.5 the full range
+ *  of forces maps to the full range of the output.
+ */
+struct JoyEffect
+{
+  JoyEffectType type;
+  // Output driven, and axis read by springs and dampers (indices into the group layout)
+  size_t output;
+  size_t axis;
+  double magnitude;
+  double offset;
+  // Periodic period or ramp duration (seconds)
+  double period;
+  double deadband;
+  // Largest force the effect produces (1 if not positive)
+  double saturation;
+};
+
+/**
+ * \brief Decode an effect from a row of block parameters: type, output (1 based), axis
+ *  (1 based), magnitude, offset, period, deadband and saturation.
+ *
+ * \param[in] params JOY_EFFECT_PARAMS values.
+ * \param[out] effect Decoded effect, of type kJoyEffect_None if the row isn't valid.
+ * \return true if the row is a valid effect.
+ */
+bool JoyEffectFromParams( const double *params, JoyEffect &effect );
+
+/**
+ * \brief Force produced by an effect.
+ *
+ * \param[in] effect Effect.
+ * \param[in] elapsed Seconds since the effect started.
+ * \param[in] position Normalised position of its axis (-1 to 1).
+ * \param[in] velocity Normalised velocity of its axis (per second).
+ * \return Force, from -saturation to saturation.
+ */
+double JoyEffectForce( const JoyEffect &effect, double elapsed, double position,
+                                                                      double velocity );
+
+/**
+ * \brief Timing of the effect loop: how late each iteration woke up.
+ */
+struct JoyEffectJitter
+{
+  uint64_t ticks;
+  // Iterations missed altogether, because the previous one overran its period
+  uint64_t overruns;
+  // Pushes to the device that failed
+  uint64_t errors;
+  // Lateness (seconds)
+  double meanLate;
+  double stdLate;
+  double p99Late;
+  double maxLate;
+};
+
+/**
+ * \brief Host side force feedback: a dedicated thread that evaluates the effects at a
+ *  fixed rate (normally 1 kHz) from the newest axis values, and pushes the resulting
+ *  output values to a group's devices.
+ *
+ * The owner (such as the Simulink block) updates the effects and the direct output
+ * values at its own rate. While the engine runs it is the only one pushing to the
+ * group, so the owner must not call the group's PushInputs, and the group must be an
+ * event driven one (see Joystick::ReadAxesInto). Each output sent is its direct value
+ * plus half of the sum of the forces of the effects driving it, limited to 0 to 1. As
+ * pushes only send changed reports (see Joystick::PushInputs), steady outputs cost
+ * nothing.
+ *
+ * Start claims every member of the group (see JoystickGroup::ClaimAll), so that no
+ * other block pushes to a joystick the engine drives, and nothing set up later swaps
+ * one from under it. Captures and frame rings may then be changed while the engine
+ * runs: that only restarts a member's acquisition, which keeps its snapshot in place.
+ * Initialise and Close must wait until Stop.
+ */
+class JoyEffectEngine
+{
+  public:
+    /**
+     * \brief JoyEffectEngine constructor. Nothing runs until Start.
+     */
+    JoyEffectEngine();
+    
+    /**
+     * \brief JoyEffectEngine destructor. Stops the engine.
+     */
+    ~JoyEffectEngine();
+    
+    /**
+     * \brief Start the effect loop on a group of joysticks, once every member has been
+     *  claimed (see the class comment). The group must outlive the engine, or at least
+     *  Stop.
+     *
+     * \param[in] group Group whose outputs are driven.
+     * \param[in] numEffects Number of effect slots.
+     * \param[in] rate Loop rate (Hz).
+     * \return true if successful, false if already running, the group has no outputs,
+     *  a member couldn't be claimed or the thread couldn't be started.
+     */
+    bool Start( JoystickGroup *group, size_t numEffects, double rate = JOY_EFFECT_RATE );
+    
+    /**
+     * \brief Stop the effect loop and wait for its thread. The outputs keep their last
+     *  values.
+     */
+    void Stop( void );
+    
+    /**
+     * \brief Whether the effect loop is running.
+     */
+    bool Running( void ) const;
+    
+    /**
+     * \brief Replace the effects. A slot whose type or output changes restarts, which
+     *  matters to periodic effects and ramps. Does not allocate.
+     *
+     * \param[in] effects Effects, one per slot.
+     * \param[in] len Length of effects. Slots beyond len are left unchanged.
+     */
+    void SetEffects( const JoyEffect *effects, size_t len );
+    
+    /**
+     * \brief Replace the effects from rows of block parameters (see
+     *  JoyEffectFromParams). Does not allocate.
+     *
+     * \param[in] params JOY_EFFECT_PARAMS values per effect, one effect after another.
+     * \param[in] numEffects Number of effects in params.
+     */
+    void SetEffectParams( const double *params, size_t numEffects );
+    
+    /**
+     * \brief Set the direct value of the outputs, which the effects are added to. Does
+     *  not allocate.
+     *
+     * \param[in] normInputs Normalised values, laid out as for the group's outputs.
+     * \param[in] len Length of normInputs. Outputs beyond len are left unchanged.
+     */
+    void SetDirect( const double *normInputs, size_t len );
+    
+    /**
+     * \brief Timing of the effect loop since it started (or ResetJitter).
+     */
+    JoyEffectJitter Jitter( void );
+    
+    /**
+     * \brief Start the timing over.
+     */
+    void ResetJitter( void );
+    
+  private:
+    JoystickGroup *myGroup;
+    uint64_t myPeriod;
+    pthread_t myThread;
+    bool myStarted;
+    volatile bool myRunning;
+    
+    // Written by the owner, taken by the loop (both under myMutex)
+    pthread_mutex_t myMutex;
+    std::vector<JoyEffect> myPending;
+    std::vector<double> myPendingDirect;
+    bool myChanged;
+    
+    // Owned by the loop thread
+    std::vector<JoyEffect> myEffects;
+    std::vector<uint64_t> myStarts;
+    std::vector<double> myDirect, myValues;
+    std::vector<double> myAxes, myLastAxes, myVelocity;
+    std::vector<int32_t> myScratch;
+    bool myNeedsAxes;
+    
+    // Timing (under myMutex)
+    uint64_t myTicks, myOverruns, myErrors;
+    double myLateSum, myLateSquares, myLateMax;
+    std::vector<uint64_t> myHistogram;
+    
+    /**
+     * \brief Effect loop thread.
+     */
+    static void *EngineThread( void *context );
+    
+    /**
+     * \brief Evaluate the effects and push the outputs, once.
+     *
+     * \param[in] now Time of this iteration (ticks).
+     * \param[in] dt Seconds since the previous iteration.
+     * \return true if the push succeeded.
+     */
+    bool Update( uint64_t now, double dt );
+    
+    /**
+     * \brief Add an iteration to the timing.
+     */
+    void RecordTick( double late, uint64_t missed, bool pushed );
+    
+    // Non-copyable
+    JoyEffectEngine( const JoyEffectEngine & );
+    JoyEffectEngine &operator=( const JoyEffectEngine & );
+};
+
+#endif
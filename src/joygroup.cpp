@@ -0,0 +1,688 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joygroup.hpp"
+#include "joysession.hpp"
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief JoystickGroup constructor. The group is empty until Initialise is called.
+ */
+JoystickGroup::JoystickGroup()
+{
+  for( size_t ii=0; ii<4; ii++ ) myTotals[ ii ] = 0;
+  myOwned = false;
+  myCapturing = false;
+  myProcessing = false;
+}
+
+/**
+ * \brief JoystickGroup destructor. Gives the members back to the session pool.
+ */
+JoystickGroup::~JoystickGroup()
+{
+  Close();
+}
+
+/**
+ * \brief Open every joystick in the group.
+ *
+ * \param[in] joyLocations LocationKeys of the joysticks, in layout order.
+ * \param[in] numJoysticks Number of location keys.
+ * \param[in] mode How the element values are acquired (see JoystickAcquisition).
+ * \return true if successful, false if any of the joysticks couldn't be initialised.
+ */
+bool JoystickGroup::Initialise( const int32_t *joyLocations, size_t numJoysticks,
+                                JoystickAcquisition mode )
+{
+  Close();
+  JoySessionPool &pool = SharedJoySessionPool();
+  myJoysticks.reserve( numJoysticks );
+  myMembers.reserve( numJoysticks );
+  for( size_t ii=0; ii<numJoysticks; ii++ )
+  {
+    Joystick *joy = pool.Acquire( joyLocations[ ii ], mode );
+    if( joy == NULL )
+    {
+      ERR_PRINTF("JoystickGroup::Initialise - Joystick %i could not be initialised.\n",
+                                                                    joyLocations[ ii ]);
+      Close();
+      return false;
+    }
+    AddMember( joy, joyLocations[ ii ] );
+  }
+  return true;
+}
+
+/**
+ * \brief Replay a capture file for each member, instead of opening devices (see
+ *  Joystick::InitialiseReplay). The members are owned by the group, not the pool.
+ *
+ * \param[in] paths Capture file names, in layout order.
+ * \param[in] speed Capture seconds played per second of real time, or zero to play
+ *  up to the time given to SetReplayTime.
+ * \return true if successful, false if any capture couldn't be read.
+ */
+bool JoystickGroup::InitialiseReplay( const vector<std::string> &paths, double speed )
+{
+  Close();
+  myOwned = true;
+  myJoysticks.reserve( paths.size() );
+  myMembers.reserve( paths.size() );
+  for( size_t ii=0; ii<paths.size(); ii++ )
+  {
+    Joystick *joy = new Joystick;
+    if( !joy->InitialiseReplay( paths[ ii ].c_str(), speed ) )
+    {
+      ERR_PRINTF("JoystickGroup::InitialiseReplay - %s could not be replayed.\n",
+                                                                   paths[ ii ].c_str());
+      delete joy;
+      Close();
+      return false;
+    }
+    AddMember( joy, joy->LocationKey() );
+  }
+  return true;
+}
+
+/**
+ * \brief Play every member's capture up to the given time (see
+ *  Joystick::SetReplayTime).
+ */
+void JoystickGroup::SetReplayTime( double time )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ ) myJoysticks[ ii ]->SetReplayTime( time );
+}
+
+/**
+ * \brief Record each member into its own capture file (see Joystick::StartCapture),
+ *  until StopCapture or Close is called.
+ *
+ * \param[in] paths Capture file names, one per member.
+ * \return true if successful, false if any capture couldn't be started.
+ */
+bool JoystickGroup::StartCapture( const vector<std::string> &paths )
+{
+  StopCapture();
+  if( paths.size() != myJoysticks.size() || !ClaimAll() ) return false;
+  myCapturing = true;
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    if( !myJoysticks[ ii ]->StartCapture( paths[ ii ].c_str() ) )
+    {
+      ERR_PRINTF("JoystickGroup::StartCapture - Unable to record into %s.\n",
+                                                                   paths[ ii ].c_str());
+      StopCapture();
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * \brief Stop recording every member started by StartCapture.
+ *
+ * \return true if every value was written, false if any write failed.
+ */
+bool JoystickGroup::StopCapture( void )
+{
+  if( !myCapturing ) return true;
+  bool result = true;
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    result = myJoysticks[ ii ]->StopCapture() && result;
+  }
+  myCapturing = false;
+  return result;
+}
+
+/**
+ * \brief Give every member back to the session pool (or delete it, for a replay).
+ *  Any capture is stopped, and the frames, button edges, axis processing and relative
+ *  axes of the claimed members are put back as they were opened. The group is then
+ *  empty.
+ */
+void JoystickGroup::Close( void )
+{
+  StopCapture();
+  ClearAxisProcessing();
+  if( !myOwned )
+  {
+    // The pool may share the members again, so leave none of this group's state behind
+    for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+    {
+      if( !myClaimed[ ii ] ) continue;
+      Joystick *joy = myJoysticks[ ii ];
+      joy->DisableFrames();
+      joy->DisableButtonEdges();
+      joy->ClearAxisProcessing();
+      joy->SetRelativeMode( kAxisRelative_Position );
+      joy->ResetRelativeAxes();
+    }
+  }
+  if( myOwned )
+  {
+    for( size_t ii=0; ii<myJoysticks.size(); ii++ ) delete myJoysticks[ ii ];
+  }
+  else if( !myJoysticks.empty() )
+  {
+    JoySessionPool &pool = SharedJoySessionPool();
+    for( size_t ii=0; ii<myJoysticks.size(); ii++ ) pool.Release( myJoysticks[ ii ] );
+  }
+  myOwned = false;
+  myJoysticks.clear();
+  myClaimed.clear();
+  myMembers.clear();
+  for( size_t ii=0; ii<4; ii++ ) myTotals[ ii ] = 0;
+}
+
+/**
+ * \brief Number of joysticks in the group.
+ */
+size_t JoystickGroup::Size( void ) const
+{
+  return myMembers.size();
+}
+
+/**
+ * \brief Layout of a member of the group.
+ *
+ * \param[in] member Index of the member, in the order given to Initialise.
+ */
+const JoyGroupMember &JoystickGroup::Member( size_t member ) const
+{
+  return myMembers[ member ];
+}
+
+/**
+ * \brief Query the group for IO capabilities
+ *
+ * \return An vector containing the total number of axes, buttons, pov, outputs
+ */
+vector<int> JoystickGroup::QueryIO( void ) const
+{
+  vector<int> result( 4, 0 );
+  for( size_t ii=0; ii<4; ii++ ) result[ ii ] = (int)myTotals[ ii ];
+  return result;
+}
+
+/**
+ * \brief Poll every member in one pass. Any of the buffers may be NULL to skip that
+ *  type, otherwise they must hold the group's total count of that type.
+ *
+ * \param[out] axes Normalised axes.
+ * \param[out] buttons Button states (0 or 1).
+ * \param[out] povs POV angles (degrees, or -1 for nothing pressed).
+ */
+void JoystickGroup::PollInto( double *axes, uint8_t *buttons, double *povs )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    Joystick *joy = myJoysticks[ ii ];
+    const JoyGroupMember &member = myMembers[ ii ];
+    if( axes != NULL && member.count[ kJoystick_Axes ] > 0 )
+    {
+      joy->PollAxesInto( axes + member.offset[ kJoystick_Axes ],
+                         member.count[ kJoystick_Axes ] );
+    }
+    if( buttons != NULL && member.count[ kJoystick_Buttons ] > 0 )
+    {
+      joy->PollButtonsInto( buttons + member.offset[ kJoystick_Buttons ],
+                            member.count[ kJoystick_Buttons ] );
+    }
+    if( povs != NULL && member.count[ kJoystick_POVs ] > 0 )
+    {
+      joy->PollPOVInto( povs + member.offset[ kJoystick_POVs ],
+                        member.count[ kJoystick_POVs ] );
+    }
+  }
+}
+
+/**
+ * \brief Poll every member's axes into a caller supplied buffer.
+ *
+ * \param[out] dest Buffer for the normalised axes.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Total number of axes in the group.
+ */
+size_t JoystickGroup::PollAxesInto( double *dest, size_t len )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_Axes ];
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->PollAxesInto( dest + offset, len - offset );
+  }
+  return myTotals[ kJoystick_Axes ];
+}
+
+/**
+ * \brief Read every member's newest axes from any thread (see
+ *  Joystick::ReadAxesInto).
+ *
+ * \param[out] dest Buffer for the normalised axes.
+ * \param[out] scratch Buffer for raw values, as long as the group's total of axes.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Total number of axes in the group.
+ */
+size_t JoystickGroup::ReadAxesInto( double *dest, int32_t *scratch, size_t len ) const
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_Axes ];
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->ReadAxesInto( dest + offset, scratch, len - offset );
+  }
+  return myTotals[ kJoystick_Axes ];
+}
+
+/**
+ * \brief Poll every member's axes into a caller supplied buffer of another type (see
+ *  Joystick::PollAxes). The integer types read raw counts.
+ *
+ * \param[out] dest Buffer for the axes.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Total number of axes in the group.
+ */
+template<typename T>
+size_t JoystickGroup::PollAxes( T *dest, size_t len )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_Axes ];
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->PollAxes( dest + offset, len - offset );
+  }
+  return myTotals[ kJoystick_Axes ];
+}
+
+template size_t JoystickGroup::PollAxes<double>( double *dest, size_t len );
+template size_t JoystickGroup::PollAxes<float>( float *dest, size_t len );
+template size_t JoystickGroup::PollAxes<int16_t>( int16_t *dest, size_t len );
+template size_t JoystickGroup::PollAxes<uint16_t>( uint16_t *dest, size_t len );
+template size_t JoystickGroup::PollAxes<int32_t>( int32_t *dest, size_t len );
+
+/**
+ * \brief The logical range shared by every axis in the group, which a single scaling
+ *  of the raw counts then suits.
+ *
+ * \param[out] logmin Logical minimum.
+ * \param[out] logmax Logical maximum.
+ * \output true if successful, false if there are no axes or their ranges differ.
+ */
+bool JoystickGroup::CommonAxisRange( int32_t &logmin, int32_t &logmax ) const
+{
+  bool found = false;
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    for( size_t jj=0; jj<myMembers[ ii ].count[ kJoystick_Axes ]; jj++ )
+    {
+      int32_t lo, hi;
+      if( !myJoysticks[ ii ]->AxisRange( jj, lo, hi ) ) return false;
+      if( found && ( lo != logmin || hi != logmax ) ) return false;
+      logmin = lo;
+      logmax = hi;
+      found = true;
+    }
+  }
+  return found;
+}
+
+/**
+ * \brief Logical range of one of the group's axes (see Joystick::AxisRange).
+ *
+ * \param[in] axis Index of the axis, laid out as for the member offsets.
+ * \param[out] logmin Logical minimum.
+ * \param[out] logmax Logical maximum.
+ * \output true if successful, false if there is no such axis.
+ */
+bool JoystickGroup::AxisRange( size_t axis, int32_t &logmin, int32_t &logmax ) const
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_Axes ];
+    if( axis >= offset && axis < offset + myMembers[ ii ].count[ kJoystick_Axes ] )
+    {
+      return myJoysticks[ ii ]->AxisRange( axis - offset, logmin, logmax );
+    }
+  }
+  return false;
+}
+
+/**
+ * \brief Process every member's axes (see Joystick::SetAxisProcessing), until
+ *  ClearAxisProcessing or Close is called.
+ *
+ * \param[in] config Processing of each axis, laid out as for the member offsets.
+ * \param[in] len Length of config. Axes beyond len are left as they are.
+ * \param[in] rate Rate at which the axes are polled (Hz), for the filters.
+ * \return true if successful, false if a setting is out of range (no axis is then
+ *  processed).
+ */
+bool JoystickGroup::SetAxisProcessing( const AxisProcessing *config, size_t len, double rate )
+{
+  ClearAxisProcessing();
+  myProcessing = true;
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_Axes ];
+    if( offset >= len ) break;
+    if( !Claim( ii ) ||
+        !myJoysticks[ ii ]->SetAxisProcessing( config + offset, len - offset, rate ) )
+    {
+      ClearAxisProcessing();
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * \brief Stop processing the axes of every member.
+ */
+void JoystickGroup::ClearAxisProcessing( void )
+{
+  if( !myProcessing ) return;
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ ) myJoysticks[ ii ]->ClearAxisProcessing();
+  myProcessing = false;
+}
+
+/**
+ * \brief Poll every member's buttons into a caller supplied buffer.
+ *
+ * \param[out] dest Buffer for the button states (0 or 1).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Total number of buttons in the group.
+ */
+size_t JoystickGroup::PollButtonsInto( uint8_t *dest, size_t len )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_Buttons ];
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->PollButtonsInto( dest + offset, len - offset );
+  }
+  return myTotals[ kJoystick_Buttons ];
+}
+
+/**
+ * \brief Poll every member's POV hats into a caller supplied buffer.
+ *
+ * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Total number of POV hats in the group.
+ */
+size_t JoystickGroup::PollPOVInto( double *dest, size_t len )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_POVs ];
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->PollPOVInto( dest + offset, len - offset );
+  }
+  return myTotals[ kJoystick_POVs ];
+}
+
+/**
+ * \brief Poll every member's POV hats into a caller supplied buffer of another type
+ *  (see Joystick::PollPOV).
+ *
+ * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Total number of POV hats in the group.
+ */
+template<typename T>
+size_t JoystickGroup::PollPOV( T *dest, size_t len )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_POVs ];
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->PollPOV( dest + offset, len - offset );
+  }
+  return myTotals[ kJoystick_POVs ];
+}
+
+template size_t JoystickGroup::PollPOV<double>( double *dest, size_t len );
+template size_t JoystickGroup::PollPOV<float>( float *dest, size_t len );
+template size_t JoystickGroup::PollPOV<int16_t>( int16_t *dest, size_t len );
+template size_t JoystickGroup::PollPOV<int32_t>( int32_t *dest, size_t len );
+
+/**
+ * \brief Choose what every member's relative axes read as (see
+ *  Joystick::SetRelativeMode).
+ */
+void JoystickGroup::SetRelativeMode( AxisRelativeMode mode )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    // Deltas are consumed by each poll, so they can't be shared
+    if( !myJoysticks[ ii ]->HasRelativeAxes() ) continue;
+    if( mode != kAxisRelative_Position && !Claim( ii ) ) continue;
+    myJoysticks[ ii ]->SetRelativeMode( mode );
+  }
+}
+
+/**
+ * \brief Move the origin of every member's relative axes to their current position
+ *  (see Joystick::ResetRelativeAxes).
+ */
+void JoystickGroup::ResetRelativeAxes( void )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    if( !myJoysticks[ ii ]->HasRelativeAxes() || !Claim( ii ) ) continue;
+    myJoysticks[ ii ]->ResetRelativeAxes();
+  }
+}
+
+/**
+ * \brief Record every sample of every member, for PollFrames (see
+ *  Joystick::EnableFrames).
+ *
+ * \param[in] capacity Number of samples each member's ring must hold between polls.
+ * \return true if successful, false if any member doesn't support frames.
+ */
+bool JoystickGroup::EnableFrames( size_t capacity )
+{
+  if( !ClaimAll() ) return false;
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    if( !myJoysticks[ ii ]->EnableFrames( capacity ) ) return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Poll every member's samples since the last call, as frames (see
+ *  Joystick::PollFrames). The members' columns are laid out as for the member offsets.
+ *
+ * \param[in] frameSize Number of rows.
+ * \param[out] counts Number of new samples of each member, Size() long (may be NULL).
+ * \param[out] axes Normalised axes, frameSize by the total number of axes.
+ * \param[out] buttons Button states (0 or 1), frameSize by the total number of buttons.
+ * \param[out] povs POV angles, frameSize by the total number of POV hats.
+ */
+void JoystickGroup::PollFrames( size_t frameSize, double *counts, double *axes,
+                                                    uint8_t *buttons, double *povs )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    const JoyGroupMember &member = myMembers[ ii ];
+    size_t count = myJoysticks[ ii ]->PollFrames( frameSize, NULL,
+        axes == NULL ? NULL : axes + member.offset[ kJoystick_Axes ]*frameSize,
+        buttons == NULL ? NULL : buttons + member.offset[ kJoystick_Buttons ]*frameSize,
+        povs == NULL ? NULL : povs + member.offset[ kJoystick_POVs ]*frameSize );
+    if( counts != NULL ) counts[ ii ] = (double)count;
+  }
+}
+
+/**
+ * \brief Queue every member's button presses and releases (see
+ *  Joystick::EnableButtonEdges).
+ *
+ * \param[in] capacity Number of edges each member's queue must hold between polls.
+ * \return true if successful, false if any member doesn't support button edges.
+ */
+bool JoystickGroup::EnableButtonEdges( size_t capacity )
+{
+  if( !ClaimAll() ) return false;
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    if( !myJoysticks[ ii ]->EnableButtonEdges( capacity ) ) return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Summarise every member's button edges since the last call (see
+ *  Joystick::PollButtonEdgeCounts). The buffers are laid out as for the member
+ *  offsets, and any may be NULL.
+ *
+ * \param[out] presses Number of presses of each button.
+ * \param[out] releases Number of releases of each button.
+ * \param[out] latched Whether each button was down at any time since the last call.
+ * \param[in] len Length of the buffers. At most len buttons are written.
+ * \output Total number of buttons in the group.
+ */
+size_t JoystickGroup::PollButtonEdgeCounts( double *presses, double *releases,
+                                            uint8_t *latched, size_t len )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    size_t offset = myMembers[ ii ].offset[ kJoystick_Buttons ];
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->PollButtonEdgeCounts( presses == NULL ? NULL : presses + offset,
+                                             releases == NULL ? NULL : releases + offset,
+                                             latched == NULL ? NULL : latched + offset,
+                                             len - offset );
+  }
+  return myTotals[ kJoystick_Buttons ];
+}
+
+/**
+ * \brief Age of each member's newest sample (see Joystick::SampleAge).
+ *
+ * \param[out] dest Ages in microseconds, or -1 if unknown, Size() long.
+ */
+void JoystickGroup::SampleAges( double *dest )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    double age = myJoysticks[ ii ]->SampleAge();
+    dest[ ii ] = age < 0.0 ? -1.0 : age*1e6;
+  }
+}
+
+/**
+ * \brief Push values to the members' inputs (such as force feedback).
+ *
+ * \param[in] normInputs Normalised values, laid out as for the member offsets.
+ * \param[in] len Length of normInputs. Outputs beyond len are left unchanged.
+ */
+void JoystickGroup::PushInputs( const double *normInputs, size_t len )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    const JoyGroupMember &member = myMembers[ ii ];
+    size_t offset = member.offset[ kJoystick_Outputs ];
+    if( member.count[ kJoystick_Outputs ] == 0 ) continue;
+    if( offset >= len ) break;
+    myJoysticks[ ii ]->PushInputs( normInputs + offset, len - offset );
+  }
+}
+
+/**
+ * \brief Mark the end of a simulation step for every member (see Joystick::EndStep).
+ */
+void JoystickGroup::EndStep( void )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ ) myJoysticks[ ii ]->EndStep();
+}
+
+/**
+ * \brief Append a member to the layout.
+ */
+void JoystickGroup::AddMember( Joystick *joy, int32_t locationKey )
+{
+  vector<int> io = joy->QueryIO();
+  JoyGroupMember member;
+  member.locationKey = locationKey;
+  for( size_t tt=0; tt<4; tt++ )
+  {
+    member.offset[ tt ] = myTotals[ tt ];
+    member.count[ tt ] = (size_t)io[ tt ];
+    myTotals[ tt ] += (size_t)io[ tt ];
+  }
+  myJoysticks.push_back( joy );
+  myClaimed.push_back( false );
+  myMembers.push_back( member );
+}
+
+/**
+ * \brief Claim a member from the session pool (see JoySessionPool::Claim), before
+ *  changing its per user state. Does nothing for a replay.
+ *
+ * \param[in] member Index of the member.
+ * \return true if successful, false if the member couldn't be claimed.
+ */
+bool JoystickGroup::Claim( size_t member )
+{
+  if( myOwned || myClaimed[ member ] ) return true;
+  Joystick *joy = SharedJoySessionPool().Claim( myJoysticks[ member ] );
+  if( joy == NULL )
+  {
+    ERR_PRINTF("JoystickGroup::Claim - Joystick %i could not be claimed.\n",
+                                                     myMembers[ member ].locationKey);
+    return false;
+  }
+  myJoysticks[ member ] = joy;
+  myClaimed[ member ] = true;
+  return true;
+}
+
+/**
+ * \brief Claim every member from the session pool (see JoySessionPool::Claim), so that
+ *  no other user shares them, such as before another thread pushes to them. Does
+ *  nothing for a replay.
+ *
+ * \return true if successful, false if any member couldn't be claimed.
+ */
+bool JoystickGroup::ClaimAll( void )
+{
+  for( size_t ii=0; ii<myJoysticks.size(); ii++ )
+  {
+    if( !Claim( ii ) ) return false;
+  }
+  return true;
+}
@@ -0,0 +1,362 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYGROUP_H__
+#define __JOYGROUP_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "osx_joystick.hpp"
+
+/**
+ * \brief Where one member's values sit in the group's contiguous layout. Both arrays
+ *  are indexed by JoystickIOIndex.
+ */
+struct JoyGroupMember
+{
+  int32_t locationKey;
+  size_t offset[4];
+  size_t count[4];
+};
+
+/**
+ * \brief A set of joysticks (such as a stick, throttle and pedals) polled together.
+ *
+ * The members' axes are laid out one device after another in a single buffer, as are
+ * their buttons, POVs and outputs. The members come from the shared session pool, so
+ * they are shared with any other blocks using the same devices. Enabling frames, button
+ * edges, axis processing, relative deltas or a capture first claims the members (see
+ * JoySessionPool::Claim), so that the group has them to itself until Close.
+ */
+class JoystickGroup
+{
+  public:
+    /**
+     * \brief JoystickGroup constructor. The group is empty until Initialise is called.
+     */
+    JoystickGroup();
+    
+    /**
+     * \brief JoystickGroup destructor. Gives the members back to the session pool.
+     */
+    ~JoystickGroup();
+    
+    /**
+     * \brief Open every joystick in the group.
+     *
+     * \param[in] joyLocations LocationKeys of the joysticks, in layout order.
+     * \param[in] numJoysticks Number of location keys.
+     * \param[in] mode How the element values are acquired (see JoystickAcquisition).
+     * \return true if successful, false if any of the joysticks couldn't be initialised.
+     */
+    bool Initialise( const int32_t *joyLocations, size_t numJoysticks,
+                     JoystickAcquisition mode = kJoystick_EventDriven );
+    
+    /**
+     * \brief Replay a capture file for each member, instead of opening devices (see
+     *  Joystick::InitialiseReplay). The members are owned by the group, not the pool.
+     *
+     * \param[in] paths Capture file names, in layout order.
+     * \param[in] speed Capture seconds played per second of real time, or zero to play
+     *  up to the time given to SetReplayTime.
+     * \return true if successful, false if any capture couldn't be read.
+     */
+    bool InitialiseReplay( const vector<std::string> &paths, double speed );
+    
+    /**
+     * \brief Play every member's capture up to the given time (see
+     *  Joystick::SetReplayTime).
+     */
+    void SetReplayTime( double time );
+    
+    /**
+     * \brief Record each member into its own capture file (see Joystick::StartCapture),
+     *  until StopCapture or Close is called.
+     *
+     * \param[in] paths Capture file names, one per member.
+     * \return true if successful, false if any capture couldn't be started.
+     */
+    bool StartCapture( const vector<std::string> &paths );
+    
+    /**
+     * \brief Stop recording every member started by StartCapture.
+     *
+     * \return true if every value was written, false if any write failed.
+     */
+    bool StopCapture( void );
+    
+    /**
+     * \brief Give every member back to the session pool (or delete it, for a replay).
+     *  Any capture is stopped, and the frames, button edges, axis processing and
+     *  relative axes of the claimed members are put back as they were opened. The group
+     *  is then empty.
+     */
+    void Close( void );
+    
+    /**
+     * \brief Claim every member from the session pool (see JoySessionPool::Claim), so
+     *  that no other user shares them, such as before another thread pushes to them.
+     *  Does nothing for a replay.
+     *
+     * \return true if successful, false if any member couldn't be claimed.
+     */
+    bool ClaimAll( void );
+    
+    /**
+     * \brief Number of joysticks in the group.
+     */
+    size_t Size( void ) const;
+    
+    /**
+     * \brief Layout of a member of the group.
+     *
+     * \param[in] member Index of the member, in the order given to Initialise.
+     */
+    const JoyGroupMember &Member( size_t member ) const;
+    
+    /**
+     * \brief Query the group for IO capabilities
+     *
+     * \return An vector containing the total number of axes, buttons, pov, outputs
+     */
+    vector<int> QueryIO( void ) const;
+    
+    /**
+     * \brief Poll every member in one pass. Any of the buffers may be NULL to skip that
+     *  type, otherwise they must hold the group's total count of that type.
+     *
+     * \param[out] axes Normalised axes.
+     * \param[out] buttons Button states (0 or 1).
+     * \param[out] povs POV angles (degrees, or -1 for nothing pressed).
+     */
+    void PollInto( double *axes, uint8_t *buttons, double *povs );
+    
+    /**
+     * \brief Poll every member's axes into a caller supplied buffer.
+     *
+     * \param[out] dest Buffer for the normalised axes.
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Total number of axes in the group.
+     */
+    size_t PollAxesInto( double *dest, size_t len );
+    
+    /**
+     * \brief Read every member's newest axes from any thread (see
+     *  Joystick::ReadAxesInto).
+     *
+     * \param[out] dest Buffer for the normalised axes.
+     * \param[out] scratch Buffer for raw values, as long as the group's total of axes.
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Total number of axes in the group.
+     */
+    size_t ReadAxesInto( double *dest, int32_t *scratch, size_t len ) const;
+    
+    /**
+     * \brief Poll every member's axes into a caller supplied buffer of another type
+     *  (see Joystick::PollAxes). The integer types read raw counts.
+     *
+     * \param[out] dest Buffer for the axes.
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Total number of axes in the group.
+     */
+    template<typename T> size_t PollAxes( T *dest, size_t len );
+    
+    /**
+     * \brief The logical range shared by every axis in the group, which a single
+     *  scaling of the raw counts then suits.
+     *
+     * \param[out] logmin Logical minimum.
+     * \param[out] logmax Logical maximum.
+     * \return true if successful, false if there are no axes or their ranges differ.
+     */
+    bool CommonAxisRange( int32_t &logmin, int32_t &logmax ) const;
+    
+    /**
+     * \brief Logical range of one of the group's axes (see Joystick::AxisRange).
+     *
+     * \param[in] axis Index of the axis, laid out as for the member offsets.
+     * \param[out] logmin Logical minimum.
+     * \param[out] logmax Logical maximum.
+     * \return true if successful, false if there is no such axis.
+     */
+    bool AxisRange( size_t axis, int32_t &logmin, int32_t &logmax ) const;
+    
+    /**
+     * \brief Process every member's axes (see Joystick::SetAxisProcessing), until
+     *  ClearAxisProcessing or Close is called.
+     *
+     * \param[in] config Processing of each axis, laid out as for the member offsets.
+     * \param[in] len Length of config. Axes beyond len are left as they are.
+     * \param[in] rate Rate at which the axes are polled (Hz), for the filters.
+     * \return true if successful, false if a setting is out of range (no axis is then
+     *  processed).
+     */
+    bool SetAxisProcessing( const AxisProcessing *config, size_t len, double rate );
+    
+    /**
+     * \brief Stop processing the axes of every member.
+     */
+    void ClearAxisProcessing( void );
+    
+    /**
+     * \brief Poll every member's buttons into a caller supplied buffer.
+     *
+     * \param[out] dest Buffer for the button states (0 or 1).
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Total number of buttons in the group.
+     */
+    size_t PollButtonsInto( uint8_t *dest, size_t len );
+    
+    /**
+     * \brief Poll every member's POV hats into a caller supplied buffer.
+     *
+     * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Total number of POV hats in the group.
+     */
+    size_t PollPOVInto( double *dest, size_t len );
+    
+    /**
+     * \brief Poll every member's POV hats into a caller supplied buffer of another type
+     *  (see Joystick::PollPOV).
+     *
+     * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+     * \param[in] len Length of dest. At most len values are written.
+     * \output Total number of POV hats in the group.
+     */
+    template<typename T> size_t PollPOV( T *dest, size_t len );
+    
+    /**
+     * \brief Choose what every member's relative axes read as (see
+     *  Joystick::SetRelativeMode).
+     */
+    void SetRelativeMode( AxisRelativeMode mode );
+    
+    /**
+     * \brief Move the origin of every member's relative axes to their current position
+     *  (see Joystick::ResetRelativeAxes).
+     */
+    void ResetRelativeAxes( void );
+    
+    /**
+     * \brief Record every sample of every member, for PollFrames (see
+     *  Joystick::EnableFrames).
+     *
+     * \param[in] capacity Number of samples each member's ring must hold between polls.
+     * \return true if successful, false if any member doesn't support frames.
+     */
+    bool EnableFrames( size_t capacity );
+    
+    /**
+     * \brief Poll every member's samples since the last call, as frames (see
+     *  Joystick::PollFrames). The members' columns are laid out as for the member offsets.
+     *
+     * \param[in] frameSize Number of rows.
+     * \param[out] counts Number of new samples of each member, Size() long (may be NULL).
+     * \param[out] axes Normalised axes, frameSize by the total number of axes.
+     * \param[out] buttons Button states (0 or 1), frameSize by the total number of buttons.
+     * \param[out] povs POV angles, frameSize by the total number of POV hats.
+     */
+    void PollFrames( size_t frameSize, double *counts, double *axes, uint8_t *buttons,
+                                                                         double *povs );
+    
+    /**
+     * \brief Queue every member's button presses and releases (see
+     *  Joystick::EnableButtonEdges).
+     *
+     * \param[in] capacity Number of edges each member's queue must hold between polls.
+     * \return true if successful, false if any member doesn't support button edges.
+     */
+    bool EnableButtonEdges( size_t capacity );
+    
+    /**
+     * \brief Summarise every member's button edges since the last call (see
+     *  Joystick::PollButtonEdgeCounts). The buffers are laid out as for the member
+     *  offsets, and any may be NULL.
+     *
+     * \param[out] presses Number of presses of each button.
+     * \param[out] releases Number of releases of each button.
+     * \param[out] latched Whether each button was down at any time since the last call.
+     * \param[in] len Length of the buffers. At most len buttons are written.
+     * \output Total number of buttons in the group.
+     */
+    size_t PollButtonEdgeCounts( double *presses, double *releases, uint8_t *latched,
+                                                                          size_t len );
+    
+    /**
+     * \brief Age of each member's newest sample (see Joystick::SampleAge).
+     *
+     * \param[out] dest Ages in microseconds, or -1 if unknown, Size() long.
+     */
+    void SampleAges( double *dest );
+    
+    /**
+     * \brief Push values to the members' inputs (such as force feedback).
+     *
+     * \param[in] normInputs Normalised values, laid out as for the member offsets.
+     * \param[in] len Length of normInputs. Outputs beyond len are left unchanged.
+     */
+    void PushInputs( const double *normInputs, size_t len );
+    
+    /**
+     * \brief Mark the end of a simulation step for every member (see
+     *  Joystick::EndStep).
+     */
+    void EndStep( void );
+    
+  private:
+    vector<Joystick *> myJoysticks;
+    vector<JoyGroupMember> myMembers;
+    size_t myTotals[4];
+    // Whether each member has been claimed from the pool (see Claim)
+    vector<bool> myClaimed;
+    // Whether the members are owned by the group (replays) rather than the pool
+    bool myOwned;
+    bool myCapturing;
+    bool myProcessing;
+    
+    /**
+     * \brief Append a member to the layout.
+     */
+    void AddMember( Joystick *joy, int32_t locationKey );
+    
+    /**
+     * \brief Claim a member from the session pool (see JoySessionPool::Claim), before
+     *  changing its per user state. Does nothing for a replay.
+     *
+     * \param[in] member Index of the member.
+     * \return true if successful, false if the member couldn't be claimed.
+     */
+    bool Claim( size_t member );
+    
+    // Non-copyable
+    JoystickGroup( const JoystickGroup & );
+    JoystickGroup &operator=( const JoystickGroup & );
+};
+
+#endif
@@ -0,0 +1,253 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joyregistry.hpp"
+#include <algorithm>
+#include <cstdio>
+
+/**
+ * \brief Not a member of Joystick, instead a compare function for sorting JoyDevs.
+ */
+bool JoyDevCompare( JoyDev i, JoyDev j )
+{
+  return ( i.locationKey < j.locationKey );
+}
+
+/**
+ * \brief JoyRegistry constructor. The registry starts empty.
+ */
+JoyRegistry::JoyRegistry()
+{
+  pthread_mutex_init( &myMutex, NULL );
+  mySortedValid = false;
+  myGeneration = 0;
+  myRetain = NULL;
+  myRelease = NULL;
+}
+
+/**
+ * \brief JoyRegistry destructor. Releases the handles of any remaining devices.
+ */
+JoyRegistry::~JoyRegistry()
+{
+  if( myRelease != NULL )
+  {
+    for( LocationMap::iterator it=myByLocation.begin(); it!=myByLocation.end(); ++it )
+    {
+      myRelease( it->second.handle );
+    }
+  }
+  pthread_mutex_destroy( &myMutex );
+}
+
+/**
+ * \brief Set the functions used to retain and release device handles. Either may be
+ *  NULL if the handles don't need reference counting.
+ */
+void JoyRegistry::SetHandleCallbacks( HandleFn retain, HandleFn release )
+{
+  pthread_mutex_lock( &myMutex );
+  myRetain = retain;
+  myRelease = release;
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Add (or replace) a device. Called from the device matching callback.
+ *
+ * \param[in] entry Device description. The handle is retained by the registry.
+ */
+void JoyRegistry::Add( const JoyDeviceEntry &entry )
+{
+  pthread_mutex_lock( &myMutex );
+  RemoveLocked( entry.locationKey );
+  if( myRetain != NULL ) myRetain( entry.handle );
+  myByLocation[ entry.locationKey ] = entry;
+  // Identical devices without serial numbers share a key; the first one wins.
+  std::string key = IdentityKey( entry.vendorID, entry.productID, entry.serialNumber );
+  if( myByIdentity.find( key ) == myByIdentity.end() )
+  {
+    myByIdentity[ key ] = entry.locationKey;
+  }
+  mySortedValid = false;
+  myGeneration++;
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Remove a device. Called from the device removal callback.
+ *
+ * \param[in] locationKey Location key of the removed device.
+ * \return true if the device was in the registry.
+ */
+bool JoyRegistry::Remove( int32_t locationKey )
+{
+  pthread_mutex_lock( &myMutex );
+  bool found = RemoveLocked( locationKey );
+  pthread_mutex_unlock( &myMutex );
+  return found;
+}
+
+/**
+ * \brief Look up a device by its location key.
+ *
+ * \param[in] locationKey Location key of the device.
+ * \param[out] entry Device description. If found, the handle has been retained and
+ *  must be given back with ReleaseHandle.
+ * \return true if the device was found.
+ */
+bool JoyRegistry::FindByLocation( int32_t locationKey, JoyDeviceEntry &entry )
+{
+  pthread_mutex_lock( &myMutex );
+  LocationMap::iterator it = myByLocation.find( locationKey );
+  bool found = ( it != myByLocation.end() );
+  if( found )
+  {
+    entry = it->second;
+    if( myRetain != NULL ) myRetain( entry.handle );
+  }
+  pthread_mutex_unlock( &myMutex );
+  return found;
+}
+
+/**
+ * \brief Look up a device by vendor ID, product ID and serial number. If several
+ *  identical devices are attached, the first to be added is returned.
+ *
+ * \param[out] entry As for FindByLocation.
+ * \return true if the device was found.
+ */
+bool JoyRegistry::FindByIdentity( int32_t vendorID, int32_t productID,
+                                  const std::string &serial, JoyDeviceEntry &entry )
+{
+  pthread_mutex_lock( &myMutex );
+  IdentityMap::iterator it = myByIdentity.find( IdentityKey( vendorID, productID, serial ) );
+  int32_t locationKey = 0;
+  bool found = ( it != myByIdentity.end() );
+  if( found ) locationKey = it->second;
+  pthread_mutex_unlock( &myMutex );
+  return found && FindByLocation( locationKey, entry );
+}
+
+/**
+ * \brief Give back a handle returned by one of the Find functions.
+ */
+void JoyRegistry::ReleaseHandle( void *handle )
+{
+  if( myRelease != NULL ) myRelease( handle );
+}
+
+/**
+ * \brief All attached devices, sorted by location key.
+ */
+std::vector<JoyDev> JoyRegistry::Devices( void )
+{
+  pthread_mutex_lock( &myMutex );
+  // Only re-sort after the device list has changed
+  if( !mySortedValid )
+  {
+    mySorted.clear();
+    for( LocationMap::iterator it=myByLocation.begin(); it!=myByLocation.end(); ++it )
+    {
+      JoyDev dev;
+      dev.productKey = it->second.productKey;
+      dev.locationKey = it->second.locationKey;
+      mySorted.push_back( dev );
+    }
+    std::sort( mySorted.begin(), mySorted.end(), JoyDevCompare );
+    mySortedValid = true;
+  }
+  std::vector<JoyDev> result( mySorted );
+  pthread_mutex_unlock( &myMutex );
+  return result;
+}
+
+/**
+ * \brief Number of attached devices.
+ */
+size_t JoyRegistry::Size( void )
+{
+  pthread_mutex_lock( &myMutex );
+  size_t size = myByLocation.size();
+  pthread_mutex_unlock( &myMutex );
+  return size;
+}
+
+/**
+ * \brief Counter that changes every time a device is added or removed.
+ */
+uint32_t JoyRegistry::Generation( void )
+{
+  pthread_mutex_lock( &myMutex );
+  uint32_t generation = myGeneration;
+  pthread_mutex_unlock( &myMutex );
+  return generation;
+}
+
+/**
+ * \brief Remove a device (myMutex must be held).
+ */
+bool JoyRegistry::RemoveLocked( int32_t locationKey )
+{
+  LocationMap::iterator it = myByLocation.find( locationKey );
+  if( it == myByLocation.end() ) return false;
+  
+  std::string key = IdentityKey( it->second.vendorID, it->second.productID,
+                                                          it->second.serialNumber );
+  IdentityMap::iterator id = myByIdentity.find( key );
+  if( id != myByIdentity.end() && id->second == locationKey )
+  {
+    myByIdentity.erase( id );
+    // Hand the identity over to another identical device, if there is one
+    for( LocationMap::iterator other=myByLocation.begin(); other!=myByLocation.end(); ++other )
+    {
+      if( other != it && IdentityKey( other->second.vendorID, other->second.productID,
+                                      other->second.serialNumber ) == key )
+      {
+        myByIdentity[ key ] = other->first;
+        break;
+      }
+    }
+  }
+  
+  if( myRelease != NULL ) myRelease( it->second.handle );
+  myByLocation.erase( it );
+  mySortedValid = false;
+  myGeneration++;
+  return true;
+}
+
+/**
+ * \brief Key for the vendor/product/serial map.
+ */
+std::string JoyRegistry::IdentityKey( int32_t vendorID, int32_t productID,
+                                                          const std::string &serial )
+{
+  char buffer[32];
+  snprintf( buffer, sizeof(buffer), "%08x:%08x:", (unsigned)vendorID, (unsigned)productID );
+  return std::string( buffer ) + serial;
+}
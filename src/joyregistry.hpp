@@ -0,0 +1,180 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYREGISTRY_H__
+#define __JOYREGISTRY_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <tr1/unordered_map>
+
+/**
+ * \brief Class for joystick object descriptions. Contains public productKey and locationKey.
+ */
+class JoyDev
+{
+  public:
+    std::string productKey;
+    int32_t locationKey;
+};
+
+/**
+ * \brief Not a member of Joystick, instead a compare function for sorting JoyDevs.
+ */
+bool JoyDevCompare( JoyDev i, JoyDev j );
+
+/**
+ * \brief Everything the registry knows about an attached device.
+ */
+struct JoyDeviceEntry
+{
+  int32_t locationKey;
+  std::string productKey;
+  int32_t vendorID;
+  int32_t productID;
+  std::string serialNumber;
+  // Backend specific device handle (an io_service_t on OS X).
+  void *handle;
+};
+
+/**
+ * \brief Registry of the attached joysticks, kept up to date by device matching and
+ *  removal callbacks.
+ *
+ * Lookups by location key, and by vendor/product/serial, are hash map lookups. The
+ * registry is safe to use from several threads.
+ */
+class JoyRegistry
+{
+  public:
+    /**
+     * \brief Function used to retain or release a device handle.
+     */
+    typedef void (*HandleFn)( void *handle );
+    
+    /**
+     * \brief JoyRegistry constructor. The registry starts empty.
+     */
+    JoyRegistry();
+    
+    /**
+     * \brief JoyRegistry destructor. Releases the handles of any remaining devices.
+     */
+    ~JoyRegistry();
+    
+    /**
+     * \brief Set the functions used to retain and release device handles. Either may be
+     *  NULL if the handles don't need reference counting.
+     */
+    void SetHandleCallbacks( HandleFn retain, HandleFn release );
+    
+    /**
+     * \brief Add (or replace) a device. Called from the device matching callback.
+     *
+     * \param[in] entry Device description. The handle is retained by the registry.
+     */
+    void Add( const JoyDeviceEntry &entry );
+    
+    /**
+     * \brief Remove a device. Called from the device removal callback.
+     *
+     * \param[in] locationKey Location key of the removed device.
+     * \return true if the device was in the registry.
+     */
+    bool Remove( int32_t locationKey );
+    
+    /**
+     * \brief Look up a device by its location key.
+     *
+     * \param[in] locationKey Location key of the device.
+     * \param[out] entry Device description. If found, the handle has been retained and
+     *  must be given back with ReleaseHandle.
+     * \return true if the device was found.
+     */
+    bool FindByLocation( int32_t locationKey, JoyDeviceEntry &entry );
+    
+    /**
+     * \brief Look up a device by vendor ID, product ID and serial number. If several
+     *  identical devices are attached, the first to be added is returned.
+     *
+     * \param[out] entry As for FindByLocation.
+     * \return true if the device was found.
+     */
+    bool FindByIdentity( int32_t vendorID, int32_t productID, const std::string &serial,
+                                                               JoyDeviceEntry &entry );
+    
+    /**
+     * \brief Give back a handle returned by one of the Find functions.
+     */
+    void ReleaseHandle( void *handle );
+    
+    /**
+     * \brief All attached devices, sorted by location key.
+     */
+    std::vector<JoyDev> Devices( void );
+    
+    /**
+     * \brief Number of attached devices.
+     */
+    size_t Size( void );
+    
+    /**
+     * \brief Counter that changes every time a device is added or removed.
+     */
+    uint32_t Generation( void );
+    
+  private:
+    typedef std::tr1::unordered_map<int32_t, JoyDeviceEntry> LocationMap;
+    typedef std::tr1::unordered_map<std::string, int32_t> IdentityMap;
+    
+    pthread_mutex_t myMutex;
+    LocationMap myByLocation;
+    IdentityMap myByIdentity;
+    std::vector<JoyDev> mySorted;
+    bool mySortedValid;
+    uint32_t myGeneration;
+    HandleFn myRetain, myRelease;
+    
+    /**
+     * \brief Remove a device (myMutex must be held).
+     */
+    bool RemoveLocked( int32_t locationKey );
+    
+    /**
+     * \brief Key for the vendor/product/serial map.
+     */
+    static std::string IdentityKey( int32_t vendorID, int32_t productID,
+                                                          const std::string &serial );
+    
+    // Non-copyable
+    JoyRegistry( const JoyRegistry & );
+    JoyRegistry &operator=( const JoyRegistry & );
+};
+
+#endif
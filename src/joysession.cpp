@@ -0,0 +1,453 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joysession.hpp"
+#include <cstdlib>
+#include <sys/time.h>
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief Pool key for a location key and acquisition mode.
+ */
+static uint64_t SessionKey( int32_t joyLocation, JoystickAcquisition mode )
+{
+  return ( (uint64_t)(uint32_t)joyLocation << 32 ) | (uint32_t)mode;
+}
+
+/**
+ * \brief Registry generation that sessions of the given mode follow. Shared joysticks
+ *  follow the daemon's devices, without starting the registry here.
+ */
+static uint32_t CurrentGeneration( JoystickAcquisition mode )
+{
+  if( mode == kJoystick_Shared )
+  {
+    JoyShmSegment *segment = SharedJoyShm();
+    return segment != NULL ? segment->Generation() : 0;
+  }
+  return SharedJoyRegistry().Generation();
+}
+
+/**
+ * \brief The process wide session pool. The idle timeout may be set (in seconds) with
+ *  the OSX_JOYSTICK_IDLE_TIMEOUT environment variable, such as with setenv in Matlab.
+ */
+JoySessionPool &SharedJoySessionPool( void )
+{
+  // The registry must outlive the pool, so make sure it is constructed first
+  SharedJoyRegistry();
+  static JoySessionPool pool;
+  static bool configured = false;
+  if( !configured )
+  {
+    const char *timeout = getenv( "OSX_JOYSTICK_IDLE_TIMEOUT" );
+    if( timeout != NULL ) pool.SetIdleTimeout( atof( timeout ) );
+    configured = true;
+  }
+  return pool;
+}
+
+/**
+ * \brief JoySessionPool constructor. The default idle timeout is 30 seconds.
+ */
+JoySessionPool::JoySessionPool()
+{
+  myIdleTimeout = 30.0;
+  myCheckedGeneration = 0;
+  myStats.acquires = 0;
+  myStats.opens = 0;
+  myStats.reused = 0;
+  myStats.reaped = 0;
+  myStats.openSeconds = 0.0;
+  myStats.savedSeconds = 0.0;
+  myReaperStarted = false;
+  myReaperRunning = false;
+  pthread_mutex_init( &myMutex, NULL );
+  pthread_cond_init( &myCond, NULL );
+}
+
+/**
+ * \brief JoySessionPool destructor. Closes every session, held or not.
+ */
+JoySessionPool::~JoySessionPool()
+{
+  pthread_mutex_lock( &myMutex );
+  myReaperRunning = false;
+  pthread_cond_signal( &myCond );
+  pthread_mutex_unlock( &myMutex );
+  if( myReaperStarted ) pthread_join( myReaper, NULL );
+  
+  while( !mySessions.empty() ) CloseLocked( mySessions.begin() );
+  pthread_cond_destroy( &myCond );
+  pthread_mutex_destroy( &myMutex );
+}
+
+/**
+ * \brief Set how long a session may stay idle before it is closed.
+ *
+ * \param[in] seconds Idle timeout. Zero closes sessions as soon as they are released,
+ *  and a negative value keeps them open until Flush is called.
+ */
+void JoySessionPool::SetIdleTimeout( double seconds )
+{
+  pthread_mutex_lock( &myMutex );
+  myIdleTimeout = seconds;
+  ReapLocked( Now() );
+  // Let the reaper pick up the new expiry times
+  pthread_cond_signal( &myCond );
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief The idle timeout (seconds).
+ */
+double JoySessionPool::IdleTimeout( void )
+{
+  pthread_mutex_lock( &myMutex );
+  double timeout = myIdleTimeout;
+  pthread_mutex_unlock( &myMutex );
+  return timeout;
+}
+
+/**
+ * \brief Get an open Joystick for the given location key, opening it if necessary.
+ *
+ * \param[in] joyLocation LocationKey of the Joystick.
+ * \param[in] mode Acquisition mode. Sessions are not shared between modes.
+ * \return The Joystick, or NULL if it could not be initialised. Must be given back
+ *  with Release, and must not be deleted.
+ */
+Joystick *JoySessionPool::Acquire( int32_t joyLocation, JoystickAcquisition mode )
+{
+  uint64_t key = SessionKey( joyLocation, mode );
+  uint32_t generation = CurrentGeneration( mode );
+  
+  pthread_mutex_lock( &myMutex );
+  myStats.acquires++;
+  if( mode != kJoystick_Shared ) CloseRemovedLocked( generation );
+  // Claimed sessions aren't shared, so look for the unclaimed one
+  SessionMap::iterator it = mySessions.lower_bound( key );
+  while( it != mySessions.end() && it->first == key && it->second.claimed ) ++it;
+  if( it != mySessions.end() && it->first != key ) it = mySessions.end();
+  // An idle session may refer to a device that has since been removed (or replaced).
+  if( it != mySessions.end() && it->second.refs == 0 && it->second.generation != generation )
+  {
+    CloseLocked( it );
+    it = mySessions.end();
+  }
+  if( it != mySessions.end() )
+  {
+    it->second.refs++;
+    myStats.reused++;
+    myStats.savedSeconds = myStats.reused * ( myStats.openSeconds / myStats.opens );
+    Joystick *joy = it->second.joy;
+    pthread_mutex_unlock( &myMutex );
+    return joy;
+  }
+  
+  it = OpenLocked( key, generation, false );
+  Joystick *joy = it != mySessions.end() ? it->second.joy : NULL;
+  pthread_mutex_unlock( &myMutex );
+  return joy;
+}
+
+/**
+ * \brief Take sole use of a Joystick returned by Acquire, so that its per user state
+ *  (see the class description) can be changed. If nobody else holds it, it is no
+ *  longer handed out by Acquire. Otherwise a separate Joystick is opened on the same
+ *  device, and the one given is released.
+ *
+ * \param[in] joy Joystick returned by Acquire (or by an earlier Claim).
+ * \return The Joystick to use in place of joy (which it may be), or NULL if a
+ *  separate one could not be opened, in which case joy is still held.
+ */
+Joystick *JoySessionPool::Claim( Joystick *joy )
+{
+  pthread_mutex_lock( &myMutex );
+  SessionMap::iterator it = FindLocked( joy );
+  if( it == mySessions.end() )
+  {
+    ERR_PRINTF("JoySessionPool::Claim - Joystick is not from this pool.\n");
+    pthread_mutex_unlock( &myMutex );
+    return NULL;
+  }
+  if( it->second.refs <= 1 || it->second.claimed )
+  {
+    it->second.claimed = true;
+    pthread_mutex_unlock( &myMutex );
+    return joy;
+  }
+  
+  // Others hold it, so leave it to them and open another on the same device
+  uint64_t key = it->first;
+  JoystickAcquisition mode = (JoystickAcquisition)(uint32_t)key;
+  SessionMap::iterator claimed = OpenLocked( key, CurrentGeneration( mode ), true );
+  if( claimed == mySessions.end() )
+  {
+    pthread_mutex_unlock( &myMutex );
+    return NULL;
+  }
+  it->second.refs--;
+  pthread_mutex_unlock( &myMutex );
+  return claimed->second.joy;
+}
+
+/**
+ * \brief Give back a Joystick returned by Acquire or Claim. NULL is ignored.
+ */
+void JoySessionPool::Release( Joystick *joy )
+{
+  if( joy == NULL ) return;
+  pthread_mutex_lock( &myMutex );
+  SessionMap::iterator it = FindLocked( joy );
+  if( it == mySessions.end() )
+  {
+    ERR_PRINTF("JoySessionPool::Release - Joystick is not from this pool.\n");
+    pthread_mutex_unlock( &myMutex );
+    return;
+  }
+  if( it->second.refs > 0 ) it->second.refs--;
+  if( it->second.refs == 0 )
+  {
+    // The holder has put back its per user state, so the session may be shared again,
+    // unless the device already has a shared session.
+    it->second.claimed = false;
+    it->second.idleSince = Now();
+    bool shared = false;
+    for( SessionMap::iterator other = mySessions.lower_bound( it->first );
+         other != mySessions.end() && other->first == it->first; ++other )
+    {
+      if( other != it && !other->second.claimed ) shared = true;
+    }
+    if( myIdleTimeout == 0.0 || shared ) CloseLocked( it );
+    else if( myIdleTimeout > 0.0 )
+    {
+      if( !myReaperStarted )
+      {
+        myReaperRunning = true;
+        if( pthread_create( &myReaper, NULL, &JoySessionPool::ReaperThread, this ) == 0 )
+        {
+          myReaperStarted = true;
+        }
+        else
+        {
+          // Sessions are still reaped on SetIdleTimeout, or closed on Flush.
+          myReaperRunning = false;
+          ERR_PRINTF("JoySessionPool::Release - Failed to start the reaper thread.\n");
+        }
+      }
+      pthread_cond_signal( &myCond );
+    }
+  }
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Close every idle session now.
+ */
+void JoySessionPool::Flush( void )
+{
+  pthread_mutex_lock( &myMutex );
+  SessionMap::iterator it = mySessions.begin();
+  while( it != mySessions.end() )
+  {
+    SessionMap::iterator current = it++;
+    if( current->second.refs == 0 ) CloseLocked( current );
+  }
+  pthread_mutex_unlock( &myMutex );
+}
+
+/**
+ * \brief Number of open sessions (held or idle).
+ */
+size_t JoySessionPool::Size( void )
+{
+  pthread_mutex_lock( &myMutex );
+  size_t size = mySessions.size();
+  pthread_mutex_unlock( &myMutex );
+  return size;
+}
+
+/**
+ * \brief A copy of the pool's counters.
+ */
+JoySessionStats JoySessionPool::Stats( void )
+{
+  pthread_mutex_lock( &myMutex );
+  JoySessionStats stats = myStats;
+  pthread_mutex_unlock( &myMutex );
+  return stats;
+}
+
+/**
+ * \brief The session of a Joystick, or mySessions.end() if it isn't from this pool
+ *  (myMutex must be held).
+ */
+JoySessionPool::SessionMap::iterator JoySessionPool::FindLocked( Joystick *joy )
+{
+  std::map<Joystick *, uint64_t>::iterator kk = myKeys.find( joy );
+  if( kk == myKeys.end() ) return mySessions.end();
+  SessionMap::iterator it = mySessions.lower_bound( kk->second );
+  while( it->second.joy != joy ) ++it;
+  return it;
+}
+
+/**
+ * \brief Open a session (myMutex must be held).
+ *
+ * \output The session, or mySessions.end() if the Joystick could not be initialised.
+ */
+JoySessionPool::SessionMap::iterator JoySessionPool::OpenLocked( uint64_t key,
+                                                 uint32_t generation, bool claimed )
+{
+  int32_t joyLocation = (int32_t)(uint32_t)( key >> 32 );
+  double start = Now();
+  Joystick *joy = new Joystick;
+  if( !joy->Initialise( joyLocation, (JoystickAcquisition)(uint32_t)key ) )
+  {
+    ERR_PRINTF("JoySessionPool::OpenLocked - Failed to initialise joystick %i.\n", joyLocation);
+    delete joy;
+    return mySessions.end();
+  }
+  myStats.opens++;
+  myStats.openSeconds += Now() - start;
+  myStats.savedSeconds = myStats.reused * ( myStats.openSeconds / myStats.opens );
+  
+  Session session;
+  session.joy = joy;
+  session.refs = 1;
+  session.idleSince = 0.0;
+  session.generation = generation;
+  session.claimed = claimed;
+  myKeys[ joy ] = key;
+  return mySessions.insert( std::make_pair( key, session ) );
+}
+
+/**
+ * \brief Close the idle sessions of devices no longer in the registry, if the
+ *  registry has changed since the last call (myMutex must be held).
+ *
+ * \param[in] generation Current registry generation.
+ */
+void JoySessionPool::CloseRemovedLocked( uint32_t generation )
+{
+  if( generation == myCheckedGeneration ) return;
+  myCheckedGeneration = generation;
+  JoyRegistry &registry = SharedJoyRegistry();
+  SessionMap::iterator it = mySessions.begin();
+  while( it != mySessions.end() )
+  {
+    SessionMap::iterator current = it++;
+    // Shared joysticks follow the daemon's devices instead
+    if( current->second.refs != 0 ||
+        (JoystickAcquisition)(uint32_t)current->first == kJoystick_Shared ) continue;
+    JoyDeviceEntry entry;
+    if( registry.FindByLocation( (int32_t)(uint32_t)( current->first >> 32 ), entry ) )
+    {
+      registry.ReleaseHandle( entry.handle );
+    }
+    else CloseLocked( current );
+  }
+}
+
+/**
+ * \brief Close a session (myMutex must be held).
+ */
+void JoySessionPool::CloseLocked( SessionMap::iterator it )
+{
+  myKeys.erase( it->second.joy );
+  delete it->second.joy;
+  mySessions.erase( it );
+}
+
+/**
+ * \brief Close the sessions idle for longer than the timeout (myMutex must be held).
+ *
+ * \return Time at which the next idle session expires, or a negative number if none
+ *  will.
+ */
+double JoySessionPool::ReapLocked( double now )
+{
+  if( myIdleTimeout < 0.0 ) return -1.0;
+  double next = -1.0;
+  SessionMap::iterator it = mySessions.begin();
+  while( it != mySessions.end() )
+  {
+    SessionMap::iterator current = it++;
+    if( current->second.refs != 0 ) continue;
+    double expiry = current->second.idleSince + myIdleTimeout;
+    if( expiry <= now )
+    {
+      CloseLocked( current );
+      myStats.reaped++;
+    }
+    else if( next < 0.0 || expiry < next ) next = expiry;
+  }
+  return next;
+}
+
+/**
+ * \brief Reaper thread. Closes idle sessions as they expire.
+ */
+void *JoySessionPool::ReaperThread( void *context )
+{
+  JoySessionPool *pool = (JoySessionPool *)context;
+  pthread_mutex_lock( &pool->myMutex );
+  while( pool->myReaperRunning )
+  {
+    double next = pool->ReapLocked( Now() );
+    if( next < 0.0 )
+    {
+      pthread_cond_wait( &pool->myCond, &pool->myMutex );
+    }
+    else
+    {
+      struct timespec deadline;
+      deadline.tv_sec = (time_t)next;
+      deadline.tv_nsec = (long)( ( next - (double)deadline.tv_sec ) * 1e9 );
+      pthread_cond_timedwait( &pool->myCond, &pool->myMutex, &deadline );
+    }
+  }
+  pthread_mutex_unlock( &pool->myMutex );
+  return NULL;
+}
+
+/**
+ * \brief Wall clock time in seconds.
+ */
+double JoySessionPool::Now( void )
+{
+  struct timeval tv;
+  gettimeofday( &tv, NULL );
+  return (double)tv.tv_sec + 1e-6 * (double)tv.tv_usec;
+}
@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYSESSION_H__
+#define __JOYSESSION_H__
+
+#include <map>
+#include <stdint.h>
+#include <pthread.h>
+#include "osx_joystick.hpp"
+
+/**
+ * \brief Counters kept by the session pool, to show the device bring-up time it saves.
+ */
+struct JoySessionStats
+{
+  // Number of Acquire calls
+  uint32_t acquires;
+  // Number of sessions opened (Acquire calls that missed the pool)
+  uint32_t opens;
+  // Number of Acquire calls answered by an already open session
+  uint32_t reused;
+  // Number of idle sessions closed by the timeout
+  uint32_t reaped;
+  // Total time (seconds) spent opening sessions
+  double openSeconds;
+  // Estimated time (seconds) saved by reuse, at the mean open time
+  double savedSeconds;
+};
+
+/**
+ * \brief Process wide pool of open Joysticks, reference counted and keyed by location
+ *  key and acquisition mode.
+ *
+ * The s-function opens a joystick in mdlCheckParameters, mdlInitializeSizes and
+ * mdlStart of every run. With the pool these all share one Joystick, which also stays
+ * open between back to back simulations. A session that nobody holds is closed once it
+ * has been idle for the idle timeout, or reopened on its next Acquire if a device has
+ * been attached or removed in the meantime. The idle sessions of removed devices are
+ * closed on the next Acquire of any device.
+ *
+ * A Joystick also holds state for whoever polls it: the frame ring, the button edge
+ * queue, the axis processing (with its filter state), the relative axes and any
+ * capture. A user that needs any of these claims its Joystick first, which then stops
+ * being shared.
+ */
+class JoySessionPool
+{
+  public:
+    /**
+     * \brief JoySessionPool constructor. The default idle timeout is 30 seconds.
+     */
+    JoySessionPool();
+    
+    /**
+     * \brief JoySessionPool destructor. Closes every session, held or not.
+     */
+    ~JoySessionPool();
+    
+    /**
+     * \brief Set how long a session may stay idle before it is closed.
+     *
+     * \param[in] seconds Idle timeout. Zero closes sessions as soon as they are released,
+     *  and a negative value keeps them open until Flush is called.
+     */
+    void SetIdleTimeout( double seconds );
+    
+    /**
+     * \brief The idle timeout (seconds).
+     */
+    double IdleTimeout( void );
+    
+    /**
+     * \brief Get an open Joystick for the given location key, opening it if necessary.
+     *
+     * \param[in] joyLocation LocationKey of the Joystick.
+     * \param[in] mode Acquisition mode. Sessions are not shared between modes.
+     * \return The Joystick, or NULL if it could not be initialised. Must be given back
+     *  with Release, and must not be deleted.
+     */
+    Joystick *Acquire( int32_t joyLocation, JoystickAcquisition mode );
+    
+    /**
+     * \brief Take sole use of a Joystick returned by Acquire, so that its per user state
+     *  (see the class description) can be changed. If nobody else holds it, it is no
+     *  longer handed out by Acquire. Otherwise a separate Joystick is opened on the same
+     *  device, and the one given is released.
+     *
+     * \param[in] joy Joystick returned by Acquire (or by an earlier Claim).
+     * \return The Joystick to use in place of joy (which it may be), or NULL if a
+     *  separate one could not be opened, in which case joy is still held.
+     */
+    Joystick *Claim( Joystick *joy );
+    
+    /**
+     * \brief Give back a Joystick returned by Acquire or Claim. NULL is ignored.
+     */
+    void Release( Joystick *joy );
+    
+    /**
+     * \brief Close every idle session now.
+     */
+    void Flush( void );
+    
+    /**
+     * \brief Number of open sessions (held or idle).
+     */
+    size_t Size( void );
+    
+    /**
+     * \brief A copy of the pool's counters.
+     */
+    JoySessionStats Stats( void );
+    
+  private:
+    struct Session
+    {
+      Joystick *joy;
+      unsigned int refs;
+      // Time the session was last released (valid when refs is 0)
+      double idleSince;
+      // Registry generation when the session was opened
+      uint32_t generation;
+      // Whether the session has been claimed (see Claim), so isn't shared
+      bool claimed;
+    };
+    typedef std::multimap<uint64_t, Session> SessionMap;
+    
+    SessionMap mySessions;
+    std::map<Joystick *, uint64_t> myKeys;
+    double myIdleTimeout;
+    JoySessionStats myStats;
+    // Registry generation when the idle sessions were last checked for removed devices
+    uint32_t myCheckedGeneration;
+    pthread_mutex_t myMutex;
+    pthread_cond_t myCond;
+    pthread_t myReaper;
+    bool myReaperStarted;
+    volatile bool myReaperRunning;
+    
+    /**
+     * \brief The session of a Joystick, or mySessions.end() if it isn't from this pool
+     *  (myMutex must be held).
+     */
+    SessionMap::iterator FindLocked( Joystick *joy );
+    
+    /**
+     * \brief Open a session (myMutex must be held).
+     *
+     * \return The session, or mySessions.end() if the Joystick could not be initialised.
+     */
+    SessionMap::iterator OpenLocked( uint64_t key, uint32_t generation, bool claimed );
+    
+    /**
+     * \brief Close the idle sessions of devices no longer in the registry, if the
+     *  registry has changed since the last call (myMutex must be held).
+     *
+     * \param[in] generation Current registry generation.
+     */
+    void CloseRemovedLocked( uint32_t generation );
+    
+    /**
+     * \brief Close a session (myMutex must be held).
+     */
+    void CloseLocked( SessionMap::iterator it );
+    
+    /**
+     * \brief Close the sessions idle for longer than the timeout (myMutex must be held).
+     *
+     * \return Time at which the next idle session expires, or a negative number if none
+     *  will.
+     */
+    double ReapLocked( double now );
+    
+    /**
+     * \brief Reaper thread. Closes idle sessions as they expire.
+     */
+    static void *ReaperThread( void *context );
+    
+    /**
+     * \brief Wall clock time in seconds.
+     */
+    static double Now( void );
+    
+    // Non-copyable
+    JoySessionPool( const JoySessionPool & );
+    JoySessionPool &operator=( const JoySessionPool & );
+};
+
+/**
+ * \brief The process wide session pool. The idle timeout may be set (in seconds) with
+ *  the OSX_JOYSTICK_IDLE_TIMEOUT environment variable, such as with setenv in Matlab.
+ */
+JoySessionPool &SharedJoySessionPool( void );
+
+#endif
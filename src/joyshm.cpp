@@ -0,0 +1,465 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joyshm.hpp"
+#include "joytime.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief Round a size up to a whole number of cache lines.
+ */
+static size_t RoundToLine( size_t bytes )
+{
+  return ( ( bytes + JOY_CACHE_LINE - 1 )/JOY_CACHE_LINE )*JOY_CACHE_LINE;
+}
+
+/**
+ * \brief Bytes per device slot: the description, then room for the largest snapshot.
+ */
+static size_t SlotBytes( void )
+{
+  return RoundToLine( sizeof(JoyShmSlot) ) + RoundToLine( JoySnapshot::StorageSize(
+                           JOY_SHM_MAX_AXES, JOY_SHM_MAX_BUTTONS, JOY_SHM_MAX_POVS ) );
+}
+
+/**
+ * \brief The monotonic clock in milliseconds, wrapping, and never 0 (which marks a
+ *  stopped daemon).
+ */
+static uint32_t NowMilliseconds( void )
+{
+  uint32_t now = (uint32_t)( (uint64_t)( JoyTicksToSeconds( JoyNowTicks() )*1000.0 ) );
+  return now == 0 ? 1 : now;
+}
+
+/**
+ * \brief Copy a slot, retrying while the daemon is rewriting it.
+ *
+ * \return true if successful, false if the daemon stopped in the middle of a rewrite.
+ */
+static bool ReadSlot( const JoyShmSegment &segment, const JoyShmSlot *slot, JoyShmSlot &copy )
+{
+  uint32_t before, after;
+  do
+  {
+    unsigned int spins = 0;
+    while( (before = slot->epoch) & 1 )
+    {
+      if( ++spins < JOY_SNAPSHOT_SPINS ) continue;
+      spins = 0;
+      if( !segment.Alive() ) return false;
+      sched_yield();
+    }
+    __sync_synchronize();
+    memcpy( &copy, (const void *)slot, sizeof(JoyShmSlot) );
+    __sync_synchronize();
+    after = slot->epoch;
+  } while( before != after );
+  return true;
+}
+
+/**
+ * \brief JoyShmSegment constructor. Nothing is mapped until Create or Attach.
+ */
+JoyShmSegment::JoyShmSegment()
+{
+  myBase = NULL;
+  myBytes = 0;
+  myOwner = false;
+}
+
+/**
+ * \brief JoyShmSegment destructor. Closes the segment.
+ */
+JoyShmSegment::~JoyShmSegment()
+{
+  Close();
+}
+
+/**
+ * \brief Create the segment and map it for writing (daemon only). Any segment left
+ *  behind by a daemon that has gone is replaced.
+ *
+ * \param[in] name Shared memory name, such as JoyShmName().
+ * \return true if successful, false if another daemon is running or the segment
+ *  could not be created.
+ */
+bool JoyShmSegment::Create( const char *name )
+{
+  Close();
+  int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+  if( fd < 0 && errno == EEXIST )
+  {
+    JoyShmSegment existing;
+    if( existing.Attach( name ) && existing.Alive() )
+    {
+      ERR_PRINTF("JoyShmSegment::Create - A daemon is already publishing %s.\n", name);
+      return false;
+    }
+    shm_unlink( name );
+    fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+  }
+  if( fd < 0 )
+  {
+    ERR_PRINTF("JoyShmSegment::Create - Unable to create %s.\n", name);
+    return false;
+  }
+  size_t bytes = sizeof(JoyShmHeader) + JOY_SHM_MAX_DEVICES*SlotBytes();
+  if( ftruncate( fd, (off_t)bytes ) != 0 || !Map( fd, bytes, true ) )
+  {
+    ERR_PRINTF("JoyShmSegment::Create - Unable to size %s.\n", name);
+    close( fd );
+    shm_unlink( name );
+    return false;
+  }
+  close( fd );
+  myName = name;
+  myOwner = true;
+  
+  // A new segment is zero filled, so every slot starts empty. The magic goes last, so
+  // a reader never accepts a half written header.
+  JoyShmHeader *header = Header();
+  header->version = JOY_SHM_VERSION;
+  header->headerBytes = sizeof(JoyShmHeader);
+  header->slotBytes = (uint32_t)SlotBytes();
+  header->maxDevices = JOY_SHM_MAX_DEVICES;
+  header->pid = (int32_t)getpid();
+  // Start from the clock, so that readers never mistake this daemon's devices for
+  // those of one before it
+  header->generation = NowMilliseconds();
+  Beat();
+  __sync_synchronize();
+  memcpy( header->magic, JOY_SHM_MAGIC, sizeof(header->magic) );
+  return true;
+}
+
+/**
+ * \brief Map an existing segment read-only.
+ *
+ * \param[in] name Shared memory name, such as JoyShmName().
+ * \return true if successful, false if there is no usable segment.
+ */
+bool JoyShmSegment::Attach( const char *name )
+{
+  Close();
+  int fd = shm_open( name, O_RDONLY, 0 );
+  if( fd < 0 ) return false;
+  struct stat info;
+  bool ok = fstat( fd, &info ) == 0 && Map( fd, (size_t)info.st_size, false );
+  close( fd );
+  if( ok ) myName = name;
+  return ok;
+}
+
+/**
+ * \brief Map the segment behind fd, and check its header (when reading).
+ */
+bool JoyShmSegment::Map( int fd, size_t bytes, bool writable )
+{
+  if( bytes < sizeof(JoyShmHeader) ) return false;
+  void *mem = mmap( NULL, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                    fd, 0 );
+  if( mem == MAP_FAILED ) return false;
+  myBase = (char *)mem;
+  myBytes = bytes;
+  if( writable ) return true;
+  
+  const JoyShmHeader *header = Header();
+  if( memcmp( header->magic, JOY_SHM_MAGIC, sizeof(header->magic) ) != 0 ||
+      header->version != JOY_SHM_VERSION || header->headerBytes != sizeof(JoyShmHeader) ||
+      header->slotBytes != SlotBytes() ||
+      bytes < sizeof(JoyShmHeader) + header->maxDevices*SlotBytes() )
+  {
+    ERR_PRINTF("JoyShmSegment::Map - Not a version %d joystick segment.\n", JOY_SHM_VERSION);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Unmap the segment. The daemon also marks it stopped and removes the name,
+ *  although readers keep their mappings.
+ */
+void JoyShmSegment::Close( void )
+{
+  if( myBase == NULL ) return;
+  if( myOwner )
+  {
+    Header()->heartbeat = 0;
+    __sync_fetch_and_add( &Header()->generation, 1 );
+    shm_unlink( myName.c_str() );
+  }
+  munmap( myBase, myBytes );
+  myBase = NULL;
+  myBytes = 0;
+  myOwner = false;
+  myName.clear();
+}
+
+/**
+ * \brief Whether a segment is mapped.
+ */
+bool JoyShmSegment::IsOpen( void ) const
+{
+  return myBase != NULL;
+}
+
+/**
+ * \brief Whether the daemon is still publishing (its heartbeat is recent).
+ */
+bool JoyShmSegment::Alive( void ) const
+{
+  if( myBase == NULL ) return false;
+  uint32_t heartbeat = Header()->heartbeat;
+  return heartbeat != 0 && (int32_t)( NowMilliseconds() - heartbeat ) < JOY_SHM_TIMEOUT_MS;
+}
+
+/**
+ * \brief Counter bumped whenever a device is published or withdrawn.
+ */
+uint32_t JoyShmSegment::Generation( void ) const
+{
+  return myBase == NULL ? 0 : Header()->generation;
+}
+
+/**
+ * \brief The published (live) devices, sorted by location key.
+ */
+std::vector<JoyDev> JoyShmSegment::Devices( void ) const
+{
+  std::vector<JoyDev> devices;
+  JoyShmSlot copy;
+  for( size_t ii=0; Slot( ii ) != NULL; ii++ )
+  {
+    if( !ReadSlot( *this, Slot( ii ), copy ) || copy.state != kJoyShm_Live ) continue;
+    JoyDev dev;
+    copy.productKey[ JOY_CAPTURE_NAME_LEN-1 ] = '\0';
+    dev.productKey = copy.productKey;
+    dev.locationKey = copy.locationKey;
+    devices.push_back( dev );
+  }
+  std::sort( devices.begin(), devices.end(), JoyDevCompare );
+  return devices;
+}
+
+/**
+ * \brief Consistent copy of a live device's description.
+ *
+ * \param[in] locationKey LocationKey of the device.
+ * \param[out] info Description, including the axis and POV ranges.
+ * \return Snapshot storage of the device, or NULL if it isn't published.
+ */
+void *JoyShmSegment::Find( int32_t locationKey, JoyCaptureInfo &info ) const
+{
+  JoyShmSlot copy;
+  for( size_t ii=0; Slot( ii ) != NULL; ii++ )
+  {
+    if( !ReadSlot( *this, Slot( ii ), copy ) ) return NULL;
+    if( copy.state != kJoyShm_Live || copy.locationKey != locationKey ) continue;
+    copy.productKey[ JOY_CAPTURE_NAME_LEN-1 ] = '\0';
+    info.locationKey = copy.locationKey;
+    info.vendorID = copy.vendorID;
+    info.productID = copy.productID;
+    info.mode = copy.mode;
+    info.productKey = copy.productKey;
+    info.numButtons = copy.count[ kJoystick_Buttons ];
+    info.numOutputs = copy.count[ kJoystick_Outputs ];
+    info.axes.assign( copy.axes, copy.axes + copy.count[ kJoystick_Axes ] );
+    info.povs.assign( copy.povs, copy.povs + copy.count[ kJoystick_POVs ] );
+    return Storage( ii );
+  }
+  return NULL;
+}
+
+/**
+ * \brief Describe a device in its slot and mark it live (daemon only). The slot's
+ *  snapshot storage is zeroed.
+ *
+ * \param[in] info Description of the device.
+ * \return Snapshot storage for JoySnapshot::Place, or NULL if there is no room for
+ *  the device.
+ */
+void *JoyShmSegment::Publish( const JoyCaptureInfo &info )
+{
+  if( !myOwner ) return NULL;
+  if( info.axes.size() > JOY_SHM_MAX_AXES || info.numButtons > JOY_SHM_MAX_BUTTONS ||
+      info.povs.size() > JOY_SHM_MAX_POVS )
+  {
+    ERR_PRINTF("JoyShmSegment::Publish - Joystick %i has too many elements.\n", info.locationKey);
+    return NULL;
+  }
+  
+  // Reuse the device's own slot, otherwise take the first empty one
+  size_t index = JOY_SHM_MAX_DEVICES;
+  for( size_t ii=0; Slot( ii ) != NULL && index == JOY_SHM_MAX_DEVICES; ii++ )
+  {
+    if( Slot( ii )->state != kJoyShm_Empty && Slot( ii )->locationKey == info.locationKey )
+      index = ii;
+  }
+  for( size_t ii=0; Slot( ii ) != NULL && index == JOY_SHM_MAX_DEVICES; ii++ )
+  {
+    if( Slot( ii )->state == kJoyShm_Empty ) index = ii;
+  }
+  if( index == JOY_SHM_MAX_DEVICES )
+  {
+    ERR_PRINTF("JoyShmSegment::Publish - No room for joystick %i.\n", info.locationKey);
+    return NULL;
+  }
+  
+  JoyShmSlot *slot = Slot( index );
+  slot->epoch = slot->epoch + 1;
+  __sync_synchronize();
+  slot->locationKey = info.locationKey;
+  slot->vendorID = info.vendorID;
+  slot->productID = info.productID;
+  slot->mode = info.mode;
+  slot->count[ kJoystick_Axes ] = (uint32_t)info.axes.size();
+  slot->count[ kJoystick_Buttons ] = (uint32_t)info.numButtons;
+  slot->count[ kJoystick_POVs ] = (uint32_t)info.povs.size();
+  slot->count[ kJoystick_Outputs ] = (uint32_t)info.numOutputs;
+  memset( slot->productKey, 0, JOY_CAPTURE_NAME_LEN );
+  strncpy( slot->productKey, info.productKey.c_str(), JOY_CAPTURE_NAME_LEN-1 );
+  if( !info.axes.empty() ) std::copy( info.axes.begin(), info.axes.end(), slot->axes );
+  if( !info.povs.empty() ) std::copy( info.povs.begin(), info.povs.end(), slot->povs );
+  memset( Storage( index ), 0, SlotBytes() - RoundToLine( sizeof(JoyShmSlot) ) );
+  slot->state = kJoyShm_Live;
+  __sync_synchronize();
+  slot->epoch = slot->epoch + 1;
+  __sync_fetch_and_add( &Header()->generation, 1 );
+  return Storage( index );
+}
+
+/**
+ * \brief Mark a device as removed (daemon only).
+ */
+void JoyShmSegment::Withdraw( int32_t locationKey )
+{
+  if( !myOwner ) return;
+  for( size_t ii=0; Slot( ii ) != NULL; ii++ )
+  {
+    JoyShmSlot *slot = Slot( ii );
+    if( slot->state != kJoyShm_Live || slot->locationKey != locationKey ) continue;
+    slot->epoch = slot->epoch + 1;
+    __sync_synchronize();
+    slot->state = kJoyShm_Removed;
+    __sync_synchronize();
+    slot->epoch = slot->epoch + 1;
+    __sync_fetch_and_add( &Header()->generation, 1 );
+  }
+}
+
+/**
+ * \brief Refresh the heartbeat (daemon only). Must be called more often than
+ *  JOY_SHM_TIMEOUT_MS.
+ */
+void JoyShmSegment::Beat( void )
+{
+  if( myOwner ) Header()->heartbeat = NowMilliseconds();
+}
+
+/**
+ * \brief The segment header.
+ */
+JoyShmHeader *JoyShmSegment::Header( void ) const
+{
+  return (JoyShmHeader *)myBase;
+}
+
+/**
+ * \brief Slot ii, or NULL if it is out of range.
+ */
+JoyShmSlot *JoyShmSegment::Slot( size_t ii ) const
+{
+  if( myBase == NULL || ii >= Header()->maxDevices ) return NULL;
+  return (JoyShmSlot *)( myBase + sizeof(JoyShmHeader) + ii*SlotBytes() );
+}
+
+/**
+ * \brief Snapshot storage of slot ii.
+ */
+void *JoyShmSegment::Storage( size_t ii ) const
+{
+  return (char *)Slot( ii ) + RoundToLine( sizeof(JoyShmSlot) );
+}
+
+/**
+ * \brief Writer check (see JoySnapshot::SetWriterCheck) for a snapshot placed in a
+ *  segment: whether the segment's daemon is still publishing.
+ *
+ * \param[in] segment The JoyShmSegment the snapshot is placed in.
+ */
+bool JoyShmAlive( const void *segment )
+{
+  return ((const JoyShmSegment *)segment)->Alive();
+}
+
+/**
+ * \brief Shared memory name to use: SLJOYSTICK_SHM if it is set, otherwise JOY_SHM_NAME.
+ */
+const char *JoyShmName( void )
+{
+  const char *name = getenv( "SLJOYSTICK_SHM" );
+  return ( name != NULL && name[ 0 ] == '/' ) ? name : JOY_SHM_NAME;
+}
+
+/**
+ * \brief The segment the readers in this process share, or NULL if no daemon is
+ *  running. It is attached on first use, and attached again once a restarted daemon
+ *  replaces it. A replaced segment stays mapped, as Joysticks may still be placed over it.
+ */
+JoyShmSegment *SharedJoyShm( void )
+{
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  static JoyShmSegment *segment = NULL;
+  pthread_mutex_lock( &mutex );
+  if( segment == NULL || !segment->Alive() )
+  {
+    JoyShmSegment *fresh = new JoyShmSegment;
+    if( fresh->Attach( JoyShmName() ) && fresh->Alive() ) segment = fresh;
+    else delete fresh;
+  }
+  JoyShmSegment *result = ( segment != NULL && segment->Alive() ) ? segment : NULL;
+  pthread_mutex_unlock( &mutex );
+  return result;
+}
@@ -0,0 +1,263 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYSHM_H__
+#define __JOYSHM_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "snapshot.hpp"
+#include "joycapture.hpp"
+#include "joyregistry.hpp"
+
+/**
+ * \brief Default POSIX shared memory name of the segment the daemon (sljoyd) publishes.
+ *  The SLJOYSTICK_SHM environment variable overrides it, for the daemon and readers
+ *  alike.
+ */
+#define JOY_SHM_NAME "/sljoystick"
+
+/**
+ * \brief Segment identification and layout version.
+ */
+#define JOY_SHM_MAGIC "SLJOYSHM"
+#define JOY_SHM_VERSION 1
+
+/**
+ * \brief Capacity of the segment. Every slot has room for the largest device, so a slot
+ *  never moves while readers are attached to it.
+ */
+#define JOY_SHM_MAX_DEVICES 32
+#define JOY_SHM_MAX_AXES 64
+#define JOY_SHM_MAX_BUTTONS 256
+#define JOY_SHM_MAX_POVS 16
+
+/**
+ * \brief Milliseconds without a heartbeat after which readers take the daemon to be gone.
+ */
+#define JOY_SHM_TIMEOUT_MS 2000
+
+/**
+ * \brief Segment header, on a cache line of its own. It is followed by the device slots.
+ */
+struct JoyShmHeader
+{
+  char magic[ 8 ];
+  uint32_t version;
+  uint32_t headerBytes;
+  uint32_t slotBytes;
+  uint32_t maxDevices;
+  int32_t pid;
+  // Bumped whenever a device is published or withdrawn
+  volatile uint32_t generation;
+  // Daemon clock (milliseconds, wrapping) of its latest pass, or 0 once it has stopped
+  volatile uint32_t heartbeat;
+  char pad[ JOY_CACHE_LINE - 8 - 7*sizeof(uint32_t) ];
+};
+
+/**
+ * \brief State of a device slot.
+ */
+enum JoyShmSlotState {
+  kJoyShm_Empty = 0,
+  kJoyShm_Live,
+  // The device was removed. Its last values stay readable.
+  kJoyShm_Removed
+};
+
+/**
+ * \brief Description of the device in a slot. The slot's snapshot storage (see
+ *  JoySnapshot::Place) follows it, on the next cache line.
+ */
+struct JoyShmSlot
+{
+  // Odd while the daemon rewrites the description
+  volatile uint32_t epoch;
+  volatile uint32_t state;
+  int32_t locationKey;
+  int32_t vendorID;
+  int32_t productID;
+  // JoystickAcquisition the daemon acquires the device with
+  int32_t mode;
+  // QueryIO layout, indexed by JoystickIOIndex
+  uint32_t count[ 4 ];
+  char productKey[ JOY_CAPTURE_NAME_LEN ];
+  JoyCaptureRange axes[ JOY_SHM_MAX_AXES ];
+  JoyCaptureRange povs[ JOY_SHM_MAX_POVS ];
+};
+
+/**
+ * \brief POSIX shared memory segment through which one daemon process publishes the
+ *  state of every joystick to any number of readers.
+ *
+ * Each device gets a slot, found by its location key. The daemon's acquisition threads
+ * write the element values straight into the slot's snapshot, so readers get them with
+ * the usual seqlock copy, and never touch the device. Readers map the segment read-only.
+ *
+ * A slot is only ever reused for the same location key, so the storage a reader is
+ * placed over stays the storage of that device.
+ */
+class JoyShmSegment
+{
+  public:
+    /**
+     * \brief JoyShmSegment constructor. Nothing is mapped until Create or Attach.
+     */
+    JoyShmSegment();
+    
+    /**
+     * \brief JoyShmSegment destructor. Closes the segment.
+     */
+    ~JoyShmSegment();
+    
+    /**
+     * \brief Create the segment and map it for writing (daemon only). Any segment left
+     *  behind by a daemon that has gone is replaced.
+     *
+     * \param[in] name Shared memory name, such as JoyShmName().
+     * \return true if successful, false if another daemon is running or the segment
+     *  could not be created.
+     */
+    bool Create( const char *name );
+    
+    /**
+     * \brief Map an existing segment read-only.
+     *
+     * \param[in] name Shared memory name, such as JoyShmName().
+     * \return true if successful, false if there is no usable segment.
+     */
+    bool Attach( const char *name );
+    
+    /**
+     * \brief Unmap the segment. The daemon also marks it stopped and removes the name,
+     *  although readers keep their mappings.
+     */
+    void Close( void );
+    
+    /**
+     * \brief Whether a segment is mapped.
+     */
+    bool IsOpen( void ) const;
+    
+    /**
+     * \brief Whether the daemon is still publishing (its heartbeat is recent).
+     */
+    bool Alive( void ) const;
+    
+    /**
+     * \brief Counter bumped whenever a device is published or withdrawn.
+     */
+    uint32_t Generation( void ) const;
+    
+    /**
+     * \brief The published (live) devices, sorted by location key.
+     */
+    std::vector<JoyDev> Devices( void ) const;
+    
+    /**
+     * \brief Consistent copy of a live device's description.
+     *
+     * \param[in] locationKey LocationKey of the device.
+     * \param[out] info Description, including the axis and POV ranges.
+     * \return Snapshot storage of the device, or NULL if it isn't published.
+     */
+    void *Find( int32_t locationKey, JoyCaptureInfo &info ) const;
+    
+    /**
+     * \brief Describe a device in its slot and mark it live (daemon only). The slot's
+     *  snapshot storage is zeroed.
+     *
+     * \param[in] info Description of the device.
+     * \return Snapshot storage for JoySnapshot::Place, or NULL if there is no room for
+     *  the device.
+     */
+    void *Publish( const JoyCaptureInfo &info );
+    
+    /**
+     * \brief Mark a device as removed (daemon only).
+     */
+    void Withdraw( int32_t locationKey );
+    
+    /**
+     * \brief Refresh the heartbeat (daemon only). Must be called more often than
+     *  JOY_SHM_TIMEOUT_MS.
+     */
+    void Beat( void );
+    
+  private:
+    std::string myName;
+    char *myBase;
+    size_t myBytes;
+    bool myOwner;
+    
+    /**
+     * \brief The segment header.
+     */
+    JoyShmHeader *Header( void ) const;
+    
+    /**
+     * \brief Slot ii, or NULL if it is out of range.
+     */
+    JoyShmSlot *Slot( size_t ii ) const;
+    
+    /**
+     * \brief Snapshot storage of slot ii.
+     */
+    void *Storage( size_t ii ) const;
+    
+    /**
+     * \brief Map the segment behind fd, and check its header (when reading).
+     */
+    bool Map( int fd, size_t bytes, bool writable );
+    
+    // Non-copyable
+    JoyShmSegment( const JoyShmSegment & );
+    JoyShmSegment &operator=( const JoyShmSegment & );
+};
+
+/**
+ * \brief Writer check (see JoySnapshot::SetWriterCheck) for a snapshot placed in a
+ *  segment: whether the segment's daemon is still publishing.
+ *
+ * \param[in] segment The JoyShmSegment the snapshot is placed in.
+ */
+bool JoyShmAlive( const void *segment );
+
+/**
+ * \brief Shared memory name to use: SLJOYSTICK_SHM if it is set, otherwise JOY_SHM_NAME.
+ */
+const char *JoyShmName( void );
+
+/**
+ * \brief The segment the readers in this process share, or NULL if no daemon is
+ *  running. It is attached on first use, and attached again once a restarted daemon
+ *  replaces it. A replaced segment stays mapped, as Joysticks may still be placed over it.
+ */
+JoyShmSegment *SharedJoyShm( void );
+
+#endif
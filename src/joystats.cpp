@@ -0,0 +1,359 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joystats.hpp"
+#include "joytime.hpp"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Environment variable holding "pid:address" of the process wide table
+#define JOY_PERF_ENV "OSX_JOYSTICK_PERF_TABLE"
+#define JOY_PERF_MAGIC 0x4A504631u
+
+/**
+ * \brief The process wide table of counters. Plain data only, so that any MEX file can
+ *  use a table made by another.
+ */
+struct JoyPerfTable
+{
+  uint32_t magic;
+  uint32_t size;
+  pthread_mutex_t mutex;
+  uint32_t inUse[ JOY_PERF_SLOTS ];
+  JoyPerfRecord records[ JOY_PERF_SLOTS ];
+};
+
+/**
+ * \brief Find the process wide table, making it if asked to.
+ *
+ * \param[in] create Whether to make the table if there isn't one yet.
+ * \return The table, or NULL if there is none (or it could not be made).
+ */
+static JoyPerfTable *FindPerfTable( bool create )
+{
+  static pthread_mutex_t findMutex = PTHREAD_MUTEX_INITIALIZER;
+  static JoyPerfTable *table = NULL;
+  
+  pthread_mutex_lock( &findMutex );
+  if( table == NULL )
+  {
+    // The variable is inherited by child processes, so check that it is ours
+    const char *env = getenv( JOY_PERF_ENV );
+    unsigned long pid, address;
+    if( env != NULL && sscanf( env, "%lu:%lx", &pid, &address ) == 2 &&
+        pid == (unsigned long)getpid() )
+    {
+      JoyPerfTable *found = (JoyPerfTable *)(uintptr_t)address;
+      if( found->magic == JOY_PERF_MAGIC && found->size == sizeof(JoyPerfTable) ) table = found;
+    }
+  }
+  if( table == NULL && create )
+  {
+    JoyPerfTable *made = (JoyPerfTable *)calloc( 1, sizeof(JoyPerfTable) );
+    if( made != NULL )
+    {
+      pthread_mutex_init( &made->mutex, NULL );
+      made->magic = JOY_PERF_MAGIC;
+      made->size = sizeof(JoyPerfTable);
+      char value[64];
+      sprintf( value, "%lu:%lx", (unsigned long)getpid(), (unsigned long)(uintptr_t)made );
+      setenv( JOY_PERF_ENV, value, 1 );
+      table = made;
+    }
+  }
+  pthread_mutex_unlock( &findMutex );
+  return table;
+}
+
+/**
+ * \brief Read a counter that other threads may be adding to. A 64-bit load isn't
+ *  atomic on the 32-bit build.
+ */
+static uint64_t LoadCounter( uint64_t *counter )
+{
+  return __sync_fetch_and_add( counter, 0 );
+}
+
+/**
+ * \brief Set a counter that other threads may be adding to.
+ */
+static void StoreCounter( uint64_t *counter, uint64_t value )
+{
+  uint64_t seen = LoadCounter( counter );
+  for( ;; )
+  {
+    uint64_t was = __sync_val_compare_and_swap( counter, seen, value );
+    if( was == seen ) break;
+    seen = was;
+  }
+}
+
+/**
+ * \brief Zero a record's counters, keeping its key and mode. Record calls may run
+ *  meanwhile.
+ */
+static void ClearPerfRecord( JoyPerfRecord *record )
+{
+  StoreCounter( &record->polls, 0 );
+  StoreCounter( &record->exceptions, 0 );
+  for( size_t ii=0; ii<kJoyPerf_NumStats; ii++ )
+  {
+    JoyStat *stat = &record->stats[ ii ];
+    StoreCounter( &stat->count, 0 );
+    StoreCounter( &stat->sum, 0 );
+    // An empty statistic's minimum starts at the top, so that any value lowers it
+    StoreCounter( &stat->min, ~(uint64_t)0 );
+    StoreCounter( &stat->max, 0 );
+    for( size_t jj=0; jj<JOY_STAT_BUCKETS; jj++ ) StoreCounter( &stat->buckets[ jj ], 0 );
+  }
+}
+
+/**
+ * \brief Lower a counter to value, if it is larger.
+ */
+static void LowerCounter( uint64_t *counter, uint64_t value )
+{
+  uint64_t seen = LoadCounter( counter );
+  while( value < seen )
+  {
+    uint64_t was = __sync_val_compare_and_swap( counter, seen, value );
+    if( was == seen ) break;
+    seen = was;
+  }
+}
+
+/**
+ * \brief Raise a counter to value, if it is smaller.
+ */
+static void RaiseCounter( uint64_t *counter, uint64_t value )
+{
+  uint64_t seen = LoadCounter( counter );
+  while( value > seen )
+  {
+    uint64_t was = __sync_val_compare_and_swap( counter, seen, value );
+    if( was == seen ) break;
+    seen = was;
+  }
+}
+
+/**
+ * \brief Copy a statistic that other threads may be adding to. An empty one reads
+ *  as all zeros.
+ */
+static void LoadStat( JoyStat *stat, JoyStat &copy )
+{
+  copy.count = LoadCounter( &stat->count );
+  copy.sum = LoadCounter( &stat->sum );
+  copy.min = LoadCounter( &stat->min );
+  copy.max = LoadCounter( &stat->max );
+  for( size_t ii=0; ii<JOY_STAT_BUCKETS; ii++ ) copy.buckets[ ii ] = LoadCounter( &stat->buckets[ ii ] );
+  if( copy.count == 0 ) copy.min = 0;
+}
+
+/**
+ * \brief Add a value to a JoyStat. Safe to call from several threads at once, and
+ *  while the JoyStat is being read.
+ */
+void JoyStatAdd( JoyStat *stat, uint64_t value )
+{
+  LowerCounter( &stat->min, value );
+  RaiseCounter( &stat->max, value );
+  __sync_fetch_and_add( &stat->count, 1 );
+  __sync_fetch_and_add( &stat->sum, value );
+  size_t bucket = value == 0 ? 0 : 64 - (size_t)__builtin_clzll( value );
+  if( bucket >= JOY_STAT_BUCKETS ) bucket = JOY_STAT_BUCKETS - 1;
+  __sync_fetch_and_add( &stat->buckets[ bucket ], 1 );
+}
+
+/**
+ * \brief Mean of the values added to a JoyStat, or 0 if there are none.
+ */
+double JoyStatMean( const JoyStat *stat )
+{
+  if( stat->count == 0 ) return 0.0;
+  return (double)stat->sum / (double)stat->count;
+}
+
+/**
+ * \brief JoyPerfCounters constructor. Nothing is counted until Attach.
+ */
+JoyPerfCounters::JoyPerfCounters()
+{
+  mySlot = -1;
+  myRecord = NULL;
+  myStepCalls = 0;
+}
+
+/**
+ * \brief JoyPerfCounters destructor. Detaches from the table.
+ */
+JoyPerfCounters::~JoyPerfCounters()
+{
+  Detach();
+}
+
+/**
+ * \brief Start counting for a Joystick, with all of its counters zero.
+ *
+ * \param[in] locationKey LocationKey of the Joystick.
+ * \param[in] mode Acquisition mode of the Joystick.
+ * \return true if successful, false if the table is full.
+ */
+bool JoyPerfCounters::Attach( int32_t locationKey, int32_t mode )
+{
+  Detach();
+  JoyPerfTable *table = FindPerfTable( true );
+  if( table == NULL ) return false;
+  
+  pthread_mutex_lock( &table->mutex );
+  for( int ii=0; ii<JOY_PERF_SLOTS; ii++ )
+  {
+    if( table->inUse[ ii ] ) continue;
+    JoyPerfRecord &record = table->records[ ii ];
+    record.locationKey = locationKey;
+    record.mode = mode;
+    ClearPerfRecord( &record );
+    table->inUse[ ii ] = 1;
+    mySlot = ii;
+    myRecord = &record;
+    break;
+  }
+  pthread_mutex_unlock( &table->mutex );
+  myStepCalls = 0;
+  return mySlot >= 0;
+}
+
+/**
+ * \brief Stop counting, and give back the table slot.
+ */
+void JoyPerfCounters::Detach( void )
+{
+  if( mySlot < 0 ) return;
+  JoyPerfTable *table = FindPerfTable( false );
+  if( table != NULL )
+  {
+    pthread_mutex_lock( &table->mutex );
+    table->inUse[ mySlot ] = 0;
+    pthread_mutex_unlock( &table->mutex );
+  }
+  mySlot = -1;
+  myRecord = NULL;
+}
+
+/**
+ * \brief Record a poll call that started at the given time (ticks, see joytime.hpp).
+ *
+ * \param[in] start JoyNowTicks() at the start of the call.
+ * \param[in] ioKitCalls Number of IOKit calls made by the poll.
+ */
+void JoyPerfCounters::RecordPoll( uint64_t start, uint32_t ioKitCalls )
+{
+  if( myRecord == NULL ) return;
+  uint64_t ns = (uint64_t)( JoyTicksToSeconds( JoyNowTicks() - start )*1e9 );
+  __sync_fetch_and_add( &myStepCalls, ioKitCalls );
+  __sync_fetch_and_add( &myRecord->polls, 1 );
+  JoyStatAdd( &myRecord->stats[ kJoyPerf_PollTime ], ns );
+}
+
+/**
+ * \brief Record a PushInputs call that started at the given time.
+ *
+ * \param[in] start JoyNowTicks() at the start of the call.
+ * \param[in] ioKitCalls Number of IOKit calls made by the push.
+ */
+void JoyPerfCounters::RecordPush( uint64_t start, uint32_t ioKitCalls )
+{
+  if( myRecord == NULL ) return;
+  uint64_t ns = (uint64_t)( JoyTicksToSeconds( JoyNowTicks() - start )*1e9 );
+  __sync_fetch_and_add( &myStepCalls, ioKitCalls );
+  JoyStatAdd( &myRecord->stats[ kJoyPerf_PushTime ], ns );
+}
+
+/**
+ * \brief Record a read error thrown by a poll.
+ */
+void JoyPerfCounters::RecordException( void )
+{
+  if( myRecord == NULL ) return;
+  __sync_fetch_and_add( &myRecord->exceptions, 1 );
+}
+
+/**
+ * \brief End a step. The IOKit calls counted since the last EndStep are added to the
+ *  kJoyPerf_IOKitCalls statistic.
+ */
+void JoyPerfCounters::EndStep( void )
+{
+  if( myRecord == NULL ) return;
+  uint32_t calls = __sync_fetch_and_and( &myStepCalls, 0 );
+  JoyStatAdd( &myRecord->stats[ kJoyPerf_IOKitCalls ], calls );
+}
+
+/**
+ * \brief Copy the counters of every Joystick in the process.
+ *
+ * \param[out] records One record per counted Joystick.
+ * \return Number of records.
+ */
+size_t JoyPerfRead( std::vector<JoyPerfRecord> &records )
+{
+  records.clear();
+  JoyPerfTable *table = FindPerfTable( false );
+  if( table == NULL ) return 0;
+  pthread_mutex_lock( &table->mutex );
+  for( size_t ii=0; ii<JOY_PERF_SLOTS; ii++ )
+  {
+    if( !table->inUse[ ii ] ) continue;
+    JoyPerfRecord *record = &table->records[ ii ];
+    JoyPerfRecord copy;
+    copy.locationKey = record->locationKey;
+    copy.mode = record->mode;
+    copy.polls = LoadCounter( &record->polls );
+    copy.exceptions = LoadCounter( &record->exceptions );
+    for( size_t jj=0; jj<kJoyPerf_NumStats; jj++ ) LoadStat( &record->stats[ jj ], copy.stats[ jj ] );
+    records.push_back( copy );
+  }
+  pthread_mutex_unlock( &table->mutex );
+  return records.size();
+}
+
+/**
+ * \brief Zero the counters of every Joystick in the process. Counting carries on.
+ */
+void JoyPerfReset( void )
+{
+  JoyPerfTable *table = FindPerfTable( false );
+  if( table == NULL ) return;
+  pthread_mutex_lock( &table->mutex );
+  for( size_t ii=0; ii<JOY_PERF_SLOTS; ii++ )
+  {
+    if( table->inUse[ ii ] ) ClearPerfRecord( &table->records[ ii ] );
+  }
+  pthread_mutex_unlock( &table->mutex );
+}
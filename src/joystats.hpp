@@ -0,0 +1,190 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOYSTATS_H__
+#define __JOYSTATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Number of histogram buckets. Bucket 0 counts zeros, and bucket b counts values in
+// [2^(b-1), 2^b). The last bucket also counts anything larger.
+#define JOY_STAT_BUCKETS 32
+
+// Maximum number of Joysticks with counters at once. Others run without counters.
+#define JOY_PERF_SLOTS 64
+
+/**
+ * \brief Running min/max/mean and log2 bucketed histogram of a non-negative quantity.
+ */
+struct JoyStat
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[ JOY_STAT_BUCKETS ];
+};
+
+/**
+ * \brief Add a value to a JoyStat. Safe to call from several threads at once, and
+ *  while the JoyStat is being read.
+ */
+void JoyStatAdd( JoyStat *stat, uint64_t value );
+
+/**
+ * \brief Mean of the values added to a JoyStat, or 0 if there are none.
+ */
+double JoyStatMean( const JoyStat *stat );
+
+/**
+ * \brief Index of the statistics kept for each Joystick.
+ */
+enum JoyPerfStat
+{
+  // Time spent in each poll call (nanoseconds)
+  kJoyPerf_PollTime = 0,
+  // IOKit calls made by a joystick in each step (see JoyPerfCounters::EndStep)
+  kJoyPerf_IOKitCalls,
+  // Time spent in each PushInputs call (nanoseconds)
+  kJoyPerf_PushTime,
+  kJoyPerf_NumStats
+};
+
+/**
+ * \brief The counters of one Joystick.
+ */
+struct JoyPerfRecord
+{
+  // LocationKey and acquisition mode of the Joystick
+  int32_t locationKey;
+  int32_t mode;
+  // Number of poll calls, and of read errors thrown by them
+  uint64_t polls;
+  uint64_t exceptions;
+  JoyStat stats[ kJoyPerf_NumStats ];
+};
+
+/**
+ * \brief Hot path performance counters of a Joystick.
+ *
+ * The counters live in a process wide table rather than in the Joystick, as each MEX
+ * file has its own copy of this code (and of the session pool). The table is found
+ * through an environment variable holding its address and the process ID, so that the
+ * osx_joystick_stats MEX function can read and reset the counters of the Joysticks
+ * opened by the s-function, even while it is running. The table is never freed, so it
+ * stays valid when the MEX file that made it is cleared.
+ *
+ * The Record calls take no lock. Attach finds the Joystick's record once, and each
+ * call then adds to its counters atomically, so that a poll and a push from another
+ * thread (see joyeffects.hpp) don't lose each other's counts. Only Attach, Detach,
+ * JoyPerfRead and JoyPerfReset take the table's mutex. A read or reset may then see
+ * a Record call half done, which costs no more than that call's counts.
+ */
+class JoyPerfCounters
+{
+  public:
+    /**
+     * \brief JoyPerfCounters constructor. Nothing is counted until Attach.
+     */
+    JoyPerfCounters();
+    
+    /**
+     * \brief JoyPerfCounters destructor. Detaches from the table.
+     */
+    ~JoyPerfCounters();
+    
+    /**
+     * \brief Start counting for a Joystick, with all of its counters zero.
+     *
+     * \param[in] locationKey LocationKey of the Joystick.
+     * \param[in] mode Acquisition mode of the Joystick.
+     * \return true if successful, false if the table is full.
+     */
+    bool Attach( int32_t locationKey, int32_t mode );
+    
+    /**
+     * \brief Stop counting, and give back the table slot.
+     */
+    void Detach( void );
+    
+    /**
+     * \brief Record a poll call that started at the given time (ticks, see joytime.hpp).
+     *
+     * \param[in] start JoyNowTicks() at the start of the call.
+     * \param[in] ioKitCalls Number of IOKit calls made by the poll.
+     */
+    void RecordPoll( uint64_t start, uint32_t ioKitCalls );
+    
+    /**
+     * \brief Record a PushInputs call that started at the given time.
+     *
+     * \param[in] start JoyNowTicks() at the start of the call.
+     * \param[in] ioKitCalls Number of IOKit calls made by the push.
+     */
+    void RecordPush( uint64_t start, uint32_t ioKitCalls );
+    
+    /**
+     * \brief Record a read error thrown by a poll.
+     */
+    void RecordException( void );
+    
+    /**
+     * \brief End a step. The IOKit calls counted since the last EndStep are added to the
+     *  kJoyPerf_IOKitCalls statistic.
+     */
+    void EndStep( void );
+    
+  private:
+    // Index of our table slot, or -1 if detached
+    int mySlot;
+    // Our record in the table, or NULL if detached
+    JoyPerfRecord *myRecord;
+    // IOKit calls since the last EndStep. Pushes may come from an effect thread (see
+    // joyeffects.hpp), so it is updated atomically.
+    volatile uint32_t myStepCalls;
+    
+    // Non-copyable
+    JoyPerfCounters( const JoyPerfCounters & );
+    JoyPerfCounters &operator=( const JoyPerfCounters & );
+};
+
+/**
+ * \brief Copy the counters of every Joystick in the process.
+ *
+ * \param[out] records One record per counted Joystick.
+ * \return Number of records.
+ */
+size_t JoyPerfRead( std::vector<JoyPerfRecord> &records );
+
+/**
+ * \brief Zero the counters of every Joystick in the process. Counting carries on.
+ */
+void JoyPerfReset( void );
+
+#endif
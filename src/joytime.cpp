@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "joytime.hpp"
+
+#ifdef __APPLE__
+  #include <mach/mach_time.h>
+#else
+  #include <errno.h>
+  #include <time.h>
+#endif
+
+/**
+ * \brief Current time in ticks of the monotonic clock. On OS X these are the same
+ *  units as mach_absolute_time and the IOHIDValue time stamps.
+ */
+uint64_t JoyNowTicks( void )
+{
+#ifdef __APPLE__
+  return mach_absolute_time();
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * \brief Convert a duration (or time) in ticks to seconds.
+ */
+double JoyTicksToSeconds( uint64_t ticks )
+{
+#ifdef __APPLE__
+  static double secondsPerTick = 0.0;
+  if( secondsPerTick == 0.0 )
+  {
+    mach_timebase_info_data_t info;
+    mach_timebase_info( &info );
+    secondsPerTick = 1e-9 * (double)info.numer / (double)info.denom;
+  }
+  return (double)ticks * secondsPerTick;
+#else
+  return 1e-9 * (double)ticks;
+#endif
+}
+
+/**
+ * \brief Convert a duration in seconds to ticks. Negative durations give 0.
+ */
+uint64_t JoySecondsToTicks( double seconds )
+{
+  if( seconds <= 0.0 ) return 0;
+  return (uint64_t)( seconds / JoyTicksToSeconds( 1000000000u ) * 1e9 + 0.5 );
+}
+
+/**
+ * \brief Sleep the calling thread until a time in ticks (see JoyNowTicks). Returns at
+ *  once if the time has passed.
+ */
+void JoySleepUntil( uint64_t ticks )
+{
+#ifdef __APPLE__
+  mach_wait_until( ticks );
+#else
+  struct timespec ts;
+  ts.tv_sec = (time_t)( ticks / 1000000000u );
+  ts.tv_nsec = (long)( ticks % 1000000000u );
+  while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR ) {}
+#endif
+}
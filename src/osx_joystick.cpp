@@ -26,6 +26,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "osx_joystick.hpp"
+#include <map>
+#include <algorithm>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
 
 #define UNUSED(x) (void)(x)
 
@@ -46,11 +52,101 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 /**
- * \brief Not a member of Joystick, instead a compare function for sorting JoyDevs.
+ * \brief Whether PollAxes<T> reads raw counts (the integer types) rather than
+ *  normalised axes.
+ */
+template<typename T> struct AxisCounts { enum { value = 1 }; };
+template<> struct AxisCounts<float> { enum { value = 0 }; };
+template<> struct AxisCounts<double> { enum { value = 0 }; };
+
+/**
+ * \brief Store a value in another type, rounding and saturating for the integer types.
+ */
+static inline void StoreAs( double value, double &dest ) { dest = value; }
+static inline void StoreAs( double value, float &dest ) { dest = (float)value; }
+static inline void StoreAs( double value, int32_t &dest )
+{
+  value = value < 0.0 ? value - 0.5 : value + 0.5;
+  if( value <= -2147483648.0 ) dest = (int32_t)( -2147483647 - 1 );
+  else if( value >= 2147483647.0 ) dest = 2147483647;
+  else dest = (int32_t)value;
+}
+static inline void StoreAs( double value, int16_t &dest )
+{
+  value = value < 0.0 ? value - 0.5 : value + 0.5;
+  dest = (int16_t)( value <= -32768.0 ? -32768 : value >= 32767.0 ? 32767 : (int)value );
+}
+static inline void StoreAs( double value, uint16_t &dest )
+{
+  value += 0.5;
+  dest = (uint16_t)( value <= 0.0 ? 0 : value >= 65535.0 ? 65535 : (int)value );
+}
+
+/**
+ * \brief Store a raw count in another type, saturating for the narrower types.
+ */
+static inline void StoreCount( int32_t count, double &dest ) { dest = (double)count; }
+static inline void StoreCount( int32_t count, float &dest ) { dest = (float)count; }
+static inline void StoreCount( int32_t count, int32_t &dest ) { dest = count; }
+static inline void StoreCount( int32_t count, int16_t &dest )
+{
+  dest = (int16_t)( count < -32768 ? -32768 : count > 32767 ? 32767 : count );
+}
+static inline void StoreCount( int32_t count, uint16_t &dest )
+{
+  dest = (uint16_t)( count < 0 ? 0 : count > 65535 ? 65535 : count );
+}
+
+/**
+ * \brief Store a block of values in another type.
+ */
+template<typename T>
+static void StoreValues( const double *values, T *dest, size_t len )
+{
+  for( size_t ii=0; ii<len; ii++ ) StoreAs( values[ ii ], dest[ ii ] );
+}
+
+static void StoreValues( const double *values, float *dest, size_t len )
+{
+  size_t ii = 0;
+#if defined(__SSE2__)
+  for( ; ii+4<=len; ii+=4 )
+  {
+    __m128 lo = _mm_cvtpd_ps( _mm_loadu_pd( values + ii ) );
+    __m128 hi = _mm_cvtpd_ps( _mm_loadu_pd( values + ii + 2 ) );
+    _mm_storeu_ps( dest + ii, _mm_movelh_ps( lo, hi ) );
+  }
+#endif
+  for( ; ii<len; ii++ ) dest[ ii ] = (float)values[ ii ];
+}
+
+/**
+ * \brief Store a block of raw counts in another type.
  */
-bool JoyDevCompare( JoyDev i, JoyDev j )
+template<typename T>
+static void StoreCounts( const int32_t *counts, T *dest, size_t len )
 {
-  return ( i.locationKey < j.locationKey );
+  for( size_t ii=0; ii<len; ii++ ) StoreCount( counts[ ii ], dest[ ii ] );
+}
+
+static void StoreCounts( const int32_t *counts, int32_t *dest, size_t len )
+{
+  copy( counts, counts + len, dest );
+}
+
+static void StoreCounts( const int32_t *counts, int16_t *dest, size_t len )
+{
+  size_t ii = 0;
+#if defined(__SSE2__)
+  // The pack saturates
+  for( ; ii+8<=len; ii+=8 )
+  {
+    __m128i lo = _mm_loadu_si128( (const __m128i *)( counts + ii ) );
+    __m128i hi = _mm_loadu_si128( (const __m128i *)( counts + ii + 4 ) );
+    _mm_storeu_si128( (__m128i *)( dest + ii ), _mm_packs_epi32( lo, hi ) );
+  }
+#endif
+  for( ; ii<len; ii++ ) StoreCount( counts[ ii ], dest[ ii ] );
 }
 
 /**
@@ -58,9 +154,27 @@ bool JoyDevCompare( JoyDev i, JoyDev j )
  */
  Joystick::Joystick()
  {
-   myManager = NULL;
    myElements = NULL;
    myDevice = NULL;
+   myMode = kJoystick_Polled;
+   myAcqRunLoop = NULL;
+   myAcqStarted = false;
+   myAcqRunning = false;
+   myRingEnabled = false;
+   myRingDirty = false;
+   myRingTime = 0;
+   myLastFrameTime = 0.0;
+   myEdgesEnabled = false;
+   myEdgesDropped = 0;
+   myCapturing = false;
+   myReplaySpeed = 1.0;
+   myReplayStarted = false;
+   myReplayStart = 0;
+   myReplayTime = 0.0;
+   myPublished = NULL;
+   myShared = NULL;
+   pthread_mutex_init( &myAcqMutex, NULL );
+   pthread_cond_init( &myAcqCond, NULL );
  }
 
 /**
@@ -68,22 +182,12 @@ bool JoyDevCompare( JoyDev i, JoyDev j )
  */
 Joystick::~Joystick()
 {
-  if( myElements != NULL )
-  {
-    CFRelease( myElements );
-    myElements = NULL;
-  }
-  if( myDevice != NULL )
-  {
-//    CFRelease( myDevice );  // Causes segfault 11?
-    myDevice = NULL;
-  }
-  if( myManager != NULL )
-  {
-    IOHIDManagerClose(myManager, kIOHIDOptionsTypeNone);  // Ignore output.
-    CFRelease(myManager);
-    myManager = NULL;
-  }
+  // The acquisition thread uses the device, so it must go first
+  StopAcquisition();
+  StopCapture();
+  pthread_cond_destroy( &myAcqCond );
+  pthread_mutex_destroy( &myAcqMutex );
+  ReleaseDevice();
 }
  
  /**
@@ -91,63 +195,50 @@ Joystick::~Joystick()
   * 
   * \param[in] joyLocation LocationKey of the selected Joystick. These can be obtained
   *                        from the QueryAvailableDevices function.
+  * \param[in] mode How the element values are acquired (see JoystickAcquisition).
   *
   * \return true if successful, false if unsuccessful (such as the joystick doesn't exist)
   */
-bool Joystick::Initialise( int32_t joyLocation )
+bool Joystick::Initialise( int32_t joyLocation, JoystickAcquisition mode )
 {
-  if( !InitialiseJoyManager() )
-  {
-    ERR_PRINTF("Failed to initialise the IO HID Manager.\n");
-    return false;
-  }
-#ifdef DEBUG
-  else DBG_PRINTF("Joystick::Initialise - Successfully opened the IO HID Manager.\n");
-#endif
-  
-  // Clear the output, buttons and axes storage
-  if( !myButtons.empty() ) myButtons.erase( myButtons.begin(), myButtons.end() );
-  if( !myAxes.empty() ) myAxes.erase( myAxes.begin(), myAxes.end() );
-  if( !myPOV.empty() ) myPOV.erase( myPOV.begin(), myPOV.end() );
-  if( !myOutputs.empty() ) myOutputs.erase( myOutputs.begin(), myOutputs.end() );
-  
-  // Open the device references
-  CFSetRef deviceRefs = IOHIDManagerCopyDevices(myManager);
+  // Stop acquiring from any previously initialised device
+  StopAcquisition();
+  StopCapture();
+  myRingEnabled = false;
+  DisableButtonEdges();
+  myMode = mode;
+  myPublished = NULL;
+  myShared = NULL;
+  ReleaseDevice();
+  ClearElements();
+  if( mode == kJoystick_Replay ) return false;
+  if( mode == kJoystick_Shared ) return InitialiseShared( joyLocation );
   
-  // If the device references are empty (NULL), it means there are no devices
-  if( deviceRefs == NULL ) return false;
-  
-  // Number of available devices
-  CFIndex numDevices = CFSetGetCount( deviceRefs );
-  
-  // Check to make sure at least some devices are available.
-  if( (size_t)numDevices < 1 )
+  // Look the device up in the registry, and create our own device reference from its
+  // service, so this Joystick can be scheduled on its own run loop.
+  JoyRegistry &registry = SharedJoyRegistry();
+  JoyDeviceEntry entry;
+  if( !registry.FindByLocation( joyLocation, entry ) )
   {
-    DBG_PRINTF("Joystick::Initialise - No devices to initialise.\n" );
-    CFRelease( deviceRefs );
+    DBG_PRINTF("Requested device could not be found.\n");
     return false;
   }
-  
-  // Move the device references into a vector
-  vector<const void *> devices (numDevices, 0);
-  CFSetGetValues( deviceRefs, &devices.front() );
-  CFRelease( deviceRefs );
-  
-  // Loop through all devices, checking for a matching LocationKey. This isn't the ideal
-  // way of doing it, but since the expected number of devices will only ever be small,
-  // it should suffice.
-  myDevice = NULL;
-  for( size_t ii=0; ii<(size_t)numDevices; ii++ )
+  myInfo.locationKey = entry.locationKey;
+  myInfo.vendorID = entry.vendorID;
+  myInfo.productID = entry.productID;
+  myInfo.productKey = entry.productKey;
+  myDevice = IOHIDDeviceCreate( kCFAllocatorDefault, (io_service_t)(uintptr_t)entry.handle );
+  registry.ReleaseHandle( entry.handle );
+  if( myDevice == NULL )
   {
-    if( joyLocation == GetLocationKey( (IOHIDDeviceRef)devices[ii] ) )
-    {
-      myDevice = (IOHIDDeviceRef)devices[ii];
-      break;
-    }
+    ERR_PRINTF("Failed to create a reference to the requested device.\n");
+    return false;
   }
-  if( myDevice == NULL )
+  if( IOHIDDeviceOpen( myDevice, kIOHIDOptionsTypeNone ) != kIOReturnSuccess )
   {
-    DBG_PRINTF("Requested device could not be found.\n");
+    ERR_PRINTF("Failed to open the requested device.\n");
+    CFRelease( myDevice );
+    myDevice = NULL;
     return false;
   }
   
@@ -170,8 +261,7 @@ bool Joystick::Initialise( int32_t joyLocation )
   }
 
 #ifdef DEBUG
-  string thisName = GetProductKey( myDevice );
-  DumpJoystick dj( thisName.c_str(), myDevice );
+  DumpJoystick dj( entry.productKey.c_str(), myDevice );
 #endif
   
   // Loop through elements
@@ -197,6 +287,10 @@ bool Joystick::Initialise( int32_t joyLocation )
           {
             DBG_PRINTF("HatSwitch at %i\n",(int)ii);
             myPOV.push_back( POV( myDevice, element ) );
+            JoyCaptureRange range = { (int32_t)IOHIDElementGetLogicalMin( element ),
+                                      (int32_t)IOHIDElementGetLogicalMax( element ), 0, 0 };
+            myInfo.povs.push_back( range );
+            MapElement( element, kJoystick_POVs, myPOV.size()-1 );
             continue;
           }
 #ifdef DEBUG
@@ -204,12 +298,21 @@ bool Joystick::Initialise( int32_t joyLocation )
           else DBG_PRINTF("Axis at %i: usage 0x%X\n",(int)ii,usage);
 #endif
           myAxes.push_back( Axes( myDevice, element ) );
+          myAxisTable.Add( IOHIDElementGetLogicalMin( element ),
+                           IOHIDElementGetLogicalMax( element ),
+                           IOHIDElementIsRelative( element ) );
+          JoyCaptureRange range = { (int32_t)IOHIDElementGetLogicalMin( element ),
+                                    (int32_t)IOHIDElementGetLogicalMax( element ),
+                                    IOHIDElementIsRelative( element ) ? 1u : 0u, 0 };
+          myInfo.axes.push_back( range );
+          MapElement( element, kJoystick_Axes, myAxes.size()-1 );
         }
         break;
         
       case kIOHIDElementTypeInput_Button:
         DBG_PRINTF("Button at %i\n", (int)ii );
         myButtons.push_back( Button( myDevice, element ) );
+        MapElement( element, kJoystick_Buttons, myButtons.size()-1 );
         break;
         
       case kIOHIDElementTypeOutput:
@@ -224,312 +327,1637 @@ bool Joystick::Initialise( int32_t joyLocation )
   dj.Close();
 #endif
 
+  myInfo.numButtons = myButtons.size();
+  myInfo.numOutputs = myOutputs.size();
+  AllocateScratch();
+  if( CompileOutputPlan() )
+  {
+    DBG_PRINTF("Joystick::Initialise - Outputs are sent as whole reports.\n");
+  }
+  
+  // Fall back to value callbacks if the report descriptor can't be used
+  if( myMode == kJoystick_RawReports && !CompileReportPlan() )
+  {
+    DBG_PRINTF("Joystick::Initialise - No usable report descriptor, using value callbacks.\n");
+    myMode = kJoystick_EventDriven;
+  }
+  myInfo.mode = (int32_t)myMode;
+  
+  if( myMode != kJoystick_Polled && !StartAcquisition() )
+  {
+    ERR_PRINTF("Failed to start the acquisition thread.\n");
+    return false;
+  }
+  
+  if( !myPerf.Attach( joyLocation, (int32_t)myMode ) )
+  {
+    DBG_PRINTF("Joystick::Initialise - Too many joysticks, not counting this one.\n");
+  }
+
   return true;
 }
-  
+
+
 /**
- * \brief Query joystick for IO capabilities
+ * \brief Initialise the Joystick from a capture file (see StartCapture) instead of a
+ *  device. The captured values are played into the snapshot as the joystick is polled,
+ *  so the joystick looks the same as the captured one, except that it has no outputs
+ *  to push to.
  *
- * \return An vector containing the number of axes, buttons, pov, outputs. If the joystick
- *         has not been initialised yet, the result will be all -1.
+ * \param[in] path Capture file name.
+ * \param[in] speed Capture seconds played per second of real time, starting from the
+ *  first poll. Zero plays the capture up to the time given to SetReplayTime instead,
+ *  such as the simulation time, and the time stamps are then the capture times.
+ * \return true if successful, false if the file isn't a readable capture.
  */
-vector<int> Joystick::QueryIO( void )
+bool Joystick::InitialiseReplay( const char *path, double speed )
 {
-  vector<int> result(4,-1);
-  if( myElements != NULL )
+  StopAcquisition();
+  StopCapture();
+  myRingEnabled = false;
+  DisableButtonEdges();
+  myMode = kJoystick_Replay;
+  myPublished = NULL;
+  myShared = NULL;
+  ReleaseDevice();
+  ClearElements();
+  if( !myReplay.Open( path ) )
   {
-    result[ kJoystick_Axes ] = myAxes.size();
-    result[ kJoystick_Buttons ] = myButtons.size();
-    result[ kJoystick_POVs ] = myPOV.size();
-    result[ kJoystick_Outputs ] = myOutputs.size();
+    DBG_PRINTF("Joystick::InitialiseReplay - %s is not a readable capture.\n", path);
+    return false;
   }
-  return result;
+  
+  // Stand in elements with the captured ranges
+  const JoyCapture &capture = myReplay.Capture();
+  const JoyCaptureHeader &header = capture.Header();
+  JoyCaptureInfo info;
+  info.locationKey = header.locationKey;
+  info.vendorID = header.vendorID;
+  info.productID = header.productID;
+  info.mode = (int32_t)myMode;
+  info.productKey = capture.ProductKey();
+  info.numButtons = capture.Count( kJoystick_Buttons );
+  info.numOutputs = capture.Count( kJoystick_Outputs );
+  for( size_t ii=0; ii<capture.Count( kJoystick_Axes ); ii++ )
+  {
+    info.axes.push_back( capture.Range( kJoystick_Axes, ii ) );
+  }
+  for( size_t ii=0; ii<capture.Count( kJoystick_POVs ); ii++ )
+  {
+    info.povs.push_back( capture.Range( kJoystick_POVs, ii ) );
+  }
+  AddStandIns( info );
+  AllocateScratch();
+  mySnapshot.Resize( myAxes.size(), myButtons.size(), myPOV.size() );
+  MarkRelativeAxes();
+  myPacked.assign( max( mySnapshot.PackedSize(), (size_t)1 ), 0 );
+  
+  // The replay starts at the first poll (or SetReplayTime)
+  myReplaySpeed = max( speed, 0.0 );
+  myReplayStarted = false;
+  myReplayTime = 0.0;
+  
+  if( !myPerf.Attach( header.locationKey, (int32_t)myMode ) )
+  {
+    DBG_PRINTF("Joystick::InitialiseReplay - Too many joysticks, not counting this one.\n");
+  }
+  return true;
 }
-   
+
 /**
- * \brief Poll the joystick axes
- *
- * \output vector of normalised axes doubles.
+ * \brief Attach to a joystick published by the acquisition daemon (kJoystick_Shared).
  */
-vector<double> Joystick::PollAxes( void )
+bool Joystick::InitialiseShared( int32_t joyLocation )
 {
-  vector<double> axes( myAxes.size(), 0.0 );
-  for( size_t ii=0; ii<myAxes.size(); ii++ )
+  JoyShmSegment *segment = SharedJoyShm();
+  if( segment == NULL )
+  {
+    DBG_PRINTF("Joystick::InitialiseShared - The acquisition daemon is not running.\n");
+    return false;
+  }
+  JoyCaptureInfo info;
+  void *storage = segment->Find( joyLocation, info );
+  if( storage == NULL )
   {
-    axes[ ii ] = myAxes[ ii ].ReadState();
+    DBG_PRINTF("Joystick::InitialiseShared - Joystick %i is not published.\n", joyLocation);
+    return false;
   }
-  return axes;
+  AddStandIns( info );
+  AllocateScratch();
+  // The daemon has already initialised the storage, and the mapping is read-only
+  mySnapshot.Place( storage, myAxes.size(), myButtons.size(), myPOV.size(), false );
+  // Readers would otherwise wait forever on a daemon killed in the middle of a write
+  mySnapshot.SetWriterCheck( JoyShmAlive, segment );
+  myShared = segment;
+  myPacked.assign( max( mySnapshot.PackedSize(), (size_t)1 ), 0 );
+  // The daemon has been summing the relative axes for a while, so start from here
+  ResetRelativeAxes();
+  
+  if( !myPerf.Attach( joyLocation, (int32_t)myMode ) )
+  {
+    DBG_PRINTF("Joystick::InitialiseShared - Too many joysticks, not counting this one.\n");
+  }
+  return true;
 }
 
 /**
- * \brief Poll the joystick buttons
+ * \brief Play a capture up to the given time. Only used when InitialiseReplay was
+ *  given a speed of zero.
  *
- * \output vector of button boolean values.
+ * \param[in] time Capture time (seconds).
  */
-vector<bool> Joystick::PollButtons( void )
+void Joystick::SetReplayTime( double time )
 {
-  vector<bool> buttons( myButtons.size(), FALSE );
-  for( size_t ii=0; ii<myButtons.size(); ii++ )
+  if( myMode != kJoystick_Replay || myReplaySpeed > 0.0 ) return;
+  if( !myReplayStarted )
   {
-    buttons[ ii ] = myButtons[ ii ].ReadState();
+    myReplay.Start( &mySnapshot, 0, 1.0 );
+    myReplayStarted = true;
   }
-  return buttons;
+  myReplayTime = time;
+  myReplay.Advance( time );
 }
-    
+
 /**
- * \brief Poll the joystick POV hats
+ * \brief Record every element value change, with its time stamp, into a capture file
+ *  (see joycapture.hpp). The current values are recorded first. In kJoystick_Polled
+ *  mode, only the values read by the polls are recorded.
  *
- * \output vector of POV doubles. The value corresponds to the angle (degrees) and
- *         -1 corresponds to nothing pressed.
+ * \param[in] path Capture file name. An existing file is overwritten.
+ * \return true if successful, false if the file could not be created (or the
+ *  joystick is itself a replay, or shared).
  */
-vector<double> Joystick::PollPOV( void )
+bool Joystick::StartCapture( const char *path )
 {
-  vector<double> POVs( myPOV.size(), -1.0 );
-  for( size_t ii=0; ii<myPOV.size(); ii++ )
+  if( myElements == NULL || myMode == kJoystick_Replay ) return false;
+  StopCapture();
+  
+  // The writer belongs to the acquisition thread, so it is swapped while the thread is
+  // stopped. Restarting the thread reseeds the snapshot, which records the current
+  // values.
+  bool restart = myAcqStarted;
+  StopAcquisition();
+  myCapturing = myCapture.Open( path, myInfo, JoyNowTicks() );
+  if( restart && !StartAcquisition() )
   {
-    POVs[ ii ] = myPOV[ ii ].ReadState();
+    ERR_PRINTF("Joystick::StartCapture - Failed to restart the acquisition thread.\n");
   }
-  return POVs;
+  return myCapturing;
 }
 
 /**
- * \brief Push values to the joystick inputs (such as force feedback)
+ * \brief Stop recording, and close the capture file.
+ *
+ * \return true if every value was written, false if any write failed.
  */
-void Joystick::PushInputs( vector<double> normInputs )
+bool Joystick::StopCapture( void )
 {
-  for( size_t ii=0; ii<myOutputs.size(); ii++ )
+  if( !myCapturing ) return true;
+  bool restart = myAcqStarted;
+  StopAcquisition();
+  myCapturing = false;
+  bool result = myCapture.Close();
+  if( restart && !StartAcquisition() )
   {
-    myOutputs[ ii ].SetValue( normInputs[ ii ] );
+    ERR_PRINTF("Joystick::StopCapture - Failed to restart the acquisition thread.\n");
   }
-//  UNUSED( normInputs );
-//#ifdef ERROR_OUT
-//  static bool onceOff = true;
-//  if( onceOff )
-//  {
-//    onceOff = false;
-//    ERR_PRINTF("Joystick::PushInputs has not been implemented.");
-//  }
-//#endif
+  return result;
 }
 
 /**
- * \brief Query for the available device names
+ * \brief Publish the joystick in a shared memory segment (daemon only). The snapshot
+ *  moves into the device's slot, so the acquisition thread writes every value
+ *  straight to the readers. Only for kJoystick_EventDriven and kJoystick_RawReports.
  *
- * \output vector JoyDev devices (which contain Product names and location values).
+ * \param[in] segment Segment made by JoyShmSegment::Create. It must stay open until
+ *  the joystick is withdrawn and reinitialised (or destroyed).
+ * \return true if successful, false if the joystick has no acquisition thread or
+ *  there is no room for it.
  */
-vector<JoyDev> Joystick::QueryAvailableDevices( void )
+bool Joystick::Publish( JoyShmSegment &segment )
 {
-  vector<JoyDev> result;
-  
-  // Open the IO HID manager (sub-function tests whether it is already open already)
-  if( !InitialiseJoyManager() )
-  {
-    ERR_PRINTF("Joystick::QueryDeviceNames - Failed to initialise the IO HID manager.");
-    return result;
-  }
-  
-  // Open the device references
-  CFSetRef deviceRefs = IOHIDManagerCopyDevices(myManager);
-  
-  // If the device references are empty (NULL), it means there are no devices
-  if( deviceRefs == NULL ) return result;
-  
-  // Number of available devices
-  CFIndex numDevices = CFSetGetCount( deviceRefs );
+  if( !myAcqStarted ) return false;
+  void *storage = segment.Publish( myInfo );
+  if( storage == NULL ) return false;
   
-  // Move the device references into a vector
-  vector<const void *> devices (numDevices, 0);
-  CFSetGetValues( deviceRefs, &devices.front() );
-  CFRelease( deviceRefs );
+  // The snapshot can only move while the acquisition thread is stopped. Restarting it
+  // seeds the published snapshot with the current values.
+  myRingEnabled = false;
+  StopAcquisition();
+  DisableButtonEdges();
+  myPublished = storage;
+  return StartAcquisition();
+}
   
-  // Loop through the devices, and add them to the output vector
-  for( CFIndex ii=0; ii<numDevices; ii++ )
+/**
+ * \brief Query joystick for IO capabilities
+ *
+ * \return An vector containing the number of axes, buttons, pov, outputs. If the joystick
+ *         has not been initialised yet, the result will be all -1. A replayed joystick
+ *         has the outputs of the captured one, and a shared joystick those of the
+ *         device, although nothing is pushed to them.
+ */
+vector<int> Joystick::QueryIO( void )
+{
+  vector<int> result(4,-1);
+  if( myElements != NULL || myMode == kJoystick_Replay || myMode == kJoystick_Shared )
   {
-    JoyDev thisDev;
-    thisDev.productKey = GetProductKey( (IOHIDDeviceRef)devices[ii] );
-    thisDev.locationKey = GetLocationKey( (IOHIDDeviceRef)devices[ii] );
-    result.push_back( thisDev );
+    result[ kJoystick_Axes ] = myAxes.size();
+    result[ kJoystick_Buttons ] = myButtons.size();
+    result[ kJoystick_POVs ] = myPOV.size();
+    result[ kJoystick_Outputs ] = myInfo.numOutputs;
   }
-  
-  // Now sort the values before returning them.
-  sort( result.begin(), result.end(), JoyDevCompare );
   return result;
 }
-  
+
+
 /**
- * \brief Query for the number of available devices
+ * \brief LocationKey of the joystick, or of the captured one for a replay.
+ */
+int32_t Joystick::LocationKey( void ) const
+{
+  return myInfo.locationKey;
+}   
+
+/**
+ * \brief Acquisition mode in use, which is kJoystick_EventDriven if
+ *  kJoystick_RawReports was asked for but the report descriptor couldn't be used.
+ */
+JoystickAcquisition Joystick::Acquisition( void ) const
+{
+  return myMode;
+}
+
+/**
+ * \brief Poll the joystick axes
  *
- * \output number of available devices
+ * \output vector of normalised axes doubles.
  */
-unsigned int Joystick::QueryNumberDevices( void )
+vector<double> Joystick::PollAxes( void )
 {
-  // Open the IO HID manager (sub-function tests whether it is already open already)
-  if( !InitialiseJoyManager() )
-  {
-    ERR_PRINTF("Joystick::QueryDeviceNames - Failed to initialise the IO HID manager.");
-    return 0;
-  }
-  
-  // Copy the devices
-  CFSetRef deviceRefs = IOHIDManagerCopyDevices(myManager);
-  
-  // If none (NULL), it means there are no devices
-  if( deviceRefs == NULL ) return 0;
-  
-  // Copy the number of devices and release the set
-  unsigned int devCount = CFSetGetCount( deviceRefs );
-  CFRelease( deviceRefs );
-  
-  // Otherwise return the number of devices
-  return devCount;
+  vector<double> axes( myAxes.size(), 0.0 );
+  if( !axes.empty() ) PollAxesInto( &axes.front(), axes.size() );
+  return axes;
 }
 
 /**
- * \brief Initialise the IOHID manager
+ * \brief Poll the joystick axes into a caller supplied buffer. Does not allocate.
  *
- * \output true if successful, false if unsuccessful.
+ * \param[out] dest Buffer for the normalised axes.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of axes on the joystick.
  */
-bool Joystick::InitialiseJoyManager( void )
+size_t Joystick::PollAxesInto( double *dest, size_t len )
 {
-  // If the manager is already open
-  if( myManager != NULL ) return true;
+  uint64_t start = JoyNowTicks();
+  size_t num = min( len, myAxes.size() );
+  ReadRawAxes( num );
+  // Normalise all of the axes in one pass, then process them
+  myAxisTable.Normalise( &myRaw.front(), dest, num );
+  if( myPipeline.Active() ) myPipeline.Process( dest, num );
+  myPerf.RecordPoll( start, myMode == kJoystick_Polled ? (uint32_t)num : 0 );
+  return myAxes.size();
+}
 
-  // Create IO HID manager
-  myManager = IOHIDManagerCreate( kCFAllocatorDefault, kIOHIDManagerOptionNone );
-  if( myManager == NULL ){
-    ERR_PRINTF("Failed to create the IO HID Manager.\n");
-    return false;
-  }
-  
-  // Open IO HID manager
-  IOReturn openResult =  IOHIDManagerOpen( myManager, kIOHIDManagerOptionNone );
-  
-  // Check the result of opening the IO HID manager
-  if( openResult != kIOReturnSuccess )
+/**
+ * \brief Poll the joystick axes into a caller supplied buffer of another type. Does
+ *  not allocate. double and float read the normalised axes, as PollAxesInto does. The
+ *  integer types (int16_t, uint16_t and int32_t) read the raw counts instead,
+ *  saturated to the type, which skips the normalisation and the axis processing.
+ *
+ * \param[out] dest Buffer for the axes.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of axes on the joystick.
+ */
+template<typename T>
+size_t Joystick::PollAxes( T *dest, size_t len )
+{
+  size_t num = min( len, myAxes.size() );
+  if( !AxisCounts<T>::value )
   {
-    ERR_PRINTF("Failed to open the IO HID Manager.\n");
-    CFRelease( myManager );
-    myManager = NULL;
-    return false;
+    PollAxesInto( &myTypedScratch.front(), num );
+    StoreValues( &myTypedScratch.front(), dest, num );
+    return myAxes.size();
   }
+  uint64_t start = JoyNowTicks();
+  ReadRawAxes( num );
+  myAxisTable.Counts( &myRaw.front(), num );
+  StoreCounts( &myRaw.front(), dest, num );
+  myPerf.RecordPoll( start, myMode == kJoystick_Polled ? (uint32_t)num : 0 );
+  return myAxes.size();
+}
 
-  // Magic numbers telling the system to access joysticks (and associated)
-  uint32_t page = kHIDPage_GenericDesktop;
-  const uint32_t usages[] = { kHIDUsage_GD_Joystick,
-                              kHIDUsage_GD_GamePad,
-                              kHIDUsage_GD_MultiAxisController };
-  
-  CFMutableArrayRef myMatching = CFArrayCreateMutable( kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks );
-  if( myMatching == NULL )
-  {
-    ERR_PRINTF("Failed to create CFMutableArrayRef.\n");
-    return false;
-  }
-  
-  // Loop through and add the usages.
-  for( size_t ii=0; ii<(sizeof(usages)/sizeof(uint32_t)); ii++ )
-  {
-    CFMutableDictionaryRef matchingDict = CFDictionaryCreateMutable( kCFAllocatorDefault,
-                    1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks );
-    if( matchingDict == NULL )
-    {
-      ERR_PRINTF("Failed to create CFMutableDictionaryRef.\n");
-      return false;
-    }
-    
-    // Add the page reference
-    CFNumberRef pageRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &page);
-    if( pageRef == NULL )
-    {
-      ERR_PRINTF("Failed to create page CFNumberCreate.\n");
-      return false;
-    }
-    CFDictionarySetValue( matchingDict, CFSTR(kIOHIDDeviceUsagePageKey), pageRef );
-    CFRelease( pageRef );
-    
-    // Add the usage reference
-    CFNumberRef usageRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usages[ii] );
-    if( usageRef == NULL )
-    {
-      ERR_PRINTF("Failed to create the usage CFNumberRef.\n");
-      return false;
-    }
-    CFDictionarySetValue( matchingDict, CFSTR(kIOHIDDeviceUsageKey), usageRef );
-    CFRelease( usageRef );
-    
-    // Append the page-usage pairs to the CFArray
-    CFArrayAppendValue( myMatching, matchingDict );
-    CFRelease( matchingDict );
-  }
+template<>
+size_t Joystick::PollAxes<double>( double *dest, size_t len )
+{
+  return PollAxesInto( dest, len );
+}
 
-  IOHIDManagerSetDeviceMatchingMultiple( myManager, myMatching );
-  CFRelease( myMatching );
+template size_t Joystick::PollAxes<float>( float *dest, size_t len );
+template size_t Joystick::PollAxes<int16_t>( int16_t *dest, size_t len );
+template size_t Joystick::PollAxes<uint16_t>( uint16_t *dest, size_t len );
+template size_t Joystick::PollAxes<int32_t>( int32_t *dest, size_t len );
 
+/**
+ * \brief Logical range of an axis, which its raw counts are normalised over.
+ *
+ * \param[in] axis Index of the axis.
+ * \param[out] logmin Logical minimum.
+ * \param[out] logmax Logical maximum.
+ * \output true if successful, false if there is no such axis.
+ */
+bool Joystick::AxisRange( size_t axis, int32_t &logmin, int32_t &logmax ) const
+{
+  if( axis >= myAxisTable.Size() ) return false;
+  myAxisTable.Range( axis, logmin, logmax );
   return true;
 }
 
 /**
- * \brief Returns the LocationKey of the input device.
+ * \brief Read the newest normalised axes from any thread, such as the force feedback
+ *  effect engine's (see joyeffects.hpp). Unlike PollAxesInto this only copies the
+ *  snapshot, and leaves the device, the replay and the counters alone, so it isn't
+ *  available in kJoystick_Polled mode. Relative axes read as their position since the
+ *  acquisition first started. Restarts of the acquisition (captures, frames) keep the
+ *  snapshot where it is, but Initialise, Publish and Close move or free it, so they
+ *  must not be called while another thread reads.
  *
- * \param[in] dev Device to extract the LocationKey from.
- * \return LocationKey, or 0 if there was an error.
+ * \param[out] dest Buffer for the normalised axes.
+ * \param[out] scratch Buffer for the raw values, one per axis on the joystick.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of axes on the joystick, or 0 in kJoystick_Polled mode.
  */
-int32_t Joystick::GetLocationKey( IOHIDDeviceRef dev )
+size_t Joystick::ReadAxesInto( double *dest, int32_t *scratch, size_t len ) const
 {
-  CFTypeRef locRef = IOHIDDeviceGetProperty( dev, CFSTR(kIOHIDLocationIDKey) );
-  if( locRef == NULL )
-  {
-    ERR_PRINTF("Device returned a NULL location key.");
-    return 0;
-  }
-  else if( CFGetTypeID( (CFNumberRef)locRef) == CFNumberGetTypeID() )
-  {
-    if( CFNumberGetType( (CFNumberRef)locRef) == kCFNumberSInt32Type )
-    {
-      int32_t devLocInt;
-      CFNumberGetValue( (CFNumberRef)locRef, kCFNumberSInt32Type, (void *)&devLocInt );
-      return devLocInt;
-    }
-    else
-    {
-      ERR_PRINTF("Device returned a location key that wasn't an int32.");
-      return 0;
-    }
-  }
-  else
-  {
-    ERR_PRINTF("Device returned a location key that wasn't a number.");
-    return 0;
-  }
+  if( myMode == kJoystick_Polled || myAxes.empty() ) return 0;
+  mySnapshot.Read( kJoystick_Axes, scratch );
+  myAxisTable.Scale( scratch, dest, min( len, myAxes.size() ) );
+  return myAxes.size();
 }
 
 /**
- * \brief Returns the ProductKey for the input device.
- * \param[in] dev Device to extract the ProductKey from.
- * \return A string object with the ProductKey in it. The string may be empty if the
- *         there was an error (or the device doesn't have a product key).
+ * \brief Process the normalised axes (calibration, deadzones, response curves and low
+ *  pass filters, see axispipeline.hpp) before PollAxesInto and PollFrames return them.
+ *  ReadAxesInto is left unprocessed. The processing (and the filter state) belongs to
+ *  the joystick, so a pooled joystick must be claimed first (see JoySessionPool::Claim).
+ *
+ * \param[in] config Processing of each axis.
+ * \param[in] len Length of config. Axes beyond len are left as they are.
+ * \param[in] rate Rate at which the axes are polled (Hz), for the filters. For frames,
+ *  the filters are stepped once per row.
+ * \output true if successful, false if a setting is out of range.
  */
-string Joystick::GetProductKey( IOHIDDeviceRef dev )
+bool Joystick::SetAxisProcessing( const AxisProcessing *config, size_t len, double rate )
 {
-  string devStr;
-  // Extract the Product Key string
-  CFTypeRef devProdRef = IOHIDDeviceGetProperty( dev, CFSTR(kIOHIDProductKey) );
-  if( devProdRef == NULL )
-  {
-    ERR_PRINTF("Device returned a NULL product key.");
-    return devStr;
-  }
-  else if( CFGetTypeID(devProdRef) == CFStringGetTypeID() )
+  myAxisTable.ClearLookup();
+  if( !myPipeline.Configure( config, len, myAxes.size(), rate ) ) return false;
+  // Bake the calibration, deadzones and curves into lookup tables, so that only the
+  // filters (and the axes without a table) are left to the pipeline. Plain scaling is
+  // quicker than a table, so filters alone don't need one.
+  if( !myPipeline.Shapes() ) return true;
+  myAxisTable.BuildLookup( &myPipeline );
+  for( size_t ii=0; ii<myAxes.size(); ii++ )
   {
-    char buffer[256];
-    CFStringGetCString( (CFStringRef)devProdRef, buffer,  sizeof(buffer),
-                                                                kCFStringEncodingUTF8 );
-    devStr.append( buffer );
-    return devStr;
+    if( myAxisTable.HasLookup( ii ) ) myPipeline.Bypass( ii );
   }
-  else
+  return true;
+}
+
+/**
+ * \brief Stop processing the axes.
+ */
+void Joystick::ClearAxisProcessing( void )
+{
+  myPipeline.Clear();
+  myAxisTable.ClearLookup();
+}
+
+/**
+ * \brief Choose whether relative axes (such as those of 3D mice and trackballs) read
+ *  as their accumulated position, or as their change since the last poll (or frame
+ *  row). Every change is integrated as it arrives, so none is lost between polls,
+ *  except in kJoystick_Polled mode, which only sees the value at each poll.
+ *
+ * \param[in] mode What the relative axes read as.
+ */
+void Joystick::SetRelativeMode( AxisRelativeMode mode )
+{
+  myAxisTable.SetRelativeMode( mode );
+}
+
+/**
+ * \brief Move the origin of the relative axes to their current position, so that
+ *  their positions restart from zero and their next change is measured from now.
+ */
+void Joystick::ResetRelativeAxes( void )
+{
+  if( myAxisTable.Relative().empty() ) return;
+  if( myMode == kJoystick_Polled )
+  {
+    myAxisTable.RebaseRelative( &myPolledCounts.front(), myPolledCounts.size(), true );
+    return;
+  }
+  if( myMode == kJoystick_Replay ) AdvanceReplay();
+  mySnapshot.Read( kJoystick_Axes, &myRaw.front() );
+  myAxisTable.RebaseRelative( &myRaw.front(), myAxes.size(), true );
+}
+
+/**
+ * \brief Whether the joystick has any relative axes (see SetRelativeMode).
+ */
+bool Joystick::HasRelativeAxes( void ) const
+{
+  return !myAxisTable.Relative().empty();
+}
+
+/**
+ * \brief Poll the joystick buttons
+ *
+ * \output vector of button boolean values.
+ */
+vector<bool> Joystick::PollButtons( void )
+{
+  vector<bool> buttons( myButtons.size(), FALSE );
+  PollButtonMask( &myButtonWords.front(), myButtonWords.size() );
+  for( size_t ii=0; ii<myButtons.size(); ii++ )
+  {
+    buttons[ ii ] = GetButtonMaskBit( &myButtonWords.front(), ii );
+  }
+  return buttons;
+}
+
+/**
+ * \brief Poll the joystick buttons into a caller supplied buffer. Does not allocate.
+ *
+ * \param[out] dest Buffer for the button states (0 or 1).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of buttons on the joystick.
+ */
+size_t Joystick::PollButtonsInto( uint8_t *dest, size_t len )
+{
+  PollButtonMask( &myButtonWords.front(), myButtonWords.size() );
+  ExpandButtonMask( &myButtonWords.front(), min( len, myButtons.size() ), dest );
+  return myButtons.size();
+}
+
+/**
+ * \brief Poll the joystick buttons as a packed mask (see buttonmask.hpp).
+ *
+ * \param[out] dest Buffer for the mask. Button n is bit (n%64) of word n/64.
+ * \param[in] numWords Length of dest in words. Buttons beyond 64*numWords are dropped.
+ * \output Number of buttons on the joystick.
+ */
+size_t Joystick::PollButtonMask( uint64_t *dest, size_t numWords )
+{
+  uint64_t start = JoyNowTicks();
+  size_t words = min( numWords, ButtonMaskWords( myButtons.size() ) );
+  if( myMode != kJoystick_Polled )
+  {
+    if( myMode == kJoystick_Replay ) AdvanceReplay();
+    else if( myMode == kJoystick_Shared ) CheckShared();
+    if( words == ButtonMaskWords( myButtons.size() ) )
+    {
+      mySnapshot.ReadButtonMask( dest );
+    }
+    else
+    {
+      mySnapshot.ReadButtonMask( &myButtonWords.front() );
+      copy( myButtonWords.begin(), myButtonWords.begin()+words, dest );
+    }
+    myPerf.RecordPoll( start, 0 );
+    return myButtons.size();
+  }
+  size_t num = min( myButtons.size(), words*64 );
+  uint64_t *times = &myPolledTimes.front() + PolledTimeOffset( kJoystick_Buttons );
+  for( size_t ii=0; ii<words; ii++ ) dest[ ii ] = 0;
+  try
+  {
+    for( size_t ii=0; ii<num; ii++ )
+    {
+      bool pressed = myButtons[ ii ].ReadRaw( &times[ ii ] ) != 0;
+      if( pressed ) SetButtonMaskBit( dest, ii, true );
+      UpdateNewestTime( times[ ii ] );
+      if( myCapturing ) myCapture.Record( kJoystick_Buttons, ii, pressed ? 1 : 0, times[ ii ] );
+    }
+  }
+  catch( const char *message )
+  {
+    myPerf.RecordException();
+    throw;
+  }
+  myPerf.RecordPoll( start, (uint32_t)num );
+  return myButtons.size();
+}
+    
+/**
+ * \brief Poll the joystick POV hats
+ *
+ * \output vector of POV doubles. The value corresponds to the angle (degrees) and
+ *         -1 corresponds to nothing pressed.
+ */
+vector<double> Joystick::PollPOV( void )
+{
+  vector<double> POVs( myPOV.size(), -1.0 );
+  if( !POVs.empty() ) PollPOVInto( &POVs.front(), POVs.size() );
+  return POVs;
+}
+
+/**
+ * \brief Poll the joystick POV hats into a caller supplied buffer. Does not allocate.
+ *
+ * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of POV hats on the joystick.
+ */
+size_t Joystick::PollPOVInto( double *dest, size_t len )
+{
+  uint64_t start = JoyNowTicks();
+  size_t num = min( len, myPOV.size() );
+  if( myMode != kJoystick_Polled )
+  {
+    if( myMode == kJoystick_Replay ) AdvanceReplay();
+    else if( myMode == kJoystick_Shared ) CheckShared();
+    mySnapshot.Read( kJoystick_POVs, &myRaw.front() );
+    for( size_t ii=0; ii<num; ii++ )
+    {
+      dest[ ii ] = myPOV[ ii ].Decode( myRaw[ ii ] );
+    }
+    myPerf.RecordPoll( start, 0 );
+    return myPOV.size();
+  }
+  uint64_t *times = &myPolledTimes.front() + PolledTimeOffset( kJoystick_POVs );
+  try
+  {
+    for( size_t ii=0; ii<num; ii++ )
+    {
+      long raw = myPOV[ ii ].ReadRaw( &times[ ii ] );
+      dest[ ii ] = myPOV[ ii ].Decode( raw );
+      UpdateNewestTime( times[ ii ] );
+      if( myCapturing ) myCapture.Record( kJoystick_POVs, ii, (int32_t)raw, times[ ii ] );
+    }
+  }
+  catch( const char *message )
+  {
+    myPerf.RecordException();
+    throw;
+  }
+  myPerf.RecordPoll( start, (uint32_t)num );
+  return myPOV.size();
+}
+
+/**
+ * \brief Poll the joystick POV hats into a caller supplied buffer of another type.
+ *  Does not allocate. Angles are rounded to whole degrees for the integer types.
+ *
+ * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of POV hats on the joystick.
+ */
+template<typename T>
+size_t Joystick::PollPOV( T *dest, size_t len )
+{
+  size_t num = min( len, myPOV.size() );
+  PollPOVInto( &myTypedScratch.front(), num );
+  StoreValues( &myTypedScratch.front(), dest, num );
+  return myPOV.size();
+}
+
+template<>
+size_t Joystick::PollPOV<double>( double *dest, size_t len )
+{
+  return PollPOVInto( dest, len );
+}
+
+template size_t Joystick::PollPOV<float>( float *dest, size_t len );
+template size_t Joystick::PollPOV<int16_t>( int16_t *dest, size_t len );
+template size_t Joystick::PollPOV<int32_t>( int32_t *dest, size_t len );
+
+/**
+ * \brief Time stamps (ticks, see joytime.hpp) of the latest value of each element of
+ *  the given type. In kJoystick_Polled mode, these are the values read by the last
+ *  poll of that type.
+ *
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ * \param[out] dest Buffer for the time stamps.
+ * \param[in] len Length of dest. At most len values are written.
+ * \output Number of elements of the given type.
+ */
+size_t Joystick::PollTimesInto( JoystickIOIndex type, uint64_t *dest, size_t len )
+{
+  size_t count;
+  switch( type )
+  {
+    case kJoystick_Axes: count = myAxes.size(); break;
+    case kJoystick_Buttons: count = myButtons.size(); break;
+    case kJoystick_POVs: count = myPOV.size(); break;
+    default: return 0;
+  }
+  size_t num = min( len, count );
+  if( myMode != kJoystick_Polled )
+  {
+    if( num == count )
+    {
+      mySnapshot.ReadTimes( type, dest );
+    }
+    else
+    {
+      mySnapshot.ReadTimes( type, &myTimeScratch.front() );
+      copy( myTimeScratch.begin(), myTimeScratch.begin()+num, dest );
+    }
+    return count;
+  }
+  const uint64_t *times = &myPolledTimes.front() + PolledTimeOffset( type );
+  copy( times, times+num, dest );
+  return count;
+}
+
+/**
+ * \brief Time stamp (ticks) of the newest value of any element, or 0 if none is known.
+ */
+uint64_t Joystick::NewestTimeStamp( void )
+{
+  if( myMode != kJoystick_Polled ) return mySnapshot.NewestTime();
+  return myPolledTimes.empty() ? 0 : myPolledTimes[ 0 ];
+}
+
+/**
+ * \brief Age of the newest value of any element. A replay played up to the time given
+ *  to SetReplayTime measures it in capture time, from that time.
+ *
+ * \output Seconds since the newest value was produced, or -1 if none is known.
+ */
+double Joystick::SampleAge( void )
+{
+  if( myMode == kJoystick_Replay && myReplaySpeed <= 0.0 )
+  {
+    // Its time stamps are capture times, not host ticks, so the age only depends on
+    // the replay time, and is as repeatable as the replay
+    if( !myReplayStarted || myReplay.Played() == 0 ) return -1.0;
+    double age = myReplayTime - JoyTicksToSeconds( mySnapshot.NewestTime() );
+    return age > 0.0 ? age : 0.0;
+  }
+  uint64_t newest = NewestTimeStamp();
+  if( newest == 0 ) return -1.0;
+  uint64_t now = JoyNowTicks();
+  // Time stamps taken on another thread may be a little ahead of our clock read
+  return now > newest ? JoyTicksToSeconds( now - newest ) : 0.0;
+}
+
+/**
+ * \brief Offset of the first time stamp of the given type in myPolledTimes.
+ */
+size_t Joystick::PolledTimeOffset( JoystickIOIndex type ) const
+{
+  switch( type )
+  {
+    case kJoystick_Axes: return 1;
+    case kJoystick_Buttons: return 1 + myAxes.size();
+    default: return 1 + myAxes.size() + myButtons.size();
+  }
+}
+
+/**
+ * \brief Record a time stamp read in kJoystick_Polled mode as the newest, if it is.
+ */
+void Joystick::UpdateNewestTime( uint64_t time )
+{
+  if( time > myPolledTimes[ 0 ] ) myPolledTimes[ 0 ] = time;
+}
+
+/**
+ * \brief Push values to the joystick inputs (such as force feedback)
+ */
+void Joystick::PushInputs( const vector<double> &normInputs )
+{
+  if( !normInputs.empty() ) PushInputs( &normInputs.front(), normInputs.size() );
+}
+
+/**
+ * \brief Push values to the joystick inputs (such as force feedback) from a caller
+ *  supplied buffer. Does not allocate.
+ *
+ * \param[in] normInputs Normalised values, one per joystick output.
+ * \param[in] len Length of normInputs. Outputs beyond len are left unchanged.
+ */
+void Joystick::PushInputs( const double *normInputs, size_t len )
+{
+  uint64_t start = JoyNowTicks();
+  size_t num = min( len, myOutputs.size() );
+  size_t calls = 0;
+  for( size_t ii=0; ii<num; ii++ )
+  {
+    int32_t value = myOutputs[ ii ].LogicalValue( normInputs[ ii ] );
+    if( myOutputPlan.Covers( ii ) ) myOutputPlan.Stage( ii, value );
+    else if( myOutputs[ ii ].Send( value ) ) calls++;
+  }
+  calls += myOutputPlan.Flush( myOutputSink );
+  myPerf.RecordPush( start, (uint32_t)calls );
+}
+
+/**
+ * \brief Mark the end of a simulation step, for the IOKit calls per step counter (see
+ *  joystats.hpp).
+ */
+void Joystick::EndStep( void )
+{
+  myPerf.EndStep();
+}
+
+/**
+ * \brief Record every sample into a ring buffer, for PollFrames. Only available when
+ *  values are acquired by callbacks or replayed (not kJoystick_Polled or
+ *  kJoystick_Shared). Any samples already in the ring are discarded.
+ *
+ * \param[in] capacity Number of samples the ring must hold between polls.
+ * \output true if successful, false if unsuccessful.
+ */
+bool Joystick::EnableFrames( size_t capacity )
+{
+  if( myMode == kJoystick_Polled || ( !myAcqStarted && myMode != kJoystick_Replay ) )
+    return false;
+  
+  // Keep each sample a whole number of 64-bit words, for the button mask
+  size_t stride = ( mySnapshot.PackedSize() + 1 ) & ~(size_t)1;
+  if( myMode == kJoystick_Replay )
+  {
+    // The replay is played by the polls, so there is no thread to stop
+    myRingEnabled = false;
+    myReplay.SetRing( NULL );
+    try
+    {
+      if( myRing.Capacity() < capacity || myRing.Stride() != stride )
+      {
+        myRing.Resize( capacity, stride );
+      }
+    }
+    catch( const char *message )
+    {
+      ERR_PRINTF("Joystick::EnableFrames - %s.\n", message);
+      return false;
+    }
+    myRing.Consume( myRing.Available() );
+    myReplay.SetRing( &myRing );
+    myRingEnabled = true;
+    return true;
+  }
+  if( myRing.Capacity() < capacity || myRing.Stride() != stride )
+  {
+    // The ring can only be resized while the acquisition thread is stopped
+    myRingEnabled = false;
+    StopAcquisition();
+    try
+    {
+      myRing.Resize( capacity, stride );
+    }
+    catch( const char *message )
+    {
+      ERR_PRINTF("Joystick::EnableFrames - %s.\n", message);
+      StartAcquisition();
+      return false;
+    }
+    if( !StartAcquisition() ) return false;
+  }
+  else
+  {
+    // Discard stale samples (such as from a previous simulation)
+    myRing.Consume( myRing.Available() );
+  }
+  __sync_synchronize();
+  myRingEnabled = true;
+  return true;
+}
+
+/**
+ * \brief Stop recording samples into the ring buffer.
+ */
+void Joystick::DisableFrames( void )
+{
+  myRingEnabled = false;
+  if( myMode == kJoystick_Replay ) myReplay.SetRing( NULL );
+}
+
+/**
+ * \brief Poll every sample recorded since the last call. Each buffer is a column
+ *  major frameSize by N matrix, with one row per sample (oldest first). If more than
+ *  frameSize samples are waiting, only the newest are kept. Rows without a new sample
+ *  repeat the newest one. Any buffer may be NULL to skip it.
+ *
+ * \param[in] frameSize Number of rows.
+ * \param[out] times Sample times (seconds, see joytime.hpp), frameSize long.
+ * \param[out] axes Normalised axes, frameSize by the number of axes.
+ * \param[out] buttons Button states (0 or 1), frameSize by the number of buttons.
+ * \param[out] povs POV angles, frameSize by the number of POV hats.
+ * \output Number of new samples, at most frameSize.
+ */
+size_t Joystick::PollFrames( size_t frameSize, double *times, double *axes,
+                                                    uint8_t *buttons, double *povs )
+{
+  if( frameSize == 0 ) return 0;
+  uint64_t start = JoyNowTicks();
+  size_t count = 0;
+  if( myMode == kJoystick_Replay ) AdvanceReplay();
+  if( myRingEnabled )
+  {
+    count = myRing.Available();
+    if( count > frameSize )
+    {
+      myRing.Consume( count - frameSize );
+      count = frameSize;
+    }
+    for( size_t kk=0; kk<count; kk++ )
+    {
+      uint64_t time;
+      DecodeFrameRow( myRing.Peek( kk, &time ) );
+      ScatterFrameRow( kk, frameSize, axes, buttons, povs );
+      myLastFrameTime = JoyTicksToSeconds( time );
+      if( times != NULL ) times[ kk ] = myLastFrameTime;
+    }
+    myRing.Consume( count );
+  }
+  
+  // Without a new sample, the first row holds the current values
+  size_t held = count;
+  if( count == 0 )
+  {
+    if( myMode != kJoystick_Polled )
+    {
+      mySnapshot.ReadPacked( &myPacked.front() );
+      DecodeFrameRow( &myPacked.front() );
+    }
+    else
+    {
+      PollAxesInto( &myFrameAxes.front(), myAxes.size() );
+      PollButtonsInto( &myFrameButtons.front(), myButtons.size() );
+      PollPOVInto( &myFramePOVs.front(), myPOV.size() );
+    }
+    ScatterFrameRow( 0, frameSize, axes, buttons, povs );
+    if( times != NULL ) times[ 0 ] = myLastFrameTime;
+    held = 1;
+  }
+  
+  // The remaining rows repeat the newest one
+  for( size_t kk=held; kk<frameSize; kk++ )
+  {
+    ScatterFrameRow( kk, frameSize, axes, buttons, povs );
+    if( times != NULL ) times[ kk ] = times[ held-1 ];
+  }
+  // Polled mode frames are counted by the polls above
+  if( myMode != kJoystick_Polled ) myPerf.RecordPoll( start, 0 );
+  return count;
+}
+
+/**
+ * \brief Queue every button press and release with its time stamp, for
+ *  PollButtonEdges and PollButtonEdgeCounts, so that taps shorter than the poll
+ *  interval aren't lost. Only available when values are acquired by callbacks or
+ *  replayed (not kJoystick_Polled or kJoystick_Shared). Any edges already queued are
+ *  discarded.
+ *
+ * \param[in] capacity Number of edges the queue must hold between polls. Further
+ *  edges are dropped (and counted, see ButtonEdgesDropped).
+ * \output true if successful, false if unsuccessful.
+ */
+bool Joystick::EnableButtonEdges( size_t capacity )
+{
+  if( myMode == kJoystick_Polled || ( !myAcqStarted && myMode != kJoystick_Replay ) )
+    return false;
+  
+  if( myEdges.Capacity() < capacity )
+  {
+    // Once detached, nothing is queueing into the queue, so it can be resized without
+    // stopping the acquisition thread
+    myEdgesEnabled = false;
+    mySnapshot.SetEdgeRing( NULL );
+    try
+    {
+      myEdges.Resize( capacity, 2 );
+    }
+    catch( const char *message )
+    {
+      ERR_PRINTF("Joystick::EnableButtonEdges - %s.\n", message);
+      return false;
+    }
+  }
+  else
+  {
+    // Discard stale edges (such as from a previous simulation)
+    myEdges.Consume( myEdges.Available() );
+  }
+  
+  // Attach the queue before reading the states, so that no edge falls in between. An
+  // edge queued before the read is then applied to a state that already has it, which
+  // leaves the state unchanged.
+  mySnapshot.SetEdgeRing( &myEdges );
+  myEdgeLevels.assign( ButtonMaskWords( myButtons.size() ), 0 );
+  SyncEdgeLevels( true );
+  myEdgesEnabled = true;
+  return true;
+}
+
+/**
+ * \brief Stop queueing button edges.
+ */
+void Joystick::DisableButtonEdges( void )
+{
+  myEdgesEnabled = false;
+  // Waits for the acquisition thread to finish any edge it is queueing
+  mySnapshot.SetEdgeRing( NULL );
+}
+
+/**
+ * \brief Take the oldest queued button edges, in the order they happened.
+ *
+ * \param[out] dest Buffer for the edges.
+ * \param[in] len Length of dest. Edges that don't fit stay queued for the next call.
+ * \output Number of edges written.
+ */
+size_t Joystick::PollButtonEdges( JoyButtonEdge *dest, size_t len )
+{
+  if( myMode == kJoystick_Replay ) AdvanceReplay();
+  if( !myEdgesEnabled ) return 0;
+  size_t count = min( myEdges.Available(), len );
+  for( size_t kk=0; kk<count; kk++ )
+  {
+    uint64_t time;
+    const int32_t *edge = myEdges.Peek( kk, &time );
+    dest[ kk ].time = JoyTicksToSeconds( time );
+    dest[ kk ].button = (size_t)edge[ 0 ];
+    dest[ kk ].pressed = edge[ 1 ] != 0;
+    SetButtonMaskBit( &myEdgeLevels.front(), (size_t)edge[ 0 ], edge[ 1 ] != 0 );
+  }
+  myEdges.Consume( count );
+  SyncEdgeLevels( false );
+  return count;
+}
+
+/**
+ * \brief Take every queued button edge, and summarise it per button. Any buffer may be
+ *  NULL to skip it. Without EnableButtonEdges there are no edges, so latched is the
+ *  current button states.
+ *
+ * \param[out] presses Number of presses of each button since the last call.
+ * \param[out] releases Number of releases of each button since the last call.
+ * \param[out] latched Whether each button was down at any time since the last call
+ *  (0 or 1), so a tap between calls still shows up.
+ * \param[in] len Length of the buffers. At most len buttons are written.
+ * \output Number of buttons written.
+ */
+size_t Joystick::PollButtonEdgeCounts( double *presses, double *releases, uint8_t *latched,
+                                                                          size_t len )
+{
+  size_t count = min( len, myButtons.size() );
+  if( presses != NULL ) fill( presses, presses + count, 0.0 );
+  if( releases != NULL ) fill( releases, releases + count, 0.0 );
+  if( !myEdgesEnabled )
+  {
+    if( latched != NULL ) PollButtonsInto( latched, count );
+    return count;
+  }
+  if( myMode == kJoystick_Replay ) AdvanceReplay();
+  
+  // A button was down since the last call if it was down then, or has been pressed since
+  if( latched != NULL && count > 0 ) ExpandButtonMask( &myEdgeLevels.front(), count, latched );
+  size_t available = myEdges.Available();
+  for( size_t kk=0; kk<available; kk++ )
+  {
+    const int32_t *edge = myEdges.Peek( kk, NULL );
+    size_t button = (size_t)edge[ 0 ];
+    bool pressed = edge[ 1 ] != 0;
+    SetButtonMaskBit( &myEdgeLevels.front(), button, pressed );
+    if( button >= count ) continue;
+    if( pressed )
+    {
+      if( presses != NULL ) presses[ button ] += 1.0;
+      if( latched != NULL ) latched[ button ] = 1;
+    }
+    else if( releases != NULL ) releases[ button ] += 1.0;
+  }
+  myEdges.Consume( available );
+  SyncEdgeLevels( false );
+  return count;
+}
+
+/**
+ * \brief Number of button edges dropped because the queue was full.
+ */
+uint32_t Joystick::ButtonEdgesDropped( void ) const
+{
+  return myEdges.Dropped();
+}
+
+/**
+ * \brief Read the button states the edges are applied to from the snapshot, if they
+ *  may have been lost (when edges were dropped, or force is set).
+ */
+void Joystick::SyncEdgeLevels( bool force )
+{
+  uint32_t dropped = myEdges.Dropped();
+  if( !force && dropped == myEdgesDropped ) return;
+  myEdgesDropped = dropped;
+  if( !myEdgeLevels.empty() ) mySnapshot.ReadButtonMask( &myEdgeLevels.front() );
+}
+
+/**
+ * \brief Query for the available device names. Answered from the shared registry
+ *  (see hidhotplug.hpp), so no devices are enumerated.
+ *
+ * \output vector JoyDev devices (which contain Product names and location values).
+ */
+vector<JoyDev> Joystick::QueryAvailableDevices( void )
+{
+  return SharedJoyRegistry().Devices();
+}
+  
+/**
+ * \brief Query for the number of available devices
+ *
+ * \output number of available devices
+ */
+unsigned int Joystick::QueryNumberDevices( void )
+{
+  return (unsigned int)SharedJoyRegistry().Size();
+}
+
+/**
+ * \brief Close and release the device reference and its elements.
+ */
+void Joystick::ReleaseDevice( void )
+{
+  myPerf.Detach();
+  myReplay.Close();
+  if( myElements != NULL )
+  {
+    CFRelease( myElements );
+    myElements = NULL;
+  }
+  myOutputSink.Attach( NULL );
+  if( myDevice != NULL )
+  {
+    IOHIDDeviceClose( myDevice, kIOHIDOptionsTypeNone );  // Ignore output.
+    CFRelease( myDevice );
+    myDevice = NULL;
+  }
+}
+
+/**
+ * \brief Forget the elements of the previous device.
+ */
+void Joystick::ClearElements( void )
+{
+  // Clear the output, buttons and axes storage
+  if( !myButtons.empty() ) myButtons.erase( myButtons.begin(), myButtons.end() );
+  if( !myAxes.empty() ) myAxes.erase( myAxes.begin(), myAxes.end() );
+  if( !myPOV.empty() ) myPOV.erase( myPOV.begin(), myPOV.end() );
+  if( !myOutputs.empty() ) myOutputs.erase( myOutputs.begin(), myOutputs.end() );
+  myOutputPlan.Clear();
+  myCookieSlots.clear();
+  myAxisTable.Clear();
+  myPipeline.Clear();
+  myInfo.locationKey = 0;
+  myInfo.vendorID = 0;
+  myInfo.productID = 0;
+  myInfo.mode = (int32_t)myMode;
+  myInfo.productKey.clear();
+  myInfo.numButtons = 0;
+  myInfo.numOutputs = 0;
+  myInfo.axes.clear();
+  myInfo.povs.clear();
+}
+
+/**
+ * \brief Create stand in elements for a device that isn't opened (a replay or a
+ *  shared joystick) from its description.
+ */
+void Joystick::AddStandIns( const JoyCaptureInfo &info )
+{
+  for( size_t ii=0; ii<info.axes.size(); ii++ )
+  {
+    const JoyCaptureRange &range = info.axes[ ii ];
+    myAxes.push_back( Axes( range.logicalMin, range.logicalMax, range.relative != 0 ) );
+    myAxisTable.Add( range.logicalMin, range.logicalMax, range.relative != 0 );
+  }
+  for( size_t ii=0; ii<info.numButtons; ii++ )
+  {
+    myButtons.push_back( Button( NULL, NULL ) );
+  }
+  for( size_t ii=0; ii<info.povs.size(); ii++ )
+  {
+    const JoyCaptureRange &range = info.povs[ ii ];
+    myPOV.push_back( POV( range.logicalMin, range.logicalMax ) );
+  }
+  myInfo = info;
+  myInfo.mode = (int32_t)myMode;
+}
+
+/**
+ * \brief Size the scratch buffers for the elements found.
+ */
+void Joystick::AllocateScratch( void )
+{
+  // Scratch space for copying raw values out of the snapshot
+  size_t maxElements = max( myAxes.size(), max( myButtons.size(), myPOV.size() ) );
+  myRaw.assign( max( maxElements, (size_t)1 ), 0 );
+  myButtonWords.assign( max( ButtonMaskWords( myButtons.size() ), (size_t)1 ), 0 );
+  myPolledTimes.assign( 1 + myAxes.size() + myButtons.size() + myPOV.size(), 0 );
+  myPolledCounts.assign( max( myAxes.size(), (size_t)1 ), 0 );
+  myTimeScratch.assign( max( maxElements, (size_t)1 ), 0 );
+  myFrameAxes.assign( max( myAxes.size(), (size_t)1 ), 0.0 );
+  myFrameButtons.assign( max( myButtons.size(), (size_t)1 ), 0 );
+  myFramePOVs.assign( max( myPOV.size(), (size_t)1 ), -1.0 );
+  myTypedScratch.assign( max( max( myAxes.size(), myPOV.size() ), (size_t)1 ), 0.0 );
+}
+
+/**
+ * \brief Read the raw axes into myRaw, from the snapshot or the device. The relative
+ *  axes are left as counters (see JoySnapshot::SetRelative).
+ *
+ * \param[in] num Number of axes to read from the device in kJoystick_Polled mode.
+ */
+void Joystick::ReadRawAxes( size_t num )
+{
+  if( myMode != kJoystick_Polled )
+  {
+    if( myMode == kJoystick_Replay ) AdvanceReplay();
+    else if( myMode == kJoystick_Shared ) CheckShared();
+    mySnapshot.Read( kJoystick_Axes, &myRaw.front() );
+    return;
+  }
+  uint64_t *times = &myPolledTimes.front() + PolledTimeOffset( kJoystick_Axes );
+  try
+  {
+    for( size_t ii=0; ii<num; ii++ )
+    {
+      myRaw[ ii ] = (int32_t)myAxes[ ii ].ReadRaw( &times[ ii ] );
+      UpdateNewestTime( times[ ii ] );
+      if( myCapturing ) myCapture.Record( kJoystick_Axes, ii, myRaw[ ii ], times[ ii ] );
+    }
+    // Sum the relative axes into counters, as the snapshot does
+    const vector<size_t> &relative = myAxisTable.Relative();
+    for( size_t jj=0; jj<relative.size() && relative[ jj ]<num; jj++ )
+    {
+      int32_t &counter = myPolledCounts[ relative[ jj ] ];
+      counter = (int32_t)( (uint32_t)counter + (uint32_t)myRaw[ relative[ jj ] ] );
+      myRaw[ relative[ jj ] ] = counter;
+    }
+  }
+  catch( const char *message )
+  {
+    myPerf.RecordException();
+    throw;
+  }
+}
+
+/**
+ * \brief Mark the relative axes in the snapshot, which sums their changes.
+ */
+void Joystick::MarkRelativeAxes( void )
+{
+  const vector<size_t> &relative = myAxisTable.Relative();
+  for( size_t jj=0; jj<relative.size(); jj++ ) mySnapshot.SetRelative( relative[ jj ], true );
+}
+
+/**
+ * \brief Play a capture up to the current time, when it is replayed in real time.
+ */
+void Joystick::AdvanceReplay( void )
+{
+  if( myReplaySpeed <= 0.0 ) return;
+  uint64_t now = JoyNowTicks();
+  if( !myReplayStarted )
+  {
+    myReplay.Start( &mySnapshot, now, myReplaySpeed );
+    myReplayStart = now;
+    myReplayStarted = true;
+  }
+  myReplay.Advance( JoyTicksToSeconds( now - myReplayStart )*myReplaySpeed );
+}
+
+/**
+ * \brief Throw if the daemon a kJoystick_Shared joystick reads from has stopped,
+ *  rather than return its last values as current ones.
+ */
+void Joystick::CheckShared( void )
+{
+  if( myShared == NULL || myShared->Alive() ) return;
+  myPerf.RecordException();
+  throw "Error reading joystick: the acquisition daemon has stopped";
+}
+
+/**
+ * \brief Push the snapshot into the sample ring (acquisition thread only).
+ */
+void Joystick::PushSample( uint64_t time )
+{
+  int32_t *slot = myRing.BeginPush();
+  if( slot == NULL ) return;
+  mySnapshot.CopyPacked( slot );
+  myRing.EndPush( time );
+}
+
+/**
+ * \brief Decode a packed snapshot (see JoySnapshot::PackedOffset) into the frame
+ *  scratch buffers.
+ */
+void Joystick::DecodeFrameRow( const int32_t *packed )
+{
+  myAxisTable.Normalise( packed + mySnapshot.PackedOffset( kJoystick_Axes ),
+                         &myFrameAxes.front(), myAxes.size() );
+  if( myPipeline.Active() ) myPipeline.Process( &myFrameAxes.front(), myAxes.size() );
+  ExpandButtonMask( (const uint64_t *)( packed + mySnapshot.PackedOffset( kJoystick_Buttons ) ),
+                    myButtons.size(), &myFrameButtons.front() );
+  const int32_t *rawPOVs = packed + mySnapshot.PackedOffset( kJoystick_POVs );
+  for( size_t ii=0; ii<myPOV.size(); ii++ )
+  {
+    myFramePOVs[ ii ] = myPOV[ ii ].Decode( rawPOVs[ ii ] );
+  }
+}
+
+/**
+ * \brief Copy the frame scratch buffers into one row of the frame outputs.
+ */
+void Joystick::ScatterFrameRow( size_t row, size_t frameSize, double *axes,
+                                                    uint8_t *buttons, double *povs )
+{
+  if( axes != NULL )
+  {
+    for( size_t ii=0; ii<myAxes.size(); ii++ ) axes[ row + ii*frameSize ] = myFrameAxes[ ii ];
+  }
+  if( buttons != NULL )
+  {
+    for( size_t ii=0; ii<myButtons.size(); ii++ )
+    {
+      buttons[ row + ii*frameSize ] = myFrameButtons[ ii ];
+    }
+  }
+  if( povs != NULL )
+  {
+    for( size_t ii=0; ii<myPOV.size(); ii++ ) povs[ row + ii*frameSize ] = myFramePOVs[ ii ];
+  }
+}
+
+/**
+ * \brief Record which snapshot slot an element's value callbacks should write to.
+ *
+ * \param[in] element Element reference.
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ * \param[in] index Index of the element within its type.
+ */
+void Joystick::MapElement( IOHIDElementRef element, JoystickIOIndex type, size_t index )
+{
+  // Cookies are small per-device indices, so a flat table gives an O(1) lookup in the
+  // callback. Unmapped entries are marked with kJoystick_Outputs.
+  size_t cookie = (size_t)IOHIDElementGetCookie( element );
+  if( cookie >= myCookieSlots.size() )
+  {
+    ElementSlot unmapped = { kJoystick_Outputs, 0 };
+    myCookieSlots.resize( cookie+1, unmapped );
+  }
+  myCookieSlots[ cookie ].type = type;
+  myCookieSlots[ cookie ].index = index;
+}
+
+/**
+ * \brief Parse the device's report descriptor.
+ *
+ * \param[out] fields Parsed fields.
+ * \param[out] outputReportBytes If not NULL, receives the length of each output report.
+ * \output true if successful, false if the descriptor is missing or malformed.
+ */
+bool Joystick::ParseDescriptor( vector<HIDField> &fields, vector<uint32_t> *outputReportBytes )
+{
+  CFTypeRef descRef = IOHIDDeviceGetProperty( myDevice, CFSTR(kIOHIDReportDescriptorKey) );
+  if( descRef == NULL || CFGetTypeID( descRef ) != CFDataGetTypeID() ) return false;
+  if( !ParseHIDDescriptor( CFDataGetBytePtr( (CFDataRef)descRef ),
+                           (size_t)CFDataGetLength( (CFDataRef)descRef ), fields, NULL,
+                           outputReportBytes ) )
+  {
+    ERR_PRINTF("Joystick::ParseDescriptor - Malformed report descriptor.\n");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * \brief Parse the device's report descriptor and compile the input report plan. The
+ *  fields are matched to the elements found by Initialise by report ID and usage.
+ *
+ * \output true if successful, false if the descriptor is missing or unusable.
+ */
+bool Joystick::CompileReportPlan( void )
+{
+  myReportPlan.Clear();
+  vector<HIDField> fields;
+  if( !ParseDescriptor( fields, NULL ) ) return false;
+  
+  // Group the mapped elements by (report ID, usage page, usage), in element order.
+  map< uint64_t, vector<ElementSlot> > slotsByKey;
+  CFIndex numElements = CFArrayGetCount( myElements );
+  for( CFIndex ii=0; ii<numElements; ii++ )
+  {
+    IOHIDElementRef element = (IOHIDElementRef) CFArrayGetValueAtIndex( myElements, ii );
+    size_t cookie = (size_t)IOHIDElementGetCookie( element );
+    if( cookie >= myCookieSlots.size() || myCookieSlots[ cookie ].type == kJoystick_Outputs )
+      continue;
+    uint64_t key = ( (uint64_t)IOHIDElementGetReportID( element ) << 32 ) |
+                   ( (uint64_t)( IOHIDElementGetUsagePage( element ) & 0xFFFF ) << 16 ) |
+                   ( IOHIDElementGetUsage( element ) & 0xFFFF );
+    slotsByKey[ key ].push_back( myCookieSlots[ cookie ] );
+  }
+  
+  // The n-th field with a given key belongs to the n-th element with that key. Fields
+  // without a matching element (such as vendor data IOKit doesn't expose) are dropped.
+  map< uint64_t, size_t > used;
+  for( size_t ii=0; ii<fields.size(); ii++ )
+  {
+    const HIDField &field = fields[ ii ];
+    if( field.direction != kHIDField_Input ) continue;
+    uint64_t key = ( (uint64_t)field.reportID << 32 ) | ( (uint64_t)field.usagePage << 16 ) |
+                   field.usage;
+    map< uint64_t, vector<ElementSlot> >::iterator it = slotsByKey.find( key );
+    if( it == slotsByKey.end() ) continue;
+    size_t nth = used[ key ]++;
+    if( nth >= it->second.size() ) continue;
+    myReportPlan.Add( field, it->second[ nth ].type, it->second[ nth ].index );
+  }
+  if( myReportPlan.Empty() ) return false;
+  myReportPlan.Compile( HIDUsesReportIDs( fields ) );
+  
+  // Input report buffer
+  int32_t reportSize = 64;
+  CFTypeRef sizeRef = IOHIDDeviceGetProperty( myDevice, CFSTR(kIOHIDMaxInputReportSizeKey) );
+  if( sizeRef != NULL && CFGetTypeID( sizeRef ) == CFNumberGetTypeID() )
+  {
+    CFNumberGetValue( (CFNumberRef)sizeRef, kCFNumberSInt32Type, &reportSize );
+  }
+  myReportBuffer.assign( (size_t)max( reportSize, (int32_t)1 ), 0 );
+  return true;
+}
+
+/**
+ * \brief Parse the device's report descriptor and compile the output report plan, in
+ *  the same way as CompileReportPlan.
+ *
+ * \output true if any output is carried by the plan.
+ */
+bool Joystick::CompileOutputPlan( void )
+{
+  myOutputPlan.Clear();
+  myOutputSink.Attach( myDevice );
+  if( myOutputs.empty() ) return false;
+  vector<HIDField> fields;
+  vector<uint32_t> reportBytes;
+  if( !ParseDescriptor( fields, &reportBytes ) ) return false;
+  
+  // Group the outputs by (report ID, usage page, usage), in element order.
+  map< uint64_t, vector<size_t> > outputsByKey;
+  for( size_t ii=0; ii<myOutputs.size(); ii++ )
+  {
+    IOHIDElementRef element = myOutputs[ ii ].Element();
+    uint64_t key = ( (uint64_t)IOHIDElementGetReportID( element ) << 32 ) |
+                   ( (uint64_t)( IOHIDElementGetUsagePage( element ) & 0xFFFF ) << 16 ) |
+                   ( IOHIDElementGetUsage( element ) & 0xFFFF );
+    outputsByKey[ key ].push_back( ii );
+  }
+  
+  // The n-th field with a given key belongs to the n-th output with that key. Outputs
+  // without a field are set one by one by PushInputs.
+  map< uint64_t, size_t > used;
+  for( size_t ii=0; ii<fields.size(); ii++ )
+  {
+    const HIDField &field = fields[ ii ];
+    if( field.direction != kHIDField_Output ) continue;
+    uint64_t key = ( (uint64_t)field.reportID << 32 ) | ( (uint64_t)field.usagePage << 16 ) |
+                   field.usage;
+    map< uint64_t, vector<size_t> >::iterator it = outputsByKey.find( key );
+    if( it == outputsByKey.end() ) continue;
+    size_t nth = used[ key ]++;
+    if( nth >= it->second.size() ) continue;
+    myOutputPlan.Add( field, it->second[ nth ] );
+  }
+  myOutputPlan.Compile( HIDUsesReportIDs( fields ), reportBytes );
+  myOutputSink.Reserve( reportBytes );
+  return !myOutputPlan.Empty();
+}
+
+/**
+ * \brief Seed the snapshot with the current element values and start the acquisition
+ *  thread.
+ *
+ * \output true if successful, false if the thread could not be started.
+ */
+bool Joystick::StartAcquisition( void )
+{
+  if( myAcqStarted ) return true;
+  
+  // Seed the snapshot, otherwise elements read as zero until they first change. A
+  // published snapshot lives in the shared memory slot, which Publish already zeroed.
+  // Otherwise it is only allocated by the first start: a restart (such as for a capture
+  // or a larger frame ring) reseeds it in place, as ReadAxesInto may be reading it from
+  // another thread. The seed isn't queued as button edges either way.
+  if( myPublished != NULL )
+  {
+    mySnapshot.Place( myPublished, myAxes.size(), myButtons.size(), myPOV.size(), false );
+  }
+  else if( !mySnapshot.Holds( myAxes.size(), myButtons.size(), myPOV.size() ) )
+  {
+    mySnapshot.Resize( myAxes.size(), myButtons.size(), myPOV.size() );
+  }
+  else mySnapshot.SetEdgeRing( NULL );
+  MarkRelativeAxes();
+  myPacked.assign( max( mySnapshot.PackedSize(), (size_t)1 ), 0 );
+  myCapturePacked.assign( max( mySnapshot.PackedSize(), (size_t)1 ), 0 );
+  try
+  {
+    uint64_t time = 0;
+    mySnapshot.BeginWrite();
+    for( size_t ii=0; ii<myAxes.size(); ii++ )
+    {
+      // A relative axis' value is its last change, which has already been counted
+      if( myAxes[ ii ].IsRelative() ) continue;
+      int32_t value = (int32_t)myAxes[ ii ].ReadRaw( &time );
+      mySnapshot.Store( kJoystick_Axes, ii, value, time );
+      if( myCapturing ) myCapture.Record( kJoystick_Axes, ii, value, time );
+    }
+    for( size_t ii=0; ii<myButtons.size(); ii++ )
+    {
+      int32_t value = (int32_t)myButtons[ ii ].ReadRaw( &time );
+      mySnapshot.Store( kJoystick_Buttons, ii, value, time );
+      if( myCapturing ) myCapture.Record( kJoystick_Buttons, ii, value != 0 ? 1 : 0, time );
+    }
+    for( size_t ii=0; ii<myPOV.size(); ii++ )
+    {
+      int32_t value = (int32_t)myPOV[ ii ].ReadRaw( &time );
+      mySnapshot.Store( kJoystick_POVs, ii, value, time );
+      if( myCapturing ) myCapture.Record( kJoystick_POVs, ii, value, time );
+    }
+    mySnapshot.EndWrite();
+  }
+  catch( const char *message )
+  {
+    mySnapshot.EndWrite();
+    ERR_PRINTF("Joystick::StartAcquisition - %s while seeding the snapshot.\n", message);
+  }
+  // The relative axes' counters may have restarted, but their positions carry on. The
+  // button edges are queued again from here.
+  if( !myAxisTable.Relative().empty() )
+  {
+    mySnapshot.Read( kJoystick_Axes, &myRaw.front() );
+    myAxisTable.RebaseRelative( &myRaw.front(), myAxes.size(), false );
+  }
+  if( myEdgesEnabled ) mySnapshot.SetEdgeRing( &myEdges );
+  
+  myAcqRunning = true;
+  myAcqRunLoop = NULL;
+  if( pthread_create( &myAcqThread, NULL, &Joystick::AcquisitionThread, this ) != 0 )
+  {
+    myAcqRunning = false;
+    return false;
+  }
+  myAcqStarted = true;
+  
+  // Wait until the callback has been registered
+  pthread_mutex_lock( &myAcqMutex );
+  while( myAcqRunLoop == NULL ) pthread_cond_wait( &myAcqCond, &myAcqMutex );
+  pthread_mutex_unlock( &myAcqMutex );
+  
+  // The device is now scheduled, so output reports can complete on its run loop
+  myOutputSink.SetAsynchronous( true );
+  return true;
+}
+
+/**
+ * \brief Stop the acquisition thread (if running) and wait for it to exit.
+ */
+void Joystick::StopAcquisition( void )
+{
+  if( !myAcqStarted ) return;
+  myAcqRunning = false;
+  pthread_mutex_lock( &myAcqMutex );
+  if( myAcqRunLoop != NULL ) CFRunLoopStop( myAcqRunLoop );
+  pthread_mutex_unlock( &myAcqMutex );
+  pthread_join( myAcqThread, NULL );
+  myAcqStarted = false;
+  myAcqRunLoop = NULL;
+  myOutputSink.SetAsynchronous( false );
+}
+
+/**
+ * \brief Acquisition thread. Schedules the device on its own run loop and services
+ *  the input value callbacks until StopAcquisition is called.
+ */
+void *Joystick::AcquisitionThread( void *context )
+{
+  Joystick *joy = (Joystick *)context;
+  CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+  if( joy->myMode == kJoystick_RawReports )
+  {
+    IOHIDDeviceRegisterInputReportCallback( joy->myDevice, &joy->myReportBuffer.front(),
+             (CFIndex)joy->myReportBuffer.size(), &Joystick::InputReportCallback, joy );
+  }
+  else
+  {
+    IOHIDDeviceRegisterInputValueCallback( joy->myDevice, &Joystick::InputValueCallback, joy );
+  }
+  IOHIDDeviceScheduleWithRunLoop( joy->myDevice, runLoop, kCFRunLoopDefaultMode );
+  
+  // Pushes the samples for value callbacks into the ring
+  CFRunLoopObserverContext observerContext = { 0, joy, NULL, NULL, NULL };
+  CFRunLoopObserverRef observer = CFRunLoopObserverCreate( kCFAllocatorDefault,
+         kCFRunLoopBeforeWaiting, true, 0, &Joystick::RunLoopObserver, &observerContext );
+  if( observer != NULL ) CFRunLoopAddObserver( runLoop, observer, kCFRunLoopDefaultMode );
+  
+  // Let StartAcquisition return
+  pthread_mutex_lock( &joy->myAcqMutex );
+  joy->myAcqRunLoop = runLoop;
+  pthread_cond_signal( &joy->myAcqCond );
+  pthread_mutex_unlock( &joy->myAcqMutex );
+  
+  // The timeout covers a CFRunLoopStop that arrives before the run loop is entered.
+  while( joy->myAcqRunning )
+  {
+    CFRunLoopRunInMode( kCFRunLoopDefaultMode, 0.1, false );
+  }
+  
+  if( observer != NULL )
+  {
+    CFRunLoopRemoveObserver( runLoop, observer, kCFRunLoopDefaultMode );
+    CFRelease( observer );
+  }
+  IOHIDDeviceUnscheduleFromRunLoop( joy->myDevice, runLoop, kCFRunLoopDefaultMode );
+  if( joy->myMode == kJoystick_RawReports )
+  {
+    IOHIDDeviceRegisterInputReportCallback( joy->myDevice, &joy->myReportBuffer.front(),
+                                     (CFIndex)joy->myReportBuffer.size(), NULL, NULL );
+  }
+  else IOHIDDeviceRegisterInputValueCallback( joy->myDevice, NULL, NULL );
+  return NULL;
+}
+
+/**
+ * \brief IOKit input value callback. Writes the new value into the snapshot.
+ */
+void Joystick::InputValueCallback( void *context, IOReturn result, void *sender,
+                                                                   IOHIDValueRef value )
+{
+  UNUSED( sender );
+  if( result != kIOReturnSuccess ) return;
+  Joystick *joy = (Joystick *)context;
+  
+  // Values wider than an integer (such as byte buffers) are not ours
+  if( IOHIDValueGetLength( value ) > (CFIndex)sizeof(int32_t) ) return;
+  
+  size_t cookie = (size_t)IOHIDElementGetCookie( IOHIDValueGetElement( value ) );
+  if( cookie >= joy->myCookieSlots.size() ) return;
+  const ElementSlot &slot = joy->myCookieSlots[ cookie ];
+  if( slot.type == kJoystick_Outputs ) return;
+  
+  uint64_t time = IOHIDValueGetTimeStamp( value );
+  int32_t raw = (int32_t)IOHIDValueGetIntegerValue( value );
+  joy->mySnapshot.Write( slot.type, slot.index, raw, time );
+  if( joy->myCapturing )
+  {
+    joy->myCapture.Record( slot.type, slot.index, slot.type == kJoystick_Buttons ?
+                                                  ( raw != 0 ? 1 : 0 ) : raw, time );
+  }
+  if( joy->myRingEnabled )
+  {
+    joy->myRingDirty = true;
+    joy->myRingTime = time;
+  }
+}
+
+/**
+ * \brief Run loop observer. Pushes a sample once a burst of value callbacks has been
+ *  handled, just before the acquisition thread sleeps.
+ */
+void Joystick::RunLoopObserver( CFRunLoopObserverRef observer, CFRunLoopActivity activity,
+                                                                         void *context )
+{
+  UNUSED( observer );
+  UNUSED( activity );
+  Joystick *joy = (Joystick *)context;
+  if( !joy->myRingDirty ) return;
+  joy->myRingDirty = false;
+  if( joy->myRingEnabled ) joy->PushSample( joy->myRingTime );
+}
+
+/**
+ * \brief IOKit input report callback. Decodes the whole report into the snapshot.
+ */
+void Joystick::InputReportCallback( void *context, IOReturn result, void *sender,
+                        IOHIDReportType type, uint32_t reportID, uint8_t *report,
+                        CFIndex reportLength )
+{
+  UNUSED( sender );
+  UNUSED( reportID );
+  if( result != kIOReturnSuccess || type != kIOHIDReportTypeInput || reportLength <= 0 ) return;
+  Joystick *joy = (Joystick *)context;
+  uint64_t time = JoyNowTicks();
+  joy->myReportPlan.Decode( report, (size_t)reportLength, &joy->mySnapshot, time );
+  if( joy->myCapturing )
   {
-    ERR_PRINTF("Device returned a product key that wasn't a string.");
-    return devStr;
+    joy->mySnapshot.CopyPacked( &joy->myCapturePacked.front() );
+    joy->myCapture.RecordPacked( joy->mySnapshot, &joy->myCapturePacked.front(), time );
   }
+  if( joy->myRingEnabled ) joy->PushSample( time );
 }
\ No newline at end of file
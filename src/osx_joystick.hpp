@@ -30,33 +30,61 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <string>
 #include <vector>
+#include <pthread.h>
 #include <IOKit/hid/IOHIDManager.h>
 #include <IOKit/hid/IOHIDDevice.h>
 #include "button.hpp"
 #include "axes.hpp"
 #include "pov.hpp"
 #include "outputs.hpp"
+#include "snapshot.hpp"
+#include "buttonmask.hpp"
+#include "axistable.hpp"
+#include "axispipeline.hpp"
+#include "hidreport.hpp"
+#include "hidoutput.hpp"
+#include "joyregistry.hpp"
+#include "hidhotplug.hpp"
+#include "samplering.hpp"
+#include "joytime.hpp"
+#include "joystats.hpp"
+#include "joycapture.hpp"
+#include "joyshm.hpp"
 
 using namespace std;
 
 /**
- * \brief Enumerated indices for the QueryIO vector.
+ * \brief How the joystick element values are acquired.
+ *
+ * kJoystick_Polled calls IOHIDDeviceGetValue for every element on every poll.
+ * kJoystick_EventDriven registers an input value callback on a dedicated thread, which
+ * writes each value change into a snapshot. Polling then only copies the snapshot.
+ * kJoystick_RawReports is the same, except that whole input reports are received and
+ * decoded with a plan compiled from the report descriptor. If the device has no usable
+ * descriptor, kJoystick_EventDriven is used instead.
+ * kJoystick_Replay plays a capture file (see joycapture.hpp) instead of reading a
+ * device. It is selected with InitialiseReplay, not Initialise.
+ * kJoystick_Shared reads the snapshot the acquisition daemon (sljoyd) publishes in shared
+ * memory (see joyshm.hpp), so this process never opens the device. Only the daemon can
+ * push to the device's outputs.
  */
-enum JoystickIOIndex {
-  kJoystick_Axes = 0,
-  kJoystick_Buttons,
-  kJoystick_POVs,
-  kJoystick_Outputs
+enum JoystickAcquisition {
+  kJoystick_Polled = 0,
+  kJoystick_EventDriven,
+  kJoystick_RawReports,
+  kJoystick_Replay,
+  kJoystick_Shared
 };
 
 /**
- * \brief Class for joystick object descriptions. Contains public productKey and locationKey.
+ * \brief A button press or release, as queued by Joystick::EnableButtonEdges.
  */
-class JoyDev
+struct JoyButtonEdge
 {
-  public:
-    string productKey;
-    int32_t locationKey;
+  // Time of the change (seconds, see joytime.hpp)
+  double time;
+  size_t button;
+  bool pressed;
 };
 
 class Joystick
@@ -77,10 +105,63 @@ public:
    * 
    * \param[in] joyLocation LocationKey of the selected Joystick. These can be obtained
    *                        from the QueryAvailableDevices function.
+   * \param[in] mode How the element values are acquired (see JoystickAcquisition).
    *
    * \return true if successful, false if unsuccessful (such as the joystick doesn't exist)
    */
-  bool Initialise( int32_t joyLocation );
+  bool Initialise( int32_t joyLocation, JoystickAcquisition mode = kJoystick_Polled );
+  
+  /**
+   * \brief Initialise the Joystick from a capture file (see StartCapture) instead of a
+   *  device. The captured values are played into the snapshot as the joystick is polled,
+   *  so the joystick looks the same as the captured one, except that it has no outputs
+   *  to push to.
+   *
+   * \param[in] path Capture file name.
+   * \param[in] speed Capture seconds played per second of real time, starting from the
+   *  first poll. Zero plays the capture up to the time given to SetReplayTime instead,
+   *  such as the simulation time, and the time stamps are then the capture times.
+   * \return true if successful, false if the file isn't a readable capture.
+   */
+  bool InitialiseReplay( const char *path, double speed = 1.0 );
+  
+  /**
+   * \brief Play a capture up to the given time. Only used when InitialiseReplay was
+   *  given a speed of zero.
+   *
+   * \param[in] time Capture time (seconds).
+   */
+  void SetReplayTime( double time );
+  
+  /**
+   * \brief Record every element value change, with its time stamp, into a capture file
+   *  (see joycapture.hpp). The current values are recorded first. In kJoystick_Polled
+   *  mode, only the values read by the polls are recorded.
+   *
+   * \param[in] path Capture file name. An existing file is overwritten.
+   * \return true if successful, false if the file could not be created (or the
+   *  joystick is itself a replay, or shared).
+   */
+  bool StartCapture( const char *path );
+  
+  /**
+   * \brief Stop recording, and close the capture file.
+   *
+   * \return true if every value was written, false if any write failed.
+   */
+  bool StopCapture( void );
+  
+  /**
+   * \brief Publish the joystick in a shared memory segment (daemon only). The snapshot
+   *  moves into the device's slot, so the acquisition thread writes every value
+   *  straight to the readers. Only for kJoystick_EventDriven and kJoystick_RawReports.
+   *
+   * \param[in] segment Segment made by JoyShmSegment::Create. It must stay open until
+   *  the joystick is withdrawn and reinitialised (or destroyed).
+   * \return true if successful, false if the joystick has no acquisition thread or
+   *  there is no room for it.
+   */
+  bool Publish( JoyShmSegment &segment );
   
   /**
    * \brief Query joystick for IO capabilities
@@ -88,6 +169,17 @@ public:
    * \return An vector containing the number of axes, buttons, pov, outputs
    */
   vector<int> QueryIO( void );
+  
+  /**
+   * \brief LocationKey of the joystick, or of the captured one for a replay.
+   */
+  int32_t LocationKey( void ) const;
+  
+  /**
+   * \brief Acquisition mode in use, which is kJoystick_EventDriven if
+   *  kJoystick_RawReports was asked for but the report descriptor couldn't be used.
+   */
+  JoystickAcquisition Acquisition( void ) const;
    
   /**
    * \brief Poll the joystick axes
@@ -95,6 +187,97 @@ public:
    * \output vector of normalised axes doubles.
    */
   vector<double> PollAxes( void );
+  
+  /**
+   * \brief Poll the joystick axes into a caller supplied buffer. Does not allocate.
+   *
+   * \param[out] dest Buffer for the normalised axes.
+   * \param[in] len Length of dest. At most len values are written.
+   * \output Number of axes on the joystick.
+   */
+  size_t PollAxesInto( double *dest, size_t len );
+  
+  /**
+   * \brief Poll the joystick axes into a caller supplied buffer of another type. Does
+   *  not allocate. double and float read the normalised axes, as PollAxesInto does. The
+   *  integer types (int16_t, uint16_t and int32_t) read the raw counts instead,
+   *  saturated to the type, which skips the normalisation and the axis processing. A
+   *  count v normalises to 2*(v - min)/(max - min) - 1 over the logical range of its
+   *  axis (see AxisRange). Relative axes count their position or their change (see
+   *  SetRelativeMode). Only these five types are instantiated.
+   *
+   * \param[out] dest Buffer for the axes.
+   * \param[in] len Length of dest. At most len values are written.
+   * \output Number of axes on the joystick.
+   */
+  template<typename T> size_t PollAxes( T *dest, size_t len );
+  
+  /**
+   * \brief Logical range of an axis, which its raw counts are normalised over.
+   *
+   * \param[in] axis Index of the axis.
+   * \param[out] logmin Logical minimum.
+   * \param[out] logmax Logical maximum.
+   * \output true if successful, false if there is no such axis.
+   */
+  bool AxisRange( size_t axis, int32_t &logmin, int32_t &logmax ) const;
+
+  /**
+   * \brief Read the newest normalised axes from any thread, such as the force feedback
+   *  effect engine's (see joyeffects.hpp). Unlike PollAxesInto this only copies the
+   *  snapshot, and leaves the device, the replay and the counters alone, so it isn't
+   *  available in kJoystick_Polled mode. Relative axes read as their position since the
+   *  acquisition first started. Restarts of the acquisition (captures, frames) keep the
+   *  snapshot where it is, but Initialise, Publish and Close move or free it, so they
+   *  must not be called while another thread reads.
+   *
+   * \param[out] dest Buffer for the normalised axes.
+   * \param[out] scratch Buffer for the raw values, one per axis on the joystick.
+   * \param[in] len Length of dest. At most len values are written.
+   * \output Number of axes on the joystick, or 0 in kJoystick_Polled mode.
+   */
+  size_t ReadAxesInto( double *dest, int32_t *scratch, size_t len ) const;
+
+  /**
+   * \brief Process the normalised axes (calibration, deadzones, response curves and
+   *  low pass filters, see axispipeline.hpp) before PollAxesInto and PollFrames return
+   *  them. ReadAxesInto is left unprocessed. The processing (and the filter state) belongs
+   *  to the joystick, so a pooled joystick must be claimed first (see
+   *  JoySessionPool::Claim).
+   *
+   * \param[in] config Processing of each axis.
+   * \param[in] len Length of config. Axes beyond len are left as they are.
+   * \param[in] rate Rate at which the axes are polled (Hz), for the filters. For
+   *  frames, the filters are stepped once per row.
+   * \output true if successful, false if a setting is out of range.
+   */
+  bool SetAxisProcessing( const AxisProcessing *config, size_t len, double rate );
+  
+  /**
+   * \brief Stop processing the axes.
+   */
+  void ClearAxisProcessing( void );
+  
+  /**
+   * \brief Choose whether relative axes (such as those of 3D mice and trackballs) read
+   *  as their accumulated position, or as their change since the last poll (or frame
+   *  row). Every change is integrated as it arrives, so none is lost between polls,
+   *  except in kJoystick_Polled mode, which only sees the value at each poll.
+   *
+   * \param[in] mode What the relative axes read as.
+   */
+  void SetRelativeMode( AxisRelativeMode mode );
+  
+  /**
+   * \brief Move the origin of the relative axes to their current position, so that
+   *  their positions restart from zero and their next change is measured from now.
+   */
+  void ResetRelativeAxes( void );
+  
+  /**
+   * \brief Whether the joystick has any relative axes (see SetRelativeMode).
+   */
+  bool HasRelativeAxes( void ) const;
 
   /**
    * \brief Poll the joystick buttons
@@ -102,6 +285,24 @@ public:
    * \output vector of button boolean values.
    */
   vector<bool> PollButtons( void );
+  
+  /**
+   * \brief Poll the joystick buttons into a caller supplied buffer. Does not allocate.
+   *
+   * \param[out] dest Buffer for the button states (0 or 1).
+   * \param[in] len Length of dest. At most len values are written.
+   * \output Number of buttons on the joystick.
+   */
+  size_t PollButtonsInto( uint8_t *dest, size_t len );
+  
+  /**
+   * \brief Poll the joystick buttons as a packed mask (see buttonmask.hpp).
+   *
+   * \param[out] dest Buffer for the mask. Button n is bit (n%64) of word n/64.
+   * \param[in] numWords Length of dest in words. Buttons beyond 64*numWords are dropped.
+   * \output Number of buttons on the joystick.
+   */
+  size_t PollButtonMask( uint64_t *dest, size_t numWords );
     
   /**
    * \brief Poll the joystick POV hats
@@ -110,14 +311,161 @@ public:
    *         -1 corresponds to nothing pressed.
    */
   vector<double> PollPOV( void );
+  
+  /**
+   * \brief Poll the joystick POV hats into a caller supplied buffer. Does not allocate.
+   *
+   * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+   * \param[in] len Length of dest. At most len values are written.
+   * \output Number of POV hats on the joystick.
+   */
+  size_t PollPOVInto( double *dest, size_t len );
+  
+  /**
+   * \brief Poll the joystick POV hats into a caller supplied buffer of another type.
+   *  Does not allocate. Angles are rounded to whole degrees for the integer types.
+   *  Only double, float, int16_t and int32_t are instantiated.
+   *
+   * \param[out] dest Buffer for the POV angles (degrees, or -1 for nothing pressed).
+   * \param[in] len Length of dest. At most len values are written.
+   * \output Number of POV hats on the joystick.
+   */
+  template<typename T> size_t PollPOV( T *dest, size_t len );
+  
+  /**
+   * \brief Time stamps (ticks, see joytime.hpp) of the latest value of each element of
+   *  the given type. In kJoystick_Polled mode, these are the values read by the last
+   *  poll of that type.
+   *
+   * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+   * \param[out] dest Buffer for the time stamps.
+   * \param[in] len Length of dest. At most len values are written.
+   * \output Number of elements of the given type.
+   */
+  size_t PollTimesInto( JoystickIOIndex type, uint64_t *dest, size_t len );
+  
+  /**
+   * \brief Time stamp (ticks) of the newest value of any element, or 0 if none is known.
+   */
+  uint64_t NewestTimeStamp( void );
+  
+  /**
+   * \brief Age of the newest value of any element. A replay played up to the time
+   *  given to SetReplayTime measures it in capture time, from that time.
+   *
+   * \output Seconds since the newest value was produced, or -1 if none is known.
+   */
+  double SampleAge( void );
 
   /**
    * \brief Push values to the joystick inputs (such as force feedback)
    */
-  void PushInputs( vector<double> normInputs );
+  void PushInputs( const vector<double> &normInputs );
+  
+  /**
+   * \brief Push values to the joystick inputs (such as force feedback) from a caller
+   *  supplied buffer. Does not allocate.
+   *
+   * Outputs described by the report descriptor are packed into whole output reports,
+   * and only the reports holding a changed value are sent: asynchronously while the
+   * acquisition thread is running (so this never waits on the bus), and synchronously
+   * in kJoystick_Polled mode. Other outputs are set one by one, again only on change.
+   *
+   * \param[in] normInputs Normalised values, one per joystick output.
+   * \param[in] len Length of normInputs. Outputs beyond len are left unchanged.
+   */
+  void PushInputs( const double *normInputs, size_t len );
+  
+  /**
+   * \brief Mark the end of a simulation step, for the IOKit calls per step counter (see
+   *  joystats.hpp).
+   */
+  void EndStep( void );
 
   /**
-   * \brief Query for the available device names
+   * \brief Record every sample into a ring buffer, for PollFrames. Only available when
+   *  values are acquired by callbacks or replayed (not kJoystick_Polled or
+   *  kJoystick_Shared). Any samples already in the ring are discarded.
+   *
+   * A sample is recorded for each input report. For kJoystick_EventDriven, that is each
+   * burst of value callbacks handled before the acquisition thread next sleeps.
+   *
+   * \param[in] capacity Number of samples the ring must hold between polls.
+   * \output true if successful, false if unsuccessful.
+   */
+  bool EnableFrames( size_t capacity );
+  
+  /**
+   * \brief Stop recording samples into the ring buffer.
+   */
+  void DisableFrames( void );
+  
+  /**
+   * \brief Poll every sample recorded since the last call. Each buffer is a column
+   *  major frameSize by N matrix, with one row per sample (oldest first). If more than
+   *  frameSize samples are waiting, only the newest are kept. Rows without a new sample
+   *  repeat the newest one. Any buffer may be NULL to skip it.
+   *
+   * \param[in] frameSize Number of rows.
+   * \param[out] times Sample times (seconds, see joytime.hpp), frameSize long.
+   * \param[out] axes Normalised axes, frameSize by the number of axes.
+   * \param[out] buttons Button states (0 or 1), frameSize by the number of buttons.
+   * \param[out] povs POV angles, frameSize by the number of POV hats.
+   * \output Number of new samples, at most frameSize.
+   */
+  size_t PollFrames( size_t frameSize, double *times, double *axes, uint8_t *buttons,
+                                                                         double *povs );
+
+  /**
+   * \brief Queue every button press and release with its time stamp, for
+   *  PollButtonEdges and PollButtonEdgeCounts, so that taps shorter than the poll
+   *  interval aren't lost. Only available when values are acquired by callbacks or
+   *  replayed (not kJoystick_Polled or kJoystick_Shared). Any edges already queued are
+   *  discarded.
+   *
+   * \param[in] capacity Number of edges the queue must hold between polls. Further
+   *  edges are dropped (and counted, see ButtonEdgesDropped).
+   * \output true if successful, false if unsuccessful.
+   */
+  bool EnableButtonEdges( size_t capacity );
+  
+  /**
+   * \brief Stop queueing button edges.
+   */
+  void DisableButtonEdges( void );
+  
+  /**
+   * \brief Take the oldest queued button edges, in the order they happened.
+   *
+   * \param[out] dest Buffer for the edges.
+   * \param[in] len Length of dest. Edges that don't fit stay queued for the next call.
+   * \output Number of edges written.
+   */
+  size_t PollButtonEdges( JoyButtonEdge *dest, size_t len );
+  
+  /**
+   * \brief Take every queued button edge, and summarise it per button. Any buffer may be
+   *  NULL to skip it. Without EnableButtonEdges there are no edges, so latched is the
+   *  current button states.
+   *
+   * \param[out] presses Number of presses of each button since the last call.
+   * \param[out] releases Number of releases of each button since the last call.
+   * \param[out] latched Whether each button was down at any time since the last call
+   *  (0 or 1), so a tap between calls still shows up.
+   * \param[in] len Length of the buffers. At most len buttons are written.
+   * \output Number of buttons written.
+   */
+  size_t PollButtonEdgeCounts( double *presses, double *releases, uint8_t *latched,
+                                                                          size_t len );
+  
+  /**
+   * \brief Number of button edges dropped because the queue was full.
+   */
+  uint32_t ButtonEdgesDropped( void ) const;
+  
+  /**
+   * \brief Query for the available device names. Answered from the shared registry
+   *  (see hidhotplug.hpp), so no devices are enumerated.
    *
    * \output vector JoyDev devices (which contain Product names and location values).
    */
@@ -131,38 +479,248 @@ public:
   unsigned int QueryNumberDevices( );
   
 private:
-  IOHIDManagerRef myManager;
   IOHIDDeviceRef myDevice;
   CFArrayRef myElements;
   size_t numButtons, numAxes, numInputs;
   vector<Button> myButtons;
   vector<Axes> myAxes;
+  AxisTable myAxisTable;
+  // Processing of the normalised axes
+  AxisPipeline myPipeline;
   vector<POV> myPOV;
   vector<Outputs> myOutputs;
   
+  // Event driven acquisition
+  struct ElementSlot
+  {
+    JoystickIOIndex type;
+    size_t index;
+  };
+  JoystickAcquisition myMode;
+  JoySnapshot mySnapshot;
+  vector<int32_t> myRaw;
+  vector<uint64_t> myButtonWords;
+  // Time stamps in kJoystick_Polled mode, laid out as in JoySnapshot
+  vector<uint64_t> myPolledTimes;
+  // Counters of the relative axes in kJoystick_Polled mode (see JoySnapshot::SetRelative)
+  vector<int32_t> myPolledCounts;
+  // Normalised values for the typed polls, to be converted
+  vector<double> myTypedScratch;
+  vector<uint64_t> myTimeScratch;
+  vector<ElementSlot> myCookieSlots;
+  HIDReportPlan myReportPlan;
+  vector<uint8_t> myReportBuffer;
+  HIDOutputPlan myOutputPlan;
+  OutputReportSink myOutputSink;
+  pthread_t myAcqThread;
+  pthread_mutex_t myAcqMutex;
+  pthread_cond_t myAcqCond;
+  CFRunLoopRef myAcqRunLoop;
+  bool myAcqStarted;
+  volatile bool myAcqRunning;
+  
+  // Sample ring for frame based polling
+  SampleRing myRing;
+  volatile bool myRingEnabled;
+  bool myRingDirty;
+  uint64_t myRingTime;
+  double myLastFrameTime;
+  vector<int32_t> myPacked;
+  vector<double> myFrameAxes, myFramePOVs;
+  vector<uint8_t> myFrameButtons;
+  
+  // Button edge queue. myEdgeLevels are the button states after the last edge taken,
+  // and myEdgesDropped the drops already accounted for.
+  SampleRing myEdges;
+  bool myEdgesEnabled;
+  vector<uint64_t> myEdgeLevels;
+  uint32_t myEdgesDropped;
+  
+  // Hot path counters, readable with osx_joystick_stats
+  JoyPerfCounters myPerf;
+  
+  // Device description, and the logical ranges of the axes and POVs, for captures
+  JoyCaptureInfo myInfo;
+  
+  // Capture recording. Only changed while the acquisition thread is stopped.
+  JoyCaptureWriter myCapture;
+  bool myCapturing;
+  vector<int32_t> myCapturePacked;
+  
+  // Capture replay (kJoystick_Replay)
+  JoyReplay myReplay;
+  double myReplaySpeed;
+  bool myReplayStarted;
+  uint64_t myReplayStart;
+  // Latest time given to SetReplayTime
+  double myReplayTime;
+  
+  // Shared memory slot the snapshot is published in (see Publish), or NULL
+  void *myPublished;
+  
+  // Segment a kJoystick_Shared joystick reads from, or NULL
+  const JoyShmSegment *myShared;
+  
+  /**
+   * \brief Close and release the device reference and its elements.
+   */
+  void ReleaseDevice( void );
+  
+  /**
+   * \brief Forget the elements of the previous device.
+   */
+  void ClearElements( void );
+  
+  /**
+   * \brief Create stand in elements for a device that isn't opened (a replay or a
+   *  shared joystick) from its description.
+   */
+  void AddStandIns( const JoyCaptureInfo &info );
+  
   /**
-   * \brief Initialise the IOHID manager
+   * \brief Attach to a joystick published by the acquisition daemon (kJoystick_Shared).
+   */
+  bool InitialiseShared( int32_t joyLocation );
+  
+  /**
+   * \brief Size the scratch buffers for the elements found.
+   */
+  void AllocateScratch( void );
+  
+  /**
+   * \brief Read the raw axes into myRaw, from the snapshot or the device. The
+   *  relative axes are left as counters (see JoySnapshot::SetRelative).
    *
-   * \output true if successful, false if unsuccessful.
+   * \param[in] num Number of axes to read from the device in kJoystick_Polled mode.
+   */
+  void ReadRawAxes( size_t num );
+  
+  /**
+   * \brief Mark the relative axes in the snapshot, which sums their changes.
+   */
+  void MarkRelativeAxes( void );
+  
+  /**
+   * \brief Play a capture up to the current time, when it is replayed in real time.
    */
-  bool InitialiseJoyManager( );
+  void AdvanceReplay( void );
   
   /**
-   * \brief Returns the LocationKey of the input device.
+   * \brief Throw if the daemon a kJoystick_Shared joystick reads from has stopped,
+   *  rather than return its last values as current ones.
+   */
+  void CheckShared( void );
+  
+  /**
+   * \brief Record which snapshot slot an element's value callbacks should write to.
    *
-   * \param[in] dev Device to extract the LocationKey from.
-   * \return LocationKey, or 0 if there was an error.
+   * \param[in] element Element reference.
+   * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+   * \param[in] index Index of the element within its type.
    */
-  int32_t GetLocationKey( IOHIDDeviceRef dev );
-
+  void MapElement( IOHIDElementRef element, JoystickIOIndex type, size_t index );
+  
+  /**
+   * \brief Parse the device's report descriptor.
+   *
+   * \param[out] fields Parsed fields.
+   * \param[out] outputReportBytes If not NULL, receives the length of each output report.
+   * \output true if successful, false if the descriptor is missing or malformed.
+   */
+  bool ParseDescriptor( vector<HIDField> &fields, vector<uint32_t> *outputReportBytes );
+  
+  /**
+   * \brief Parse the device's report descriptor and compile the input report plan. The
+   *  fields are matched to the elements found by Initialise by report ID and usage.
+   *
+   * \output true if successful, false if the descriptor is missing or unusable.
+   */
+  bool CompileReportPlan( void );
+  
+  /**
+   * \brief Parse the device's report descriptor and compile the output report plan, in
+   *  the same way as CompileReportPlan.
+   *
+   * \output true if any output is carried by the plan.
+   */
+  bool CompileOutputPlan( void );
+  
+  /**
+   * \brief Seed the snapshot with the current element values and start the acquisition
+   *  thread.
+   *
+   * \output true if successful, false if the thread could not be started.
+   */
+  bool StartAcquisition( void );
+  
+  /**
+   * \brief Stop the acquisition thread (if running) and wait for it to exit.
+   */
+  void StopAcquisition( void );
+  
+  /**
+   * \brief Acquisition thread. Schedules the device on its own run loop and services
+   *  the input value callbacks until StopAcquisition is called.
+   */
+  static void *AcquisitionThread( void *context );
+  
+  /**
+   * \brief Push the snapshot into the sample ring (acquisition thread only).
+   */
+  void PushSample( uint64_t time );
+  
+  /**
+   * \brief Read the button states the edges are applied to from the snapshot, if they
+   *  may have been lost (when edges were dropped, or force is set).
+   */
+  void SyncEdgeLevels( bool force );
+  
+  /**
+   * \brief Decode a packed snapshot (see JoySnapshot::PackedOffset) into the frame
+   *  scratch buffers.
+   */
+  void DecodeFrameRow( const int32_t *packed );
+  
+  /**
+   * \brief Copy the frame scratch buffers into one row of the frame outputs.
+   */
+  void ScatterFrameRow( size_t row, size_t frameSize, double *axes, uint8_t *buttons,
+                                                                          double *povs );
+  
   /**
-   * \brief Returns the ProductKey for the input device.
-   * \param[in] dev Device to extract the ProductKey from.
-   * \return A string object with the ProductKey in it. The string may be empty if the
-   *         there was an error (or the device doesn't have a product key).
+   * \brief Offset of the first time stamp of the given type in myPolledTimes.
    */
-  string GetProductKey( IOHIDDeviceRef dev );
+  size_t PolledTimeOffset( JoystickIOIndex type ) const;
+  
+  /**
+   * \brief Record a time stamp read in kJoystick_Polled mode as the newest, if it is.
+   */
+  void UpdateNewestTime( uint64_t time );
+  
+  /**
+   * \brief Run loop observer. Pushes a sample once a burst of value callbacks has been
+   *  handled, just before the acquisition thread sleeps.
+   */
+  static void RunLoopObserver( CFRunLoopObserverRef observer, CFRunLoopActivity activity,
+                                                                        void *context );
+  
+  /**
+   * \brief IOKit input value callback. Writes the new value into the snapshot.
+   */
+  static void InputValueCallback( void *context, IOReturn result, void *sender,
+                                                                   IOHIDValueRef value );
+  
+  /**
+   * \brief IOKit input report callback. Decodes the whole report into the snapshot.
+   */
+  static void InputReportCallback( void *context, IOReturn result, void *sender,
+                        IOHIDReportType type, uint32_t reportID, uint8_t *report,
+                        CFIndex reportLength );
 
 };
 
+// PollAxes and PollPOV into doubles are PollAxesInto and PollPOVInto
+template<> size_t Joystick::PollAxes<double>( double *dest, size_t len );
+template<> size_t Joystick::PollPOV<double>( double *dest, size_t len );
+
 #endif
\ No newline at end of file
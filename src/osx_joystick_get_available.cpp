@@ -17,12 +17,19 @@ void mexFunction( int nlhs, mxArray *plhs[],
                    "Too many output arguments.\n");
   UNUSED( prhs );
   
-  // Open the joystick, and get the names of all available devices
-  Joystick myJoy;
+  // Get the names of all available devices: the acquisition daemon's when it is
+  // running, otherwise the registry's
+  vector<JoyDev> AvailJoyDevs;
+  JoyShmSegment *segment = SharedJoyShm();
+  if( segment != NULL ) AvailJoyDevs = segment->Devices();
+  else
+  {
+    Joystick myJoy;
+    AvailJoyDevs = myJoy.QueryAvailableDevices();
+  }
   mwSize numJoys[2];
-  numJoys[0] = (unsigned int)myJoy.QueryNumberDevices();
+  numJoys[0] = (unsigned int)AvailJoyDevs.size();
   numJoys[1] = 2;
-  vector<JoyDev> AvailJoyDevs = myJoy.QueryAvailableDevices();
   
   // Create the cell output array
   plhs[0] = mxCreateCellArray( 2, numJoys );
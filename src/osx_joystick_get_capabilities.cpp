@@ -1,14 +1,20 @@
 #include "mex.h"
 #include "matrix.h"
 #include "osx_joystick.hpp"
+#include "joygroup.hpp"
 #include <vector>
 
 #define IS_PARAM_INT32(pVal) ( mxIsNumeric(pVal) && !mxIsLogical(pVal) &&\
     !mxIsEmpty(pVal) && !mxIsSparse(pVal) && !mxIsComplex(pVal) &&\
-    mxIsClass(pVal,"int32") && (mxGetNumberOfElements(pVal)==1) )
+    mxIsClass(pVal,"int32") && (mxGetNumberOfElements(pVal)>=1) )
 
 /**
  * \brief mex gateway function.
+ *
+ * Given a vector of LocationKeys, the four outputs hold the capabilities of each device,
+ * and an optional fifth output holds each device's (zero based) offsets into the
+ * concatenated axes, buttons, POVs and outputs of the group, one row per device.
+ *
  * \param[in] nlhs Number of left-hand side arguments
  * \param[out] plhs Pointers to left-hand side data
  * \param[in] nrhs Number of right-hand side arguments
@@ -22,24 +28,41 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] )
       "Exactly 1 parameter required.\n" );
   if( !IS_PARAM_INT32(prhs[0]) ) mexErrMsgIdAndTxt(
       "osx_joystick_get_capabilities:LocKeyNotInt32",
-      "Joystick LocationKey must be an int32.\n");
+      "Joystick LocationKey must be an int32 (or a vector of int32).\n");
   
   // Make sure there are enough outputs
-  if( nlhs !=4 ) mexErrMsgIdAndTxt(
+  if( nlhs !=4 && nlhs != 5 ) mexErrMsgIdAndTxt(
       "osx_joystick_get_capabilities:IncorrectNumberOfOutputs",
-      "Exactly 4 outputs required.\n");
+      "Exactly 4 (or 5, with the group offsets) outputs required.\n");
   
-  // Initialise the joystick
-  int32_T JoyLoc = int32_T(mxGetScalar( prhs[0] ));
-  Joystick myJoy;
-  if( !myJoy.Initialise( JoyLoc ) ) mexErrMsgIdAndTxt(
+  // Initialise the joysticks
+  const int32_T *JoyLocs = (const int32_T *)mxGetData( prhs[0] );
+  size_t numJoys = mxGetNumberOfElements( prhs[0] );
+  // Joysticks published by the acquisition daemon are described from shared memory,
+  // without opening them
+  JoystickGroup myJoys;
+  bool shared = SharedJoyShm() != NULL && myJoys.Initialise( JoyLocs, numJoys, kJoystick_Shared );
+  if( !shared && !myJoys.Initialise( JoyLocs, numJoys, kJoystick_Polled ) ) mexErrMsgIdAndTxt(
       "osx_joystick_get_capabilities:JoystickNotFound",
       "Selected joystick not found.\n");
       
-  // Get the IO capabilities of the Joystick
-  vector<int> IO = myJoy.QueryIO();
+  // Get the IO capabilities of the Joysticks
   for( size_t ii=0; ii<4; ii++ )
   {
-    plhs[ii] = mxCreateDoubleScalar( double(IO[ii]) );
+    plhs[ii] = mxCreateDoubleMatrix( numJoys, 1, mxREAL );
+    double *pr = mxGetPr( plhs[ii] );
+    for( size_t jj=0; jj<numJoys; jj++ ) pr[jj] = double( myJoys.Member( jj ).count[ii] );
   }
-}
\ No newline at end of file
+  if( nlhs == 5 )
+  {
+    plhs[4] = mxCreateDoubleMatrix( numJoys, 4, mxREAL );
+    double *pr = mxGetPr( plhs[4] );
+    for( size_t ii=0; ii<4; ii++ )
+    {
+      for( size_t jj=0; jj<numJoys; jj++ )
+      {
+        pr[ ii*numJoys + jj ] = double( myJoys.Member( jj ).offset[ii] );
+      }
+    }
+  }
+}
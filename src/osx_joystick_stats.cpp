@@ -0,0 +1,90 @@
+#include "mex.h"
+#include "matrix.h"
+#include "joystats.hpp"
+#include <vector>
+#include <string.h>
+
+/**
+ * \brief Make a Matlab struct from a JoyStat: count, min, max, mean, a 1 by
+ *  JOY_STAT_BUCKETS histogram, and its 1 by JOY_STAT_BUCKETS+1 bucket edges.
+ */
+static mxArray *StatToStruct( const JoyStat &stat )
+{
+  const char *fields[] = { "count", "min", "max", "mean", "histogram", "edges" };
+  mxArray *result = mxCreateStructMatrix( 1, 1, 6, fields );
+  mxSetField( result, 0, "count", mxCreateDoubleScalar( (double)stat.count ) );
+  mxSetField( result, 0, "min", mxCreateDoubleScalar( (double)stat.min ) );
+  mxSetField( result, 0, "max", mxCreateDoubleScalar( (double)stat.max ) );
+  mxSetField( result, 0, "mean", mxCreateDoubleScalar( JoyStatMean( &stat ) ) );
+
+  mxArray *histogram = mxCreateDoubleMatrix( 1, JOY_STAT_BUCKETS, mxREAL );
+  mxArray *edges = mxCreateDoubleMatrix( 1, JOY_STAT_BUCKETS+1, mxREAL );
+  double *ph = mxGetPr( histogram ), *pe = mxGetPr( edges );
+  double edge = 1.0;
+  pe[ 0 ] = 0.0;
+  for( size_t ii=0; ii<JOY_STAT_BUCKETS; ii++ )
+  {
+    ph[ ii ] = (double)stat.buckets[ ii ];
+    pe[ ii+1 ] = edge;
+    edge *= 2.0;
+  }
+  mxSetField( result, 0, "histogram", histogram );
+  mxSetField( result, 0, "edges", edges );
+  return result;
+}
+
+/**
+ * \brief mex gateway function.
+ *
+ * Returns the hot path counters of every open joystick in this Matlab session as a
+ * struct array, with fields locationKey, mode (0 polled, 1 event driven, 2 raw
+ * reports, 3 capture replay, 4 shared), polls, exceptions, pollTime and pushTime (nanoseconds),
+ * and ioKitCalls (per simulation step). Each statistic is a struct with count, min, max, mean and a log2
+ * bucketed histogram. Called as osx_joystick_stats('reset'), the counters are zeroed
+ * after being read, and counting carries on.
+ *
+ * \param[in] nlhs Number of left-hand side arguments
+ * \param[out] plhs Pointers to left-hand side data
+ * \param[in] nrhs Number of right-hand side arguments
+ * \param[in] prhs Pointers to right-hand side data
+ */
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] )
+{
+  // Sanity check the inputs.
+  bool reset = false;
+  if( nrhs > 1 ) mexErrMsgIdAndTxt( "osx_joystick_stats:TooManyInputs",
+                   "At most 1 parameter ('reset') accepted.\n" );
+  if( nrhs == 1 )
+  {
+    char command[16];
+    if( !mxIsChar( prhs[0] ) || mxGetString( prhs[0], command, sizeof(command) ) != 0 ||
+        strcmp( command, "reset" ) != 0 ) mexErrMsgIdAndTxt(
+        "osx_joystick_stats:UnknownCommand", "The only command is 'reset'.\n" );
+    reset = true;
+  }
+  if( nlhs > 1 ) mexErrMsgIdAndTxt( "osx_joystick_stats:TooManyOutputs",
+                   "Too many output arguments.\n");
+
+  // Read (then possibly reset) the counters, so nothing counted in between is lost
+  std::vector<JoyPerfRecord> records;
+  JoyPerfRead( records );
+  if( reset ) JoyPerfReset();
+  if( reset && nlhs == 0 ) return;
+
+  const char *fields[] = { "locationKey", "mode", "polls", "exceptions", "pollTime",
+                                                             "ioKitCalls", "pushTime" };
+  plhs[0] = mxCreateStructMatrix( records.size(), 1, 7, fields );
+  for( size_t ii=0; ii<records.size(); ii++ )
+  {
+    const JoyPerfRecord &record = records[ ii ];
+    mxArray *key = mxCreateNumericMatrix( 1, 1, mxINT32_CLASS, mxREAL );
+    *(int32_T *)mxGetData( key ) = record.locationKey;
+    mxSetField( plhs[0], ii, "locationKey", key );
+    mxSetField( plhs[0], ii, "mode", mxCreateDoubleScalar( (double)record.mode ) );
+    mxSetField( plhs[0], ii, "polls", mxCreateDoubleScalar( (double)record.polls ) );
+    mxSetField( plhs[0], ii, "exceptions", mxCreateDoubleScalar( (double)record.exceptions ) );
+    mxSetField( plhs[0], ii, "pollTime", StatToStruct( record.stats[ kJoyPerf_PollTime ] ) );
+    mxSetField( plhs[0], ii, "ioKitCalls", StatToStruct( record.stats[ kJoyPerf_IOKitCalls ] ) );
+    mxSetField( plhs[0], ii, "pushTime", StatToStruct( record.stats[ kJoyPerf_PushTime ] ) );
+  }
+}
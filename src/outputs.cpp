@@ -44,6 +44,10 @@ Outputs::Outputs( IOHIDDeviceRef device, IOHIDElementRef element )
   logmin = IOHIDElementGetLogicalMin( myElement );
   // Is it relative?
   isRelative = IOHIDElementIsRelative( myElement );
+  lastVal = 0.0;
+  // Nothing has been sent yet
+  mySent = 0;
+  myHasSent = false;
 }
     
 /**
@@ -54,12 +58,26 @@ Outputs::~Outputs()
 }
     
 /**
- * \brief Set the value of the output.
+ * \brief Set the value of the output. Nothing is sent if the value is the one last
+ *  sent.
  *
  * \param[in] val Normalised value to send to the device.
- * \exception const char* exception thrown if the value cannot be read.
+ * \return true if the value was sent.
+ * \exception const char* exception thrown if the value cannot be set.
  */
-void Outputs::SetValue( double val )
+bool Outputs::SetValue( double val )
+{
+  return Send( LogicalValue( val ) );
+}
+
+/**
+ * \brief Convert a normalised value to the logical value sent to the device. For
+ *  relative outputs this is the change since the last value converted.
+ *
+ * \param[in] val Normalised value.
+ * \return Logical value.
+ */
+int32_t Outputs::LogicalValue( double val )
 {
   if( val > 1.0 ) val = 1.0;
   if( val < 0.0 ) val = 0.0;
@@ -71,12 +89,158 @@ void Outputs::SetValue( double val )
     if( val > 1.0 ) val = 1.0;
     if( val < 0.0 ) val = 0.0;
   }
-  int intVal = int( (logmax-logmin)*val + logmin );
+  return int32_t( (logmax-logmin)*val + logmin );
+}
+
+/**
+ * \brief Send a logical value (see LogicalValue) to the device with
+ *  IOHIDDeviceSetValue. Nothing is sent if the value is the one last sent.
+ *
+ * \param[in] value Logical value.
+ * \return true if the value was sent.
+ * \exception const char* exception thrown if the value cannot be set.
+ */
+bool Outputs::Send( int32_t value )
+{
+  if( myHasSent && value == mySent ) return false;
   IOHIDValueRef hidVal = IOHIDValueCreateWithIntegerValue( kCFAllocatorDefault, myElement, 
-                                                  mach_absolute_time(), intVal );
+                                                  mach_absolute_time(), value );
   IOReturn mySuccess = IOHIDDeviceSetValue( myDevice, myElement, hidVal );
+  CFRelease( hidVal );
   if( mySuccess != kIOReturnSuccess )
   {
     throw "Unable to set output value.";
   }
-}
\ No newline at end of file
+  mySent = value;
+  myHasSent = true;
+  return true;
+}
+
+/**
+ * \brief The output's element.
+ */
+IOHIDElementRef Outputs::Element( void ) const
+{
+  return myElement;
+}
+
+/**
+ * \brief OutputReportSink constructor. Reports are dropped until Attach is called.
+ */
+OutputReportSink::OutputReportSink()
+{
+  myDevice = NULL;
+  myAsync = false;
+  myError = kIOReturnSuccess;
+  for( size_t ii=0; ii<256; ii++ ) myBusy[ ii ] = 0;
+}
+
+/**
+ * \brief OutputReportSink destructor.
+ */
+OutputReportSink::~OutputReportSink()
+{
+}
+
+/**
+ * \brief Send reports to a device, synchronously until SetAsynchronous is called.
+ *
+ * \param[in] device Device reference, or NULL to drop reports.
+ */
+void OutputReportSink::Attach( IOHIDDeviceRef device )
+{
+  myDevice = device;
+  SetAsynchronous( false );
+}
+
+/**
+ * \brief Choose between synchronous and asynchronous reports. Only call with true
+ *  while the device is scheduled on a run loop that is being serviced, as that is
+ *  where the completions are delivered. Switching back to synchronous forgets the
+ *  reports in flight, so call it once the run loop has stopped.
+ */
+void OutputReportSink::SetAsynchronous( bool async )
+{
+  myAsync = async && myDevice != NULL;
+  if( myAsync ) return;
+  for( size_t ii=0; ii<256; ii++ ) myBusy[ ii ] = 0;
+  myError = kIOReturnSuccess;
+}
+
+/**
+ * \brief Make room for the copy kept of each report in flight, so that sending
+ *  asynchronously never allocates.
+ *
+ * \param[in] reportBytes Length of each output report, indexed by report ID.
+ */
+void OutputReportSink::Reserve( const std::vector<uint32_t> &reportBytes )
+{
+  for( size_t ii=0; ii<reportBytes.size() && ii<256; ii++ ) myBuffers[ ii ].reserve( reportBytes[ ii ] );
+}
+
+/**
+ * \brief Send a whole output report (see HIDOutputSink).
+ *
+ * \return true if the report was sent (or queued to be sent), false if a report
+ *  with the same ID is still in flight.
+ * \exception const char* exception thrown if the report, or an earlier asynchronous
+ *  one, could not be sent.
+ */
+bool OutputReportSink::SendReport( uint8_t reportID, const uint8_t *report, size_t len )
+{
+  if( myDevice == NULL || len == 0 ) return true;
+  if( myError != kIOReturnSuccess )
+  {
+    myError = kIOReturnSuccess;
+    throw "Unable to send output report.";
+  }
+  
+  IOReturn result;
+  if( myAsync )
+  {
+    if( myBusy[ reportID ] ) return false;
+    std::vector<uint8_t> &buffer = myBuffers[ reportID ];
+    buffer.assign( report, report+len );
+    __sync_lock_test_and_set( &myBusy[ reportID ], 1u );
+    result = IOHIDDeviceSetReportWithCallback( myDevice, kIOHIDReportTypeOutput, reportID,
+              &buffer.front(), (CFIndex)len, JOY_OUTPUT_TIMEOUT, &OutputReportSink::ReportSent, this );
+    if( result != kIOReturnSuccess ) __sync_lock_release( &myBusy[ reportID ] );
+  }
+  else
+  {
+    result = IOHIDDeviceSetReport( myDevice, kIOHIDReportTypeOutput, reportID, report, (CFIndex)len );
+  }
+  if( result != kIOReturnSuccess )
+  {
+    throw "Unable to send output report.";
+  }
+  return true;
+}
+
+/**
+ * \brief Number of asynchronous reports in flight.
+ */
+size_t OutputReportSink::InFlight( void ) const
+{
+  size_t inFlight = 0;
+  for( size_t ii=0; ii<256; ii++ )
+  {
+    if( myBusy[ ii ] ) inFlight++;
+  }
+  return inFlight;
+}
+
+/**
+ * \brief Completion of an asynchronous report (on the run loop's thread).
+ */
+void OutputReportSink::ReportSent( void *context, IOReturn result, void *sender,
+         IOHIDReportType type, uint32_t reportID, uint8_t *report, CFIndex reportLength )
+{
+  (void)sender;
+  (void)type;
+  (void)report;
+  (void)reportLength;
+  OutputReportSink *sink = (OutputReportSink *)context;
+  if( result != kIOReturnSuccess ) sink->myError = result;
+  __sync_lock_release( &sink->myBusy[ reportID & 0xFF ] );
+}
@@ -32,6 +32,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <IOKit/hid/IOHIDElement.h>
 #include <IOKit/hid/IOHIDValue.h>
 #include <mach/mach_time.h>
+#include "hidoutput.hpp"
+
+/**
+ * \brief Timeout of an asynchronous output report, in seconds.
+ */
+#define JOY_OUTPUT_TIMEOUT 0.1
 
 class Outputs
 {
@@ -51,18 +57,121 @@ class Outputs
     ~Outputs();
     
     /**
-     * \brief Set the value of the output.
+     * \brief Set the value of the output. Nothing is sent if the value is the one last
+     *  sent.
      *
      * \param[in] val Normalised value to send to the device.
-     * \exception const char* exception thrown if the value cannot be read.
+     * \return true if the value was sent.
+     * \exception const char* exception thrown if the value cannot be set.
+     */
+    bool SetValue( double val );
+    
+    /**
+     * \brief Convert a normalised value to the logical value sent to the device. For
+     *  relative outputs this is the change since the last value converted.
+     *
+     * \param[in] val Normalised value.
+     * \return Logical value.
+     */
+    int32_t LogicalValue( double val );
+    
+    /**
+     * \brief Send a logical value (see LogicalValue) to the device with
+     *  IOHIDDeviceSetValue. Nothing is sent if the value is the one last sent.
+     *
+     * \param[in] value Logical value.
+     * \return true if the value was sent.
+     * \exception const char* exception thrown if the value cannot be set.
+     */
+    bool Send( int32_t value );
+    
+    /**
+     * \brief The output's element.
      */
-    void SetValue( double val );
+    IOHIDElementRef Element( void ) const;
     
   private:
     IOHIDElementRef myElement;
     IOHIDDeviceRef myDevice;
     double logmax, logmin, lastVal;
     bool isRelative;
+    int32_t mySent;
+    bool myHasSent;
+};
+
+/**
+ * \brief Sends whole output reports to a device with IOHIDDeviceSetReport, or
+ *  asynchronously with IOHIDDeviceSetReportWithCallback while the device is scheduled
+ *  on a run loop (so the caller never waits on the bus).
+ *
+ * At most one report with each ID is in flight at a time. While it is, SendReport
+ * refuses further reports with that ID, and HIDOutputPlan keeps them staged to be sent
+ * by a later Flush, so only the newest values are ever queued.
+ */
+class OutputReportSink : public HIDOutputSink
+{
+  public:
+    /**
+     * \brief OutputReportSink constructor. Reports are dropped until Attach is called.
+     */
+    OutputReportSink();
+    
+    /**
+     * \brief OutputReportSink destructor.
+     */
+    ~OutputReportSink();
+    
+    /**
+     * \brief Send reports to a device, synchronously until SetAsynchronous is called.
+     *
+     * \param[in] device Device reference, or NULL to drop reports.
+     */
+    void Attach( IOHIDDeviceRef device );
+    
+    /**
+     * \brief Choose between synchronous and asynchronous reports. Only call with true
+     *  while the device is scheduled on a run loop that is being serviced, as that is
+     *  where the completions are delivered. Switching back to synchronous forgets the
+     *  reports in flight, so call it once the run loop has stopped.
+     */
+    void SetAsynchronous( bool async );
+    
+    /**
+     * \brief Make room for the copy kept of each report in flight, so that sending
+     *  asynchronously never allocates.
+     *
+     * \param[in] reportBytes Length of each output report, indexed by report ID.
+     */
+    void Reserve( const std::vector<uint32_t> &reportBytes );
+    
+    /**
+     * \brief Send a whole output report (see HIDOutputSink).
+     *
+     * \return true if the report was sent (or queued to be sent), false if a report
+     *  with the same ID is still in flight.
+     * \exception const char* exception thrown if the report, or an earlier asynchronous
+     *  one, could not be sent.
+     */
+    bool SendReport( uint8_t reportID, const uint8_t *report, size_t len );
+    
+    /**
+     * \brief Number of asynchronous reports in flight.
+     */
+    size_t InFlight( void ) const;
+    
+  private:
+    /**
+     * \brief Completion of an asynchronous report (on the run loop's thread).
+     */
+    static void ReportSent( void *context, IOReturn result, void *sender,
+         IOHIDReportType type, uint32_t reportID, uint8_t *report, CFIndex reportLength );
+    
+    IOHIDDeviceRef myDevice;
+    bool myAsync;
+    // A copy of each report in flight, as IOKit reads it after SendReport returns
+    std::vector<uint8_t> myBuffers[ 256 ];
+    volatile uint32_t myBusy[ 256 ];
+    volatile IOReturn myError;
 };
 
 #endif
\ No newline at end of file
@@ -45,6 +45,21 @@ POV::POV( IOHIDDeviceRef device, IOHIDElementRef element )
   logmin = IOHIDElementGetLogicalMin( myElement );
 }
 
+/**
+ * \brief POV (hatswitch) with no device, such as one replayed from a capture. Only
+ *  its range is known, so it can decode values but must not be read.
+ *
+ * \param[in] logicalMin Logical minimum of the element.
+ * \param[in] logicalMax Logical maximum of the element.
+ */
+POV::POV( long logicalMin, long logicalMax )
+{
+  myDevice = NULL;
+  myElement = NULL;
+  logmax = (double)logicalMax;
+  logmin = (double)logicalMin;
+}
+
 /**
  * \brief POV (hatswitch) destructor.
  */
@@ -61,19 +76,43 @@ POV::~POV()
  * \exception const char* exception thrown if the value cannot be read.
  */
 double POV::ReadState( void )
+{
+  return Decode( ReadRaw() );
+}
+
+/**
+ * \brief Read the raw (integer) value of the POV (hatswitch) from the device.
+ *
+ * \param[out] timeStamp If not NULL, receives the time stamp of the value.
+ * \return Raw value of the element, as reported by the device.
+ * \exception const char* exception thrown if the value cannot be read.
+ */
+long POV::ReadRaw( uint64_t *timeStamp )
 {
   // Open the value
   IOHIDValueRef myValue;
   IOReturn mySuccess = IOHIDDeviceGetValue( myDevice, myElement, &myValue );
   if( mySuccess == kIOReturnSuccess )
   {
-    // If successful, read the value
-    double value = double( IOHIDValueGetIntegerValue( myValue ) );
-    // If it outside the range (i.e. the NULL state), return -1;
-    if( value > logmax || value < logmin ) return -1.0;
-    // Otherwise, convert to degrees and return.
-    else return 360.0*value/(logmax-logmin+1.0);
+    // If successful, return the value
+    if( timeStamp != NULL ) *timeStamp = IOHIDValueGetTimeStamp( myValue );
+    return IOHIDValueGetIntegerValue( myValue );
   }
   // If unsuccessful, throw an exception
   throw "Error reading POV";
+}
+
+/**
+ * \brief Convert a raw value of this POV (hatswitch) into an angle.
+ *
+ * \param[in] rawValue Raw value, such as returned by ReadRaw.
+ * \return Angle in degrees, or -1 if the value is the Null state.
+ */
+double POV::Decode( long rawValue ) const
+{
+  double value = double( rawValue );
+  // If it outside the range (i.e. the NULL state), return -1;
+  if( value > logmax || value < logmin ) return -1.0;
+  // Otherwise, convert to degrees and return.
+  else return 360.0*value/(logmax-logmin+1.0);
 }
\ No newline at end of file
@@ -45,6 +45,15 @@ class POV
      */
     POV( IOHIDDeviceRef device, IOHIDElementRef element );
     
+    /**
+     * \brief POV (hatswitch) with no device, such as one replayed from a capture. Only
+     *  its range is known, so it can decode values but must not be read.
+     *
+     * \param[in] logicalMin Logical minimum of the element.
+     * \param[in] logicalMax Logical maximum of the element.
+     */
+    POV( long logicalMin, long logicalMax );
+    
     /**
      * \brief POV (hatswitch) destructor.
      */
@@ -60,6 +69,23 @@ class POV
      */
     double ReadState( void );
     
+    /**
+     * \brief Read the raw (integer) value of the POV (hatswitch) from the device.
+     *
+     * \param[out] timeStamp If not NULL, receives the time stamp of the value.
+     * \return Raw value of the element, as reported by the device.
+     * \exception const char* exception thrown if the value cannot be read.
+     */
+    long ReadRaw( uint64_t *timeStamp = NULL );
+    
+    /**
+     * \brief Convert a raw value of this POV (hatswitch) into an angle.
+     *
+     * \param[in] rawValue Raw value, such as returned by ReadRaw.
+     * \return Angle in degrees, or -1 if the value is the Null state.
+     */
+    double Decode( long rawValue ) const;
+    
   private:
     IOHIDElementRef myElement;
     IOHIDDeviceRef myDevice;
@@ -0,0 +1,216 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "samplering.hpp"
+#include <cstdlib>
+#include <cstring>
+
+// Index of the producer (head) and consumer (tail) counters
+#define RING_HEAD 0
+#define RING_TAIL 1
+
+/**
+ * \brief SampleRing constructor. The ring has no capacity until Resize is called.
+ */
+SampleRing::SampleRing()
+{
+  void *mem = NULL;
+  if( posix_memalign( &mem, JOY_CACHE_LINE, 2*sizeof(Index) ) != 0 )
+  {
+    throw "Unable to allocate the sample ring";
+  }
+  myIndices = (Index *)mem;
+  myIndices[ RING_HEAD ].value = 0;
+  myIndices[ RING_TAIL ].value = 0;
+  myTimes = NULL;
+  myValues = NULL;
+  myCapacity = 0;
+  myStride = 0;
+  myMask = 0;
+  myDropped = 0;
+}
+
+/**
+ * \brief SampleRing destructor.
+ */
+SampleRing::~SampleRing()
+{
+  free( myIndices );
+  free( myTimes );
+  free( myValues );
+}
+
+/**
+ * \brief Allocate storage, and empty the ring. Must not be called while the producer
+ *  or consumer is active.
+ *
+ * \param[in] capacity Number of samples. Rounded up to a power of two.
+ * \param[in] stride Number of int32_t values per sample.
+ */
+void SampleRing::Resize( size_t capacity, size_t stride )
+{
+  free( myTimes );
+  free( myValues );
+  myTimes = NULL;
+  myValues = NULL;
+  myCapacity = 0;
+  myStride = 0;
+  myMask = 0;
+  myIndices[ RING_HEAD ].value = 0;
+  myIndices[ RING_TAIL ].value = 0;
+  myDropped = 0;
+  if( capacity == 0 ) return;
+  
+  size_t rounded = 1;
+  while( rounded < capacity ) rounded <<= 1;
+  
+  void *times = NULL, *values = NULL;
+  if( posix_memalign( &times, JOY_CACHE_LINE, rounded*sizeof(uint64_t) ) != 0 )
+  {
+    throw "Unable to allocate the sample ring";
+  }
+  // Allocate at least one value, so myValues is valid even for an empty stride.
+  if( posix_memalign( &values, JOY_CACHE_LINE, (rounded*stride + 1)*sizeof(int32_t) ) != 0 )
+  {
+    free( times );
+    throw "Unable to allocate the sample ring";
+  }
+  myTimes = (uint64_t *)times;
+  myValues = (int32_t *)values;
+  memset( myValues, 0, (rounded*stride + 1)*sizeof(int32_t) );
+  myCapacity = rounded;
+  myStride = stride;
+  myMask = (uint32_t)( rounded - 1 );
+}
+
+/**
+ * \brief Number of samples the ring can hold.
+ */
+size_t SampleRing::Capacity( void ) const
+{
+  return myCapacity;
+}
+
+/**
+ * \brief Number of int32_t values per sample.
+ */
+size_t SampleRing::Stride( void ) const
+{
+  return myStride;
+}
+
+/**
+ * \brief Producer: get the slot for the next sample. Fill it in, then call EndPush.
+ *
+ * \return Slot of Stride() values, or NULL if the ring is full (the sample is dropped).
+ */
+int32_t *SampleRing::BeginPush( void )
+{
+  uint32_t head = myIndices[ RING_HEAD ].value;
+  uint32_t tail = myIndices[ RING_TAIL ].value;
+  if( myCapacity == 0 || head - tail >= (uint32_t)myCapacity )
+  {
+    myDropped = myDropped + 1;
+    return NULL;
+  }
+  return myValues + ( head & myMask )*myStride;
+}
+
+/**
+ * \brief Producer: publish the sample written into the slot from BeginPush.
+ *
+ * \param[in] time Time stamp of the sample.
+ */
+void SampleRing::EndPush( uint64_t time )
+{
+  uint32_t head = myIndices[ RING_HEAD ].value;
+  myTimes[ head & myMask ] = time;
+  // The sample must be visible before the new head
+  __sync_synchronize();
+  myIndices[ RING_HEAD ].value = head + 1;
+}
+
+/**
+ * \brief Producer: copy a sample into the ring.
+ *
+ * \return false if the ring is full (the sample is dropped).
+ */
+bool SampleRing::Push( uint64_t time, const int32_t *values )
+{
+  int32_t *slot = BeginPush();
+  if( slot == NULL ) return false;
+  memcpy( slot, values, myStride*sizeof(int32_t) );
+  EndPush( time );
+  return true;
+}
+
+/**
+ * \brief Consumer: number of samples waiting.
+ */
+size_t SampleRing::Available( void ) const
+{
+  uint32_t head = myIndices[ RING_HEAD ].value;
+  // Samples must not be read before the head that published them
+  __sync_synchronize();
+  return (size_t)( head - myIndices[ RING_TAIL ].value );
+}
+
+/**
+ * \brief Consumer: look at a waiting sample without removing it.
+ *
+ * \param[in] index Sample index, 0 being the oldest. Must be less than Available().
+ * \param[out] time Time stamp of the sample (may be NULL).
+ * \return The sample's Stride() values.
+ */
+const int32_t *SampleRing::Peek( size_t index, uint64_t *time ) const
+{
+  uint32_t slot = ( myIndices[ RING_TAIL ].value + (uint32_t)index ) & myMask;
+  if( time != NULL ) *time = myTimes[ slot ];
+  return myValues + slot*myStride;
+}
+
+/**
+ * \brief Consumer: remove the oldest samples.
+ *
+ * \param[in] count Number of samples to remove. At most Available() are removed.
+ */
+void SampleRing::Consume( size_t count )
+{
+  size_t available = Available();
+  if( count > available ) count = available;
+  // Reads of the samples must be complete before the producer may overwrite them
+  __sync_synchronize();
+  myIndices[ RING_TAIL ].value = myIndices[ RING_TAIL ].value + (uint32_t)count;
+}
+
+/**
+ * \brief Number of samples dropped because the ring was full.
+ */
+uint32_t SampleRing::Dropped( void ) const
+{
+  return myDropped;
+}
@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __SAMPLERING_H__
+#define __SAMPLERING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "snapshot.hpp"
+
+/**
+ * \brief Lock-free single producer, single consumer ring of timestamped samples.
+ *
+ * Each sample is a fixed number (the stride) of int32_t values, such as a packed copy of
+ * a JoySnapshot, plus a 64 bit time stamp. The producer (the acquisition thread) and the
+ * consumer (the Simulink step) each own one index, kept on separate cache lines. When
+ * the ring is full, new samples are dropped and counted.
+ */
+class SampleRing
+{
+  public:
+    /**
+     * \brief SampleRing constructor. The ring has no capacity until Resize is called.
+     */
+    SampleRing();
+    
+    /**
+     * \brief SampleRing destructor.
+     */
+    ~SampleRing();
+    
+    /**
+     * \brief Allocate storage, and empty the ring. Must not be called while the producer
+     *  or consumer is active.
+     *
+     * \param[in] capacity Number of samples. Rounded up to a power of two.
+     * \param[in] stride Number of int32_t values per sample.
+     */
+    void Resize( size_t capacity, size_t stride );
+    
+    /**
+     * \brief Number of samples the ring can hold.
+     */
+    size_t Capacity( void ) const;
+    
+    /**
+     * \brief Number of int32_t values per sample.
+     */
+    size_t Stride( void ) const;
+    
+    /**
+     * \brief Producer: get the slot for the next sample. Fill it in, then call EndPush.
+     *
+     * \return Slot of Stride() values, or NULL if the ring is full (the sample is dropped).
+     */
+    int32_t *BeginPush( void );
+    
+    /**
+     * \brief Producer: publish the sample written into the slot from BeginPush.
+     *
+     * \param[in] time Time stamp of the sample.
+     */
+    void EndPush( uint64_t time );
+    
+    /**
+     * \brief Producer: copy a sample into the ring.
+     *
+     * \return false if the ring is full (the sample is dropped).
+     */
+    bool Push( uint64_t time, const int32_t *values );
+    
+    /**
+     * \brief Consumer: number of samples waiting.
+     */
+    size_t Available( void ) const;
+    
+    /**
+     * \brief Consumer: look at a waiting sample without removing it.
+     *
+     * \param[in] index Sample index, 0 being the oldest. Must be less than Available().
+     * \param[out] time Time stamp of the sample (may be NULL).
+     * \return The sample's Stride() values.
+     */
+    const int32_t *Peek( size_t index, uint64_t *time ) const;
+    
+    /**
+     * \brief Consumer: remove the oldest samples.
+     *
+     * \param[in] count Number of samples to remove. At most Available() are removed.
+     */
+    void Consume( size_t count );
+    
+    /**
+     * \brief Number of samples dropped because the ring was full.
+     */
+    uint32_t Dropped( void ) const;
+    
+  private:
+    // Each index gets a cache line to itself (see JoySnapshot::Sequence).
+    struct Index
+    {
+      volatile uint32_t value;
+      char pad[ JOY_CACHE_LINE - sizeof(uint32_t) ];
+    };
+    
+    Index *myIndices;
+    uint64_t *myTimes;
+    int32_t *myValues;
+    size_t myCapacity, myStride;
+    uint32_t myMask;
+    volatile uint32_t myDropped;
+    
+    // Non-copyable
+    SampleRing( const SampleRing & );
+    SampleRing &operator=( const SampleRing & );
+};
+
+#endif
@@ -29,16 +29,66 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define S_FUNCTION_NAME  sfun_osx_joystick
 
 #include "simstruc.h"
+#include "fixedpoint.h"
 #include "osx_joystick.hpp"
+#include "joysession.hpp"
+#include "joygroup.hpp"
+#include "joyeffects.hpp"
 
-// Parameter indicies
+// Parameter indicies. The parameters from NUM_PARAMS on are optional.
 #define NUM_PARAMS 6
+#define MAX_PARAMS 16
 #define P_JOYID 0
 #define P_TS 1
 #define P_LA 2
 #define P_LB 3
 #define P_LP 4
 #define P_LO 5
+#define P_FRAME 6
+#define P_AGE 7
+#define P_CAPTURE 8
+#define P_REPLAY 9
+#define P_EFFECTS 10
+#define P_AXES 11
+#define P_EDGES 12
+#define P_RELATIVE 13
+#define P_TYPES 14
+#define P_RATES 15
+
+// Columns of the axis processing parameter
+#define AXIS_COLUMNS 8
+
+// Ring buffer capacity (samples) used for frame based outputs
+#define MIN_FRAME_CAPACITY 256
+
+// Button edge outputs: press and release count ports, or a latched port
+#define EDGES_COUNTS 1
+#define EDGES_LATCHED 2
+// Button edges each joystick can queue between steps
+#define EDGE_CAPACITY 1024
+
+// Relative axis outputs: accumulated positions, changes per step, or positions with an
+// input port that resets their origin
+#define RELATIVE_POSITION 0
+#define RELATIVE_DELTA 1
+#define RELATIVE_RESETTABLE 2
+
+// Axis and POV output data types. Raw counts skip the normalisation, and fixed-point
+// stores the raw counts with the normalisation as its scaling. POVs are whole degrees
+// for the integer types.
+#define TYPES_DOUBLE 0
+#define TYPES_SINGLE 1
+#define TYPES_INT16 2
+#define TYPES_INT32 3
+#define TYPES_FIXPT 4
+
+// Port groups that can run at their own sample times: the axis, button, POV and
+// joystick output (block input) ports
+#define RATE_AXES 0
+#define RATE_BUTTONS 1
+#define RATE_POVS 2
+#define RATE_OUTPUTS 3
+#define NUM_RATES 4
 
 #define UNUSED(x) (void)(x)
 
@@ -50,6 +100,399 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
     !mxIsEmpty(pVal) && !mxIsSparse(pVal) && !mxIsComplex(pVal) &&\
     mxIsClass(pVal,"int32") && (mxGetNumberOfElements(pVal)==1) )
 
+#define IS_PARAM_INT32_VECTOR(pVal) ( mxIsNumeric(pVal) && !mxIsLogical(pVal) &&\
+    !mxIsEmpty(pVal) && !mxIsSparse(pVal) && !mxIsComplex(pVal) &&\
+    mxIsClass(pVal,"int32") && (mxGetNumberOfElements(pVal)>=1) )
+
+/**
+ * \brief Value of an optional parameter, or the default if it wasn't given.
+ */
+static real_T GetOptionalParam( SimStruct *S, int_T param, real_T defaultValue )
+{
+  if( ssGetSFcnParamsCount( S ) <= param ) return defaultValue;
+  return mxGetScalar( ssGetSFcnParam( S, param ) );
+}
+
+/**
+ * \brief Number of samples per frame, or 0 if the outputs aren't frame based.
+ */
+static int_T GetFrameSize( SimStruct *S )
+{
+  return int_T( GetOptionalParam( S, P_FRAME, 0.0 ) );
+}
+
+/**
+ * \brief Whether the block has a port with the age (microseconds) of each joystick's
+ *  newest sample.
+ */
+static bool HasAgePort( SimStruct *S )
+{
+  return GetOptionalParam( S, P_AGE, 0.0 ) > 0;
+}
+
+/**
+ * \brief Which button edge ports the block has (0 for none, EDGES_COUNTS or
+ *  EDGES_LATCHED).
+ */
+static int_T GetEdgeMode( SimStruct *S )
+{
+  return int_T( GetOptionalParam( S, P_EDGES, 0.0 ) );
+}
+
+/**
+ * \brief Number of button edge ports.
+ */
+static int_T NumEdgePorts( SimStruct *S )
+{
+  if( GetEdgeMode( S ) == EDGES_COUNTS ) return 2;
+  return GetEdgeMode( S ) == EDGES_LATCHED ? 1 : 0;
+}
+
+/**
+ * \brief What the relative axes output (RELATIVE_POSITION, RELATIVE_DELTA or
+ *  RELATIVE_RESETTABLE).
+ */
+static int_T GetRelativeMode( SimStruct *S )
+{
+  return int_T( GetOptionalParam( S, P_RELATIVE, RELATIVE_POSITION ) );
+}
+
+/**
+ * \brief Whether the block has an input port that resets the origin of the relative
+ *  axes. It comes after the joystick output and effect ports.
+ */
+static bool HasResetPort( SimStruct *S )
+{
+  return GetRelativeMode( S ) == RELATIVE_RESETTABLE;
+}
+
+/**
+ * \brief Data type of the axis and POV ports (TYPES_DOUBLE, TYPES_SINGLE, TYPES_INT16,
+ *  TYPES_INT32 or TYPES_FIXPT).
+ */
+static int_T GetOutputTypes( SimStruct *S )
+{
+  return int_T( GetOptionalParam( S, P_TYPES, TYPES_DOUBLE ) );
+}
+
+/**
+ * \brief Built-in type the axes are polled as. For fixed-point this is the integer
+ *  type holding the raw counts over the logical range the group's axes share, or
+ *  INVALID_DTYPE_ID if there is no such range.
+ *
+ * \param[in] S Simulink structure.
+ * \param[in] group The block's joysticks, or NULL for the dummy joystick.
+ * \param[out] logmin Logical minimum of the axes, for fixed-point.
+ * \param[out] logmax Logical maximum of the axes, for fixed-point.
+ */
+static DTypeId AxisStorageType( SimStruct *S, const JoystickGroup *group,
+                                int32_t &logmin, int32_t &logmax )
+{
+  switch( GetOutputTypes( S ) )
+  {
+    case TYPES_SINGLE: return SS_SINGLE;
+    case TYPES_INT16: return SS_INT16;
+    case TYPES_INT32: return SS_INT32;
+    case TYPES_FIXPT: break;
+    default: return SS_DOUBLE;
+  }
+  if( group == NULL ) return SS_INT16;
+  if( !group->CommonAxisRange( logmin, logmax ) || logmax <= logmin ) return INVALID_DTYPE_ID;
+  if( logmin >= -32768 && logmax <= 32767 ) return SS_INT16;
+  if( logmin >= 0 && logmax <= 65535 ) return SS_UINT16;
+  return SS_INT32;
+}
+
+/**
+ * \brief Data type of the axis port. Fixed-point axes store the raw counts, with the
+ *  slope and bias that normalise the logical range to [-1,1], so that reading them
+ *  costs nothing. The dummy joystick (group NULL) has no range, so its fixed-point axes
+ *  are normalised sfix16_En14.
+ *
+ * \output The data type, or INVALID_DTYPE_ID if it couldn't be registered.
+ */
+static DTypeId AxisPortType( SimStruct *S, const JoystickGroup *group )
+{
+  int32_t logmin = 0, logmax = 0;
+  DTypeId storage = AxisStorageType( S, group, logmin, logmax );
+  if( GetOutputTypes( S ) != TYPES_FIXPT || storage == INVALID_DTYPE_ID ) return storage;
+  if( group == NULL ) return ssRegisterDataTypeFxpBinaryPoint( S, 1, 16, 14, 0 );
+  // The stored integer is then the raw count itself
+  double slope = 2.0/( (double)logmax - (double)logmin );
+  double bias = -slope*(double)logmin - 1.0;
+  return ssRegisterDataTypeFxpSlopeBias( S, storage == SS_UINT16 ? 0 : 1,
+                                         storage == SS_INT32 ? 32 : 16, slope, bias, 0 );
+}
+
+/**
+ * \brief Data type of the POV port. Fixed-point POVs are int16 degrees.
+ */
+static DTypeId POVPortType( SimStruct *S )
+{
+  switch( GetOutputTypes( S ) )
+  {
+    case TYPES_SINGLE: return SS_SINGLE;
+    case TYPES_INT32: return SS_INT32;
+    case TYPES_INT16:
+    case TYPES_FIXPT: return SS_INT16;
+    default: return SS_DOUBLE;
+  }
+}
+
+/**
+ * \brief Poll the group's axes into port memory of a built-in type.
+ */
+static void PollAxesAs( JoystickGroup *group, DTypeId type, void *dest, size_t len )
+{
+  switch( type )
+  {
+    case SS_SINGLE: group->PollAxes( (float *)dest, len ); break;
+    case SS_INT16: group->PollAxes( (int16_t *)dest, len ); break;
+    case SS_UINT16: group->PollAxes( (uint16_t *)dest, len ); break;
+    case SS_INT32: group->PollAxes( (int32_t *)dest, len ); break;
+    default: group->PollAxes( (double *)dest, len ); break;
+  }
+}
+
+/**
+ * \brief Poll the group's POV hats into port memory of a built-in type.
+ */
+static void PollPOVAs( JoystickGroup *group, DTypeId type, void *dest, size_t len )
+{
+  switch( type )
+  {
+    case SS_SINGLE: group->PollPOV( (float *)dest, len ); break;
+    case SS_INT16: group->PollPOV( (int16_t *)dest, len ); break;
+    case SS_INT32: group->PollPOV( (int32_t *)dest, len ); break;
+    default: group->PollPOV( (double *)dest, len ); break;
+  }
+}
+
+/**
+ * \brief Whether the (optional) rates parameter gives the port groups their own sample
+ *  times, in which case the ports have port based sample times.
+ */
+static bool HasGroupRates( SimStruct *S )
+{
+  return ssGetSFcnParamsCount( S ) > P_RATES && !mxIsEmpty( ssGetSFcnParam( S, P_RATES ) );
+}
+
+/**
+ * \brief Sample time of a port group (RATE_AXES, RATE_BUTTONS, RATE_POVS or
+ *  RATE_OUTPUTS). Groups given 0 run at the block sample time.
+ */
+static real_T GetGroupSampleTime( SimStruct *S, int_T group )
+{
+  real_T Ts = mxGetScalar( ssGetSFcnParam( S, P_TS ) );
+  if( !HasGroupRates( S ) ) return Ts;
+  real_T rate = mxGetPr( ssGetSFcnParam( S, P_RATES ) )[ group ];
+  return rate > 0.0 ? rate : Ts;
+}
+
+/**
+ * \brief Give each port the sample time of its group, when the groups have their own.
+ *  The ports after the axis, button and POV ports are laid out as in
+ *  mdlInitializeSizes, and each runs with the groups it describes: the frame counts
+ *  and the sample ages with the fastest of the axis, button and POV ports, and the
+ *  button edge ports with the buttons. The reset input runs with the axes, and the
+ *  output and effect inputs with the outputs.
+ *
+ * \param[in] S Simulink structure, with its ports already created.
+ * \param[in] axes Whether the block has an axis port.
+ * \param[in] buttons Whether the block has a button port.
+ * \param[in] povs Whether the block has a POV port.
+ */
+static void SetPortSampleTimes( SimStruct *S, bool axes, bool buttons, bool povs )
+{
+  if( !HasGroupRates( S ) ) return;
+  const bool present[] = { axes, buttons, povs };
+  real_T fastest = 0.0;
+  int_T port = 0;
+  for( int_T group=RATE_AXES; group<=RATE_POVS; group++ )
+  {
+    if( !present[ group ] ) continue;
+    real_T Ts = GetGroupSampleTime( S, group );
+    if( fastest == 0.0 || Ts < fastest ) fastest = Ts;
+    ssSetOutputPortSampleTime( S, port, Ts );
+    ssSetOutputPortOffsetTime( S, port++, 0.0 );
+  }
+  if( fastest == 0.0 ) fastest = GetGroupSampleTime( S, RATE_AXES );
+  
+  // mdlCheckParameters rejects frames with group rates, but their port is placed all
+  // the same, so that the ports after it keep their own rates
+  if( GetFrameSize( S ) > 0 )
+  {
+    ssSetOutputPortSampleTime( S, port, fastest );
+    ssSetOutputPortOffsetTime( S, port++, 0.0 );
+  }
+  if( HasAgePort( S ) )
+  {
+    ssSetOutputPortSampleTime( S, port, fastest );
+    ssSetOutputPortOffsetTime( S, port++, 0.0 );
+  }
+  // The rest are the button edge ports
+  for( ; port<ssGetNumOutputPorts( S ); port++ )
+  {
+    ssSetOutputPortSampleTime( S, port, GetGroupSampleTime( S, RATE_BUTTONS ) );
+    ssSetOutputPortOffsetTime( S, port, 0.0 );
+  }
+  int_T resets = HasResetPort( S ) ? 1 : 0;
+  for( int_T ii=0; ii<ssGetNumInputPorts( S ); ii++ )
+  {
+    bool reset = ii == ssGetNumInputPorts( S ) - resets;
+    ssSetInputPortSampleTime( S, ii, GetGroupSampleTime( S, reset ? RATE_AXES : RATE_OUTPUTS ) );
+    ssSetInputPortOffsetTime( S, ii, 0.0 );
+  }
+}
+
+/**
+ * \brief Whether a port's group runs in this call of mdlOutputs. Without group rates
+ *  every port runs at every call.
+ */
+static bool IsPortHit( SimStruct *S, int_T port, bool input, int_T tid )
+{
+  if( !HasGroupRates( S ) ) return true;
+  int_T index = input ? ssGetInputPortSampleTimeIndex( S, port )
+                      : ssGetOutputPortSampleTimeIndex( S, port );
+  return ssIsSampleHit( S, index, tid ) != 0;
+}
+
+/**
+ * \brief Read the LocationKeys from the Joystick ID parameter. Several LocationKeys
+ *  select a group of joysticks, whose values are concatenated in each port.
+ */
+static vector<int32_t> GetLocationKeys( SimStruct *S )
+{
+  const mxArray *pVal = ssGetSFcnParam( S, P_JOYID );
+  const int32_T *keys = (const int32_T *)mxGetData( pVal );
+  return vector<int32_t>( keys, keys + mxGetNumberOfElements( pVal ) );
+}
+
+/**
+ * \brief Capture file names from the (optional) capture parameter: a string, or a cell
+ *  array of strings with one per joystick in the group. Empty if there are none.
+ */
+static vector<string> GetCapturePaths( SimStruct *S )
+{
+  vector<string> paths;
+  if( ssGetSFcnParamsCount( S ) <= P_CAPTURE ) return paths;
+  const mxArray *pVal = ssGetSFcnParam( S, P_CAPTURE );
+  size_t num = mxIsCell( pVal ) ? mxGetNumberOfElements( pVal ) : 1;
+  for( size_t ii=0; ii<num; ii++ )
+  {
+    const mxArray *name = mxIsCell( pVal ) ? mxGetCell( pVal, ii ) : pVal;
+    if( name == NULL || !mxIsChar( name ) || mxIsEmpty( name ) ) return vector<string>();
+    char *text = mxArrayToString( name );
+    if( text == NULL ) return vector<string>();
+    paths.push_back( string( text ) );
+    mxFree( text );
+  }
+  return paths;
+}
+
+/**
+ * \brief Replay speed from the (optional) replay parameter. Negative (the default)
+ *  records the joysticks into the capture files, zero replays the captures in step with
+ *  the simulation time, and a positive value replays them at that multiple of real time.
+ */
+static real_T GetReplaySpeed( SimStruct *S )
+{
+  return GetOptionalParam( S, P_REPLAY, -1.0 );
+}
+
+/**
+ * \brief Number of force feedback effect slots from the (optional) effects parameter.
+ *  With effects, the block has a second input port with JOY_EFFECT_PARAMS values per
+ *  slot, and the outputs are driven by a 1 kHz effect thread (see joyeffects.hpp)
+ *  rather than pushed at each step.
+ */
+static int_T GetNumEffects( SimStruct *S )
+{
+  if( mxGetScalar( ssGetSFcnParam( S, P_LO ) ) <= 0 ) return 0;
+  return int_T( GetOptionalParam( S, P_EFFECTS, 0.0 ) );
+}
+
+/**
+ * \brief Whether the (optional) axis processing parameter is given.
+ */
+static bool HasAxisProcessing( SimStruct *S )
+{
+  return ssGetSFcnParamsCount( S ) > P_AXES && !mxIsEmpty( ssGetSFcnParam( S, P_AXES ) );
+}
+
+/**
+ * \brief Axis processing from the (optional) axis processing parameter: the name of a
+ *  file (see ReadAxisProcessing), or a matrix with a row for each axis of the group (or
+ *  a single row for all of them). The columns are the centre deadzone, edge deadzone,
+ *  calibration minimum, centre and maximum, curve (0 linear, 1 cubic, 2 expo), curve
+ *  amount and low pass cutoff (Hz). Trailing columns may be left out.
+ */
+static bool GetAxisProcessing( SimStruct *S, size_t numAxes, vector<AxisProcessing> &config )
+{
+  const mxArray *pVal = ssGetSFcnParam( S, P_AXES );
+  if( mxIsChar( pVal ) )
+  {
+    char *path = mxArrayToString( pVal );
+    if( path == NULL ) return false;
+    bool result = ReadAxisProcessing( path, numAxes, config );
+    mxFree( path );
+    return result;
+  }
+  
+  size_t rows = mxGetM( pVal ), cols = mxGetN( pVal );
+  if( rows != 1 && rows != numAxes ) return false;
+  const real_T *pr = mxGetPr( pVal );
+  config.assign( numAxes, AxisProcessingDefaults() );
+  for( size_t ii=0; ii<numAxes; ii++ )
+  {
+    size_t row = rows == 1 ? 0 : ii;
+    double values[ AXIS_COLUMNS ] = { 0.0, 0.0, -1.0, 0.0, 1.0, 0.0, 0.0, 0.0 };
+    for( size_t jj=0; jj<cols; jj++ ) values[ jj ] = pr[ row + jj*rows ];
+    AxisProcessing &axis = config[ ii ];
+    axis.deadzone = values[0];
+    axis.edge = values[1];
+    axis.calMin = values[2];
+    axis.calCentre = values[3];
+    axis.calMax = values[4];
+    axis.curve = (AxisCurve)(int)values[5];
+    axis.curveAmount = values[6];
+    axis.cutoff = values[7];
+  }
+  return true;
+}
+
+/**
+ * \brief Whether the block can read its joysticks from the acquisition daemon (sljoyd)
+ *  instead of opening them. The daemon must be running, and the block must not push
+ *  outputs, record captures, output frames or queue button edges, which all need the
+ *  device itself.
+ */
+static bool UseSharedJoysticks( SimStruct *S )
+{
+  const mxArray *pVal = ssGetSFcnParam( S, P_LO );
+  if( !IS_PARAM_DOUBLE( pVal ) || mxGetScalar( pVal ) > 0 ) return false;
+  if( GetFrameSize( S ) > 0 || !GetCapturePaths( S ).empty() ) return false;
+  if( NumEdgePorts( S ) > 0 ) return false;
+  return SharedJoyShm() != NULL;
+}
+
+/**
+ * \brief Open the block's joysticks, or replay their capture files instead. Joysticks
+ *  published by the acquisition daemon are read from shared memory when possible.
+ */
+static bool OpenJoysticks( SimStruct *S, JoystickGroup &group )
+{
+  vector<string> paths = GetCapturePaths( S );
+  if( !paths.empty() && GetReplaySpeed( S ) >= 0.0 )
+  {
+    return group.InitialiseReplay( paths, GetReplaySpeed( S ) );
+  }
+  vector<int32_t> locKeys = GetLocationKeys( S );
+  if( UseSharedJoysticks( S ) &&
+      group.Initialise( &locKeys.front(), locKeys.size(), kJoystick_Shared ) ) return true;
+  return group.Initialise( &locKeys.front(), locKeys.size(), kJoystick_EventDriven );
+}
+
 /*==================== S-function methods ====================*/
 
 #define MDL_CHECK_PARAMETERS
@@ -61,11 +504,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 void mdlCheckParameters_REALJoy( SimStruct *S )
 {
-  int32_T locKey = int32_T( mxGetScalar( ssGetSFcnParam( S, P_JOYID ) ) );
-  Joystick myJoy;
-  if( !myJoy.Initialise( locKey ) )
+  vector<int32_t> locKeys = GetLocationKeys( S );
+  for( size_t ii=0; ii<locKeys.size(); ii++ )
+  {
+    if( locKeys[ ii ] == 0 )
+    {
+      ssSetErrorStatus( S, "sfun-osx-joystick::mdlCheckParameters A group of joysticks can't include the dummy (0) joystick.");
+      return;
+    }
+  }
+  // The sessions are kept by the pool, so mdlInitializeSizes and mdlStart reuse them.
+  JoystickGroup myJoy;
+  if( !OpenJoysticks( S, myJoy ) )
   {
-    ssSetErrorStatus( S, "sfun-osx-joystick::mdlCheckParameters Selected Joystick is not available.");
+    ssSetErrorStatus( S, "sfun-osx-joystick::mdlCheckParameters Selected Joystick (or capture file) is not available.");
     return;
   }
 }
@@ -101,25 +553,28 @@ static void mdlCheckParameters( SimStruct *S )
 {
   // Make sure we have the correct number of parameters
   int_T numParams = ssGetSFcnParamsCount(S);
-  if( numParams != NUM_PARAMS )
+  if( numParams < NUM_PARAMS || numParams > MAX_PARAMS )
   {
     static char msg[256];
-    sprintf( msg, "sfun-osx-joystick::mdlCheckParameters Exactly %i parameters required.", NUM_PARAMS );
+    sprintf( msg, "sfun-osx-joystick::mdlCheckParameters Between %i and %i parameters required.", NUM_PARAMS, MAX_PARAMS );
     ssSetErrorStatus( S, msg );
     return;
   }
   
-  // Make sure that the Joystick LocationKey is an int32
-  if ( !IS_PARAM_INT32( ssGetSFcnParam( S, P_JOYID ) ) )
+  // Make sure that the Joystick LocationKey is an int32 (or a vector of them, for a
+  // group of joysticks)
+  if ( !IS_PARAM_INT32_VECTOR( ssGetSFcnParam( S, P_JOYID ) ) )
   {
-    ssSetErrorStatus(S, "sfun-osx-joystick::mdlCheckParameters Joystick ID must be an int32.");
+    ssSetErrorStatus(S, "sfun-osx-joystick::mdlCheckParameters Joystick ID must be an int32, or a vector of int32 for a group of joysticks.");
     return;
   }
   
-  // Make sure the appropriate device is available.
-  int32_t locKey = int32_t( mxGetScalar( ssGetSFcnParam( S, P_JOYID ) ) );
-  if( locKey == 0 ) mdlCheckParameters_NULLJoy( S );
+  // Make sure the appropriate device is available. Only a lone 0 selects the dummy
+  // joystick: a group goes through the real checks, which reject a 0 anywhere in it.
+  vector<int32_t> locKeys = GetLocationKeys( S );
+  if( locKeys.size() == 1 && locKeys[ 0 ] == 0 ) mdlCheckParameters_NULLJoy( S );
   else mdlCheckParameters_REALJoy( S );
+  if( ssGetErrorStatus( S ) != NULL ) return;
   
   // Make sure the sampling time is a scalar double.
   if ( !IS_PARAM_DOUBLE( ssGetSFcnParam( S, P_TS ) ) )
@@ -140,6 +595,132 @@ static void mdlCheckParameters( SimStruct *S )
     ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters lO (any outputs?) must be a scalar double.");
     return;
   }
+  // Check the (optional) frame size
+  if( numParams > P_FRAME )
+  {
+    if( !IS_PARAM_DOUBLE( ssGetSFcnParam( S, P_FRAME ) ) ||
+        mxGetScalar( ssGetSFcnParam( S, P_FRAME ) ) < 0.0 )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Frame size must be a non-negative scalar double (0 for sample based outputs).");
+      return;
+    }
+  }
+  // Check the (optional) sample age output parameter
+  if( numParams > P_AGE && !IS_PARAM_DOUBLE( ssGetSFcnParam( S, P_AGE ) ) )
+  {
+    ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters lS (sample age output?) must be a scalar double.");
+    return;
+  }
+  // Check the (optional) capture files and replay speed
+  if( numParams > P_CAPTURE && !mxIsEmpty( ssGetSFcnParam( S, P_CAPTURE ) ) )
+  {
+    vector<string> paths = GetCapturePaths( S );
+    if( paths.empty() )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters The capture file must be a string, or a cell array of strings (one per joystick).");
+      return;
+    }
+    if( GetReplaySpeed( S ) < 0.0 && paths.size() != GetLocationKeys( S ).size() )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters A capture file is needed for each joystick.");
+      return;
+    }
+  }
+  if( numParams > P_REPLAY && !IS_PARAM_DOUBLE( ssGetSFcnParam( S, P_REPLAY ) ) )
+  {
+    ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Replay speed must be a scalar double (negative to record, 0 to follow the simulation time).");
+    return;
+  }
+  // Check the (optional) number of effect slots
+  if( numParams > P_EFFECTS )
+  {
+    if( !IS_PARAM_DOUBLE( ssGetSFcnParam( S, P_EFFECTS ) ) ||
+        mxGetScalar( ssGetSFcnParam( S, P_EFFECTS ) ) < 0.0 )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Number of effects must be a non-negative scalar double (0 for no force feedback).");
+      return;
+    }
+  }
+  // Check the (optional) axis processing. The rows are checked against the axes in
+  // mdlStart.
+  if( HasAxisProcessing( S ) )
+  {
+    const mxArray *pVal = ssGetSFcnParam( S, P_AXES );
+    if( !mxIsChar( pVal ) && ( !mxIsDouble( pVal ) || mxIsComplex( pVal ) || mxIsSparse( pVal ) ||
+                               mxGetN( pVal ) > AXIS_COLUMNS ) )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Axis processing must be a file name, or a double matrix with up to 8 columns.");
+      return;
+    }
+  }
+  // Check the (optional) button edge ports
+  if( numParams > P_EDGES )
+  {
+    const mxArray *pVal = ssGetSFcnParam( S, P_EDGES );
+    if( !IS_PARAM_DOUBLE( pVal ) || ( mxGetScalar( pVal ) != 0.0 &&
+        mxGetScalar( pVal ) != EDGES_COUNTS && mxGetScalar( pVal ) != EDGES_LATCHED ) )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Button edges must be 0 (none), 1 (press and release counts) or 2 (latched presses).");
+      return;
+    }
+  }
+  // Check the (optional) relative axis outputs
+  if( numParams > P_RELATIVE )
+  {
+    const mxArray *pVal = ssGetSFcnParam( S, P_RELATIVE );
+    if( !IS_PARAM_DOUBLE( pVal ) || ( mxGetScalar( pVal ) != RELATIVE_POSITION &&
+        mxGetScalar( pVal ) != RELATIVE_DELTA && mxGetScalar( pVal ) != RELATIVE_RESETTABLE ) )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Relative axes must be 0 (positions), 1 (changes per step) or 2 (positions with a reset input).");
+      return;
+    }
+  }
+  // Check the (optional) output data types. Frames are only polled as doubles, and
+  // raw counts skip the axis processing.
+  if( numParams > P_TYPES )
+  {
+    const mxArray *pVal = ssGetSFcnParam( S, P_TYPES );
+    if( !IS_PARAM_DOUBLE( pVal ) || mxGetScalar( pVal ) < TYPES_DOUBLE ||
+        mxGetScalar( pVal ) > TYPES_FIXPT || mxGetScalar( pVal ) != int_T( mxGetScalar( pVal ) ) )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Output data type must be 0 (double), 1 (single), 2 (int16 raw counts), 3 (int32 raw counts) or 4 (fixed-point).");
+      return;
+    }
+    if( GetOutputTypes( S ) != TYPES_DOUBLE && GetFrameSize( S ) > 0 )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Frame based outputs are double only.");
+      return;
+    }
+    if( GetOutputTypes( S ) > TYPES_SINGLE && HasAxisProcessing( S ) )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Axis processing needs double or single outputs, as raw counts skip it.");
+      return;
+    }
+  }
+  // Check the (optional) port group sample times
+  if( HasGroupRates( S ) )
+  {
+    const mxArray *pVal = ssGetSFcnParam( S, P_RATES );
+    if( !mxIsDouble( pVal ) || mxIsComplex( pVal ) || mxIsSparse( pVal ) ||
+        mxGetNumberOfElements( pVal ) != NUM_RATES )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Rates must be a double vector of 4 sample times: axes, buttons, POVs and outputs (0 for the block sample time).");
+      return;
+    }
+    for( int_T ii=0; ii<NUM_RATES; ii++ )
+    {
+      if( mxGetPr( pVal )[ ii ] < 0.0 || GetGroupSampleTime( S, ii ) <= 0.0 )
+      {
+        ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Rates must be positive, or 0 with a positive block sample time.");
+        return;
+      }
+    }
+    if( GetFrameSize( S ) > 0 )
+    {
+      ssSetErrorStatus( S, "sfun_osx_joystick::mdlCheckParameters Frame based outputs run at a single rate.");
+      return;
+    }
+  }
 }
 #endif
 
@@ -184,9 +765,26 @@ static void mdlSetDefaultPortDimensionInfo( SimStruct *S )
     if( ssGetOutputPortWidth( S, output ) == DYNAMICALLY_SIZED ) ssSetOutputPortWidth( S, output, 1 );
     output++;
   }
+  if( GetFrameSize( S ) > 0 )
+  {
+    if( ssGetOutputPortWidth( S, output ) == DYNAMICALLY_SIZED ) ssSetOutputPortWidth( S, output, 1 );
+    output++;
+  }
+  if( HasAgePort( S ) )
+  {
+    if( ssGetOutputPortWidth( S, output ) == DYNAMICALLY_SIZED ) ssSetOutputPortWidth( S, output, 1 );
+    output++;
+  }
+  for( int_T ii=0; ii<NumEdgePorts( S ); ii++ )
+  {
+    if( ssGetOutputPortWidth( S, output ) == DYNAMICALLY_SIZED ) ssSetOutputPortWidth( S, output, 1 );
+    output++;
+  }
   if( mxGetScalar( ssGetSFcnParam( S, P_LO ) ) > 0 )
   {
     if( ssGetInputPortWidth( S, 0 ) == DYNAMICALLY_SIZED ) ssSetInputPortWidth( S, 0, 1 );
+    if( GetNumEffects( S ) > 0 && ssGetInputPortWidth( S, 1 ) == DYNAMICALLY_SIZED )
+      ssSetInputPortWidth( S, 1, GetNumEffects( S )*JOY_EFFECT_PARAMS );
   }
 }
 
@@ -202,35 +800,47 @@ void mdlInitializeSizes_REALJoy( SimStruct *S );
  */
 static void mdlInitializeSizes(SimStruct *S)
 {
-  // Number of expected parameters, and check them.
-  ssSetNumSFcnParams( S, NUM_PARAMS );
+  // Number of expected parameters, and check them. The trailing parameters are
+  // optional, so accept the number given (mdlCheckParameters checks the range).
+  ssSetNumSFcnParams( S, ssGetSFcnParamsCount( S ) );
   mdlCheckParameters(S);
   if (ssGetErrorStatus(S) != NULL) return;
   
   // No tunable parameters.
   ssSetSFcnParamTunable( S, P_JOYID, SS_PRM_NOT_TUNABLE );
   ssSetSFcnParamTunable( S, P_TS, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_FRAME ) ssSetSFcnParamTunable( S, P_FRAME, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_AGE ) ssSetSFcnParamTunable( S, P_AGE, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_CAPTURE ) ssSetSFcnParamTunable( S, P_CAPTURE, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_REPLAY ) ssSetSFcnParamTunable( S, P_REPLAY, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_EFFECTS ) ssSetSFcnParamTunable( S, P_EFFECTS, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_AXES ) ssSetSFcnParamTunable( S, P_AXES, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_EDGES ) ssSetSFcnParamTunable( S, P_EDGES, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_RELATIVE ) ssSetSFcnParamTunable( S, P_RELATIVE, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_TYPES ) ssSetSFcnParamTunable( S, P_TYPES, SS_PRM_NOT_TUNABLE );
+  if( ssGetSFcnParamsCount( S ) > P_RATES ) ssSetSFcnParamTunable( S, P_RATES, SS_PRM_NOT_TUNABLE );
 
   // No internal dynamic states
   ssSetNumContStates(S, 0);
   ssSetNumDiscStates(S, 0);
   
-  // Number of sample times (1)
-  ssSetNumSampleTimes(S, 1);
+  // Number of sample times (1), or one per port group, set on the ports
+  ssSetNumSampleTimes( S, HasGroupRates( S ) ? PORT_BASED_SAMPLE_TIMES : 1 );
   // No Real work vector
   ssSetNumRWork(S, 0);
-  // No integer work vector
-  ssSetNumIWork(S, 0);
-  // 2 pointers in the work vector (to store the Joystick object and Joystick IO)
-  ssSetNumPWork(S, 2);
+  // 2 integers in the work vector (the built-in types the axes and POVs are polled as)
+  ssSetNumIWork(S, 2);
+  // 3 pointers in the work vector (to store the Joystick object, Joystick IO and the
+  // effect engine)
+  ssSetNumPWork(S, 3);
   // No Modes
   ssSetNumModes(S, 0);
   // No zero crossings
   ssSetNumNonsampledZCs(S, 0);
   // Allow automatic state saving and restoring
   ssSetSimStateCompliance( S, USE_DEFAULT_SIM_STATE );
-  // No options set.
-  ssSetOptions(S, 0);
+  // No options set, other than the port sample times being set on the ports.
+  ssSetOptions( S, HasGroupRates( S ) ? SS_OPTION_PORT_SAMPLE_TIMES_ASSIGNED : 0 );
 
   int32_t locKey = int32_t( mxGetScalar( ssGetSFcnParam( S, P_JOYID ) ) );
   if( locKey == 0 ) mdlInitializeSizes_NULLJoy( S );
@@ -243,10 +853,9 @@ static void mdlInitializeSizes(SimStruct *S)
  */
 void mdlInitializeSizes_REALJoy( SimStruct *S )
 {
-  // Initialise the joystick, so we can retrieve its IO capabilities
-  Joystick myJoy;
-  int32_t locKey = int32_t( mxGetScalar( ssGetSFcnParam( S, P_JOYID ) ) );
-  if( !myJoy.Initialise( locKey ) )
+  // Get the (pooled) joysticks, so we can retrieve their IO capabilities
+  JoystickGroup myJoy;
+  if( !OpenJoysticks( S, myJoy ) )
   {
     // If the joystick doesn't exist, initialise the sizes as per the NULL joystick, and
     // return an error.
@@ -257,32 +866,50 @@ void mdlInitializeSizes_REALJoy( SimStruct *S )
   // Retrieve IO capability information from the joystick.
   vector<int> JoyIO = myJoy.QueryIO();
   
-  // Set the number of input ports to the number of Outputs to the Joystick
+  // Set the number of input ports to the number of Outputs to the Joystick (and the
+  // effects), followed by the relative axis reset
   bool result;
-  if( JoyIO[ kJoystick_Outputs ] > 0 )
+  int_T resetPort = 0;
+  if( JoyIO[ kJoystick_Outputs ] > 0 && mxGetScalar( ssGetSFcnParam( S, P_LO ) ) > 0 )
   {
-    int lO = int( mxGetScalar( ssGetSFcnParam( S, P_LO ) ) );
-    if( lO )
+    int_T numEffects = GetNumEffects( S );
+    resetPort = numEffects > 0 ? 2 : 1;
+    result = ssSetNumInputPorts( S, resetPort + ( HasResetPort( S ) ? 1 : 0 ) );
+    ssSetInputPortWidth( S, 0, JoyIO[ kJoystick_Outputs ] );
+    ssSetInputPortDataType( S, 0, SS_DOUBLE );
+    ssSetInputPortDirectFeedThrough( S, 0, 1 );
+    if( result && numEffects > 0 )
     {
-      result = ssSetNumInputPorts( S, 1 );
-      ssSetInputPortWidth( S, 0, JoyIO[ kJoystick_Outputs ] );
-      ssSetInputPortDataType( S, 0, SS_DOUBLE );
-      ssSetInputPortDirectFeedThrough( S, 0, 1 );
+      ssSetInputPortWidth( S, 1, numEffects*JOY_EFFECT_PARAMS );
+      ssSetInputPortDataType( S, 1, SS_DOUBLE );
+      ssSetInputPortDirectFeedThrough( S, 1, 1 );
     }
-    else result = ssSetNumInputPorts( S, 0 );
   }
-  else result = ssSetNumInputPorts( S, 0 );
+  else result = ssSetNumInputPorts( S, HasResetPort( S ) ? 1 : 0 );
+  if( result && HasResetPort( S ) )
+  {
+    ssSetInputPortWidth( S, resetPort, 1 );
+    ssSetInputPortDataType( S, resetPort, SS_DOUBLE );
+    ssSetInputPortDirectFeedThrough( S, resetPort, 1 );
+  }
   if( !result )
   {
     ssSetErrorStatus( S, "Unable to set the number of input ports." );
     return;
   }
   
-  // Count the number of output types
+  // Count the number of output types. Frame based outputs also have a port with the
+  // number of new samples from each joystick. The sample age port comes next, then the
+  // button edge ports.
+  int_T frameSize = GetFrameSize( S );
+  int_T edgePorts = JoyIO[ kJoystick_Buttons ] > 0 ? NumEdgePorts( S ) : 0;
   int numOutputs = 0;
   if( JoyIO[ kJoystick_Axes ] > 0 ) numOutputs++;
   if( JoyIO[ kJoystick_Buttons ] > 0 ) numOutputs++;
   if( JoyIO[ kJoystick_POVs ] > 0 ) numOutputs++;
+  if( frameSize > 0 ) numOutputs++;
+  if( HasAgePort( S ) ) numOutputs++;
+  numOutputs += edgePorts;
   
   // Set the number of output ports
   if( !ssSetNumOutputPorts( S, numOutputs ) )
@@ -293,26 +920,44 @@ void mdlInitializeSizes_REALJoy( SimStruct *S )
     ssSetErrorStatus( S, msg );
   }
   
-  // Now set the output port widths and data types
+  // Now set the output port widths (or frame dimensions) and data types
+  DTypeId axisType = JoyIO[ kJoystick_Axes ] > 0 ? AxisPortType( S, &myJoy ) : SS_DOUBLE;
+  if( axisType == INVALID_DTYPE_ID )
+  {
+    ssSetErrorStatus( S, "sfun-osx-joystick::mdlInitializeSizes Fixed-point axes need every axis in the group to have the same logical range." );
+    return;
+  }
   int jj = 0;
-  if( JoyIO[ kJoystick_Axes ] > 0 )
+  const JoystickIOIndex types[] = { kJoystick_Axes, kJoystick_Buttons, kJoystick_POVs };
+  const DTypeId dataTypes[] = { axisType, SS_BOOLEAN, POVPortType( S ) };
+  for( size_t ii=0; ii<3; ii++ )
   {
-    ssSetOutputPortWidth( S, jj, JoyIO[ kJoystick_Axes ] );
-    ssSetOutputPortDataType( S, jj, SS_DOUBLE );
+    if( JoyIO[ types[ii] ] <= 0 ) continue;
+    if( frameSize > 0 ) ssSetOutputPortMatrixDimensions( S, jj, frameSize, JoyIO[ types[ii] ] );
+    else ssSetOutputPortWidth( S, jj, JoyIO[ types[ii] ] );
+    ssSetOutputPortDataType( S, jj, dataTypes[ii] );
     jj++;
   }
-  if( JoyIO[ kJoystick_Buttons ] > 0 )
+  if( frameSize > 0 )
   {
-    ssSetOutputPortWidth( S, jj, JoyIO[ kJoystick_Buttons ] );
-    ssSetOutputPortDataType( S, jj, SS_BOOLEAN );
+    ssSetOutputPortWidth( S, jj, (int_T)myJoy.Size() );
+    ssSetOutputPortDataType( S, jj, SS_DOUBLE );
     jj++;
   }
-  if( JoyIO[ kJoystick_POVs ] > 0 )
+  if( HasAgePort( S ) )
   {
-    ssSetOutputPortWidth( S, jj, JoyIO[ kJoystick_POVs ] );
+    ssSetOutputPortWidth( S, jj, (int_T)myJoy.Size() );
     ssSetOutputPortDataType( S, jj, SS_DOUBLE );
     jj++;
   }
+  for( int_T ii=0; ii<edgePorts; ii++ )
+  {
+    ssSetOutputPortWidth( S, jj, JoyIO[ kJoystick_Buttons ] );
+    ssSetOutputPortDataType( S, jj, GetEdgeMode( S ) == EDGES_LATCHED ? SS_BOOLEAN : SS_DOUBLE );
+    jj++;
+  }
+  SetPortSampleTimes( S, JoyIO[ kJoystick_Axes ] > 0, JoyIO[ kJoystick_Buttons ] > 0,
+                      JoyIO[ kJoystick_POVs ] > 0 );
 }
 
 /**
@@ -330,13 +975,26 @@ void mdlInitializeSizes_NULLJoy( SimStruct *S )
   
   // Set the number of input ports and the input data size
   bool result;
+  int_T resetPort = 0;
   if( lO )
   {
-    result = ssSetNumInputPorts( S, 1 );
+    int_T numEffects = GetNumEffects( S );
+    resetPort = numEffects > 0 ? 2 : 1;
+    result = ssSetNumInputPorts( S, resetPort + ( HasResetPort( S ) ? 1 : 0 ) );
     ssSetInputPortWidth( S, 0, DYNAMICALLY_SIZED );
     ssSetInputPortDataType( S, 0, SS_DOUBLE );
+    if( result && numEffects > 0 )
+    {
+      ssSetInputPortWidth( S, 1, numEffects*JOY_EFFECT_PARAMS );
+      ssSetInputPortDataType( S, 1, SS_DOUBLE );
+    }
+  }
+  else result = ssSetNumInputPorts( S, HasResetPort( S ) ? 1 : 0 );
+  if( result && HasResetPort( S ) )
+  {
+    ssSetInputPortWidth( S, resetPort, 1 );
+    ssSetInputPortDataType( S, resetPort, SS_DOUBLE );
   }
-  else result = ssSetNumInputPorts( S, 0 );
   if( !result )
   {
     ssSetErrorStatus( S, "sfun-osx-joystick::mdlInitializeSizes_NULLJoy Failed to set the number of input ports.\n" );
@@ -348,6 +1006,9 @@ void mdlInitializeSizes_NULLJoy( SimStruct *S )
   if( lA ) numOutputs++;
   if( lB ) numOutputs++;
   if( lP ) numOutputs++;
+  if( GetFrameSize( S ) > 0 ) numOutputs++;
+  if( HasAgePort( S ) ) numOutputs++;
+  numOutputs += NumEdgePorts( S );
   
   result = ssSetNumOutputPorts( S, numOutputs );
   if( !result )
@@ -361,7 +1022,7 @@ void mdlInitializeSizes_NULLJoy( SimStruct *S )
   if( lA )
   {
     ssSetOutputPortWidth( S, output, DYNAMICALLY_SIZED );
-    ssSetOutputPortDataType( S, output, SS_DOUBLE );
+    ssSetOutputPortDataType( S, output, AxisPortType( S, NULL ) );
     output++;
   }
   if( lB )
@@ -371,11 +1032,30 @@ void mdlInitializeSizes_NULLJoy( SimStruct *S )
     output++;
   }
   if( lP )
+  {
+    ssSetOutputPortWidth( S, output, DYNAMICALLY_SIZED );
+    ssSetOutputPortDataType( S, output, POVPortType( S ) );
+    output++;
+  }
+  if( GetFrameSize( S ) > 0 )
   {
     ssSetOutputPortWidth( S, output, DYNAMICALLY_SIZED );
     ssSetOutputPortDataType( S, output, SS_DOUBLE );
     output++;
   }
+  if( HasAgePort( S ) )
+  {
+    ssSetOutputPortWidth( S, output, DYNAMICALLY_SIZED );
+    ssSetOutputPortDataType( S, output, SS_DOUBLE );
+    output++;
+  }
+  for( int_T ii=0; ii<NumEdgePorts( S ); ii++ )
+  {
+    ssSetOutputPortWidth( S, output, DYNAMICALLY_SIZED );
+    ssSetOutputPortDataType( S, output, GetEdgeMode( S ) == EDGES_LATCHED ? SS_BOOLEAN : SS_DOUBLE );
+    output++;
+  }
+  SetPortSampleTimes( S, lA != 0, lB != 0, lP != 0 );
 }
 
 
@@ -386,8 +1066,12 @@ void mdlInitializeSizes_NULLJoy( SimStruct *S )
  */
 static void mdlInitializeSampleTimes(SimStruct *S)
 {
-  ssSetSampleTime( S, 0, mxGetScalar( ssGetSFcnParam( S, P_TS ) ) );
-  ssSetOffsetTime( S, 0, 0.0 );
+  // Port based sample times are set with the ports
+  if( !HasGroupRates( S ) )
+  {
+    ssSetSampleTime( S, 0, mxGetScalar( ssGetSFcnParam( S, P_TS ) ) );
+    ssSetOffsetTime( S, 0, 0.0 );
+  }
   // Allow the block to inherit sample times
   ssSetModelReferenceSampleTimeDefaultInheritance(S);
 }
@@ -399,6 +1083,7 @@ void mdlStart_NULLJoy( SimStruct *S )
 {
   ssGetPWork(S)[0] = NULL;
   ssGetPWork(S)[1] = NULL;
+  ssGetPWork(S)[2] = NULL;
   // Initialise POVs to -1.0
   int lA, lB, lP;
   lA = int( mxGetScalar( ssGetSFcnParam( S, P_LA ) ) );
@@ -410,10 +1095,16 @@ void mdlStart_NULLJoy( SimStruct *S )
   if( lP )
   {
     int_T pw = ssGetOutputPortWidth( S, output );
-    real_T *pr = ssGetOutputPortRealSignal( S, output );
+    void *pv = ssGetOutputPortSignal( S, output );
     for( int_T ii=0; ii<pw; ii++ )
     {
-      pr[ ii ] = -1.0;
+      switch( POVPortType( S ) )
+      {
+        case SS_SINGLE: ((real32_T *)pv)[ ii ] = -1.0f; break;
+        case SS_INT16: ((int16_T *)pv)[ ii ] = -1; break;
+        case SS_INT32: ((int32_T *)pv)[ ii ] = -1; break;
+        default: ((real_T *)pv)[ ii ] = -1.0; break;
+      }
     }
   }
 }
@@ -423,15 +1114,21 @@ void mdlStart_NULLJoy( SimStruct *S )
  */
 void mdlStart_REALJoy( SimStruct *S )
 {
-  // Create a new Joystick object, and get the pointer to it.
-  Joystick *myJoy = new Joystick;
-  // Get the device ID and open it.
-  int devId = int(mxGetScalar( ssGetSFcnParam( S, P_JOYID ) ));
-  if( !myJoy->Initialise( devId ) )
+  // Get the Joysticks from the session pool. They are usually already open from
+  // mdlInitializeSizes (or a previous run). Values are delivered by callbacks, so each
+  // step only copies the latest snapshot rather than querying every element.
+  ssGetPWork(S)[0] = NULL;
+  ssGetPWork(S)[1] = NULL;
+  ssGetPWork(S)[2] = NULL;
+  vector<int32_t> locKeys = GetLocationKeys( S );
+  JoystickGroup *myJoy = new JoystickGroup;
+  if( !OpenJoysticks( S, *myJoy ) )
   {
+    int devId = int( locKeys.front() );
     if( devId > 65535 ) devId = -1;
     static char msg[256];
-    sprintf( msg, "sfun-osx-joystick::mdlStart Device %i does not exist.\n", devId );
+    if( locKeys.size() > 1 ) sprintf( msg, "sfun-osx-joystick::mdlStart A device in the group does not exist.\n" );
+    else sprintf( msg, "sfun-osx-joystick::mdlStart Device %i does not exist.\n", devId );
     ssSetErrorStatus( S, msg );
     delete myJoy;
     return;
@@ -441,12 +1138,14 @@ void mdlStart_REALJoy( SimStruct *S )
   // Double check that the device hasn't changed between the call to mdlInitializeSizes
   // and mdlStart
   bool error = false;
+  int_T resets = HasResetPort( S ) ? 1 : 0;
   if( (*JoyIO)[ kJoystick_Outputs ] > 0 )
   {
     int lO = int( mxGetScalar( ssGetSFcnParam( S, P_LO ) ) );
     if( lO )
     {
-      if( ssGetNumInputPorts(S) != 1 )
+      if( ssGetNumInputPorts(S) != (GetNumEffects( S ) > 0 ? 2 : 1) + resets ||
+          (GetNumEffects( S ) > 0 && ssGetInputPortWidth( S, 1 ) != GetNumEffects( S )*JOY_EFFECT_PARAMS) )
       {
         ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart Input number of ports size error." );
         delete myJoy;
@@ -465,20 +1164,45 @@ void mdlStart_REALJoy( SimStruct *S )
     }
     else (*JoyIO)[ kJoystick_Outputs ] = 0;
   }
+  if( (*JoyIO)[ kJoystick_Outputs ] == 0 && ssGetNumInputPorts(S) != resets )
+  {
+    ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart Input number of ports size error." );
+    delete myJoy;
+    delete JoyIO;
+    return;
+  }
+  int_T frameSize = GetFrameSize( S );
+  int_T rows = frameSize > 0 ? frameSize : 1;
   int jj=0;
   if( (*JoyIO)[ kJoystick_Axes ] > 0 )
   {
-    if( ssGetOutputPortWidth( S, jj ) != (*JoyIO)[ kJoystick_Axes ] ) error = true;
+    if( ssGetOutputPortWidth( S, jj ) != rows*(*JoyIO)[ kJoystick_Axes ] ) error = true;
     jj++;
   }
   if( (*JoyIO)[ kJoystick_Buttons ] > 0 )
   {
-    if( ssGetOutputPortWidth( S, jj ) != (*JoyIO)[ kJoystick_Buttons ] ) error = true;
+    if( ssGetOutputPortWidth( S, jj ) != rows*(*JoyIO)[ kJoystick_Buttons ] ) error = true;
     jj++;
   }
   if( (*JoyIO)[ kJoystick_POVs ] > 0 )
   {
-    if( ssGetOutputPortWidth( S, jj ) != (*JoyIO)[ kJoystick_POVs ] ) error = true;
+    if( ssGetOutputPortWidth( S, jj ) != rows*(*JoyIO)[ kJoystick_POVs ] ) error = true;
+    jj++;
+  }
+  if( frameSize > 0 )
+  {
+    if( ssGetOutputPortWidth( S, jj ) != (int_T)myJoy->Size() ) error = true;
+    jj++;
+  }
+  if( HasAgePort( S ) )
+  {
+    if( ssGetOutputPortWidth( S, jj ) != (int_T)myJoy->Size() ) error = true;
+    jj++;
+  }
+  int_T edgePorts = (*JoyIO)[ kJoystick_Buttons ] > 0 ? NumEdgePorts( S ) : 0;
+  for( int_T ii=0; ii<edgePorts; ii++ )
+  {
+    if( ssGetOutputPortWidth( S, jj ) != (*JoyIO)[ kJoystick_Buttons ] ) error = true;
     jj++;
   }
   if( jj != ssGetNumOutputPorts(S) ) error = true;
@@ -491,9 +1215,87 @@ void mdlStart_REALJoy( SimStruct *S )
     return;
   }
   
-  // Store Joystick object and the joystick IO capabilities
+  // Record every sample between steps for the frame based outputs
+  if( frameSize > 0 && !myJoy->EnableFrames( max( (size_t)(2*frameSize), (size_t)MIN_FRAME_CAPACITY ) ) )
+  {
+    ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart Unable to record samples for the frame based outputs." );
+    delete myJoy;
+    delete JoyIO;
+    return;
+  }
+  
+  // Queue every button press and release between steps for the button edge ports
+  if( edgePorts > 0 && !myJoy->EnableButtonEdges( EDGE_CAPACITY ) )
+  {
+    ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart Unable to queue the button edges." );
+    delete myJoy;
+    delete JoyIO;
+    return;
+  }
+  
+  // Record every value change into the capture files, until the group is deleted
+  vector<string> paths = GetCapturePaths( S );
+  if( !paths.empty() && GetReplaySpeed( S ) < 0.0 && !myJoy->StartCapture( paths ) )
+  {
+    ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart Unable to create the capture files." );
+    delete myJoy;
+    delete JoyIO;
+    return;
+  }
+  
+  // Process the axes in the library. The filters are stepped at each step, or at each
+  // row of a frame.
+  if( HasAxisProcessing( S ) && (*JoyIO)[ kJoystick_Axes ] > 0 )
+  {
+    vector<AxisProcessing> config;
+    real_T Ts = HasGroupRates( S ) ? GetGroupSampleTime( S, RATE_AXES ) : ssGetSampleTime( S, 0 );
+    real_T rate = Ts > 0.0 ? rows/Ts : 0.0;
+    if( !GetAxisProcessing( S, (size_t)(*JoyIO)[ kJoystick_Axes ], config ) ||
+        !myJoy->SetAxisProcessing( &config.front(), config.size(), rate ) )
+    {
+      ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart Invalid axis processing. It needs a row per axis (or one row), valid settings, and a discrete sample time for the filters." );
+      delete myJoy;
+      delete JoyIO;
+      return;
+    }
+  }
+  
+  // The built-in types to poll the axes and POVs as
+  int32_t logmin = 0, logmax = 0;
+  ssGetIWork(S)[0] = (int_T)AxisStorageType( S, myJoy, logmin, logmax );
+  ssGetIWork(S)[1] = (int_T)POVPortType( S );
+  if( (*JoyIO)[ kJoystick_Axes ] > 0 && ssGetIWork(S)[0] == INVALID_DTYPE_ID )
+  {
+    ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart The axes' logical ranges have changed between mdlInitializeSizes and mdlStart." );
+    delete myJoy;
+    delete JoyIO;
+    return;
+  }
+  
+  // Relative axes start from here, as positions or as changes per step
+  myJoy->SetRelativeMode( GetRelativeMode( S ) == RELATIVE_DELTA ? kAxisRelative_Delta
+                                                                 : kAxisRelative_Position );
+  myJoy->ResetRelativeAxes();
+  
+  // Drive the outputs from the effect thread, which from now on does all the pushes
+  JoyEffectEngine *effects = NULL;
+  if( (*JoyIO)[ kJoystick_Outputs ] > 0 && GetNumEffects( S ) > 0 )
+  {
+    effects = new JoyEffectEngine;
+    if( !effects->Start( myJoy, (size_t)GetNumEffects( S ) ) )
+    {
+      ssSetErrorStatus( S, "sfun-osx-joystick::mdlStart Unable to start the force feedback effect thread." );
+      delete effects;
+      delete myJoy;
+      delete JoyIO;
+      return;
+    }
+  }
+  
+  // Store JoystickGroup object, the joystick IO capabilities and the effect engine
   ssGetPWork(S)[0] = (void *) myJoy;
   ssGetPWork(S)[1] = (vector<int> *) JoyIO;
+  ssGetPWork(S)[2] = (void *) effects;
 }
 
 #define MDL_START
@@ -524,74 +1326,115 @@ void mdlOutputs_NULLJoy( SimStruct *S, int_T tid )
  */
 void mdlOutputs_REALJoy( SimStruct *S, int_T tid )
 {
-  UNUSED( tid );
-  Joystick *myJoy = (Joystick *) ssGetPWork(S)[0];
+  JoystickGroup *myJoy = (JoystickGroup *) ssGetPWork(S)[0];
   vector<int> *JoyIO = (vector<int> *) ssGetPWork(S)[1];
+  JoyEffectEngine *effects = (JoyEffectEngine *) ssGetPWork(S)[2];
   
   // Exception could be thrown in the case of a read error.
   try
   {
-    // Poll the Joystick axes
+    // Find the port memory. The port widths were checked against the group in mdlStart.
+    // With group rates, only the groups whose sample time hits this tid are polled, so
+    // the other ports hold their last values.
+    void *axes = NULL;
+    boolean_T *buttons = NULL;
+    void *povs = NULL;
+    bool buttonsHit = false;
     int jj = 0;
     if( (*JoyIO)[ kJoystick_Axes ] > 0 )
     {
-      real_T *pr = ssGetOutputPortRealSignal( S, jj );
-      vector<double> axes = myJoy->PollAxes();
-      if( (int)axes.size() != ssGetOutputPortWidth( S, jj ) )
-      {
-        ssSetErrorStatus( S, "osx-sl-joystick::mdlOutputs Axes port width badness." );
-        return;
-      }
-      copy( axes.begin(), axes.end(), pr );
+      if( IsPortHit( S, jj, false, tid ) ) axes = ssGetOutputPortSignal( S, jj );
       jj++;
     }
-  
-    // Poll the buttons
     if( (*JoyIO)[ kJoystick_Buttons ] > 0 )
     {
-      boolean_T *pb = (boolean_T *)ssGetOutputPortSignal( S, jj );
-      vector<bool> buttons = myJoy->PollButtons();
-      if( (int)buttons.size() != ssGetOutputPortWidth( S, jj ) )
-      {
-        ssSetErrorStatus( S, "osx-sl-joystick::mdlOutputs Button port width badness." );
-        return;
-      }
-      copy( buttons.begin(), buttons.end(), pb );
+      buttonsHit = IsPortHit( S, jj, false, tid );
+      if( buttonsHit ) buttons = (boolean_T *)ssGetOutputPortSignal( S, jj );
       jj++;
     }
-  
-    // Poll the POVs
     if( (*JoyIO)[ kJoystick_POVs ] > 0 )
     {
-      real_T *pr = ssGetOutputPortRealSignal( S, jj );
-      vector<double> POVs = myJoy->PollPOV();
-      if( (int)POVs.size() != ssGetOutputPortWidth( S, jj ) )
-      {
-        ssSetErrorStatus( S, "osx-sl-joystick::mdlOutputs POV port width badness.");
-        return;
-      }
-      copy( POVs.begin(), POVs.end(), pr );
+      if( IsPortHit( S, jj, false, tid ) ) povs = ssGetOutputPortSignal( S, jj );
       jj++;
     }
+    bool anyHit = axes != NULL || buttons != NULL || povs != NULL;
+    bool outputsHit = (*JoyIO)[ kJoystick_Outputs ] > 0 && IsPortHit( S, 0, true, tid );
+    bool resetHit = HasResetPort( S ) && IsPortHit( S, ssGetNumInputPorts( S )-1, true, tid );
+    if( !anyHit && !outputsHit && !resetHit ) return;
+    
+    // A replay in step with the simulation is played up to the current time first
+    if( GetReplaySpeed( S ) == 0.0 ) myJoy->SetReplayTime( ssGetT( S ) );
+    
+    // A non-zero reset input makes this step's position the relative axes' origin
+    if( resetHit && *ssGetInputPortRealSignal( S, ssGetNumInputPorts( S )-1 ) != 0.0 )
+    {
+      myJoy->ResetRelativeAxes();
+    }
+    
+    // Poll every joystick in the group straight into the port memory. Frames are
+    // always doubles.
+    int_T frameSize = GetFrameSize( S );
+    DTypeId axisType = (DTypeId)ssGetIWork(S)[0], povType = (DTypeId)ssGetIWork(S)[1];
+    if( frameSize > 0 )
+    {
+      real_T *counts = ssGetOutputPortRealSignal( S, jj++ );
+      myJoy->PollFrames( (size_t)frameSize, counts, (real_T *)axes, buttons, (real_T *)povs );
+    }
+    else if( axisType == SS_DOUBLE && povType == SS_DOUBLE )
+    {
+      myJoy->PollInto( (real_T *)axes, buttons, (real_T *)povs );
+    }
+    else if( anyHit )
+    {
+      myJoy->PollInto( NULL, buttons, NULL );
+      if( axes != NULL ) PollAxesAs( myJoy, axisType, axes, (size_t)(*JoyIO)[ kJoystick_Axes ] );
+      if( povs != NULL ) PollPOVAs( myJoy, povType, povs, (size_t)(*JoyIO)[ kJoystick_POVs ] );
+    }
+    
+    // Age of the newest sample, measured now that the step has read it
+    if( HasAgePort( S ) )
+    {
+      if( IsPortHit( S, jj, false, tid ) ) myJoy->SampleAges( ssGetOutputPortRealSignal( S, jj ) );
+      jj++;
+    }
+    
+    // Button presses and releases since the last step, so that taps between steps show.
+    // The edge ports run with the button port.
+    if( buttonsHit && GetEdgeMode( S ) == EDGES_COUNTS )
+    {
+      real_T *presses = ssGetOutputPortRealSignal( S, jj++ );
+      real_T *releases = ssGetOutputPortRealSignal( S, jj++ );
+      myJoy->PollButtonEdgeCounts( presses, releases, NULL, (size_t)(*JoyIO)[ kJoystick_Buttons ] );
+    }
+    else if( buttonsHit && GetEdgeMode( S ) == EDGES_LATCHED )
+    {
+      boolean_T *latched = (boolean_T *)ssGetOutputPortSignal( S, jj++ );
+      myJoy->PollButtonEdgeCounts( NULL, NULL, latched, (size_t)(*JoyIO)[ kJoystick_Buttons ] );
+    }
   
     // Push the input signals to the Joystick
-    if( (*JoyIO)[ kJoystick_Outputs ] > 0 )
+    if( outputsHit )
     {
       const real_T *pr = ssGetInputPortRealSignal( S, 0 );
-      vector<double> outputs( (*JoyIO)[ kJoystick_Outputs ], 0 );
-      if( (int)outputs.size() != ssGetInputPortWidth( S, 0 ) )
+      if( (*JoyIO)[ kJoystick_Outputs ] != ssGetInputPortWidth( S, 0 ) )
       {
         ssSetErrorStatus( S, "osx-sl-joystick::mdlOutputs Joystick Output (block input) port width badness." );
         return;
       }
-      copy( pr, pr+outputs.size(), outputs.begin() );
-      myJoy->PushInputs( outputs );
+      // With effects, the effect thread adds them to these values and pushes the sum
+      if( effects != NULL )
+      {
+        effects->SetDirect( pr, (size_t)(*JoyIO)[ kJoystick_Outputs ] );
+        effects->SetEffectParams( ssGetInputPortRealSignal( S, 1 ), (size_t)GetNumEffects( S ) );
+      }
+      else myJoy->PushInputs( pr, (size_t)(*JoyIO)[ kJoystick_Outputs ] );
     }
   }
   catch(const char *message)
   {
     ssSetErrorStatus( S, "Joystick read error. This is most likely due to a joystick being removed during simulation." );
   }
+  myJoy->EndStep();
   return;
 }
 
@@ -615,29 +1458,47 @@ static void mdlTerminate(SimStruct *S)
   int JoyLocKey = int(mxGetScalar( ssGetSFcnParam( S, P_JOYID ) ));
   if( JoyLocKey != 0 )
   {
-    // Retrieve the Joystick object.
-    Joystick *myJoy =  (Joystick *) ssGetPWork(S)[0];
+    // Retrieve the Joystick object. Both are NULL if mdlStart failed.
+    JoystickGroup *myJoy =  (JoystickGroup *) ssGetPWork(S)[0];
     vector<int> *JoyIO = (vector<int> *) ssGetPWork(S)[1];
+    if( myJoy == NULL || JoyIO == NULL ) return;
+    // Stop the effect thread first, so that it doesn't push over the zeroed outputs
+    JoyEffectEngine *effects = (JoyEffectEngine *) ssGetPWork(S)[2];
+    if( effects != NULL )
+    {
+      effects->Stop();
+      delete effects;
+      ssGetPWork(S)[2] = NULL;
+    }
     // If there are some Joystick outputs, set them to 0.
     if( (*JoyIO)[ kJoystick_Outputs ] > 0 )
     {
       vector<double> outputs( (*JoyIO)[ kJoystick_Outputs ], 0 );
       try
       {
-        myJoy->PushInputs( outputs );
+        myJoy->PushInputs( &outputs.front(), outputs.size() );
       }
       catch(const char* message)
       {
       }
     }
+    // Give the Joysticks back to the pool, which keeps them open for the next run.
     delete myJoy;
     delete JoyIO;
+    ssGetPWork(S)[0] = NULL;
+    ssGetPWork(S)[1] = NULL;
+#ifdef DEBUG
+    JoySessionStats stats = SharedJoySessionPool().Stats();
+    ssPrintf( "sfun-osx-joystick: %u sessions opened in %.1f ms, %u reused (about %.1f ms saved).\n",
+              stats.opens, 1e3*stats.openSeconds, stats.reused, 1e3*stats.savedSeconds );
+#endif
   }
 }
 
 // Required s-function trailer
 #ifdef  MATLAB_MEX_FILE    // Is this file being compiled as a MEX-file?
 #include "simulink.c"      // MEX-file interface mechanism
+#include "fixedpoint.c"    // Fixed-point data type registration
 #else
 #include "cg_sfun.h"       // Code generation registration function
 #endif
@@ -0,0 +1,313 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "sljoy.h"
+#include "joygroup.hpp"
+#include "joyshm.hpp"
+#include <new>
+#include <cstring>
+
+#ifdef ERROR_OUT
+  #include <cstdio>
+  #define ERR_PRINTF(...) fprintf(stderr,__VA_ARGS__)
+#else
+  #define ERR_PRINTF(...)
+#endif
+
+/**
+ * \brief An open joystick or group of joysticks, and its layout.
+ */
+struct SLJoy
+{
+  JoystickGroup group;
+  int32_t mode;
+  vector<int> io;
+};
+
+/**
+ * \brief Catch everything the core can throw, so that no exception reaches C. Read
+ *  and write errors are thrown as strings.
+ */
+#define SLJOY_TRY try {
+#define SLJOY_CATCH } \
+  catch( const char *message ) { ERR_PRINTF( "sljoy: %s\n", message ); return SLJOY_ERR_IO; } \
+  catch( const std::bad_alloc & ) { return SLJOY_ERR_MEMORY; } \
+  catch( ... ) { return SLJOY_ERR_INTERNAL; }
+
+/**
+ * \brief Whether a buffer is either skipped (NULL) or long enough for its type.
+ */
+static bool FitsLayout( const void *buffer, size_t len, const SLJoy *handle, JoystickIOIndex type )
+{
+  return buffer == NULL || len >= (size_t)handle->io[ type ];
+}
+
+/**
+ * \brief Version of the interface the library implements (SLJOY_ABI_VERSION).
+ */
+int32_t sljoy_version( void )
+{
+  return SLJOY_ABI_VERSION;
+}
+
+/**
+ * \brief Description of a status code, which is never NULL.
+ */
+const char *sljoy_status_string( int32_t status )
+{
+  switch( status )
+  {
+    case SLJOY_OK: return "no error";
+    case SLJOY_ERR_ARGUMENT: return "invalid argument";
+    case SLJOY_ERR_NOT_FOUND: return "joystick or capture file not available";
+    case SLJOY_ERR_IO: return "joystick read or write failed";
+    case SLJOY_ERR_MEMORY: return "out of memory";
+    case SLJOY_ERR_UNSUPPORTED: return "not supported in this acquisition mode";
+    case SLJOY_ERR_INTERNAL: return "internal error";
+    default: return "unknown status";
+  }
+}
+
+/**
+ * \brief List the attached devices: the daemon's when it is running, otherwise the
+ *  devices found by the library.
+ *
+ * \param[out] devices Buffer for the devices (may be NULL if len is 0).
+ * \param[in] len Length of devices. At most len devices are written.
+ * \param[out] count Number of attached devices, which may be more than len.
+ * \output SLJOY_OK or an error code.
+ */
+int32_t sljoy_list( SLJoyDevice *devices, size_t len, size_t *count )
+{
+  if( count == NULL || ( devices == NULL && len > 0 ) ) return SLJOY_ERR_ARGUMENT;
+  SLJOY_TRY
+  vector<JoyDev> found;
+  JoyShmSegment *segment = SharedJoyShm();
+  if( segment != NULL ) found = segment->Devices();
+  else
+  {
+    Joystick joy;
+    found = joy.QueryAvailableDevices();
+  }
+  *count = found.size();
+  for( size_t ii=0; ii<len && ii<found.size(); ii++ )
+  {
+    devices[ ii ].location = found[ ii ].locationKey;
+    strncpy( devices[ ii ].name, found[ ii ].productKey.c_str(), SLJOY_NAME_MAX - 1 );
+    devices[ ii ].name[ SLJOY_NAME_MAX - 1 ] = '\0';
+  }
+  return SLJOY_OK;
+  SLJOY_CATCH
+}
+
+/**
+ * \brief Open a joystick, or a group of joysticks.
+ *
+ * \param[in] locations Locations of the joysticks, from sljoy_list.
+ * \param[in] count Number of joysticks.
+ * \param[in] mode SLJOY_MODE_EVENTS, SLJOY_MODE_POLLED or SLJOY_MODE_SHARED.
+ * \param[out] handle The new handle, or NULL on failure.
+ * \output SLJOY_OK or an error code.
+ */
+int32_t sljoy_open( const int32_t *locations, size_t count, int32_t mode, SLJoy **handle )
+{
+  if( handle == NULL ) return SLJOY_ERR_ARGUMENT;
+  *handle = NULL;
+  if( locations == NULL || count == 0 ) return SLJOY_ERR_ARGUMENT;
+  JoystickAcquisition acquisition;
+  switch( mode )
+  {
+    case SLJOY_MODE_EVENTS: acquisition = kJoystick_EventDriven; break;
+    case SLJOY_MODE_POLLED: acquisition = kJoystick_Polled; break;
+    case SLJOY_MODE_SHARED: acquisition = kJoystick_Shared; break;
+    default: return SLJOY_ERR_ARGUMENT;
+  }
+  SLJOY_TRY
+  SLJoy *joy = new SLJoy;
+  if( !joy->group.Initialise( locations, count, acquisition ) )
+  {
+    delete joy;
+    return SLJOY_ERR_NOT_FOUND;
+  }
+  joy->mode = mode;
+  joy->io = joy->group.QueryIO();
+  *handle = joy;
+  return SLJOY_OK;
+  SLJOY_CATCH
+}
+
+/**
+ * \brief Replay capture files (made by the S-function), one per joystick, instead of
+ *  opening devices.
+ *
+ * \param[in] paths Capture file names.
+ * \param[in] count Number of files.
+ * \param[in] speed Multiple of real time to replay at.
+ * \param[out] handle The new handle, or NULL on failure.
+ * \output SLJOY_OK or an error code.
+ */
+int32_t sljoy_open_replay( const char *const *paths, size_t count, double speed, SLJoy **handle )
+{
+  if( handle == NULL ) return SLJOY_ERR_ARGUMENT;
+  *handle = NULL;
+  if( paths == NULL || count == 0 || !( speed > 0.0 ) ) return SLJOY_ERR_ARGUMENT;
+  SLJOY_TRY
+  vector<std::string> names;
+  for( size_t ii=0; ii<count; ii++ )
+  {
+    if( paths[ ii ] == NULL ) return SLJOY_ERR_ARGUMENT;
+    names.push_back( paths[ ii ] );
+  }
+  SLJoy *joy = new SLJoy;
+  if( !joy->group.InitialiseReplay( names, speed ) )
+  {
+    delete joy;
+    return SLJOY_ERR_NOT_FOUND;
+  }
+  joy->mode = SLJOY_MODE_EVENTS;
+  joy->io = joy->group.QueryIO();
+  *handle = joy;
+  return SLJOY_OK;
+  SLJOY_CATCH
+}
+
+/**
+ * \brief Close a handle. The joysticks stay open for a while in case they are opened
+ *  again. NULL is ignored.
+ */
+void sljoy_close( SLJoy *handle )
+{
+  try
+  {
+    delete handle;
+  }
+  catch( ... )
+  {
+  }
+}
+
+/**
+ * \brief Number of elements of each type.
+ *
+ * \param[in] handle Open handle.
+ * \param[in,out] layout The layout, with size set by the caller. Only the fields that
+ *  fit in size are written.
+ * \output SLJOY_OK or an error code.
+ */
+int32_t sljoy_layout( const SLJoy *handle, SLJoyLayout *layout )
+{
+  if( handle == NULL || layout == NULL || layout->size < sizeof( uint32_t ) ) return SLJOY_ERR_ARGUMENT;
+  SLJoyLayout full;
+  full.size = (uint32_t)sizeof( SLJoyLayout );
+  full.numJoysticks = (uint32_t)handle->group.Size();
+  full.numAxes = (uint32_t)handle->io[ kJoystick_Axes ];
+  full.numButtons = (uint32_t)handle->io[ kJoystick_Buttons ];
+  full.numPOVs = (uint32_t)handle->io[ kJoystick_POVs ];
+  full.numOutputs = handle->mode == SLJOY_MODE_SHARED ? 0 : (uint32_t)handle->io[ kJoystick_Outputs ];
+  // A caller built against an older, shorter layout only gets the fields it knows
+  size_t bytes = layout->size < sizeof( SLJoyLayout ) ? layout->size : sizeof( SLJoyLayout );
+  memcpy( layout, &full, bytes );
+  layout->size = (uint32_t)bytes;
+  return SLJOY_OK;
+}
+
+/**
+ * \brief Logical range of an axis, which its raw counts are normalised over.
+ *
+ * \output SLJOY_OK, or SLJOY_ERR_ARGUMENT if there is no such axis.
+ */
+int32_t sljoy_axis_range( const SLJoy *handle, size_t axis, int32_t *logmin, int32_t *logmax )
+{
+  if( handle == NULL || logmin == NULL || logmax == NULL ) return SLJOY_ERR_ARGUMENT;
+  return handle->group.AxisRange( axis, *logmin, *logmax ) ? SLJOY_OK : SLJOY_ERR_ARGUMENT;
+}
+
+/**
+ * \brief Poll every joystick into caller supplied buffers. Does not allocate. A NULL
+ *  buffer skips its type; any other must hold at least the layout's number of elements.
+ *  Each call ends a step for the performance counters (see joystats.hpp).
+ *
+ * \param[in] handle Open handle.
+ * \param[out] axes Normalised axes, in [-1,1].
+ * \param[in] numAxes Length of axes.
+ * \param[out] buttons Button states (0 or 1).
+ * \param[in] numButtons Length of buttons.
+ * \param[out] povs POV angles (degrees, or -1 for nothing pressed).
+ * \param[in] numPOVs Length of povs.
+ * \output SLJOY_OK or an error code.
+ */
+int32_t sljoy_poll( SLJoy *handle, double *axes, size_t numAxes, uint8_t *buttons,
+                    size_t numButtons, double *povs, size_t numPOVs )
+{
+  if( handle == NULL || !FitsLayout( axes, numAxes, handle, kJoystick_Axes ) ||
+      !FitsLayout( buttons, numButtons, handle, kJoystick_Buttons ) ||
+      !FitsLayout( povs, numPOVs, handle, kJoystick_POVs ) ) return SLJOY_ERR_ARGUMENT;
+  SLJOY_TRY
+  handle->group.PollInto( axes, buttons, povs );
+  handle->group.EndStep();
+  return SLJOY_OK;
+  SLJOY_CATCH
+}
+
+/**
+ * \brief Poll the raw axis counts, which skips the normalisation (see sljoy_axis_range).
+ *
+ * \param[in] handle Open handle.
+ * \param[out] counts Raw counts, at least the layout's number of axes.
+ * \param[in] len Length of counts.
+ * \output SLJOY_OK or an error code.
+ */
+int32_t sljoy_poll_counts( SLJoy *handle, int32_t *counts, size_t len )
+{
+  if( handle == NULL || counts == NULL || !FitsLayout( counts, len, handle, kJoystick_Axes ) )
+    return SLJOY_ERR_ARGUMENT;
+  SLJOY_TRY
+  handle->group.PollAxes( counts, len );
+  return SLJOY_OK;
+  SLJOY_CATCH
+}
+
+/**
+ * \brief Push values to the joysticks' outputs (such as force feedback). Only changed
+ *  values are sent.
+ *
+ * \param[in] handle Open handle.
+ * \param[in] outputs Normalised values, at least the layout's number of outputs.
+ * \param[in] len Length of outputs.
+ * \output SLJOY_OK or an error code. SLJOY_MODE_SHARED handles have no outputs.
+ */
+int32_t sljoy_push( SLJoy *handle, const double *outputs, size_t len )
+{
+  if( handle == NULL ) return SLJOY_ERR_ARGUMENT;
+  if( handle->mode == SLJOY_MODE_SHARED ) return SLJOY_ERR_UNSUPPORTED;
+  if( outputs == NULL || !FitsLayout( outputs, len, handle, kJoystick_Outputs ) )
+    return SLJOY_ERR_ARGUMENT;
+  SLJOY_TRY
+  handle->group.PushInputs( outputs, len );
+  return SLJOY_OK;
+  SLJOY_CATCH
+}
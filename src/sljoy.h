@@ -0,0 +1,228 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __SLJOY_H__
+#define __SLJOY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \file
+ * \brief C interface to the joystick core (libsljoy), for code outside Matlab: Simulink
+ *  Coder targets, command line tools and other processes. It doesn't depend on mex.h or
+ *  simstruc.h, and polls through the same paths as the S-function.
+ *
+ * A handle opens one joystick, or a group of them whose values are laid out one device
+ * after another (see JoystickGroup). Every function returns SLJOY_OK or a negative
+ * error code, and no C++ exception crosses the interface. A handle must only be used
+ * by one thread at a time.
+ *
+ * The static library (libsljoy.a) also needs -framework IOKit -framework
+ * CoreFoundation and the C++ runtime.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Version of this interface. Functions are only ever added, and structures only
+ *  grow at their end, so a program built against an older version keeps working.
+ */
+#define SLJOY_ABI_VERSION 1
+
+/**
+ * \brief Status codes.
+ */
+#define SLJOY_OK 0
+/* A NULL handle or buffer, or a buffer too short for the layout */
+#define SLJOY_ERR_ARGUMENT -1
+/* The joystick (or capture file) isn't available */
+#define SLJOY_ERR_NOT_FOUND -2
+/* A read or write failed, most likely because a joystick was removed */
+#define SLJOY_ERR_IO -3
+/* Out of memory */
+#define SLJOY_ERR_MEMORY -4
+/* The handle's acquisition mode doesn't support the call */
+#define SLJOY_ERR_UNSUPPORTED -5
+/* Any other failure */
+#define SLJOY_ERR_INTERNAL -6
+
+/**
+ * \brief How the element values are acquired.
+ */
+/* Element callbacks on a background thread, so a poll only copies the latest values */
+#define SLJOY_MODE_EVENTS 0
+/* Each element is read from the device at each poll */
+#define SLJOY_MODE_POLLED 1
+/* Read from the acquisition daemon (sljoyd) through shared memory, without outputs */
+#define SLJOY_MODE_SHARED 2
+
+/**
+ * \brief Longest device name, including the terminating NUL. Longer names are cut.
+ */
+#define SLJOY_NAME_MAX 128
+
+/**
+ * \brief Opaque handle to an open joystick or group of joysticks.
+ */
+typedef struct SLJoy SLJoy;
+
+/**
+ * \brief An attached device.
+ */
+typedef struct SLJoyDevice
+{
+  int32_t location;
+  char name[ SLJOY_NAME_MAX ];
+} SLJoyDevice;
+
+/**
+ * \brief Number of elements of each type, totalled over the group. Set size to
+ *  sizeof(SLJoyLayout) before calling sljoy_layout.
+ */
+typedef struct SLJoyLayout
+{
+  uint32_t size;
+  uint32_t numJoysticks;
+  uint32_t numAxes;
+  uint32_t numButtons;
+  uint32_t numPOVs;
+  uint32_t numOutputs;
+} SLJoyLayout;
+
+/**
+ * \brief Version of the interface the library implements (SLJOY_ABI_VERSION).
+ */
+int32_t sljoy_version( void );
+
+/**
+ * \brief Description of a status code, which is never NULL.
+ */
+const char *sljoy_status_string( int32_t status );
+
+/**
+ * \brief List the attached devices: the daemon's when it is running, otherwise the
+ *  devices found by the library.
+ *
+ * \param[out] devices Buffer for the devices (may be NULL if len is 0).
+ * \param[in] len Length of devices. At most len devices are written.
+ * \param[out] count Number of attached devices, which may be more than len.
+ * \return SLJOY_OK or an error code.
+ */
+int32_t sljoy_list( SLJoyDevice *devices, size_t len, size_t *count );
+
+/**
+ * \brief Open a joystick, or a group of joysticks.
+ *
+ * \param[in] locations Locations of the joysticks, from sljoy_list.
+ * \param[in] count Number of joysticks.
+ * \param[in] mode SLJOY_MODE_EVENTS, SLJOY_MODE_POLLED or SLJOY_MODE_SHARED.
+ * \param[out] handle The new handle, or NULL on failure.
+ * \return SLJOY_OK or an error code.
+ */
+int32_t sljoy_open( const int32_t *locations, size_t count, int32_t mode, SLJoy **handle );
+
+/**
+ * \brief Replay capture files (made by the S-function), one per joystick, instead of
+ *  opening devices.
+ *
+ * \param[in] paths Capture file names.
+ * \param[in] count Number of files.
+ * \param[in] speed Multiple of real time to replay at.
+ * \param[out] handle The new handle, or NULL on failure.
+ * \return SLJOY_OK or an error code.
+ */
+int32_t sljoy_open_replay( const char *const *paths, size_t count, double speed, SLJoy **handle );
+
+/**
+ * \brief Close a handle. The joysticks stay open for a while in case they are opened
+ *  again. NULL is ignored.
+ */
+void sljoy_close( SLJoy *handle );
+
+/**
+ * \brief Number of elements of each type.
+ *
+ * \param[in] handle Open handle.
+ * \param[in,out] layout The layout, with size set by the caller. Only the fields that
+ *  fit in size are written.
+ * \return SLJOY_OK or an error code.
+ */
+int32_t sljoy_layout( const SLJoy *handle, SLJoyLayout *layout );
+
+/**
+ * \brief Logical range of an axis, which its raw counts are normalised over.
+ *
+ * \return SLJOY_OK, or SLJOY_ERR_ARGUMENT if there is no such axis.
+ */
+int32_t sljoy_axis_range( const SLJoy *handle, size_t axis, int32_t *logmin, int32_t *logmax );
+
+/**
+ * \brief Poll every joystick into caller supplied buffers. Does not allocate. A NULL
+ *  buffer skips its type; any other must hold at least the layout's number of elements.
+ *  Each call ends a step for the performance counters (see joystats.hpp).
+ *
+ * \param[in] handle Open handle.
+ * \param[out] axes Normalised axes, in [-1,1].
+ * \param[in] numAxes Length of axes.
+ * \param[out] buttons Button states (0 or 1).
+ * \param[in] numButtons Length of buttons.
+ * \param[out] povs POV angles (degrees, or -1 for nothing pressed).
+ * \param[in] numPOVs Length of povs.
+ * \return SLJOY_OK or an error code.
+ */
+int32_t sljoy_poll( SLJoy *handle, double *axes, size_t numAxes, uint8_t *buttons,
+                    size_t numButtons, double *povs, size_t numPOVs );
+
+/**
+ * \brief Poll the raw axis counts, which skips the normalisation (see sljoy_axis_range).
+ *
+ * \param[in] handle Open handle.
+ * \param[out] counts Raw counts, at least the layout's number of axes.
+ * \param[in] len Length of counts.
+ * \return SLJOY_OK or an error code.
+ */
+int32_t sljoy_poll_counts( SLJoy *handle, int32_t *counts, size_t len );
+
+/**
+ * \brief Push values to the joysticks' outputs (such as force feedback). Only changed
+ *  values are sent.
+ *
+ * \param[in] handle Open handle.
+ * \param[in] outputs Normalised values, at least the layout's number of outputs.
+ * \param[in] len Length of outputs.
+ * \return SLJOY_OK or an error code. SLJOY_MODE_SHARED handles have no outputs.
+ */
+int32_t sljoy_push( SLJoy *handle, const double *outputs, size_t len );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
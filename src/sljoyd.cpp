@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * sljoyd: the joystick acquisition daemon. It opens every attached joystick and
+ * publishes its state in shared memory (see joyshm.hpp), so that any number of
+ * Simulink models and Matlab sessions can read the joysticks without opening them.
+ *
+ * Usage: sljoyd [-e]
+ *   -e  Acquire with value callbacks (kJoystick_EventDriven) rather than whole input
+ *       reports (kJoystick_RawReports).
+ *
+ * The segment name is JOY_SHM_NAME, unless SLJOYSTICK_SHM is set. The daemon runs until
+ * it is interrupted or terminated, and then removes the segment.
+ */
+
+#include "joydaemon.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+// Interval between refreshes (microseconds), well inside JOY_SHM_TIMEOUT_MS
+#define SLJOYD_REFRESH_US 100000
+
+static volatile sig_atomic_t running = 1;
+
+/**
+ * \brief Ask the main loop to stop.
+ */
+static void StopRunning( int signum )
+{
+  (void)signum;
+  running = 0;
+}
+
+int main( int argc, char *argv[] )
+{
+  JoystickAcquisition mode = kJoystick_RawReports;
+  for( int ii=1; ii<argc; ii++ )
+  {
+    if( strcmp( argv[ ii ], "-e" ) == 0 ) mode = kJoystick_EventDriven;
+    else
+    {
+      fprintf( stderr, "Usage: %s [-e]\n", argv[ 0 ] );
+      return 2;
+    }
+  }
+  
+  signal( SIGINT, StopRunning );
+  signal( SIGTERM, StopRunning );
+  signal( SIGHUP, StopRunning );
+  
+  JoyDaemon daemon;
+  if( !daemon.Start( JoyShmName(), mode ) )
+  {
+    fprintf( stderr, "%s: Unable to publish %s (is another daemon running?).\n", argv[ 0 ],
+             JoyShmName() );
+    return 1;
+  }
+  size_t published = daemon.Size();
+  printf( "%s: Publishing %lu joysticks in %s.\n", argv[ 0 ], (unsigned long)published,
+          JoyShmName() );
+  fflush( stdout );
+  while( running )
+  {
+    daemon.Refresh();
+    if( daemon.Size() != published )
+    {
+      published = daemon.Size();
+      printf( "%s: Publishing %lu joysticks.\n", argv[ 0 ], (unsigned long)published );
+      fflush( stdout );
+    }
+    usleep( SLJOYD_REFRESH_US );
+  }
+  daemon.Stop();
+  return 0;
+}
@@ -0,0 +1,517 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "snapshot.hpp"
+#include "buttonmask.hpp"
+#include "samplering.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+
+// Number of int32_t values per cache line. Each element type starts on a new line.
+#define VALUES_PER_LINE ( JOY_CACHE_LINE/sizeof(int32_t) )
+
+/**
+ * \brief JoySnapshot constructor. The snapshot is empty until Resize is called.
+ */
+JoySnapshot::JoySnapshot()
+{
+  void *mem = NULL;
+  if( posix_memalign( &mem, JOY_CACHE_LINE, sizeof(Sequence) ) != 0 )
+  {
+    throw "Unable to allocate the joystick snapshot";
+  }
+  myOwnSequence = (Sequence *)mem;
+  myOwnSequence->value = 0;
+  mySequence = myOwnSequence;
+  myPlaced = false;
+  myValues = NULL;
+  myTimes = NULL;
+  myButtonMask = NULL;
+  myEdges = NULL;
+  myRelative = NULL;
+  myWriterCheck = NULL;
+  myWriterContext = NULL;
+  for( size_t ii=0; ii<3; ii++ )
+  {
+    myOffset[ ii ] = 0;
+    myCount[ ii ] = 0;
+  }
+}
+
+/**
+ * \brief JoySnapshot destructor.
+ */
+JoySnapshot::~JoySnapshot()
+{
+  Release();
+  free( myOwnSequence );
+  myOwnSequence = NULL;
+  mySequence = NULL;
+}
+
+/**
+ * \brief Allocate storage for the given number of elements, and zero it.
+ *
+ * Must not be called while a writer or reader is active.
+ *
+ * \param[in] numAxes Number of axes.
+ * \param[in] numButtons Number of buttons.
+ * \param[in] numPOVs Number of POV hats.
+ */
+void JoySnapshot::Resize( size_t numAxes, size_t numButtons, size_t numPOVs )
+{
+  Release();
+  mySequence = myOwnSequence;
+  
+  myCount[ kJoystick_Axes ] = numAxes;
+  myCount[ kJoystick_Buttons ] = numButtons;
+  myCount[ kJoystick_POVs ] = numPOVs;
+  size_t total = Layout( myCount, myOffset );
+  
+  void *mem = NULL;
+  if( posix_memalign( &mem, JOY_CACHE_LINE, total*sizeof(int32_t) ) != 0 )
+  {
+    for( size_t ii=0; ii<3; ii++ ) myCount[ ii ] = 0;
+    throw "Unable to allocate the joystick snapshot";
+  }
+  myValues = (int32_t *)mem;
+  memset( myValues, 0, total*sizeof(int32_t) );
+  
+  size_t numTimes = 1 + numAxes + numButtons + numPOVs;
+  if( posix_memalign( &mem, JOY_CACHE_LINE, numTimes*sizeof(uint64_t) ) != 0 )
+  {
+    for( size_t ii=0; ii<3; ii++ ) myCount[ ii ] = 0;
+    free( myValues );
+    myValues = NULL;
+    throw "Unable to allocate the joystick snapshot";
+  }
+  myTimes = (uint64_t *)mem;
+  memset( myTimes, 0, numTimes*sizeof(uint64_t) );
+  myButtonMask = (uint64_t *)( myValues + myOffset[ kJoystick_Buttons ] );
+  mySequence->value = 0;
+}
+
+/**
+ * \brief Bytes of storage Place needs for the given number of elements.
+ *
+ * \param[in] numAxes Number of axes.
+ * \param[in] numButtons Number of buttons.
+ * \param[in] numPOVs Number of POV hats.
+ */
+size_t JoySnapshot::StorageSize( size_t numAxes, size_t numButtons, size_t numPOVs )
+{
+  size_t count[3], offset[3];
+  count[ kJoystick_Axes ] = numAxes;
+  count[ kJoystick_Buttons ] = numButtons;
+  count[ kJoystick_POVs ] = numPOVs;
+  // The sequence counter, then the values, then the time stamps
+  return sizeof(Sequence) + Layout( count, offset )*sizeof(int32_t)
+       + ( 1 + numAxes + numButtons + numPOVs )*sizeof(uint64_t);
+}
+
+/**
+ * \brief Keep the snapshot (including its sequence counter) in caller supplied
+ *  memory rather than allocating it, so that it can be shared between processes
+ *  (see joyshm.hpp). The snapshot never frees that memory.
+ *
+ * Must not be called while a writer or reader is active.
+ *
+ * \param[in] storage Cache line aligned memory, at least StorageSize bytes long.
+ * \param[in] numAxes Number of axes.
+ * \param[in] numButtons Number of buttons.
+ * \param[in] numPOVs Number of POV hats.
+ * \param[in] initialise Zero the storage. Only the writer should do this; readers
+ *  attach to storage the writer has already initialised, and may map it read-only.
+ */
+void JoySnapshot::Place( void *storage, size_t numAxes, size_t numButtons, size_t numPOVs,
+                         bool initialise )
+{
+  Release();
+  
+  myCount[ kJoystick_Axes ] = numAxes;
+  myCount[ kJoystick_Buttons ] = numButtons;
+  myCount[ kJoystick_POVs ] = numPOVs;
+  size_t total = Layout( myCount, myOffset );
+  
+  char *base = (char *)storage;
+  mySequence = (Sequence *)base;
+  myValues = (int32_t *)( base + sizeof(Sequence) );
+  myTimes = (uint64_t *)( base + sizeof(Sequence) + total*sizeof(int32_t) );
+  myButtonMask = (uint64_t *)( myValues + myOffset[ kJoystick_Buttons ] );
+  myPlaced = true;
+  if( initialise ) memset( storage, 0, StorageSize( numAxes, numButtons, numPOVs ) );
+}
+
+/**
+ * \brief Work out the offset of each element type's block of values, and return the
+ *  total number of int32_t values (a whole number of cache lines).
+ */
+size_t JoySnapshot::Layout( const size_t count[3], size_t offset[3] )
+{
+  // Round each block up to a whole number of cache lines. Offsets are in int32_t units;
+  // the button block holds the packed mask.
+  size_t blockSize[3];
+  blockSize[ kJoystick_Axes ] = count[ kJoystick_Axes ];
+  blockSize[ kJoystick_Buttons ] = ButtonMaskWords( count[ kJoystick_Buttons ] )*2;
+  blockSize[ kJoystick_POVs ] = count[ kJoystick_POVs ];
+  size_t total = 0;
+  for( size_t ii=0; ii<3; ii++ )
+  {
+    offset[ ii ] = total;
+    total += ( (blockSize[ ii ] + VALUES_PER_LINE - 1)/VALUES_PER_LINE )*VALUES_PER_LINE;
+  }
+  if( total == 0 ) total = VALUES_PER_LINE;
+  return total;
+}
+
+/**
+ * \brief Free the value and time stamp storage if the snapshot owns it.
+ */
+void JoySnapshot::Release( void )
+{
+  if( !myPlaced )
+  {
+    free( myValues );
+    free( myTimes );
+  }
+  myValues = NULL;
+  myTimes = NULL;
+  myButtonMask = NULL;
+  myPlaced = false;
+  myEdges = NULL;
+  free( myRelative );
+  myRelative = NULL;
+  myWriterCheck = NULL;
+  myWriterContext = NULL;
+}
+
+/**
+ * \brief Number of elements of the given type.
+ *
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ */
+size_t JoySnapshot::Count( JoystickIOIndex type ) const
+{
+  if( type > kJoystick_POVs ) return 0;
+  return myCount[ type ];
+}
+
+/**
+ * \brief Whether the snapshot has its own storage (from Resize) for exactly these
+ *  numbers of elements, so that it can be written again in place rather than
+ *  reallocated under its readers.
+ *
+ * \param[in] numAxes Number of axes.
+ * \param[in] numButtons Number of buttons.
+ * \param[in] numPOVs Number of POV hats.
+ */
+bool JoySnapshot::Holds( size_t numAxes, size_t numButtons, size_t numPOVs ) const
+{
+  return myValues != NULL && !myPlaced && myCount[ kJoystick_Axes ] == numAxes &&
+         myCount[ kJoystick_Buttons ] == numButtons && myCount[ kJoystick_POVs ] == numPOVs;
+}
+
+/**
+ * \brief Write a single raw element value into the snapshot (writer only).
+ *
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ * \param[in] index Index of the element within its type.
+ * \param[in] value Raw (integer) element value.
+ */
+void JoySnapshot::Write( JoystickIOIndex type, size_t index, int32_t value, uint64_t time )
+{
+  BeginWrite();
+  Store( type, index, value, time );
+  EndWrite();
+}
+
+/**
+ * \brief Queue every button press and release into a ring, as a sample of two values
+ *  (the button index, then 1 for a press or 0 for a release) stamped with the time of
+ *  the change. Stores that leave a button unchanged queue nothing. Resize and Place
+ *  detach the ring.
+ *
+ * The ring may be attached or detached while the writer runs, but not from another
+ *  reader at the same time. Once this returns, the writer has finished any store into
+ *  the previous ring, which may then be emptied or resized.
+ *
+ * \param[in] ring Ring with a stride of at least 2, or NULL to stop queueing.
+ */
+void JoySnapshot::SetEdgeRing( SampleRing *ring )
+{
+  __sync_synchronize();
+  myEdges = ring;
+  __sync_synchronize();
+  // A write in progress may have loaded the previous ring, so wait for it to finish.
+  // Stores are only ever made between BeginWrite and EndWrite.
+  uint32_t sequence = mySequence->value;
+  if( sequence & 1 )
+  {
+    while( mySequence->value == sequence ) sched_yield();
+  }
+}
+
+/**
+ * \brief Mark an axis as relative, so that its values are summed into a counter
+ *  rather than overwriting each other. Resize and Place make every axis absolute
+ *  again, and the writer must not be active.
+ *
+ * \param[in] index Index of the axis.
+ * \param[in] relative Whether the axis is relative.
+ */
+void JoySnapshot::SetRelative( size_t index, bool relative )
+{
+  if( index >= myCount[ kJoystick_Axes ] ) return;
+  if( myRelative == NULL )
+  {
+    if( !relative ) return;
+    myRelative = (uint64_t *)calloc( ButtonMaskWords( myCount[ kJoystick_Axes ] ), sizeof(uint64_t) );
+    if( myRelative == NULL ) throw "Unable to allocate the relative axis mask";
+  }
+  SetButtonMaskBit( myRelative, index, relative );
+}
+
+/**
+ * \brief Have readers check that the writer is still running whenever a write has
+ *  been in progress for JOY_SNAPSHOT_SPINS tries, and throw rather than wait for a
+ *  writer that has gone (such as a daemon killed in the middle of a write). Resize
+ *  and Place remove the check. Must not be called while a reader is active.
+ *
+ * \param[in] check Function returning whether the writer is running, or NULL.
+ * \param[in] context Argument passed to check.
+ */
+void JoySnapshot::SetWriterCheck( WriterCheck check, const void *context )
+{
+  myWriterCheck = check;
+  myWriterContext = context;
+}
+
+/**
+ * \brief Start a batch of writes (writer only). Readers will retry until EndWrite.
+ */
+void JoySnapshot::BeginWrite( void )
+{
+  // An odd sequence number tells readers a write is in progress
+  mySequence->value = mySequence->value + 1;
+  __sync_synchronize();
+}
+
+/**
+ * \brief Store a raw value without touching the sequence counter. Must be bracketed
+ *  by BeginWrite and EndWrite.
+ */
+void JoySnapshot::Store( JoystickIOIndex type, size_t index, int32_t value, uint64_t time )
+{
+  if( type > kJoystick_POVs || index >= myCount[ type ] ) return;
+  if( type == kJoystick_Buttons )
+  {
+    bool pressed = value != 0;
+    SampleRing *edges = myEdges;
+    if( edges != NULL && GetButtonMaskBit( myButtonMask, index ) != pressed )
+    {
+      const int32_t edge[ 2 ] = { (int32_t)index, pressed ? 1 : 0 };
+      edges->Push( time, edge );
+    }
+    SetButtonMaskBit( myButtonMask, index, pressed );
+  }
+  else if( myRelative != NULL && type == kJoystick_Axes && GetButtonMaskBit( myRelative, index ) )
+  {
+    // Wrap around rather than overflow
+    int32_t &counter = myValues[ myOffset[ type ] + index ];
+    counter = (int32_t)( (uint32_t)counter + (uint32_t)value );
+  }
+  else myValues[ myOffset[ type ] + index ] = value;
+  myTimes[ TimeOffset( type ) + index ] = time;
+  if( time > myTimes[ 0 ] ) myTimes[ 0 ] = time;
+}
+
+/**
+ * \brief Finish a batch of writes (writer only).
+ */
+void JoySnapshot::EndWrite( void )
+{
+  __sync_synchronize();
+  mySequence->value = mySequence->value + 1;
+}
+
+/**
+ * \brief Copy a consistent set of raw values of the given type.
+ *
+ * \param[in] type One of kJoystick_Axes or kJoystick_POVs.
+ * \param[out] dest Destination buffer, at least Count(type) long.
+ */
+void JoySnapshot::Read( JoystickIOIndex type, int32_t *dest ) const
+{
+  if( type > kJoystick_POVs || type == kJoystick_Buttons || myCount[ type ] == 0 ) return;
+  ReadRegion( myValues + myOffset[ type ], dest, myCount[ type ]*sizeof(int32_t) );
+}
+
+/**
+ * \brief Copy a consistent packed mask of the button states.
+ *
+ * \param[out] dest Destination buffer, at least ButtonMaskWords(Count(kJoystick_Buttons))
+ *  words long.
+ */
+void JoySnapshot::ReadButtonMask( uint64_t *dest ) const
+{
+  if( myCount[ kJoystick_Buttons ] == 0 ) return;
+  ReadRegion( myButtonMask, dest,
+              ButtonMaskWords( myCount[ kJoystick_Buttons ] )*sizeof(uint64_t) );
+}
+
+/**
+ * \brief Copy a consistent set of time stamps of the given type.
+ *
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ * \param[out] dest Destination buffer, at least Count(type) long.
+ */
+void JoySnapshot::ReadTimes( JoystickIOIndex type, uint64_t *dest ) const
+{
+  if( type > kJoystick_POVs || myCount[ type ] == 0 ) return;
+  ReadRegion( myTimes + TimeOffset( type ), dest, myCount[ type ]*sizeof(uint64_t) );
+}
+
+/**
+ * \brief Time stamp of the newest value of any element, or 0 if nothing has been
+ *  written yet.
+ */
+uint64_t JoySnapshot::NewestTime( void ) const
+{
+  uint64_t time = 0;
+  // A 64-bit load is not atomic on the 32-bit build, so go through the sequence
+  if( myTimes != NULL ) ReadRegion( myTimes, &time, sizeof(uint64_t) );
+  return time;
+}
+
+/**
+ * \brief Offset of the first time stamp of the given type in myTimes.
+ */
+size_t JoySnapshot::TimeOffset( JoystickIOIndex type ) const
+{
+  size_t offset = 1;
+  for( size_t ii=0; ii<(size_t)type; ii++ ) offset += myCount[ ii ];
+  return offset;
+}
+
+/**
+ * \brief Number of int32_t values in a packed copy of the snapshot.
+ */
+size_t JoySnapshot::PackedSize( void ) const
+{
+  return PackedOffset( kJoystick_POVs ) + myCount[ kJoystick_POVs ];
+}
+
+/**
+ * \brief Offset (in int32_t values) of the given type within a packed copy. The
+ *  button mask comes first, so that it keeps its 64-bit alignment.
+ *
+ * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+ */
+size_t JoySnapshot::PackedOffset( JoystickIOIndex type ) const
+{
+  size_t maskSize = ButtonMaskWords( myCount[ kJoystick_Buttons ] )*2;
+  switch( type )
+  {
+    case kJoystick_Buttons: return 0;
+    case kJoystick_Axes: return maskSize;
+    default: return maskSize + myCount[ kJoystick_Axes ];
+  }
+}
+
+/**
+ * \brief Copy every value into a packed buffer (writer only, so no retry is needed).
+ *
+ * \param[out] dest Destination buffer, at least PackedSize() long.
+ */
+void JoySnapshot::CopyPacked( int32_t *dest ) const
+{
+  if( myValues == NULL ) return;
+  size_t maskSize = ButtonMaskWords( myCount[ kJoystick_Buttons ] )*2;
+  memcpy( dest, myButtonMask, maskSize*sizeof(int32_t) );
+  memcpy( dest + maskSize, myValues + myOffset[ kJoystick_Axes ],
+          myCount[ kJoystick_Axes ]*sizeof(int32_t) );
+  memcpy( dest + maskSize + myCount[ kJoystick_Axes ], myValues + myOffset[ kJoystick_POVs ],
+          myCount[ kJoystick_POVs ]*sizeof(int32_t) );
+}
+
+/**
+ * \brief Copy a consistent set of every value into a packed buffer.
+ *
+ * \param[out] dest Destination buffer, at least PackedSize() long.
+ */
+void JoySnapshot::ReadPacked( int32_t *dest ) const
+{
+  if( myValues == NULL ) return;
+  uint32_t before, after;
+  do
+  {
+    before = WaitForWriter();
+    __sync_synchronize();
+    CopyPacked( dest );
+    __sync_synchronize();
+    after = mySequence->value;
+  } while( before != after );
+}
+
+/**
+ * \brief Seqlock read of an arbitrary region of the snapshot.
+ */
+void JoySnapshot::ReadRegion( const void *src, void *dest, size_t bytes ) const
+{
+  uint32_t before, after;
+  do
+  {
+    before = WaitForWriter();
+    __sync_synchronize();
+    memcpy( dest, src, bytes );
+    __sync_synchronize();
+    after = mySequence->value;
+  } while( before != after );
+}
+
+/**
+ * \brief Wait for any write in progress to finish, and return the (even) sequence
+ *  number. Throws if the writer check finds the writer gone.
+ */
+uint32_t JoySnapshot::WaitForWriter( void ) const
+{
+  uint32_t sequence;
+  unsigned int spins = 0;
+  while( (sequence = mySequence->value) & 1 )
+  {
+    if( ++spins < JOY_SNAPSHOT_SPINS ) continue;
+    // A write only takes a moment, so the writer has been descheduled, or has gone
+    spins = 0;
+    if( myWriterCheck != NULL && !myWriterCheck( myWriterContext ) )
+    {
+      throw "Error reading joystick: its writer has stopped";
+    }
+    sched_yield();
+  }
+  return sequence;
+}
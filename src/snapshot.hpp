@@ -0,0 +1,328 @@
+/*
+Copyright (c) 2012, Zebb Prime and The University of Adelaide
+All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the organization nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ZEBB PRIME OR THE UNIVERSITY OF ADELAIDE BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * \brief Size of a cache line. Used to keep the sequence counter and the element values
+ *  from sharing a line with anything else.
+ */
+#define JOY_CACHE_LINE 64
+
+/**
+ * \brief Number of times a reader retries a write in progress before it yields, and
+ *  checks that the writer is still running (see JoySnapshot::SetWriterCheck).
+ */
+#define JOY_SNAPSHOT_SPINS 1024
+
+class SampleRing;
+
+/**
+ * \brief Enumerated indices for the QueryIO vector.
+ */
+enum JoystickIOIndex {
+  kJoystick_Axes = 0,
+  kJoystick_Buttons,
+  kJoystick_POVs,
+  kJoystick_Outputs
+};
+
+/**
+ * \brief Seqlock protected snapshot of the raw element values of a joystick.
+ *
+ * There must only ever be one writer (the acquisition thread), but there may be any
+ * number of readers. Readers never block the writer; instead they retry the copy if the
+ * writer modified the snapshot while it was being read.
+ *
+ * Axes and POVs are stored as one int32_t each. Buttons are stored as a packed mask of
+ * 64-bit words (see buttonmask.hpp). Every element also has the time stamp (ticks, see
+ * joytime.hpp) of its latest value.
+ *
+ * The writer can also queue every button press and release into a ring (see
+ * SetEdgeRing), so that taps shorter than a reader's poll interval aren't lost.
+ *
+ * Relative axes (see SetRelative) report changes rather than positions. Their values
+ * are summed as they are written, into a counter that wraps around, so that no change
+ * is lost however seldom the snapshot is read. Readers take the difference of two
+ * counters (modulo 2^32) to get the change between them.
+ */
+class JoySnapshot
+{
+  public:
+    /**
+     * \brief Check of whether the writer of a snapshot is still running.
+     */
+    typedef bool (*WriterCheck)( const void *context );
+    
+    /**
+     * \brief JoySnapshot constructor. The snapshot is empty until Resize is called.
+     */
+    JoySnapshot();
+    
+    /**
+     * \brief JoySnapshot destructor.
+     */
+    ~JoySnapshot();
+    
+    /**
+     * \brief Allocate storage for the given number of elements, and zero it.
+     *
+     * Must not be called while a writer or reader is active.
+     *
+     * \param[in] numAxes Number of axes.
+     * \param[in] numButtons Number of buttons.
+     * \param[in] numPOVs Number of POV hats.
+     */
+    void Resize( size_t numAxes, size_t numButtons, size_t numPOVs );
+    
+    /**
+     * \brief Bytes of storage Place needs for the given number of elements.
+     *
+     * \param[in] numAxes Number of axes.
+     * \param[in] numButtons Number of buttons.
+     * \param[in] numPOVs Number of POV hats.
+     */
+    static size_t StorageSize( size_t numAxes, size_t numButtons, size_t numPOVs );
+    
+    /**
+     * \brief Keep the snapshot (including its sequence counter) in caller supplied
+     *  memory rather than allocating it, so that it can be shared between processes
+     *  (see joyshm.hpp). The snapshot never frees that memory.
+     *
+     * Must not be called while a writer or reader is active.
+     *
+     * \param[in] storage Cache line aligned memory, at least StorageSize bytes long.
+     * \param[in] numAxes Number of axes.
+     * \param[in] numButtons Number of buttons.
+     * \param[in] numPOVs Number of POV hats.
+     * \param[in] initialise Zero the storage. Only the writer should do this; readers
+     *  attach to storage the writer has already initialised, and may map it read-only.
+     */
+    void Place( void *storage, size_t numAxes, size_t numButtons, size_t numPOVs,
+                bool initialise );
+    
+    /**
+     * \brief Number of elements of the given type.
+     *
+     * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+     */
+    size_t Count( JoystickIOIndex type ) const;
+    
+    /**
+     * \brief Whether the snapshot has its own storage (from Resize) for exactly these
+     *  numbers of elements, so that it can be written again in place rather than
+     *  reallocated under its readers.
+     *
+     * \param[in] numAxes Number of axes.
+     * \param[in] numButtons Number of buttons.
+     * \param[in] numPOVs Number of POV hats.
+     */
+    bool Holds( size_t numAxes, size_t numButtons, size_t numPOVs ) const;
+    
+    /**
+     * \brief Write a single raw element value into the snapshot (writer only).
+     *
+     * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+     * \param[in] index Index of the element within its type.
+     * \param[in] value Raw (integer) element value.
+     * \param[in] time Time stamp of the value.
+     */
+    void Write( JoystickIOIndex type, size_t index, int32_t value, uint64_t time );
+    
+    /**
+     * \brief Queue every button press and release into a ring, as a sample of two values
+     *  (the button index, then 1 for a press or 0 for a release) stamped with the time of
+     *  the change. Stores that leave a button unchanged queue nothing. Resize and Place
+     *  detach the ring.
+     *
+     * The ring may be attached or detached while the writer runs, but not from another
+     *  reader at the same time. Once this returns, the writer has finished any store
+     *  into the previous ring, which may then be emptied or resized.
+     *
+     * \param[in] ring Ring with a stride of at least 2, or NULL to stop queueing.
+     */
+    void SetEdgeRing( SampleRing *ring );
+    
+    /**
+     * \brief Mark an axis as relative, so that its values are summed into a counter
+     *  rather than overwriting each other. Resize and Place make every axis absolute
+     *  again, and the writer must not be active.
+     *
+     * \param[in] index Index of the axis.
+     * \param[in] relative Whether the axis is relative.
+     */
+    void SetRelative( size_t index, bool relative );
+    
+    /**
+     * \brief Have readers check that the writer is still running whenever a write has
+     *  been in progress for JOY_SNAPSHOT_SPINS tries, and throw rather than wait for a
+     *  writer that has gone (such as a daemon killed in the middle of a write). Resize
+     *  and Place remove the check. Must not be called while a reader is active.
+     *
+     * \param[in] check Function returning whether the writer is running, or NULL.
+     * \param[in] context Argument passed to check.
+     */
+    void SetWriterCheck( WriterCheck check, const void *context );
+    
+    /**
+     * \brief Start a batch of writes (writer only). Readers will retry until EndWrite.
+     */
+    void BeginWrite( void );
+    
+    /**
+     * \brief Store a raw value without touching the sequence counter. Must be bracketed
+     *  by BeginWrite and EndWrite.
+     */
+    void Store( JoystickIOIndex type, size_t index, int32_t value, uint64_t time );
+    
+    /**
+     * \brief Finish a batch of writes (writer only).
+     */
+    void EndWrite( void );
+    
+    /**
+     * \brief Copy a consistent set of raw values of the given type.
+     *
+     * \param[in] type One of kJoystick_Axes or kJoystick_POVs.
+     * \param[out] dest Destination buffer, at least Count(type) long.
+     */
+    void Read( JoystickIOIndex type, int32_t *dest ) const;
+    
+    /**
+     * \brief Copy a consistent packed mask of the button states.
+     *
+     * \param[out] dest Destination buffer, at least ButtonMaskWords(Count(kJoystick_Buttons))
+     *  words long.
+     */
+    void ReadButtonMask( uint64_t *dest ) const;
+    
+    /**
+     * \brief Copy a consistent set of time stamps of the given type.
+     *
+     * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+     * \param[out] dest Destination buffer, at least Count(type) long.
+     */
+    void ReadTimes( JoystickIOIndex type, uint64_t *dest ) const;
+    
+    /**
+     * \brief Time stamp of the newest value of any element, or 0 if nothing has been
+     *  written yet.
+     */
+    uint64_t NewestTime( void ) const;
+    
+    /**
+     * \brief Number of int32_t values in a packed copy of the snapshot.
+     */
+    size_t PackedSize( void ) const;
+    
+    /**
+     * \brief Offset (in int32_t values) of the given type within a packed copy. The
+     *  button mask comes first, so that it keeps its 64-bit alignment.
+     *
+     * \param[in] type One of kJoystick_Axes, kJoystick_Buttons or kJoystick_POVs.
+     */
+    size_t PackedOffset( JoystickIOIndex type ) const;
+    
+    /**
+     * \brief Copy every value into a packed buffer (writer only, so no retry is needed).
+     *
+     * \param[out] dest Destination buffer, at least PackedSize() long.
+     */
+    void CopyPacked( int32_t *dest ) const;
+    
+    /**
+     * \brief Copy a consistent set of every value into a packed buffer.
+     *
+     * \param[out] dest Destination buffer, at least PackedSize() long.
+     */
+    void ReadPacked( int32_t *dest ) const;
+    
+  private:
+    // The sequence counter gets a cache line to itself so that the writer bumping it
+    // doesn't invalidate the line holding the readers' data (and vice versa). It is
+    // allocated separately, as operator new doesn't honour over-aligned members.
+    struct Sequence
+    {
+      volatile uint32_t value;
+      char pad[ JOY_CACHE_LINE - sizeof(uint32_t) ];
+    };
+    
+    Sequence *mySequence;
+    // The snapshot's own sequence counter, used unless it has been placed
+    Sequence *myOwnSequence;
+    int32_t *myValues;
+    // The newest time stamp, followed by each element's time stamp
+    uint64_t *myTimes;
+    uint64_t *myButtonMask;
+    size_t myOffset[3], myCount[3];
+    // myValues and myTimes belong to someone else (see Place)
+    bool myPlaced;
+    // Ring the button edges are queued into, or NULL
+    SampleRing *volatile myEdges;
+    // Packed mask of the relative axes (see buttonmask.hpp), or NULL if there are none
+    uint64_t *myRelative;
+    // Check of whether the writer is still running (see SetWriterCheck), or NULL
+    WriterCheck myWriterCheck;
+    const void *myWriterContext;
+    
+    /**
+     * \brief Work out the offset of each element type's block of values, and return the
+     *  total number of int32_t values (a whole number of cache lines).
+     */
+    static size_t Layout( const size_t count[3], size_t offset[3] );
+    
+    /**
+     * \brief Free the value and time stamp storage if the snapshot owns it.
+     */
+    void Release( void );
+    
+    /**
+     * \brief Offset of the first time stamp of the given type in myTimes.
+     */
+    size_t TimeOffset( JoystickIOIndex type ) const;
+    
+    /**
+     * \brief Seqlock read of an arbitrary region of the snapshot.
+     */
+    void ReadRegion( const void *src, void *dest, size_t bytes ) const;
+    
+    /**
+     * \brief Wait for any write in progress to finish, and return the (even) sequence
+     *  number. Throws if the writer check finds the writer gone.
+     */
+    uint32_t WaitForWriter( void ) const;
+    
+    // Non-copyable
+    JoySnapshot( const JoySnapshot & );
+    JoySnapshot &operator=( const JoySnapshot & );
+};
+
+#endif